@@ -48,6 +48,19 @@ bool CommandLineArguments::ParseArguments( QStringList & args )
         }
         else if( arg == "-v" )
             m_viewerOnly = true;
+        else if( arg == "-p" )
+        {
+            if( args.size() > i + 1 && !args[i + 1].startsWith( '-' ) )
+            {
+                m_acquisitionsToPack.push_back( args[i + 1] );
+                ++i;
+            }
+            else
+            {
+                std::cerr << "Error: expecting acquisition directory after -p option" << std::endl;
+                return false;
+            }
+        }
         else
             m_loadFileNames.push_back( arg );
     }
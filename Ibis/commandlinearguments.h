@@ -25,6 +25,8 @@ public:
     bool GetLoadConfigFile() { return m_loadConfigFile; }
     QString GetConfigFile() { return m_configFile; }
     QStringList GetDataFilesToLoad() { return m_loadFileNames; }
+    // Acquisition directories of MINC frames to convert to packed files, Ibis exits after converting them
+    QStringList GetAcquisitionsToPack() { return m_acquisitionsToPack; }
 
 protected:
     bool m_viewerOnly;
@@ -33,6 +35,7 @@ protected:
     bool m_loadConfigFile;
     QString m_configFile;
     QStringList m_loadFileNames;
+    QStringList m_acquisitionsToPack;
 };
 
 #endif
@@ -16,10 +16,12 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QFile>
 #include <QMessageBox>
 #include <QTimer>
+#include <iostream>
 
 #include "application.h"
 #include "commandlinearguments.h"
 #include "mainwindow.h"
+#include "usacquisitionobject.h"
 
 int main( int argc, char ** argv )
 {
@@ -35,16 +37,36 @@ int main( int argc, char ** argv )
     QApplication a( argc, argv );
     Q_INIT_RESOURCE( IbisLib );
 
-    // Warning : IBIS IS NOT APPROVED FOR CLINICAL USE.
-    if( !QFile::exists( QDir::homePath() + QString( "/.ibis/no-clinical-warning.txt" ) ) )
-        QMessageBox::warning( nullptr, "WARNING!", QString( "The Ibis platform is not approved for clinical use." ) );
-
-    // On Mac, we always do Viewer-mode only without command-line params for now
     // Parse command-line arguments
     CommandLineArguments cmdArgs;
     QStringList args = a.arguments();
     cmdArgs.ParseArguments( args );
 
+    // Convert acquisition directories to packed files without starting the GUI
+    if( !cmdArgs.GetAcquisitionsToPack().isEmpty() )
+    {
+        Application::CreateInstance( true );
+        int ret = 0;
+        foreach( QString dir, cmdArgs.GetAcquisitionsToPack() )
+        {
+            QString packedFileName = USAcquisitionObject::PackMINCDirectory( dir );
+            if( packedFileName.isEmpty() )
+            {
+                std::cerr << "Could not pack acquisition " << dir.toUtf8().data() << std::endl;
+                ret = 1;
+            }
+            else
+                std::cout << dir.toUtf8().data() << " -> " << packedFileName.toUtf8().data() << std::endl;
+        }
+        Application::DeleteInstance();
+        return ret;
+    }
+
+    // Warning : IBIS IS NOT APPROVED FOR CLINICAL USE.
+    if( !QFile::exists( QDir::homePath() + QString( "/.ibis/no-clinical-warning.txt" ) ) )
+        QMessageBox::warning( nullptr, "WARNING!", QString( "The Ibis platform is not approved for clinical use." ) );
+
+    // On Mac, we always do Viewer-mode only without command-line params for now
     // Create unique instance of application
     Application::CreateInstance( cmdArgs.GetViewerOnly() );
 
@@ -0,0 +1,106 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "benchmarksuite.h"
+
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+BenchmarkSuite::BenchmarkSuite()
+{
+    m_repetitions      = 5;
+    m_verbose          = false;
+    m_numberOfFailures = 0;
+}
+
+bool BenchmarkSuite::IsEnabled( const QString & name )
+{
+    return !m_filter.isValid() || m_filter.pattern().isEmpty() || m_filter.match( name ).hasMatch();
+}
+
+void BenchmarkSuite::Run( const Case & c )
+{
+    if( !IsEnabled( c.name ) ) return;
+    if( m_verbose ) std::cerr << c.name.toStdString() << "..." << std::flush;
+
+    std::vector<double> times;  // ms per operation
+    try
+    {
+        // The first run warms up the caches and the allocators, it is not recorded
+        for( int i = 0; i <= m_repetitions; ++i )
+        {
+            if( c.setUp ) c.setUp();
+            QElapsedTimer timer;
+            timer.start();
+            c.run();
+            qint64 elapsed = timer.nsecsElapsed();
+            if( c.tearDown ) c.tearDown();
+            if( i > 0 ) times.push_back( elapsed / 1.0e6 / std::max( c.operations, 1 ) );
+        }
+    }
+    catch( std::exception & e )
+    {
+        Skip( c.name, QString( "failed: %1" ).arg( e.what() ) );
+        ++m_numberOfFailures;
+        return;
+    }
+
+    std::vector<double> sorted = times;
+    std::sort( sorted.begin(), sorted.end() );
+    size_t n      = sorted.size();
+    double median = n % 2 ? sorted[n / 2] : 0.5 * ( sorted[n / 2 - 1] + sorted[n / 2] );
+    double mean   = 0.0;
+    for( double t : times ) mean += t;
+    mean /= n;
+    double variance = 0.0;
+    for( double t : times ) variance += ( t - mean ) * ( t - mean );
+    double stdDev = n > 1 ? sqrt( variance / ( n - 1 ) ) : 0.0;
+
+    QJsonArray samples;
+    for( double t : times ) samples.append( t );
+
+    QJsonObject result;
+    result["name"]        = c.name;
+    result["unit"]        = "ms";
+    result["operations"]  = c.operations;
+    result["repetitions"] = int( n );
+    result["min"]         = sorted.front();
+    result["median"]      = median;
+    result["mean"]        = mean;
+    result["max"]         = sorted.back();
+    result["stddev"]      = stdDev;
+    result["samples"]     = samples;
+    if( !c.parameters.isEmpty() ) result["parameters"] = c.parameters;
+    m_results.append( result );
+
+    if( m_verbose ) std::cerr << " " << median << " ms" << std::endl;
+}
+
+void BenchmarkSuite::Skip( const QString & name, const QString & reason )
+{
+    if( !IsEnabled( name ) ) return;
+    if( m_verbose ) std::cerr << name.toStdString() << ": " << reason.toStdString() << std::endl;
+    QJsonObject result;
+    result["name"]    = name;
+    result["skipped"] = reason;
+    m_results.append( result );
+}
+
+QJsonObject BenchmarkSuite::GetReport()
+{
+    QJsonObject report    = m_context;
+    report["repetitions"] = m_repetitions;
+    report["benchmarks"]  = m_results;
+    return report;
+}
@@ -0,0 +1,73 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef BENCHMARKSUITE_H
+#define BENCHMARKSUITE_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QString>
+#include <functional>
+
+/**
+ * @class   BenchmarkSuite
+ * @brief   Time benchmark cases and collect the results in a JSON report
+ *
+ * A case is run Repetitions times, after a warm up run that is not recorded. Setup and TearDown are called around
+ * every run and are not timed. A run may perform several operations, e.g. add 500 frames, the times of the report
+ * are then given per operation so that they don't depend on the size of the synthetic dataset.
+ *
+ * Case names are hierarchical, "Group/Operation/Variant", the filter is matched against the full name.
+ */
+class BenchmarkSuite
+{
+public:
+    struct Case
+    {
+        Case() : operations( 1 ) {}
+        QString name;
+        int operations;  // operations performed by a single call of run
+        QJsonObject parameters;
+        std::function<void()> setUp;
+        std::function<void()> run;
+        std::function<void()> tearDown;
+    };
+
+    BenchmarkSuite();
+
+    void SetRepetitions( int n ) { m_repetitions = n; }
+    int GetRepetitions() { return m_repetitions; }
+    void SetFilter( const QRegularExpression & filter ) { m_filter = filter; }
+    void SetVerbose( bool verbose ) { m_verbose = verbose; }
+
+    /** Return false if the case is excluded by the filter, the datasets it needs don't have to be created. */
+    bool IsEnabled( const QString & name );
+
+    /** Time a case and add it to the report. */
+    void Run( const Case & c );
+    /** Record a case that could not run, with the reason in the report. */
+    void Skip( const QString & name, const QString & reason );
+
+    /** Information on the build and the machine, added at the top of the report. */
+    void SetContext( const QJsonObject & context ) { m_context = context; }
+    QJsonObject GetReport();
+    int GetNumberOfFailures() { return m_numberOfFailures; }
+
+protected:
+    int m_repetitions;
+    QRegularExpression m_filter;
+    bool m_verbose;
+    QJsonObject m_context;
+    QJsonArray m_results;
+    int m_numberOfFailures;
+};
+
+#endif
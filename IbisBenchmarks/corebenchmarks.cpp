@@ -0,0 +1,878 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "corebenchmarks.h"
+
+#include <vtkImageData.h>
+#include <vtkLookupTable.h>
+#include <vtkMatrix4x4.h>
+#include <vtkMultiImagePlaneWidget.h>
+#include <vtkPolyData.h>
+#include <vtkRenderWindow.h>
+#include <vtkRenderer.h>
+#include <vtkSmartPointer.h>
+#include <vtkTransform.h>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QList>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "application.h"
+#include "benchmarksuite.h"
+#include "filereader.h"
+#include "imageobject.h"
+#include "polydataobject.h"
+#include "scenearchive.h"
+#include "scenemanager.h"
+#include "sequencefile.h"
+#include "syntheticdata.h"
+#include "trackedvideobuffer.h"
+#include "usacquisitionobject.h"
+
+#ifdef IBIS_BENCHMARK_VOLUME_RECONSTRUCTION
+#include "itkCPUVolumeReconstruction.h"
+#ifdef HAS_OPENCL
+#include "itkGPUVolumeReconstruction.h"
+#endif
+#endif
+#ifdef IBIS_BENCHMARK_RIGID_REGISTRATION
+#include <itkEuler3DTransform.h>
+#include "itkCPUOrientationMatchingMatrixTransformationSparseMask.h"
+#ifdef HAS_OPENCL
+#include "itkGPUOrientationMatchingMatrixTransformationSparseMask.h"
+#endif
+#endif
+
+namespace
+{
+// Frames of a sweep, a small pool of images is reused for all the poses to keep the memory and the time needed to
+// generate them low, the copies are what is measured anyway.
+struct Sweep
+{
+    std::vector<vtkSmartPointer<vtkImageData> > frames;
+    std::vector<vtkSmartPointer<vtkMatrix4x4> > poses;
+    vtkImageData * GetFrame( int index ) { return frames[index % frames.size()]; }
+};
+
+const int SweepFramePoolSize    = 16;
+const double SweepFramePeriod = 1.0 / 30.0;
+
+void CreateSweep( SyntheticData & data, int nbFrames, int width, int height, int nbPoolFrames, Sweep & sweep )
+{
+    for( int i = 0; i < std::min( nbFrames, nbPoolFrames ); ++i )
+        sweep.frames.push_back( data.CreateUSFrame( i, width, height ) );
+    for( int i = 0; i < nbFrames; ++i )
+    {
+        vtkSmartPointer<vtkMatrix4x4> pose = vtkSmartPointer<vtkMatrix4x4>::New();
+        data.GetSweepPose( i, nbFrames, pose );
+        sweep.poses.push_back( pose );
+    }
+}
+
+void DeleteObjects( QList<SceneObject *> & objects )
+{
+    for( int i = 0; i < objects.size(); ++i ) objects[i]->Delete();
+    objects.clear();
+}
+
+#ifdef IBIS_BENCHMARK_VOLUME_RECONSTRUCTION
+typedef itk::VolumeReconstruction<IbisItkFloat3ImageType> VolumeReconstructionType;
+
+// Reconstruction parameters of the benchmark and of the backend comparison
+const unsigned int ReconstructionSearchRadius = 3;
+const float ReconstructionVolumeSpacing       = 1.0f;
+const float ReconstructionKernelStdDev        = 1.0f;
+
+// Slices of the sweep and a mask that keeps all their pixels, converted once so that only the reconstruction is
+// timed
+struct ReconstructionInput
+{
+    std::vector<IbisItkFloat3ImageType::Pointer> slices;
+    IbisItkFloat3ImageType::Pointer mask;
+};
+
+void CreateReconstructionInput( Sweep & sweep, int width, int height, ReconstructionInput & input )
+{
+    vtkSmartPointer<IbisItkVtkConverter> converter = vtkSmartPointer<IbisItkVtkConverter>::New();
+    for( size_t f = 0; f < sweep.poses.size(); ++f )
+    {
+        IbisItkFloat3ImageType::Pointer slice = IbisItkFloat3ImageType::New();
+        converter->ConvertVtkImageToItkImage( slice, sweep.GetFrame( int( f ) ), sweep.poses[f] );
+        input.slices.push_back( slice );
+    }
+    vtkSmartPointer<vtkImageData> maskImage = vtkSmartPointer<vtkImageData>::New();
+    maskImage->SetDimensions( width, height, 1 );
+    maskImage->AllocateScalars( VTK_FLOAT, 1 );
+    std::fill_n( static_cast<float *>( maskImage->GetScalarPointer() ), width * height, 1.0f );
+    input.mask = IbisItkFloat3ImageType::New();
+    converter->ConvertVtkImageToItkImage( input.mask, maskImage, vtkSmartPointer<vtkMatrix4x4>::New() );
+}
+
+void SetReconstructionInput( VolumeReconstructionType * reconstructor, const ReconstructionInput & input )
+{
+    reconstructor->SetNumberOfSlices( (unsigned int)input.slices.size() );
+    for( size_t f = 0; f < input.slices.size(); ++f ) reconstructor->SetFixedSlice( (unsigned int)f, input.slices[f] );
+    reconstructor->SetFixedSliceMask( input.mask );
+    reconstructor->SetUSSearchRadius( ReconstructionSearchRadius );
+    reconstructor->SetVolumeSpacing( ReconstructionVolumeSpacing );
+    reconstructor->SetKernelStdDev( ReconstructionKernelStdDev );
+    reconstructor->SetTransform( VolumeReconstructionType::TransformType::New() );
+}
+#endif
+}  // namespace
+
+CoreBenchmarks::CoreBenchmarks( BenchmarkSuite & suite, SyntheticData & data, const QString & scratchDirectory )
+    : m_suite( suite ), m_data( data ), m_scratchDirectory( scratchDirectory )
+{
+    SetQuick( false );
+}
+
+void CoreBenchmarks::SetQuick( bool quick )
+{
+    m_volumeSize        = quick ? 64 : 256;
+    m_frameWidth        = quick ? 320 : 640;
+    m_frameHeight       = quick ? 240 : 480;
+    m_numberOfFrames    = quick ? 40 : 300;
+    m_surfaceResolution = quick ? 64 : 256;
+}
+
+QJsonObject CoreBenchmarks::GetDatasetSizes()
+{
+    QJsonObject sizes;
+    sizes["volumeSize"]        = m_volumeSize;
+    sizes["frameWidth"]        = m_frameWidth;
+    sizes["frameHeight"]       = m_frameHeight;
+    sizes["numberOfFrames"]    = m_numberOfFrames;
+    sizes["surfaceResolution"] = m_surfaceResolution;
+    return sizes;
+}
+
+void CoreBenchmarks::RunAll()
+{
+    RunTrackedVideoBuffer();
+    RunUSAcquisition();
+    RunItkVtkConverter();
+    RunFileReader();
+    RunSequenceFile();
+    RunScene();
+    RunReslice();
+    RunVolumeReconstruction();
+    RunVolumeReconstructionBackends();
+    RunRigidRegistration();
+    RunRigidRegistrationBackends();
+}
+
+bool CoreBenchmarks::IsAnyEnabled( const QStringList & names )
+{
+    for( int i = 0; i < names.size(); ++i )
+    {
+        if( m_suite.IsEnabled( names[i] ) ) return true;
+    }
+    return false;
+}
+
+void CoreBenchmarks::RunTrackedVideoBuffer()
+{
+    QStringList names;
+    names << "TrackedVideoBuffer/AddFrame/Dynamic"
+          << "TrackedVideoBuffer/AddFrame/Chunked";
+    if( !IsAnyEnabled( names ) ) return;
+
+    Sweep sweep;
+    CreateSweep( m_data, m_numberOfFrames, m_frameWidth, m_frameHeight, SweepFramePoolSize, sweep );
+
+    std::unique_ptr<TrackedVideoBuffer> buffer;
+    QJsonObject parameters;
+    parameters["width"]  = m_frameWidth;
+    parameters["height"] = m_frameHeight;
+    parameters["frames"] = m_numberOfFrames;
+
+    for( int i = 0; i < names.size(); ++i )
+    {
+        bool reserve = i == 1;
+        BenchmarkSuite::Case c;
+        c.name       = names[i];
+        c.operations = m_numberOfFrames;
+        c.parameters = parameters;
+        c.setUp      = [&, reserve]() {
+            buffer.reset( new TrackedVideoBuffer( m_frameWidth, m_frameHeight ) );
+            if( reserve )
+                buffer->ReserveFrames( m_numberOfFrames, m_frameWidth, m_frameHeight, 1, VTK_UNSIGNED_CHAR,
+                                       TrackedVideoBuffer::ChunkedStorage );
+        };
+        c.run = [&]() {
+            for( int f = 0; f < m_numberOfFrames; ++f )
+                buffer->AddFrame( sweep.GetFrame( f ), sweep.poses[f], f * SweepFramePeriod );
+        };
+        c.tearDown = [&]() { buffer.reset(); };
+        m_suite.Run( c );
+    }
+}
+
+void CoreBenchmarks::RunUSAcquisition()
+{
+    QStringList names;
+    names << "USAcquisition/GetItkImage/Unmasked"
+          << "USAcquisition/GetItkImage/Masked";
+    if( !IsAnyEnabled( names ) ) return;
+
+    Sweep sweep;
+    CreateSweep( m_data, m_numberOfFrames, m_frameWidth, m_frameHeight, SweepFramePoolSize, sweep );
+    vtkSmartPointer<USAcquisitionObject> acquisition = vtkSmartPointer<USAcquisitionObject>::New();
+    for( int f = 0; f < m_numberOfFrames; ++f )
+        acquisition->AddFrame( sweep.GetFrame( f ), sweep.poses[f], f * SweepFramePeriod );
+
+    IbisItkUnsignedChar3ImageType::Pointer itkFrame = IbisItkUnsignedChar3ImageType::New();
+    QJsonObject parameters;
+    parameters["width"]  = m_frameWidth;
+    parameters["height"] = m_frameHeight;
+
+    for( int i = 0; i < names.size(); ++i )
+    {
+        bool masked = i == 1;
+        BenchmarkSuite::Case c;
+        c.name       = names[i];
+        c.operations = m_numberOfFrames;
+        c.parameters = parameters;
+        c.run        = [&, masked]() {
+            for( int f = 0; f < m_numberOfFrames; ++f ) acquisition->GetItkImage( itkFrame, f, masked );
+        };
+        m_suite.Run( c );
+    }
+}
+
+void CoreBenchmarks::RunItkVtkConverter()
+{
+    QStringList names;
+    names << "IbisItkVtkConverter/ItkToVtk"
+          << "IbisItkVtkConverter/VtkToItk";
+    if( !IsAnyEnabled( names ) ) return;
+
+    IbisItkFloat3ImageType::Pointer itkVolume      = m_data.CreateItkVolume( m_volumeSize );
+    vtkSmartPointer<vtkImageData> vtkVolume        = m_data.CreateVolume( m_volumeSize );
+    vtkSmartPointer<vtkMatrix4x4> identity         = vtkSmartPointer<vtkMatrix4x4>::New();
+    vtkSmartPointer<IbisItkVtkConverter> converter = vtkSmartPointer<IbisItkVtkConverter>::New();
+    IbisItkFloat3ImageType::Pointer itkOutput      = IbisItkFloat3ImageType::New();
+    QJsonObject parameters;
+    parameters["size"] = m_volumeSize;
+
+    // A new converter for every conversion, as when a volume is loaded
+    BenchmarkSuite::Case itkToVtk;
+    itkToVtk.name       = names[0];
+    itkToVtk.parameters = parameters;
+    itkToVtk.setUp      = [&]() { converter = vtkSmartPointer<IbisItkVtkConverter>::New(); };
+    itkToVtk.run        = [&]() { converter->ConvertItkImageToVtkImage( itkVolume ); };
+    m_suite.Run( itkToVtk );
+
+    BenchmarkSuite::Case vtkToItk;
+    vtkToItk.name       = names[1];
+    vtkToItk.parameters = parameters;
+    vtkToItk.run        = [&]() { converter->ConvertVtkImageToItkImage( itkOutput, vtkVolume, identity ); };
+    m_suite.Run( vtkToItk );
+}
+
+void CoreBenchmarks::RunFileReader()
+{
+    QStringList names;
+    names << "FileReader/Open/MINC"
+          << "FileReader/Open/VTK"
+          << "FileReader/Open/OBJ";
+    if( !IsAnyEnabled( names ) ) return;
+
+    QDir dir( m_scratchDirectory );
+    QStringList files;
+    files << dir.filePath( "volume.mnc" ) << dir.filePath( "surface.vtk" ) << dir.filePath( "surface.obj" );
+    bool written[3] = { false, false, false };
+    if( m_suite.IsEnabled( names[0] ) ) written[0] = m_data.WriteMincVolume( files[0], m_volumeSize );
+    if( m_suite.IsEnabled( names[1] ) ) written[1] = m_data.WriteVtkSurface( files[1], m_surfaceResolution );
+    if( m_suite.IsEnabled( names[2] ) ) written[2] = m_data.WriteObjSurface( files[2], m_surfaceResolution );
+
+    QList<SceneObject *> objects;
+    for( int i = 0; i < names.size(); ++i )
+    {
+        if( !written[i] )
+        {
+            m_suite.Skip( names[i], QString( "could not write %1" ).arg( files[i] ) );
+            continue;
+        }
+        QString filename = files[i];
+        BenchmarkSuite::Case c;
+        c.name                   = names[i];
+        c.parameters["size"]     = i == 0 ? m_volumeSize : m_surfaceResolution;
+        c.parameters["fileSize"] = QFileInfo( filename ).size();
+        c.run                    = [&, filename]() {
+            QStringList filenames( filename );
+            FileReader reader;
+            reader.SetFileNames( filenames );
+            reader.start();
+            reader.wait();
+            reader.GetReadObjects( objects );
+        };
+        c.tearDown = [&]() { DeleteObjects( objects ); };
+        m_suite.Run( c );
+    }
+}
+
+void CoreBenchmarks::RunSequenceFile()
+{
+    const QString name = "SequenceFile/RoundTrip";
+    if( !m_suite.IsEnabled( name ) ) return;
+
+    Sweep sweep;
+    CreateSweep( m_data, m_numberOfFrames, m_frameWidth, m_frameHeight, SweepFramePoolSize, sweep );
+    const QString fileName = QDir( m_scratchDirectory ).filePath( "sequence.igs.mha" );
+    const int nbFrames     = m_numberOfFrames;
+    const size_t frameSize = size_t( m_frameWidth ) * m_frameHeight;
+    auto check             = []( bool ok, const char * message ) {
+        if( !ok ) throw std::runtime_error( message );
+    };
+
+    // Frame fields as exported by SequenceIO, with some invalid poses
+    auto writeSequence = [&]() {
+        SequenceFile file;
+        check( file.Create( fileName ), "Could not create the sequence file" );
+        file.WriteField( "ObjectType", "Image" );
+        file.WriteField( "NDims", "3" );
+        file.WriteField( "BinaryData", "True" );
+        file.WriteField( "BinaryDataByteOrderMSB", "False" );
+        file.WriteField( "CompressedData", "False" );
+        file.WriteField( "DimSize", QByteArray::number( m_frameWidth ) + " " + QByteArray::number( m_frameHeight ) +
+                                        " " + QByteArray::number( nbFrames ) );
+        file.WriteField( "ElementSpacing", "1 1 1" );
+        file.WriteField( "ElementType", "MET_UCHAR" );
+        file.WriteField( "UltrasoundImageOrientation", "MF" );
+        for( int i = 0; i < nbFrames; ++i )
+        {
+            file.BeginFrame( i );
+            file.WriteFrameField( "FrameNumber", QByteArray::number( i ).rightJustified( 10, '0' ) );
+            file.WriteFrameField( "ProbeToReferenceTransform", &sweep.poses[i]->Element[0][0] );
+            file.WriteFrameField( "ProbeToReferenceTransformStatus", i % 7 ? "OK" : "INVALID" );
+            file.WriteFrameField( "Timestamp", SequenceFile::FormatNumber( i * SweepFramePeriod ) );
+        }
+        file.WriteField( "ElementDataFile", "LOCAL" );
+        for( int i = 0; i < nbFrames; ++i )
+            file.WriteData( sweep.GetFrame( i )->GetScalarPointer(), qint64( frameSize ) );
+        check( file.Finish(), "Could not write the sequence file" );
+    };
+
+    // Numbers are written in their shortest exact representation, everything must read back unchanged
+    auto readSequence = [&]() {
+        SequenceFile file;
+        check( file.Open( fileName ), "Could not open the sequence file" );
+        check( file.GetFrameWidth() == m_frameWidth && file.GetFrameHeight() == m_frameHeight &&
+                   file.GetNumberOfFrames() == nbFrames && file.GetNumberOfComponents() == 1,
+               "The dimensions of the sequence changed" );
+
+        std::vector<double> matrices;
+        check( file.GetFrameMatrices( "ProbeToReferenceTransform", matrices ), "Could not read the frame poses" );
+        std::vector<char> statuses;
+        check( file.GetFrameStatuses( "ProbeToReferenceTransformStatus", statuses ),
+               "Could not read the frame statuses" );
+        std::vector<double> timestamps;
+        check( file.GetFrameValues( "Timestamp", timestamps ), "Could not read the frame timestamps" );
+        for( int i = 0; i < nbFrames; ++i )
+        {
+            check( std::equal( matrices.begin() + 16 * i, matrices.begin() + 16 * ( i + 1 ),
+                               &sweep.poses[i]->Element[0][0] ),
+                   "A frame pose changed" );
+            check( bool( statuses[i] ) == bool( i % 7 ), "A frame status changed" );
+            check( timestamps[i] == i * SweepFramePeriod, "A frame timestamp changed" );
+        }
+
+        std::vector<unsigned char> frames;
+        check( file.ReadFrames( frames ), "Could not read the frames" );
+        for( int i = 0; i < nbFrames; ++i )
+        {
+            const unsigned char * pixels =
+                static_cast<const unsigned char *>( sweep.GetFrame( i )->GetScalarPointer() );
+            check( std::equal( pixels, pixels + frameSize, frames.begin() + i * frameSize ), "A frame changed" );
+        }
+    };
+
+    BenchmarkSuite::Case c;
+    c.name                 = name;
+    c.operations           = nbFrames;
+    c.parameters["width"]  = m_frameWidth;
+    c.parameters["height"] = m_frameHeight;
+    c.parameters["frames"] = nbFrames;
+    // A difference fails the case and ibis_benchmarks returns an error
+    c.run = [&]() {
+        writeSequence();
+        readSequence();
+    };
+    c.tearDown = [&]() { QFile::remove( fileName ); };
+    m_suite.Run( c );
+}
+
+void CoreBenchmarks::RunScene()
+{
+    QStringList names;
+    names << "Scene/Save/XML"
+          << "Scene/Load/XML"
+          << "Scene/Save/Archive"
+          << "Scene/Load/Archive";
+    if( !IsAnyEnabled( names ) ) return;
+
+    // Objects are added to an empty scene as if they had just been loaded
+    SceneManager * manager                    = Application::GetSceneManager();
+    IbisItkFloat3ImageType::Pointer itkVolume = m_data.CreateItkVolume( m_volumeSize );
+    vtkSmartPointer<vtkPolyData> surfaceData  = m_data.CreateSurface( m_surfaceResolution );
+    auto createScene                          = [&]() {
+        manager->NewScene();
+        vtkSmartPointer<ImageObject> volume = vtkSmartPointer<ImageObject>::New();
+        volume->SetName( "Volume" );
+        volume->SetItkImage( itkVolume );
+        manager->AddObject( volume );
+        vtkSmartPointer<PolyDataObject> surface = vtkSmartPointer<PolyDataObject>::New();
+        surface->SetName( "Surface" );
+        surface->SetPolyData( surfaceData );
+        manager->AddObject( surface );
+    };
+
+    QDir dir( m_scratchDirectory );
+    QStringList files;
+    files << dir.filePath( "scene/scene.xml" )
+          << dir.filePath( QString( "archive/scene.%1" ).arg( SceneArchive::FileNameSuffix ) );
+    dir.mkpath( "scene" );
+    dir.mkpath( "archive" );
+
+    QJsonObject parameters;
+    parameters["volumeSize"]        = m_volumeSize;
+    parameters["surfaceResolution"] = m_surfaceResolution;
+
+    // Each format is saved from the synthetic scene, then loaded in an empty scene
+    for( int i = 0; i < files.size(); ++i )
+    {
+        createScene();
+        QString filename = files[i];
+        BenchmarkSuite::Case save;
+        save.name       = names[2 * i];
+        save.parameters = parameters;
+        save.run        = [&, filename]() {
+            QString f = filename;
+            manager->SaveScene( f );
+        };
+        m_suite.Run( save );
+
+        if( !m_suite.IsEnabled( names[2 * i + 1] ) ) continue;
+        if( !QFileInfo::exists( filename ) )
+        {
+            m_suite.Skip( names[2 * i + 1], QString( "%1 was not saved" ).arg( filename ) );
+            continue;
+        }
+        BenchmarkSuite::Case load;
+        load.name       = names[2 * i + 1];
+        load.parameters = parameters;
+        load.setUp      = [&]() { manager->NewScene(); };
+        load.run        = [&, filename]() {
+            QString f = filename;
+            manager->LoadScene( f, false );
+        };
+        m_suite.Run( load );
+    }
+
+    manager->NewScene();
+}
+
+void CoreBenchmarks::RunReslice()
+{
+    QStringList names;
+    names << "MultiImagePlaneWidget/MoveSlice/Nearest"
+          << "MultiImagePlaneWidget/MoveSlice/Linear"
+          << "MultiImagePlaneWidget/MoveSliceAndRender";
+    if( !IsAnyEnabled( names ) ) return;
+
+    vtkSmartPointer<vtkImageData> volume   = m_data.CreateVolume( m_volumeSize );
+    vtkSmartPointer<vtkTransform> identity = vtkSmartPointer<vtkTransform>::New();
+    vtkSmartPointer<vtkLookupTable> lut    = vtkSmartPointer<vtkLookupTable>::New();
+    lut->SetTableRange( 0.0, 255.0 );
+    lut->SetSaturationRange( 0.0, 0.0 );
+    lut->SetValueRange( 0.0, 1.0 );
+    lut->Build();
+
+    vtkSmartPointer<vtkMultiImagePlaneWidget> plane = vtkSmartPointer<vtkMultiImagePlaneWidget>::New();
+    plane->SetBoundingVolume( volume, identity );
+    plane->AddInput( volume, lut, identity, true );
+    plane->SetPlaneOrientation( 2 );
+    plane->PlaceWidget();
+
+    // Sweep the slice from the middle of the volume to one side and back
+    int nbMoves   = m_volumeSize - 2;
+    auto moveStep = [nbMoves]( int i ) { return i < nbMoves / 2 ? 1 : -1; };
+    QJsonObject parameters;
+    parameters["size"] = m_volumeSize;
+
+    for( int i = 0; i < 2; ++i )
+    {
+        int interpolation = i == 0 ? VTK_NEAREST_RESLICE : VTK_LINEAR_RESLICE;
+        BenchmarkSuite::Case c;
+        c.name       = names[i];
+        c.operations = nbMoves;
+        c.parameters = parameters;
+        c.setUp      = [&, interpolation]() { plane->SetResliceInterpolate( interpolation ); };
+        c.run        = [&]() {
+            for( int m = 0; m < nbMoves; ++m ) plane->MoveNSlices( moveStep( m ) );
+        };
+        m_suite.Run( c );
+    }
+
+    if( !m_suite.IsEnabled( names[2] ) ) return;
+    vtkSmartPointer<vtkRenderWindow> renderWindow = vtkSmartPointer<vtkRenderWindow>::New();
+    renderWindow->SetOffScreenRendering( 1 );
+    renderWindow->SetSize( 512, 512 );
+    if( !renderWindow->SupportsOpenGL() )
+    {
+        m_suite.Skip( names[2], "no OpenGL context available for offscreen rendering" );
+        return;
+    }
+    vtkSmartPointer<vtkRenderer> renderer = vtkSmartPointer<vtkRenderer>::New();
+    renderWindow->AddRenderer( renderer );
+    plane->AddRenderer( renderer );
+    plane->Show( renderer, 1 );
+    plane->SetResliceInterpolate( VTK_LINEAR_RESLICE );
+    renderer->ResetCamera();
+    renderWindow->Render();
+
+    BenchmarkSuite::Case render;
+    render.name                   = names[2];
+    render.operations             = nbMoves;
+    render.parameters             = parameters;
+    render.parameters["viewSize"] = 512;
+    render.run                    = [&]() {
+        for( int m = 0; m < nbMoves; ++m )
+        {
+            plane->MoveNSlices( moveStep( m ) );
+            renderWindow->Render();
+        }
+    };
+    m_suite.Run( render );
+}
+
+void CoreBenchmarks::RunVolumeReconstruction()
+{
+    const QString name = "VolumeReconstruction/CPU";
+#ifdef IBIS_BENCHMARK_VOLUME_RECONSTRUCTION
+    if( !m_suite.IsEnabled( name ) ) return;
+
+    typedef itk::CPUVolumeReconstruction<IbisItkFloat3ImageType> ReconstructionType;
+    Sweep sweep;
+    CreateSweep( m_data, m_numberOfFrames, m_frameWidth, m_frameHeight, SweepFramePoolSize, sweep );
+    ReconstructionInput input;
+    CreateReconstructionInput( sweep, m_frameWidth, m_frameHeight, input );
+    ReconstructionType::Pointer reconstructor;
+
+    BenchmarkSuite::Case c;
+    c.name                        = name;
+    c.parameters["width"]         = m_frameWidth;
+    c.parameters["height"]        = m_frameHeight;
+    c.parameters["frames"]        = m_numberOfFrames;
+    c.parameters["searchRadius"]  = int( ReconstructionSearchRadius );
+    c.parameters["volumeSpacing"] = ReconstructionVolumeSpacing;
+    c.parameters["kernelStdDev"]  = ReconstructionKernelStdDev;
+    c.setUp                       = [&]() {
+        reconstructor = ReconstructionType::New();
+        SetReconstructionInput( reconstructor, input );
+    };
+    c.run      = [&]() { reconstructor->ReconstructVolume(); };
+    c.tearDown = [&]() { reconstructor = nullptr; };
+    m_suite.Run( c );
+#else
+    m_suite.Skip( name, "GPU_VolumeReconstruction plugin not built" );
+#endif
+}
+
+void CoreBenchmarks::RunVolumeReconstructionBackends()
+{
+    const QString name = "VolumeReconstruction/CPUvsOpenCL";
+#if defined( IBIS_BENCHMARK_VOLUME_RECONSTRUCTION ) && defined( HAS_OPENCL )
+    if( !m_suite.IsEnabled( name ) ) return;
+    if( !itk::IsGPUAvailable() )
+    {
+        m_suite.Skip( name, "OpenCL device not available" );
+        return;
+    }
+
+    // The backends only differ by the order in which the contributions of the slices are accumulated. The sweep is
+    // small and the same in quick mode, the volumes are compared in intensity units.
+    const int nbFrames               = 20;
+    const int width                  = 160;
+    const int height                 = 120;
+    const double maxDifferenceLimit  = 1.0;
+    const double meanDifferenceLimit = 0.01;
+
+    Sweep sweep;
+    CreateSweep( m_data, nbFrames, width, height, SweepFramePoolSize, sweep );
+    ReconstructionInput input;
+    CreateReconstructionInput( sweep, width, height, input );
+
+    typedef itk::CPUVolumeReconstruction<IbisItkFloat3ImageType> CPUReconstructionType;
+    typedef itk::GPUVolumeReconstruction<IbisItkFloat3ImageType> GPUReconstructionType;
+    CPUReconstructionType::Pointer cpuReconstructor;
+    GPUReconstructionType::Pointer gpuReconstructor;
+
+    BenchmarkSuite::Case c;
+    c.name                              = name;
+    c.parameters["width"]               = width;
+    c.parameters["height"]              = height;
+    c.parameters["frames"]              = nbFrames;
+    c.parameters["maxDifferenceLimit"]  = maxDifferenceLimit;
+    c.parameters["meanDifferenceLimit"] = meanDifferenceLimit;
+    c.setUp                             = [&]() {
+        cpuReconstructor = CPUReconstructionType::New();
+        gpuReconstructor = GPUReconstructionType::New();
+        SetReconstructionInput( cpuReconstructor, input );
+        SetReconstructionInput( gpuReconstructor, input );
+    };
+    // A difference past the limits fails the case and ibis_benchmarks returns an error
+    c.run = [&]() {
+        cpuReconstructor->ReconstructVolume();
+        gpuReconstructor->ReconstructVolume();
+        IbisItkFloat3ImageType * cpuVolume = cpuReconstructor->GetReconstructedVolume();
+        IbisItkFloat3ImageType * gpuVolume = gpuReconstructor->GetReconstructedVolume();
+        if( cpuVolume->GetLargestPossibleRegion() != gpuVolume->GetLargestPossibleRegion() )
+            throw std::runtime_error( "CPU and OpenCL volumes don't have the same size" );
+
+        const float * cpuVoxels = cpuVolume->GetBufferPointer();
+        const float * gpuVoxels = gpuVolume->GetBufferPointer();
+        size_t nbVoxels         = cpuVolume->GetLargestPossibleRegion().GetNumberOfPixels();
+        double maxDifference    = 0.0;
+        double sumDifference    = 0.0;
+        for( size_t i = 0; i < nbVoxels; ++i )
+        {
+            double difference = std::fabs( double( cpuVoxels[i] ) - double( gpuVoxels[i] ) );
+            maxDifference     = std::max( maxDifference, difference );
+            sumDifference += difference;
+        }
+        double meanDifference = nbVoxels > 0 ? sumDifference / nbVoxels : 0.0;
+        if( maxDifference > maxDifferenceLimit || meanDifference > meanDifferenceLimit )
+            throw std::runtime_error( QString( "CPU and OpenCL volumes differ, max %1 (limit %2), mean %3 (limit %4)" )
+                                          .arg( maxDifference )
+                                          .arg( maxDifferenceLimit )
+                                          .arg( meanDifference )
+                                          .arg( meanDifferenceLimit )
+                                          .toStdString() );
+    };
+    c.tearDown = [&]() {
+        cpuReconstructor = nullptr;
+        gpuReconstructor = nullptr;
+    };
+    m_suite.Run( c );
+#elif defined( IBIS_BENCHMARK_VOLUME_RECONSTRUCTION )
+    m_suite.Skip( name, "GPU_VolumeReconstruction plugin built without OpenCL" );
+#else
+    m_suite.Skip( name, "GPU_VolumeReconstruction plugin not built" );
+#endif
+}
+
+void CoreBenchmarks::RunRigidRegistration()
+{
+    QStringList names;
+    names << "RigidRegistration/Metric/Preprocess"
+          << "RigidRegistration/Metric/Evaluate";
+#ifdef IBIS_BENCHMARK_RIGID_REGISTRATION
+    if( !IsAnyEnabled( names ) ) return;
+
+    typedef itk::CPUOrientationMatchingMatrixTransformationSparseMask<IbisItkFloat3ImageType, IbisItkFloat3ImageType>
+        MetricType;
+    typedef itk::Euler3DTransform<double> TransformType;
+
+    IbisItkFloat3ImageType::Pointer fixed  = m_data.CreateItkVolume( m_volumeSize );
+    IbisItkFloat3ImageType::Pointer moving = m_data.CreateItkVolume( m_volumeSize );
+
+    // Candidates around the identity, as evaluated by one generation of the optimizer
+    const int nbTransforms = 32;
+    std::vector<MetricType::MatrixTransformConstPointer> transforms;
+    for( int i = 0; i < nbTransforms; ++i )
+    {
+        TransformType::Pointer transform = TransformType::New();
+        double angle                     = 0.01 * ( i - nbTransforms / 2 );
+        transform->SetRotation( angle, -0.5 * angle, 0.25 * angle );
+        TransformType::OutputVectorType translation;
+        translation[0] = 0.1 * ( i % 4 );
+        translation[1] = 0.1 * ( i % 3 );
+        translation[2] = -0.1 * ( i % 5 );
+        transform->SetTranslation( translation );
+        transforms.push_back( transform.GetPointer() );
+    }
+    std::vector<MetricType::InternalRealType> values;
+
+    const unsigned int numberOfPixels = 16000;
+    MetricType::Pointer metric;
+    auto createMetric = [&]() {
+        metric = MetricType::New();
+        metric->SetFixedImage( fixed );
+        metric->SetMovingImage( moving );
+        metric->SetTransform( TransformType::New() );
+        metric->SetSamplingStrategyToGrid();
+        metric->SetNumberOfPixels( numberOfPixels );
+        metric->SetPercentile( 0.8 );
+        metric->SetN( 1 );
+    };
+    QJsonObject parameters;
+    parameters["size"]           = m_volumeSize;
+    parameters["numberOfPixels"] = int( numberOfPixels );
+
+    // Image gradients and selection of the samples
+    BenchmarkSuite::Case preprocess;
+    preprocess.name       = names[0];
+    preprocess.parameters = parameters;
+    preprocess.setUp      = createMetric;
+    preprocess.run        = [&]() { metric->Update(); };
+    m_suite.Run( preprocess );
+
+    BenchmarkSuite::Case evaluate;
+    evaluate.name                     = names[1];
+    evaluate.operations               = nbTransforms;
+    evaluate.parameters               = parameters;
+    evaluate.parameters["transforms"] = nbTransforms;
+    evaluate.setUp                    = [&]() {
+        createMetric();
+        metric->Update();
+    };
+    evaluate.run      = [&]() { metric->GetValues( transforms, values ); };
+    evaluate.tearDown = [&]() { metric = nullptr; };
+    m_suite.Run( evaluate );
+#else
+    for( int i = 0; i < names.size(); ++i ) m_suite.Skip( names[i], "GPU_RigidRegistration plugin not built" );
+#endif
+}
+
+void CoreBenchmarks::RunRigidRegistrationBackends()
+{
+    const QString name = "RigidRegistration/CPUvsOpenCL";
+#if defined( IBIS_BENCHMARK_RIGID_REGISTRATION ) && defined( HAS_OPENCL )
+    if( !m_suite.IsEnabled( name ) ) return;
+    if( !itk::IsGPUAvailable() )
+    {
+        m_suite.Skip( name, "OpenCL device not available" );
+        return;
+    }
+
+    typedef itk::CPUOrientationMatchingMatrixTransformationSparseMask<IbisItkFloat3ImageType, IbisItkFloat3ImageType>
+        CPUMetricType;
+    typedef itk::GPUOrientationMatchingMatrixTransformationSparseMask<IbisItkFloat3ImageType, IbisItkFloat3ImageType>
+        GPUMetricType;
+    typedef itk::OrientationMatchingMatrixTransformationSparseMask<IbisItkFloat3ImageType, IbisItkFloat3ImageType>
+        MetricType;
+    typedef itk::Euler3DTransform<double> TransformType;
+
+    // The backends compute the same gradients and reduce the samples in the same order, only the float rounding
+    // differs. The grid sampling selects the same samples for both. The poses are the identity and a small step
+    // on each side of it along every parameter, the derivative of the metric along a parameter is the central
+    // difference of its two poses. The same relative tolerance as the vertebra registration is used for the
+    // values, the derivatives are allowed the resulting error of the difference.
+    const int volumeSize            = 64;
+    const unsigned int nbPixels     = 16000;
+    const double steps[6]           = { 0.02, 0.02, 0.02, 0.5, 0.5, 0.5 };
+    const int nbPoses               = 13;
+    const double relativeValueLimit = 0.001;
+
+    IbisItkFloat3ImageType::Pointer fixed  = m_data.CreateItkVolume( volumeSize );
+    IbisItkFloat3ImageType::Pointer moving = m_data.CreateItkVolume( volumeSize );
+
+    std::vector<MetricType::MatrixTransformConstPointer> transforms;
+    for( int p = 0; p < nbPoses; ++p )
+    {
+        TransformType::Pointer transform        = TransformType::New();
+        TransformType::ParametersType parameters = transform->GetParameters();
+        if( p > 0 ) parameters[( p - 1 ) / 2] += ( p % 2 ? 1.0 : -1.0 ) * steps[( p - 1 ) / 2];
+        transform->SetParameters( parameters );
+        transforms.push_back( transform.GetPointer() );
+    }
+
+    MetricType::Pointer cpuMetric;
+    MetricType::Pointer gpuMetric;
+    auto initializeMetric = [&]( MetricType * metric ) {
+        metric->SetFixedImage( fixed );
+        metric->SetMovingImage( moving );
+        metric->SetTransform( TransformType::New() );
+        metric->SetSamplingStrategyToGrid();
+        metric->SetNumberOfPixels( nbPixels );
+        metric->SetPercentile( 0.8 );
+        metric->SetN( 1 );
+    };
+
+    BenchmarkSuite::Case c;
+    c.name                             = name;
+    c.operations                       = nbPoses;
+    c.parameters["size"]               = volumeSize;
+    c.parameters["numberOfPixels"]     = int( nbPixels );
+    c.parameters["poses"]              = nbPoses;
+    c.parameters["relativeValueLimit"] = relativeValueLimit;
+    c.setUp                            = [&]() {
+        cpuMetric = CPUMetricType::New().GetPointer();
+        gpuMetric = GPUMetricType::New().GetPointer();
+        initializeMetric( cpuMetric );
+        initializeMetric( gpuMetric );
+    };
+    // A difference past the limits fails the case and ibis_benchmarks returns an error
+    c.run = [&]() {
+        // The identity goes through Update(), then every pose through GetValues(): pose p is at index p + 1
+        cpuMetric->Update();
+        gpuMetric->Update();
+        std::vector<double> cpuValues( 1, cpuMetric->GetMetricValue() );
+        std::vector<double> gpuValues( 1, gpuMetric->GetMetricValue() );
+
+        std::vector<MetricType::InternalRealType> values;
+        cpuMetric->GetValues( transforms, values );
+        cpuValues.insert( cpuValues.end(), values.begin(), values.end() );
+        gpuMetric->GetValues( transforms, values );
+        gpuValues.insert( gpuValues.end(), values.begin(), values.end() );
+        if( cpuValues.size() != gpuValues.size() )
+            throw std::runtime_error( "CPU and OpenCL metrics didn't evaluate the same number of poses" );
+
+        double maxValue = 0.0;
+        for( size_t i = 0; i < gpuValues.size(); ++i ) maxValue = std::max( maxValue, std::fabs( gpuValues[i] ) );
+        for( size_t i = 0; i < gpuValues.size(); ++i )
+        {
+            double difference = std::fabs( cpuValues[i] - gpuValues[i] );
+            double limit      = relativeValueLimit * std::max( 1.0, std::fabs( gpuValues[i] ) );
+            if( difference > limit )
+                throw std::runtime_error( QString( "CPU and OpenCL metric values differ for evaluation %1: %2 and %3" )
+                                              .arg( int( i ) )
+                                              .arg( cpuValues[i] )
+                                              .arg( gpuValues[i] )
+                                              .toStdString() );
+        }
+
+        // Derivatives along each parameter, from poses 2k + 1 (+step) and 2k + 2 (-step)
+        for( int k = 0; k < 6; ++k )
+        {
+            size_t plus          = 2 * k + 2;
+            size_t minus         = 2 * k + 3;
+            double cpuDerivative = ( cpuValues[plus] - cpuValues[minus] ) / ( 2.0 * steps[k] );
+            double gpuDerivative = ( gpuValues[plus] - gpuValues[minus] ) / ( 2.0 * steps[k] );
+            double limit         = relativeValueLimit * std::max( 1.0, maxValue ) / steps[k];
+            if( std::fabs( cpuDerivative - gpuDerivative ) > limit )
+                throw std::runtime_error( QString( "CPU and OpenCL metric derivatives differ along parameter %1: "
+                                                   "%2 and %3 (limit %4)" )
+                                              .arg( k )
+                                              .arg( cpuDerivative )
+                                              .arg( gpuDerivative )
+                                              .arg( limit )
+                                              .toStdString() );
+        }
+    };
+    c.tearDown = [&]() {
+        cpuMetric = nullptr;
+        gpuMetric = nullptr;
+    };
+    m_suite.Run( c );
+#elif defined( IBIS_BENCHMARK_RIGID_REGISTRATION )
+    m_suite.Skip( name, "GPU_RigidRegistration plugin built without OpenCL" );
+#else
+    m_suite.Skip( name, "GPU_RigidRegistration plugin not built" );
+#endif
+}
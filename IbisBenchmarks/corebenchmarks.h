@@ -0,0 +1,73 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef COREBENCHMARKS_H
+#define COREBENCHMARKS_H
+
+#include <QJsonObject>
+#include <QString>
+#include <QStringList>
+
+class BenchmarkSuite;
+class SyntheticData;
+
+/**
+ * @class   CoreBenchmarks
+ * @brief   Benchmark cases of the hot paths of IbisLib
+ *
+ * Each group creates the datasets it needs only if at least one of its cases is enabled in the suite. Files are
+ * written to a scratch directory that must exist and stay valid while the cases run.
+ *
+ * The sizes are those of a typical acquisition: 256^3 volumes and sweeps of 300 frames of 640x480. In quick mode
+ * they are reduced to run the whole suite in a few seconds, e.g. to check that nothing is broken.
+ */
+class CoreBenchmarks
+{
+public:
+    CoreBenchmarks( BenchmarkSuite & suite, SyntheticData & data, const QString & scratchDirectory );
+
+    void SetQuick( bool quick );
+    /** Sizes of the datasets, added to the context of the report. */
+    QJsonObject GetDatasetSizes();
+
+    void RunAll();
+
+    void RunTrackedVideoBuffer();
+    void RunUSAcquisition();
+    void RunItkVtkConverter();
+    void RunFileReader();
+    /** Fails if a tracked sequence written with SequenceFile doesn't read back with the same frames and fields. */
+    void RunSequenceFile();
+    void RunScene();
+    void RunReslice();
+    /** CPU reconstruction and registration are only available if the plugins they belong to are built. */
+    void RunVolumeReconstruction();
+    /** Fails if the CPU and OpenCL reconstructions of a small sweep differ by more than a tolerance. */
+    void RunVolumeReconstructionBackends();
+    void RunRigidRegistration();
+    /** Fails if the CPU and OpenCL gradient orientation metrics, or their derivatives, differ by more than a
+     *  tolerance. */
+    void RunRigidRegistrationBackends();
+
+protected:
+    bool IsAnyEnabled( const QStringList & names );
+
+    BenchmarkSuite & m_suite;
+    SyntheticData & m_data;
+    QString m_scratchDirectory;
+
+    int m_volumeSize;
+    int m_frameWidth;
+    int m_frameHeight;
+    int m_numberOfFrames;
+    int m_surfaceResolution;
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include <itkVersion.h>
+#include <vtkObject.h>
+#include <vtkVersion.h>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QFile>
+#include <QJsonDocument>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QThread>
+#include <algorithm>
+#include <iostream>
+
+#include "application.h"
+#include "benchmarksuite.h"
+#include "corebenchmarks.h"
+#include "syntheticdata.h"
+
+int main( int argc, char ** argv )
+{
+    vtkObject::SetGlobalWarningDisplay( 0 );
+
+    // Scene loading and saving report their progress in dialogs, a QApplication is needed but nothing is displayed
+    if( qEnvironmentVariableIsEmpty( "QT_QPA_PLATFORM" ) ) qputenv( "QT_QPA_PLATFORM", "offscreen" );
+    QApplication app( argc, argv );
+    QApplication::setApplicationName( "ibis_benchmarks" );
+    Q_INIT_RESOURCE( IbisLib );
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "Time the core operations of Ibis on synthetic datasets and write the results as JSON. Times are in ms per "
+        "operation, compare reports of the same machine only." );
+    parser.addHelpOption();
+    QCommandLineOption outputOption( "output", "JSON report file, standard output if not set.", "file" );
+    QCommandLineOption filterOption( "filter", "Only run the benchmarks whose name matches the regular expression.",
+                                     "regexp" );
+    QCommandLineOption repetitionsOption( "repetitions", "Number of timed runs of each benchmark.", "n", "5" );
+    QCommandLineOption seedOption( "seed", "Seed of the synthetic datasets.", "seed",
+                                   QString::number( SyntheticData::DefaultSeed ) );
+    QCommandLineOption quickOption( "quick", "Small datasets, to check that all the benchmarks run." );
+    QCommandLineOption verboseOption( "verbose", "Print the benchmarks and their median time while running." );
+    parser.addOptions( { outputOption, filterOption, repetitionsOption, seedOption, quickOption, verboseOption } );
+    parser.process( app );
+
+    QRegularExpression filter( parser.value( filterOption ) );
+    if( !filter.isValid() )
+    {
+        std::cerr << "Invalid filter: " << filter.errorString().toStdString() << std::endl;
+        return 1;
+    }
+    QTemporaryDir scratchDirectory;
+    if( !scratchDirectory.isValid() )
+    {
+        std::cerr << "Could not create a temporary directory." << std::endl;
+        return 1;
+    }
+
+    Application::CreateInstance( true );
+
+    BenchmarkSuite suite;
+    suite.SetRepetitions( std::max( parser.value( repetitionsOption ).toInt(), 1 ) );
+    suite.SetFilter( filter );
+    suite.SetVerbose( parser.isSet( verboseOption ) );
+
+    SyntheticData data( parser.value( seedOption ).toUInt() );
+    CoreBenchmarks benchmarks( suite, data, scratchDirectory.path() );
+    benchmarks.SetQuick( parser.isSet( quickOption ) );
+
+    QJsonObject context;
+    context["suite"]        = "ibis_benchmarks";
+    context["ibisVersion"]  = Application::GetInstance().GetVersionString();
+    context["gitHash"]      = Application::GetGitHash();
+    context["date"]         = QDateTime::currentDateTimeUtc().toString( Qt::ISODate );
+    context["qtVersion"]    = qVersion();
+    context["vtkVersion"]   = vtkVersion::GetVTKVersion();
+    context["itkVersion"]   = QString::fromStdString( itk::Version::GetITKVersion() );
+    context["cpu"]          = QSysInfo::currentCpuArchitecture();
+    context["os"]           = QSysInfo::prettyProductName();
+    context["threads"]      = QThread::idealThreadCount();
+    context["seed"]         = qint64( data.GetSeed() );
+    context["quick"]        = parser.isSet( quickOption );
+    context["datasetSizes"] = benchmarks.GetDatasetSizes();
+    suite.SetContext( context );
+
+    benchmarks.RunAll();
+
+    QByteArray report = QJsonDocument( suite.GetReport() ).toJson( QJsonDocument::Indented );
+    if( parser.isSet( outputOption ) )
+    {
+        QFile file( parser.value( outputOption ) );
+        if( !file.open( QIODevice::WriteOnly ) || file.write( report ) != report.size() )
+        {
+            std::cerr << "Could not write " << file.fileName().toStdString() << std::endl;
+            Application::DeleteInstance();
+            return 1;
+        }
+    }
+    else
+        std::cout << report.constData();
+
+    int nbFailures = suite.GetNumberOfFailures();
+    Application::DeleteInstance();
+    return nbFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,229 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "syntheticdata.h"
+
+#include <itkImageFileWriter.h>
+#include <vtkCellArray.h>
+#include <vtkDataArray.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkPointData.h>
+#include <vtkPolyDataWriter.h>
+#include <vtkSphereSource.h>
+#include <vtkTransform.h>
+
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+const unsigned int SyntheticData::DefaultSeed = 20240611;
+
+namespace
+{
+enum Dataset
+{
+    VolumeDataset = 1,
+    FrameDataset  = 2
+};
+
+// The distributions of the standard library are implementation defined, only the output of the engine is the
+// same everywhere. Noise is made from the raw engine output.
+double Uniform( std::mt19937 & rng ) { return ( rng() + 0.5 ) / 4294967296.0; }
+
+// Approximately normal, sum of 4 uniforms
+double Normal( std::mt19937 & rng )
+{
+    return ( Uniform( rng ) + Uniform( rng ) + Uniform( rng ) + Uniform( rng ) - 2.0 ) * 1.7320508;
+}
+}  // namespace
+
+SyntheticData::SyntheticData( unsigned int seed ) : m_seed( seed ) {}
+
+unsigned int SyntheticData::GetSeed( unsigned int dataset, int index )
+{
+    return m_seed ^ ( dataset * 0x9E3779B9u ) ^ ( unsigned( index ) * 0x85EBCA6Bu );
+}
+
+IbisItkFloat3ImageType::Pointer SyntheticData::CreateItkVolume( int size )
+{
+    IbisItkFloat3ImageType::Pointer volume = IbisItkFloat3ImageType::New();
+    IbisItkFloat3ImageType::RegionType region;
+    IbisItkFloat3ImageType::SizeType regionSize;
+    IbisItkFloat3ImageType::PointType origin;
+    IbisItkFloat3ImageType::SpacingType spacing;
+    for( int i = 0; i < 3; ++i )
+    {
+        regionSize[i] = size;
+        origin[i]     = -0.5 * ( size - 1 );
+        spacing[i]    = 1.0;
+    }
+    region.SetSize( regionSize );
+    volume->SetRegions( region );
+    volume->SetOrigin( origin );
+    volume->SetSpacing( spacing );
+    volume->Allocate();
+
+    // Skull, brain, 2 ventricles and a lesion, in units of the half size of the volume
+    std::mt19937 rng( GetSeed( VolumeDataset, size ) );
+    float * voxel = volume->GetBufferPointer();
+    double half   = 0.5 * size;
+    for( int z = 0; z < size; ++z )
+    {
+        for( int y = 0; y < size; ++y )
+        {
+            for( int x = 0; x < size; ++x, ++voxel )
+            {
+                double px     = ( x - half ) / half;
+                double py     = ( y - half ) / half;
+                double pz     = ( z - half ) / half;
+                double head   = px * px / 0.72 + py * py / 0.81 + pz * pz / 0.64;
+                double value  = 0.0;
+                double lesion = ( px - 0.3 ) * ( px - 0.3 ) + ( py + 0.2 ) * ( py + 0.2 ) + ( pz - 0.1 ) * ( pz - 0.1 );
+                if( head < 0.85 ) value = 80.0;
+                else if( head < 1.0 )
+                    value = 200.0;
+                if( head < 0.85 && ( ( px + 0.15 ) * ( px + 0.15 ) + py * py * 0.3 + pz * pz < 0.01 ||
+                                     ( px - 0.15 ) * ( px - 0.15 ) + py * py * 0.3 + pz * pz < 0.01 ) )
+                    value = 20.0;
+                if( lesion < 0.005 ) value = 140.0;
+                *voxel = float( value + 5.0 * Normal( rng ) );
+            }
+        }
+    }
+    return volume;
+}
+
+vtkSmartPointer<vtkImageData> SyntheticData::CreateVolume( int size )
+{
+    vtkSmartPointer<IbisItkVtkConverter> converter = vtkSmartPointer<IbisItkVtkConverter>::New();
+    vtkSmartPointer<vtkImageData> volume           = vtkSmartPointer<vtkImageData>::New();
+    volume->DeepCopy( converter->ConvertItkImageToVtkImage( CreateItkVolume( size ) ) );
+    return volume;
+}
+
+vtkSmartPointer<vtkImageData> SyntheticData::CreateUSFrame( int index, int width, int height, int nbComponents )
+{
+    vtkSmartPointer<vtkImageData> frame = vtkSmartPointer<vtkImageData>::New();
+    frame->SetDimensions( width, height, 1 );
+    frame->AllocateScalars( VTK_UNSIGNED_CHAR, nbComponents );
+
+    // Rayleigh distributed speckle, attenuated with depth, with a few reflectors moving with the frame index
+    std::mt19937 rng( GetSeed( FrameDataset, index ) );
+    unsigned char * pixel = static_cast<unsigned char *>( frame->GetScalarPointer() );
+    for( int y = 0; y < height; ++y )
+    {
+        double depth     = double( height - 1 - y ) / height;
+        double intensity = 60.0 * ( 1.0 - 0.6 * depth );
+        bool reflector   = ( y + index / 4 ) % ( height / 6 + 1 ) < 3;
+        for( int x = 0; x < width; ++x )
+        {
+            double value = intensity * sqrt( -2.0 * log( Uniform( rng ) ) );
+            if( reflector ) value += 120.0;
+            unsigned char v = (unsigned char)std::min( value, 255.0 );
+            for( int c = 0; c < nbComponents; ++c ) *pixel++ = v;
+        }
+    }
+    return frame;
+}
+
+void SyntheticData::GetSweepPose( int index, int nbFrames, vtkMatrix4x4 * pose )
+{
+    double x    = 0.5 * ( index - 0.5 * nbFrames );
+    double tilt = 5.0 * sin( 2.0 * vtkMath::Pi() * index / std::max( nbFrames, 1 ) );
+    vtkSmartPointer<vtkTransform> transform = vtkSmartPointer<vtkTransform>::New();
+    transform->Translate( x, 0.0, 60.0 );
+    transform->RotateY( tilt );
+    transform->RotateX( 180.0 );
+    transform->Scale( 0.2, 0.2, 1.0 );  // pixel size of the frames in mm
+    pose->DeepCopy( transform->GetMatrix() );
+}
+
+vtkSmartPointer<vtkPolyData> SyntheticData::CreateSurface( int resolution )
+{
+    vtkSmartPointer<vtkSphereSource> sphere = vtkSmartPointer<vtkSphereSource>::New();
+    sphere->SetRadius( 80.0 );
+    sphere->SetThetaResolution( resolution );
+    sphere->SetPhiResolution( resolution );
+    sphere->Update();
+    vtkSmartPointer<vtkPolyData> surface = vtkSmartPointer<vtkPolyData>::New();
+    surface->DeepCopy( sphere->GetOutput() );
+    return surface;
+}
+
+bool SyntheticData::WriteMincVolume( const QString & filename, int size )
+{
+    typedef itk::ImageFileWriter<IbisItkFloat3ImageType> WriterType;
+    WriterType::Pointer writer = WriterType::New();
+    writer->SetFileName( filename.toUtf8().data() );
+    writer->SetInput( CreateItkVolume( size ) );
+    try
+    {
+        writer->Update();
+    }
+    catch( itk::ExceptionObject & )
+    {
+        return false;
+    }
+    return true;
+}
+
+bool SyntheticData::WriteVtkSurface( const QString & filename, int resolution )
+{
+    vtkSmartPointer<vtkPolyDataWriter> writer = vtkSmartPointer<vtkPolyDataWriter>::New();
+    writer->SetFileName( filename.toUtf8().data() );
+    writer->SetInputData( CreateSurface( resolution ) );
+    writer->SetFileTypeToBinary();
+    return writer->Write() == 1;
+}
+
+bool SyntheticData::WriteObjSurface( const QString & filename, int resolution )
+{
+    QFile file( filename );
+    if( !file.open( QIODevice::WriteOnly | QIODevice::Text ) ) return false;
+
+    // MNI .obj polygons, see vtkMNIOBJReader
+    vtkSmartPointer<vtkPolyData> surface = CreateSurface( resolution );
+    vtkDataArray * normals               = surface->GetPointData()->GetNormals();
+    vtkIdType nbPoints                   = surface->GetNumberOfPoints();
+    QTextStream out( &file );
+    out << "P 0.3 0.3 0.4 10 1 " << nbPoints << "\n";
+    for( vtkIdType i = 0; i < nbPoints; ++i )
+    {
+        double * p = surface->GetPoint( i );
+        out << " " << p[0] << " " << p[1] << " " << p[2] << "\n";
+    }
+    out << "\n";
+    for( vtkIdType i = 0; i < nbPoints; ++i )
+    {
+        double * n = normals->GetTuple3( i );
+        out << " " << n[0] << " " << n[1] << " " << n[2] << "\n";
+    }
+    out << "\n" << surface->GetNumberOfPolys() << "\n0 1 1 1 1\n\n";
+
+    vtkCellArray * polys = surface->GetPolys();
+    vtkIdType nbIndices  = 0;
+    vtkIdType npts;
+    const vtkIdType * pts;
+    for( polys->InitTraversal(); polys->GetNextCell( npts, pts ); )
+    {
+        nbIndices += npts;
+        out << " " << nbIndices;
+    }
+    out << "\n\n";
+    for( polys->InitTraversal(); polys->GetNextCell( npts, pts ); )
+    {
+        for( vtkIdType i = 0; i < npts; ++i ) out << " " << pts[i];
+    }
+    out << "\n";
+    return out.status() == QTextStream::Ok;
+}
@@ -0,0 +1,62 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef SYNTHETICDATA_H
+#define SYNTHETICDATA_H
+
+#include <vtkImageData.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+
+#include <QString>
+
+#include "ibisitkvtkconverter.h"
+
+class vtkMatrix4x4;
+
+/**
+ * @class   SyntheticData
+ * @brief   Reproducible datasets for the benchmarks
+ *
+ * Every dataset is generated from the seed and its own index only, so a volume, a frame or a pose is the same
+ * whatever the order in which the benchmarks ask for them, on every machine and between releases.
+ *
+ * The volume is a head phantom: an ellipsoid with a few inner structures and Gaussian noise, with 1 mm voxels
+ * centered on the origin. US frames are speckle with bright reflectors, taken by a probe sweeping across the
+ * phantom, see GetSweepPose().
+ */
+class SyntheticData
+{
+public:
+    static const unsigned int DefaultSeed;
+
+    SyntheticData( unsigned int seed = DefaultSeed );
+    unsigned int GetSeed() { return m_seed; }
+
+    IbisItkFloat3ImageType::Pointer CreateItkVolume( int size );
+    vtkSmartPointer<vtkImageData> CreateVolume( int size );
+    vtkSmartPointer<vtkImageData> CreateUSFrame( int index, int width, int height, int nbComponents = 1 );
+    /** Pose of frame index out of nbFrames, the probe moves 0.5 mm and tilts slightly between frames. */
+    void GetSweepPose( int index, int nbFrames, vtkMatrix4x4 * pose );
+    /** Closed surface of about 2 * resolution^2 triangles. */
+    vtkSmartPointer<vtkPolyData> CreateSurface( int resolution );
+
+    /** Files read by the FileReader benchmarks. Return false if the file can't be written. */
+    bool WriteMincVolume( const QString & filename, int size );
+    bool WriteVtkSurface( const QString & filename, int resolution );
+    bool WriteObjSurface( const QString & filename, int resolution );
+
+protected:
+    unsigned int GetSeed( unsigned int dataset, int index );
+
+    unsigned int m_seed;
+};
+
+#endif
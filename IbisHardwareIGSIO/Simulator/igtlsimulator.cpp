@@ -0,0 +1,341 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "igtlsimulator.h"
+
+#include <igtlImageMessage.h>
+#include <igtlServerSocket.h>
+#include <igtlTimeStamp.h>
+#include <igtlTransformMessage.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+namespace
+{
+const double Pi = 3.14159265358979323846;
+
+void ToIgtlMatrix( const double matrix[16], igtl::Matrix4x4 & m )
+{
+    for( int i = 0; i < 4; ++i )
+        for( int j = 0; j < 4; ++j ) m[i][j] = (float)matrix[i * 4 + j];
+}
+
+void SetTimeStamp( igtl::MessageBase * message, double timestamp )
+{
+    igtl::TimeStamp::Pointer ts = igtl::TimeStamp::New();
+    ts->SetTime( timestamp );
+    message->SetTimeStamp( ts );
+}
+}  // namespace
+
+IGTLSimulator::Settings::Settings()
+{
+    port              = 18944;
+    trackingRate      = 60.0;
+    videoRate         = 30.0;
+    jitter            = 0.0;
+    videoDelay        = 0.0;
+    packetLoss        = 0.0;
+    duration          = 0.0;
+    sendStatus        = true;
+    imageSize[0]      = 640;
+    imageSize[1]      = 480;
+    probeDeviceName   = "ProbeToReference";
+    pointerDeviceName = "StylusToReference";
+    imageDeviceName   = "Image_Reference";
+}
+
+IGTLSimulator::IGTLSimulator( const Settings & settings ) : m_settings( settings ), m_replay( false )
+{
+    m_elapsedTime           = 0.0;
+    m_sequenceDimensions[0] = 0;
+    m_sequenceDimensions[1] = 0;
+    m_sequenceSpacing[0]    = 1.0;
+    m_sequenceSpacing[1]    = 1.0;
+    m_sequenceLength        = 0;
+
+    // Speckle-like background, scrolled from frame to frame
+    int width  = m_settings.imageSize[0];
+    int height = m_settings.imageSize[1];
+    std::normal_distribution<double> speckle( 40.0, 15.0 );
+    m_speckle.resize( (size_t)width * height * 2 );
+    for( size_t i = 0; i < m_speckle.size(); ++i )
+        m_speckle[i] = (unsigned char)std::min( 255.0, std::max( 0.0, speckle( m_random ) ) );
+    m_image.resize( (size_t)width * height );
+}
+
+bool IGTLSimulator::LoadSequence( const std::string & filename, const std::string & transformName )
+{
+    // Frames are read once and kept in memory, they are flipped as given by UltrasoundImageOrientation
+    m_replay = false;
+    SequenceFile sequence;
+    if( !sequence.Open( QString::fromStdString( filename ) ) )
+        m_errorMessage = "Can't read the header of " + filename;
+    else if( sequence.GetNumberOfComponents() != 1 )
+        m_errorMessage = "Only single channel sequences are supported";
+    else if( !sequence.GetFrameMatrices( QString::fromStdString( transformName ), m_sequenceMatrices ) )
+        m_errorMessage = "Every frame must have a valid " + transformName;
+    else if( !sequence.ReadFrames( m_sequenceFrames ) )
+        m_errorMessage = "Can't read the frames of " + filename;
+    else
+    {
+        m_sequenceDimensions[0] = sequence.GetFrameWidth();
+        m_sequenceDimensions[1] = sequence.GetFrameHeight();
+        m_sequenceSpacing[0]    = sequence.GetFrameSpacing( 0 );
+        m_sequenceSpacing[1]    = sequence.GetFrameSpacing( 1 );
+        m_sequenceLength        = sequence.GetNumberOfFrames();
+        m_replay                = true;
+    }
+    return m_replay;
+}
+
+bool IGTLSimulator::Run()
+{
+    igtl::ServerSocket::Pointer server = igtl::ServerSocket::New();
+    if( server->CreateServer( m_settings.port ) < 0 )
+    {
+        m_errorMessage = "Can't listen on port " + std::to_string( m_settings.port );
+        return false;
+    }
+    std::cout << "Waiting for clients on port " << m_settings.port << std::endl;
+
+    bool streaming = true;
+    while( streaming )
+    {
+        igtl::Socket::Pointer socket = server->WaitForConnection( 1000 );
+        if( !socket ) continue;
+
+        std::cout << "Client connected" << std::endl;
+        m_statistics = Statistics();
+        streaming    = Stream( socket );
+        socket->CloseSocket();
+        std::cout << "Client disconnected: " << m_statistics.trackingMessages << " transforms and "
+                  << m_statistics.imageMessages << " images sent, " << m_statistics.droppedMessages << " dropped"
+                  << std::endl;
+    }
+    server->CloseSocket();
+    return true;
+}
+
+bool IGTLSimulator::Stream( igtl::Socket * socket )
+{
+    typedef std::chrono::steady_clock Clock;
+    const double never = std::numeric_limits<double>::infinity();
+
+    Clock::time_point start          = Clock::now();
+    igtl::TimeStamp::Pointer startTs = igtl::TimeStamp::New();
+    startTs->GetTime();
+    double startTimestamp = startTs->GetTimeStamp();
+
+    double trackingPeriod  = m_settings.trackingRate > 0.0 ? 1.0 / m_settings.trackingRate : never;
+    double videoPeriod     = m_settings.videoRate > 0.0 ? 1.0 / m_settings.videoRate : never;
+    double nextTracking    = m_settings.trackingRate > 0.0 ? 0.0 : never;
+    double nextVideo       = m_settings.videoRate > 0.0 ? 0.0 : never;
+    double lastProbeSend   = 0.0;
+    double lastPointerSend = 0.0;
+    double lastImageSend   = 0.0;
+    m_queue.clear();
+
+    while( true )
+    {
+        double time = std::chrono::duration<double>( Clock::now() - start ).count();
+        if( m_settings.duration > 0.0 && m_elapsedTime + time >= m_settings.duration )
+        {
+            m_elapsedTime += time;
+            return false;
+        }
+
+        // Acquire the samples that are due. The motion continues where the previous client left it.
+        double matrix[16];
+        while( nextTracking <= time )
+        {
+            GetProbeMatrix( m_elapsedTime + nextTracking, matrix );
+            QueueMessage( CreateTransformMessage( m_settings.probeDeviceName, matrix, startTimestamp + nextTracking ),
+                          nextTracking, lastProbeSend );
+            GetPointerMatrix( m_elapsedTime + nextTracking, matrix );
+            QueueMessage( CreateTransformMessage( m_settings.pointerDeviceName, matrix, startTimestamp + nextTracking ),
+                          nextTracking, lastPointerSend );
+            nextTracking += trackingPeriod;
+        }
+        while( nextVideo <= time )
+        {
+            QueueMessage( CreateImageMessage( m_elapsedTime + nextVideo, startTimestamp + nextVideo ),
+                          nextVideo + m_settings.videoDelay, lastImageSend );
+            nextVideo += videoPeriod;
+        }
+
+        // Send the messages that are due
+        while( !m_queue.empty() && m_queue.begin()->first <= time )
+        {
+            igtl::MessageBase * message = m_queue.begin()->second;
+            if( !socket->Send( message->GetPackPointer(), message->GetPackSize() ) )
+            {
+                m_elapsedTime += time;
+                return true;
+            }
+            if( std::string( message->GetDeviceType() ) == "IMAGE" )
+                ++m_statistics.imageMessages;
+            else
+                ++m_statistics.trackingMessages;
+            m_queue.erase( m_queue.begin() );
+        }
+
+        double next = std::min( nextTracking, nextVideo );
+        if( !m_queue.empty() ) next = std::min( next, m_queue.begin()->first );
+        if( next == never )
+            std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+        else
+            std::this_thread::sleep_until(
+                start + std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( next ) ) );
+    }
+}
+
+void IGTLSimulator::QueueMessage( igtl::MessageBase * message, double sendTime, double & lastSendTime )
+{
+    std::uniform_real_distribution<double> uniform( 0.0, 1.0 );
+    if( uniform( m_random ) < m_settings.packetLoss )
+    {
+        ++m_statistics.droppedMessages;
+        return;
+    }
+
+    // The messages of a device arrive in the order they are sent
+    sendTime     = std::max( sendTime + m_settings.jitter * uniform( m_random ), lastSendTime );
+    lastSendTime = sendTime;
+    m_queue.insert( std::make_pair( sendTime, igtl::MessageBase::Pointer( message ) ) );
+}
+
+void IGTLSimulator::GetProbeMatrix( double time, double matrix[16] )
+{
+    int frame = GetSequenceFrame( time );
+    if( frame >= 0 )
+    {
+        std::copy( &m_sequenceMatrices[(size_t)frame * 16], &m_sequenceMatrices[(size_t)frame * 16] + 16, matrix );
+        return;
+    }
+
+    // Sweep along x with the probe tilting around y, 4 s period
+    double phase = sin( 2.0 * Pi * time / 4.0 );
+    double angle = 0.3 * phase;
+    for( int i = 0; i < 16; ++i ) matrix[i] = ( i % 5 == 0 ) ? 1.0 : 0.0;
+    matrix[0]  = cos( angle );
+    matrix[2]  = sin( angle );
+    matrix[8]  = -sin( angle );
+    matrix[10] = cos( angle );
+    matrix[3]  = 50.0 * phase;
+    matrix[7]  = 20.0;
+    matrix[11] = 150.0;
+}
+
+void IGTLSimulator::GetPointerMatrix( double time, double matrix[16] )
+{
+    // Circle in the xy plane, 2 s period
+    double angle = 2.0 * Pi * time / 2.0;
+    for( int i = 0; i < 16; ++i ) matrix[i] = ( i % 5 == 0 ) ? 1.0 : 0.0;
+    matrix[3]  = 30.0 * cos( angle );
+    matrix[7]  = 30.0 * sin( angle );
+    matrix[11] = 100.0;
+}
+
+void IGTLSimulator::GetImage( double time, const unsigned char *& pixels, int dimensions[2], double spacing[2] )
+{
+    int frame = GetSequenceFrame( time );
+    if( frame >= 0 )
+    {
+        pixels        = &m_sequenceFrames[(size_t)frame * m_sequenceDimensions[0] * m_sequenceDimensions[1]];
+        dimensions[0] = m_sequenceDimensions[0];
+        dimensions[1] = m_sequenceDimensions[1];
+        spacing[0]    = m_sequenceSpacing[0];
+        spacing[1]    = m_sequenceSpacing[1];
+        return;
+    }
+
+    // Scrolling speckle with a bright interface and a disk that follows the probe sweep
+    int width  = m_settings.imageSize[0];
+    int height = m_settings.imageSize[1];
+    int scroll = (int)( time * m_settings.videoRate ) % height;
+    memcpy( m_image.data(), &m_speckle[(size_t)scroll * width], m_image.size() );
+    memset( &m_image[(size_t)( height * 3 / 10 ) * width], 220, width );
+    double phase = sin( 2.0 * Pi * time / 4.0 );
+    int cx       = (int)( width * ( 0.5 - 0.3 * phase ) );
+    int cy       = height / 2;
+    int radius   = height / 8;
+    for( int y = std::max( 0, cy - radius ); y < std::min( height, cy + radius ); ++y )
+        for( int x = std::max( 0, cx - radius ); x < std::min( width, cx + radius ); ++x )
+            if( ( x - cx ) * ( x - cx ) + ( y - cy ) * ( y - cy ) < radius * radius )
+                m_image[(size_t)y * width + x] = 180;
+
+    pixels        = m_image.data();
+    dimensions[0] = width;
+    dimensions[1] = height;
+    spacing[0]    = 0.2;
+    spacing[1]    = 0.2;
+}
+
+int IGTLSimulator::GetSequenceFrame( double time )
+{
+    if( !m_replay ) return -1;
+    double rate = m_settings.videoRate > 0.0 ? m_settings.videoRate : m_settings.trackingRate;
+    return (int)( time * rate ) % m_sequenceLength;
+}
+
+igtl::MessageBase::Pointer IGTLSimulator::CreateTransformMessage( const std::string & deviceName,
+                                                                  const double matrix[16], double timestamp )
+{
+    igtl::TransformMessage::Pointer message = igtl::TransformMessage::New();
+    SetStatus( message );
+    message->SetDeviceName( deviceName );
+    igtl::Matrix4x4 m;
+    ToIgtlMatrix( matrix, m );
+    message->SetMatrix( m );
+    SetTimeStamp( message, timestamp );
+    message->Pack();
+    return message.GetPointer();
+}
+
+igtl::MessageBase::Pointer IGTLSimulator::CreateImageMessage( double time, double timestamp )
+{
+    const unsigned char * pixels = nullptr;
+    int dimensions[2];
+    double spacing[2];
+    GetImage( time, pixels, dimensions, spacing );
+    double matrix[16];
+    GetProbeMatrix( time, matrix );
+
+    igtl::ImageMessage::Pointer message = igtl::ImageMessage::New();
+    SetStatus( message );
+    message->SetDeviceName( m_settings.imageDeviceName );
+    message->SetDimensions( dimensions[0], dimensions[1], 1 );
+    message->SetSpacing( (float)spacing[0], (float)spacing[1], 1.0f );
+    message->SetScalarType( igtl::ImageMessage::TYPE_UINT8 );
+    message->SetNumComponents( 1 );
+    igtl::Matrix4x4 m;
+    ToIgtlMatrix( matrix, m );
+    message->SetMatrix( m );
+    message->AllocateScalars();
+    memcpy( message->GetScalarPointer(), pixels, message->GetImageSize() );
+    SetTimeStamp( message, timestamp );
+    message->Pack();
+    return message.GetPointer();
+}
+
+void IGTLSimulator::SetStatus( igtl::MessageBase * message )
+{
+    // Metadata requires a version 2 header
+    if( !m_settings.sendStatus ) return;
+    message->SetHeaderVersion( IGTL_HEADER_VERSION_2 );
+    message->SetMetaDataElement( "Status", IANA_TYPE_US_ASCII, "OK" );
+}
@@ -0,0 +1,106 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef IGTLSIMULATOR_H
+#define IGTLSIMULATOR_H
+
+#include <igtlMessageBase.h>
+#include <igtlSocket.h>
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sequencefile.h"
+
+/**
+ * @class   IGTLSimulator
+ * @brief   OpenIGTLink server that streams a tracked US probe, a pointer and B-mode images
+ *
+ * Stands in for a Plus server so that IbisHardwareIGSIO, the tracked video pipeline and US acquisitions can
+ * be tested without hardware. Poses and images are synthetic, or replayed from a .igs.mha sequence.
+ *
+ * Samples are timestamped when they are acquired, at the tracking and video rates, then sent after a random
+ * delay of up to Jitter seconds (plus VideoDelay for images) to reproduce network and frame grabber latency.
+ * A fraction PacketLoss of the messages is dropped. Messages of a device are always sent in order.
+ */
+class IGTLSimulator
+{
+public:
+    struct Settings
+    {
+        Settings();
+        int port;
+        double trackingRate;  // Hz
+        double videoRate;     // Hz
+        double jitter;        // s
+        double videoDelay;    // s
+        double packetLoss;    // fraction of messages dropped, in [0, 1]
+        double duration;      // s, 0 to stream until the process is killed
+        bool sendStatus;      // Status metadata in the messages (OpenIGTLink v2 header)
+        int imageSize[2];     // synthetic images
+        std::string probeDeviceName;
+        std::string pointerDeviceName;
+        std::string imageDeviceName;
+    };
+
+    IGTLSimulator( const Settings & settings );
+
+    // Replay the frames and probe transforms of a sequence instead of synthetic ones
+    bool LoadSequence( const std::string & filename, const std::string & transformName );
+    const std::string & GetErrorMessage() const { return m_errorMessage; }
+
+    // Wait for clients and stream to them one at a time until Duration has elapsed
+    bool Run();
+
+protected:
+    typedef std::multimap<double, igtl::MessageBase::Pointer> MessageQueue;
+
+    struct Statistics
+    {
+        Statistics() : trackingMessages( 0 ), imageMessages( 0 ), droppedMessages( 0 ) {}
+        int trackingMessages;
+        int imageMessages;
+        int droppedMessages;
+    };
+
+    // Return false when the client disconnects or Duration has elapsed
+    bool Stream( igtl::Socket * socket );
+    void QueueMessage( igtl::MessageBase * message, double sendTime, double & lastSendTime );
+
+    void GetProbeMatrix( double time, double matrix[16] );
+    void GetPointerMatrix( double time, double matrix[16] );
+    void GetImage( double time, const unsigned char *& pixels, int dimensions[2], double spacing[2] );
+    int GetSequenceFrame( double time );
+
+    igtl::MessageBase::Pointer CreateTransformMessage( const std::string & deviceName, const double matrix[16],
+                                                       double timestamp );
+    igtl::MessageBase::Pointer CreateImageMessage( double time, double timestamp );
+    void SetStatus( igtl::MessageBase * message );
+
+    Settings m_settings;
+    // Replayed sequence: frames and 16 elements per frame of the probe matrices, row major
+    std::vector<unsigned char> m_sequenceFrames;
+    std::vector<double> m_sequenceMatrices;
+    int m_sequenceDimensions[2];
+    double m_sequenceSpacing[2];
+    int m_sequenceLength;
+    bool m_replay;
+    std::vector<unsigned char> m_speckle;  // synthetic image background, twice the image height
+    std::vector<unsigned char> m_image;
+    std::mt19937 m_random;
+    MessageQueue m_queue;
+    Statistics m_statistics;
+    double m_elapsedTime;  // s, streaming time of the previous clients
+    std::string m_errorMessage;
+};
+
+#endif
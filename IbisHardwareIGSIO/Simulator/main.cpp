@@ -0,0 +1,97 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <csignal>
+#include <iostream>
+
+#include "igtlsimulator.h"
+
+int main( int argc, char ** argv )
+{
+    QCoreApplication app( argc, argv );
+    QCoreApplication::setApplicationName( "ibis-igtl-simulator" );
+
+#ifndef _WIN32
+    // A client closing its connection must not kill the simulator
+    signal( SIGPIPE, SIG_IGN );
+#endif
+
+    IGTLSimulator::Settings defaults;
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+        "OpenIGTLink server streaming a tracked US probe, a pointer and B-mode images to test Ibis without "
+        "tracking or imaging hardware. Images and probe poses are synthetic unless a sequence is replayed." );
+    parser.addHelpOption();
+    QCommandLineOption portOption( "port", "Server port.", "port", QString::number( defaults.port ) );
+    QCommandLineOption trackingRateOption( "tracking-rate", "Transform rate in Hz, 0 to disable.", "hz",
+                                           QString::number( defaults.trackingRate ) );
+    QCommandLineOption videoRateOption( "video-rate", "Image rate in Hz, 0 to disable.", "hz",
+                                        QString::number( defaults.videoRate ) );
+    QCommandLineOption jitterOption( "jitter", "Maximum random delay of the messages in ms.", "ms", "0" );
+    QCommandLineOption videoDelayOption( "video-delay", "Delay between image timestamps and sending in ms.", "ms",
+                                         "0" );
+    QCommandLineOption lossOption( "packet-loss", "Fraction of messages dropped, between 0 and 1.", "fraction",
+                                   "0" );
+    QCommandLineOption durationOption( "duration", "Streaming time in s, 0 to stream until killed.", "s", "0" );
+    QCommandLineOption noStatusOption( "no-status", "Don't send the Status metadata, Ibis then derives the tool "
+                                                    "status from the timestamps." );
+    QCommandLineOption imageSizeOption( "image-size", "Size of the synthetic images.", "WxH", "640x480" );
+    QCommandLineOption sequenceOption( "sequence", "Replay the frames and probe poses of a .igs.mha file.", "file" );
+    QCommandLineOption sequenceTransformOption( "sequence-transform", "Per-frame probe transform of the sequence.",
+                                                "name", "ProbeToReferenceTransform" );
+    QCommandLineOption probeOption( "probe-device", "Device name of the probe transforms.", "name",
+                                    QString::fromStdString( defaults.probeDeviceName ) );
+    QCommandLineOption pointerOption( "pointer-device", "Device name of the pointer transforms.", "name",
+                                      QString::fromStdString( defaults.pointerDeviceName ) );
+    QCommandLineOption imageOption( "image-device", "Device name of the images.", "name",
+                                    QString::fromStdString( defaults.imageDeviceName ) );
+    parser.addOptions( { portOption, trackingRateOption, videoRateOption, jitterOption, videoDelayOption, lossOption,
+                         durationOption, noStatusOption, imageSizeOption, sequenceOption, sequenceTransformOption,
+                         probeOption, pointerOption, imageOption } );
+    parser.process( app );
+
+    IGTLSimulator::Settings settings;
+    settings.port              = parser.value( portOption ).toInt();
+    settings.trackingRate      = parser.value( trackingRateOption ).toDouble();
+    settings.videoRate         = parser.value( videoRateOption ).toDouble();
+    settings.jitter            = parser.value( jitterOption ).toDouble() / 1000.0;
+    settings.videoDelay        = parser.value( videoDelayOption ).toDouble() / 1000.0;
+    settings.packetLoss        = parser.value( lossOption ).toDouble();
+    settings.duration          = parser.value( durationOption ).toDouble();
+    settings.sendStatus        = !parser.isSet( noStatusOption );
+    settings.probeDeviceName   = parser.value( probeOption ).toStdString();
+    settings.pointerDeviceName = parser.value( pointerOption ).toStdString();
+    settings.imageDeviceName   = parser.value( imageOption ).toStdString();
+    QStringList imageSize      = parser.value( imageSizeOption ).split( 'x' );
+    if( imageSize.size() != 2 || imageSize[0].toInt() <= 0 || imageSize[1].toInt() <= 0 )
+    {
+        std::cerr << "Invalid image size: " << parser.value( imageSizeOption ).toStdString() << std::endl;
+        return 1;
+    }
+    settings.imageSize[0] = imageSize[0].toInt();
+    settings.imageSize[1] = imageSize[1].toInt();
+
+    IGTLSimulator simulator( settings );
+    if( parser.isSet( sequenceOption ) &&
+        !simulator.LoadSequence( parser.value( sequenceOption ).toStdString(),
+                                 parser.value( sequenceTransformOption ).toStdString() ) )
+    {
+        std::cerr << "Can't load sequence: " << simulator.GetErrorMessage() << std::endl;
+        return 1;
+    }
+    if( !simulator.Run() )
+    {
+        std::cerr << simulator.GetErrorMessage() << std::endl;
+        return 1;
+    }
+    return 0;
+}
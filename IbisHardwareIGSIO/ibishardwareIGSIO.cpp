@@ -10,15 +10,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 =========================================================================*/
 #include "ibishardwareIGSIO.h"
 
-#include <igtlioImageConverter.h>
-#include <igtlioImageDevice.h>
 #include <igtlioLogic.h>
-#include <igtlioStatusDevice.h>
-#include <igtlioTransformConverter.h>
-#include <igtlioTransformDevice.h>
-#include <igtlioVideoConverter.h>
-#include <igtlioVideoDevice.h>
-#include <vtkEventQtSlotConnect.h>
 #include <vtkImageData.h>
 #include <vtkPLYReader.h>
 #include <vtkTimerLog.h>
@@ -33,25 +25,22 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "configio.h"
 #include "ibisapi.h"
 #include "ibishardwareIGSIOsettingswidget.h"
+#include "igsioreceiver.h"
 #include "logger.h"
 #include "plusserverinterface.h"
 #include "pointerobject.h"
 #include "polydataobject.h"
 #include "qIGTLIOClientWidget.h"
-#include "qIGTLIOLogicController.h"
 #include "usprobeobject.h"
 
-#undef SendMessage
-
 const double IbisHardwareIGSIO::MaxTimeBetweenTransformSamples = 0.2;
 const QString IbisHardwareIGSIO::PlusServerExecutable          = "PlusServerExecutable";
 
 IbisHardwareIGSIO::IbisHardwareIGSIO()
 {
-    m_logicController           = nullptr;
     m_logic                     = nullptr;
+    m_receiver                  = nullptr;
     m_clientWidget              = nullptr;
-    m_logicCallbacks            = vtkSmartPointer<vtkEventQtSlotConnect>::New();
     m_settingsWidget            = nullptr;
     m_autoStartLastConfig       = false;
     m_currentIbisPlusConfigFile = "";
@@ -80,13 +69,10 @@ void IbisHardwareIGSIO::AddSettingsMenuEntries( QMenu * menu )
 
 void IbisHardwareIGSIO::Init()
 {
-    m_logicController = new qIGTLIOLogicController;
-    m_logic           = vtkSmartPointer<igtlioLogic>::New();
-    m_logicController->setLogic( m_logic );
-    m_logicCallbacks->Connect( m_logic, igtlioLogic::NewDeviceEvent, this,
-                               SLOT( OnDeviceNew( vtkObject *, unsigned long, void *, void * ) ) );
-    m_logicCallbacks->Connect( m_logic, igtlioLogic::RemovedDeviceEvent, this,
-                               SLOT( OnDeviceRemoved( vtkObject *, unsigned long, void *, void * ) ) );
+    // The logic is processed by the receiver thread rather than by a qIGTLIOLogicController on the GUI thread
+    m_logic    = vtkSmartPointer<igtlioLogic>::New();
+    m_receiver = new IGSIOReceiver( m_logic );
+    m_receiver->start();
 
     // Initialize with last config file
     if( m_autoStartLastConfig ) StartConfig( m_lastIbisPlusConfigFile );
@@ -103,6 +89,7 @@ void IbisHardwareIGSIO::StartConfig( QString configFile )
     m_currentIbisPlusConfigFile = configFile;
 
     // Instanciate Ibis scene objects specified in config file
+    QStringList toolNames;
     for( int i = 0; i < in.GetNumberOfTools(); ++i )
     {
         Tool * newTool       = new Tool;
@@ -110,12 +97,14 @@ void IbisHardwareIGSIO::StartConfig( QString configFile )
         newTool->toolModel   = InstanciateToolModel( in.GetToolModelFile( i ) );
         ReadToolConfig( in.GetToolParamFile( i ), newTool->sceneObject );
         m_tools.append( newTool );
+        toolNames.append( newTool->sceneObject->GetName() );
         GetIbisAPI()->AddObject( newTool->sceneObject );
         if( newTool->toolModel ) GetIbisAPI()->AddObject( newTool->toolModel, newTool->sceneObject );
     }
 
     // Keep track of Plus device to Ibis tool association
     m_deviceToolAssociations = in.GetAssociations();
+    m_receiver->SetTools( toolNames, m_deviceToolAssociations );
 
     // Try to launch or connect with all servers in the config file or connect to existing servers
     for( int i = 0; i < in.GetNumberOfServers(); ++i )
@@ -127,7 +116,7 @@ void IbisHardwareIGSIO::StartConfig( QString configFile )
         }
 
         // Now try to connect to server
-        Connect( in.GetServerIPAddress( i ), in.GetServerPort( i ), in.GetConnectAuto( i ) );
+        m_receiver->Connect( in.GetServerIPAddress( i ), in.GetServerPort( i ), in.GetConnectAuto( i ) );
     }
 
     m_lastIbisPlusConfigFile = configFile;
@@ -138,7 +127,11 @@ void IbisHardwareIGSIO::ClearConfig()
     m_log->ClearLog();
     m_currentIbisPlusConfigFile.clear();
     RemoveToolObjectsFromScene();
-    DisconnectAllServers();
+    if( m_receiver )
+    {
+        m_receiver->DisconnectAllServers();
+        m_receiver->ClearTools();
+    }
     foreach( Tool * tool, m_tools )
     {
         delete tool;
@@ -150,31 +143,30 @@ void IbisHardwareIGSIO::ClearConfig()
 
 void IbisHardwareIGSIO::Update()
 {
-    // Update everything
-    m_logic->PeriodicProcess();
-
-    // Push images, transforms and states to the TrackedSceneObjects
-    foreach( Tool * tool, m_tools )
+    // Push the latest images, transforms and states decoded by the receiver thread to the TrackedSceneObjects
+    for( int i = 0; i < m_tools.size(); ++i )
     {
-        if( tool->transformDevice )
+        Tool * tool                          = m_tools[i];
+        IGSIOReceiver::ToolChannel * channel = m_receiver->GetToolChannel( i );
+        if( channel->hasTransformDevice )
         {
-            if( tool->transformDevice->GetDeviceType() == igtlioImageConverter::GetIGTLTypeName() )
-            {
-                igtlioImageDevice * imageDevice = igtlioImageDevice::SafeDownCast( tool->transformDevice );
-                tool->sceneObject->SetInputMatrix( imageDevice->GetContent().transform );
-            }
-            else if( tool->transformDevice->GetDeviceType() == igtlioTransformConverter::GetIGTLTypeName() )
+            // Every sample goes to the pose history so that video frames can be paired with the pose at their timestamp
+            bool newTransform = false;
+            while( channel->transforms.Pop( tool->lastTransform ) )
             {
-                igtlioTransformDevice * transformDevice = igtlioTransformDevice::SafeDownCast( tool->transformDevice );
-                tool->sceneObject->SetInputMatrix( transformDevice->GetContent().transform );
+                tool->inputMatrix->DeepCopy( tool->lastTransform.matrix );
+                TrackerToolState state = tool->lastTransform.hasStatus ? tool->lastTransform.state : Ok;
+                tool->sceneObject->AddPoseSample( tool->inputMatrix, tool->lastTransform.timestamp, state );
+                newTransform = true;
             }
-            tool->sceneObject->SetTimestamp( tool->transformDevice->GetTimestamp() );
-            tool->sceneObject->SetState( ComputeToolStatus( tool->transformDevice, tool ) );
+            if( newTransform ) tool->sceneObject->SetInputMatrix( tool->inputMatrix );
+            tool->sceneObject->SetTimestamp( tool->lastTransform.timestamp );
+            tool->sceneObject->SetState( ComputeToolStatus( tool ) );
         }
-        if( tool->imageDevice )
+        IGSIOReceiver::ImageSample image;
+        if( channel->images.Pop( image ) )
         {
-            // simtodo : We should not have to do this every frame. Check UsProbeObject and CameraObject pipeline logic.
-            AssignDeviceImageToTool( tool->imageDevice, tool );
+            AssignImageToTool( image.image, image.timestamp, tool );
         }
         tool->sceneObject->MarkModified();
     }
@@ -185,8 +177,10 @@ bool IbisHardwareIGSIO::ShutDown()
     WriteToolConfig();
     ClearConfig();
 
-    delete m_logicController;
-    m_logicController           = nullptr;
+    // The settings widget observes the logic
+    if( m_clientWidget ) m_clientWidget->close();
+    delete m_receiver;
+    m_receiver                  = nullptr;
     m_logic                     = nullptr;
     m_currentIbisPlusConfigFile = "";
 
@@ -228,6 +222,9 @@ void IbisHardwareIGSIO::OpenSettingsWidget()
 {
     if( !m_clientWidget )
     {
+        if( !m_receiver ) return;
+        // Diagnostic view: it observes the logic, messages are processed on the GUI thread while it is open
+        m_receiver->SetProcessOnGuiThread( true );
         m_clientWidget = new qIGTLIOClientWidget;
         m_clientWidget->setLogic( m_logic );
         m_clientWidget->setGeometry( 0, 0, 859, 811 );
@@ -239,7 +236,11 @@ void IbisHardwareIGSIO::OpenSettingsWidget()
     m_clientWidget->show();
 }
 
-void IbisHardwareIGSIO::OnSettingsWidgetClosed() { m_clientWidget = nullptr; }
+void IbisHardwareIGSIO::OnSettingsWidgetClosed()
+{
+    m_clientWidget = nullptr;
+    if( m_receiver ) m_receiver->SetProcessOnGuiThread( false );
+}
 
 void IbisHardwareIGSIO::OpenConfigFileWidget()
 {
@@ -255,53 +256,6 @@ void IbisHardwareIGSIO::OpenConfigFileWidget()
 
 void IbisHardwareIGSIO::OnConfigFileWidgetClosed() { m_settingsWidget = nullptr; }
 
-void IbisHardwareIGSIO::OnDeviceNew( vtkObject *, unsigned long, void *, void * callData )
-{
-    igtlioDevicePointer device = reinterpret_cast<igtlioDevice *>( callData );
-    QString toolName, toolPart;
-    QString deviceName( device->GetDeviceName().c_str() );
-    std::cout << "New device: " << deviceName.toUtf8().data() << std::endl;
-    m_deviceToolAssociations.ToolAndPartFromDevice( deviceName, toolName, toolPart );
-    if( toolName.isEmpty() ) return;
-    int toolIndex = FindToolByName( toolName );
-    if( toolIndex == -1 ) return;
-
-    std::cout << "----> Connected to tool ( " << toolName.toUtf8().data() << " ), part ( " << toolPart.toUtf8().data()
-              << " )" << std::endl;
-
-    // Assign image data of new device to the video input of the scene object
-    if( toolPart == "ImageAndTransform" || toolPart == "Image" )
-    {
-        AssignDeviceImageToTool( device, m_tools[toolIndex] );
-        m_tools[toolIndex]->imageDevice = device;
-    }
-
-    // Specify the device should be used to recover transform on every update
-    if( toolPart == "ImageAndTransform" || toolPart == "Transform" )
-    {
-        m_tools[toolIndex]->transformDevice = device;
-    }
-}
-
-void IbisHardwareIGSIO::OnDeviceRemoved( vtkObject *, unsigned long, void *, void * callData )
-{
-    igtlioDevice * device = reinterpret_cast<igtlioDevice *>( callData );
-    QString toolName, toolPart;
-    m_deviceToolAssociations.ToolAndPartFromDevice( QString( device->GetDeviceName().c_str() ), toolName, toolPart );
-    if( toolName.isEmpty() ) return;
-    int toolIndex = FindToolByName( toolName );
-    if( toolIndex == -1 ) return;
-
-    if( toolPart == "ImageAndTransform" )
-    {
-        m_tools[toolIndex]->imageDevice = nullptr;
-    }
-    else if( toolPart == "Transform" )
-    {
-        m_tools[toolIndex]->transformDevice = nullptr;
-    }
-}
-
 void IbisHardwareIGSIO::InitPlugin()
 {
     // Look for the Plus Toolkit path and Plus Server executable
@@ -347,49 +301,6 @@ bool IbisHardwareIGSIO::LaunchLocalServer( QString plusConfigFile )
     return didLaunch;
 }
 
-void IbisHardwareIGSIO::Connect( std::string ip, int port, bool start )
-{
-    igtlioConnectorPointer c = m_logic->CreateConnector();
-    c->SetTypeClient( ip, port );
-    if( start )
-    {
-        c->Start();
-    }
-    m_logicCallbacks->Connect( c, igtlioConnector::ConnectedEvent, this,
-                               SLOT( OnConnectionEstablished( vtkObject *, unsigned long, void *, void * ) ) );
-}
-
-void IbisHardwareIGSIO::OnConnectionEstablished( vtkObject * caller, unsigned long, void *, void * )
-{
-    // send a dummy message with metadata to force v2 message exchange
-    igtlioConnectorPointer connector = reinterpret_cast<igtlioConnector *>( caller );
-    igtlioDeviceKeyType key;
-    key.name                                         = "";
-    key.type                                         = "STATUS";
-    vtkSmartPointer<igtlioStatusDevice> statusDevice = igtlioStatusDevice::SafeDownCast( connector->GetDevice( key ) );
-    if( !statusDevice )
-    {
-        statusDevice = vtkSmartPointer<igtlioStatusDevice>::New();
-        connector->AddDevice( statusDevice );
-    }
-
-    statusDevice->SetMetaDataElement(
-        "dummy", "dummy" );  // existence of metadata makes the IO connector send a header v2 message
-    connector->SendMessage( igtlioDeviceKeyType::CreateDeviceKey( statusDevice ) );
-    connector->RemoveDevice( statusDevice );
-}
-
-void IbisHardwareIGSIO::DisconnectAllServers()
-{
-    for( int i = 0; i < m_logic->GetNumberOfConnectors(); ++i )
-    {
-        m_logic->GetConnector( static_cast<unsigned>( i ) )->Stop();
-    }
-
-    // Clear all connectors
-    while( m_logic->GetNumberOfConnectors() > 0 ) m_logic->RemoveConnector( 0 );
-}
-
 void IbisHardwareIGSIO::ShutDownLocalServers()
 {
     for( int i = 0; i < m_plusLaunchers.size(); ++i )
@@ -399,39 +310,13 @@ void IbisHardwareIGSIO::ShutDownLocalServers()
     m_plusLaunchers.clear();
 }
 
-TrackerToolState StatusStringToState( const std::string & status )
-{
-    QString qstatus( status.c_str() );
-    if( qstatus.toUpper().toStdString() == "OK" ) return Ok;
-    if( qstatus.toUpper().toStdString() == "OUTOFVIEW" ) return OutOfView;
-    if( qstatus.toUpper().toStdString() == "OUTOFVOLUME" ) return OutOfVolume;
-    if( qstatus.toUpper().toStdString() == "HIGHERROR" ) return HighError;
-    if( qstatus.toUpper().toStdString() == "DISABLED" ) return Disabled;
-    if( qstatus.toUpper().toStdString() == "MISSING" ) return Missing;
-    return Undefined;
-}
-
-std::string GetMetaData( igtlioDevicePointer dev, const std::string & key )
+TrackerToolState IbisHardwareIGSIO::ComputeToolStatus( Tool * t )
 {
-    for( igtl::MessageBase::MetaDataMap::const_iterator iter = dev->GetMetaData().begin();
-         iter != dev->GetMetaData().end(); ++iter )
-    {
-        if( iter->first.find( key ) != std::string::npos )
-        {
-            return iter->second.second.c_str();
-        }
-    }
-    return std::string( "" );
-}
-
-TrackerToolState IbisHardwareIGSIO::ComputeToolStatus( igtlioDevicePointer dev, Tool * t )
-{
-    // First, try to find a status in the metadata
-    std::string statusString = GetMetaData( dev, "Status" );
-    if( !statusString.empty() ) return StatusStringToState( statusString );
+    // First, use the status found in the metadata
+    if( t->lastTransform.hasStatus ) return t->lastTransform.state;
 
     // If status is not found in metadata, use timestamps to guess
-    double newTimeStamp   = dev->GetTimestamp();
+    double newTimeStamp   = t->lastTransform.timestamp;
     bool timeStampChanged = newTimeStamp > t->lastTimeStamp;
     double now            = vtkTimerLog::GetUniversalTime();
     if( timeStampChanged )
@@ -445,33 +330,8 @@ TrackerToolState IbisHardwareIGSIO::ComputeToolStatus( igtlioDevicePointer dev,
     return Missing;
 }
 
-int IbisHardwareIGSIO::FindToolByName( QString name )
-{
-    for( int i = 0; i < m_tools.size(); ++i )
-        if( m_tools[i]->sceneObject->GetName() == name ) return i;
-    return -1;
-}
-
-void IbisHardwareIGSIO::AssignDeviceImageToTool( igtlioDevicePointer device, Tool * tool )
+void IbisHardwareIGSIO::AssignImageToTool( vtkImageData * imageContent, double timestamp, Tool * tool )
 {
-    vtkImageData * imageContent = nullptr;
-    if( IsDeviceImage( device ) )
-    {
-        igtlioImageDevicePointer imageDev = igtlioImageDevice::SafeDownCast( device );
-        if( !( imageDev->GetContent().image == nullptr ) )
-        {
-            imageContent = imageDev->GetContent().image;
-            // OpenIGTLink specifications has origin as center of image
-            double origin[3] = { 0., 0., 0. };
-            imageContent->SetOrigin( origin );
-        }
-    }
-    else if( IsDeviceVideo( device ) )
-    {
-        igtlioVideoDevicePointer videoDev = igtlioVideoDevice::SafeDownCast( device );
-        imageContent                      = videoDev->GetContent().image;
-    }
-
     if( tool->sceneObject->IsA( "CameraObject" ) )
     {
         vtkSmartPointer<CameraObject> cam = CameraObject::SafeDownCast( tool->sceneObject );
@@ -480,7 +340,7 @@ void IbisHardwareIGSIO::AssignDeviceImageToTool( igtlioDevicePointer device, Too
     else if( tool->sceneObject->IsA( "UsProbeObject" ) )
     {
         vtkSmartPointer<UsProbeObject> probe = UsProbeObject::SafeDownCast( tool->sceneObject );
-        probe->SetVideoInputData( imageContent );
+        probe->SetVideoInputData( imageContent, timestamp );
     }
 }
 
@@ -548,21 +408,6 @@ void IbisHardwareIGSIO::ReadToolConfig( QString filename, vtkSmartPointer<Tracke
     reader.Finish();
 }
 
-bool IbisHardwareIGSIO::IsDeviceImage( igtlioDevicePointer device )
-{
-    return device->GetDeviceType() == igtlioImageConverter::GetIGTLTypeName();
-}
-
-bool IbisHardwareIGSIO::IsDeviceTransform( igtlioDevicePointer device )
-{
-    return device->GetDeviceType() == igtlioTransformConverter::GetIGTLTypeName();
-}
-
-bool IbisHardwareIGSIO::IsDeviceVideo( igtlioDevicePointer device )
-{
-    return device->GetDeviceType() == igtlioVideoConverter::GetIGTLTypeName();
-}
-
 void IbisHardwareIGSIO::WriteToolConfig()
 {
     QString configFilePath = m_ibisPlusConfigFilesDirectory + m_currentIbisPlusConfigFile;
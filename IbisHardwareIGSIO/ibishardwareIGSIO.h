@@ -11,19 +11,18 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #ifndef IBISHARDWAREIGSIO_H
 #define IBISHARDWAREIGSIO_H
 
-#include <igtlioDevice.h>
+#include <vtkMatrix4x4.h>
 
 #include "configio.h"
 #include "hardwaremodule.h"
+#include "igsioreceiver.h"
 
 class igtlioLogic;
-class igtlioConnector;
+class IGSIOReceiver;
 
 class QMenu;
-class qIGTLIOLogicController;
 class qIGTLIOClientWidget;
 class PlusServerInterface;
-class vtkEventQtSlotConnect;
 class IbisHardwareIGSIOSettingsWidget;
 class PolyDataObject;
 class Logger;
@@ -87,30 +86,28 @@ private slots:
     void OnSettingsWidgetClosed();
     void OpenConfigFileWidget();
     void OnConfigFileWidgetClosed();
-    void OnDeviceNew( vtkObject *, unsigned long, void *, void * );
-    void OnDeviceRemoved( vtkObject *, unsigned long, void *, void * );
-    void OnConnectionEstablished( vtkObject *, unsigned long, void *, void * );
 
 protected:
     virtual void InitPlugin() override;
 
     // Launch a Plus server and connect
     bool LaunchLocalServer( QString plusConfigFile );
-    void Connect( std::string ip, int port, bool start );
-    void DisconnectAllServers();
     void ShutDownLocalServers();
 
     struct Tool
     {
         Tool()
         {
+            inputMatrix               = vtkSmartPointer<vtkMatrix4x4>::New();
             lastTimeStamp             = 0.0;
             lastTimeStampModifiedTime = 0.0;
         }
         vtkSmartPointer<TrackedSceneObject> sceneObject;
         vtkSmartPointer<PolyDataObject> toolModel;
-        igtlioDevicePointer transformDevice;
-        igtlioDevicePointer imageDevice;
+        vtkSmartPointer<vtkMatrix4x4> inputMatrix;
+
+        // last sample received from the receiver thread
+        IGSIOReceiver::TransformSample lastTransform;
 
         // timestamps used to compute tool status when not in Metadata
         double lastTimeStamp;              // The timestamp of the last message we received
@@ -120,15 +117,11 @@ protected:
     toolList m_tools;
 
     // Utility functions
-    TrackerToolState ComputeToolStatus( igtlioDevicePointer dev, Tool * t );
-    int FindToolByName( QString name );
-    void AssignDeviceImageToTool( igtlioDevicePointer device, Tool * tool );
+    TrackerToolState ComputeToolStatus( Tool * t );
+    void AssignImageToTool( vtkImageData * image, double timestamp, Tool * tool );
     TrackedSceneObject * InstanciateSceneObjectFromType( QString objectName, QString objectType );
     vtkSmartPointer<PolyDataObject> InstanciateToolModel( QString filename );
     void ReadToolConfig( QString filename, vtkSmartPointer<TrackedSceneObject> tool );
-    bool IsDeviceImage( igtlioDevicePointer device );
-    bool IsDeviceTransform( igtlioDevicePointer device );
-    bool IsDeviceVideo( igtlioDevicePointer device );
 
     void WriteToolConfig();
     void InternalWriteToolConfig( QString, Tool * );
@@ -136,9 +129,9 @@ protected:
     DeviceToolMap m_deviceToolAssociations;
 
     vtkSmartPointer<igtlioLogic> m_logic;
-    vtkSmartPointer<vtkEventQtSlotConnect> m_logicCallbacks;
+    // Processes the messages of the connectors, the logic is only accessed through it
+    IGSIOReceiver * m_receiver;
     QList<vtkSmartPointer<PlusServerInterface> > m_plusLaunchers;
-    qIGTLIOLogicController * m_logicController;
 
     bool m_autoStartLastConfig;
 
@@ -0,0 +1,347 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "igsioreceiver.h"
+
+#include <igtlioConnector.h>
+#include <igtlioImageConverter.h>
+#include <igtlioImageDevice.h>
+#include <igtlioLogic.h>
+#include <igtlioStatusDevice.h>
+#include <igtlioTransformConverter.h>
+#include <igtlioTransformDevice.h>
+#include <igtlioVideoConverter.h>
+#include <igtlioVideoDevice.h>
+#include <vtkCallbackCommand.h>
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+
+#include <QMutexLocker>
+#include <QTimer>
+#include <iostream>
+
+#undef SendMessage
+
+namespace
+{
+const unsigned TransformRingCapacity = 256;
+
+bool IsDeviceImage( igtlioDevice * device )
+{
+    return device->GetDeviceType() == igtlioImageConverter::GetIGTLTypeName();
+}
+
+bool IsDeviceTransform( igtlioDevice * device )
+{
+    return device->GetDeviceType() == igtlioTransformConverter::GetIGTLTypeName();
+}
+
+bool IsDeviceVideo( igtlioDevice * device )
+{
+    return device->GetDeviceType() == igtlioVideoConverter::GetIGTLTypeName();
+}
+
+TrackerToolState StatusStringToState( const std::string & status )
+{
+    QString qstatus( status.c_str() );
+    if( qstatus.toUpper().toStdString() == "OK" ) return Ok;
+    if( qstatus.toUpper().toStdString() == "OUTOFVIEW" ) return OutOfView;
+    if( qstatus.toUpper().toStdString() == "OUTOFVOLUME" ) return OutOfVolume;
+    if( qstatus.toUpper().toStdString() == "HIGHERROR" ) return HighError;
+    if( qstatus.toUpper().toStdString() == "DISABLED" ) return Disabled;
+    if( qstatus.toUpper().toStdString() == "MISSING" ) return Missing;
+    return Undefined;
+}
+
+std::string GetMetaData( igtlioDevice * dev, const std::string & key )
+{
+    for( igtl::MessageBase::MetaDataMap::const_iterator iter = dev->GetMetaData().begin();
+         iter != dev->GetMetaData().end(); ++iter )
+    {
+        if( iter->first.find( key ) != std::string::npos )
+        {
+            return iter->second.second.c_str();
+        }
+    }
+    return std::string( "" );
+}
+}  // namespace
+
+IGSIOReceiver::ToolChannel::ToolChannel( const QString & name )
+    : toolName( name ),
+      transforms( TransformRingCapacity ),
+      hasTransformDevice( false ),
+      transformMTime( 0 ),
+      imageMTime( 0 )
+{
+}
+
+IGSIOReceiver::IGSIOReceiver( igtlioLogic * logic, QObject * parent ) : QThread( parent ), m_logic( logic )
+{
+    m_stop           = false;
+    m_pollInterval   = 1;
+    m_guiThreadTimer = new QTimer( this );
+    connect( m_guiThreadTimer, SIGNAL( timeout() ), this, SLOT( ProcessMessages() ) );
+
+    m_logicCallback = vtkSmartPointer<vtkCallbackCommand>::New();
+    m_logicCallback->SetCallback( LogicEventCallback );
+    m_logicCallback->SetClientData( this );
+    m_logic->AddObserver( igtlioLogic::NewDeviceEvent, m_logicCallback );
+    m_logic->AddObserver( igtlioLogic::RemovedDeviceEvent, m_logicCallback );
+}
+
+IGSIOReceiver::~IGSIOReceiver()
+{
+    Stop();
+    m_guiThreadTimer->stop();
+    ClearTools();
+    QMutexLocker lock( &m_logicMutex );
+    m_logic->RemoveObserver( m_logicCallback );
+}
+
+void IGSIOReceiver::Stop()
+{
+    m_logicMutex.lock();
+    m_stop = true;
+    m_wakeUp.wakeAll();
+    m_logicMutex.unlock();
+    wait();
+    m_stop = false;
+}
+
+void IGSIOReceiver::SetProcessOnGuiThread( bool onGuiThread )
+{
+    if( onGuiThread == IsProcessingOnGuiThread() ) return;
+    if( onGuiThread )
+    {
+        // The receiver thread is done with the logic and the rings once it is stopped
+        Stop();
+        m_guiThreadTimer->start( m_pollInterval );
+    }
+    else
+    {
+        m_guiThreadTimer->stop();
+        start();
+    }
+}
+
+bool IGSIOReceiver::IsProcessingOnGuiThread() { return m_guiThreadTimer->isActive(); }
+
+void IGSIOReceiver::ProcessMessages()
+{
+    QMutexLocker lock( &m_logicMutex );
+    m_logic->PeriodicProcess();
+    ProcessDevices();
+}
+
+void IGSIOReceiver::SetTools( const QStringList & toolNames, const DeviceToolMap & associations )
+{
+    QMutexLocker lock( &m_logicMutex );
+    qDeleteAll( m_channels );
+    m_channels.clear();
+    foreach( QString name, toolNames )
+    {
+        m_channels.append( new ToolChannel( name ) );
+    }
+    m_deviceToolAssociations = associations;
+
+    // Devices created by a previous config
+    for( int i = 0; i < m_logic->GetNumberOfDevices(); ++i ) AssignDevice( m_logic->GetDevice( i ) );
+}
+
+void IGSIOReceiver::ClearTools()
+{
+    QMutexLocker lock( &m_logicMutex );
+    qDeleteAll( m_channels );
+    m_channels.clear();
+    m_deviceToolAssociations.clear();
+}
+
+void IGSIOReceiver::Connect( std::string ip, int port, bool start )
+{
+    QMutexLocker lock( &m_logicMutex );
+    igtlioConnectorPointer c = m_logic->CreateConnector();
+    c->SetTypeClient( ip, port );
+    if( start )
+    {
+        c->Start();
+    }
+    c->AddObserver( igtlioConnector::ConnectedEvent, m_logicCallback );
+    m_wakeUp.wakeAll();
+}
+
+void IGSIOReceiver::DisconnectAllServers()
+{
+    QMutexLocker lock( &m_logicMutex );
+    for( int i = 0; i < m_logic->GetNumberOfConnectors(); ++i )
+    {
+        m_logic->GetConnector( static_cast<unsigned>( i ) )->Stop();
+    }
+
+    // Clear all connectors
+    while( m_logic->GetNumberOfConnectors() > 0 ) m_logic->RemoveConnector( 0 );
+}
+
+void IGSIOReceiver::run()
+{
+    QMutexLocker lock( &m_logicMutex );
+    while( !m_stop )
+    {
+        m_logic->PeriodicProcess();
+        ProcessDevices();
+
+        // The connectors receive on their own threads but don't signal new messages, they are polled while
+        // there are connectors. Without connectors, the thread sleeps until Connect() or Stop().
+        // Waiting releases the logic lock.
+        if( m_stop ) break;
+        if( m_logic->GetNumberOfConnectors() > 0 )
+            m_wakeUp.wait( &m_logicMutex, m_pollInterval );
+        else
+            m_wakeUp.wait( &m_logicMutex );
+    }
+}
+
+void IGSIOReceiver::ProcessDevices()
+{
+    foreach( ToolChannel * channel, m_channels )
+    {
+        if( channel->transformDevice && channel->transformDevice->GetMTime() != channel->transformMTime )
+        {
+            channel->transformMTime = channel->transformDevice->GetMTime();
+            PushTransform( channel );
+        }
+        if( channel->imageDevice && channel->imageDevice->GetMTime() != channel->imageMTime )
+        {
+            channel->imageMTime = channel->imageDevice->GetMTime();
+            PushImage( channel );
+        }
+    }
+}
+
+void IGSIOReceiver::PushTransform( ToolChannel * channel )
+{
+    vtkMatrix4x4 * matrix = nullptr;
+    if( IsDeviceImage( channel->transformDevice ) )
+    {
+        matrix = igtlioImageDevice::SafeDownCast( channel->transformDevice )->GetContent().transform;
+    }
+    else if( IsDeviceTransform( channel->transformDevice ) )
+    {
+        matrix = igtlioTransformDevice::SafeDownCast( channel->transformDevice )->GetContent().transform;
+    }
+    if( !matrix ) return;
+
+    TransformSample sample;
+    vtkMatrix4x4::DeepCopy( sample.matrix, matrix );
+    sample.timestamp         = channel->transformDevice->GetTimestamp();
+    std::string statusString = GetMetaData( channel->transformDevice, "Status" );
+    sample.hasStatus         = !statusString.empty();
+    if( sample.hasStatus ) sample.state = StatusStringToState( statusString );
+    channel->transforms.Push( sample );
+}
+
+void IGSIOReceiver::PushImage( ToolChannel * channel )
+{
+    vtkImageData * content = nullptr;
+    if( IsDeviceImage( channel->imageDevice ) )
+    {
+        content = igtlioImageDevice::SafeDownCast( channel->imageDevice )->GetContent().image;
+    }
+    else if( IsDeviceVideo( channel->imageDevice ) )
+    {
+        content = igtlioVideoDevice::SafeDownCast( channel->imageDevice )->GetContent().image;
+    }
+    if( !content ) return;
+
+    // Replaces the previous image if the GUI thread has not picked it up yet
+    ImageSample sample;
+    sample.image = vtkSmartPointer<vtkImageData>::New();
+    sample.image->DeepCopy( content );
+    // OpenIGTLink specifications has origin as center of image
+    if( IsDeviceImage( channel->imageDevice ) ) sample.image->SetOrigin( 0.0, 0.0, 0.0 );
+    sample.timestamp = channel->imageDevice->GetTimestamp();
+    channel->images.Push( sample );
+}
+
+void IGSIOReceiver::AssignDevice( igtlioDevice * device )
+{
+    QString toolName, toolPart;
+    QString deviceName( device->GetDeviceName().c_str() );
+    std::cout << "New device: " << deviceName.toUtf8().data() << std::endl;
+    m_deviceToolAssociations.ToolAndPartFromDevice( deviceName, toolName, toolPart );
+    if( toolName.isEmpty() ) return;
+    foreach( ToolChannel * channel, m_channels )
+    {
+        if( channel->toolName != toolName ) continue;
+
+        std::cout << "----> Connected to tool ( " << toolName.toUtf8().data() << " ), part ( "
+                  << toolPart.toUtf8().data() << " )" << std::endl;
+
+        // Image data of the device is sent to the video input of the scene object
+        if( toolPart == "ImageAndTransform" || toolPart == "Image" )
+        {
+            channel->imageDevice = device;
+            channel->imageMTime  = 0;
+        }
+
+        // The device is used to recover the transform of the tool
+        if( toolPart == "ImageAndTransform" || toolPart == "Transform" )
+        {
+            channel->transformDevice    = device;
+            channel->transformMTime     = 0;
+            channel->hasTransformDevice = true;
+        }
+        return;
+    }
+}
+
+void IGSIOReceiver::UnassignDevice( igtlioDevice * device )
+{
+    foreach( ToolChannel * channel, m_channels )
+    {
+        if( channel->imageDevice == device ) channel->imageDevice = nullptr;
+        if( channel->transformDevice == device )
+        {
+            channel->transformDevice    = nullptr;
+            channel->hasTransformDevice = false;
+        }
+    }
+}
+
+void IGSIOReceiver::SendStatusMessage( igtlioConnector * connector )
+{
+    // send a dummy message with metadata to force v2 message exchange
+    igtlioDeviceKeyType key;
+    key.name                                         = "";
+    key.type                                         = "STATUS";
+    vtkSmartPointer<igtlioStatusDevice> statusDevice = igtlioStatusDevice::SafeDownCast( connector->GetDevice( key ) );
+    if( !statusDevice )
+    {
+        statusDevice = vtkSmartPointer<igtlioStatusDevice>::New();
+        connector->AddDevice( statusDevice );
+    }
+
+    statusDevice->SetMetaDataElement(
+        "dummy", "dummy" );  // existence of metadata makes the IO connector send a header v2 message
+    connector->SendMessage( igtlioDeviceKeyType::CreateDeviceKey( statusDevice ) );
+    connector->RemoveDevice( statusDevice );
+}
+
+void IGSIOReceiver::LogicEventCallback( vtkObject * caller, unsigned long event, void * clientData, void * callData )
+{
+    // Events are invoked from PeriodicProcess(), the logic lock is held
+    IGSIOReceiver * self = reinterpret_cast<IGSIOReceiver *>( clientData );
+    if( event == igtlioLogic::NewDeviceEvent )
+        self->AssignDevice( reinterpret_cast<igtlioDevice *>( callData ) );
+    else if( event == igtlioLogic::RemovedDeviceEvent )
+        self->UnassignDevice( reinterpret_cast<igtlioDevice *>( callData ) );
+    else if( event == igtlioConnector::ConnectedEvent )
+        self->SendStatusMessage( reinterpret_cast<igtlioConnector *>( caller ) );
+}
@@ -0,0 +1,138 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef IGSIORECEIVER_H
+#define IGSIORECEIVER_H
+
+#include <igtlioDevice.h>
+#include <vtkSmartPointer.h>
+
+#include <QList>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <string>
+
+#include "configio.h"
+#include "ibistypes.h"
+#include "spscring.h"
+
+class igtlioConnector;
+class igtlioLogic;
+class vtkCallbackCommand;
+class vtkImageData;
+class QTimer;
+
+/**
+ * @class   IGSIOReceiver
+ * @brief   Runs the OpenIGTLink logic of IbisHardwareIGSIO in a separate thread
+ *
+ * The receiver thread processes the messages received by the connectors, decodes the transforms and copies
+ * the images of the devices associated with the tools. The samples of each tool are handed to the GUI thread
+ * without locking (ToolChannel): every transform goes through a ring, images through a latest value slot so
+ * that IbisHardwareIGSIO::Update() always gets the most recent image and a slow render doesn't hold back tracking.
+ *
+ * The logic must only be accessed through this class once the thread is started: connectors and tools are
+ * added and removed from the GUI thread under a lock that the receiver thread holds while it processes messages.
+ * Widgets that observe the logic directly, like qIGTLIOClientWidget, require SetProcessOnGuiThread( true ): the
+ * thread is stopped and messages are processed by a timer of the GUI thread, so logic events reach the widget on
+ * the GUI thread.
+ */
+class IGSIOReceiver : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct TransformSample
+    {
+        TransformSample() : timestamp( 0.0 ), hasStatus( false ), state( Undefined ) {}
+        double matrix[16];
+        double timestamp;
+        bool hasStatus;  // true if state comes from the Status metadata of the message
+        TrackerToolState state;
+    };
+
+    struct ImageSample
+    {
+        ImageSample() : timestamp( 0.0 ) {}
+        vtkSmartPointer<vtkImageData> image;  // a new image per sample, never modified by the receiver thread
+        double timestamp;
+    };
+
+    // Samples of a tool: written by the receiver thread, read by the GUI thread
+    struct ToolChannel
+    {
+        ToolChannel( const QString & name );
+        QString toolName;
+        SPSCRing<TransformSample> transforms;
+        SPSCLatestValue<ImageSample> images;
+        std::atomic<bool> hasTransformDevice;
+
+        // Only accessed by the receiver thread
+        igtlioDevicePointer transformDevice;
+        igtlioDevicePointer imageDevice;
+        unsigned long transformMTime;
+        unsigned long imageMTime;
+    };
+
+    IGSIOReceiver( igtlioLogic * logic, QObject * parent = nullptr );
+    ~IGSIOReceiver();
+
+    // Stop the receiver thread and wait for it to finish
+    void Stop();
+
+    // Time between two passes over the connectors, in milliseconds
+    void SetPollInterval( int msec ) { m_pollInterval = msec; }
+    int GetPollInterval() { return m_pollInterval; }
+
+    // Process messages on the GUI thread instead of the receiver thread, while a widget observes the logic
+    void SetProcessOnGuiThread( bool onGuiThread );
+    bool IsProcessingOnGuiThread();
+
+    // Create a channel per tool, in the order of toolNames. Devices are assigned to the tools with associations.
+    void SetTools( const QStringList & toolNames, const DeviceToolMap & associations );
+    void ClearTools();
+    // GUI thread: channel of tool index, valid until the next call to SetTools or ClearTools
+    ToolChannel * GetToolChannel( int index ) { return m_channels[index]; }
+
+    void Connect( std::string ip, int port, bool start );
+    void DisconnectAllServers();
+
+private slots:
+
+    void ProcessMessages();
+
+protected:
+    void run() override;
+
+    // Called with the logic lock held
+    void ProcessDevices();
+    void PushTransform( ToolChannel * channel );
+    void PushImage( ToolChannel * channel );
+    void AssignDevice( igtlioDevice * device );
+    void UnassignDevice( igtlioDevice * device );
+    void SendStatusMessage( igtlioConnector * connector );
+
+    static void LogicEventCallback( vtkObject * caller, unsigned long event, void * clientData, void * callData );
+
+    vtkSmartPointer<igtlioLogic> m_logic;
+    vtkSmartPointer<vtkCallbackCommand> m_logicCallback;
+    QMutex m_logicMutex;
+    QWaitCondition m_wakeUp;  // wakes the receiver thread up on Stop() and Connect()
+    QTimer * m_guiThreadTimer;
+    QList<ToolChannel *> m_channels;
+    DeviceToolMap m_deviceToolAssociations;
+    std::atomic<bool> m_stop;
+    std::atomic<int> m_pollInterval;
+};
+
+#endif
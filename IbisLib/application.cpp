@@ -41,11 +41,13 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "pointerobject.h"
 #include "pointsobject.h"
 #include "polydataobject.h"
+#include "renderscheduler.h"
 #include "scenemanager.h"
 #include "sceneobject.h"
 #include "serializer.h"
 #include "toolplugininterface.h"
 #include "updatemanager.h"
+#include "usacquisitionexporter.h"
 #include "version.h"
 #include "view.h"
 #include "worldobject.h"
@@ -95,6 +97,11 @@ void ApplicationSettings::LoadSettings( QSettings & settings )
     VolumeRendererEnabled                  = settings.value( "VolumeRendererEnabled", false ).toBool();
     ShowMINCConversionWarning              = settings.value( "ShowMINCConversionWarning", true ).toBool();
     UpdateFrequency                        = settings.value( "UpdateFrequency", 15.0 ).toDouble();
+    MaximumRenderFrameRate                 = settings.value( "MaximumRenderFrameRate", 0.0 ).toDouble();
+    USRecordingBufferSize                  = settings.value( "USRecordingBufferSize", 0 ).toInt();
+    USRecordingBufferIsRing                = settings.value( "USRecordingBufferIsRing", false ).toBool();
+    CompressSceneArchives                  = settings.value( "CompressSceneArchives", false ).toBool();
+    NumberOfFileReaderThreads              = settings.value( "NumberOfFileReaderThreads", 0 ).toInt();
 }
 
 void ApplicationSettings::SaveSettings( QSettings & settings )
@@ -125,6 +132,11 @@ void ApplicationSettings::SaveSettings( QSettings & settings )
     settings.setValue( "TripleCutPlaneDisplayInterpolationType", TripleCutPlaneDisplayInterpolationType );
     settings.setValue( "ShowMINCConversionWarning", ShowMINCConversionWarning );
     settings.setValue( "UpdateFrequency", UpdateFrequency );
+    settings.setValue( "MaximumRenderFrameRate", MaximumRenderFrameRate );
+    settings.setValue( "USRecordingBufferSize", USRecordingBufferSize );
+    settings.setValue( "USRecordingBufferIsRing", USRecordingBufferIsRing );
+    settings.setValue( "CompressSceneArchives", CompressSceneArchives );
+    settings.setValue( "NumberOfFileReaderThreads", NumberOfFileReaderThreads );
 }
 
 Application::Application()
@@ -138,6 +150,7 @@ Application::Application()
     m_ibisAPI                   = nullptr;
     m_updateManager             = nullptr;
     m_lookupTableManager        = nullptr;
+    m_usAcquisitionExporter     = nullptr;
     m_preferences               = nullptr;
 }
 
@@ -176,6 +189,8 @@ void Application::Init( bool viewerOnly )
 
     m_lookupTableManager = new LookupTableManager;
 
+    m_usAcquisitionExporter = new USAcquisitionExporter;
+
     // Get instance of the hardware module
     foreach( QObject * plugin, QPluginLoader::staticInstances() )
     {
@@ -208,6 +223,8 @@ Application::~Application()
     m_sceneManager->Destroy();
 
     delete m_lookupTableManager;
+    delete m_usAcquisitionExporter;  // finishes the exports still queued
+    m_usAcquisitionExporter = nullptr;
 
     QList<IbisPlugin *> allPlugins;
     this->GetAllPlugins( allPlugins );
@@ -230,6 +247,7 @@ void Application::ApplyApplicationSettings()
     double bg3DColord[3] = { bg3DColor[0], bg3DColor[1], bg3DColor[2] };
     m_sceneManager->SetView3DBackgroundColor( bg3DColord );
     m_sceneManager->Set3DCameraViewAngle( m_settings.CameraViewAngle3D );
+    m_sceneManager->GetRenderScheduler()->SetMaximumFrameRate( m_settings.MaximumRenderFrameRate );
 
     float cursorColor[3] = {0., 0., 0.};
     m_settings.CutPlanesCursorColor.getRgbF( &cursorColor[0], &cursorColor[1], &cursorColor[2] );
@@ -440,6 +458,7 @@ void Application::OpenFiles( OpenFileParams * params, bool addToScene )
     m_fileReader = new FileReader;
     m_fileReader->SetParams( params );
     m_fileReader->SetIbisAPI( m_ibisAPI );
+    m_fileReader->SetMaximumNumberOfThreads( m_settings.NumberOfFileReaderThreads );
     for( int i = 0; i < params->filesParams.size(); ++i )
     {
         OpenFileParams::SingleFileParam & cur = params->filesParams[i];
@@ -787,6 +806,8 @@ SceneManager * Application::GetSceneManager() { return GetInstance().m_sceneMana
 
 LookupTableManager * Application::GetLookupTableManager() { return GetInstance().m_lookupTableManager; }
 
+USAcquisitionExporter * Application::GetUSAcquisitionExporter() { return GetInstance().m_usAcquisitionExporter; }
+
 ApplicationSettings * Application::GetSettings() { return &m_settings; }
 
 void Application::SetUpdateFrequency( double fps )
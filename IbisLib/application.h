@@ -40,6 +40,7 @@ class GeneratorPluginInterface;
 class OpenFileParams;
 class FileReader;
 class LookupTableManager;
+class USAcquisitionExporter;
 class QProgressDialog;
 class QTimer;
 class QDialog;
@@ -102,7 +103,18 @@ struct ApplicationSettings
     int TripleCutPlaneDisplayInterpolationType;
     bool VolumeRendererEnabled;
     double UpdateFrequency;
+    /** Maximum number of times per second a view is rendered. 0 renders at the refresh rate of the display. */
+    double MaximumRenderFrameRate;
     bool ShowMINCConversionWarning;
+    /** Number of frames reserved up front when recording US acquisitions. 0 allocates every frame separately. */
+    int USRecordingBufferSize;
+    /** When the reserved US recording buffer is full, overwrite the oldest frames instead of growing the buffer. */
+    bool USRecordingBufferIsRing;
+    /** Compress images, surfaces and data files saved in scene archives. Frame stacks are never compressed so that
+     * they can be read from the mapped archive. */
+    bool CompressSceneArchives;
+    /** Maximum number of files read at the same time when opening files. 0 uses one thread per core. */
+    int NumberOfFileReaderThreads;
     QList<QString> PluginsWithOpenWidget;
     QList<QString> PluginsWithOpenTab;
 };
@@ -182,6 +194,8 @@ public:
     static SceneManager * GetSceneManager();
     /** Get pointer to LookupTableManager. */
     static LookupTableManager * GetLookupTableManager();
+    /** Get pointer to the exporter writing US acquisitions in the background. */
+    static USAcquisitionExporter * GetUSAcquisitionExporter();
 
     /** @name  Application Settings
      *   @brief Application Settings are loaded at the start of the application and
@@ -357,6 +371,7 @@ private:
     UpdateManager * m_updateManager;
     QList<HardwareModule *> m_hardwareModules;
     LookupTableManager * m_lookupTableManager;
+    USAcquisitionExporter * m_usAcquisitionExporter;
     QList<GlobalEventHandler *> m_globalEventHandlers;
 
     ApplicationSettings m_settings;
@@ -163,8 +163,13 @@ void CameraObject::Serialize( Serializer * ser )
     SerializeLocalParams( ser );
     ::Serialize( ser, "TrackingCamera", m_trackingCamera );
 
-    QString dataDirName = GetSceneDataDirectoryForThisObject( ser->GetSerializationDirectory() );
-    m_videoBuffer->Serialize( ser, dataDirName );
+    if( ser->GetArchive() )
+        m_videoBuffer->Serialize( ser, ser->GetArchive(), GetSceneArchiveChunkName( "frames" ) );
+    else
+    {
+        QString dataDirName = GetSceneDataDirectoryForThisObject( ser->GetSerializationDirectory() );
+        m_videoBuffer->Serialize( ser, dataDirName );
+    }
 
     if( ser->IsReader() )
     {
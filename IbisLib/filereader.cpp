@@ -12,9 +12,9 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "filereader.h"
 
 #include <itkImageIOFactory.h>
+#include <vtkCallbackCommand.h>
 #include <vtkDataObjectReader.h>
 #include <vtkErrorCode.h>
-#include <vtkEventQtSlotConnect.h>
 #include <vtkImageData.h>
 #include <vtkMNIOBJReader.h>
 #include <vtkOBJReader.h>
@@ -34,6 +34,8 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QMessageBox>
 #include <QProcess>
 #include <QStringList>
+#include <QTemporaryDir>
+#include <QThreadPool>
 
 #include "ibisapi.h"
 #include "imageobject.h"
@@ -43,23 +45,31 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 
 const QString FileReader::MINCToolsPathVarName = "MINCToolsDirectory";
 
+// HDF5 is not built thread safe, files it reads are decoded one at a time by all readers
+static QMutex HDF5ReadMutex;
+
 FileReader::FileReader( QObject * parent ) : QThread( parent )
 
 {
-    m_currentFileIndex  = 0;
-    m_progress          = 0.0;
-    m_selfAllocParams   = false;
-    m_params            = nullptr;
-    m_fileProgressEvent = vtkEventQtSlotConnect::New();
-    m_ibisAPI           = nullptr;
+    m_selfAllocParams = false;
+    m_params          = nullptr;
+    m_ibisAPI         = nullptr;
+    m_readers         = new QThreadPool;
 }
 
 FileReader::~FileReader()
 {
-    m_fileProgressEvent->Delete();
+    delete m_readers;
     if( m_params && m_selfAllocParams ) delete m_params;
 }
 
+void FileReader::SetMaximumNumberOfThreads( int n )
+{
+    m_readers->setMaxThreadCount( n > 0 ? n : QThread::idealThreadCount() );
+}
+
+int FileReader::GetMaximumNumberOfThreads() { return m_readers->maxThreadCount(); }
+
 static QStringList mincConvertPaths = QStringList() << "/usr/bin/mincconvert"
                                                     << "/usr/local/bin/mincconvert"
                                                     << "/usr/local/minc/bin/mincconvert"
@@ -175,6 +185,23 @@ bool FileReader::IsMINC1( QString fileName )
     return false;
 }
 
+bool FileReader::IsHDF5( QString fileName )
+{
+    FILE * fp = fopen( fileName.toUtf8().data(), "rb" );
+    if( fp )
+    {
+        char first8[8];
+        size_t count = fread( first8, 8, 1, fp );
+        fclose( fp );
+
+        if( count == 1 && memcmp( first8, "\x89HDF\r\n\x1a\n", 8 ) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool FileReader::ConvertMINC1toMINC2( QString & inputileName, QString & outputileName, bool isVideoFrame )
 {
     if( m_mincconvert.isEmpty() )
@@ -188,22 +215,27 @@ bool FileReader::ConvertMINC1toMINC2( QString & inputileName, QString & outputil
     }
     QString dirname( QDir::homePath() );
     dirname.append( "/.ibis/tmp/" );
-    QDir tmpDir( dirname );
-    bool ok = true;
-    if( !tmpDir.exists() ) ok = tmpDir.mkdir( dirname );
-    if( !ok )
+    // mkpath succeeds if the directory already exists, e.g. created by a conversion running at the same time
+    if( !QDir().mkpath( dirname ) )
     {
         QString tmp( "Cannot create directory: " );
         tmp.append( dirname );
         this->ReportWarning( tmp );
         return false;
     }
-    outputileName.append( dirname );
+    // Files with the same name may be converted at the same time, each conversion gets its own directory to keep the
+    // name of the file. The directory is only kept if the conversion succeeds.
+    QTemporaryDir outputDir( dirname + "convert_XXXXXX" );
+    if( !outputDir.isValid() )
+    {
+        this->ReportWarning( QString( "Cannot create directory: " ) + dirname );
+        return false;
+    }
     QFileInfo fi( inputileName );
-    outputileName.append( fi.fileName() );
+    outputileName.append( outputDir.filePath( fi.fileName() ) );
     QString program( m_mincconvert );
     QStringList arguments;
-    ok = false;
+    bool ok = false;
     if( !isVideoFrame )
     {
         arguments << "-2" << inputileName << outputileName << "-clobber";
@@ -212,6 +244,7 @@ bool FileReader::ConvertMINC1toMINC2( QString & inputileName, QString & outputil
         ok = convertProcess->waitForStarted();
         if( ok ) ok = convertProcess->waitForFinished();
         delete convertProcess;
+        outputDir.setAutoRemove( !ok );
         return ok;
     }
     else
@@ -219,8 +252,8 @@ bool FileReader::ConvertMINC1toMINC2( QString & inputileName, QString & outputil
         QFileInfo fi( outputileName );
         QString dirname( fi.absolutePath() );
         QDir tmpDir( dirname );
-        QString tempFile( dirname );
-        tempFile.append( "/tempfile.mnc" );
+        QString tempFile( outputileName );
+        tempFile.append( ".tmp.mnc" );
         arguments << "-2" << inputileName << tempFile << "-clobber";
         QProcess * convertProcess = new QProcess( 0 );
         convertProcess->start( program, arguments );
@@ -251,10 +284,17 @@ bool FileReader::ConvertMINC1toMINC2( QString & inputileName, QString & outputil
                 return false;
             }
         }
+        outputDir.setAutoRemove( !ok );
         return ok;
     }
 }
 
+void FileReader::RemoveConvertedFile( const QString & convertedFileName )
+{
+    if( convertedFileName.isEmpty() ) return;
+    QDir( QFileInfo( convertedFileName ).absolutePath() ).removeRecursively();
+}
+
 void FileReader::SetParams( OpenFileParams * params ) { m_params = params; }
 
 void FileReader::SetFileNames( QStringList & filenames )
@@ -280,56 +320,103 @@ void FileReader::GetReadObjects( QList<SceneObject *> & objects )
 
 void FileReader::run()
 {
-    m_currentFileIndex = 0;
-    m_progress         = 0.0;
+    int nbFiles = m_params->filesParams.size();
+    m_mutex.lock();
+    m_fileProgress.assign( nbFiles, -1.0 );
+    m_fileWarnings.assign( nbFiles, QStringList() );
     m_warnings.clear();
-    for( int i = 0; i < m_params->filesParams.size(); ++i )
-    {
-        OpenFileParams::SingleFileParam & param = m_params->filesParams[i];
-        m_currentFileIndex                      = i;
-        QList<SceneObject *> readObjects;
-        OpenFile( readObjects, param.fileName, param.objectName, param.isLabel );
-        if( readObjects.size() > 0 ) param.loadedObject = readObjects[0];
-        if( readObjects.size() > 1 ) param.secondaryObject = readObjects[1];
-    }
+    m_fileNames.clear();
+    for( int i = 0; i < nbFiles; ++i )
+        m_fileNames.push_back( QFileInfo( m_params->filesParams.at( i ).fileName ).fileName() );
+    m_mutex.unlock();
+
+    // Get all parameters before starting the reads, accessing the list may detach it
+    std::vector<OpenFileParams::SingleFileParam *> params;
+    for( int i = 0; i < nbFiles; ++i ) params.push_back( &m_params->filesParams[i] );
 
     // Push all read objects to main thread to be able to create connections without having to worry about type of
-    // connection
+    // connection. It has to be done by the thread that created them.
     QThread * mainThread = QApplication::instance()->thread();
-    for( int i = 0; i < m_params->filesParams.size(); ++i )
+    for( int i = 0; i < nbFiles; ++i )
     {
-        OpenFileParams::SingleFileParam & param = m_params->filesParams[i];
-        if( param.loadedObject ) param.loadedObject->moveToThread( mainThread );
-        if( param.secondaryObject ) param.secondaryObject->moveToThread( mainThread );
+        OpenFileParams::SingleFileParam * param = params[i];
+        m_readers->start( [this, i, param, mainThread]() {
+            m_threadFileIndex.setLocalData( i );
+            ReaderProgress( 0.0 );
+            QList<SceneObject *> readObjects;
+            OpenFile( readObjects, param->fileName, param->objectName, param->isLabel );
+            if( readObjects.size() > 0 ) param->loadedObject = readObjects[0];
+            if( readObjects.size() > 1 ) param->secondaryObject = readObjects[1];
+            for( int j = 0; j < readObjects.size(); ++j ) readObjects[j]->moveToThread( mainThread );
+            ReaderProgress( 1.0 );
+            m_threadFileIndex.setLocalData( -1 );
+        } );
     }
+    m_readers->waitForDone();
 
-    m_progress = 1.0;
+    // Warnings are returned in the order of the files
+    QMutexLocker lock( &m_mutex );
+    for( int i = 0; i < nbFiles; ++i ) m_warnings += m_fileWarnings[i];
+}
+
+double FileReader::GetProgress()
+{
+    QMutexLocker lock( &m_mutex );
+    if( m_fileProgress.empty() ) return 0.0;
+    double progress = 0.0;
+    for( unsigned i = 0; i < m_fileProgress.size(); ++i ) progress += std::max( m_fileProgress[i], 0.0 );
+    return progress / m_fileProgress.size();
 }
 
 QString FileReader::GetCurrentlyReadFile()
 {
-    QString filename;
-    if( m_currentFileIndex < m_params->filesParams.size() )
+    QStringList filenames;
+    QMutexLocker lock( &m_mutex );
+    for( unsigned i = 0; i < m_fileProgress.size(); ++i )
     {
-        QFileInfo info( m_params->filesParams[m_currentFileIndex].fileName );
-        filename = info.fileName();
+        if( m_fileProgress[i] < 0.0 || m_fileProgress[i] >= 1.0 ) continue;
+        filenames.push_back( m_fileNames[i] );
     }
-    return filename;
+    return filenames.join( ", " );
 }
 
-void FileReader::OnReaderProgress( vtkObject * caller, unsigned long /*event*/ )
+int FileReader::GetThreadFileIndex()
+{
+    if( !m_threadFileIndex.hasLocalData() ) return -1;
+    return m_threadFileIndex.localData();
+}
+
+void FileReader::ObserveProgress( vtkAlgorithm * reader )
+{
+    // The observer is called by the thread updating the reader, which is the thread reading the file
+    vtkSmartPointer<vtkCallbackCommand> callback = vtkSmartPointer<vtkCallbackCommand>::New();
+    callback->SetCallback( OnReaderProgress );
+    callback->SetClientData( this );
+    reader->AddObserver( vtkCommand::ProgressEvent, callback );
+}
+
+void FileReader::OnReaderProgress( vtkObject * caller, unsigned long /*event*/, void * clientData, void * /*callData*/ )
 {
     vtkAlgorithm * reader = vtkAlgorithm::SafeDownCast( caller );
     Q_ASSERT( reader );
 
-    double fileProgress = reader->GetProgress();
-    ReaderProgress( fileProgress );
+    FileReader * self = static_cast<FileReader *>( clientData );
+    self->ReaderProgress( reader->GetProgress() );
+}
+
+// Reading an image is the first half of its progress, the conversion to ImageObject the second
+void FileReader::OnItkReaderProgress( itk::Object * caller, const itk::EventObject & /*event*/ )
+{
+    itk::ProcessObject * reader = dynamic_cast<itk::ProcessObject *>( caller );
+    if( reader ) ReaderProgress( 0.5 * reader->GetProgress() );
 }
 
 void FileReader::ReaderProgress( double fileProgress )
 {
-    double ratio = double( 1.0 ) / m_params->filesParams.size();
-    m_progress   = ratio * ( (double)m_currentFileIndex + fileProgress );
+    int index = GetThreadFileIndex();
+    if( index < 0 ) return;
+    QMutexLocker lock( &m_mutex );
+    m_fileProgress[index] = fileProgress;
 }
 
 bool FileReader::OpenFile( QList<SceneObject *> & readObjects, QString filename, const QString & dataObjectName,
@@ -365,8 +452,13 @@ bool FileReader::OpenFile( QList<SceneObject *> & readObjects, QString filename,
             fileOpened = OpenItkFile( readObjects, fileToOpen, dataObjectName );
         }
 
-        // temporary files cannot be removed before the end of the session - remove on exit from the application or on
-        // load scene
+        // The image is in memory, the converted copy is removed and the object refers to the original MINC1 file,
+        // which is converted again when a scene referring to it is loaded
+        if( !fileMINC2.isEmpty() )
+        {
+            if( fileOpened ) SetObjectName( readObjects.back(), dataObjectName, filename );
+            RemoveConvertedFile( fileMINC2 );
+        }
         if( fileOpened ) return true;
 
         // try tag file
@@ -438,6 +530,7 @@ bool FileReader::OpenFile( QList<SceneObject *> & readObjects, QString filename,
 
 typedef itk::ImageIOBase IOBase;
 typedef itk::SmartPointer<IOBase> IOBasePointer;
+typedef itk::MemberCommand<FileReader> ProgressCommandType;
 
 void FileReader::PrintMetadata( itk::MetaDataDictionary & dict )
 {
@@ -466,9 +559,13 @@ bool FileReader::OpenItkFile( QList<SceneObject *> & readObjects, QString filena
     typedef itk::ImageFileReader<IbisItkFloat3ImageType> ReaderType;
     ReaderType::Pointer reader = ReaderType::New();
     reader->SetFileName( filename.toUtf8().data() );
+    ProgressCommandType::Pointer progressCommand = ProgressCommandType::New();
+    progressCommand->SetCallbackFunction( this, &FileReader::OnItkReaderProgress );
+    reader->AddObserver( itk::ProgressEvent(), progressCommand );
 
     try
     {
+        QMutexLocker lock( IsHDF5( filename ) ? &HDF5ReadMutex : nullptr );
         reader->Update();
     }
     catch( itk::ExceptionObject & err )
@@ -476,7 +573,6 @@ bool FileReader::OpenItkFile( QList<SceneObject *> & readObjects, QString filena
         std::cerr << err << std::endl;
         return false;
     }
-    // Update progress. simtodo : do something smarter. Itk minc reader doesn't seem to support progress.
     ReaderProgress( .5 );
 
     IbisItkFloat3ImageType::Pointer itkImage = reader->GetOutput();
@@ -502,9 +598,13 @@ bool FileReader::OpenItkLabelFile( QList<SceneObject *> & readObjects, QString f
     typedef itk::ImageFileReader<IbisItkUnsignedChar3ImageType> ReaderType;
     ReaderType::Pointer reader = ReaderType::New();
     reader->SetFileName( filename.toUtf8().data() );
+    ProgressCommandType::Pointer progressCommand = ProgressCommandType::New();
+    progressCommand->SetCallbackFunction( this, &FileReader::OnItkReaderProgress );
+    reader->AddObserver( itk::ProgressEvent(), progressCommand );
 
     try
     {
+        QMutexLocker lock( IsHDF5( filename ) ? &HDF5ReadMutex : nullptr );
         reader->Update();
     }
     catch( itk::ExceptionObject & err )
@@ -512,7 +612,6 @@ bool FileReader::OpenItkLabelFile( QList<SceneObject *> & readObjects, QString f
         std::cerr << err << std::endl;
         return false;
     }
-    // Update progress. simtodo : do something smarter. Itk minc reader doesn't seem to support progress.
     ReaderProgress( .5 );
 
     IbisItkUnsignedChar3ImageType::Pointer itkImage = reader->GetOutput();
@@ -536,11 +635,8 @@ bool FileReader::OpenObjFile( QList<SceneObject *> & readObjects, QString filena
     reader->SetFileName( filename.toUtf8().data() );
 
     // Read file and monitor progress
-    m_fileProgressEvent->Connect( reader, vtkCommand::ProgressEvent, this,
-                                  SLOT( OnReaderProgress( vtkObject *, unsigned long ) ), 0, 0.0,
-                                  Qt::DirectConnection );
+    ObserveProgress( reader );
     reader->Update();
-    m_fileProgressEvent->Disconnect( reader );
 
     PolyDataObject * object = PolyDataObject::New();
     object->SetPolyData( reader->GetOutput() );
@@ -559,11 +655,8 @@ bool FileReader::OpenWavObjFile( QList<SceneObject *> & readObjects, QString fil
     reader->SetFileName( filename.toUtf8().data() );
 
     // Read file and monito progress
-    m_fileProgressEvent->Connect( reader, vtkCommand::ProgressEvent, this,
-                                  SLOT( OnReaderProgress( vtkObject *, unsigned long ) ), 0, 0.0,
-                                  Qt::DirectConnection );
+    ObserveProgress( reader );
     reader->Update();
-    m_fileProgressEvent->Disconnect( reader );
 
     PolyDataObject * object = PolyDataObject::New();
     object->SetPolyData( reader->GetOutput() );
@@ -581,11 +674,8 @@ bool FileReader::OpenPlyFile( QList<SceneObject *> & readObjects, QString filena
     reader->SetFileName( filename.toUtf8().data() );
 
     // Read file and monitor progress
-    m_fileProgressEvent->Connect( reader, vtkCommand::ProgressEvent, this,
-                                  SLOT( OnReaderProgress( vtkObject *, unsigned long ) ), 0, 0.0,
-                                  Qt::DirectConnection );
+    ObserveProgress( reader );
     reader->Update();
-    m_fileProgressEvent->Disconnect( reader );
 
     PolyDataObject * object = PolyDataObject::New();
     object->SetPolyData( reader->GetOutput() );
@@ -602,7 +692,6 @@ bool FileReader::OpenVTKFile( QList<SceneObject *> & readObjects, QString filena
     vtkDataObjectReader * reader = vtkDataObjectReader::New();
     reader->SetFileName( filename.toUtf8().data() );
     reader->Update();
-    m_fileProgressEvent->Disconnect( reader );
 
     bool res = false;
     if( reader->GetErrorCode() == vtkErrorCode::NoError )
@@ -612,11 +701,8 @@ bool FileReader::OpenVTKFile( QList<SceneObject *> & readObjects, QString filena
             vtkPolyDataReader * polyReader = vtkPolyDataReader::New();
             polyReader->SetFileName( filename.toUtf8().data() );
 
-            m_fileProgressEvent->Connect( polyReader, vtkCommand::ProgressEvent, this,
-                                          SLOT( OnReaderProgress( vtkObject *, unsigned long ) ), 0, 0.0,
-                                          Qt::DirectConnection );
+            ObserveProgress( polyReader );
             polyReader->Update();
-            m_fileProgressEvent->Disconnect( polyReader );
 
             PolyDataObject * object = PolyDataObject::New();
             object->SetPolyData( polyReader->GetOutput() );
@@ -631,11 +717,8 @@ bool FileReader::OpenVTKFile( QList<SceneObject *> & readObjects, QString filena
             vtkStructuredPointsReader * pReader = vtkStructuredPointsReader::New();
             pReader->SetFileName( filename.toUtf8().data() );
 
-            m_fileProgressEvent->Connect( pReader, vtkCommand::ProgressEvent, this,
-                                          SLOT( OnReaderProgress( vtkObject *, unsigned long ) ), 0, 0.0,
-                                          Qt::DirectConnection );
+            ObserveProgress( pReader );
             pReader->Update();
-            m_fileProgressEvent->Disconnect( pReader );
 
             ImageObject * image = ImageObject::New();
             image->SetImage( (vtkImageData *)pReader->GetOutput() );
@@ -659,7 +742,6 @@ bool FileReader::OpenFIBFile( QList<SceneObject *> & readObjects, QString filena
     vtkDataObjectReader * reader = vtkDataObjectReader::New();
     reader->SetFileName( filename.toUtf8().data() );
     reader->Update();
-    m_fileProgressEvent->Disconnect( reader );
 
     bool res = false;
 
@@ -670,11 +752,8 @@ bool FileReader::OpenFIBFile( QList<SceneObject *> & readObjects, QString filena
             vtkPolyDataReader * polyReader = vtkPolyDataReader::New();
             polyReader->SetFileName( filename.toUtf8().data() );
 
-            m_fileProgressEvent->Connect( polyReader, vtkCommand::ProgressEvent, this,
-                                          SLOT( OnReaderProgress( vtkObject *, unsigned long ) ), 0, 0.0,
-                                          Qt::DirectConnection );
+            ObserveProgress( polyReader );
             polyReader->Update();
-            m_fileProgressEvent->Disconnect( polyReader );
 
             TractogramObject * object = TractogramObject::New();
             object->SetPolyData( polyReader->GetOutput() );
@@ -697,11 +776,8 @@ bool FileReader::OpenVTPFile( QList<SceneObject *> & readObjects, QString filena
     {
         polyReader->SetFileName( filename.toUtf8().data() );
 
-        m_fileProgressEvent->Connect( polyReader, vtkCommand::ProgressEvent, this,
-                                      SLOT( OnReaderProgress( vtkObject *, unsigned long ) ), 0, 0.0,
-                                      Qt::DirectConnection );
+        ObserveProgress( polyReader );
         polyReader->Update();
-        m_fileProgressEvent->Disconnect( polyReader );
 
         PolyDataObject * object = PolyDataObject::New();
         object->SetPolyData( polyReader->GetOutput() );
@@ -719,11 +795,8 @@ bool FileReader::OpenTagFile( QList<SceneObject *> & readObjects, QString filena
     vtkTagReader * reader = vtkTagReader::New();
     reader->SetFileName( filename.toUtf8().data() );
 
-    m_fileProgressEvent->Connect( reader, vtkCommand::ProgressEvent, this,
-                                  SLOT( OnReaderProgress( vtkObject *, unsigned long ) ), 0, 0.0,
-                                  Qt::DirectConnection );
+    ObserveProgress( reader );
     reader->Update();
-    m_fileProgressEvent->Disconnect( reader );
 
     vtkPoints * pts = reader->GetVolume( 0 );
     if( !pts )
@@ -832,7 +905,15 @@ void FileReader::SetObjectName( SceneObject * obj, QString objName, QString file
         obj->SetName( info.fileName() );
 }
 
-void FileReader::ReportWarning( QString warning ) { m_warnings.push_back( warning ); }
+void FileReader::ReportWarning( QString warning )
+{
+    int index = GetThreadFileIndex();
+    QMutexLocker lock( &m_mutex );
+    if( index >= 0 )
+        m_fileWarnings[index].push_back( warning );
+    else
+        m_warnings.push_back( warning );
+}
 
 // Getting US acquisition files
 //
@@ -857,10 +938,23 @@ int FileReader::GetNumberOfComponents( QString filename )
     }
     IOBasePointer io = itk::ImageIOFactory::CreateImageIO( fileToRead.toUtf8().data(), itk::CommonEnums::IOFileMode::ReadMode );
 
-    if( !io ) throw itk::ExceptionObject( "Unsupported image file type" );
+    if( !io )
+    {
+        RemoveConvertedFile( fileMINC2 );
+        throw itk::ExceptionObject( "Unsupported image file type" );
+    }
 
     io->SetFileName( ( fileToRead.toUtf8().data() ) );
-    io->ReadImageInformation();
+    try
+    {
+        io->ReadImageInformation();
+    }
+    catch( itk::ExceptionObject & )
+    {
+        RemoveConvertedFile( fileMINC2 );
+        throw;
+    }
+    RemoveConvertedFile( fileMINC2 );
 
     size_t nc = io->GetNumberOfComponents();
     return static_cast<int>( nc );
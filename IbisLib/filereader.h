@@ -11,18 +11,23 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #ifndef FILEREADER_H
 #define FILEREADER_H
 
+#include <itkCommand.h>
 #include <itkMetaDataDictionary.h>
 #include <itkMetaDataObject.h>
 
+#include <QMutex>
 #include <QObject>
 #include <QStringList>
 #include <QThread>
+#include <QThreadStorage>
+#include <vector>
 
 #include "ibisitkvtkconverter.h"
 
 class SceneManager;
 class SceneObject;
-class vtkEventQtSlotConnect;
+class QThreadPool;
+class vtkAlgorithm;
 class vtkObject;
 class vtkImageData;
 class vtkMatrix4x4;
@@ -52,6 +57,10 @@ class OpenFileParams;
  * Object, PLY, VTK and VTP are represented as PolyDataObject.
  * FIB is represented as a TractogramObject.
  *
+ * Files are read concurrently by a pool of threads, each file by one thread. Objects are stored in the parameters of
+ * their file, so they are returned in the order of the files whatever the order the reads finish in. MINC2 files
+ * are HDF5 files, which can only be decoded one at a time, but their conversion to ImageObject is concurrent.
+ *
  * @sa
  * IbisAPI OpenFileParams SceneManager PointsObject SceneObject ImageObject TractogramObject
  */
@@ -75,11 +84,15 @@ public:
 
     /** Warnings are accumulated during reading and then returned in a list of strings. */
     const QStringList & GetWarnings() { return m_warnings; }
-    /** Return reading progress as a fraction between 0 and 1. */
-    double GetProgress() { return m_progress; }
-    /** Return the name of currently processed file. */
+    /** Return reading progress of all files as a fraction between 0 and 1. */
+    double GetProgress();
+    /** Return the names of the files being read. */
     QString GetCurrentlyReadFile();
 
+    /** Maximum number of files read at the same time, the ideal number of threads if n <= 0. */
+    void SetMaximumNumberOfThreads( int n );
+    int GetMaximumNumberOfThreads();
+
     /** Used for debugging */
     void PrintMetadata( itk::MetaDataDictionary & dict );
 
@@ -93,9 +106,14 @@ public:
     bool HasMincConverter();
     /** Is the file of MINC1 type? */
     bool IsMINC1( QString fileName );
+    /** Is the file an HDF5 file, like MINC2 files? */
+    bool IsHDF5( QString fileName );
     /** Convert MINC1 file to MINC2 file using mincconvert, if it is a frame from US acquisition, additionaly use
-     * mincalc. */
+     * mincalc. The output file is a new file of the temporary directory, files can be converted concurrently.
+     * Remove the output file with RemoveConvertedFile() once it is read. */
     bool ConvertMINC1toMINC2( QString & inputileName, QString & outputileName, bool isVideoFrame = false );
+    /** Remove a file written by ConvertMINC1toMINC2() and its directory. */
+    void RemoveConvertedFile( const QString & convertedFileName );
     ///@}
 
     /** Return one or two PointsObjects loaded from a tag file. */
@@ -118,12 +136,15 @@ public:
      */
     void SetIbisAPI( IbisAPI * api );
 
-private slots:
-
-    void OnReaderProgress( vtkObject *, unsigned long );
-
 protected:
+    /** Progress of the file read by the calling thread */
     void ReaderProgress( double fileProgress );
+    /** Report the progress of reader as the progress of the file read by the calling thread */
+    void ObserveProgress( vtkAlgorithm * reader );
+    static void OnReaderProgress( vtkObject * caller, unsigned long event, void * clientData, void * callData );
+    void OnItkReaderProgress( itk::Object * caller, const itk::EventObject & event );
+    /** Index of the file read by the calling thread, -1 if it is not reading a file */
+    int GetThreadFileIndex();
 
     void run();
 
@@ -148,20 +169,23 @@ protected:
     bool FindMINCTool( QString candidate );
 
     ///@{
-    /** Progress report */
-    int m_currentFileIndex;
-    double m_progress;
+    /** Progress report, m_mutex protects the progress and warnings of the files */
+    QMutex m_mutex;
+    std::vector<double> m_fileProgress;  // -1 until the file is started
+    std::vector<QStringList> m_fileWarnings;
+    std::vector<QString> m_fileNames;  // copied at start, the readers write to the file params
+    QThreadStorage<int> m_threadFileIndex;
     ///@}
 
+    /** Threads reading the files */
+    QThreadPool * m_readers;
+
     ///@{
     /** define stuff to read */
     bool m_selfAllocParams;
     OpenFileParams * m_params;
     ///@}
 
-    /** callbacks */
-    vtkEventQtSlotConnect * m_fileProgressEvent;
-
     /** Error collecting */
     QStringList m_warnings;
 
@@ -48,8 +48,8 @@ void PointerCalibrationDialog::CalibrateButtonClicked()
     }
     else
     {
+        // Keep updating until the refinement of the calibration is done, see Update()
         m_pointer->StopTipCalibration();
-        disconnect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( Update() ) );
     }
     Update();
 }
@@ -63,12 +63,27 @@ void PointerCalibrationDialog::CancelButtonClicked()
 
 void PointerCalibrationDialog::Update()
 {
+    if( !m_pointer->IsCalibratingTip() && !m_pointer->IsRefiningTipCalibration() )
+        disconnect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( Update() ) );
+
     cancelButton->setEnabled( m_pointer->IsCalibratingTip() );
+    calibrateButton->setEnabled( !m_pointer->IsRefiningTipCalibration() );
     if( m_pointer->IsCalibratingTip() )
         calibrateButton->setText( "Stop" );
+    else if( m_pointer->IsRefiningTipCalibration() )
+        calibrateButton->setText( "Refining..." );
     else
         calibrateButton->setText( "Start" );
 
+    if( m_pointer->IsCalibratingTip() || m_pointer->IsRefiningTipCalibration() )
+    {
+        coverageEdit->setText( QString( "%1 samples, %2 deg" )
+                                   .arg( m_pointer->GetNumberOfTipCalibrationSamples() )
+                                   .arg( m_pointer->GetTipCalibrationRotationSpread(), 0, 'f', 1 ) );
+    }
+    else
+        coverageEdit->setText( "-------" );
+
     double rms         = m_pointer->GetTipCalibrationRMSError();
     vtkMatrix4x4 * mat = m_pointer->GetCalibrationMatrix();
     if( mat && rms != 0 )
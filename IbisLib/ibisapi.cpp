@@ -20,7 +20,9 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "imageobject.h"
 #include "mainwindow.h"
 #include "objectplugininterface.h"
+#include "pointcloudobject.h"
 #include "pointerobject.h"
+#include "pointsobject.h"
 #include "polydataobject.h"
 #include "scenemanager.h"
 #include "sceneobject.h"
@@ -125,6 +127,43 @@ void IbisAPI::GetAllPointsObjects( QList<PointsObject *> & objects )
     return m_sceneManager->GetAllPointsObjects( objects );
 }
 
+int IbisAPI::FindClosestPoint( SceneObject * pointSet, double worldPos[3], double * distance )
+{
+    if( !pointSet ) return -1;
+    double localPos[3];
+    pointSet->WorldToLocal( worldPos, localPos );
+    if( PointsObject * points = PointsObject::SafeDownCast( pointSet ) )
+        return points->FindClosestPoint( localPos, distance );
+    if( PointCloudObject * cloud = PointCloudObject::SafeDownCast( pointSet ) )
+        return cloud->FindClosestPoint( localPos, distance );
+    return -1;
+}
+
+void IbisAPI::FindPointsWithinRadius( SceneObject * pointSet, double worldPos[3], double radius,
+                                      std::vector<int> & indices )
+{
+    indices.clear();
+    if( !pointSet ) return;
+    double localPos[3];
+    pointSet->WorldToLocal( worldPos, localPos );
+    if( PointsObject * points = PointsObject::SafeDownCast( pointSet ) )
+        points->FindPointsWithinRadius( localPos, radius, indices );
+    else if( PointCloudObject * cloud = PointCloudObject::SafeDownCast( pointSet ) )
+        cloud->FindPointsWithinRadius( localPos, radius, indices );
+}
+
+void IbisAPI::FindClosestNPoints( SceneObject * pointSet, int n, double worldPos[3], std::vector<int> & indices )
+{
+    indices.clear();
+    if( !pointSet ) return;
+    double localPos[3];
+    pointSet->WorldToLocal( worldPos, localPos );
+    if( PointsObject * points = PointsObject::SafeDownCast( pointSet ) )
+        points->FindClosestNPoints( n, localPos, indices );
+    else if( PointCloudObject * cloud = PointCloudObject::SafeDownCast( pointSet ) )
+        cloud->FindClosestNPoints( n, localPos, indices );
+}
+
 void IbisAPI::GetAllObjectsOfType( const char * typeName, QList<SceneObject *> & all )
 {
     return m_sceneManager->GetAllObjectsOfType( typeName, all );
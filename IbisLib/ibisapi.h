@@ -15,6 +15,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QList>
 #include <QMap>
 #include <QObject>
+#include <vector>
 
 class Application;
 class SceneManager;
@@ -197,6 +198,18 @@ public:
      * PointsObject is derived from SceneOBject. It is used to represent multiple points in the scene.
      */
     void GetAllPointsObjects( QList<PointsObject *> & objects );
+    /**
+     * @{
+     * Proximity queries on the points of a PointsObject or a PointCloudObject, using the spatial index they maintain.
+     * worldPos is in world coordinates, it is brought to the local space of the object where the query is done, so
+     * radius and distance are those of the local space. Returned indices are those of the points in the object.
+     * FindClosestPoint returns -1 and the other queries return no indices if pointSet is not one of these objects.
+     */
+    int FindClosestPoint( SceneObject * pointSet, double worldPos[3], double * distance = nullptr );
+    void FindPointsWithinRadius( SceneObject * pointSet, double worldPos[3], double radius,
+                                 std::vector<int> & indices );
+    void FindClosestNPoints( SceneObject * pointSet, int n, double worldPos[3], std::vector<int> & indices );
+    /** @}*/
     /**
      * Return a list of objects of type PointerObject.
      * PointerObject is derived from SceneOBject. It represents a pointer.
@@ -258,6 +258,26 @@ bool ImageObject::SetItkImage( IbisItkFloat3ImageType::Pointer image )
     return true;
 }
 
+void ImageObject::ItkImageModified()
+{
+    if( !this->ItkImage ) return;
+
+    // The importer runs again because the ITK image is newer than its output, then the VTK image is modified
+    this->ItkImage->Modified();
+    this->SetInternalImage( this->ItktovtkConverter->ConvertItkImageToVtkImage( this->ItkImage, nullptr ) );
+
+    double range[2];
+    this->Image->GetScalarRange( range );
+    if( this->Lut )
+        this->SetLutRange( range );
+    else
+    {
+        this->lutRange[0] = range[0];
+        this->lutRange[1] = range[1];
+        emit ObjectModified();
+    }
+}
+
 bool ImageObject::SetItkLabelImage( IbisItkUnsignedChar3ImageType::Pointer image )
 {
     if( !SanityCheck( image ) ) return false;
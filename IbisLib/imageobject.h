@@ -88,6 +88,8 @@ public:
     bool SetItkLabelImage( IbisItkUnsignedChar3ImageType::Pointer image );
     /** Return image data, ITK format. */
     IbisItkFloat3ImageType::Pointer GetItkImage() { return this->ItkImage; }
+    /** Update the VTK image, the histogram and the LUT range after the voxels of the ITK image were changed in place. */
+    void ItkImageModified();
     /** Return label image data, ITK format. */
     IbisItkUnsignedChar3ImageType::Pointer GetItkLabelImage() { return this->ItkLabelImage; }
     /** Set image data, VTK format.
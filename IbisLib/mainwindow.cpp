@@ -508,8 +508,8 @@ void MainWindow::SaveScene( bool asFile )
     if( asFile || sceneDir.isEmpty() )
     {
         QString initialFile = manager->GetSceneDirectory() + "/scene.xml";
-        fileName =
-            Application::GetInstance().GetFileNameSave( tr( "Save Scene" ), initialFile, tr( "xml file (*.xml)" ) );
+        fileName            = Application::GetInstance().GetFileNameSave(
+            tr( "Save Scene" ), initialFile, tr( "xml file (*.xml);;Ibis scene archive (*.ibis)" ) );
         if( !fileName.isEmpty() )
         {
             QFileInfo info( fileName );
@@ -544,8 +544,8 @@ void MainWindow::fileLoadScene()
         workingDir = QDir::homePath();
     }
 
-    QString fileName =
-        Application::GetInstance().GetFileNameOpen( tr( "Load Scene" ), workingDir, tr( "Scene files (*.xml)" ) );
+    QString fileName = Application::GetInstance().GetFileNameOpen( tr( "Load Scene" ), workingDir,
+                                                                   tr( "Scene files (*.xml *.ibis)" ) );
 
     if( !fileName.isEmpty() )
     {
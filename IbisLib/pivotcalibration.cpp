@@ -0,0 +1,233 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "pivotcalibration.h"
+
+#include <vtkAmoebaMinimizer.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkSmartPointer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const int SampleSize = 12;  // rotation rows followed by translation
+// Squared spread (rad^2) under which the rotations are considered to be around a single axis
+static const double MinimumSquaredSpread = 1e-6;
+// Distance (mm) under which the residuals of Refine() are weighted as in least squares
+static const double RefineRobustDistance = 0.5;
+
+namespace
+{
+struct RefineData
+{
+    PivotCalibration * self;
+    vtkAmoebaMinimizer * minimizer;
+};
+}  // namespace
+
+void PivotCalibrationRefineFunction( void * userData )
+{
+    RefineData * data           = static_cast<RefineData *>( userData );
+    PivotCalibration * self     = data->self;
+    vtkAmoebaMinimizer * params = data->minimizer;
+
+    double tip[3]   = { params->GetParameterValue( "tx" ), params->GetParameterValue( "ty" ),
+                        params->GetParameterValue( "tz" ) };
+    double pivot[3] = { params->GetParameterValue( "px" ), params->GetParameterValue( "py" ),
+                        params->GetParameterValue( "pz" ) };
+
+    // Pseudo-Huber cost: quadratic for small distances, linear for large ones
+    double delta2       = RefineRobustDistance * RefineRobustDistance;
+    double cost         = 0.0;
+    const double * s    = self->m_samples.data();
+    const double * sEnd = s + self->m_samples.size();
+    for( ; s < sEnd; s += SampleSize )
+    {
+        double d2 = 0.0;
+        for( int i = 0; i < 3; ++i )
+        {
+            double d = s[3 * i] * tip[0] + s[3 * i + 1] * tip[1] + s[3 * i + 2] * tip[2] + s[9 + i] - pivot[i];
+            d2 += d * d;
+        }
+        cost += sqrt( d2 + delta2 ) - RefineRobustDistance;
+    }
+    params->SetFunctionValue( cost / self->m_numberOfSamples );
+}
+
+PivotCalibration::PivotCalibration() { Clear(); }
+
+void PivotCalibration::Clear()
+{
+    m_numberOfSamples = 0;
+    memset( m_origin, 0, sizeof( m_origin ) );
+    memset( m_sumRtR, 0, sizeof( m_sumRtR ) );
+    memset( m_sumR, 0, sizeof( m_sumR ) );
+    memset( m_sumRtT, 0, sizeof( m_sumRtT ) );
+    memset( m_sumT, 0, sizeof( m_sumT ) );
+    m_sumTT = 0.0;
+    m_samples.clear();
+
+    m_valid = false;
+    memset( m_tip, 0, sizeof( m_tip ) );
+    memset( m_pivot, 0, sizeof( m_pivot ) );
+    m_rmsError       = 0.0;
+    m_rotationSpread = 0.0;
+}
+
+void PivotCalibration::AddSample( vtkMatrix4x4 * toolToTracker )
+{
+    if( m_numberOfSamples == 0 )
+    {
+        for( int i = 0; i < 3; ++i ) m_origin[i] = toolToTracker->GetElement( i, 3 );
+    }
+
+    double r[3][3], t[3];
+    for( int i = 0; i < 3; ++i )
+    {
+        for( int j = 0; j < 3; ++j ) r[i][j] = toolToTracker->GetElement( i, j );
+        t[i] = toolToTracker->GetElement( i, 3 ) - m_origin[i];
+    }
+
+    for( int i = 0; i < 3; ++i )
+    {
+        for( int j = 0; j < 3; ++j )
+        {
+            m_sumRtR[i][j] += r[0][i] * r[0][j] + r[1][i] * r[1][j] + r[2][i] * r[2][j];
+            m_sumR[i][j] += r[i][j];
+        }
+        m_sumRtT[i] += r[0][i] * t[0] + r[1][i] * t[1] + r[2][i] * t[2];
+        m_sumT[i] += t[i];
+        m_sumTT += t[i] * t[i];
+    }
+    ++m_numberOfSamples;
+
+    m_samples.insert( m_samples.end(), &r[0][0], &r[0][0] + 9 );
+    m_samples.insert( m_samples.end(), t, t + 3 );
+}
+
+bool PivotCalibration::Update()
+{
+    m_valid          = false;
+    m_rmsError       = 0.0;
+    m_rotationSpread = 0.0;
+    if( m_numberOfSamples < 3 ) return false;
+    double n = m_numberOfSamples;
+
+    // Spread of the rotations: smallest eigenvalue of sum( (R - mean(R))^T (R - mean(R)) ) / n
+    double cov[3][3], eigenValues[3], eigenVectors[3][3];
+    for( int i = 0; i < 3; ++i )
+    {
+        for( int j = 0; j < 3; ++j )
+        {
+            double meanRtR =
+                ( m_sumR[0][i] * m_sumR[0][j] + m_sumR[1][i] * m_sumR[1][j] + m_sumR[2][i] * m_sumR[2][j] ) / n;
+            cov[i][j] = ( m_sumRtR[i][j] - meanRtR ) / n;
+        }
+    }
+    double * covRows[3]    = { cov[0], cov[1], cov[2] };
+    double * vectorRows[3] = { eigenVectors[0], eigenVectors[1], eigenVectors[2] };
+    vtkMath::Jacobi( covRows, eigenValues, vectorRows );
+    // A rotation by angle a moves a unit vector by 2 * sin( a / 2 )
+    double minSquaredSpread = std::max( eigenValues[2], 0.0 );
+    double spread           = 2.0 * asin( std::min( 1.0, sqrt( minSquaredSpread ) / 2.0 ) );
+    m_rotationSpread        = vtkMath::DegreesFromRadians( spread );
+    if( minSquaredSpread < MinimumSquaredSpread ) return false;
+
+    // Normal equations of [R -I] * (tip, pivot) = -T
+    double ata[6][6], atb[6];
+    memset( ata, 0, sizeof( ata ) );
+    for( int i = 0; i < 3; ++i )
+    {
+        for( int j = 0; j < 3; ++j )
+        {
+            ata[i][j]     = m_sumRtR[i][j];
+            ata[i][j + 3] = -m_sumR[j][i];
+            ata[i + 3][j] = -m_sumR[i][j];
+        }
+        ata[i + 3][i + 3] = n;
+        atb[i]            = -m_sumRtT[i];
+        atb[i + 3]        = m_sumT[i];
+    }
+
+    double a[6][6], x[6];
+    memcpy( a, ata, sizeof( a ) );
+    memcpy( x, atb, sizeof( x ) );
+    double * rows[6] = { a[0], a[1], a[2], a[3], a[4], a[5] };
+    if( !vtkMath::SolveLinearSystem( rows, x, 6 ) ) return false;
+
+    // Sum of squared residuals: b^T b - 2 x^T A^T b + x^T A^T A x
+    double residual = m_sumTT;
+    for( int i = 0; i < 6; ++i )
+    {
+        double atax = 0.0;
+        for( int j = 0; j < 6; ++j ) atax += ata[i][j] * x[j];
+        residual += x[i] * ( atax - 2.0 * atb[i] );
+    }
+    m_rmsError = sqrt( std::max( residual, 0.0 ) / n );
+
+    for( int i = 0; i < 3; ++i )
+    {
+        m_tip[i]   = x[i];
+        m_pivot[i] = x[i + 3] + m_origin[i];
+    }
+    m_valid = true;
+    return true;
+}
+
+bool PivotCalibration::Refine()
+{
+    if( !m_valid && !Update() ) return false;
+
+    vtkSmartPointer<vtkAmoebaMinimizer> minimizer = vtkSmartPointer<vtkAmoebaMinimizer>::New();
+    RefineData data                               = { this, minimizer };
+    minimizer->SetFunction( PivotCalibrationRefineFunction, &data );
+    minimizer->SetFunctionArgDelete( nullptr );
+    const char * names[6] = { "tx", "ty", "tz", "px", "py", "pz" };
+    for( int i = 0; i < 3; ++i )
+    {
+        minimizer->SetParameterValue( names[i], m_tip[i] );
+        minimizer->SetParameterScale( names[i], 1.0 );
+        minimizer->SetParameterValue( names[i + 3], m_pivot[i] - m_origin[i] );
+        minimizer->SetParameterScale( names[i + 3], 1.0 );
+    }
+    minimizer->SetParameterTolerance( 1e-4 );
+    minimizer->SetMaxIterations( 5000 );
+    minimizer->Minimize();
+
+    double tip[3], pivot[3];
+    for( int i = 0; i < 3; ++i )
+    {
+        tip[i]     = minimizer->GetParameterValue( names[i] );
+        pivot[i]   = minimizer->GetParameterValue( names[i + 3] );
+        m_tip[i]   = tip[i];
+        m_pivot[i] = pivot[i] + m_origin[i];
+    }
+    m_rmsError = ComputeRMSError( tip, pivot );
+    return true;
+}
+
+double PivotCalibration::ComputeRMSError( const double tip[3], const double pivot[3] )
+{
+    if( m_numberOfSamples == 0 ) return 0.0;
+    double sum          = 0.0;
+    const double * s    = m_samples.data();
+    const double * sEnd = s + m_samples.size();
+    for( ; s < sEnd; s += SampleSize )
+    {
+        for( int i = 0; i < 3; ++i )
+        {
+            double d = s[3 * i] * tip[0] + s[3 * i + 1] * tip[1] + s[3 * i + 2] * tip[2] + s[9 + i] - pivot[i];
+            sum += d * d;
+        }
+    }
+    return sqrt( sum / m_numberOfSamples );
+}
@@ -0,0 +1,74 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef PIVOTCALIBRATION_H
+#define PIVOTCALIBRATION_H
+
+#include <vector>
+
+class vtkMatrix4x4;
+
+// Pivot calibration of a tracked tool: find the tip of the tool (in tool coordinates) and the fixed point it
+// pivots around (in tracker coordinates) from poses recorded while the tool is rotated around its tip.
+//
+// Every pose (R, T) gives 3 equations of the linear system R * tip - pivot = -T. Only the sums of the normal
+// equations are kept, so adding a sample and solving the 6x6 system, see Update(), cost the same whatever the
+// number of samples. The RMS distance between the tip and the pivot is computed from the same sums.
+// The poses are also kept to run Refine() once when the acquisition is finished.
+class PivotCalibration
+{
+public:
+    PivotCalibration();
+
+    void Clear();
+    void AddSample( vtkMatrix4x4 * toolToTracker );
+    int GetNumberOfSamples() { return m_numberOfSamples; }
+
+    // Solve the linear system from the current sums. Returns false if there are not enough samples or if the
+    // tool was not rotated around 2 different axes.
+    bool Update();
+    bool IsValid() { return m_valid; }
+    const double * GetTip() { return m_tip; }
+    const double * GetPivot() { return m_pivot; }
+    double GetRMSError() { return m_rmsError; }
+
+    // Angular spread of the samples in degrees, in the direction where the rotations of the tool are the
+    // smallest. The tip is poorly determined along that direction when the spread is small. Valid after Update().
+    double GetRotationSpread() { return m_rotationSpread; }
+
+    // Minimize the distances between the tip and the pivot over all samples, starting from the linear solution.
+    // The distances are weighted so that the samples taken while the tip slipped have less influence than in
+    // the least squares solution. This is O(n) per iteration, it should be called from a worker thread.
+    bool Refine();
+
+protected:
+    friend void PivotCalibrationRefineFunction( void * userData );
+    double ComputeRMSError( const double tip[3], const double pivot[3] );
+
+    // Translations are relative to the first sample to avoid cancellation in the sums
+    double m_origin[3];
+    int m_numberOfSamples;
+    double m_sumRtR[3][3];
+    double m_sumR[3][3];
+    double m_sumRtT[3];
+    double m_sumT[3];
+    double m_sumTT;
+
+    // Rows of the rotation and translation of every sample, relative to m_origin
+    std::vector<double> m_samples;
+
+    bool m_valid;
+    double m_tip[3];
+    double m_pivot[3];
+    double m_rmsError;
+    double m_rotationSpread;
+};
+
+#endif
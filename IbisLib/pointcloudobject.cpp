@@ -120,11 +120,27 @@ void PointCloudObject::SetPointCloudArray( vtkPoints * pointCloudArray )
     for( int i = 0; i < pointCloudArray->GetNumberOfPoints(); i++ )
     {
         m_PointCloudArray->InsertNextPoint( pointCloudArray->GetPoint( i ) );
+        m_PointIndex.InsertNextPoint( pointCloudArray->GetPoint( i ) );
     }
     this->m_PointsPolydata->SetPoints( m_PointCloudArray );
     emit ObjectModified();
 }
 
+int PointCloudObject::FindClosestPoint( const double pos[3], double * distance )
+{
+    return m_PointIndex.FindClosestPoint( pos, distance );
+}
+
+void PointCloudObject::FindPointsWithinRadius( const double pos[3], double radius, std::vector<int> & ids )
+{
+    m_PointIndex.FindPointsWithinRadius( pos, radius, ids );
+}
+
+void PointCloudObject::FindClosestNPoints( int n, const double pos[3], std::vector<int> & ids )
+{
+    m_PointIndex.FindClosestNPoints( n, pos, ids );
+}
+
 void PointCloudObject::SetColor( double color[3] )
 {
     for( int i = 0; i < 3; i++ ) this->m_Color[i] = color[i];
@@ -19,7 +19,9 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QObject>
 #include <QVector>
 #include <map>
+#include <vector>
 
+#include "pointindex.h"
 #include "sceneobject.h"
 #include "serializer.h"
 
@@ -56,6 +58,11 @@ public:
 
     void SetPointCloudArray( vtkPoints * pointCloudArray );
 
+    // Proximity queries, positions are in local space
+    int FindClosestPoint( const double pos[3], double * distance = nullptr );
+    void FindPointsWithinRadius( const double pos[3], double radius, std::vector<int> & ids );
+    void FindClosestNPoints( int n, const double pos[3], std::vector<int> & ids );
+
 signals:
 
     void ObjectViewChanged();
@@ -69,6 +76,7 @@ protected:
     vtkSmartPointer<vtkPoints> m_PointCloudArray;
     vtkSmartPointer<vtkPolyData> m_PointsPolydata;
     vtkSmartPointer<vtkVertexGlyphFilter> m_PointCloudGlyphFilter;
+    PointIndex m_PointIndex;
 
     typedef std::map<View *, vtkActor *> PointCloudObjectViewAssociationType;
     PointCloudObjectViewAssociationType m_PointCloudObjectInstances;
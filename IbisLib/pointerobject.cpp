@@ -11,9 +11,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "pointerobject.h"
 
 #include <vtkActor.h>
-#include <vtkAmoebaMinimizer.h>
 #include <vtkAxes.h>
-#include <vtkDoubleArray.h>
 #include <vtkMath.h>
 #include <vtkObjectFactory.h>
 #include <vtkPolyDataMapper.h>
@@ -21,8 +19,11 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vtkRenderer.h>
 #include <vtkTransform.h>
 
+#include <QThreadPool>
+
 #include "application.h"
 #include "hardwaremodule.h"
+#include "pivotcalibration.h"
 #include "pointerobjectsettingsdialog.h"
 #include "pointsobject.h"
 #include "scenemanager.h"
@@ -41,10 +42,13 @@ PointerObject::PointerObject()
     m_backupCalibrationRMS    = 0.0;
     m_backupCalibrationMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
 
-    m_calibrating      = 0;
-    m_minimizer        = vtkAmoebaMinimizer::New();
-    m_calibrationArray = vtkDoubleArray::New();
-    m_calibrationArray->SetNumberOfComponents( 16 );
+    m_calibrating                    = 0;
+    m_tipCalibration                 = std::make_shared<PivotCalibration>();
+    m_lastCalibrationSampleTimestamp = -1.0;
+    m_tipCalibrationRefinement       = new QThreadPool;
+    m_tipCalibrationRefinement->setMaxThreadCount( 1 );
+    m_refiningTipCalibration = false;
+    m_tipCalibrationId       = 0;
 
     m_pointerAxis[0]  = 0.0;
     m_pointerAxis[1]  = 0.0;
@@ -61,8 +65,8 @@ PointerObject::PointerObject()
 
 PointerObject::~PointerObject()
 {
-    m_calibrationArray->Delete();
-    m_minimizer->Delete();
+    m_tipCalibrationRefinement->waitForDone();
+    delete m_tipCalibrationRefinement;
 }
 
 void PointerObject::Setup( View * view )
@@ -147,106 +151,90 @@ void PointerObject::StartTipCalibration()
 {
     m_backupCalibrationRMS = m_lastTipCalibrationRMS;
     m_backupCalibrationMatrix->DeepCopy( GetCalibrationMatrix() );
-    m_calibrationArray->SetNumberOfTuples( 0 );
+    m_tipCalibration                 = std::make_shared<PivotCalibration>();
+    m_lastCalibrationSampleTimestamp = -1.0;
+    m_refiningTipCalibration         = false;
+    ++m_tipCalibrationId;
     m_calibrating = 1;
     connect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( UpdateTipCalibration() ) );
 }
 
-//----------------------------------------------------------------------------
-void vtkTrackerToolCalibrationFunction( void * userData )
+void PointerObject::UpdateTipCalibration()
 {
-    PointerObject * self = (PointerObject *)userData;
-
-    int i;
-    int n = self->m_calibrationArray->GetNumberOfTuples();
-
-    double x = self->m_minimizer->GetParameterValue( "x" );
-    double y = self->m_minimizer->GetParameterValue( "y" );
-    double z = self->m_minimizer->GetParameterValue( "z" );
-    double nx, ny, nz, sx, sy, sz, sxx, syy, szz;
-
-    double matrix[4][4];
-
-    sx = sy = sz = 0.0;
-    sxx = syy = szz = 0.0;
-
-    for( i = 0; i < n; i++ )
+    // Solving from the sums of the normal equations does not depend on the number of samples
+    if( !m_tipCalibration->Update() )
     {
-        self->m_calibrationArray->GetTuple( i, *matrix );
-
-        nx = matrix[0][0] * x + matrix[0][1] * y + matrix[0][2] * z + matrix[0][3];
-        ny = matrix[1][0] * x + matrix[1][1] * y + matrix[1][2] * z + matrix[1][3];
-        nz = matrix[2][0] * x + matrix[2][1] * y + matrix[2][2] * z + matrix[2][3];
-
-        sx += nx;
-        sy += ny;
-        sz += nz;
-
-        sxx += nx * nx;
-        syy += ny * ny;
-        szz += nz * nz;
-    }
-
-    double r;
-
-    if( n > 1 )
-    {
-        r = sqrt( ( sxx - sx * sx / n ) / ( n - 1 ) + ( syy - sy * sy / n ) / ( n - 1 ) +
-                  ( szz - sz * sz / n ) / ( n - 1 ) );
+        m_lastTipCalibrationRMS = 0.0;
+        return;
     }
-    else
-    {
-        r = 0;
-    }
-
-    self->m_minimizer->SetFunctionValue( r );
-    /*
-    cerr << self->Minimizer->GetIterations() << " (" << x << ", " << y << ", " << z << ")" << " " << r << " " << (sxx -
-    sx*sx/n)/(n-1) << (syy - sy*sy/n)/(n-1) << (szz - sz*sz/n)/(n-1) << "\n";
-    */
+    SetTipCalibration( m_tipCalibration->GetTip(), m_tipCalibration->GetRMSError() );
 }
 
-void PointerObject::UpdateTipCalibration()
+void PointerObject::SetTipCalibration( const double tip[3], double rms )
 {
-    vtkMatrix4x4 * mat = vtkMatrix4x4::New();
-    // do tip calibration:
-    this->m_minimizer->Initialize();
-    this->m_minimizer->SetFunction( vtkTrackerToolCalibrationFunction, this );
-    this->m_minimizer->SetFunctionArgDelete( NULL );
-    this->m_minimizer->SetParameterValue( "x", 0 );
-    this->m_minimizer->SetParameterScale( "x", 1000 );
-    this->m_minimizer->SetParameterValue( "y", 0 );
-    this->m_minimizer->SetParameterScale( "y", 1000 );
-    this->m_minimizer->SetParameterValue( "z", 0 );
-    this->m_minimizer->SetParameterScale( "z", 1000 );
-
-    this->m_minimizer->Minimize();
-    m_lastTipCalibrationRMS = this->m_minimizer->GetFunctionValue();
-
-    double x = this->m_minimizer->GetParameterValue( "x" );
-    double y = this->m_minimizer->GetParameterValue( "y" );
-    double z = this->m_minimizer->GetParameterValue( "z" );
-
-    mat->SetElement( 0, 3, x );
-    mat->SetElement( 1, 3, y );
-    mat->SetElement( 2, 3, z );
-
+    vtkSmartPointer<vtkMatrix4x4> mat = vtkSmartPointer<vtkMatrix4x4>::New();
+    mat->SetElement( 0, 3, tip[0] );
+    mat->SetElement( 1, 3, tip[1] );
+    mat->SetElement( 2, 3, tip[2] );
+    m_lastTipCalibrationRMS = rms;
     SetCalibrationMatrix( mat );
     emit ObjectModified();
 }
 
+void PointerObject::FinishTipCalibration( std::shared_ptr<PivotCalibration> calibration, int calibrationId )
+{
+    if( calibrationId != m_tipCalibrationId ) return;
+    m_refiningTipCalibration = false;
+    SetTipCalibration( calibration->GetTip(), calibration->GetRMSError() );
+}
+
 bool PointerObject::IsCalibratingTip() { return m_calibrating > 0 ? true : false; }
 
 double PointerObject::GetTipCalibrationRMSError() { return m_lastTipCalibrationRMS; }
 
+int PointerObject::GetNumberOfTipCalibrationSamples() { return m_tipCalibration->GetNumberOfSamples(); }
+
+double PointerObject::GetTipCalibrationRotationSpread() { return m_tipCalibration->GetRotationSpread(); }
+
 void PointerObject::CancelTipCalibration()
 {
-    m_calibrating           = 0;
+    disconnect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( UpdateTipCalibration() ) );
+    m_calibrating            = 0;
+    m_refiningTipCalibration = false;
+    ++m_tipCalibrationId;
     m_lastTipCalibrationRMS = m_backupCalibrationRMS;
     SetCalibrationMatrix( m_backupCalibrationMatrix );
 }
 
-void PointerObject::StopTipCalibration() { m_calibrating = 0; }
+void PointerObject::StopTipCalibration()
+{
+    if( !m_calibrating ) return;
+    disconnect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( UpdateTipCalibration() ) );
+    m_calibrating = 0;
+
+    // Not enough samples, keep the previous calibration
+    if( !m_tipCalibration->Update() )
+    {
+        m_lastTipCalibrationRMS = m_backupCalibrationRMS;
+        SetCalibrationMatrix( m_backupCalibrationMatrix );
+        return;
+    }
+    SetTipCalibration( m_tipCalibration->GetTip(), m_tipCalibration->GetRMSError() );
+
+    // The nonlinear refinement goes through all the samples, run it once in the background and apply the
+    // result in the main thread, unless the calibration was restarted or cancelled in the mean time.
+    m_refiningTipCalibration                      = true;
+    std::shared_ptr<PivotCalibration> calibration = m_tipCalibration;
+    int calibrationId                             = m_tipCalibrationId;
+    m_tipCalibrationRefinement->start(
+        [this, calibration, calibrationId]()
+        {
+            calibration->Refine();
+            QMetaObject::invokeMethod(
+                this, [this, calibration, calibrationId]() { FinishTipCalibration( calibration, calibrationId ); },
+                Qt::QueuedConnection );
+        } );
+}
 
 void PointerObject::CreatePointerPickedPointsObject()
 {
@@ -365,13 +353,16 @@ void PointerObject::UpdateTip()
 }
 
 //----------------------------------------------------------------------------
-// Insert the latest matrix in the buffer in the calibration array
+// Add the latest pose of the pointer to the tip calibration
 int PointerObject::InsertNextCalibrationPoint()
 {
-    int ret                  = -1;
-    vtkTransform * transform = this->GetUncalibratedTransform();
-    vtkMatrix4x4 * mat       = vtkMatrix4x4::New();
-    transform->GetMatrix( mat );
-    ret = m_calibrationArray->InsertNextTuple( *mat->Element );
-    return ret;
+    // The clock can tick faster than the tracker, don't count the same pose twice
+    double timestamp = GetLastTimestamp();
+    if( !IsOk() || ( timestamp >= 0 && timestamp == m_lastCalibrationSampleTimestamp ) ) return -1;
+    m_lastCalibrationSampleTimestamp = timestamp;
+
+    vtkSmartPointer<vtkMatrix4x4> mat = vtkSmartPointer<vtkMatrix4x4>::New();
+    this->GetUncalibratedTransform()->GetMatrix( mat );
+    m_tipCalibration->AddSample( mat );
+    return m_tipCalibration->GetNumberOfSamples() - 1;
 }
@@ -17,6 +17,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QObject>
 #include <QVector>
 #include <map>
+#include <memory>
 
 #include "hardwaremodule.h"
 #include "trackedsceneobject.h"
@@ -26,8 +27,8 @@ class vtkMatrix4x4;
 class vtkActor;
 class PointsObject;
 class Tracker;
-class vtkAmoebaMinimizer;
-class vtkDoubleArray;
+class PivotCalibration;
+class QThreadPool;
 
 class PointerObject : public TrackedSceneObject
 {
@@ -49,11 +50,16 @@ public:
     double * GetTipPosition();
     void GetMainAxisPosition( double pos[3] );
 
-    // Tip calibration
+    // Tip calibration: the tip is updated on every clock tick while calibrating. When the calibration is
+    // stopped, the tip is refined once from all the samples on a worker thread.
     void StartTipCalibration();
     int InsertNextCalibrationPoint();
     bool IsCalibratingTip();
+    bool IsRefiningTipCalibration() { return m_refiningTipCalibration; }
     double GetTipCalibrationRMSError();
+    int GetNumberOfTipCalibrationSamples();
+    // Smallest angular spread of the pointer orientations in degrees, see PivotCalibration
+    double GetTipCalibrationRotationSpread();
     void CancelTipCalibration();
     void StopTipCalibration();
 
@@ -86,6 +92,8 @@ protected:
     virtual void Show() override;
     void ObjectAddedToScene() override;
     void ObjectRemovedFromScene() override;
+    void SetTipCalibration( const double tip[3], double rms );
+    void FinishTipCalibration( std::shared_ptr<PivotCalibration> calibration, int calibrationId );
 
     double m_lastTipCalibrationRMS;
     double m_backupCalibrationRMS;
@@ -98,10 +106,11 @@ protected:
     double m_tipLength;
 
     int m_calibrating;
-    vtkAmoebaMinimizer * m_minimizer;
-    vtkDoubleArray * m_calibrationArray;
-
-    friend void vtkTrackerToolCalibrationFunction( void * userData );
+    std::shared_ptr<PivotCalibration> m_tipCalibration;
+    double m_lastCalibrationSampleTimestamp;
+    QThreadPool * m_tipCalibrationRefinement;
+    bool m_refiningTipCalibration;
+    int m_tipCalibrationId;  // results of the refinement of a previous calibration are discarded
 
     struct PerViewElements
     {
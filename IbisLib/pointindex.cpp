@@ -0,0 +1,390 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "pointindex.h"
+
+#include <vtkPoints.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <utility>
+
+// Cell size (mm) in automatic mode until there are enough points to choose one, about the size of a landmark
+static const double DefaultCellSize = 10.0;
+// In automatic mode, the grid is rebuilt when there are more points than this per occupied cell
+static const int CrowdedCellPoints = 8;
+// Cell coordinates are packed in 21 bits each
+static const int CellLimit = ( 1 << 20 ) - 1;
+
+PointIndex::PointIndex()
+{
+    m_cellSize                = DefaultCellSize;
+    m_automaticCellSize       = true;
+    m_numberOfPointsAtRebuild = 0;
+    Clear();
+}
+
+void PointIndex::SetCellSize( double size )
+{
+    m_automaticCellSize = size <= 0.0;
+    m_cellSize          = m_automaticCellSize ? DefaultCellSize : size;
+    Rebuild();
+}
+
+void PointIndex::Clear()
+{
+    m_cells.clear();
+    m_coordinates.clear();
+    m_pointCells.clear();
+    m_numberOfPointsAtRebuild = 0;
+    for( int i = 0; i < 3; ++i )
+    {
+        m_cellMin[i] = CellLimit;
+        m_cellMax[i] = -CellLimit;
+    }
+}
+
+void PointIndex::Build( vtkPoints * points )
+{
+    vtkIdType nbPoints = points ? points->GetNumberOfPoints() : 0;
+    m_coordinates.resize( 3 * nbPoints );
+    for( vtkIdType i = 0; i < nbPoints; ++i ) points->GetPoint( i, &m_coordinates[3 * i] );
+    m_pointCells.resize( nbPoints );
+    Rebuild();
+}
+
+void PointIndex::InsertNextPoint( const double p[3] )
+{
+    m_coordinates.insert( m_coordinates.end(), p, p + 3 );
+    m_pointCells.push_back( 0 );
+    AddToCell( GetNumberOfPoints() - 1 );
+
+    // Rebuilding only when the number of points has doubled keeps the cost of insertions constant on average
+    int nbPoints = GetNumberOfPoints();
+    if( m_automaticCellSize && nbPoints > CrowdedCellPoints * int( m_cells.size() ) &&
+        nbPoints >= 2 * m_numberOfPointsAtRebuild )
+        Rebuild();
+}
+
+void PointIndex::SetPoint( int id, const double p[3] )
+{
+    std::copy( p, p + 3, &m_coordinates[3 * id] );
+    int cell[3];
+    GetCell( p, cell );
+    if( GetCellKey( cell ) == m_pointCells[id] ) return;
+    RemoveFromCell( id );
+    AddToCell( id );
+}
+
+void PointIndex::RemovePoint( int id )
+{
+    RemoveFromCell( id );
+    m_coordinates.erase( m_coordinates.begin() + 3 * id, m_coordinates.begin() + 3 * id + 3 );
+    m_pointCells.erase( m_pointCells.begin() + id );
+    for( auto & cell : m_cells )
+    {
+        for( int & other : cell.second )
+        {
+            if( other > id ) --other;
+        }
+    }
+}
+
+int PointIndex::FindClosestPoint( const double p[3], double * distance )
+{
+    int nbPoints = GetNumberOfPoints();
+    if( nbPoints == 0 ) return -1;
+
+    int closest    = -1;
+    double minDist = std::numeric_limits<double>::max();
+    auto visit     = [&]( const std::vector<int> & ids ) {
+        for( int id : ids )
+        {
+            double d = Distance2( id, p );
+            if( d < minDist )
+            {
+                minDist = d;
+                closest = id;
+            }
+        }
+    };
+
+    // After the rings up to r have been visited, the points left are at least r * m_cellSize away
+    int cell[3];
+    GetCell( p, cell );
+    int maxRing     = GetMaximumRing( cell );
+    int visited     = 0;
+    bool bruteForce = false;
+    for( int ring = GetMinimumRing( cell ); ring <= maxRing; ++ring )
+    {
+        double reached = ( ring - 1 ) * m_cellSize;
+        if( closest != -1 && ring > 0 && minDist <= reached * reached ) break;
+        visited += VisitRing( cell, ring, visit );
+        if( visited > nbPoints + 64 )
+        {
+            bruteForce = true;
+            break;
+        }
+    }
+    if( bruteForce )
+    {
+        for( int id = 0; id < nbPoints; ++id )
+        {
+            double d = Distance2( id, p );
+            if( d < minDist )
+            {
+                minDist = d;
+                closest = id;
+            }
+        }
+    }
+
+    if( distance ) *distance = sqrt( minDist );
+    return closest;
+}
+
+void PointIndex::FindPointsWithinRadius( const double p[3], double radius, std::vector<int> & ids )
+{
+    ids.clear();
+    int nbPoints = GetNumberOfPoints();
+    if( nbPoints == 0 || radius < 0.0 ) return;
+
+    double radius2 = radius * radius;
+    double lowPoint[3], highPoint[3];
+    for( int i = 0; i < 3; ++i )
+    {
+        lowPoint[i]  = p[i] - radius;
+        highPoint[i] = p[i] + radius;
+    }
+    int low[3], high[3];
+    GetCell( lowPoint, low );
+    GetCell( highPoint, high );
+    double nbCells = 1.0;
+    for( int i = 0; i < 3; ++i )
+    {
+        low[i]  = std::max( low[i], m_cellMin[i] );
+        high[i] = std::min( high[i], m_cellMax[i] );
+        if( low[i] > high[i] ) return;
+        nbCells *= high[i] - low[i] + 1;
+    }
+
+    if( nbCells > nbPoints )
+    {
+        for( int id = 0; id < nbPoints; ++id )
+        {
+            if( Distance2( id, p ) <= radius2 ) ids.push_back( id );
+        }
+        return;
+    }
+
+    int cell[3];
+    for( cell[0] = low[0]; cell[0] <= high[0]; ++cell[0] )
+    {
+        for( cell[1] = low[1]; cell[1] <= high[1]; ++cell[1] )
+        {
+            for( cell[2] = low[2]; cell[2] <= high[2]; ++cell[2] )
+            {
+                auto it = m_cells.find( GetCellKey( cell ) );
+                if( it == m_cells.end() ) continue;
+                for( int id : it->second )
+                {
+                    if( Distance2( id, p ) <= radius2 ) ids.push_back( id );
+                }
+            }
+        }
+    }
+}
+
+void PointIndex::FindClosestNPoints( int n, const double p[3], std::vector<int> & ids )
+{
+    ids.clear();
+    int nbPoints = GetNumberOfPoints();
+    n            = std::min( n, nbPoints );
+    if( n <= 0 ) return;
+
+    // Max-heap of the n closest points found so far
+    typedef std::pair<double, int> Candidate;
+    std::priority_queue<Candidate> closest;
+    auto add = [&]( int id ) {
+        double d = Distance2( id, p );
+        if( int( closest.size() ) < n )
+            closest.push( Candidate( d, id ) );
+        else if( d < closest.top().first )
+        {
+            closest.pop();
+            closest.push( Candidate( d, id ) );
+        }
+    };
+    auto visit = [&]( const std::vector<int> & cellIds ) {
+        for( int id : cellIds ) add( id );
+    };
+
+    int cell[3];
+    GetCell( p, cell );
+    int maxRing     = GetMaximumRing( cell );
+    int visited     = 0;
+    bool bruteForce = false;
+    for( int ring = GetMinimumRing( cell ); ring <= maxRing; ++ring )
+    {
+        double reached = ( ring - 1 ) * m_cellSize;
+        if( int( closest.size() ) == n && ring > 0 && closest.top().first <= reached * reached ) break;
+        visited += VisitRing( cell, ring, visit );
+        if( visited > nbPoints + 64 )
+        {
+            bruteForce = true;
+            break;
+        }
+    }
+    if( bruteForce )
+    {
+        closest = std::priority_queue<Candidate>();
+        for( int id = 0; id < nbPoints; ++id ) add( id );
+    }
+
+    ids.resize( closest.size() );
+    for( int i = int( ids.size() ) - 1; i >= 0; --i )
+    {
+        ids[i] = closest.top().second;
+        closest.pop();
+    }
+}
+
+void PointIndex::Rebuild()
+{
+    m_cells.clear();
+    for( int i = 0; i < 3; ++i )
+    {
+        m_cellMin[i] = CellLimit;
+        m_cellMax[i] = -CellLimit;
+    }
+    if( m_automaticCellSize ) ComputeCellSize();
+    m_numberOfPointsAtRebuild = GetNumberOfPoints();
+    for( int id = 0; id < GetNumberOfPoints(); ++id ) AddToCell( id );
+}
+
+void PointIndex::ComputeCellSize()
+{
+    // About one point per cell for points filling their bounding box, more for points on a surface
+    m_cellSize   = DefaultCellSize;
+    int nbPoints = GetNumberOfPoints();
+    if( nbPoints < 2 ) return;
+    double low[3], high[3];
+    for( int i = 0; i < 3; ++i )
+    {
+        low[i]  = std::numeric_limits<double>::max();
+        high[i] = -std::numeric_limits<double>::max();
+    }
+    for( int id = 0; id < nbPoints; ++id )
+    {
+        const double * p = GetPoint( id );
+        for( int i = 0; i < 3; ++i )
+        {
+            low[i]  = std::min( low[i], p[i] );
+            high[i] = std::max( high[i], p[i] );
+        }
+    }
+    double extent = std::max( high[0] - low[0], std::max( high[1] - low[1], high[2] - low[2] ) );
+    double size   = extent / ceil( cbrt( double( nbPoints ) ) );
+    // Cells much smaller than the extent would not fit in the packed cell coordinates
+    if( size > extent / CellLimit ) m_cellSize = size;
+}
+
+void PointIndex::GetCell( const double p[3], int cell[3] )
+{
+    for( int i = 0; i < 3; ++i )
+    {
+        double c = floor( p[i] / m_cellSize );
+        cell[i]  = int( std::max( -double( CellLimit ), std::min( double( CellLimit ), c ) ) );
+    }
+}
+
+PointIndex::CellKey PointIndex::GetCellKey( const int cell[3] )
+{
+    return ( CellKey( cell[0] + CellLimit + 1 ) << 42 ) | ( CellKey( cell[1] + CellLimit + 1 ) << 21 ) |
+           CellKey( cell[2] + CellLimit + 1 );
+}
+
+void PointIndex::AddToCell( int id )
+{
+    int cell[3];
+    GetCell( GetPoint( id ), cell );
+    CellKey key = GetCellKey( cell );
+    m_cells[key].push_back( id );
+    m_pointCells[id] = key;
+    for( int i = 0; i < 3; ++i )
+    {
+        m_cellMin[i] = std::min( m_cellMin[i], cell[i] );
+        m_cellMax[i] = std::max( m_cellMax[i], cell[i] );
+    }
+}
+
+void PointIndex::RemoveFromCell( int id )
+{
+    auto it = m_cells.find( m_pointCells[id] );
+    if( it == m_cells.end() ) return;
+    std::vector<int> & ids = it->second;
+    ids.erase( std::find( ids.begin(), ids.end(), id ) );
+    if( ids.empty() ) m_cells.erase( it );
+}
+
+double PointIndex::Distance2( int id, const double p[3] )
+{
+    const double * q = GetPoint( id );
+    return ( q[0] - p[0] ) * ( q[0] - p[0] ) + ( q[1] - p[1] ) * ( q[1] - p[1] ) + ( q[2] - p[2] ) * ( q[2] - p[2] );
+}
+
+template <class Visitor>
+int PointIndex::VisitRing( const int cell[3], int ring, Visitor & visit )
+{
+    int low[3], high[3];
+    for( int i = 0; i < 3; ++i )
+    {
+        low[i]  = std::max( cell[i] - ring, m_cellMin[i] );
+        high[i] = std::min( cell[i] + ring, m_cellMax[i] );
+    }
+
+    int nbVisited = 0;
+    int c[3];
+    for( c[0] = low[0]; c[0] <= high[0]; ++c[0] )
+    {
+        bool onFaceX = std::abs( c[0] - cell[0] ) == ring;
+        for( c[1] = low[1]; c[1] <= high[1]; ++c[1] )
+        {
+            bool onFace = onFaceX || std::abs( c[1] - cell[1] ) == ring;
+            // Inside the ring only the 2 cells on the z faces belong to it
+            int step = onFace ? 1 : 2 * ring;
+            c[2]     = onFace ? low[2] : cell[2] - ring;
+            for( ; c[2] <= high[2]; c[2] += step )
+            {
+                if( c[2] < low[2] ) continue;
+                ++nbVisited;
+                auto it = m_cells.find( GetCellKey( c ) );
+                if( it != m_cells.end() ) visit( it->second );
+            }
+        }
+    }
+    return nbVisited;
+}
+
+int PointIndex::GetMaximumRing( const int cell[3] )
+{
+    int ring = 0;
+    for( int i = 0; i < 3; ++i ) ring = std::max( ring, std::max( cell[i] - m_cellMin[i], m_cellMax[i] - cell[i] ) );
+    return ring;
+}
+
+int PointIndex::GetMinimumRing( const int cell[3] )
+{
+    int ring = 0;
+    for( int i = 0; i < 3; ++i ) ring = std::max( ring, std::max( m_cellMin[i] - cell[i], cell[i] - m_cellMax[i] ) );
+    return ring;
+}
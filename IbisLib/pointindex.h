@@ -0,0 +1,84 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef POINTINDEX_H
+#define POINTINDEX_H
+
+#include <unordered_map>
+#include <vector>
+
+class vtkPoints;
+
+// Uniform grid of points for the closest point, radius and k closest points queries of PointsObject and
+// PointCloudObject.
+//
+// Points are identified by their index, as in vtkPoints. Inserting, moving and removing a point only updates the
+// cell it belongs to, except RemovePoint() that also renumbers the points that follow, as PointsObject does.
+// Queries visit the cells around the query point, rings of cells further away are only visited while they may
+// contain a closer point. When more cells than points would be visited, e.g. for a query far from all the points,
+// the points are simply scanned.
+//
+// The cell size is either fixed or automatic. In automatic mode, Build() chooses it from the extent and the
+// number of points and the grid is rebuilt if points are inserted until the cells become crowded.
+class PointIndex
+{
+public:
+    PointIndex();
+
+    // Size of the cells, 0 for automatic. Rebuilds the grid.
+    void SetCellSize( double size );
+    double GetCellSize() { return m_cellSize; }
+
+    void Clear();
+    void Build( vtkPoints * points );
+    int GetNumberOfPoints() { return int( m_pointCells.size() ); }
+    const double * GetPoint( int id ) { return &m_coordinates[3 * id]; }
+
+    void InsertNextPoint( const double p[3] );
+    void SetPoint( int id, const double p[3] );
+    // Remove a point, the id of the following points is decremented
+    void RemovePoint( int id );
+
+    // Return the id of the closest point or -1 if there are no points. The distance is set if not null.
+    int FindClosestPoint( const double p[3], double * distance = nullptr );
+    // Ids of the points closer than radius, in no particular order
+    void FindPointsWithinRadius( const double p[3], double radius, std::vector<int> & ids );
+    // Ids of the n closest points, the closest first
+    void FindClosestNPoints( int n, const double p[3], std::vector<int> & ids );
+
+protected:
+    typedef long long CellKey;
+
+    void Rebuild();
+    void ComputeCellSize();
+    void GetCell( const double p[3], int cell[3] );
+    CellKey GetCellKey( const int cell[3] );
+    void AddToCell( int id );
+    void RemoveFromCell( int id );
+    double Distance2( int id, const double p[3] );
+    // Visit the occupied cells at distance ring from cell (Chebyshev distance in cells), return the number of cells
+    // looked up
+    template <class Visitor>
+    int VisitRing( const int cell[3], int ring, Visitor & visit );
+    int GetMaximumRing( const int cell[3] );
+    int GetMinimumRing( const int cell[3] );
+
+    double m_cellSize;
+    bool m_automaticCellSize;
+    int m_numberOfPointsAtRebuild;
+    std::unordered_map<CellKey, std::vector<int> > m_cells;
+    std::vector<double> m_coordinates;
+    std::vector<CellKey> m_pointCells;
+    // Range of the cells that contain or have contained points since the last rebuild
+    int m_cellMin[3];
+    int m_cellMax[3];
+};
+
+#endif
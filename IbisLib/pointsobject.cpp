@@ -13,6 +13,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vtkCellArray.h>
 #include <vtkCellPicker.h>
 #include <vtkMath.h>
+#include <vtkMatrix4x4.h>
 #include <vtkPoints.h>
 #include <vtkPolyData.h>
 #include <vtkProperty.h>
@@ -22,6 +23,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QDateTime>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <algorithm>
 
 #include "application.h"
 #include "ibisconfig.h"
@@ -42,6 +44,20 @@ const int PointsObject::MaxRadius         = 16;
 const int PointsObject::MinLabelSize      = 6;
 const int PointsObject::MaxLabelSize      = 16;
 
+// Margin added to the point radius when looking for the picked point, in mm
+static const double PickTolerance = 1.0;
+
+// Apply the affine transform of a world matrix to a point, as vtkTransform::TransformPoint()
+static void TransformPoint( vtkMatrix4x4 * m, const double in[3], double out[3] )
+{
+    double x = m->Element[0][0] * in[0] + m->Element[0][1] * in[1] + m->Element[0][2] * in[2] + m->Element[0][3];
+    double y = m->Element[1][0] * in[0] + m->Element[1][1] * in[1] + m->Element[1][2] * in[2] + m->Element[1][3];
+    double z = m->Element[2][0] * in[0] + m->Element[2][1] * in[1] + m->Element[2][2] * in[2] + m->Element[2][3];
+    out[0]   = x;
+    out[1]   = y;
+    out[2]   = z;
+}
+
 PointsObject::PointsObject() : SceneObject()
 {
     m_pointCoordinates   = vtkSmartPointer<vtkPoints>::New();
@@ -66,6 +82,7 @@ PointsObject::PointsObject() : SceneObject()
     m_showLabels         = true;
     m_computeDistance    = false;
     m_lineToPointerTip   = 0;
+    m_pointIndexTime     = 0;
     for( int i = 0; i < 3; i++ ) m_lineToPointerColor[i] = 1.0;
 }
 
@@ -113,6 +130,8 @@ void PointsObject::Serialize( Serializer * ser )
         m_pointNames.clear();
         m_timeStamps.clear();
         m_pointCoordinates->Reset();
+        m_pointIndex.Clear();
+        m_pointIndexTime = m_pointCoordinates->GetMTime();
         for( int i = 0; i < numberOfPoints; i++ )
         {
             QString sectionName = QString( "Point_%1" ).arg( i );
@@ -246,7 +265,7 @@ vtkActor * PointsObject::DoPicking( int x, int y, vtkRenderer * ren, double pick
     // we get wron invewrse e.g world is concatenation of: identity, t1, t2 - we get inverse of t1
     // while if we go for the inverse matrix, it is correct
     vtkSmartPointer<vtkMatrix4x4> inverseMat = vtkSmartPointer<vtkMatrix4x4>::New();
-    this->GetWorldTransform()->GetInverse( inverseMat );
+    vtkMatrix4x4::Invert( this->GetWorldMatrix(), inverseMat );
 
     double transformedPoint[4];
     inverseMat->MultiplyPoint( pickPosition, transformedPoint );
@@ -340,7 +359,10 @@ void PointsObject::AddPointLocal( double coords[3], QString name, QString timest
 
     // Set properties
     m_pointNames.append( name );
+    this->UpdatePointIndex();
     m_pointCoordinates->InsertNextPoint( coords );
+    m_pointIndex.InsertNextPoint( coords );
+    m_pointIndexTime = m_pointCoordinates->GetMTime();
     m_timeStamps.append( timestamp );
 
     // Create point representation
@@ -402,7 +424,7 @@ void PointsObject::MoveCursorToPoint( int index )
     {
         double * pos = m_pointCoordinates->GetPoint( index );  // in PointsObject space
         double worldPos[3];
-        this->GetWorldTransform()->TransformPoint( pos, worldPos );
+        TransformPoint( this->GetWorldMatrix(), pos, worldPos );
         this->GetManager()->SetCursorWorldPosition( worldPos );
     }
 }
@@ -413,30 +435,36 @@ int PointsObject::FindPoint( vtkActor * actor, double * pos, int viewType )
 
     if( m_pointList.isEmpty() ) return InvalidPointIndex;
 
-    int n = m_pointList.count();
-    double pointPosition[3];
-    vtkSmartPointer<PointRepresentation> point;
+    // Only the points around the picked position can own the picked actor or be under the cursor in 2D views.
+    // The 2D radius is in world space, convert it to PointsObject space using the smallest scale of the transform.
+    // Scale factors as computed by vtkTransform::GetScale()
+    vtkMatrix4x4 * wm = this->GetWorldMatrix();
+    double linear[3][3], U[3][3], VT[3][3], scale[3];
+    for( int i = 0; i < 3; ++i )
+        for( int j = 0; j < 3; ++j ) linear[i][j] = wm->Element[i][j];
+    vtkMath::SingularValueDecomposition3x3( linear, U, scale, VT );
+    double minScale = std::min( std::min( fabs( scale[0] ), fabs( scale[1] ) ), fabs( scale[2] ) );
+    double radius   = m_pointRadius3D;
+    if( viewType != THREED_VIEW_TYPE ) radius = std::max( radius, m_pointRadius2D / std::max( minScale, 1e-6 ) );
+    std::vector<int> candidates;
+    this->FindPointsWithinRadius( pos, radius + PickTolerance, candidates );
+    // keep the lowest index when points overlap, as when scanning all points
+    std::sort( candidates.begin(), candidates.end() );
+
     // first check if 3D actor was picked
-    int i = 0;
-    while( i < n )
+    for( int i : candidates )
     {
-        point = m_pointList.value( i );
-        if( point->HasActor( actor ) )
-        {
-            return i;
-        }
-        i++;
+        if( m_pointList.value( i )->HasActor( actor ) ) return i;
     }
     if( viewType == THREED_VIEW_TYPE ) return InvalidPointIndex;
     // Now see if any of 2D actors are picked
-    vtkTransform * wt = this->GetWorldTransform();
+    double pointPosition[3];
     double worldPicked[3], worldPt[3];
-    wt->TransformPoint( pos, worldPicked );
-    for( int i = 0; i < n; i++ )
+    TransformPoint( wm, pos, worldPicked );
+    for( int i : candidates )
     {
-        point = m_pointList.value( i );
-        point->GetPosition( pointPosition );
-        wt->TransformPoint( pointPosition, worldPt );
+        m_pointList.value( i )->GetPosition( pointPosition );
+        TransformPoint( wm, pointPosition, worldPt );
         bool isInPlane  = this->GetManager()->IsInPlane( (VIEWTYPES)viewType, worldPt );
         bool isInRadius = sqrt( vtkMath::Distance2BetweenPoints( worldPicked, worldPt ) ) < m_pointRadius2D;
         if( isInPlane && isInRadius ) return i;
@@ -444,6 +472,31 @@ int PointsObject::FindPoint( vtkActor * actor, double * pos, int viewType )
     return InvalidPointIndex;
 }
 
+int PointsObject::FindClosestPoint( const double pos[3], double * distance )
+{
+    UpdatePointIndex();
+    return m_pointIndex.FindClosestPoint( pos, distance );
+}
+
+void PointsObject::FindPointsWithinRadius( const double pos[3], double radius, std::vector<int> & indices )
+{
+    UpdatePointIndex();
+    m_pointIndex.FindPointsWithinRadius( pos, radius, indices );
+}
+
+void PointsObject::FindClosestNPoints( int n, const double pos[3], std::vector<int> & indices )
+{
+    UpdatePointIndex();
+    m_pointIndex.FindClosestNPoints( n, pos, indices );
+}
+
+void PointsObject::UpdatePointIndex()
+{
+    if( m_pointIndexTime == m_pointCoordinates->GetMTime() ) return;
+    m_pointIndex.Build( m_pointCoordinates );
+    m_pointIndexTime = m_pointCoordinates->GetMTime();
+}
+
 void PointsObject::UpdatePointsVisibility()
 {
     for( int i = 0; i < m_pointList.size(); ++i )
@@ -543,12 +596,15 @@ void PointsObject::RemovePoint( int index )
     Q_ASSERT( index >= 0 && index < m_pointCoordinates->GetNumberOfPoints() );
 
     // Clear local data about the point
+    this->UpdatePointIndex();
     vtkPoints * tmpPoints = vtkPoints::New();
     tmpPoints->DeepCopy( m_pointCoordinates );
     m_pointCoordinates->Reset();
     for( int i = 0; i < tmpPoints->GetNumberOfPoints(); ++i )
         if( i != index ) m_pointCoordinates->InsertNextPoint( tmpPoints->GetPoint( i ) );
     tmpPoints->Delete();
+    m_pointIndex.RemovePoint( index );
+    m_pointIndexTime = m_pointCoordinates->GetMTime();
     m_pointNames.erase( m_pointNames.begin() + index );
     m_timeStamps.erase( m_timeStamps.begin() + index );
 
@@ -627,7 +683,10 @@ void PointsObject::GetPointCoordinates( int index, double coords[3] ) { m_pointC
 void PointsObject::SetPointCoordinates( int index, double coords[3] )
 {
     Q_ASSERT( index >= 0 && index < m_pointCoordinates->GetNumberOfPoints() );
+    this->UpdatePointIndex();
     m_pointCoordinates->SetPoint( index, coords );
+    m_pointIndex.SetPoint( index, coords );
+    m_pointIndexTime = m_pointCoordinates->GetMTime();
     m_pointList.at( index )->SetPosition( m_pointCoordinates->GetPoint( index ) );
     emit PointsChanged();
     emit ObjectModified();
@@ -17,7 +17,9 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QList>
 #include <QObject>
 #include <QVector>
+#include <vector>
 
+#include "pointindex.h"
 #include "pointrepresentation.h"
 #include "sceneobject.h"
 #include "serializer.h"
@@ -181,6 +183,18 @@ public:
     /** Set point timestamp - time when point was created. */
     void SetPointTimeStamp( int index, const QString & stamp );
 
+    /** @name   Proximity queries
+     *  @brief  Positions are in PointsObject space, queries use a spatial index kept up to date with the points.
+     */
+    ///@{
+    /** Return the index of the point closest to pos or InvalidPointIndex if there are no points. */
+    int FindClosestPoint( const double pos[3], double * distance = nullptr );
+    /** Get indices of all points within radius of pos. */
+    void FindPointsWithinRadius( const double pos[3], double radius, std::vector<int> & indices );
+    /** Get indices of the n points closest to pos, sorted by increasing distance. */
+    void FindClosestNPoints( int n, const double pos[3], std::vector<int> & indices );
+    ///@}
+
 signals:
     void PointAdded();
     void PointRemoved( int );
@@ -234,6 +248,11 @@ protected:
 
 private:
     void LineToPointerTip( double selectedPoint[3], double pointerTip[3] );
+    /** Rebuild the index if m_pointCoordinates was modified from outside, e.g. through GetPoints(). */
+    void UpdatePointIndex();
+
+    PointIndex m_pointIndex;
+    vtkMTimeType m_pointIndexTime;
 
     typedef QList<vtkSmartPointer<PointRepresentation> > PointList;
     PointList m_pointList;
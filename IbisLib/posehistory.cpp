@@ -0,0 +1,121 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "posehistory.h"
+
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkQuaternion.h>
+
+PoseHistory::PoseHistory( int capacity ) : m_samples( capacity > 1 ? capacity : 2 )
+{
+    m_firstSample     = 0;
+    m_numberOfSamples = 0;
+}
+
+void PoseHistory::SetCapacity( int capacity )
+{
+    m_samples.assign( capacity > 1 ? capacity : 2, Sample() );
+    Clear();
+}
+
+void PoseHistory::Clear()
+{
+    m_firstSample     = 0;
+    m_numberOfSamples = 0;
+}
+
+void PoseHistory::AddPose( vtkMatrix4x4 * pose, double timestamp, bool valid )
+{
+    if( m_numberOfSamples > 0 && timestamp <= GetSample( m_numberOfSamples - 1 ).timestamp ) return;
+
+    // Overwrite the oldest sample when full
+    int capacity = (int)m_samples.size();
+    int index;
+    if( m_numberOfSamples < capacity )
+    {
+        index = ( m_firstSample + m_numberOfSamples ) % capacity;
+        ++m_numberOfSamples;
+    }
+    else
+    {
+        index         = m_firstSample;
+        m_firstSample = ( m_firstSample + 1 ) % capacity;
+    }
+
+    Sample & s  = m_samples[index];
+    s.timestamp = timestamp;
+    s.valid     = valid;
+    if( !valid ) return;  // the matrix of a tool that is not tracked may not be a rotation
+
+    double rotation[3][3];
+    for( int i = 0; i < 3; ++i )
+    {
+        s.position[i] = pose->GetElement( i, 3 );
+        for( int j = 0; j < 3; ++j ) rotation[i][j] = pose->GetElement( i, j );
+    }
+    vtkMath::Orthogonalize3x3( rotation, rotation );
+    vtkMath::Matrix3x3ToQuaternion( rotation, s.orientation );
+}
+
+PoseHistory::PoseStatus PoseHistory::GetPoseAt( double timestamp, vtkMatrix4x4 * pose )
+{
+    if( m_numberOfSamples == 0 || timestamp < GetSample( 0 ).timestamp ) return NoPose;
+
+    const Sample & last = GetSample( m_numberOfSamples - 1 );
+    if( timestamp >= last.timestamp )
+    {
+        if( !last.valid ) return InvalidPose;
+        SampleToMatrix( last, pose );
+        return ValidPose;
+    }
+
+    // Find the first sample after timestamp
+    int low  = 1;
+    int high = m_numberOfSamples - 1;
+    while( low < high )
+    {
+        int mid = ( low + high ) / 2;
+        if( GetSample( mid ).timestamp <= timestamp )
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    const Sample & s0 = GetSample( low - 1 );
+    const Sample & s1 = GetSample( low );
+    if( !s0.valid || !s1.valid ) return InvalidPose;
+    double t = ( timestamp - s0.timestamp ) / ( s1.timestamp - s0.timestamp );
+
+    Sample s;
+    s.timestamp = timestamp;
+    for( int i = 0; i < 3; ++i ) s.position[i] = ( 1.0 - t ) * s0.position[i] + t * s1.position[i];
+    vtkQuaterniond q0( s0.orientation );
+    vtkQuaterniond q1( s1.orientation );
+    // q and -q are the same rotation, interpolate along the shortest arc
+    if( q0.GetW() * q1.GetW() + q0.GetX() * q1.GetX() + q0.GetY() * q1.GetY() + q0.GetZ() * q1.GetZ() < 0.0 )
+        q1 = q1 * -1.0;
+    vtkQuaterniond q = q0.Slerp( t, q1 );
+    q.Normalize();
+    q.Get( s.orientation );
+    SampleToMatrix( s, pose );
+    return ValidPose;
+}
+
+void PoseHistory::SampleToMatrix( const Sample & s, vtkMatrix4x4 * m )
+{
+    double rotation[3][3];
+    vtkMath::QuaternionToMatrix3x3( s.orientation, rotation );
+    m->Identity();
+    for( int i = 0; i < 3; ++i )
+    {
+        m->SetElement( i, 3, s.position[i] );
+        for( int j = 0; j < 3; ++j ) m->SetElement( i, j, rotation[i][j] );
+    }
+}
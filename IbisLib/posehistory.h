@@ -0,0 +1,64 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef POSEHISTORY_H
+#define POSEHISTORY_H
+
+#include <vector>
+
+class vtkMatrix4x4;
+
+// Ring of the last rigid poses of a tracked tool with their timestamps. Poses can be queried at any time
+// between the oldest and the most recent sample: the translation is interpolated linearly and the rotation
+// by spherical linear interpolation of quaternions. Samples received while the tool was not tracked correctly
+// are kept as invalid so that no pose is interpolated across them.
+class PoseHistory
+{
+public:
+    enum PoseStatus
+    {
+        NoPose,       // no sample at that time
+        InvalidPose,  // a sample around that time is invalid
+        ValidPose
+    };
+
+    PoseHistory( int capacity = 256 );
+
+    void SetCapacity( int capacity );
+    int GetCapacity() { return (int)m_samples.size(); }
+    int GetNumberOfSamples() { return m_numberOfSamples; }
+    void Clear();
+
+    // Samples must be added in increasing timestamp order, older or duplicate samples are ignored.
+    void AddPose( vtkMatrix4x4 * pose, double timestamp, bool valid = true );
+
+    // Compute the pose at timestamp. After the most recent sample, the most recent pose is returned.
+    // Returns NoPose if the history is empty or if timestamp is older than the oldest sample and InvalidPose
+    // if one of the samples the pose would be interpolated from is invalid. pose is only set for ValidPose.
+    PoseStatus GetPoseAt( double timestamp, vtkMatrix4x4 * pose );
+
+protected:
+    struct Sample
+    {
+        double timestamp;
+        double position[3];
+        double orientation[4];  // unit quaternion, w first
+        bool valid;
+    };
+
+    const Sample & GetSample( int index ) { return m_samples[( m_firstSample + index ) % m_samples.size()]; }
+    static void SampleToMatrix( const Sample & s, vtkMatrix4x4 * m );
+
+    std::vector<Sample> m_samples;
+    int m_firstSample;
+    int m_numberOfSamples;
+};
+
+#endif
@@ -0,0 +1,167 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "renderscheduler.h"
+
+#include <QGuiApplication>
+#include <QScreen>
+#include <QTimer>
+#include <algorithm>
+#include <cmath>
+
+#include "view.h"
+
+static const double DefaultDisplayRefreshRate = 60.0;
+
+RenderStatistics::RenderStatistics()
+{
+    numberOfRenders  = 0;
+    numberOfRequests = 0;
+    totalTime        = 0.0;
+    lastTime         = 0.0;
+    maximumTime      = 0.0;
+}
+
+RenderScheduler::RenderScheduler( QObject * parent ) : QObject( parent )
+{
+    m_timer = new QTimer( this );
+    m_timer->setSingleShot( true );
+    m_timer->setTimerType( Qt::PreciseTimer );
+    connect( m_timer, SIGNAL( timeout() ), this, SLOT( RenderDirtyViews() ) );
+    m_clock.start();
+    m_lastFrameTime    = -1;
+    m_maximumFrameRate = 0.0;
+    m_activeView       = nullptr;
+}
+
+RenderScheduler::~RenderScheduler() {}
+
+void RenderScheduler::RequestRender( View * v )
+{
+    m_statistics[v].numberOfRequests++;
+    if( !m_dirtyViews.contains( v ) ) m_dirtyViews.append( v );
+    ScheduleFrame();
+}
+
+void RenderScheduler::RenderNow( View * v )
+{
+    m_statistics[v].numberOfRequests++;
+    if( !v->IsRenderingEnabled() ) return;
+    m_dirtyViews.removeAll( v );
+    m_deferredViews.removeAll( v );
+    RenderView( v );
+}
+
+void RenderScheduler::RemoveView( View * v )
+{
+    m_dirtyViews.removeAll( v );
+    m_deferredViews.removeAll( v );
+    m_lastRenderTimes.remove( v );
+    m_statistics.remove( v );
+    if( m_activeView == v ) m_activeView = nullptr;
+}
+
+double RenderScheduler::GetFramePeriod()
+{
+    double refreshRate = DefaultDisplayRefreshRate;
+    QScreen * screen   = QGuiApplication::primaryScreen();
+    if( screen && screen->refreshRate() > 0.0 ) refreshRate = screen->refreshRate();
+    double framePeriod = 1000.0 / refreshRate;
+    if( m_maximumFrameRate > 0.0 ) framePeriod = std::max( framePeriod, 1000.0 / m_maximumFrameRate );
+    return framePeriod;
+}
+
+RenderStatistics RenderScheduler::GetStatistics( View * v ) { return m_statistics.value( v ); }
+
+void RenderScheduler::ResetStatistics()
+{
+    QList<View *> views = m_statistics.keys();
+    m_statistics.clear();
+    for( int i = 0; i < views.size(); ++i ) m_statistics.insert( views[i], RenderStatistics() );
+}
+
+// The timer fires once the events being processed are done, so requests made while processing them are coalesced.
+// When a frame was rendered recently, it waits for the start of the next frame.
+void RenderScheduler::ScheduleFrame()
+{
+    if( m_timer->isActive() ) return;
+
+    int delay = 0;
+    if( m_lastFrameTime >= 0 )
+    {
+        double nextFrameTime = m_lastFrameTime * 1e-6 + GetFramePeriod();
+        double now           = m_clock.nsecsElapsed() * 1e-6;
+        delay                = std::max( 0, static_cast<int>( std::ceil( nextFrameTime - now ) ) );
+    }
+    m_timer->start( delay );
+}
+
+void RenderScheduler::RenderDirtyViews()
+{
+    qint64 frameStart  = m_clock.nsecsElapsed();
+    qint64 framePeriod = static_cast<qint64>( GetFramePeriod() * 1e6 );
+    m_lastFrameTime    = frameStart;
+
+    // Active view first, then the views that have been waiting the longest
+    QList<View *> views = m_dirtyViews;
+    std::stable_sort( views.begin(), views.end(), [this]( View * a, View * b ) {
+        if( a == m_activeView || b == m_activeView ) return a == m_activeView && b != m_activeView;
+        return m_lastRenderTimes.value( a, -1 ) < m_lastRenderTimes.value( b, -1 );
+    } );
+
+    bool renderedOne = false;
+    QList<View *> deferredViews;
+    for( int i = 0; i < views.size(); ++i )
+    {
+        View * v = views[i];
+
+        // Views stay dirty while their rendering is disabled, they request a render when it is enabled again
+        if( !v->IsRenderingEnabled() ) continue;
+
+        // Leave the other views for the next frame when over budget. At least one view is rendered per frame and a
+        // view is never left twice in a row, so a slow active view can't starve the others.
+        qint64 start = m_clock.nsecsElapsed();
+        if( renderedOne && start - frameStart > framePeriod && !m_deferredViews.contains( v ) )
+        {
+            deferredViews.append( v );
+            continue;
+        }
+
+        m_dirtyViews.removeAll( v );
+        RenderView( v );
+        renderedOne = true;
+    }
+    m_deferredViews = deferredViews;
+
+    for( int i = 0; i < m_dirtyViews.size(); ++i )
+    {
+        if( m_dirtyViews[i]->IsRenderingEnabled() )
+        {
+            ScheduleFrame();
+            break;
+        }
+    }
+}
+
+void RenderScheduler::RenderView( View * v )
+{
+    qint64 start = m_clock.nsecsElapsed();
+    v->DoVTKRender();
+
+    qint64 end               = m_clock.nsecsElapsed();
+    double renderTime        = ( end - start ) * 1e-6;
+    RenderStatistics & stats = m_statistics[v];
+    stats.numberOfRenders++;
+    stats.totalTime += renderTime;
+    stats.lastTime    = renderTime;
+    stats.maximumTime = std::max( stats.maximumTime, renderTime );
+
+    m_lastRenderTimes[v] = end;
+}
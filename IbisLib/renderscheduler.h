@@ -0,0 +1,101 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef RENDERSCHEDULER_H
+#define RENDERSCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMap>
+#include <QObject>
+
+class QTimer;
+class View;
+
+/** Render times of a view, in ms. */
+struct RenderStatistics
+{
+    RenderStatistics();
+    double GetMeanTime() { return numberOfRenders > 0 ? totalTime / numberOfRenders : 0.0; }
+
+    /** Number of times the view was rendered and number of render requests it received. */
+    int numberOfRenders;
+    int numberOfRequests;
+    double totalTime;
+    double lastTime;
+    double maximumTime;
+};
+
+/**
+ * @class   RenderScheduler
+ * @brief   Coalesce the render requests of the views
+ *
+ * View::NotifyNeedRender() only marks the view dirty. Dirty views are rendered once the current event is processed,
+ * so all the requests of a clock tick, e.g. the tracked tools, the US probe and the video, result in a single render.
+ * Each view is rendered at most once per frame. The frame period is the refresh period of the display or the
+ * period of the maximum frame rate if one is set.
+ *
+ * The active view, the one the user last interacted with, is rendered first. If rendering the dirty views of a
+ * frame takes longer than the frame period, the views that were not rendered yet are left for the next frame,
+ * where they are rendered first after the active view.
+ *
+ * The render time of each view is measured, see GetStatistics().
+ *
+ * @sa View SceneManager
+ */
+class RenderScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    RenderScheduler( QObject * parent = nullptr );
+    ~RenderScheduler();
+
+    /** Mark the view dirty and schedule a render. */
+    void RequestRender( View * v );
+    /** Render the view immediately, bypassing the frame period, e.g. to measure the render rate. The render is
+     *  counted in the statistics of the view. */
+    void RenderNow( View * v );
+    /** Forget the view, called before it is deleted. */
+    void RemoveView( View * v );
+
+    /** The active view is rendered first. */
+    void SetActiveView( View * v ) { m_activeView = v; }
+    View * GetActiveView() { return m_activeView; }
+
+    /** Maximum number of frames per second, 0 to render at the refresh rate of the display. */
+    void SetMaximumFrameRate( double fps ) { m_maximumFrameRate = fps; }
+    double GetMaximumFrameRate() { return m_maximumFrameRate; }
+    double GetFramePeriod();
+
+    /** Render statistics of the view since it was added or since the last reset. */
+    RenderStatistics GetStatistics( View * v );
+    void ResetStatistics();
+
+private slots:
+
+    void RenderDirtyViews();
+
+private:
+    void ScheduleFrame();
+    void RenderView( View * v );
+
+    QTimer * m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_lastFrameTime;  // ns, m_clock time of the start of the last frame, -1 if no frame was rendered
+    double m_maximumFrameRate;
+    View * m_activeView;
+    QList<View *> m_dirtyViews;
+    QList<View *> m_deferredViews;  // dirty views that were left for the next frame
+    QMap<View *, qint64> m_lastRenderTimes;
+    QMap<View *, RenderStatistics> m_statistics;
+};
+
+#endif
@@ -0,0 +1,300 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "scenearchive.h"
+
+#include <QDataStream>
+#include <QSaveFile>
+#include <cstring>
+
+const char * SceneArchive::PropertyTreeChunkName = "scene.xml";
+const char * SceneArchive::FileNameSuffix        = "ibis";
+
+// Header: magic, version. Trailer: offset of the table of contents, magic.
+static const char HeaderMagic[8]          = { 'I', 'B', 'I', 'S', 'S', 'C', 'N', '\0' };
+static const char TrailerMagic[8]         = { 'I', 'B', 'I', 'S', 'T', 'O', 'C', '\0' };
+static const quint32 ArchiveVersion       = 1;
+static const qint64 HeaderSize            = 16;
+static const qint64 TrailerSize           = 16;
+static const quint64 ChunkAlignment       = 64;  // chunks start on a cache line
+static const char Padding[ChunkAlignment] = {};
+
+SceneArchive::SceneArchive()
+{
+    m_file             = nullptr;
+    m_saveFile         = nullptr;
+    m_mappedFile       = nullptr;
+    m_writeOffset      = 0;
+    m_compressionLevel = -1;
+    m_writeFailed      = false;
+}
+
+SceneArchive::~SceneArchive()
+{
+    if( m_saveFile )
+    {
+        // never commit a partially written archive
+        m_saveFile->cancelWriting();
+        delete m_saveFile;
+    }
+    m_saveFile = nullptr;
+    Close();
+}
+
+bool SceneArchive::IsSceneArchive( const QString & filename )
+{
+    QFile file( filename );
+    if( !file.open( QIODevice::ReadOnly ) ) return false;
+    QByteArray magic = file.read( sizeof( HeaderMagic ) );
+    return magic.size() == sizeof( HeaderMagic ) &&
+           memcmp( magic.constData(), HeaderMagic, sizeof( HeaderMagic ) ) == 0;
+}
+
+bool SceneArchive::Create( const QString & filename )
+{
+    Close();
+    m_errorMessage.clear();
+    m_saveFile = new QSaveFile( filename );
+    if( !m_saveFile->open( QIODevice::WriteOnly ) )
+    {
+        delete m_saveFile;
+        m_saveFile = nullptr;
+        return SetError( QString( "Can't create scene archive %1" ).arg( filename ) );
+    }
+
+    QByteArray header;
+    QDataStream out( &header, QIODevice::WriteOnly );
+    out.setByteOrder( QDataStream::LittleEndian );
+    out.writeRawData( HeaderMagic, sizeof( HeaderMagic ) );
+    out << ArchiveVersion << quint32( 0 );
+    if( m_saveFile->write( header ) != HeaderSize ) return SetError( "Can't write scene archive header" );
+    m_writeOffset = HeaderSize;
+    return true;
+}
+
+bool SceneArchive::Open( const QString & filename )
+{
+    Close();
+    m_errorMessage.clear();
+    m_file = new QFile( filename );
+    if( !m_file->open( QIODevice::ReadOnly ) )
+    {
+        SetError( QString( "Can't open scene archive %1" ).arg( filename ) );
+        Close();
+        return false;
+    }
+    if( !ReadTableOfContents() )
+    {
+        Close();
+        return false;
+    }
+
+    // Chunks are read from the mapped file when possible, from the file otherwise
+    m_mappedFile = m_file->map( 0, m_file->size() );
+    return true;
+}
+
+bool SceneArchive::Close()
+{
+    bool ok = true;
+    if( m_saveFile )
+    {
+        ok = !m_writeFailed && m_currentChunk.isEmpty() && WriteTableOfContents() && m_saveFile->commit();
+        if( !ok )
+        {
+            m_saveFile->cancelWriting();
+            if( m_errorMessage.isEmpty() ) SetError( "Can't write scene archive" );
+        }
+        delete m_saveFile;
+        m_saveFile = nullptr;
+    }
+    if( m_file )
+    {
+        if( m_mappedFile ) m_file->unmap( m_mappedFile );
+        m_mappedFile = nullptr;
+        delete m_file;
+        m_file = nullptr;
+    }
+    m_chunks.clear();
+    m_currentChunk.clear();
+    m_writeOffset = 0;
+    m_writeFailed = false;
+    return ok;
+}
+
+bool SceneArchive::AddChunk( const QString & name, ChunkType type, const QByteArray & data, bool compress )
+{
+    if( !compress )
+    {
+        return BeginChunk( name, type ) && WriteChunkData( data.constData(), data.size() ) && EndChunk();
+    }
+
+    QByteArray compressed = qCompress( data, m_compressionLevel );
+    if( compressed.isEmpty() && !data.isEmpty() ) return SetError( QString( "Can't compress chunk %1" ).arg( name ) );
+    if( !BeginChunk( name, type ) || !WriteChunkData( compressed.constData(), compressed.size() ) ) return false;
+    m_chunks[name].flags = CompressedChunk;
+    m_chunks[name].size  = data.size();
+    return EndChunk();
+}
+
+bool SceneArchive::BeginChunk( const QString & name, ChunkType type )
+{
+    if( !m_saveFile ) return SetError( "Scene archive is not open for writing" );
+    if( !m_currentChunk.isEmpty() ) return SetError( QString( "Chunk %1 is not finished" ).arg( m_currentChunk ) );
+    if( m_chunks.contains( name ) ) return SetError( QString( "Duplicate chunk %1" ).arg( name ) );
+    if( !WritePadding() ) return false;
+
+    ChunkInfo info;
+    info.type      = type;
+    info.offset    = m_writeOffset;
+    m_chunks[name] = info;
+    m_currentChunk = name;
+    return true;
+}
+
+bool SceneArchive::WriteChunkData( const void * data, qint64 size )
+{
+    if( m_currentChunk.isEmpty() ) return SetError( "No chunk is being written" );
+    if( size > 0 && m_saveFile->write( static_cast<const char *>( data ), size ) != size )
+        return SetError( QString( "Can't write chunk %1" ).arg( m_currentChunk ) );
+    m_writeOffset += size;
+    return true;
+}
+
+bool SceneArchive::EndChunk()
+{
+    if( m_currentChunk.isEmpty() ) return SetError( "No chunk is being written" );
+    ChunkInfo & info = m_chunks[m_currentChunk];
+    info.storedSize  = m_writeOffset - info.offset;
+    if( !( info.flags & CompressedChunk ) ) info.size = info.storedSize;
+    m_currentChunk.clear();
+    return true;
+}
+
+SceneArchive::ChunkType SceneArchive::GetChunkType( const QString & name )
+{
+    QMap<QString, ChunkInfo>::const_iterator it = m_chunks.constFind( name );
+    if( it == m_chunks.constEnd() ) return InvalidChunk;
+    return it.value().type;
+}
+
+QByteArray SceneArchive::GetChunk( const QString & name )
+{
+    QMap<QString, ChunkInfo>::const_iterator it = m_chunks.constFind( name );
+    if( !m_file || it == m_chunks.constEnd() )
+    {
+        SetError( QString( "Can't find chunk %1" ).arg( name ) );
+        return QByteArray();
+    }
+
+    const ChunkInfo & info = it.value();
+    QByteArray stored;
+    if( m_mappedFile )
+    {
+        stored = QByteArray::fromRawData( reinterpret_cast<const char *>( m_mappedFile + info.offset ),
+                                          qsizetype( info.storedSize ) );
+    }
+    else
+    {
+        if( !m_file->seek( qint64( info.offset ) ) ) return QByteArray();
+        stored = m_file->read( qint64( info.storedSize ) );
+        if( quint64( stored.size() ) != info.storedSize )
+        {
+            SetError( QString( "Chunk %1 is truncated" ).arg( name ) );
+            return QByteArray();
+        }
+    }
+
+    if( !( info.flags & CompressedChunk ) ) return stored;
+    QByteArray data = qUncompress( stored );
+    if( quint64( data.size() ) != info.size ) SetError( QString( "Can't uncompress chunk %1" ).arg( name ) );
+    return data;
+}
+
+bool SceneArchive::ReadTableOfContents()
+{
+    qint64 fileSize = m_file->size();
+    if( fileSize < HeaderSize + TrailerSize ) return SetError( "Not a scene archive" );
+
+    QDataStream in( m_file );
+    in.setByteOrder( QDataStream::LittleEndian );
+    char magic[sizeof( HeaderMagic )];
+    quint32 version, reserved;
+    in.readRawData( magic, sizeof( magic ) );
+    in >> version >> reserved;
+    if( memcmp( magic, HeaderMagic, sizeof( magic ) ) != 0 ) return SetError( "Not a scene archive" );
+    if( version > ArchiveVersion ) return SetError( "Scene archive was written by a more recent version of Ibis" );
+
+    quint64 tocOffset;
+    m_file->seek( fileSize - TrailerSize );
+    in >> tocOffset;
+    in.readRawData( magic, sizeof( magic ) );
+    if( memcmp( magic, TrailerMagic, sizeof( magic ) ) != 0 || tocOffset < quint64( HeaderSize ) ||
+        tocOffset > quint64( fileSize - TrailerSize ) )
+        return SetError( "Scene archive is truncated" );
+
+    m_file->seek( qint64( tocOffset ) );
+    quint32 nbChunks;
+    in >> nbChunks;
+    for( quint32 i = 0; i < nbChunks && in.status() == QDataStream::Ok; ++i )
+    {
+        QString name;
+        quint32 type;
+        ChunkInfo info;
+        in >> name >> type >> info.flags >> info.offset >> info.storedSize >> info.size;
+        info.type = ChunkType( type );
+        // The chunk must end before the table of contents, checked without overflowing the sum
+        if( info.offset > tocOffset || info.storedSize > tocOffset - info.offset )
+            return SetError( "Scene archive is corrupted" );
+        m_chunks[name] = info;
+    }
+    if( in.status() != QDataStream::Ok ) return SetError( "Can't read the table of contents of the scene archive" );
+    return true;
+}
+
+bool SceneArchive::WriteTableOfContents()
+{
+    if( !WritePadding() ) return false;
+
+    QByteArray toc;
+    QDataStream out( &toc, QIODevice::WriteOnly );
+    out.setByteOrder( QDataStream::LittleEndian );
+    out << quint32( m_chunks.size() );
+    QMap<QString, ChunkInfo>::const_iterator it = m_chunks.constBegin();
+    for( ; it != m_chunks.constEnd(); ++it )
+    {
+        const ChunkInfo & info = it.value();
+        out << it.key() << quint32( info.type ) << info.flags << info.offset << info.storedSize << info.size;
+    }
+    out << m_writeOffset;
+    out.writeRawData( TrailerMagic, sizeof( TrailerMagic ) );
+    if( m_saveFile->write( toc ) != toc.size() ) return SetError( "Can't write the table of contents" );
+    return true;
+}
+
+bool SceneArchive::WritePadding()
+{
+    qint64 padding = qint64( ( ChunkAlignment - m_writeOffset % ChunkAlignment ) % ChunkAlignment );
+    if( padding && m_saveFile->write( Padding, padding ) != padding ) return SetError( "Can't write scene archive" );
+    m_writeOffset += padding;
+    return true;
+}
+
+bool SceneArchive::SetError( const QString & message )
+{
+    // Keep the first error of a new archive, the following ones are usually a consequence of it
+    if( m_saveFile )
+    {
+        if( m_writeFailed ) return false;
+        m_writeFailed = true;
+    }
+    m_errorMessage = message;
+    return false;
+}
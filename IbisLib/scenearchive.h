@@ -0,0 +1,131 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef SCENEARCHIVE_H
+#define SCENEARCHIVE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+
+class QSaveFile;
+
+/**
+ * @class   SceneArchive
+ * @brief   Single file container holding a scene and the data of its objects as named binary chunks
+ *
+ * The archive starts with a short header, followed by the chunk payloads and ends with a table of contents
+ * giving the type, position and size of every chunk. When reading, only the header and the table of contents
+ * are parsed, chunks are loaded when they are requested. Uncompressed chunks are read straight from the
+ * memory mapped file, so large frame stacks and volumes are not copied before they reach the objects.
+ *
+ * Scene loading is not lazy: SceneManager::LoadScene() reads the chunk of every object while the scene is loaded.
+ * An object added to the scene is accessed right away, the views build their pipelines from its data and
+ * ImageObject computes its bounds, scalar range and histogram when its image is set, so an image can't be added
+ * before its voxels are read.
+ *
+ * When writing, the first error is kept and Close() discards the new archive, so an incomplete scene never
+ * replaces an existing file.
+ *
+ * The xml document written by the Serializer is stored in the PropertyTreeChunk named scene.xml, see
+ * Serializer::SetArchive(). Objects reference their data chunks by name from the property tree.
+ *
+ * Chunk payloads are written in the byte order of the machine, the header and table of contents are little
+ * endian.
+ *
+ * @sa Serializer SceneManager
+ */
+class SceneArchive
+{
+public:
+    enum ChunkType
+    {
+        InvalidChunk      = 0,
+        PropertyTreeChunk = 1,  // xml document of the Serializer
+        ImageChunk        = 2,  // voxels of an image with its geometry
+        PolyDataChunk     = 3,  // vtk polydata, legacy binary format
+        FrameStackChunk   = 4,  // frames, matrices and timestamps of a tracked video buffer
+        FileChunk         = 5   // copy of a data file that has no native chunk type
+    };
+
+    static const char * PropertyTreeChunkName;
+    static const char * FileNameSuffix;
+
+    SceneArchive();
+    ~SceneArchive();
+
+    /** Check the header of a file, the extension is not used. */
+    static bool IsSceneArchive( const QString & filename );
+
+    /** Create a new archive, the file is only replaced when Close() succeeds. */
+    bool Create( const QString & filename );
+    /** Open an existing archive and read its table of contents. */
+    bool Open( const QString & filename );
+    /** Write the table of contents of a new archive, release the file of an open archive. */
+    bool Close();
+    bool IsOpen() { return m_file != nullptr || m_saveFile != nullptr; }
+    bool IsWriting() { return m_saveFile != nullptr; }
+
+    /** Compression level of the chunks added with compression, from 0 to 9, -1 for the zlib default. */
+    void SetCompressionLevel( int level ) { m_compressionLevel = level; }
+    int GetCompressionLevel() { return m_compressionLevel; }
+
+    /** Add a chunk from memory. */
+    bool AddChunk( const QString & name, ChunkType type, const QByteArray & data, bool compress = false );
+    /** Add a chunk in pieces to avoid packing large data in memory. Streamed chunks are not compressed. */
+    bool BeginChunk( const QString & name, ChunkType type );
+    bool WriteChunkData( const void * data, qint64 size );
+    bool EndChunk();
+
+    bool HasChunk( const QString & name ) { return m_chunks.contains( name ); }
+    ChunkType GetChunkType( const QString & name );
+    QStringList GetChunkNames() { return m_chunks.keys(); }
+    /** Return the payload of a chunk. Uncompressed chunks refer to the mapped file and are only valid until
+     * Close(), copy them if they have to be kept. */
+    QByteArray GetChunk( const QString & name );
+
+    const QString & GetErrorMessage() { return m_errorMessage; }
+    /** Record an error, also used by the objects whose data can't be written to a new archive. Returns false. */
+    bool SetError( const QString & message );
+
+protected:
+    struct ChunkInfo
+    {
+        ChunkInfo() : type( InvalidChunk ), flags( 0 ), offset( 0 ), storedSize( 0 ), size( 0 ) {}
+        ChunkType type;
+        quint32 flags;
+        quint64 offset;
+        quint64 storedSize;  // size in the file
+        quint64 size;        // size once uncompressed
+    };
+
+    enum ChunkFlags
+    {
+        CompressedChunk = 0x1
+    };
+
+    bool ReadTableOfContents();
+    bool WriteTableOfContents();
+    bool WritePadding();
+
+    QFile * m_file;
+    QSaveFile * m_saveFile;
+    uchar * m_mappedFile;
+    QMap<QString, ChunkInfo> m_chunks;
+    QString m_currentChunk;  // chunk being streamed
+    quint64 m_writeOffset;
+    int m_compressionLevel;
+    QString m_errorMessage;
+    bool m_writeFailed;
+};
+
+#endif
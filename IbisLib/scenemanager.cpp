@@ -15,7 +15,10 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vtkInteractorStyleImage.h>
 #include <vtkInteractorStyleJoystickCamera.h>
 #include <vtkInteractorStyleTerrain.h>
+#include <vtkMatrix4x4.h>
 #include <vtkMultiImagePlaneWidget.h>
+#include <vtkPolyDataReader.h>
+#include <vtkPolyDataWriter.h>
 #include <vtkTransform.h>
 
 #include <QApplication>
@@ -24,6 +27,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QFileInfo>
 #include <QMessageBox>
 #include <QPluginLoader>
+#include <QTemporaryDir>
 #include <algorithm>
 #include <iostream>
 
@@ -40,6 +44,8 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "pointsobject.h"
 #include "polydataobject.h"
 #include "quadviewwindow.h"
+#include "renderscheduler.h"
+#include "scenearchive.h"
 #include "toolplugininterface.h"
 #include "trackedsceneobject.h"
 #include "trackerstatusdialog.h"
@@ -69,6 +75,9 @@ SceneManager::SceneManager()
     this->NavigationPointerID       = SceneManager::InvalidId;
     this->IsNavigating              = false;
     this->LoadingScene              = false;
+    m_archiveFilesDirectory         = nullptr;
+    m_numberOfExtractedFiles        = 0;
+    m_renderScheduler               = new RenderScheduler( this );
 
     this->Init();
 }
@@ -78,6 +87,7 @@ SceneManager::~SceneManager()
     if( m_referenceTransform ) m_referenceTransform->Delete();
     if( m_invReferenceTransform ) m_invReferenceTransform->Delete();
     m_sceneRoot->Delete();
+    delete m_archiveFilesDirectory;
 }
 
 void SceneManager::Destroy()
@@ -87,7 +97,10 @@ void SceneManager::Destroy()
     this->RemoveObject( m_sceneRoot );
 
     foreach( View * v, Views.keys() )
+    {
+        m_renderScheduler->RemoveView( v );
         v->Delete();
+    }
 
     Views.clear();
 
@@ -120,6 +133,7 @@ void SceneManager::Init()
     m_sceneRoot->ObjectID = m_nextSystemObjectID--;
 
     AllObjects.push_back( m_sceneRoot );
+    AddToIndices( m_sceneRoot );
     m_sceneRoot->Register( this );
 
     // Cut planes
@@ -256,6 +270,18 @@ void SceneManager::LoadScene( QString & fileName, bool interactive )
     SerializerReader reader;
     reader.SetFilename( fileName.toUtf8().data() );
     reader.SetSupportedVersion( this->SupportedSceneSaveVersion );
+    SceneArchive archive;
+    if( SceneArchive::IsSceneArchive( fileName ) )
+    {
+        if( !archive.Open( fileName ) )
+        {
+            QMessageBox::warning( nullptr, "Error", archive.GetErrorMessage(), QMessageBox::Ok );
+            SetRenderingEnabled( true );
+            this->LoadingScene = false;
+            return;
+        }
+        reader.SetArchive( &archive );
+    }
     reader.Start();
     reader.BeginSection( "SaveScene" );
     reader.ReadVersionFromFile();
@@ -368,6 +394,15 @@ bool SceneManager::UpdateProgress( int value )
 
 void SceneManager::SaveScene( QString & fileName )
 {
+    // A scene archive holds the scene and the data of all objects, otherwise data are saved in the scene directory
+    SceneArchive archive;
+    bool saveToArchive = QFileInfo( fileName ).suffix() == SceneArchive::FileNameSuffix;
+    if( saveToArchive && !archive.Create( fileName ) )
+    {
+        QMessageBox::warning( nullptr, "Error", archive.GetErrorMessage(), QMessageBox::Ok );
+        return;
+    }
+
     SceneObject * currentObject = this->GetCurrentObject();
     NotifyPluginsSceneAboutToSave();
 
@@ -379,6 +414,7 @@ void SceneManager::SaveScene( QString & fileName )
     m_sceneLoadSaveProgressDialog->setCancelButton( nullptr );
     SerializerWriter writer;
     writer.SetFilename( fileName.toUtf8().data() );
+    if( saveToArchive ) writer.SetArchive( &archive );
     writer.Start();
     writer.BeginSection( "SaveScene" );
     QString version( IBIS_SCENE_SAVE_VERSION );
@@ -410,6 +446,10 @@ void SceneManager::SaveScene( QString & fileName )
     writer.Finish();
     Application::GetInstance().StopProgress( m_sceneLoadSaveProgressDialog );
     m_sceneLoadSaveProgressDialog = nullptr;
+    // Any error while writing the objects makes Close() discard the archive
+    if( saveToArchive && !archive.Close() )
+        QMessageBox::warning( nullptr, "Error", tr( "The scene was not saved.\n%1" ).arg( archive.GetErrorMessage() ),
+                              QMessageBox::Ok );
 
     NotifyPluginsSceneFinishedSaving();
     this->SetCurrentObject( currentObject );
@@ -667,6 +707,7 @@ void SceneManager::AddObjectUsingID( SceneObject * object, SceneObject * attachT
             id = m_nextObjectID++;
     }
     object->AddToScene( this, id );
+    AddToIndices( object );
 
     // Attach object to the hierarchy
     attachTo->AddChild( object );
@@ -832,6 +873,7 @@ void SceneManager::RemoveObject( SceneObject * object )
 
     // remove the object from the global list
     this->AllObjects.removeAt( indexAll );
+    RemoveFromIndices( object );
 
     if( object->IsListable() ) emit FinishRemovingObject();
 
@@ -857,92 +899,127 @@ void SceneManager::ChangeParent( SceneObject * object, SceneObject * newParent,
 
 void SceneManager::GetAllImageObjects( QList<ImageObject *> & objects )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
-    {
-        ImageObject * obj = ImageObject::SafeDownCast( this->AllObjects[i] );
-        if( obj ) objects.push_back( obj );
-    }
+    ObjectList typeObjects = GetObjectsOfType( "ImageObject" );
+    for( int i = 0; i < typeObjects.size(); ++i ) objects.push_back( static_cast<ImageObject *>( typeObjects[i] ) );
 }
 
 void SceneManager::GetAllPolydataObjects( QList<PolyDataObject *> & objects )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
-    {
-        PolyDataObject * obj = PolyDataObject::SafeDownCast( this->AllObjects[i] );
-        if( obj ) objects.push_back( obj );
-    }
+    ObjectList typeObjects = GetObjectsOfType( "PolyDataObject" );
+    for( int i = 0; i < typeObjects.size(); ++i ) objects.push_back( static_cast<PolyDataObject *>( typeObjects[i] ) );
 }
 
 void SceneManager::GetAllPointsObjects( QList<PointsObject *> & objects )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
-    {
-        PointsObject * obj = PointsObject::SafeDownCast( this->AllObjects[i] );
-        if( obj ) objects.push_back( obj );
-    }
+    ObjectList typeObjects = GetObjectsOfType( "PointsObject" );
+    for( int i = 0; i < typeObjects.size(); ++i ) objects.push_back( static_cast<PointsObject *>( typeObjects[i] ) );
 }
 
 void SceneManager::GetAllCameraObjects( QList<CameraObject *> & all )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
-    {
-        CameraObject * obj = CameraObject::SafeDownCast( this->AllObjects[i] );
-        if( obj ) all.push_back( obj );
-    }
+    ObjectList typeObjects = GetObjectsOfType( "CameraObject" );
+    for( int i = 0; i < typeObjects.size(); ++i ) all.push_back( static_cast<CameraObject *>( typeObjects[i] ) );
 }
 
 void SceneManager::GetAllUSAcquisitionObjects( QList<USAcquisitionObject *> & all )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
-    {
-        USAcquisitionObject * obj = USAcquisitionObject::SafeDownCast( this->AllObjects[i] );
-        if( obj ) all.push_back( obj );
-    }
+    ObjectList typeObjects = GetObjectsOfType( "USAcquisitionObject" );
+    for( int i = 0; i < typeObjects.size(); ++i ) all.push_back( static_cast<USAcquisitionObject *>( typeObjects[i] ) );
 }
 
 void SceneManager::GetAllUsProbeObjects( QList<UsProbeObject *> & all )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
-    {
-        UsProbeObject * obj = UsProbeObject::SafeDownCast( this->AllObjects[i] );
-        if( obj ) all.push_back( obj );
-    }
+    ObjectList typeObjects = GetObjectsOfType( "UsProbeObject" );
+    for( int i = 0; i < typeObjects.size(); ++i ) all.push_back( static_cast<UsProbeObject *>( typeObjects[i] ) );
 }
 
 void SceneManager::GetAllPointerObjects( QList<PointerObject *> & all )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
-    {
-        PointerObject * obj = PointerObject::SafeDownCast( this->AllObjects[i] );
-        if( obj ) all.push_back( obj );
-    }
+    ObjectList typeObjects = GetObjectsOfType( "PointerObject" );
+    for( int i = 0; i < typeObjects.size(); ++i ) all.push_back( static_cast<PointerObject *>( typeObjects[i] ) );
 }
 
 void SceneManager::GetAllTrackedObjects( QList<TrackedSceneObject *> & all )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
+    ObjectList typeObjects = GetObjectsOfType( "TrackedSceneObject" );
+    for( int i = 0; i < typeObjects.size(); ++i )
     {
-        TrackedSceneObject * obj = TrackedSceneObject::SafeDownCast( this->AllObjects[i] );
-        if( obj && obj->IsDrivenByHardware() ) all.push_back( obj );
+        TrackedSceneObject * obj = static_cast<TrackedSceneObject *>( typeObjects[i] );
+        if( obj->IsDrivenByHardware() ) all.push_back( obj );
     }
 }
 
 void SceneManager::GetAllObjectsOfType( const char * typeName, QList<SceneObject *> & all )
 {
-    for( int i = 0; i < this->AllObjects.size(); ++i )
+    all.append( GetObjectsOfType( typeName ) );
+}
+
+SceneManager::ObjectList SceneManager::GetObjectsOfType( const char * typeName )
+{
+    QString type( typeName );
+    QHash<QString, ObjectList>::iterator it = m_objectsOfType.find( type );
+    if( it == m_objectsOfType.end() )
     {
-        if( this->AllObjects[i]->IsA( typeName ) ) all.push_back( this->AllObjects[i] );
+        ObjectList typeObjects;
+        for( int i = 0; i < this->AllObjects.size(); ++i )
+        {
+            if( this->AllObjects[i]->IsA( typeName ) ) typeObjects.push_back( this->AllObjects[i] );
+        }
+        it = m_objectsOfType.insert( type, typeObjects );
     }
+    return it.value();
 }
 
 SceneObject * SceneManager::GetObjectByID( int id )
 {
     if( id == SceneManager::InvalidId ) return nullptr;
-    for( int i = 0; i < this->AllObjects.size(); ++i )
+    return m_objectsByID.value( id, nullptr );
+}
+
+void SceneManager::GetObjectsByName( const QString & name, QList<SceneObject *> & objects )
+{
+    // QMultiHash returns the most recently inserted values first
+    QList<SceneObject *> named = m_objectsByName.values( name );
+    for( int i = named.size() - 1; i >= 0; --i ) objects.push_back( named[i] );
+}
+
+void SceneManager::AddToIndices( SceneObject * obj )
+{
+    m_objectsByID.insert( obj->GetObjectID(), obj );
+    for( QHash<QString, ObjectList>::iterator it = m_objectsOfType.begin(); it != m_objectsOfType.end(); ++it )
     {
-        if( this->AllObjects[i]->GetObjectID() == id ) return this->AllObjects[i];
+        // The list may have been built since obj was added to AllObjects, it is then already the last element
+        ObjectList & typeObjects = it.value();
+        if( obj->IsA( it.key().toUtf8().data() ) && ( typeObjects.isEmpty() || typeObjects.last() != obj ) )
+            typeObjects.push_back( obj );
     }
-    return nullptr;
+    m_objectsByName.insert( obj->GetName(), obj );
+    m_indexedNames.insert( obj, obj->GetName() );
+}
+
+void SceneManager::RemoveFromIndices( SceneObject * obj )
+{
+    // Another object may have been given the same id
+    if( m_objectsByID.value( obj->GetObjectID(), nullptr ) == obj ) m_objectsByID.remove( obj->GetObjectID() );
+    for( QHash<QString, ObjectList>::iterator it = m_objectsOfType.begin(); it != m_objectsOfType.end(); ++it )
+        it.value().removeOne( obj );
+    m_objectsByName.remove( m_indexedNames.value( obj ), obj );
+    m_indexedNames.remove( obj );
+}
+
+void SceneManager::UpdateIDIndex( SceneObject * obj, int oldId )
+{
+    if( m_objectsByID.value( oldId, nullptr ) == obj ) m_objectsByID.remove( oldId );
+    m_objectsByID.insert( obj->GetObjectID(), obj );
+}
+
+void SceneManager::UpdateNameIndex( SceneObject * obj )
+{
+    QHash<SceneObject *, QString>::iterator it = m_indexedNames.find( obj );
+    if( it == m_indexedNames.end() || it.value() == obj->GetName() ) return;
+    m_objectsByName.remove( it.value(), obj );
+    m_objectsByName.insert( obj->GetName(), obj );
+    it.value() = obj->GetName();
 }
 
 void SceneManager::SetCurrentObject( SceneObject * obj )
@@ -1295,6 +1372,19 @@ void SceneManager::GetReferenceOrientation( vtkMatrix4x4 * mat )
         mat->Identity();
 }
 
+void SceneManager::GetWorldMatrices( const QList<SceneObject *> & objects, std::vector<double> & elements,
+                                     std::vector<unsigned long> * generations )
+{
+    elements.resize( 16 * objects.size() );
+    if( generations ) generations->resize( objects.size() );
+    for( int i = 0; i < objects.size(); ++i )
+    {
+        vtkMatrix4x4 * m = objects[i]->GetWorldMatrix();
+        std::copy( &m->Element[0][0], &m->Element[0][0] + 16, elements.begin() + 16 * i );
+        if( generations ) ( *generations )[i] = objects[i]->GetWorldMatrixGeneration();
+    }
+}
+
 int SceneManager::GetNumberOfUserObjects()
 {
     int count = 0;
@@ -1353,6 +1443,74 @@ void SceneManager::EmitShowGenericLabel( bool show ) { emit ShowGenericLabel( sh
 
 void SceneManager::EmitShowGenericLabelText() { emit ShowGenericLabelText(); }
 
+// FullFileName of the objects whose data are in a chunk of the scene archive
+static const QString ArchiveChunkPrefix( "archive:" );
+
+// Image chunk: header followed by the voxels of the ITK image of an ImageObject
+struct ImageChunkHeader
+{
+    qint32 scalarType;  // VTK_FLOAT for IbisItkFloat3ImageType, VTK_UNSIGNED_CHAR for label images
+    qint32 size[3];
+    double origin[3];
+    double spacing[3];
+    double direction[9];
+};
+
+template <class TImage>
+static bool WriteItkImageChunk( SceneArchive * archive, QString chunkName, TImage * image, int scalarType,
+                                bool compress )
+{
+    ImageChunkHeader header;
+    header.scalarType                                = scalarType;
+    typename TImage::SizeType size                   = image->GetLargestPossibleRegion().GetSize();
+    const typename TImage::DirectionType & direction = image->GetDirection();
+    for( int i = 0; i < 3; ++i )
+    {
+        header.size[i]    = qint32( size[i] );
+        header.origin[i]  = image->GetOrigin()[i];
+        header.spacing[i] = image->GetSpacing()[i];
+        for( int j = 0; j < 3; ++j ) header.direction[i * 3 + j] = direction[i][j];
+    }
+    const char * voxels = reinterpret_cast<const char *>( image->GetBufferPointer() );
+    qint64 voxelsSize   = qint64( size[0] * size[1] * size[2] * sizeof( typename TImage::PixelType ) );
+
+    if( compress )
+    {
+        QByteArray data( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+        data.append( voxels, voxelsSize );
+        return archive->AddChunk( chunkName, SceneArchive::ImageChunk, data, true );
+    }
+    return archive->BeginChunk( chunkName, SceneArchive::ImageChunk ) &&
+           archive->WriteChunkData( &header, sizeof( header ) ) && archive->WriteChunkData( voxels, voxelsSize ) &&
+           archive->EndChunk();
+}
+
+template <class TImage>
+static typename TImage::Pointer ReadItkImageChunk( const QByteArray & chunk, const ImageChunkHeader & header )
+{
+    typename TImage::SizeType size;
+    typename TImage::DirectionType direction;
+    for( int i = 0; i < 3; ++i )
+    {
+        if( header.size[i] <= 0 ) return nullptr;
+        size[i] = header.size[i];
+        for( int j = 0; j < 3; ++j ) direction[i][j] = header.direction[i * 3 + j];
+    }
+    size_t voxelsSize = size[0] * size[1] * size[2] * sizeof( typename TImage::PixelType );
+    if( size_t( chunk.size() ) < sizeof( header ) + voxelsSize ) return nullptr;
+
+    typename TImage::RegionType region;
+    region.SetSize( size );
+    typename TImage::Pointer image = TImage::New();
+    image->SetRegions( region );
+    image->SetOrigin( header.origin );
+    image->SetSpacing( header.spacing );
+    image->SetDirection( direction );
+    image->Allocate();
+    memcpy( image->GetBufferPointer(), chunk.constData() + sizeof( header ), voxelsSize );
+    return image;
+}
+
 void SceneManager::ObjectReader( Serializer * ser, bool interactive )
 {
     int i, numberOfSceneObjects = 0;
@@ -1381,10 +1539,37 @@ void SceneManager::ObjectReader( Serializer * ser, bool interactive )
         }
         if( filePath.at( 0 ) == '.' ) filePath.replace( 0, 1, this->GetSceneDirectory() );
 
+        // Objects of a scene archive refer to a chunk, data files are extracted to be opened as usual
+        QString chunkName;
+        if( ser->GetArchive() && filePath.startsWith( ArchiveChunkPrefix ) )
+        {
+            chunkName = filePath.mid( ArchiveChunkPrefix.size() );
+            if( ser->GetArchive()->GetChunkType( chunkName ) == SceneArchive::FileChunk )
+            {
+                filePath = this->ExtractFileFromArchive( ser->GetArchive(), chunkName );
+                chunkName.clear();
+            }
+        }
+
         // If there is a path, we open a file
         QStringList fileToOpen;
         fileToOpen.clear();
-        if( !filePath.isEmpty() && QString::compare( filePath, "none" ) )
+        if( !chunkName.isEmpty() )
+        {
+            SceneObject * obj = this->ReadObjectFromArchive( ser->GetArchive(), chunkName );
+            if( obj )
+            {
+                obj->Serialize( ser );
+                this->AddObjectUsingID( obj, parentObject, oldId );
+                obj->Delete();
+            }
+            else
+            {
+                QString message = QString( "Can't read %1 from the scene archive." ).arg( chunkName );
+                QMessageBox::warning( nullptr, "Error", message );
+            }
+        }
+        else if( !filePath.isEmpty() && QString::compare( filePath, "none" ) )
         {
             fileToOpen.append( filePath );
             FileReader * fileReader = new FileReader;
@@ -1553,7 +1738,9 @@ void SceneManager::ObjectWriter( Serializer * ser )
         newPath.append( "/" );
         QString dataFileName( QString::number( obj->GetObjectID() ) );
         dataFileName.append( "." );
-        if( !oldPath.isEmpty() && !obj->GetDataFileName().isEmpty() )
+        if( ser->GetArchive() )
+            newPath = this->WriteObjectToArchive( ser->GetArchive(), obj );
+        else if( !oldPath.isEmpty() && !obj->GetDataFileName().isEmpty() )
         {
             QFileInfo fi( obj->GetDataFileName() );
             dataFileName.append( fi.completeSuffix() );
@@ -1620,6 +1807,113 @@ void SceneManager::ObjectWriter( Serializer * ser )
     ser->EndSection();
 }
 
+QString SceneManager::WriteObjectToArchive( SceneArchive * archive, SceneObject * obj )
+{
+    // points are always saved in the scene
+    if( obj->IsA( "PointsObject" ) ) return QString( "none" );
+
+    bool compress = Application::GetInstance().GetSettings()->CompressSceneArchives;
+    QString className( obj->GetClassName() );
+    QString chunkName;
+    bool ok = false;
+    if( className == "ImageObject" )
+    {
+        ImageObject * image = ImageObject::SafeDownCast( obj );
+        chunkName           = obj->GetSceneArchiveChunkName( "image" );
+        if( image->GetItkLabelImage() )
+            ok = WriteItkImageChunk( archive, chunkName, image->GetItkLabelImage().GetPointer(), VTK_UNSIGNED_CHAR,
+                                     compress );
+        else if( image->GetItkImage() )
+            ok = WriteItkImageChunk( archive, chunkName, image->GetItkImage().GetPointer(), VTK_FLOAT, compress );
+        else
+            archive->SetError( QString( "Image %1 has no data to save" ).arg( obj->GetName() ) );
+    }
+    else if( className == "PolyDataObject" )
+    {
+        PolyDataObject * pObj                     = PolyDataObject::SafeDownCast( obj );
+        vtkSmartPointer<vtkPolyDataWriter> writer = vtkSmartPointer<vtkPolyDataWriter>::New();
+        writer->SetInputData( pObj->GetPolyData() );
+        writer->SetFileTypeToBinary();
+        writer->WriteToOutputStringOn();
+        writer->Write();
+        QByteArray data( writer->GetOutputString(), qsizetype( writer->GetOutputStringLength() ) );
+        chunkName = obj->GetSceneArchiveChunkName( "polydata" );
+        ok        = archive->AddChunk( chunkName, SceneArchive::PolyDataChunk, data, compress );
+    }
+    else if( !obj->GetFullFileName().isEmpty() && !obj->GetDataFileName().isEmpty() )
+    {
+        // Other file formats are embedded as is
+        QFile file( obj->GetFullFileName() );
+        if( file.open( QIODevice::ReadOnly ) )
+        {
+            chunkName = obj->GetSceneArchiveChunkName( QFileInfo( obj->GetDataFileName() ).fileName() );
+            ok        = archive->AddChunk( chunkName, SceneArchive::FileChunk, file.readAll(), compress );
+        }
+        else
+            archive->SetError(
+                QString( "Can't read %1, the data file of %2" ).arg( file.fileName() ).arg( obj->GetName() ) );
+    }
+
+    if( !ok ) return QString( "none" );
+    return ArchiveChunkPrefix + chunkName;
+}
+
+SceneObject * SceneManager::ReadObjectFromArchive( SceneArchive * archive, QString chunkName )
+{
+    // The data is read now, the object is displayed as soon as it is added, see SceneArchive
+    QByteArray chunk             = archive->GetChunk( chunkName );
+    SceneArchive::ChunkType type = archive->GetChunkType( chunkName );
+    if( type == SceneArchive::ImageChunk && size_t( chunk.size() ) >= sizeof( ImageChunkHeader ) )
+    {
+        ImageChunkHeader header;
+        memcpy( &header, chunk.constData(), sizeof( header ) );
+        ImageObject * image = ImageObject::New();
+        bool ok             = false;
+        if( header.scalarType == VTK_UNSIGNED_CHAR )
+        {
+            IbisItkUnsignedChar3ImageType::Pointer itkImage =
+                ReadItkImageChunk<IbisItkUnsignedChar3ImageType>( chunk, header );
+            ok = itkImage && image->SetItkLabelImage( itkImage );
+        }
+        else if( header.scalarType == VTK_FLOAT )
+        {
+            IbisItkFloat3ImageType::Pointer itkImage = ReadItkImageChunk<IbisItkFloat3ImageType>( chunk, header );
+            ok                                       = itkImage && image->SetItkImage( itkImage );
+        }
+        if( ok ) return image;
+        image->Delete();
+    }
+    else if( type == SceneArchive::PolyDataChunk && !chunk.isEmpty() )
+    {
+        vtkSmartPointer<vtkPolyDataReader> reader = vtkSmartPointer<vtkPolyDataReader>::New();
+        reader->ReadFromInputStringOn();
+        reader->SetInputString( chunk.constData(), int( chunk.size() ) );
+        reader->Update();
+        if( reader->GetOutput()->GetNumberOfPoints() > 0 )
+        {
+            PolyDataObject * pObj = PolyDataObject::New();
+            pObj->SetPolyData( reader->GetOutput() );
+            return pObj;
+        }
+    }
+    return nullptr;
+}
+
+QString SceneManager::ExtractFileFromArchive( SceneArchive * archive, QString chunkName )
+{
+    if( !m_archiveFilesDirectory ) m_archiveFilesDirectory = new QTemporaryDir;
+    if( !m_archiveFilesDirectory->isValid() ) return QString();
+
+    // Keep the original file name, some formats are recognized by their extension
+    QString dirName = m_archiveFilesDirectory->filePath( QString::number( m_numberOfExtractedFiles++ ) );
+    QDir().mkpath( dirName );
+    QString fileName = dirName + "/" + QFileInfo( chunkName ).fileName();
+    QByteArray data  = archive->GetChunk( chunkName );
+    QFile file( fileName );
+    if( !file.open( QIODevice::WriteOnly ) || file.write( data ) != data.size() ) return QString();
+    return fileName;
+}
+
 void SceneManager::NotifyPluginsSceneAboutToLoad()
 {
     QList<IbisPlugin *> allPlugins;
@@ -15,6 +15,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vtkSmartPointer.h>
 
 #include <QColor>
+#include <QHash>
 #include <QList>
 #include <QMap>
 #include <QObject>
@@ -28,7 +29,9 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "serializer.h"
 #include "view.h"
 
+class QTemporaryDir;
 class QWidget;
+class RenderScheduler;
 class TripleCutPlaneObject;
 class TrackedSceneObject;
 class WorldObject;
@@ -151,6 +154,8 @@ public:
     vtkRenderer * GetViewRenderer( int viewID );
     /** Eneble/disable rendering in all views. */
     void SetRenderingEnabled( bool r );
+    /** Scheduler that renders the views that need render. */
+    RenderScheduler * GetRenderScheduler() { return m_renderScheduler; }
     /** Get camera view angle in main 3D view. */
     double Get3DCameraViewAngle();
     /** Set camera view angle in main 3D view. */
@@ -164,6 +169,11 @@ public:
     void WorldToReference( double worldPoint[3], double referencePoint[3] );
     void ReferenceToWorld( double referencePoint[3], double worldPoint[3] );
     void GetReferenceOrientation( vtkMatrix4x4 * mat );
+    /** Read the world matrices of objects at once, 16 elements per object in row-major order. Ancestors shared by the
+     *  objects are only updated once. If generations is not null, it receives the generation of each matrix so that
+     *  the caller can skip the ones that did not change since its last read. */
+    void GetWorldMatrices( const QList<SceneObject *> & objects, std::vector<double> & elements,
+                           std::vector<unsigned long> * generations = nullptr );
     ///@}
 
     /** Manipulate the global cursor. The cursor is a general concept that
@@ -234,7 +244,13 @@ public:
     void GetAllPointerObjects( QList<PointerObject *> & all );
     void GetAllTrackedObjects( QList<TrackedSceneObject *> & all );
     void GetAllObjectsOfType( const char * typeName, QList<SceneObject *> & all );
+    /** Objects for which IsA( typeName ) is true, in the order they were added. The list is cached and kept up to
+     * date as objects are added and removed, it is only built on the first query of a type. A copy of the cached
+     * list is returned, it shares its data until either is modified. */
+    ObjectList GetObjectsOfType( const char * typeName );
     SceneObject * GetObjectByID( int id );
+    /** Objects named name, in the order they were given the name. */
+    void GetObjectsByName( const QString & name, QList<SceneObject *> & objects );
     SceneObject * GetCurrentObject() { return m_currentObject; }
     void SetCurrentObject( SceneObject * cur );
     int GetNumberOfUserObjects();
@@ -479,11 +495,27 @@ protected:
     double ViewBackgroundColor[3];
     double View3DBackgroundColor[3];
     double CameraViewAngle3D;
+    RenderScheduler * m_renderScheduler;
     ///@}
 
     /** List of all the objects in the scene. */
     ObjectList AllObjects;
 
+    /** @name  Object indices
+     *  @brief Lookup of the objects of AllObjects by id, type and name
+     * */
+    ///@{
+    void AddToIndices( SceneObject * obj );
+    void RemoveFromIndices( SceneObject * obj );
+    /** Called by SceneObject when the id or the name of an object of the scene changes. */
+    void UpdateIDIndex( SceneObject * obj, int oldId );
+    void UpdateNameIndex( SceneObject * obj );
+    QHash<int, SceneObject *> m_objectsByID;
+    QHash<QString, ObjectList> m_objectsOfType;
+    QMultiHash<QString, SceneObject *> m_objectsByName;
+    QHash<SceneObject *, QString> m_indexedNames;
+    ///@}
+
     /** Version number saved in the scene xml file, used to verify if the scene is still supported,
      * some very old scenes cannot be loaded. */
     QString SupportedSceneSaveVersion;
@@ -504,11 +536,27 @@ protected:
     /** Text to display as a generic label on the tool bar. */
     QString GenericText;
 
+    /** @name  Scene archives
+     *  @brief Scenes saved with the SceneArchive::FileNameSuffix extension hold the data of all objects.
+     * */
+    ///@{
+    /** Store the data of an object in the archive, return the path saved as FullFileName, "none" if no data. */
+    QString WriteObjectToArchive( SceneArchive * archive, SceneObject * obj );
+    /** Create an ImageObject or a PolyDataObject from an image or polydata chunk. */
+    SceneObject * ReadObjectFromArchive( SceneArchive * archive, QString chunkName );
+    /** Write a data file chunk to a temporary file that can be opened by the FileReader. */
+    QString ExtractFileFromArchive( SceneArchive * archive, QString chunkName );
+    /** Temporary files extracted from scene archives, removed on exit from the application. */
+    QTemporaryDir * m_archiveFilesDirectory;
+    int m_numberOfExtractedFiles;
+    ///@}
+
 private:
     /** A set of 3 cutting planes used to show sagittal, coronal and transversal cross section of objects. */
     vtkSmartPointer<TripleCutPlaneObject> MainCutPlanes;
 
     friend class QuadViewWindow;
+    friend class SceneObject;
 
     /** @name  Views ID
      *  @brief Set specific view id.
@@ -45,11 +45,17 @@ SceneObject::SceneObject()
     this->AllowManualTransformEdit = true;
     this->LocalTransform = vtkTransform::New();  // by default, we have a vtkTransform that can be manipulated manually.
                                                  // Could be changed in certain object types.
-    this->WorldTransform       = vtkSmartPointer<vtkTransform>::New();
-    this->IsModifyingTransform = false;
-    this->TransformModified    = false;
-    this->RenderLayer          = 0;
-    this->m_vtkConnections     = vtkSmartPointer<vtkEventQtSlotConnect>::New();
+    this->WorldTransform               = vtkSmartPointer<vtkTransform>::New();
+    this->IsModifyingTransform         = false;
+    this->TransformModified            = false;
+    this->RenderLayer                  = 0;
+    this->m_worldMatrix                = vtkSmartPointer<vtkMatrix4x4>::New();
+    this->m_worldMatrixValid           = false;
+    this->m_worldMatrixGeneration      = 0;
+    this->m_parentGenerationAtUpdate   = 0;
+    this->m_localTransformTimeAtUpdate = 0;
+    this->m_updatingWorldTransform     = false;
+    this->m_vtkConnections             = vtkSmartPointer<vtkEventQtSlotConnect>::New();
     this->m_vtkConnections->Connect( this->LocalTransform, vtkCommand::ModifiedEvent, this,
                                      SLOT( NotifyTransformChanged() ), 0, 0.0, Qt::DirectConnection );
     this->m_vtkConnections->Connect( this->WorldTransform, vtkCommand::ModifiedEvent, this,
@@ -75,6 +81,7 @@ void SceneObject::Serialize( Serializer * ser )
     bool objectListable           = this->ObjectListable;
     bool allowManualTransformEdit = this->AllowManualTransformEdit;
     ::Serialize( ser, "ObjectName", this->Name );
+    if( ser->IsReader() && this->Manager ) this->Manager->UpdateNameIndex( this );
     ::Serialize( ser, "AllowChildren", allowChildren );
     ::Serialize( ser, "AllowChangeParent", allowChangeParent );
     ::Serialize( ser, "ObjectManagedBySystem", objectManagedBySystem );
@@ -111,9 +118,19 @@ void SceneObject::PostSceneRead()
 
 void SceneObject::Export() {}
 
+void SceneObject::SetObjectID( int id )
+{
+    if( id == this->ObjectID ) return;
+    int oldId      = this->ObjectID;
+    this->ObjectID = id;
+    if( this->Manager ) this->Manager->UpdateIDIndex( this, oldId );
+    this->Modified();
+}
+
 void SceneObject::SetName( QString name )
 {
     this->Name = name;
+    if( this->Manager ) this->Manager->UpdateNameIndex( this );
     emit NameChanged();
 }
 
@@ -123,6 +140,7 @@ void SceneObject::SetDataFileName( QString name )
     if( this->Name.isEmpty() )
     {
         this->Name = name;
+        if( this->Manager ) this->Manager->UpdateNameIndex( this );
         emit NameChanged();
     }
 }
@@ -156,8 +174,52 @@ vtkTransform * SceneObject::GetLocalTransform() { return this->LocalTransform; }
 
 vtkTransform * SceneObject::GetWorldTransform() { return this->WorldTransform; }
 
+vtkMatrix4x4 * SceneObject::GetWorldMatrix()
+{
+    UpdateWorldMatrix();
+    return m_worldMatrix;
+}
+
+unsigned long SceneObject::GetWorldMatrixGeneration()
+{
+    UpdateWorldMatrix();
+    return m_worldMatrixGeneration;
+}
+
+void SceneObject::UpdateWorldMatrix()
+{
+    // Validating the parent first updates the ancestors that need it, each of them only once
+    unsigned long parentGeneration = this->Parent ? this->Parent->GetWorldMatrixGeneration() : 0;
+    vtkMTimeType localTime         = this->LocalTransform->GetMTime();
+    if( m_worldMatrixValid && parentGeneration == m_parentGenerationAtUpdate &&
+        localTime == m_localTransformTimeAtUpdate )
+        return;
+
+    if( this->Parent )
+        vtkMatrix4x4::Multiply4x4( this->Parent->m_worldMatrix, this->LocalTransform->GetMatrix(), m_worldMatrix );
+    else
+        m_worldMatrix->DeepCopy( this->LocalTransform->GetMatrix() );
+    m_worldMatrixValid           = true;
+    m_parentGenerationAtUpdate   = parentGeneration;
+    m_localTransformTimeAtUpdate = localTime;
+    ++m_worldMatrixGeneration;
+}
+
+// Descendants of an invalid matrix are invalid too: reading a matrix validates all its ancestors. There is no need
+// to go down a subtree that is already invalid.
+void SceneObject::InvalidateWorldMatrix()
+{
+    if( !m_worldMatrixValid ) return;
+    m_worldMatrixValid = false;
+    for( int i = 0; i < this->Children.size(); ++i ) this->Children[i]->InvalidateWorldMatrix();
+}
+
 void SceneObject::NotifyTransformChanged()
 {
+    // WorldTransform is modified several times while it is rebuilt, UpdateWorldTransform() notifies once at the end
+    if( m_updatingWorldTransform ) return;
+
+    InvalidateWorldMatrix();
     if( this->IsModifyingTransform )
         this->TransformModified = true;
     else
@@ -177,8 +239,15 @@ QString SceneObject::GetSceneDataDirectoryForThisObject( QString baseDir )
     return dataDirName;
 }
 
+QString SceneObject::GetSceneArchiveChunkName( QString dataName )
+{
+    return QString( "%1_%2_data/%3" ).arg( GetObjectID() ).arg( this->GetClassName() ).arg( dataName );
+}
+
 void SceneObject::WorldTransformChanged()
 {
+    InvalidateWorldMatrix();
+
     // give subclasses a chance to react
     this->InternalWorldTransformChanged();
 
@@ -277,10 +346,12 @@ void SceneObject::RemoveChild( SceneObject * child )
 void SceneObject::UpdateWorldTransform()
 {
     // reset the list of concatenated transforms
+    m_updatingWorldTransform = true;
     this->WorldTransform->Identity();
 
     if( Parent ) this->WorldTransform->Concatenate( Parent->GetWorldTransform() );
     if( LocalTransform ) this->WorldTransform->Concatenate( LocalTransform );
+    m_updatingWorldTransform = false;
 
     WorldTransformChanged();
 }
@@ -74,7 +74,7 @@ public:
 
     ///@{
     /** Set/Get the ObjectID */
-    vtkSetMacro( ObjectID, int );
+    void SetObjectID( int id );
     vtkGetMacro( ObjectID, int );
     ///@}
 
@@ -110,6 +110,11 @@ public:
     vtkTransform * GetLocalTransform();
     /** Get world transform */
     vtkTransform * GetWorldTransform();
+    /** Get the matrix of the world transform. It is cached and only recomputed when the object or one of its
+     * ancestors has moved since the last call. The matrix belongs to the object and must not be modified. */
+    vtkMatrix4x4 * GetWorldMatrix();
+    /** Incremented every time the world matrix changes, to find out if values derived from it are outdated. */
+    unsigned long GetWorldMatrixGeneration();
     /** Find out if local transform can be set manually */
     bool CanEditTransformManually() { return AllowManualTransformEdit; }
     /** Allow/disallow manual transform change */
@@ -282,6 +287,7 @@ protected:
     virtual void Show() {}
 
     QString GetSceneDataDirectoryForThisObject( QString baseDir );
+    QString GetSceneArchiveChunkName( QString dataName );
     virtual void InternalPostSceneRead() {}
     virtual void WorldTransformChanged();
     /** let subclass react to the change in transform */
@@ -367,6 +373,18 @@ private:
     //  Tp is parent transform.
     vtkSmartPointer<vtkTransform> WorldTransform;
     vtkTransform * LocalTransform;
+
+    // World matrix cache: the matrix is valid as long as it was not invalidated, the local transform was not modified
+    // and the generation of the parent matrix it was computed from is the same. Local transforms can be modified
+    // without notice through their inputs, e.g. tracked objects, so their MTime is checked as well.
+    void UpdateWorldMatrix();
+    void InvalidateWorldMatrix();
+    vtkSmartPointer<vtkMatrix4x4> m_worldMatrix;
+    bool m_worldMatrixValid;
+    unsigned long m_worldMatrixGeneration;
+    unsigned long m_parentGenerationAtUpdate;
+    vtkMTimeType m_localTransformTimeAtUpdate;
+    bool m_updatingWorldTransform;
 };
 
 ObjectSerializationHeaderMacro( SceneObject );
@@ -20,6 +20,8 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <utility>
 #include <vector>
 
+#include "scenearchive.h"
+
 /**
  * @class   Serializer
  * @brief   Base class for reading/writing xml files to save the settings of Ibis
@@ -57,12 +59,15 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
  * bool Serialize( Serializer * serial, const char * attrName, Vec3 & v );\n
  * bool Serialize( Serializer * serial, const char * attrName, vtkMatrix4x4 * mat );\n
  *
- * @sa SerializerReader SerializerWriter
+ * When an archive is set, the xml document is written to, or read from, the PropertyTreeChunk of the archive
+ * instead of the file and objects can store their data in chunks of the same archive, see GetArchive().
+ *
+ * @sa SerializerReader SerializerWriter SceneArchive
  */
 class Serializer
 {
 public:
-    Serializer() : m_document( "configML" )
+    Serializer() : m_document( "configML" ), m_archive( nullptr )
     {
         m_root = m_document.createElement( "configuration" );
         m_document.appendChild( m_root );
@@ -80,6 +85,10 @@ public:
         QFileInfo info( QString( m_filename.c_str() ) );
         return info.path();
     }
+    /** Read/write the document and the data of the objects in a single scene archive, it must be open. */
+    void SetArchive( SceneArchive * archive ) { m_archive = archive; }
+    /** Return the scene archive, nullptr when objects save their data in separate files. */
+    SceneArchive * GetArchive() { return m_archive; }
     /** Find the version of Serializer which created currently read file. */
     void ReadVersionFromFile()
     {
@@ -133,6 +142,7 @@ protected:
     QDomDocument m_document;
     QDomElement m_root;
     QDomNode m_currentNode;
+    SceneArchive * m_archive;
 };
 
 /**
@@ -156,6 +166,10 @@ public:
 
     virtual bool Finish() override
     {
+        if( m_archive )
+            return m_archive->AddChunk( SceneArchive::PropertyTreeChunkName, SceneArchive::PropertyTreeChunk,
+                                        m_document.toByteArray(), true );
+
         QFile file( m_filename.c_str() );
         if( !file.open( QIODevice::WriteOnly ) ) return false;
 
@@ -257,16 +271,23 @@ public:
 
     virtual bool Start() override
     {
-        QFile file( m_filename.c_str() );
+        if( m_archive )
+        {
+            if( !m_document.setContent( m_archive->GetChunk( SceneArchive::PropertyTreeChunkName ) ) ) return false;
+        }
+        else
+        {
+            QFile file( m_filename.c_str() );
 
-        if( !file.open( QIODevice::ReadOnly ) ) return false;
+            if( !file.open( QIODevice::ReadOnly ) ) return false;
 
-        if( !m_document.setContent( &file ) )
-        {
+            if( !m_document.setContent( &file ) )
+            {
+                file.close();
+                return false;
+            }
             file.close();
-            return false;
         }
-        file.close();
 
         m_root = m_document.documentElement();
         if( m_root.tagName() != "configuration" )
@@ -0,0 +1,131 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+#include <vector>
+
+// Fixed size ring of items handed from one producer thread to one consumer thread without locking.
+// When the ring is full, Push() drops the new item and counts it, the producer never waits for the consumer.
+template <class T>
+class SPSCRing
+{
+public:
+    SPSCRing( unsigned capacity ) : m_items( capacity + 1 ), m_head( 0 ), m_tail( 0 ), m_numberOfDroppedItems( 0 ) {}
+
+    // Producer thread
+    bool IsFull() const
+    {
+        return Next( m_head.load( std::memory_order_relaxed ) ) == m_tail.load( std::memory_order_acquire );
+    }
+
+    bool Push( const T & item )
+    {
+        unsigned head = m_head.load( std::memory_order_relaxed );
+        unsigned next = Next( head );
+        if( next == m_tail.load( std::memory_order_acquire ) )
+        {
+            m_numberOfDroppedItems.fetch_add( 1, std::memory_order_relaxed );
+            return false;
+        }
+        m_items[head] = item;
+        m_head.store( next, std::memory_order_release );
+        return true;
+    }
+
+    void CountDroppedItem() { m_numberOfDroppedItems.fetch_add( 1, std::memory_order_relaxed ); }
+
+    // Consumer thread
+    bool Pop( T & item )
+    {
+        unsigned tail = m_tail.load( std::memory_order_relaxed );
+        if( tail == m_head.load( std::memory_order_acquire ) ) return false;
+        item = m_items[tail];
+        m_items[tail] = T();  // don't keep references to the item until the slot is reused
+        m_tail.store( Next( tail ), std::memory_order_release );
+        return true;
+    }
+
+    // Pop all items and keep the most recent one. Returns false if the ring was empty.
+    bool PopLatest( T & item )
+    {
+        bool popped = false;
+        while( Pop( item ) ) popped = true;
+        return popped;
+    }
+
+    void Clear()
+    {
+        T item;
+        while( Pop( item ) )
+        {
+        }
+    }
+
+    // Any thread
+    unsigned GetCapacity() const { return (unsigned)m_items.size() - 1; }
+    unsigned GetNumberOfDroppedItems() const { return m_numberOfDroppedItems.load( std::memory_order_relaxed ); }
+
+private:
+    unsigned Next( unsigned index ) const { return index + 1 == m_items.size() ? 0 : index + 1; }
+
+    std::vector<T> m_items;
+    std::atomic<unsigned> m_head;  // next slot written by the producer
+    std::atomic<unsigned> m_tail;  // next slot read by the consumer
+    std::atomic<unsigned> m_numberOfDroppedItems;
+};
+
+// Latest item handed from one producer thread to one consumer thread without locking (triple buffer).
+// Push() replaces an item that was not popped yet, so Pop() always returns the most recent item.
+template <class T>
+class SPSCLatestValue
+{
+public:
+    SPSCLatestValue() : m_back( 0 ), m_middle( 1 ), m_front( 2 ), m_numberOfOverwrittenItems( 0 ) {}
+
+    // Producer thread
+    void Push( const T & item )
+    {
+        m_items[m_back]   = item;
+        unsigned previous = m_middle.exchange( m_back | NewItemFlag, std::memory_order_acq_rel );
+        if( previous & NewItemFlag ) m_numberOfOverwrittenItems.fetch_add( 1, std::memory_order_relaxed );
+        m_back = previous & IndexMask;
+    }
+
+    // Consumer thread. Returns false if no item was pushed since the last call.
+    bool Pop( T & item )
+    {
+        if( !( m_middle.load( std::memory_order_acquire ) & NewItemFlag ) ) return false;
+        m_front          = m_middle.exchange( m_front, std::memory_order_acq_rel ) & IndexMask;
+        item             = m_items[m_front];
+        m_items[m_front] = T();  // don't keep references to the item
+        return true;
+    }
+
+    // Any thread
+    unsigned GetNumberOfOverwrittenItems() const
+    {
+        return m_numberOfOverwrittenItems.load( std::memory_order_relaxed );
+    }
+
+private:
+    static const unsigned NewItemFlag = 4;
+    static const unsigned IndexMask   = 3;
+
+    T m_items[3];
+    unsigned m_back;                 // slot written by the producer
+    std::atomic<unsigned> m_middle;  // slot exchanged by both threads, with NewItemFlag if it was not popped yet
+    unsigned m_front;                // slot read by the consumer
+    std::atomic<unsigned> m_numberOfOverwrittenItems;
+};
+
+#endif
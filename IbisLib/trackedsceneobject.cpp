@@ -2,10 +2,14 @@
 
 #include <vtkActor.h>
 #include <vtkAxes.h>
+#include <vtkMatrix4x4.h>
 #include <vtkPolyDataMapper.h>
 #include <vtkRenderer.h>
+#include <vtkSmartPointer.h>
 #include <vtkTransform.h>
 
+#include <algorithm>
+
 #include "hardwaremodule.h"
 #include "serializerhelper.h"
 #include "view.h"
@@ -15,6 +19,7 @@ ObjectSerializationMacro( TrackedSceneObject );
 TrackedSceneObject::TrackedSceneObject()
 {
     m_timestamp                   = -1;
+    m_temporalCalibrationOffset   = 0.0;
     m_hardwareModule              = nullptr;
     m_state                       = Undefined;
     m_transform                   = vtkTransform::New();
@@ -119,6 +124,8 @@ void TrackedSceneObject::SerializeTracked( Serializer * ser )
     if( ser->IsReader() ) SetCalibrationMatrix( calibrationMat );
 
     calibrationMat->Delete();
+
+    ::Serialize( ser, "TemporalCalibrationOffset", m_temporalCalibrationOffset );
 }
 
 void TrackedSceneObject::SetState( TrackerToolState state )
@@ -143,6 +150,39 @@ void TrackedSceneObject::SetCalibrationMatrix( vtkMatrix4x4 * mat )
 
 vtkMatrix4x4 * TrackedSceneObject::GetCalibrationMatrix() { return m_calibrationTransform->GetMatrix(); }
 
+void TrackedSceneObject::AddPoseSample( vtkMatrix4x4 * m, double timestamp, TrackerToolState state )
+{
+    // Poses of a tool that is not tracked correctly must not be used to place video frames
+    m_poseHistory.AddPose( m, timestamp, state == Ok );
+    for( size_t i = 0; i < m_poseSampleListeners.size(); ++i )
+        m_poseSampleListeners[i]->PoseSampleAdded( this, m, timestamp, state );
+}
+
+void TrackedSceneObject::AddPoseSampleListener( PoseSampleListener * listener )
+{
+    if( std::find( m_poseSampleListeners.begin(), m_poseSampleListeners.end(), listener ) ==
+        m_poseSampleListeners.end() )
+        m_poseSampleListeners.push_back( listener );
+}
+
+void TrackedSceneObject::RemovePoseSampleListener( PoseSampleListener * listener )
+{
+    m_poseSampleListeners.erase( std::remove( m_poseSampleListeners.begin(), m_poseSampleListeners.end(), listener ),
+                                 m_poseSampleListeners.end() );
+}
+
+PoseHistory::PoseStatus TrackedSceneObject::GetUncalibratedWorldMatrixAt( double timestamp, vtkMatrix4x4 * m )
+{
+    vtkSmartPointer<vtkMatrix4x4> input = vtkSmartPointer<vtkMatrix4x4>::New();
+    PoseHistory::PoseStatus status      = m_poseHistory.GetPoseAt( timestamp + m_temporalCalibrationOffset, input );
+    if( status != PoseHistory::ValidPose ) return status;
+    if( Parent )
+        vtkMatrix4x4::Multiply4x4( Parent->GetWorldMatrix(), input, m );
+    else
+        m->DeepCopy( input );
+    return status;
+}
+
 vtkTransform * TrackedSceneObject::GetReferenceToolTransform()
 {
     Q_ASSERT( m_hardwareModule );
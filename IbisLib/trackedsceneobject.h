@@ -3,12 +3,25 @@
 
 #include <QObject>
 #include <map>
+#include <vector>
 
 #include "ibistypes.h"
+#include "posehistory.h"
 #include "sceneobject.h"
 
 class vtkActor;
 class HardwareModule;
+class TrackedSceneObject;
+
+// Told of every pose sample added to a tracked object, including the samples received between clock ticks. Called on
+// the thread that adds the samples, before the input matrix of the object is updated.
+class PoseSampleListener
+{
+public:
+    virtual ~PoseSampleListener() {}
+    virtual void PoseSampleAdded( TrackedSceneObject * obj, vtkMatrix4x4 * inputMatrix, double timestamp,
+                                  TrackerToolState state ) = 0;
+};
 
 class TrackedSceneObject : public SceneObject
 {
@@ -52,6 +65,18 @@ public:
     vtkTransform * GetReferenceToolTransform();
     double GetLastTimestamp() { return m_timestamp; }
 
+    // History of the input matrices, used to find the pose of the tool when a video frame was captured
+    void AddPoseSample( vtkMatrix4x4 * m, double timestamp, TrackerToolState state = Ok );
+    PoseHistory * GetPoseHistory() { return &m_poseHistory; }
+    void AddPoseSampleListener( PoseSampleListener * listener );
+    void RemovePoseSampleListener( PoseSampleListener * listener );
+    // Uncalibrated world matrix interpolated at timestamp, a video timestamp corrected by the temporal
+    // calibration offset. m is only set if a valid pose is found, see PoseHistory::GetPoseAt.
+    PoseHistory::PoseStatus GetUncalibratedWorldMatrixAt( double timestamp, vtkMatrix4x4 * m );
+    // Time in seconds to add to video timestamps to get the tracker time at which the frame was captured
+    void SetTemporalCalibrationOffset( double offset ) { m_temporalCalibrationOffset = offset; }
+    double GetTemporalCalibrationOffset() { return m_temporalCalibrationOffset; }
+
     bool IsTransformFrozen();
     void FreezeTransform();
     void UnFreezeTransform();
@@ -72,6 +97,9 @@ protected:
     vtkTransform * m_uncalibratedWorldTransform;
 
     double m_timestamp;
+    PoseHistory m_poseHistory;
+    std::vector<PoseSampleListener *> m_poseSampleListeners;
+    double m_temporalCalibrationOffset;
 };
 
 ObjectSerializationHeaderMacro( TrackedSceneObject );
@@ -10,18 +10,56 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 =========================================================================*/
 #include "trackedvideobuffer.h"
 
+#include <vtkDataArray.h>
 #include <vtkImageData.h>
 #include <vtkMatrix4x4.h>
 #include <vtkPassThrough.h>
+#include <vtkPointData.h>
 #include <vtkTransform.h>
 
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
 #include <QProgressDialog>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
 
 #include "application.h"
+#include "scenearchive.h"
 #include "serializer.h"
 
 static int DefaultNumberOfScalarComponents = 1;
 
+// Slabs are aligned on page boundaries and every frame in a slab starts on a cache line
+static const size_t SlabAlignment      = 4096;
+static const size_t SlabFrameAlignment = 64;
+
+static size_t AlignUp( size_t size, size_t alignment ) { return ( size + alignment - 1 ) / alignment * alignment; }
+
+static unsigned char * AllocateSlab( size_t size )
+{
+#ifdef _WIN32
+    return static_cast<unsigned char *>( _aligned_malloc( size, SlabAlignment ) );
+#else
+    void * ptr = nullptr;
+    if( posix_memalign( &ptr, SlabAlignment, size ) != 0 ) return nullptr;
+    return static_cast<unsigned char *>( ptr );
+#endif
+}
+
+static void FreeSlab( unsigned char * data )
+{
+#ifdef _WIN32
+    _aligned_free( data );
+#else
+    free( data );
+#endif
+}
+
 TrackedVideoBuffer::TrackedVideoBuffer( int w, int h )
 {
     m_defaultImageSize[0] = w;
@@ -30,10 +68,252 @@ TrackedVideoBuffer::TrackedVideoBuffer( int w, int h )
     m_videoOutput         = vtkSmartPointer<vtkImageData>::New();
     m_output              = vtkSmartPointer<vtkPassThrough>::New();
     m_output->SetInputData( m_videoOutput );
-    m_outputTransform = vtkSmartPointer<vtkTransform>::New();
+    m_outputTransform    = vtkSmartPointer<vtkTransform>::New();
+    m_storageMode        = DynamicStorage;
+    m_slabNumberOfFrames = 0;
+    m_slabFormat[0]      = 0;
+    m_slabFormat[1]      = 0;
+    m_slabFormat[2]      = 0;
+    m_slabFormat[3]      = 0;
+    m_slabFrameStride    = 0;
+    m_firstSlot          = 0;
+    m_numberOfSlabFrames = 0;
+    m_mappedFile         = nullptr;
+    m_preparingSpareSlab = false;
+}
+
+TrackedVideoBuffer::~TrackedVideoBuffer()
+{
+    Clear();
+    ReleaseReservedFrames();
+}
+
+bool TrackedVideoBuffer::ReserveFrames( int nbFrames, int width, int height, int nbComponents, int scalarType,
+                                        StorageMode mode )
+{
+    Q_ASSERT( GetNumberOfFrames() == 0 );
+
+    // Reuse the slabs of the previous recording if the frames have the same size and format
+    if( mode == m_storageMode && nbFrames == m_slabNumberOfFrames && width == m_slabFormat[0] &&
+        height == m_slabFormat[1] && nbComponents == m_slabFormat[2] && scalarType == m_slabFormat[3] &&
+        !m_slabs.empty() )
+    {
+        m_firstSlot          = 0;
+        m_numberOfSlabFrames = 0;
+        return true;
+    }
+
+    ReleaseReservedFrames();
+    if( mode == DynamicStorage || mode == MappedStorage || nbFrames <= 0 || width <= 0 || height <= 0 ||
+        nbComponents <= 0 )
+        return false;
+
+    m_storageMode        = mode;
+    m_slabNumberOfFrames = nbFrames;
+    m_slabFormat[0]      = width;
+    m_slabFormat[1]      = height;
+    m_slabFormat[2]      = nbComponents;
+    m_slabFormat[3]      = scalarType;
+
+    size_t frameSize = size_t( width ) * size_t( height ) * size_t( nbComponents ) *
+                       size_t( vtkAbstractArray::GetDataTypeSize( scalarType ) );
+    m_slabFrameStride = AlignUp( frameSize, SlabFrameAlignment );
+
+    FrameSlab slab = AllocateTouchedSlab( m_slabNumberOfFrames, m_slabFormat, m_slabFrameStride );
+    if( !slab.data )
+    {
+        ReleaseReservedFrames();
+        return false;
+    }
+    m_slabs.push_back( slab );
+    return true;
+}
+
+void TrackedVideoBuffer::ReleaseReservedFrames()
+{
+    if( m_storageMode == DynamicStorage ) return;
+
+    m_currentFrame = -1;
+    m_videoOutput->Initialize();
+    ReleaseSpareSlab();
+    for( unsigned i = 0; i < m_slabs.size(); ++i ) DeleteSlab( m_slabs[i], !m_mappedFile );
+    m_slabs.clear();
+    // deleting the file unmaps the frames
+    delete m_mappedFile;
+    m_mappedFile = nullptr;
+    m_firstSlot          = 0;
+    m_numberOfSlabFrames = 0;
+    m_slabNumberOfFrames = 0;
+    m_storageMode        = DynamicStorage;
+}
+
+int TrackedVideoBuffer::GetReservedCapacity() { return int( m_slabs.size() ) * m_slabNumberOfFrames; }
+
+bool TrackedVideoBuffer::AddSlab()
+{
+    // The next slab is normally ready
+    FrameSlab slab;
+    {
+        QMutexLocker lock( &m_spareSlabMutex );
+        std::swap( slab, m_spareSlab );
+    }
+
+    // No spare slab if frames come in faster than it is allocated or if it could not be allocated. The slab is then
+    // allocated here rather than waiting for the worker, its pages are faulted in as frames are copied to it.
+    if( !slab.data )
+    {
+        size_t slabSize      = AlignUp( m_slabFrameStride * size_t( m_slabNumberOfFrames ), SlabAlignment );
+        unsigned char * data = AllocateSlab( slabSize );
+        if( !data ) return false;
+        slab = CreateSlab( data, m_slabNumberOfFrames, m_slabFormat, m_slabFrameStride );
+    }
+    m_slabs.push_back( std::move( slab ) );
+    return true;
+}
+
+TrackedVideoBuffer::FrameSlab TrackedVideoBuffer::CreateSlab( unsigned char * data, int nbFrames, const int format[4],
+                                                              size_t frameStride,
+                                                              const std::vector<qint64> * frameOffsets )
+{
+    FrameSlab slab;
+    slab.data    = data;
+    int nbValues = format[0] * format[1] * format[2];
+    for( int i = 0; i < nbFrames; ++i )
+    {
+        vtkDataArray * scalars = vtkDataArray::CreateDataArray( format[3] );
+        scalars->SetNumberOfComponents( format[2] );
+        size_t offset = frameOffsets ? size_t( ( *frameOffsets )[i] ) : i * frameStride;
+        scalars->SetVoidArray( slab.data + offset, nbValues, 1 );
+        vtkImageData * image = vtkImageData::New();
+        image->SetDimensions( format[0], format[1], 1 );
+        image->GetPointData()->SetScalars( scalars );
+        scalars->Delete();
+        slab.frames.push_back( image );
+        slab.matrices.push_back( vtkMatrix4x4::New() );
+    }
+    slab.matrixElements.resize( size_t( nbFrames ) * 16 );
+    slab.timestamps.resize( size_t( nbFrames ) );
+    return slab;
+}
+
+TrackedVideoBuffer::FrameSlab TrackedVideoBuffer::AllocateTouchedSlab( int nbFrames, const int format[4],
+                                                                       size_t frameStride )
+{
+    size_t slabSize      = AlignUp( frameStride * size_t( nbFrames ), SlabAlignment );
+    unsigned char * data = AllocateSlab( slabSize );
+    if( !data ) return FrameSlab();
+
+    // Touch every page now so that the OS does not have to fault them in while recording
+    memset( data, 0, slabSize );
+    return CreateSlab( data, nbFrames, format, frameStride );
+}
+
+void TrackedVideoBuffer::DeleteSlab( FrameSlab & slab, bool freeData )
+{
+    for( unsigned i = 0; i < slab.frames.size(); ++i ) slab.frames[i]->Delete();
+    for( unsigned i = 0; i < slab.matrices.size(); ++i ) slab.matrices[i]->Delete();
+    if( freeData && slab.data ) FreeSlab( slab.data );
+    slab = FrameSlab();
 }
 
-TrackedVideoBuffer::~TrackedVideoBuffer() { Clear(); }
+void TrackedVideoBuffer::PrepareSpareSlab()
+{
+    QMutexLocker lock( &m_spareSlabMutex );
+    if( m_spareSlab.data || m_preparingSpareSlab ) return;
+    m_preparingSpareSlab = true;
+
+    int nbFrames       = m_slabNumberOfFrames;
+    size_t frameStride = m_slabFrameStride;
+    std::vector<int> format( m_slabFormat, m_slabFormat + 4 );
+    QThreadPool::globalInstance()->start(
+        [this, nbFrames, frameStride, format]()
+        {
+            FrameSlab slab = AllocateTouchedSlab( nbFrames, format.data(), frameStride );
+            QMutexLocker lock( &m_spareSlabMutex );
+            m_spareSlab          = slab;
+            m_preparingSpareSlab = false;
+            m_spareSlabPrepared.wakeAll();
+        } );
+}
+
+void TrackedVideoBuffer::ReleaseSpareSlab()
+{
+    QMutexLocker lock( &m_spareSlabMutex );
+    while( m_preparingSpareSlab ) m_spareSlabPrepared.wait( &m_spareSlabMutex );
+    DeleteSlab( m_spareSlab, true );
+}
+
+bool TrackedVideoBuffer::IsFrameFormatCompatible( vtkImageData * frame )
+{
+    if( m_storageMode == DynamicStorage ) return true;
+    int * dims = frame->GetDimensions();
+    return dims[0] == m_slabFormat[0] && dims[1] == m_slabFormat[1] && dims[2] == 1 &&
+           frame->GetNumberOfScalarComponents() == m_slabFormat[2] && frame->GetScalarType() == m_slabFormat[3];
+}
+
+bool TrackedVideoBuffer::AddSlabFrame( vtkImageData * frame, vtkMatrix4x4 * mat, double timestamp )
+{
+    if( !IsFrameFormatCompatible( frame ) ) return false;
+    int * dims = frame->GetDimensions();
+
+    int capacity = GetReservedCapacity();
+    if( m_numberOfSlabFrames == capacity )
+    {
+        if( m_storageMode == RingStorage )
+        {
+            // drop the oldest frame
+            m_firstSlot = ( m_firstSlot + 1 ) % capacity;
+            --m_numberOfSlabFrames;
+        }
+        else if( !AddSlab() )
+            return false;
+    }
+    int slot = GetSlabSlot( m_numberOfSlabFrames );
+    ++m_numberOfSlabFrames;
+
+    // Allocate the next slab once the last one is half full, so that it is ready when the last one is full
+    if( m_storageMode == ChunkedStorage &&
+        m_numberOfSlabFrames >= GetReservedCapacity() - m_slabNumberOfFrames / 2 )
+        PrepareSpareSlab();
+
+    vtkImageData * image = GetSlabImage( slot );
+    memcpy( image->GetScalarPointer(), frame->GetScalarPointer(),
+            size_t( dims[0] ) * size_t( dims[1] ) * size_t( m_slabFormat[2] ) * size_t( frame->GetScalarSize() ) );
+    image->SetSpacing( frame->GetSpacing() );
+    image->SetOrigin( frame->GetOrigin() );
+    image->GetPointData()->GetScalars()->Modified();
+    image->Modified();
+
+    memcpy( GetSlabMatrixElements( slot ), &mat->Element[0][0], 16 * sizeof( double ) );
+    GetSlabTimestamp( slot ) = timestamp;
+    return true;
+}
+
+int TrackedVideoBuffer::GetSlabSlot( int index )
+{
+    if( m_storageMode == RingStorage ) return ( m_firstSlot + index ) % GetReservedCapacity();
+    return index;
+}
+
+vtkImageData * TrackedVideoBuffer::GetSlabImage( int slot )
+{
+    return m_slabs[slot / m_slabNumberOfFrames].frames[slot % m_slabNumberOfFrames];
+}
+
+vtkMatrix4x4 * TrackedVideoBuffer::GetSlabMatrix( int slot )
+{
+    return m_slabs[slot / m_slabNumberOfFrames].matrices[slot % m_slabNumberOfFrames];
+}
+
+double * TrackedVideoBuffer::GetSlabMatrixElements( int slot )
+{
+    return &m_slabs[slot / m_slabNumberOfFrames].matrixElements[size_t( slot % m_slabNumberOfFrames ) * 16];
+}
+
+double & TrackedVideoBuffer::GetSlabTimestamp( int slot )
+{
+    return m_slabs[slot / m_slabNumberOfFrames].timestamps[slot % m_slabNumberOfFrames];
+}
 
 void TrackedVideoBuffer::Clear()
 {
@@ -45,30 +325,50 @@ void TrackedVideoBuffer::Clear()
     m_frames.clear();
     m_matrices.clear();
     m_timestamps.clear();
+
+    // mapped frames belong to the file
+    if( m_storageMode == MappedStorage ) ReleaseReservedFrames();
+
+    // reserved storage is kept, ReserveFrames() reuses it for the next recording of the same format
+    m_firstSlot          = 0;
+    m_numberOfSlabFrames = 0;
+
     m_currentFrame = -1;
     m_videoOutput->Initialize();
 }
 
 int TrackedVideoBuffer::GetFrameWidth()
 {
+    if( m_storageMode != DynamicStorage ) return m_slabFormat[0];
     if( m_frames.size() > 0 ) return m_frames[0]->GetDimensions()[0];
     return m_defaultImageSize[0];
 }
 
 int TrackedVideoBuffer::GetFrameHeight()
 {
+    if( m_storageMode != DynamicStorage ) return m_slabFormat[1];
     if( m_frames.size() > 0 ) return m_frames[0]->GetDimensions()[1];
     return m_defaultImageSize[1];
 }
 
 int TrackedVideoBuffer::GetFrameNumberOfComponents()
 {
+    if( m_storageMode != DynamicStorage ) return m_slabFormat[2];
     if( m_frames.size() > 0 ) return m_frames[0]->GetNumberOfScalarComponents();
     return DefaultNumberOfScalarComponents;
 }
 
-void TrackedVideoBuffer::AddFrame( vtkImageData * frame, vtkMatrix4x4 * mat, double timestamp )
+bool TrackedVideoBuffer::AddFrame( vtkImageData * frame, vtkMatrix4x4 * mat, double timestamp )
 {
+    if( m_storageMode == MappedStorage && !CopyMappedFrames() ) return false;
+
+    if( m_storageMode != DynamicStorage )
+    {
+        if( !AddSlabFrame( frame, mat, timestamp ) ) return false;
+        SetCurrentFrame( m_numberOfSlabFrames - 1 );
+        return true;
+    }
+
     vtkImageData * im = vtkImageData::New();
     im->DeepCopy( frame );
     m_frames.push_back( im );
@@ -80,11 +380,18 @@ void TrackedVideoBuffer::AddFrame( vtkImageData * frame, vtkMatrix4x4 * mat, dou
     m_timestamps.push_back( timestamp );
 
     SetCurrentFrame( m_frames.size() - 1 );
+    return true;
+}
+
+int TrackedVideoBuffer::GetNumberOfFrames()
+{
+    if( m_storageMode != DynamicStorage ) return m_numberOfSlabFrames;
+    return m_frames.size();
 }
 
 void TrackedVideoBuffer::SetCurrentFrame( int index )
 {
-    Q_ASSERT( index >= 0 && index < m_frames.size() );
+    Q_ASSERT( index >= 0 && index < GetNumberOfFrames() );
     m_currentFrame = index;
     m_videoOutput->ShallowCopy( GetCurrentImage() );
     m_outputTransform->SetMatrix( GetCurrentMatrix() );
@@ -93,37 +400,47 @@ void TrackedVideoBuffer::SetCurrentFrame( int index )
 
 vtkMatrix4x4 * TrackedVideoBuffer::GetCurrentMatrix()
 {
-    Q_ASSERT( m_currentFrame != -1 && m_frames.size() > 0 );
-    return m_matrices[m_currentFrame];
+    Q_ASSERT( m_currentFrame != -1 && GetNumberOfFrames() > 0 );
+    return GetMatrix( m_currentFrame );
 }
 
 vtkImageData * TrackedVideoBuffer::GetCurrentImage()
 {
-    Q_ASSERT( m_currentFrame != -1 && m_frames.size() > 0 );
-    return m_frames[m_currentFrame];
+    Q_ASSERT( m_currentFrame != -1 && GetNumberOfFrames() > 0 );
+    return GetImage( m_currentFrame );
 }
 
 double TrackedVideoBuffer::GetCurrentTimestamp()
 {
-    Q_ASSERT( m_currentFrame != -1 && m_frames.size() > 0 );
-    return m_timestamps[m_currentFrame];
+    Q_ASSERT( m_currentFrame != -1 && GetNumberOfFrames() > 0 );
+    return GetTimestamp( m_currentFrame );
 }
 
 vtkMatrix4x4 * TrackedVideoBuffer::GetMatrix( int index )
 {
-    Q_ASSERT( index >= 0 && index < m_frames.size() );
+    Q_ASSERT( index >= 0 && index < GetNumberOfFrames() );
+    if( m_storageMode != DynamicStorage )
+    {
+        int slot             = GetSlabSlot( index );
+        vtkMatrix4x4 * mat   = GetSlabMatrix( slot );
+        const double * elems = GetSlabMatrixElements( slot );
+        if( memcmp( &mat->Element[0][0], elems, 16 * sizeof( double ) ) != 0 ) mat->DeepCopy( elems );
+        return mat;
+    }
     return m_matrices[index];
 }
 
 vtkImageData * TrackedVideoBuffer::GetImage( int index )
 {
-    Q_ASSERT( index >= 0 && index < m_frames.size() );
+    Q_ASSERT( index >= 0 && index < GetNumberOfFrames() );
+    if( m_storageMode != DynamicStorage ) return GetSlabImage( GetSlabSlot( index ) );
     return m_frames[index];
 }
 
 double TrackedVideoBuffer::GetTimestamp( int index )
 {
-    Q_ASSERT( index >= 0 && index < m_frames.size() );
+    Q_ASSERT( index >= 0 && index < GetNumberOfFrames() );
+    if( m_storageMode != DynamicStorage ) return GetSlabTimestamp( GetSlabSlot( index ) );
     return m_timestamps[index];
 }
 
@@ -141,9 +458,12 @@ bool TrackedVideoBuffer::Serialize( Serializer * ser, QString dataDirectory )
     if( needsSerialization )
     {
         if( !ser->IsReader() )
-            WriteMatrices( m_matrices, dataDirectory );
+            WriteMatrices( dataDirectory );
         else
+        {
+            ReleaseReservedFrames();
             ReadMatrices( m_matrices, dataDirectory );
+        }
 
         if( !ser->IsReader() )
             WriteImages( dataDirectory );
@@ -156,14 +476,405 @@ bool TrackedVideoBuffer::Serialize( Serializer * ser, QString dataDirectory )
     return true;
 }
 
+bool TrackedVideoBuffer::Serialize( Serializer * ser, SceneArchive * archive, QString chunkName )
+{
+    ::Serialize( ser, "CurrentFrame", m_currentFrame );
+    ::Serialize( ser, "FramesChunk", chunkName );
+
+    bool ok = ser->IsReader() ? ReadFromArchive( archive, chunkName ) : WriteToArchive( archive, chunkName );
+    if( ser->IsReader() && m_currentFrame >= 0 && m_currentFrame < GetNumberOfFrames() )
+        SetCurrentFrame( m_currentFrame );
+
+    return ok;
+}
+
+// Frame stack chunk: header, 16 matrix elements per frame, one timestamp per frame, then the pixels of every frame
+struct FrameStackHeader
+{
+    qint32 numberOfFrames;
+    qint32 width;
+    qint32 height;
+    qint32 numberOfComponents;
+    qint32 scalarType;
+    qint32 reserved;
+    double spacing[3];
+    double origin[3];
+};
+
+bool TrackedVideoBuffer::WriteToArchive( SceneArchive * archive, QString chunkName )
+{
+    FrameStackHeader header;
+    memset( &header, 0, sizeof( header ) );
+    header.numberOfFrames = GetNumberOfFrames();
+    header.spacing[0] = header.spacing[1] = header.spacing[2] = 1.0;
+    if( header.numberOfFrames > 0 )
+    {
+        vtkImageData * first      = GetImage( 0 );
+        header.width              = first->GetDimensions()[0];
+        header.height             = first->GetDimensions()[1];
+        header.numberOfComponents = first->GetNumberOfScalarComponents();
+        header.scalarType         = first->GetScalarType();
+        first->GetSpacing( header.spacing );
+        first->GetOrigin( header.origin );
+    }
+
+    // All frames are stored with the format of the first one
+    for( int i = 1; i < header.numberOfFrames; ++i )
+    {
+        vtkImageData * frame = GetImage( i );
+        int * dims           = frame->GetDimensions();
+        if( dims[0] != header.width || dims[1] != header.height || dims[2] != 1 ||
+            frame->GetNumberOfScalarComponents() != header.numberOfComponents ||
+            frame->GetScalarType() != header.scalarType )
+            return archive->SetError( QString( "Frame %1 of %2 doesn't have the size and format of the first frame" )
+                                          .arg( i )
+                                          .arg( chunkName ) );
+    }
+
+    size_t frameSize = size_t( header.width ) * size_t( header.height ) * size_t( header.numberOfComponents ) *
+                       size_t( vtkAbstractArray::GetDataTypeSize( header.scalarType ) );
+    if( !archive->BeginChunk( chunkName, SceneArchive::FrameStackChunk ) ||
+        !archive->WriteChunkData( &header, sizeof( header ) ) )
+        return false;
+    for( int i = 0; i < header.numberOfFrames; ++i )
+    {
+        if( !archive->WriteChunkData( &GetMatrix( i )->Element[0][0], 16 * sizeof( double ) ) ) return false;
+    }
+    for( int i = 0; i < header.numberOfFrames; ++i )
+    {
+        double timestamp = GetTimestamp( i );
+        if( !archive->WriteChunkData( &timestamp, sizeof( double ) ) ) return false;
+    }
+    for( int i = 0; i < header.numberOfFrames; ++i )
+    {
+        if( !archive->WriteChunkData( GetImage( i )->GetScalarPointer(), qint64( frameSize ) ) ) return false;
+    }
+    return archive->EndChunk();
+}
+
+bool TrackedVideoBuffer::ReadFromArchive( SceneArchive * archive, QString chunkName )
+{
+    if( archive->GetChunkType( chunkName ) != SceneArchive::FrameStackChunk ) return false;
+    QByteArray chunk = archive->GetChunk( chunkName );
+    if( size_t( chunk.size() ) < sizeof( FrameStackHeader ) ) return false;
+    FrameStackHeader header;
+    memcpy( &header, chunk.constData(), sizeof( header ) );
+
+    size_t nbFrames  = size_t( std::max( header.numberOfFrames, 0 ) );
+    size_t frameSize = size_t( std::max( header.width, 0 ) ) * size_t( std::max( header.height, 0 ) ) *
+                       size_t( std::max( header.numberOfComponents, 0 ) ) *
+                       size_t( vtkAbstractArray::GetDataTypeSize( header.scalarType ) );
+    size_t matricesOffset   = sizeof( header );
+    size_t timestampsOffset = matricesOffset + nbFrames * 16 * sizeof( double );
+    size_t pixelsOffset     = timestampsOffset + nbFrames * sizeof( double );
+    if( size_t( chunk.size() ) < pixelsOffset + nbFrames * frameSize ) return false;
+
+    Clear();
+    ReleaseReservedFrames();
+    if( nbFrames == 0 ) return true;
+
+    // Frames are copied from the archive straight into contiguous reserved storage
+    if( !ReserveFrames( header.numberOfFrames, header.width, header.height, header.numberOfComponents,
+                        header.scalarType, ChunkedStorage ) )
+        return false;
+
+    const char * data                     = chunk.constData();
+    vtkSmartPointer<vtkDataArray> scalars = vtkSmartPointer<vtkDataArray>::Take(
+        vtkDataArray::CreateDataArray( header.scalarType ) );
+    scalars->SetNumberOfComponents( header.numberOfComponents );
+    vtkSmartPointer<vtkImageData> frame = vtkSmartPointer<vtkImageData>::New();
+    frame->SetDimensions( header.width, header.height, 1 );
+    frame->SetSpacing( header.spacing );
+    frame->SetOrigin( header.origin );
+    frame->GetPointData()->SetScalars( scalars );
+    vtkSmartPointer<vtkMatrix4x4> matrix = vtkSmartPointer<vtkMatrix4x4>::New();
+    double elements[16];
+    double timestamp;
+    for( size_t i = 0; i < nbFrames; ++i )
+    {
+        // the frame refers to the chunk data, it is only read by AddFrame
+        scalars->SetVoidArray( const_cast<char *>( data + pixelsOffset + i * frameSize ),
+                               vtkIdType( header.width ) * header.height * header.numberOfComponents, 1 );
+        memcpy( elements, data + matricesOffset + i * 16 * sizeof( double ), sizeof( elements ) );
+        memcpy( &timestamp, data + timestampsOffset + i * sizeof( double ), sizeof( double ) );
+        matrix->DeepCopy( elements );
+        if( !AddSlabFrame( frame, matrix, timestamp ) ) return false;
+    }
+    return true;
+}
+
+// Packed file: header, table of 16 matrix elements and a timestamp per frame, then the frames starting on a page
+// boundary, each on a cache line, so that the frames of the mapped file are aligned as in reserved storage
+static const char PackedFileMagic[8] = { 'I', 'B', 'I', 'S', 'U', 'S', 'P', 'K' };
+static const qint32 PackedFileVersion = 1;
+
+struct PackedFileHeader
+{
+    char magic[8];
+    qint32 version;
+    qint32 numberOfFrames;
+    qint32 width;
+    qint32 height;
+    qint32 numberOfComponents;
+    qint32 scalarType;
+    qint32 calibratedTransformApplied;
+    qint32 reserved;
+    qint64 tableOffset;
+    qint64 framesOffset;
+    qint64 frameStride;
+    double spacing[3];
+    double origin[3];
+    double calibrationMatrix[16];
+};
+
+static const size_t PackedTableEntrySize = 17 * sizeof( double );
+
+static bool ReadPackedFileHeader( QFile & file, PackedFileHeader & header )
+{
+    if( file.read( reinterpret_cast<char *>( &header ), sizeof( header ) ) != qint64( sizeof( header ) ) ) return false;
+    if( memcmp( header.magic, PackedFileMagic, sizeof( PackedFileMagic ) ) != 0 || header.version != PackedFileVersion )
+        return false;
+    if( header.numberOfFrames < 0 || header.width < 0 || header.height < 0 || header.numberOfComponents < 0 ||
+        header.tableOffset < qint64( sizeof( header ) ) || header.framesOffset % SlabFrameAlignment != 0 )
+        return false;
+
+    qint64 nbFrames  = header.numberOfFrames;
+    qint64 frameSize = qint64( header.width ) * header.height * header.numberOfComponents *
+                       vtkAbstractArray::GetDataTypeSize( header.scalarType );
+    if( header.frameStride < frameSize || ( nbFrames > 0 && frameSize <= 0 ) ) return false;
+    return header.tableOffset + nbFrames * qint64( PackedTableEntrySize ) <= header.framesOffset &&
+           header.framesOffset + nbFrames * header.frameStride <= file.size();
+}
+
+bool TrackedVideoBuffer::IsPackedFile( QString filename )
+{
+    QFile file( filename );
+    PackedFileHeader header;
+    return file.open( QIODevice::ReadOnly ) && ReadPackedFileHeader( file, header );
+}
+
+bool TrackedVideoBuffer::WritePackedFile( QString filename, vtkMatrix4x4 * calibrationMatrix,
+                                          bool calibratedTransformApplied )
+{
+    PackedFileHeader header;
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, PackedFileMagic, sizeof( PackedFileMagic ) );
+    header.version                    = PackedFileVersion;
+    header.numberOfFrames             = GetNumberOfFrames();
+    header.calibratedTransformApplied = calibratedTransformApplied ? 1 : 0;
+    header.spacing[0] = header.spacing[1] = header.spacing[2] = 1.0;
+    vtkMatrix4x4::DeepCopy( header.calibrationMatrix, calibrationMatrix );
+    if( header.numberOfFrames > 0 )
+    {
+        vtkImageData * first      = GetImage( 0 );
+        header.width              = first->GetDimensions()[0];
+        header.height             = first->GetDimensions()[1];
+        header.numberOfComponents = first->GetNumberOfScalarComponents();
+        header.scalarType         = first->GetScalarType();
+        first->GetSpacing( header.spacing );
+        first->GetOrigin( header.origin );
+    }
+
+    // All frames are stored with the format of the first one
+    for( int i = 1; i < header.numberOfFrames; ++i )
+    {
+        vtkImageData * frame = GetImage( i );
+        int * dims           = frame->GetDimensions();
+        if( dims[0] != header.width || dims[1] != header.height || dims[2] != 1 ||
+            frame->GetNumberOfScalarComponents() != header.numberOfComponents ||
+            frame->GetScalarType() != header.scalarType )
+            return false;
+    }
+
+    size_t nbFrames     = size_t( header.numberOfFrames );
+    size_t frameSize    = size_t( header.width ) * size_t( header.height ) * size_t( header.numberOfComponents ) *
+                         size_t( vtkAbstractArray::GetDataTypeSize( header.scalarType ) );
+    header.tableOffset  = sizeof( header );
+    header.framesOffset = AlignUp( sizeof( header ) + nbFrames * PackedTableEntrySize, SlabAlignment );
+    header.frameStride  = AlignUp( frameSize, SlabFrameAlignment );
+
+    // The frames of a mapped file can't change, only the header needs to be written
+    if( QFileInfo( filename ).absoluteFilePath() == GetMappedFileName() )
+    {
+        QFile file( filename );
+        return file.open( QIODevice::ReadWrite ) &&
+               file.write( reinterpret_cast<const char *>( &header ), sizeof( header ) ) == qint64( sizeof( header ) );
+    }
+
+    // Written to a temporary file that replaces the packed file only once complete, so that a failed save keeps the
+    // previous file and frames that other buffers mapped from it stay valid
+    QSaveFile file( filename );
+    if( !file.open( QIODevice::WriteOnly ) ) return false;
+    bool ok = file.write( reinterpret_cast<const char *>( &header ), sizeof( header ) ) == qint64( sizeof( header ) );
+    for( size_t i = 0; i < nbFrames && ok; ++i )
+    {
+        double entry[17];
+        memcpy( entry, &GetMatrix( int( i ) )->Element[0][0], 16 * sizeof( double ) );
+        entry[16] = GetTimestamp( int( i ) );
+        ok        = file.write( reinterpret_cast<const char *>( entry ), sizeof( entry ) ) == qint64( sizeof( entry ) );
+    }
+    QByteArray padding( int( std::max( header.framesOffset, header.frameStride ) ), 0 );
+    qint64 tablePadding = header.framesOffset - file.pos();
+    if( ok ) ok = file.write( padding.constData(), tablePadding ) == tablePadding;
+    qint64 framePadding = header.frameStride - qint64( frameSize );
+    for( size_t i = 0; i < nbFrames && ok; ++i )
+    {
+        const char * pixels = static_cast<const char *>( GetImage( int( i ) )->GetScalarPointer() );
+        ok                  = file.write( pixels, qint64( frameSize ) ) == qint64( frameSize );
+        if( ok ) ok = file.write( padding.constData(), framePadding ) == framePadding;
+    }
+    if( !ok )
+    {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+bool TrackedVideoBuffer::MapPackedFile( QString filename, vtkMatrix4x4 * calibrationMatrix,
+                                        bool * calibratedTransformApplied )
+{
+    QFile * file = new QFile( filename );
+    PackedFileHeader header;
+    if( !file->open( QIODevice::ReadOnly ) || !ReadPackedFileHeader( *file, header ) )
+    {
+        delete file;
+        return false;
+    }
+    if( calibrationMatrix ) calibrationMatrix->DeepCopy( header.calibrationMatrix );
+    if( calibratedTransformApplied ) *calibratedTransformApplied = header.calibratedTransformApplied != 0;
+
+    Clear();
+    ReleaseReservedFrames();
+    if( header.numberOfFrames == 0 )
+    {
+        delete file;
+        return true;
+    }
+
+    // Private mapping: frames modified in memory are never written back to the file
+    uchar * data = file->map( 0, file->size(), QFileDevice::MapPrivateOption );
+    if( !data )
+    {
+        delete file;
+        return false;
+    }
+
+    m_storageMode        = MappedStorage;
+    m_mappedFile         = file;
+    m_slabNumberOfFrames = header.numberOfFrames;
+    m_slabFormat[0]      = header.width;
+    m_slabFormat[1]      = header.height;
+    m_slabFormat[2]      = header.numberOfComponents;
+    m_slabFormat[3]      = header.scalarType;
+    m_slabFrameStride    = size_t( header.frameStride );
+    m_slabs.push_back(
+        CreateSlab( data + header.framesOffset, m_slabNumberOfFrames, m_slabFormat, m_slabFrameStride ) );
+
+    size_t nbFrames  = size_t( header.numberOfFrames );
+    FrameSlab & slab = m_slabs[0];
+    for( size_t i = 0; i < nbFrames; ++i )
+    {
+        const uchar * entry = data + header.tableOffset + i * PackedTableEntrySize;
+        memcpy( &slab.matrixElements[i * 16], entry, 16 * sizeof( double ) );
+        memcpy( &slab.timestamps[i], entry + 16 * sizeof( double ), sizeof( double ) );
+        vtkImageData * image = slab.frames[i];
+        image->SetSpacing( header.spacing );
+        image->SetOrigin( header.origin );
+    }
+    m_numberOfSlabFrames = header.numberOfFrames;
+    return true;
+}
+
+bool TrackedVideoBuffer::MapFileFrames( QString filename, const int format[4], const std::vector<qint64> & frameOffsets,
+                                        const std::vector<double> & matrixElements,
+                                        const std::vector<double> & timestamps )
+{
+    size_t nbFrames = frameOffsets.size();
+    if( nbFrames == 0 || matrixElements.size() != nbFrames * 16 || timestamps.size() != nbFrames ) return false;
+
+    QFile * file = new QFile( filename );
+    if( !file->open( QIODevice::ReadOnly ) )
+    {
+        delete file;
+        return false;
+    }
+    qint64 frameSize = qint64( format[0] ) * qint64( format[1] ) * qint64( format[2] ) *
+                       qint64( vtkAbstractArray::GetDataTypeSize( format[3] ) );
+    for( size_t i = 0; i < nbFrames; ++i )
+    {
+        if( frameOffsets[i] < 0 || frameOffsets[i] + frameSize > file->size() )
+        {
+            delete file;
+            return false;
+        }
+    }
+
+    // Private mapping: frames modified in memory are never written back to the file
+    uchar * data = file->map( 0, file->size(), QFileDevice::MapPrivateOption );
+    if( !data )
+    {
+        delete file;
+        return false;
+    }
+
+    Clear();
+    ReleaseReservedFrames();
+    m_storageMode        = MappedStorage;
+    m_mappedFile         = file;
+    m_slabNumberOfFrames = int( nbFrames );
+    for( int i = 0; i < 4; ++i ) m_slabFormat[i] = format[i];
+    m_slabFrameStride = size_t( frameSize );
+    m_slabs.push_back( CreateSlab( data, m_slabNumberOfFrames, m_slabFormat, m_slabFrameStride, &frameOffsets ) );
+    m_slabs[0].matrixElements = matrixElements;
+    m_slabs[0].timestamps     = timestamps;
+    m_numberOfSlabFrames      = int( nbFrames );
+    return true;
+}
+
+QString TrackedVideoBuffer::GetMappedFileName()
+{
+    if( !m_mappedFile ) return QString();
+    return QFileInfo( m_mappedFile->fileName() ).absoluteFilePath();
+}
+
+bool TrackedVideoBuffer::CopyMappedFrames()
+{
+    // Take the mapped frames out of the buffer, they stay valid until the file is deleted
+    std::vector<FrameSlab> mappedSlabs;
+    mappedSlabs.swap( m_slabs );
+    QFile * mappedFile = m_mappedFile;
+    int nbFrames       = m_numberOfSlabFrames;
+    int currentFrame   = m_currentFrame;
+    int format[4]      = { m_slabFormat[0], m_slabFormat[1], m_slabFormat[2], m_slabFormat[3] };
+    m_mappedFile       = nullptr;
+    ReleaseReservedFrames();
+
+    // Frames are allocated one by one if storage can't be reserved
+    ReserveFrames( nbFrames, format[0], format[1], format[2], format[3], ChunkedStorage );
+    vtkSmartPointer<vtkMatrix4x4> matrix = vtkSmartPointer<vtkMatrix4x4>::New();
+    bool ok                              = true;
+    for( int i = 0; i < nbFrames && ok; ++i )
+    {
+        matrix->DeepCopy( &mappedSlabs[0].matrixElements[i * 16] );
+        ok = AddFrame( mappedSlabs[0].frames[i], matrix, mappedSlabs[0].timestamps[i] );
+    }
+    if( ok && currentFrame >= 0 ) SetCurrentFrame( currentFrame );
+
+    DeleteSlab( mappedSlabs[0], false );
+    delete mappedFile;
+    return ok;
+}
+
 void TrackedVideoBuffer::Export( QString dirName, QProgressDialog * progress )
 {
     WriteImages( dirName, progress );
-    WriteMatrices( m_matrices, dirName );
+    WriteMatrices( dirName );
 }
 
 void TrackedVideoBuffer::Import( QString dirName, QProgressDialog * progress )
 {
+    ReleaseReservedFrames();
     ReadMatrices( m_matrices, dirName );
     ReadImages( m_matrices.size(), dirName, progress );
 }
@@ -210,12 +921,12 @@ void TrackedVideoBuffer::WriteMatrix( vtkMatrix4x4 * mat, QString filename )
     writer->Write();
 }
 
-void TrackedVideoBuffer::WriteMatrices( QList<vtkMatrix4x4 *> & matrices, QString dirName )
+void TrackedVideoBuffer::WriteMatrices( QString dirName )
 {
-    for( int i = 0; i < matrices.size(); ++i )
+    for( int i = 0; i < GetNumberOfFrames(); ++i )
     {
         QString matrixFilename = dirName + QString( "/uncalMat_%1.xfm" ).arg( i, 4, 10, QLatin1Char( '0' ) );
-        WriteMatrix( matrices[i], matrixFilename );
+        WriteMatrix( GetMatrix( i ), matrixFilename );
     }
 }
 
@@ -224,15 +935,16 @@ void TrackedVideoBuffer::WriteMatrices( QList<vtkMatrix4x4 *> & matrices, QStrin
 void TrackedVideoBuffer::WriteImages( QString dirName, QProgressDialog * progressDlg )
 {
     vtkPNGWriter * writer = vtkPNGWriter::New();
-    for( int i = 0; i < m_frames.size(); ++i )
+    int nbFrames = GetNumberOfFrames();
+    for( int i = 0; i < nbFrames; ++i )
     {
         QString filename = dirName + QString( "/frame_%1" ).arg( i, 4, 10, QLatin1Char( '0' ) );
         writer->SetFileName( filename.toUtf8().data() );
-        writer->SetInputData( m_frames[i] );
+        writer->SetInputData( GetImage( i ) );
         writer->Write();
 
         if( progressDlg )
-            Application::GetInstance().UpdateProgress( progressDlg, (int)round( (float)i / m_frames.size() * 100.0 ) );
+            Application::GetInstance().UpdateProgress( progressDlg, (int)round( (float)i / nbFrames * 100.0 ) );
     }
     writer->Delete();
 }
@@ -14,14 +14,19 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vtkSmartPointer.h>
 
 #include <QList>
+#include <QMutex>
+#include <QWaitCondition>
+#include <vector>
 
 class vtkImageData;
 class vtkAlgorithmOutput;
+class QFile;
 class vtkPassThrough;
 class vtkMatrix4x4;
 class QProgressDialog;
 class vtkTransform;
 class Serializer;
+class SceneArchive;
 
 class TrackedVideoBuffer
 {
@@ -29,6 +34,26 @@ public:
     TrackedVideoBuffer( int defaultWidth, int defaultHeight );
     ~TrackedVideoBuffer();
 
+    // How frames are stored. By default, a new vtkImageData and vtkMatrix4x4 are allocated for every frame.
+    // With reserved storage, frames of a fixed size and format are copied into contiguous, page-aligned slabs
+    // allocated up front and matrices and timestamps are kept in flat parallel arrays, one per slab.
+    enum StorageMode
+    {
+        DynamicStorage,  // one image and one matrix allocated per frame
+        // Slabs of nbFrames frames. Once the last slab is half full, the next one is allocated on a worker thread, so
+        // that it is ready when the last one is full. If frames come in faster than the worker allocates, AddFrame()
+        // allocates the slab itself rather than waiting for the worker.
+        ChunkedStorage,
+        RingStorage,     // a single slab of nbFrames frames, the oldest frame is overwritten when full
+        MappedStorage    // frames of a packed file mapped in memory, see MapPackedFile()
+    };
+
+    bool ReserveFrames( int nbFrames, int width, int height, int nbComponents, int scalarType,
+                        StorageMode mode = ChunkedStorage );
+    void ReleaseReservedFrames();
+    StorageMode GetStorageMode() { return m_storageMode; }
+    int GetReservedCapacity();
+
     void Clear();
 
     // frame properties
@@ -36,8 +61,11 @@ public:
     int GetFrameHeight();
     int GetFrameNumberOfComponents();
 
-    void AddFrame( vtkImageData * frame, vtkMatrix4x4 * mat, double timestamp = 0.0 );
-    int GetNumberOfFrames() { return m_frames.size(); }
+    // Returns false if the frame could not be stored, e.g. if it doesn't match the format of reserved storage
+    bool AddFrame( vtkImageData * frame, vtkMatrix4x4 * mat, double timestamp = 0.0 );
+    // False if frame can't be added to reserved storage because its size or format differs
+    bool IsFrameFormatCompatible( vtkImageData * frame );
+    int GetNumberOfFrames();
 
     void SetCurrentFrame( int index );
     int GetCurrentFrame() { return m_currentFrame; }
@@ -55,6 +83,26 @@ public:
     vtkTransform * GetOutputTransform() { return m_outputTransform; }
 
     bool Serialize( Serializer * ser, QString dataDirectory );
+    // Frames, matrices and timestamps are stored in a single frame stack chunk of the serializer's archive
+    bool Serialize( Serializer * ser, SceneArchive * archive, QString chunkName );
+    bool WriteToArchive( SceneArchive * archive, QString chunkName );
+    bool ReadFromArchive( SceneArchive * archive, QString chunkName );
+    // Packed file: a header with the frame geometry and the calibration matrix, a table of matrices and timestamps
+    // and the frames, contiguous and page-aligned so that the file can be mapped in memory.
+    bool WritePackedFile( QString filename, vtkMatrix4x4 * calibrationMatrix, bool calibratedTransformApplied );
+    // Map the frames of a packed file, they are paged in when accessed. Adding a frame copies the mapped frames to
+    // chunked storage first. calibrationMatrix and calibratedTransformApplied are set if not null.
+    bool MapPackedFile( QString filename, vtkMatrix4x4 * calibrationMatrix = nullptr,
+                        bool * calibratedTransformApplied = nullptr );
+    // Map frames stored in a file that is not a packed file, e.g. the pixel data of a sequence file. format is the
+    // width, height, number of components and scalar type of the frames, frameOffsets the position of each frame in
+    // the file and matrixElements has 16 elements per frame.
+    bool MapFileFrames( QString filename, const int format[4], const std::vector<qint64> & frameOffsets,
+                        const std::vector<double> & matrixElements, const std::vector<double> & timestamps );
+    // Name of the mapped file, empty if frames are not mapped
+    QString GetMappedFileName();
+    static bool IsPackedFile( QString filename );
+
     void Export( QString dirName, QProgressDialog * progress = 0 );
     void Import( QString dirName, QProgressDialog * progress = 0 );
 
@@ -62,7 +110,7 @@ public:
     static void WriteMatrix( vtkMatrix4x4 * mat, QString filename );
 
 protected:
-    void WriteMatrices( QList<vtkMatrix4x4 *> & matrices, QString dirName );
+    void WriteMatrices( QString dirName );
     void ReadMatrices( QList<vtkMatrix4x4 *> & matrices, QString dirName );
     void WriteImages( QString dirName, QProgressDialog * progressDlg = 0 );
     void ReadImages( int nbImages, QString dirName, QProgressDialog * progressDlg = 0 );
@@ -77,6 +125,50 @@ protected:
     QList<double> m_timestamps;
 
     int m_defaultImageSize[2];
+
+    // Reserved storage
+    struct FrameSlab
+    {
+        FrameSlab() : data( nullptr ) {}
+        unsigned char * data;
+        std::vector<vtkImageData *> frames;    // zero-copy views into data
+        std::vector<vtkMatrix4x4 *> matrices;  // returned by GetMatrix, refreshed from matrixElements
+        std::vector<double> matrixElements;    // 16 elements per frame
+        std::vector<double> timestamps;
+    };
+    bool AddSlab();
+    bool AddSlabFrame( vtkImageData * frame, vtkMatrix4x4 * mat, double timestamp );
+    int GetSlabSlot( int index );
+    vtkImageData * GetSlabImage( int slot );
+    vtkMatrix4x4 * GetSlabMatrix( int slot );
+    double * GetSlabMatrixElements( int slot );
+    double & GetSlabTimestamp( int slot );
+    // Frames are consecutive, frameStride bytes apart, unless their offsets from data are given. Only uses its
+    // arguments, so that slabs can be created on a worker thread.
+    static FrameSlab CreateSlab( unsigned char * data, int nbFrames, const int format[4], size_t frameStride,
+                                 const std::vector<qint64> * frameOffsets = nullptr );
+    // Allocate a slab and touch its pages, null if memory can't be allocated
+    static FrameSlab AllocateTouchedSlab( int nbFrames, const int format[4], size_t frameStride );
+    static void DeleteSlab( FrameSlab & slab, bool freeData );
+    // Start allocating the next slab of chunked storage on the global thread pool
+    void PrepareSpareSlab();
+    void ReleaseSpareSlab();
+    bool CopyMappedFrames();
+
+    StorageMode m_storageMode;
+    int m_slabNumberOfFrames;  // number of frames per slab
+    int m_slabFormat[4];       // width, height, number of components, scalar type
+    size_t m_slabFrameStride;
+    std::vector<FrameSlab> m_slabs;
+    int m_firstSlot;
+    int m_numberOfSlabFrames;
+    QFile * m_mappedFile;
+
+    // Next slab of chunked storage, allocated ahead of time on the global thread pool
+    QMutex m_spareSlabMutex;
+    QWaitCondition m_spareSlabPrepared;
+    FrameSlab m_spareSlab;  // data is null until the slab is ready
+    bool m_preparingSpareSlab;
 };
 
 #endif
@@ -0,0 +1,336 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "usacquisitionexporter.h"
+
+#include <itkImageFileWriter.h>
+#include <itkMetaDataDictionary.h>
+#include <itkMetaDataObject.h>
+#include <vtkImageData.h>
+#include <vtkImageShiftScale.h>
+#include <vtkImageStencil.h>
+#include <vtkImageStencilData.h>
+#include <vtkMatrix4x4.h>
+
+#include <QThreadPool>
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include "ibisitkvtkconverter.h"
+
+namespace
+{
+// Converted frames waiting to be written. Push blocks while the queue is full and Pop while it is empty,
+// both return false once the queue is aborted.
+class ConvertedFrameQueue
+{
+public:
+    struct Item
+    {
+        Item() : index( -1 ) {}
+        int index;
+        IbisItkUnsignedChar3ImageType::Pointer grayImage;
+        IbisRGBImageType::Pointer rgbImage;
+    };
+
+    ConvertedFrameQueue( int capacity ) : m_capacity( capacity ), m_aborted( false ) {}
+
+    bool Push( const Item & item )
+    {
+        QMutexLocker lock( &m_mutex );
+        while( !m_aborted && (int)m_items.size() >= m_capacity ) m_notFull.wait( &m_mutex );
+        if( m_aborted ) return false;
+        m_items.push_back( item );
+        m_notEmpty.wakeOne();
+        return true;
+    }
+
+    bool Pop( Item & item )
+    {
+        QMutexLocker lock( &m_mutex );
+        while( !m_aborted && m_items.empty() ) m_notEmpty.wait( &m_mutex );
+        if( m_aborted ) return false;
+        item = m_items.front();
+        m_items.pop_front();
+        m_notFull.wakeOne();
+        return true;
+    }
+
+    void Abort()
+    {
+        QMutexLocker lock( &m_mutex );
+        m_aborted = true;
+        m_items.clear();
+        m_notFull.wakeAll();
+        m_notEmpty.wakeAll();
+    }
+
+private:
+    QMutex m_mutex;
+    QWaitCondition m_notFull;
+    QWaitCondition m_notEmpty;
+    std::deque<Item> m_items;
+    int m_capacity;
+    bool m_aborted;
+};
+
+// Converts the frames of a job to ITK images. Each converter thread has its own filters and copy of the mask,
+// VTK pipelines can't be shared between threads.
+class FrameConverter
+{
+public:
+    FrameConverter( const USAcquisitionExporter::Job & job ) : m_job( job )
+    {
+        m_shifter = vtkSmartPointer<vtkImageShiftScale>::New();
+        m_shifter->SetOutputScalarType( VTK_UNSIGNED_CHAR );
+        m_shifter->SetClampOverflow( 1 );
+        m_shifter->SetShift( 0 );
+        m_shifter->SetScale( 1.0 );
+        if( job.mask )
+        {
+            m_mask = vtkSmartPointer<vtkImageStencilData>::New();
+            m_mask->DeepCopy( job.mask );
+            m_stencil = vtkSmartPointer<vtkImageStencil>::New();
+            m_stencil->SetStencilData( m_mask );
+            m_stencil->SetBackgroundColor( 1.0, 1.0, 1.0, 0.0 );
+        }
+        m_matrix    = vtkSmartPointer<vtkMatrix4x4>::New();
+        m_converter = vtkSmartPointer<IbisItkVtkConverter>::New();
+    }
+
+    void Convert( int index, ConvertedFrameQueue::Item & item )
+    {
+        const USAcquisitionExporter::Frame & frame = m_job.frames[index];
+        m_matrix->DeepCopy( frame.matrix );
+        item.index = index;
+
+        vtkImageData * image = frame.image;
+        if( image->GetNumberOfScalarComponents() == 1 )
+        {
+            if( image->GetScalarType() != VTK_UNSIGNED_CHAR )
+            {
+                m_shifter->SetInputData( image );
+                m_shifter->Update();
+                image = m_shifter->GetOutput();
+            }
+            image          = this->Mask( image );
+            item.grayImage = IbisItkUnsignedChar3ImageType::New();
+            m_converter->ConvertVtkImageToItkImage( item.grayImage, image, m_matrix );
+            this->SetAttributes( item.grayImage->GetMetaDataDictionary(), index, 'f' );
+        }
+        else
+        {
+            image         = this->Mask( image );
+            item.rgbImage = IbisRGBImageType::New();
+            m_converter->ConvertVtkImageToItkImage( item.rgbImage, image, m_matrix );
+            this->SetAttributes( item.rgbImage->GetMetaDataDictionary(), index, 'g' );
+        }
+    }
+
+private:
+    vtkImageData * Mask( vtkImageData * image )
+    {
+        if( !m_stencil ) return image;
+        m_stencil->SetInputData( image );
+        m_stencil->Update();
+        return m_stencil->GetOutput();
+    }
+
+    // Acquisition properties: time stamp, calibration matrix, frame ID, flag telling if the calibration matrix
+    // was applied
+    void SetAttributes( itk::MetaDataDictionary & metaDict, int index, char timestampFormat )
+    {
+        double timestamp = m_job.frames[index].timestamp;
+        itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:calibratioMatrix",
+                                               m_job.calibrationMatrix.toUtf8().data() );
+        itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:calibratioMatrixApplied",
+                                               m_job.useCalibratedTransform ? "1" : "0" );
+        itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:timestamp",
+                                               QString::number( timestamp, timestampFormat, 6 ).toUtf8().data() );
+        itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:frameID",
+                                               QString::number( index ).toUtf8().data() );
+    }
+
+    const USAcquisitionExporter::Job & m_job;
+    vtkSmartPointer<vtkImageShiftScale> m_shifter;
+    vtkSmartPointer<vtkImageStencilData> m_mask;
+    vtkSmartPointer<vtkImageStencil> m_stencil;
+    vtkSmartPointer<vtkMatrix4x4> m_matrix;
+    vtkSmartPointer<IbisItkVtkConverter> m_converter;
+};
+
+template <class TImage>
+bool WriteFrame( typename itk::ImageFileWriter<TImage>::Pointer writer, TImage * image, const QString & fileName )
+{
+    writer->SetFileName( fileName.toUtf8().data() );
+    writer->SetInput( image );
+    try
+    {
+        writer->Update();
+    }
+    catch( itk::ExceptionObject & exp )
+    {
+        std::cerr << "Exception caught!" << std::endl;
+        std::cerr << exp << std::endl;
+        return false;
+    }
+    return true;
+}
+}  // namespace
+
+USAcquisitionExporter::USAcquisitionExporter( QObject * parent ) : QThread( parent )
+{
+    m_converters    = new QThreadPool;
+    m_queueCapacity = 2 * m_converters->maxThreadCount();
+    m_nextJobId     = 0;
+    m_quit          = false;
+}
+
+USAcquisitionExporter::~USAcquisitionExporter()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_jobsAvailable.wakeOne();
+    m_mutex.unlock();
+    wait();
+    delete m_converters;
+}
+
+int USAcquisitionExporter::Enqueue( JobPointer job )
+{
+    QMutexLocker lock( &m_mutex );
+    job->id = m_nextJobId++;
+    m_pendingJobs.push_back( job );
+    m_jobsAvailable.wakeOne();
+    if( !isRunning() ) start();
+    return job->id;
+}
+
+void USAcquisitionExporter::Cancel( int jobId )
+{
+    QMutexLocker lock( &m_mutex );
+    if( m_currentJob && m_currentJob->id == jobId ) m_currentJob->cancelled = true;
+    for( std::deque<JobPointer>::iterator it = m_pendingJobs.begin(); it != m_pendingJobs.end(); ++it )
+    {
+        if( ( *it )->id == jobId ) ( *it )->cancelled = true;
+    }
+}
+
+bool USAcquisitionExporter::HasJobs( int acquisitionId )
+{
+    if( m_currentJob && m_currentJob->acquisitionId == acquisitionId ) return true;
+    for( std::deque<JobPointer>::iterator it = m_pendingJobs.begin(); it != m_pendingJobs.end(); ++it )
+    {
+        if( ( *it )->acquisitionId == acquisitionId ) return true;
+    }
+    return false;
+}
+
+bool USAcquisitionExporter::IsExporting( int acquisitionId )
+{
+    QMutexLocker lock( &m_mutex );
+    return HasJobs( acquisitionId );
+}
+
+void USAcquisitionExporter::WaitForExports( int acquisitionId )
+{
+    QMutexLocker lock( &m_mutex );
+    while( HasJobs( acquisitionId ) ) m_jobFinished.wait( &m_mutex );
+}
+
+void USAcquisitionExporter::SetNumberOfConverterThreads( int n )
+{
+    m_converters->setMaxThreadCount( n > 0 ? n : QThread::idealThreadCount() );
+}
+
+int USAcquisitionExporter::GetNumberOfConverterThreads() { return m_converters->maxThreadCount(); }
+
+void USAcquisitionExporter::run()
+{
+    while( true )
+    {
+        m_mutex.lock();
+        while( !m_quit && m_pendingJobs.empty() ) m_jobsAvailable.wait( &m_mutex );
+        if( m_pendingJobs.empty() )
+        {
+            m_mutex.unlock();
+            return;
+        }
+        m_currentJob = m_pendingJobs.front();
+        m_pendingJobs.pop_front();
+        JobPointer job = m_currentJob;
+        m_mutex.unlock();
+
+        emit ExportStarted( job->id, job->acquisitionId, (int)job->frames.size() );
+        bool success = !job->cancelled && this->ExportFrames( *job );
+
+        m_mutex.lock();
+        m_currentJob = nullptr;
+        m_jobFinished.wakeAll();
+        m_mutex.unlock();
+
+        emit ExportFinished( job->id, job->acquisitionId, success, job->cancelled );
+    }
+}
+
+bool USAcquisitionExporter::ExportFrames( Job & job )
+{
+    const int numberOfFrames = (int)job.frames.size();
+    if( numberOfFrames == 0 ) return true;
+
+    ConvertedFrameQueue convertedFrames( m_queueCapacity );
+    std::atomic<int> nextFrame( 0 );
+    auto convertFrames = [&job, &convertedFrames, &nextFrame, numberOfFrames]()
+    {
+        FrameConverter converter( job );
+        for( int i = nextFrame++; i < numberOfFrames && !job.cancelled; i = nextFrame++ )
+        {
+            ConvertedFrameQueue::Item item;
+            converter.Convert( i, item );
+            if( !convertedFrames.Push( item ) ) return;
+        }
+        // Wake up the writer if it waits for frames that will not be converted
+        if( job.cancelled ) convertedFrames.Abort();
+    };
+    int numberOfConverters = std::min( m_converters->maxThreadCount(), numberOfFrames );
+    for( int c = 0; c < numberOfConverters; ++c ) m_converters->start( convertFrames );
+
+    // Frames are written in the order they are converted, the file name only depends on the frame index
+    itk::ImageFileWriter<IbisItkUnsignedChar3ImageType>::Pointer grayWriter =
+        itk::ImageFileWriter<IbisItkUnsignedChar3ImageType>::New();
+    itk::ImageFileWriter<IbisRGBImageType>::Pointer rgbWriter = itk::ImageFileWriter<IbisRGBImageType>::New();
+    bool success                                             = true;
+    int numberOfFramesWritten                                = 0;
+    while( numberOfFramesWritten < numberOfFrames )
+    {
+        ConvertedFrameQueue::Item item;
+        if( job.cancelled || !convertedFrames.Pop( item ) )
+        {
+            success = false;
+            break;
+        }
+
+        QString fileName = QString( "%1.%2.mnc" ).arg( job.fileNamePrefix ).arg( item.index + 1, 5, 10, QChar( '0' ) );
+        bool written     = item.grayImage
+                               ? WriteFrame<IbisItkUnsignedChar3ImageType>( grayWriter, item.grayImage, fileName )
+                               : WriteFrame<IbisRGBImageType>( rgbWriter, item.rgbImage, fileName );
+        if( !written )
+        {
+            success = false;
+            break;
+        }
+        emit ExportProgress( job.id, ++numberOfFramesWritten, numberOfFrames );
+    }
+
+    convertedFrames.Abort();
+    m_converters->waitForDone();
+    return success;
+}
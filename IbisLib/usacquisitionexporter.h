@@ -0,0 +1,116 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef USACQUISITIONEXPORTER_H
+#define USACQUISITIONEXPORTER_H
+
+#include <vtkSmartPointer.h>
+
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class QThreadPool;
+class vtkImageData;
+class vtkImageStencilData;
+
+/**
+ * @class   USAcquisitionExporter
+ * @brief   Writes US acquisitions to MINC files in the background
+ *
+ * Exports are queued and processed one after the other, so an export requested while the scene is being saved
+ * starts when the acquisitions of the scene are written. For each export, the frames are converted and masked in
+ * parallel by a pool of threads and handed through a bounded queue to this thread, which writes the files.
+ *
+ * A job holds shallow copies of the frames of the acquisition: the acquisition must not modify its frames before
+ * its exports are finished, see IsExporting(). Progress is reported with signals emitted from the exporter
+ * thread.
+ *
+ * @sa USAcquisitionObject
+ */
+class USAcquisitionExporter : public QThread
+{
+    Q_OBJECT
+
+public:
+    struct Frame
+    {
+        vtkSmartPointer<vtkImageData> image;
+        double matrix[16];  // row major, world or relative-to matrix of the frame
+        double timestamp;
+    };
+
+    struct Job
+    {
+        Job() : id( -1 ), acquisitionId( -1 ), useCalibratedTransform( false ), cancelled( false ) {}
+        int id;
+        int acquisitionId;
+        /** Frame i is written to fileNamePrefix.<i + 1 on 5 digits>.mnc */
+        QString fileNamePrefix;
+        /** Calibration matrix written in the acquisition:calibratioMatrix attribute of the frames */
+        QString calibrationMatrix;
+        bool useCalibratedTransform;
+        /** Stencil applied to the frames, nullptr to export the frames unmasked */
+        vtkSmartPointer<vtkImageStencilData> mask;
+        std::vector<Frame> frames;
+        std::atomic<bool> cancelled;
+    };
+    typedef std::shared_ptr<Job> JobPointer;
+
+    USAcquisitionExporter( QObject * parent = nullptr );
+    /** Finish the exports still queued */
+    ~USAcquisitionExporter();
+
+    /** Queue job for export, return its id. */
+    int Enqueue( JobPointer job );
+    /** Stop export jobId, the frames already written are left on disk. */
+    void Cancel( int jobId );
+    /** Return true if exports of acquisitionId are queued or running. */
+    bool IsExporting( int acquisitionId );
+    /** Block until the exports of acquisitionId are finished. */
+    void WaitForExports( int acquisitionId );
+
+    /** Number of threads converting the frames, the ideal number of threads by default. */
+    void SetNumberOfConverterThreads( int n );
+    int GetNumberOfConverterThreads();
+    /** Maximum number of converted frames waiting to be written. */
+    void SetQueueCapacity( int capacity ) { m_queueCapacity = capacity > 0 ? capacity : 1; }
+    int GetQueueCapacity() { return m_queueCapacity; }
+
+signals:
+
+    void ExportStarted( int jobId, int acquisitionId, int numberOfFrames );
+    void ExportProgress( int jobId, int numberOfFramesWritten, int numberOfFrames );
+    void ExportFinished( int jobId, int acquisitionId, bool success, bool cancelled );
+
+protected:
+    void run() override;
+    bool ExportFrames( Job & job );
+    bool HasJobs( int acquisitionId );
+
+    QThreadPool * m_converters;
+    int m_queueCapacity;
+
+    // Shared with the exporter thread
+    QMutex m_mutex;
+    QWaitCondition m_jobsAvailable;
+    QWaitCondition m_jobFinished;
+    std::deque<JobPointer> m_pendingJobs;
+    JobPointer m_currentJob;
+    int m_nextJobId;
+    bool m_quit;
+};
+
+#endif
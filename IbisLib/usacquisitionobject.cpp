@@ -23,6 +23,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vtkImageProperty.h>
 #include <vtkImageShiftScale.h>
 #include <vtkImageStencil.h>
+#include <vtkImageStencilData.h>
 #include <vtkImageToImageStencil.h>
 #include <vtkLookupTable.h>
 #include <vtkMath.h>
@@ -39,6 +40,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QMessageBox>
 #include <QProgressDialog>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include "application.h"
@@ -48,6 +50,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "lookuptablemanager.h"
 #include "serializerhelper.h"
 #include "trackedvideobuffer.h"
+#include "usacquisitionexporter.h"
 #include "usacquisitionsettingswidget.h"
 #include "usmask.h"
 #include "usmasksettingswidget.h"
@@ -64,8 +67,9 @@ USAcquisitionObject::USAcquisitionObject()
 
     m_videoBuffer = new TrackedVideoBuffer( m_defaultImageSize[0], m_defaultImageSize[1] );
 
-    m_isRecording   = false;
-    m_baseDirectory = QDir::homePath() + "/" + IBIS_CONFIGURATION_SUBDIRECTORY + "/" + ACQ_BASE_DIR;
+    m_isRecording           = false;
+    m_numberOfDroppedFrames = 0;
+    m_baseDirectory         = QDir::homePath() + "/" + IBIS_CONFIGURATION_SUBDIRECTORY + "/" + ACQ_BASE_DIR;
 
     m_usDepth         = "9cm";
     m_acquisitionType = UsProbeObject::ACQ_B_MODE;
@@ -75,6 +79,7 @@ USAcquisitionObject::USAcquisitionObject()
     m_sliceTransform       = vtkSmartPointer<vtkTransform>::New();
     m_sliceTransform->Concatenate( this->GetWorldTransform() );
     m_currentImageTransform = vtkSmartPointer<vtkTransform>::New();
+    m_probeFrameMatrix      = vtkSmartPointer<vtkMatrix4x4>::New();
     m_sliceTransform->Concatenate( m_currentImageTransform );
     m_sliceTransform->Concatenate( m_calibrationTransform );
     m_sliceProperties = vtkSmartPointer<vtkImageProperty>::New();
@@ -133,6 +138,13 @@ USAcquisitionObject::~USAcquisitionObject()
 {
     disconnect( this );
 
+    // The exports share the frames of the video buffer
+    this->WaitForExports();
+    foreach( QPointer<QProgressDialog> progress, m_exportProgressDialogs )
+    {
+        if( progress ) progress->close();
+    }
+
     m_mask->Delete();
     ClearStaticSlicesData();
 
@@ -307,18 +319,27 @@ void USAcquisitionObject::ShowStaticSlices( PerViewElements & perView )
 void USAcquisitionObject::Record()
 {
     Q_ASSERT( !m_isRecording );
-    m_isRecording = true;
+    // A ring buffer would overwrite the frames being exported
+    if( this->IsExporting() )
+    {
+        QMessageBox::warning( 0, tr( "Error: " ), tr( "Can't record while the acquisition is being exported." ),
+                              QMessageBox::Ok );
+        return;
+    }
+    m_isRecording           = true;
+    m_numberOfDroppedFrames = 0;
 
-    // Add the frame that was last captured by the system
+    // Add the frame that was last captured by the system, once the frame size and the mask are known
     UsProbeObject * probe = UsProbeObject::SafeDownCast( GetManager()->GetObjectByID( m_usProbeObjectId ) );
     Q_ASSERT( probe );
     if( probe->IsOk() )
     {
         int * dims = probe->GetVideoOutput()->GetDimensions();
         this->SetFrameAndMaskSize( dims[0], dims[1] );
-        m_videoBuffer->AddFrame( probe->GetVideoOutput(), probe->GetUncalibratedWorldTransform()->GetMatrix(),
-                                 probe->GetLastTimestamp() );
+        this->ReserveRecordingBuffer( probe->GetVideoOutput() );
     }
+    emit RecordingStarted();
+    if( probe->IsOk() ) this->AddProbeFrame( probe );
 
     // Start watching the clock for updates
     connect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( Updated() ) );
@@ -329,9 +350,61 @@ void USAcquisitionObject::Record()
     emit ObjectModified();
 }
 
+void USAcquisitionObject::ReserveRecordingBuffer( vtkImageData * frame )
+{
+    // Reserve storage for the whole sweep up front so that no allocation happens on clock ticks while recording
+    if( m_videoBuffer->GetNumberOfFrames() > 0 ) return;
+    ApplicationSettings * settings = Application::GetInstance().GetSettings();
+    if( settings->USRecordingBufferSize <= 0 ) return;
+    int * dims = frame->GetDimensions();
+    TrackedVideoBuffer::StorageMode mode =
+        settings->USRecordingBufferIsRing ? TrackedVideoBuffer::RingStorage : TrackedVideoBuffer::ChunkedStorage;
+    if( !m_videoBuffer->ReserveFrames( settings->USRecordingBufferSize, dims[0], dims[1],
+                                       frame->GetNumberOfScalarComponents(), frame->GetScalarType(), mode ) )
+        std::cerr << "Could not reserve US recording buffer, frames will be allocated one by one." << std::endl;
+}
+
+bool USAcquisitionObject::AddProbeFrame( UsProbeObject * probe )
+{
+    // Pair the frame with the pose of the probe when it was captured rather than with the last pose received.
+    // The frame is rejected if the probe was not tracked correctly at that time.
+    vtkMatrix4x4 * matrix = probe->GetUncalibratedWorldTransform()->GetMatrix();
+    double timestamp      = probe->GetLastTimestamp();
+    double videoTimestamp = probe->GetVideoTimestamp();
+    if( videoTimestamp >= 0.0 )
+    {
+        PoseHistory::PoseStatus status = probe->GetUncalibratedWorldMatrixAt( videoTimestamp, m_probeFrameMatrix );
+        if( status == PoseHistory::InvalidPose ) return false;
+        if( status == PoseHistory::ValidPose )
+        {
+            matrix    = m_probeFrameMatrix;
+            timestamp = videoTimestamp;
+        }
+    }
+    if( !m_videoBuffer->AddFrame( probe->GetVideoOutput(), matrix, timestamp ) )
+    {
+        // Report the first frame dropped, Stop() reports how many were dropped during the recording
+        if( m_numberOfDroppedFrames++ == 0 )
+        {
+            if( !m_videoBuffer->IsFrameFormatCompatible( probe->GetVideoOutput() ) )
+                std::cerr << "US frame size or format changed while recording, frames are dropped." << std::endl;
+            else
+                std::cerr << "Could not store US frame, frames are dropped." << std::endl;
+        }
+        return false;
+    }
+    emit FrameAdded( m_videoBuffer->GetNumberOfFrames() - 1 );
+    return true;
+}
+
 bool USAcquisitionObject::AddFrame( vtkImageData * image, vtkMatrix4x4 * mat, double timestamp )
 {
     if( m_isRecording ) return false;
+    if( this->IsExporting() )
+    {
+        std::cerr << "Can't add frames while the acquisition is being exported." << std::endl;
+        return false;
+    }
 
     // check if frame dimensions match
     int * dims = image->GetDimensions();
@@ -345,7 +418,28 @@ bool USAcquisitionObject::AddFrame( vtkImageData * image, vtkMatrix4x4 * mat, do
     }
 
     // Add the frame
-    m_videoBuffer->AddFrame( image, mat, timestamp );
+    if( !m_videoBuffer->AddFrame( image, mat, timestamp ) ) return false;
+
+    emit FrameAdded( m_videoBuffer->GetNumberOfFrames() - 1 );
+    emit ObjectModified();
+    return true;
+}
+
+bool USAcquisitionObject::MapFileFrames( QString filename, const int format[4],
+                                         const std::vector<qint64> & frameOffsets,
+                                         const std::vector<double> & matrixElements,
+                                         const std::vector<double> & timestamps )
+{
+    if( m_isRecording ) return false;
+    if( this->IsExporting() )
+    {
+        std::cerr << "Can't replace the frames while the acquisition is being exported." << std::endl;
+        return false;
+    }
+
+    if( !m_videoBuffer->MapFileFrames( filename, format, frameOffsets, matrixElements, timestamps ) ) return false;
+    m_componentsNumber = format[2];
+    this->SetFrameAndMaskSize( format[0], format[1] );
 
     emit ObjectModified();
     return true;
@@ -357,10 +451,8 @@ void USAcquisitionObject::Updated()
     {
         UsProbeObject * probe = UsProbeObject::SafeDownCast( GetManager()->GetObjectByID( m_usProbeObjectId ) );
         Q_ASSERT( probe );
-        if( probe->IsOk() )
+        if( probe->IsOk() && this->AddProbeFrame( probe ) )
         {
-            m_videoBuffer->AddFrame( probe->GetVideoOutput(), probe->GetUncalibratedWorldTransform()->GetMatrix(),
-                                     probe->GetLastTimestamp() );
             emit ObjectModified();
         }
     }
@@ -385,6 +477,9 @@ void USAcquisitionObject::Stop()
     {
         m_isRecording = false;
         disconnect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( Updated() ) );
+        if( m_numberOfDroppedFrames > 0 )
+            std::cerr << m_numberOfDroppedFrames << " US frames were dropped while recording." << std::endl;
+        emit RecordingStopped();
     }
 }
 
@@ -398,6 +493,12 @@ void USAcquisitionObject::SetCurrentFrame( int frameIndex )
 
 void USAcquisitionObject::Clear()
 {
+    if( this->IsExporting() )
+    {
+        QMessageBox::warning( 0, tr( "Error: " ), tr( "Can't clear the acquisition while it is being exported." ),
+                              QMessageBox::Ok );
+        return;
+    }
     m_videoBuffer->Clear();
     emit ObjectModified();
 }
@@ -581,7 +682,81 @@ void USAcquisitionObject::ClearStaticSlicesData()
     m_staticSlicesData.clear();
 }
 
-void USAcquisitionObject::Save() { this->ExportTrackedVideoBuffer(); }
+// Scenes keep the frames in a packed file that is mapped when the scene is loaded, Export() writes MINC files
+void USAcquisitionObject::Save() { this->SavePackedFile(); }
+
+bool USAcquisitionObject::SavePackedFile()
+{
+    Q_ASSERT( GetManager() );
+
+    QString baseDirName = this->GetManager()->GetSceneDirectory();
+    baseDirName.append( '/' );
+    baseDirName.append( m_baseDirectory.section( '/', -1 ) );
+    QString baseFileName = QString::number( this->GetObjectID() );
+    QString subDirName   = baseDirName + "/" + baseFileName;
+    if( !QDir().mkpath( subDirName ) )
+    {
+        QString accessError = tr( "Can't create directory:\n" ) + subDirName;
+        QMessageBox::warning( 0, tr( "Error: " ), accessError, QMessageBox::Ok );
+        return false;
+    }
+    QString packedFileName = subDirName + "/" + baseFileName + "." + ACQ_PACKED_FILE_SUFFIX;
+    if( !m_videoBuffer->WritePackedFile( packedFileName, m_calibrationTransform->GetMatrix(),
+                                         m_useCalibratedTransform ) )
+    {
+        QString accessError = tr( "Can't write acquisition frames to " ) + packedFileName;
+        QMessageBox::warning( 0, tr( "Error: " ), accessError, QMessageBox::Ok );
+        return false;
+    }
+    return true;
+}
+
+bool USAcquisitionObject::LoadPackedFile( QString filename )
+{
+    // The calibration matrix of the file is only used when converting MINC directories, it is in the scene
+    bool calibratedTransformApplied = false;
+    if( !m_videoBuffer->MapPackedFile( filename, nullptr, &calibratedTransformApplied ) )
+    {
+        QString accessError = tr( "Can't read acquisition frames from " ) + filename;
+        QMessageBox::warning( 0, tr( "Error: " ), accessError, QMessageBox::Ok );
+        return false;
+    }
+    m_useCalibratedTransform = calibratedTransformApplied;
+    m_componentsNumber       = m_videoBuffer->GetFrameNumberOfComponents();
+    return true;
+}
+
+QString USAcquisitionObject::PackMINCDirectory( QString directory )
+{
+    QDir dir( directory );
+    QStringList allMINCFiles = dir.entryList( QStringList( "*.mnc" ), QDir::Files, QDir::Name );
+    if( allMINCFiles.isEmpty() ) return QString();
+    QStringList allMincPaths;
+    for( int i = 0; i < allMINCFiles.size(); ++i ) allMincPaths.push_back( dir.absoluteFilePath( allMINCFiles[i] ) );
+
+    vtkSmartPointer<USAcquisitionObject> acquisition = vtkSmartPointer<USAcquisitionObject>::New();
+    if( !acquisition->LoadFramesFromMINCFile( allMincPaths ) ) return QString();
+
+    // look for calibration transform, as in Import()
+    vtkSmartPointer<vtkMatrix4x4> calibrationMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
+    QString calibrationTransformFileName            = dir.absoluteFilePath( "calibrationTransform.xfm" );
+    if( QFile::exists( calibrationTransformFileName ) )
+    {
+        vtkSmartPointer<vtkXFMReader> reader = vtkSmartPointer<vtkXFMReader>::New();
+        if( reader->CanReadFile( calibrationTransformFileName.toUtf8() ) )
+        {
+            reader->SetFileName( calibrationTransformFileName.toUtf8() );
+            reader->SetMatrix( calibrationMatrix );
+            reader->Update();
+        }
+    }
+
+    QString packedFileName = dir.absoluteFilePath( dir.dirName() + "." + ACQ_PACKED_FILE_SUFFIX );
+    if( !acquisition->m_videoBuffer->WritePackedFile( packedFileName, calibrationMatrix,
+                                                      acquisition->m_useCalibratedTransform ) )
+        return QString();
+    return packedFileName;
+}
 
 bool USAcquisitionObject::LoadFramesFromMINCFile( QStringList & allMINCFiles )
 {
@@ -763,6 +938,9 @@ bool USAcquisitionObject::LoadFramesFromMINCFile( Serializer * ser )
         QMessageBox::warning( 0, tr( "Error: " ), accessError, QMessageBox::Ok );
         return false;
     }
+    // Scenes saved since frames are packed have a single file, older scenes one MINC file per frame
+    QString packedFileName = subDirName + "/" + baseFileName + "." + ACQ_PACKED_FILE_SUFFIX;
+    if( QFile::exists( packedFileName ) ) return this->LoadPackedFile( packedFileName );
     QDir dir( subDirName );
     QStringList allMINCFiles = dir.entryList( QStringList( "*.mnc" ), QDir::Files, QDir::Name );
     if( allMINCFiles.isEmpty() )
@@ -797,17 +975,22 @@ void USAcquisitionObject::Serialize( Serializer * ser )
         currentSlice        = this->GetCurrentSlice();
         currentSliceOpacity = m_sliceProperties->GetOpacity();
         staticSlicesOpacity = m_staticSlicesProperties->GetOpacity();
-        QString relPath( "./" );
-        relPath.append( m_baseDirectory.section( '/', -1 ) );
-        this->SetBaseDirectory( relPath );
-        this->Save();
+        if( !ser->GetArchive() )
+        {
+            QString relPath( "./" );
+            relPath.append( m_baseDirectory.section( '/', -1 ) );
+            this->SetBaseDirectory( relPath );
+            this->Save();
+        }
     }
 
-    ::Serialize( ser, "BaseDirectory", m_baseDirectory );
+    // In a scene archive, frames are stored in a chunk of the archive instead of one MINC file per frame
+    if( !ser->GetArchive() ) ::Serialize( ser, "BaseDirectory", m_baseDirectory );
     if( ser->IsReader() )
     {
-        if( m_baseDirectory.at( 0 ) == '.' ) m_baseDirectory.replace( 0, 1, ser->GetSerializationDirectory() );
-        if( !QDir( m_baseDirectory ).exists() )
+        if( !ser->GetArchive() && m_baseDirectory.at( 0 ) == '.' )
+            m_baseDirectory.replace( 0, 1, ser->GetSerializationDirectory() );
+        if( !ser->GetArchive() && !QDir( m_baseDirectory ).exists() )
         {
             QString accessError = tr( "Cannot find acquisition directory: " ) + m_baseDirectory;
             QMessageBox::warning( 0, tr( "Error: " ), accessError, QMessageBox::Ok );
@@ -832,6 +1015,14 @@ void USAcquisitionObject::Serialize( Serializer * ser )
     ::Serialize( ser, "IsMaskOn", m_isMaskOn );
     ::Serialize( ser, "Mask", m_mask );
 
+    bool framesLoaded = false;
+    if( ser->GetArchive() )
+    {
+        ::Serialize( ser, "ComponentsNumber", m_componentsNumber );
+        ::Serialize( ser, "UseCalibratedTransform", m_useCalibratedTransform );
+        framesLoaded = m_videoBuffer->Serialize( ser, ser->GetArchive(), GetSceneArchiveChunkName( "frames" ) );
+    }
+
     if( ser->IsReader() )
     {
         m_acquisitionType = (UsProbeObject::ACQ_TYPE)acquisitionType;
@@ -840,7 +1031,8 @@ void USAcquisitionObject::Serialize( Serializer * ser )
         m_sliceProperties->SetOpacity( currentSliceOpacity );
         m_staticSlicesProperties->SetOpacity( staticSlicesOpacity );
 
-        if( this->LoadFramesFromMINCFile( ser ) ) SetCurrentFrame( currentSlice );
+        if( !ser->GetArchive() ) framesLoaded = this->LoadFramesFromMINCFile( ser );
+        if( framesLoaded && currentSlice < m_videoBuffer->GetNumberOfFrames() ) SetCurrentFrame( currentSlice );
         this->UpdateMask();
     }
 }
@@ -880,6 +1072,30 @@ void USAcquisitionObject::GetFrameData( int index, vtkImageData * slice, vtkMatr
     slice->DeepCopy( m_videoBuffer->GetImage( index ) );
 }
 
+vtkMatrix4x4 * USAcquisitionObject::GetRelativeToMatrix( int relativeToObjectID )
+{
+    if( relativeToObjectID == SceneManager::InvalidId ) return nullptr;
+    SceneObject * relativeTo = this->GetManager()->GetObjectByID( relativeToObjectID );
+    Q_ASSERT( relativeTo );
+    return relativeTo->GetWorldTransform()->GetLinearInverse()->GetMatrix();
+}
+
+void USAcquisitionObject::GetExportFrameMatrix( int frameNo, bool useCalibratedTransform,
+                                                vtkMatrix4x4 * relativeToMatrix, vtkMatrix4x4 * frameMatrix )
+{
+    vtkSmartPointer<vtkMatrix4x4> calibratedFrameMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
+    vtkMatrix4x4 * matrix                               = m_videoBuffer->GetMatrix( frameNo );
+    if( useCalibratedTransform )
+    {
+        vtkMatrix4x4::Multiply4x4( matrix, m_calibrationTransform->GetMatrix(), calibratedFrameMatrix );
+        matrix = calibratedFrameMatrix;
+    }
+    if( relativeToMatrix )
+        vtkMatrix4x4::Multiply4x4( relativeToMatrix, matrix, frameMatrix );
+    else
+        frameMatrix->DeepCopy( matrix );
+}
+
 void USAcquisitionObject::GetItkImage( IbisItkUnsignedChar3ImageType::Pointer itkOutputImage, int frameNo, bool masked,
                                        bool useCalibratedTransform, int relativeToObjectID )
 {
@@ -888,38 +1104,8 @@ void USAcquisitionObject::GetItkImage( IbisItkUnsignedChar3ImageType::Pointer it
 
     // prepare transform
     vtkSmartPointer<vtkMatrix4x4> frameMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
-    frameMatrix->Identity();
-    vtkSmartPointer<vtkMatrix4x4> calibratedFrameMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
-    calibratedFrameMatrix->Identity();
-    vtkMatrix4x4::Multiply4x4( m_videoBuffer->GetMatrix( frameNo ), m_calibrationTransform->GetMatrix(),
-                               calibratedFrameMatrix );
-
-    vtkMatrix4x4 * relativeToMatrix = 0;
-    if( relativeToObjectID != SceneManager::InvalidId )
-    {
-        SceneObject * relativeTo = this->GetManager()->GetObjectByID( relativeToObjectID );
-        Q_ASSERT( relativeTo );
-        relativeToMatrix = relativeTo->GetWorldTransform()->GetLinearInverse()->GetMatrix();
-    }
-
-    if( relativeToMatrix )
-    {
-        if( useCalibratedTransform )
-        {
-            vtkMatrix4x4::Multiply4x4( relativeToMatrix, calibratedFrameMatrix, frameMatrix );
-        }
-        else
-            vtkMatrix4x4::Multiply4x4( relativeToMatrix, m_videoBuffer->GetMatrix( frameNo ), frameMatrix );
-    }
-    else
-    {
-        if( useCalibratedTransform )
-        {
-            frameMatrix->DeepCopy( calibratedFrameMatrix );
-        }
-        else
-            frameMatrix->DeepCopy( m_videoBuffer->GetMatrix( frameNo ) );
-    }
+    this->GetExportFrameMatrix( frameNo, useCalibratedTransform, this->GetRelativeToMatrix( relativeToObjectID ),
+                                frameMatrix );
 
     // prepare image
     vtkImageData * initialImage                        = m_videoBuffer->GetImage( frameNo );
@@ -971,36 +1157,8 @@ void USAcquisitionObject::GetItkRGBImage( IbisRGBImageType::Pointer itkOutputIma
 
     // prepare transform
     vtkSmartPointer<vtkMatrix4x4> frameMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
-    frameMatrix->Identity();
-    vtkSmartPointer<vtkMatrix4x4> calibratedFrameMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
-    calibratedFrameMatrix->Identity();
-    vtkMatrix4x4::Multiply4x4( m_videoBuffer->GetMatrix( frameNo ), m_calibrationTransform->GetMatrix(),
-                               calibratedFrameMatrix );
-    vtkMatrix4x4 * relativeToMatrix = 0;
-    if( relativeToObjectID != SceneManager::InvalidId )
-    {
-        SceneObject * relativeTo = this->GetManager()->GetObjectByID( relativeToObjectID );
-        Q_ASSERT( relativeTo );
-        relativeToMatrix = relativeTo->GetWorldTransform()->GetLinearInverse()->GetMatrix();
-    }
-    if( relativeToMatrix )
-    {
-        if( useCalibratedTransform )
-        {
-            vtkMatrix4x4::Multiply4x4( relativeToMatrix, calibratedFrameMatrix, frameMatrix );
-        }
-        else
-            vtkMatrix4x4::Multiply4x4( relativeToMatrix, m_videoBuffer->GetMatrix( frameNo ), frameMatrix );
-    }
-    else
-    {
-        if( useCalibratedTransform )
-        {
-            frameMatrix->DeepCopy( calibratedFrameMatrix );
-        }
-        else
-            frameMatrix->DeepCopy( m_videoBuffer->GetMatrix( frameNo ) );
-    }
+    this->GetExportFrameMatrix( frameNo, useCalibratedTransform, this->GetRelativeToMatrix( relativeToObjectID ),
+                                frameMatrix );
 
     // prepare image
     vtkImageData * image                          = m_videoBuffer->GetImage( frameNo );
@@ -1020,8 +1178,6 @@ void USAcquisitionObject::GetItkRGBImage( IbisRGBImageType::Pointer itkOutputIma
     converter->ConvertVtkImageToItkImage( itkOutputImage, imageToConvert, frameMatrix );
 }
 
-#include <itkImageFileWriter.h>
-
 void USAcquisitionObject::Export()
 {
     ExportParams params;
@@ -1039,6 +1195,14 @@ void USAcquisitionObject::ExportTrackedVideoBuffer( QString destDir, bool masked
 {
     Q_ASSERT( GetManager() );
 
+    // A previous export of the acquisition may still be writing to the directory
+    if( this->IsExporting() )
+    {
+        QMessageBox::warning( 0, tr( "Error: " ), tr( "A previous export of the acquisition is still in progress." ),
+                              QMessageBox::Ok );
+        return;
+    }
+
     // have to provide for vtkImage only
     int numberOfFrames = m_videoBuffer->GetNumberOfFrames();
     // we have to take copy of current settings and change base directory
@@ -1091,9 +1255,6 @@ void USAcquisitionObject::ExportTrackedVideoBuffer( QString destDir, bool masked
         QMessageBox::warning( 0, tr( "Error: " ), accessError, QMessageBox::Ok );
         return;
     }
-    bool processOK             = false;
-    QProgressDialog * progress = new QProgressDialog( "Exporting frames", "Cancel", 0, numberOfFrames );
-    progress->setAttribute( Qt::WA_DeleteOnClose, true );
     // Prepare for writing out calibration matrix
     vtkMatrix4x4 * calMatrix = this->GetCalibrationTransform()->GetMatrix();
     QString calMatString;
@@ -1109,122 +1270,42 @@ void USAcquisitionObject::ExportTrackedVideoBuffer( QString destDir, bool masked
 
     if( numberOfFrames > 0 )
     {
-        int backupCurrentFrame = this->GetCurrentSlice();
-        progress->show();
-        processOK = true;
-
-        int sequenceNumber = 0;  // make sure to number output files sequentially
-        int nbComp         = m_videoBuffer->GetFrameNumberOfComponents();
-        if( nbComp == 1 )
+        // Capture the frames, their matrices and the mask now, they are converted and written by the exporter
+        USAcquisitionExporter::JobPointer job = std::make_shared<USAcquisitionExporter::Job>();
+        job->acquisitionId                    = this->GetObjectID();
+        job->fileNamePrefix                   = partFileName;
+        job->calibrationMatrix                = calMatString;
+        job->useCalibratedTransform           = useCalibratedTransform;
+        if( masked )
         {
-            itk::ImageFileWriter<IbisItkUnsignedChar3ImageType>::Pointer mincWriter =
-                itk::ImageFileWriter<IbisItkUnsignedChar3ImageType>::New();
-            for( int i = 0; i < numberOfFrames && processOK; i++ )
-            {
-                QString Number( QString::number( ++sequenceNumber ) );
-                int numLength = Number.length();
-                QString numberedFileName( partFileName );
-                numberedFileName += '.';
-                for( int j = 0; j < 5 - numLength; j++ )
-                {
-                    numberedFileName += "0";
-                }
-
-                numberedFileName += Number;
-                numberedFileName += ".mnc";
-                mincWriter->SetFileName( numberedFileName.toUtf8().data() );
-
-                IbisItkUnsignedChar3ImageType::Pointer itkSliceImage = IbisItkUnsignedChar3ImageType::New();
-                this->GetItkImage( itkSliceImage, i, masked, useCalibratedTransform, relativeToID );
-                // Output acquisition properties: time stamp, calibration matrix, frame ID, flag telling idf the
-                // calibration matrix was applied
-                double timestamp                   = m_videoBuffer->GetTimestamp( i );
-                itk::MetaDataDictionary & metaDict = itkSliceImage->GetMetaDataDictionary();
-                itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:calibratioMatrix",
-                                                       calMatString.toUtf8().data() );
-                itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:calibratioMatrixApplied",
-                                                       useCalibratedTransform ? "1" : "0" );
-                itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:timestamp",
-                                                       QString::number( timestamp, 'f', 6 ).toUtf8().data() );
-                itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:frameID",
-                                                       QString::number( sequenceNumber - 1 ).toUtf8().data() );
-                mincWriter->SetInput( itkSliceImage );
-                try
-                {
-                    mincWriter->Update();
-                }
-                catch( itk::ExceptionObject & exp )
-                {
-                    std::cerr << "Exception caught!" << std::endl;
-                    std::cerr << exp << std::endl;
-                    processOK = false;
-                    break;
-                }
-                progress->setValue( i );
-                qApp->processEvents();
-                if( progress->wasCanceled() )
-                {
-                    QMessageBox::information( 0, tr( "Exporting frames" ), tr( "Process cancelled" ), QMessageBox::Ok );
-                    processOK = false;
-                }
-            }
+            m_imageStencilSource->Update();
+            job->mask = vtkSmartPointer<vtkImageStencilData>::New();
+            job->mask->DeepCopy( m_imageStencilSource->GetOutput() );
         }
-        else
+        vtkMatrix4x4 * relativeToMatrix           = this->GetRelativeToMatrix( relativeToID );
+        vtkSmartPointer<vtkMatrix4x4> frameMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
+        job->frames.resize( numberOfFrames );
+        for( int i = 0; i < numberOfFrames; i++ )
         {
-            itk::ImageFileWriter<IbisRGBImageType>::Pointer mincWriter = itk::ImageFileWriter<IbisRGBImageType>::New();
-            for( int i = 0; i < numberOfFrames && processOK; i++ )
-            {
-                QString Number( QString::number( ++sequenceNumber ) );
-                int numLength = Number.length();
-                QString numberedFileName( partFileName );
-                numberedFileName += '.';
-                for( int j = 0; j < 5 - numLength; j++ )
-                {
-                    numberedFileName += "0";
-                }
-
-                numberedFileName += Number;
-                numberedFileName += ".mnc";
-                mincWriter->SetFileName( numberedFileName.toUtf8().data() );
-
-                IbisRGBImageType::Pointer itkSliceImage = IbisRGBImageType::New();
-                this->GetItkRGBImage( itkSliceImage, i, masked, useCalibratedTransform, relativeToID );
-                // Output acquisition properties: time stamp, calibration matrix, frame ID, flag telling idf the
-                // calibration matrix was applied
-                double timestamp                   = m_videoBuffer->GetTimestamp( i );
-                itk::MetaDataDictionary & metaDict = itkSliceImage->GetMetaDataDictionary();
-                itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:calibratioMatrix",
-                                                       calMatString.toUtf8().data() );
-                itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:calibratioMatrixApplied",
-                                                       useCalibratedTransform ? "1" : "0" );
-                itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:timestamp",
-                                                       QString::number( timestamp, 'g', 6 ).toUtf8().data() );
-                itk::EncapsulateMetaData<std::string>( metaDict, "acquisition:frameID",
-                                                       QString::number( sequenceNumber - 1 ).toUtf8().data() );
-                mincWriter->SetInput( itkSliceImage );
-
-                try
-                {
-                    mincWriter->Update();
-                }
-                catch( itk::ExceptionObject & exp )
-                {
-                    std::cerr << "Exception caught!" << std::endl;
-                    std::cerr << exp << std::endl;
-                    processOK = false;
-                    break;
-                }
-                progress->setValue( i );
-                qApp->processEvents();
-                if( progress->wasCanceled() )
-                {
-                    QMessageBox::information( 0, tr( "Exporting frames" ), tr( "Process cancelled" ), QMessageBox::Ok );
-                    processOK = false;
-                }
-            }
+            USAcquisitionExporter::Frame & frame = job->frames[i];
+            frame.image                          = vtkSmartPointer<vtkImageData>::New();
+            frame.image->ShallowCopy( m_videoBuffer->GetImage( i ) );
+            this->GetExportFrameMatrix( i, useCalibratedTransform, relativeToMatrix, frameMatrix );
+            vtkMatrix4x4::DeepCopy( frame.matrix, frameMatrix );
+            frame.timestamp = m_videoBuffer->GetTimestamp( i );
         }
-        progress->close();
-        this->SetCurrentFrame( backupCurrentFrame );
+
+        USAcquisitionExporter * exporter = Application::GetUSAcquisitionExporter();
+        connect( exporter, SIGNAL( ExportProgress( int, int, int ) ), this, SLOT( OnExportProgress( int, int, int ) ),
+                 Qt::UniqueConnection );
+        connect( exporter, SIGNAL( ExportFinished( int, int, bool, bool ) ), this,
+                 SLOT( OnExportFinished( int, int, bool, bool ) ), Qt::UniqueConnection );
+
+        QProgressDialog * progress = new QProgressDialog( tr( "Exporting frames" ), tr( "Cancel" ), 0, numberOfFrames );
+        progress->setAttribute( Qt::WA_DeleteOnClose, true );
+        connect( progress, SIGNAL( canceled() ), this, SLOT( CancelExport() ) );
+        m_exportProgressDialogs[exporter->Enqueue( job )] = progress;
+        progress->show();
     }
     if( !useCalibratedTransform )  // export calibration transform
     {
@@ -1236,7 +1317,41 @@ void USAcquisitionObject::ExportTrackedVideoBuffer( QString destDir, bool masked
         writer->Write();
         writer->Delete();
     }
-    if( !processOK ) QMessageBox::warning( 0, "Error: ", "Exporting frames failed.", QMessageBox::Ok );
+}
+
+bool USAcquisitionObject::IsExporting()
+{
+    USAcquisitionExporter * exporter = Application::GetUSAcquisitionExporter();
+    return exporter && exporter->IsExporting( this->GetObjectID() );
+}
+
+void USAcquisitionObject::WaitForExports()
+{
+    USAcquisitionExporter * exporter = Application::GetUSAcquisitionExporter();
+    if( exporter ) exporter->WaitForExports( this->GetObjectID() );
+}
+
+void USAcquisitionObject::OnExportProgress( int jobId, int numberOfFramesWritten, int numberOfFrames )
+{
+    QProgressDialog * progress = m_exportProgressDialogs.value( jobId );
+    if( progress ) progress->setValue( numberOfFramesWritten );
+}
+
+void USAcquisitionObject::OnExportFinished( int jobId, int acquisitionId, bool success, bool cancelled )
+{
+    if( !m_exportProgressDialogs.contains( jobId ) ) return;
+    QProgressDialog * progress = m_exportProgressDialogs.take( jobId );
+    if( progress ) progress->close();
+    if( cancelled )
+        QMessageBox::information( 0, tr( "Exporting frames" ), tr( "Process cancelled" ), QMessageBox::Ok );
+    else if( !success )
+        QMessageBox::warning( 0, "Error: ", "Exporting frames failed.", QMessageBox::Ok );
+}
+
+void USAcquisitionObject::CancelExport()
+{
+    int jobId = m_exportProgressDialogs.key( qobject_cast<QProgressDialog *>( sender() ), -1 );
+    if( jobId != -1 ) Application::GetUSAcquisitionExporter()->Cancel( jobId );
 }
 
 bool USAcquisitionObject::Import()
@@ -15,10 +15,13 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <stdio.h>
 
 #include <QList>
+#include <QMap>
 #include <QObject>
+#include <QPointer>
 #include <QString>
 #include <QVector>
 #include <QWidget>
+#include <vector>
 
 #include "imageobject.h"
 #include "scenemanager.h"
@@ -40,11 +43,13 @@ class vtkPiecewiseFunctionLookupTable;
 class USMask;
 class vtkImageConstantPad;
 class vtkPassThrough;
+class QProgressDialog;
 
 #define ACQ_COLOR_RGB "RGB"
 #define ACQ_COLOR_GRAYSCALE "Grayscale"
 #define ACQ_BASE_DIR "acquisitions"
 #define ACQ_ACQUISITION_PREFIX "acq"
+#define ACQ_PACKED_FILE_SUFFIX "uspack"
 
 struct ExportParams
 {
@@ -77,9 +82,18 @@ public:
     bool Import();
     void SetBaseDirectory( QString dir ) { m_baseDirectory = dir; }
     QString GetBaseDirectory() { return m_baseDirectory; }
+    // Queue the frames for export in the background, see USAcquisitionExporter
     void ExportTrackedVideoBuffer( QString destDir = "", bool masked = false, bool useCalibratedTransform = false,
                                    int relativeToID = SceneManager::InvalidId );
+    // The exports share the frames of the video buffer: recording, adding, mapping or clearing frames is refused
+    // while the acquisition is exporting
+    bool IsExporting();
+    // Block until the exports of the acquisition are written, only done when the acquisition is destroyed
+    void WaitForExports();
     bool LoadFramesFromMINCFile( Serializer * ser );
+    // Write the frames of a directory exported by ExportTrackedVideoBuffer to a packed file in the same directory,
+    // named as in saved scenes. Return the name of the packed file, empty on failure.
+    static QString PackMINCDirectory( QString directory );
 
     virtual void CreateSettingsWidgets( QWidget * parent, QVector<QWidget *> * widgets ) override;
     virtual void Setup( View * view ) override;
@@ -139,6 +153,9 @@ public:
     void Stop();
     void SetCurrentFrame( int frameIndex );
     bool AddFrame( vtkImageData *, vtkMatrix4x4 *, double );
+    // Use frames stored in a file instead of copying them, see TrackedVideoBuffer::MapFileFrames()
+    bool MapFileFrames( QString filename, const int format[4], const std::vector<qint64> & frameOffsets,
+                        const std::vector<double> & matrixElements, const std::vector<double> & timestamps );
 
     void Clear();
 
@@ -151,10 +168,21 @@ public:
     vtkAlgorithmOutput * GetMaskedOutputPort();
     vtkAlgorithmOutput * GetUnmaskedOutputPort();
 
+signals:
+
+    // Emitted every time a frame is added, while recording or with AddFrame.
+    void FrameAdded( int frameIndex );
+    // Emitted by Record() before the first frame is added
+    void RecordingStarted();
+    void RecordingStopped();
+
 private slots:
 
     void Updated();
     void UpdateMask();
+    void OnExportProgress( int jobId, int numberOfFramesWritten, int numberOfFrames );
+    void OnExportFinished( int jobId, int acquisitionId, bool success, bool cancelled );
+    void CancelExport();
 
 protected:
     virtual void Hide() override;
@@ -172,6 +200,10 @@ protected:
     // Images and matrices
     int m_defaultImageSize[2];
     TrackedVideoBuffer * m_videoBuffer;
+    void ReserveRecordingBuffer( vtkImageData * frame );
+    bool AddProbeFrame( UsProbeObject * probe );
+    vtkSmartPointer<vtkMatrix4x4> m_probeFrameMatrix;
+    int m_numberOfDroppedFrames;  // frames the buffer could not store during the current recording
 
     // Importing
     int m_componentsNumber;
@@ -180,6 +212,13 @@ protected:
     bool LoadGrayFrames( QStringList & allMINCFiles );
     bool LoadRGBFrames( QStringList & allMINCFiles );
     void AdjustFrame( vtkImageData * frame, vtkMatrix4x4 * inputMatrix, vtkMatrix4x4 * outputMatrix );
+    bool LoadPackedFile( QString filename );
+
+    // Exporting
+    vtkMatrix4x4 * GetRelativeToMatrix( int relativeToObjectID );
+    void GetExportFrameMatrix( int frameNo, bool useCalibratedTransform, vtkMatrix4x4 * relativeToMatrix,
+                               vtkMatrix4x4 * frameMatrix );
+    QMap<int, QPointer<QProgressDialog> > m_exportProgressDialogs;
 
     // 3D viewing data
     struct PerViewElements
@@ -238,6 +277,7 @@ protected:
     bool m_staticSlicesDataNeedUpdate;
 
     void Save();
+    bool SavePackedFile();
 };
 
 ObjectSerializationHeaderMacro( USAcquisitionObject );
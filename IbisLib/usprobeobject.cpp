@@ -81,7 +81,8 @@ UsProbeObject::UsProbeObject()
     m_currentCalibrationMatrixIndex = -1;
 
     // Input to the probe object
-    m_videoInput = vtkSmartPointer<vtkPassThrough>::New();
+    m_videoInput     = vtkSmartPointer<vtkPassThrough>::New();
+    m_videoTimestamp = -1.0;
 
     // Temporary input image
     vtkSmartPointer<vtkImageData> tempImage = vtkSmartPointer<vtkImageData>::New();
@@ -323,12 +324,14 @@ void UsProbeObject::CreateSettingsWidgets( QWidget * parent, QVector<QWidget *>
 void UsProbeObject::SetVideoInputConnection( vtkAlgorithmOutput * port )
 {
     m_videoInput->SetInputConnection( port );
+    m_videoTimestamp = -1.0;
     emit ObjectModified();
 }
 
-void UsProbeObject::SetVideoInputData( vtkImageData * image )
+void UsProbeObject::SetVideoInputData( vtkImageData * image, double timestamp )
 {
     m_videoInput->SetInputData( image );
+    m_videoTimestamp = timestamp;
     emit ObjectModified();
 }
 
@@ -56,7 +56,9 @@ public:
     virtual void CreateSettingsWidgets( QWidget * parent, QVector<QWidget *> * widgets ) override;
 
     void SetVideoInputConnection( vtkAlgorithmOutput * port );
-    void SetVideoInputData( vtkImageData * image );
+    // timestamp is the time the image was captured, -1 if unknown
+    void SetVideoInputData( vtkImageData * image, double timestamp = -1.0 );
+    double GetVideoTimestamp() { return m_videoTimestamp; }
     void UpdateVideoInput();
 
     int GetVideoImageWidth();
@@ -117,6 +119,7 @@ protected:
     unsigned int m_screenShotIndex;
 
     vtkSmartPointer<vtkPassThrough> m_videoInput;
+    double m_videoTimestamp;
     vtkSmartPointer<vtkPassThrough> m_actorInput;
     USMask * m_mask;
     USMask * m_defaultMask;
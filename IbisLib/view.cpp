@@ -24,7 +24,6 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vtkTransform.h>
 
 #include "SVL.h"
-#include "application.h"
 #include "imageobject.h"
 #include "scenemanager.h"
 #include "sceneobject.h"
@@ -73,15 +72,11 @@ View::View()
     m_rightButtonDown    = false;
     m_backupWindowParent = nullptr;
     CurrentController    = nullptr;
-
-    connect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( EnableRendering() ) );
 }
 
 View::~View()
 {
     if( this->Picker ) this->Picker->Delete();
-
-    disconnect( &Application::GetInstance(), SIGNAL( IbisClockTick() ), this, SLOT( EnableRendering() ) );
 }
 
 void View::Serialize( Serializer * ser )
@@ -352,6 +347,10 @@ void View::ProcessInteractionEvents( vtkObject * /*caller*/, unsigned long event
     if( this->Interactor->GetShiftKey() ) modifier |= ShiftModifier;
     if( this->Interactor->GetAltKey() ) modifier |= AltModifier;
 
+    // The view the user interacts with is rendered first
+    if( event != vtkCommand::MouseMoveEvent && this->Manager )
+        this->Manager->GetRenderScheduler()->SetActiveView( this );
+
     // Set Button State variables
     if( event == vtkCommand::LeftButtonPressEvent )
         m_leftButtonDown = true;
@@ -476,14 +475,12 @@ void View::SetViewAngle( double angle )
 
 void View::NotifyNeedRender()
 {
-    if( m_renderingEnabled )
-    {
+    if( this->Manager )
+        this->Manager->GetRenderScheduler()->RequestRender( this );
+    else
         this->DoVTKRender();
-    }
 }
 
-void View::EnableRendering() { this->SetRenderingEnabled( true ); }
-
 void View::ReferenceTransformChanged()
 {
     // We update transform only if it is a 2D view or if Manager says we follow 3D views as well
@@ -529,7 +526,6 @@ void View::DoVTKRender()
     if( this->Interactor )
     {
         this->Interactor->Render();
-        this->SetRenderingEnabled( false );
     }
 }
 
@@ -100,8 +100,9 @@ public:
      *  results in a Qt application. */
     void SetQtRenderWidget( QVTKRenderWidget * w );
 
-    /** Control rendering of the view */
+    /** Control rendering of the view. Render requests made while it is disabled are delayed until it is enabled. */
     void SetRenderingEnabled( bool b );
+    bool IsRenderingEnabled() { return m_renderingEnabled; }
 
     /** Get view interactor */
     vtkRenderWindowInteractor * GetInteractor();
@@ -166,11 +167,9 @@ public:
 
 public slots:
 
-    /** Notify the view that something it contains needs render. The view is then
-     *  going to emit a Modified event. */
+    /** Notify the view that something it contains needs render. The render is scheduled by the RenderScheduler of
+     *  the SceneManager, requests are coalesced and the view is rendered at most once per frame. */
     void NotifyNeedRender();
-    /** Set enable render to true to refresh rendering */
-    void EnableRendering();
     /** Update camera transform when the reference transform is modified. */
     void ReferenceTransformChanged();
 
@@ -190,6 +189,9 @@ private slots:
     void WindowStartsRendering();
 
 protected:
+    friend class RenderScheduler;
+
+    /** Render immediately, called by the RenderScheduler. */
     void DoVTKRender();
     void SetupAllObjects();
     void ReleaseAllObjects();
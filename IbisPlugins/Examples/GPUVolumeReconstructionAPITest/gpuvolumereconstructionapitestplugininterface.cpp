@@ -1,12 +1,16 @@
 
 #include "gpuvolumereconstructionapitestplugininterface.h"
 
+#include <itkImageRegionConstIterator.h>
 #include <vtkImageData.h>
 #include <vtkSmartPointer.h>
 #include <vtkTransform.h>
 
 #include <QMessageBox>
 #include <QtPlugin>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
 
 #include "gpu_volumereconstruction.h"
 #include "gpu_volumereconstructionplugininterface.h"
@@ -14,6 +18,60 @@
 #include "imageobject.h"
 #include "usacquisitionobject.h"
 
+// The CPU and OpenCL backends must give the same volume within these tolerances, in image intensity units. They
+// only differ by the order in which floating point contributions are accumulated.
+static const double MaxVoxelDifferenceTolerance  = 1.0;
+static const double MeanVoxelDifferenceTolerance = 0.01;
+
+// Reconstruct with the CPU and the OpenCL backends and compare the volumes. Returns false if they differ by more
+// than the tolerances, the reconstructor is left with the OpenCL result.
+static bool CompareBackends( GPU_VolumeReconstruction * reconstructor, QString & report )
+{
+    reconstructor->SetBackend( GPU_VolumeReconstruction::CPUBackend );
+    reconstructor->start();
+    reconstructor->wait();
+    IbisItkFloat3ImageType::Pointer cpuImage = reconstructor->GetReconstructedImage();
+
+    if( !reconstructor->SetBackend( GPU_VolumeReconstruction::GPUBackend ) )
+    {
+        report = "OpenCL backend could not be initialized.";
+        return false;
+    }
+    reconstructor->start();
+    reconstructor->wait();
+    IbisItkFloat3ImageType::Pointer gpuImage = reconstructor->GetReconstructedImage();
+
+    if( !cpuImage || !gpuImage ||
+        cpuImage->GetLargestPossibleRegion().GetSize() != gpuImage->GetLargestPossibleRegion().GetSize() )
+    {
+        report = "CPU and OpenCL volumes don't have the same size.";
+        return false;
+    }
+
+    typedef itk::ImageRegionConstIterator<IbisItkFloat3ImageType> IteratorType;
+    IteratorType cpuIt( cpuImage, cpuImage->GetLargestPossibleRegion() );
+    IteratorType gpuIt( gpuImage, gpuImage->GetLargestPossibleRegion() );
+    double maxDifference = 0.0;
+    double sumDifference = 0.0;
+    size_t nbVoxels      = 0;
+    for( ; !cpuIt.IsAtEnd(); ++cpuIt, ++gpuIt, ++nbVoxels )
+    {
+        double difference = std::fabs( double( cpuIt.Get() ) - double( gpuIt.Get() ) );
+        maxDifference     = std::max( maxDifference, difference );
+        sumDifference += difference;
+    }
+    double meanDifference = nbVoxels > 0 ? sumDifference / nbVoxels : 0.0;
+
+    bool ok = maxDifference <= MaxVoxelDifferenceTolerance && meanDifference <= MeanVoxelDifferenceTolerance;
+    report  = QString( "CPU vs OpenCL: max absolute voxel difference %1 (tolerance %2), mean %3 (tolerance %4): %5" )
+                 .arg( maxDifference )
+                 .arg( MaxVoxelDifferenceTolerance )
+                 .arg( meanDifference )
+                 .arg( MeanVoxelDifferenceTolerance )
+                 .arg( ok ? "passed" : "FAILED" );
+    return ok;
+}
+
 GPUVolumeReconstructionAPITestPluginInterface::GPUVolumeReconstructionAPITestPluginInterface() {}
 
 GPUVolumeReconstructionAPITestPluginInterface::~GPUVolumeReconstructionAPITestPluginInterface() {}
@@ -56,8 +114,20 @@ QWidget * GPUVolumeReconstructionAPITestPluginInterface::CreateFloatingWidget()
 
             // Construct ITK Matrix corresponding to VTK Local Matrix
             reconstructor->SetTransform( acq->GetLocalTransform()->GetMatrix() );
-            reconstructor->start();
-            reconstructor->wait();
+
+            // When OpenCL is available, both backends reconstruct the slices and their volumes are compared
+            if( GPU_VolumeReconstruction::IsGPUBackendAvailable() )
+            {
+                QString report;
+                bool sameVolume = CompareBackends( reconstructor, report );
+                std::cerr << report.toUtf8().data() << std::endl;
+                if( !sameVolume ) QMessageBox::warning( 0, "Error", report );
+            }
+            else
+            {
+                reconstructor->start();
+                reconstructor->wait();
+            }
 
             vtkSmartPointer<ImageObject> reconstructedImage = vtkSmartPointer<ImageObject>::New();
             if( reconstructedImage->SetItkImage( reconstructor->GetReconstructedImage() ) )
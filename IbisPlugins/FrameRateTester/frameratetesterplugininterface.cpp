@@ -20,6 +20,8 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 
 #include "frameratetesterwidget.h"
 #include "ibisapi.h"
+#include "renderscheduler.h"
+#include "scenemanager.h"
 #include "view.h"
 
 FrameRateTesterPluginInterface::FrameRateTesterPluginInterface()
@@ -98,8 +100,13 @@ void FrameRateTesterPluginInterface::OnTimerTriggered()
 {
     if( m_lastNumberOfFrames == 0 ) m_time->restart();
 
-    // Render
-    GetIbisAPI()->GetViewByID( m_currentViewID )->NotifyNeedRender();
+    // Render now: NotifyNeedRender() would only mark the view dirty and the scheduler would render it at most once
+    // per display frame, so the timer rate would be measured instead of the render rate
+    View * view = GetIbisAPI()->GetViewByID( m_currentViewID );
+    if( view->GetManager() )
+        view->GetManager()->GetRenderScheduler()->RenderNow( view );
+    else
+        view->NotifyNeedRender();
 
     // Increment stats
     m_lastPeriod = ( (double)m_time->elapsed() ) * 0.001;
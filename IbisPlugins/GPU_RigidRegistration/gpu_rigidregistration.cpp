@@ -11,12 +11,15 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 // Thanks to Dante De Nigris for writing this class
 #include "gpu_rigidregistration.h"
 
+#include <itkDiscreteGaussianImageFilter.h>
 #include <itkImageFileReader.h>
+#include <itkShrinkImageFilter.h>
 #include <itkTimeProbesCollectorBase.h>
 #include <vnl/algo/vnl_real_eigensystem.h>
 #include <vnl/algo/vnl_symmetric_eigensystem.h>
 #include <vtkSmartPointer.h>
 
+#include <algorithm>
 #include <sstream>
 
 class CommandIterationUpdateOpenCL : public itk::Command
@@ -113,6 +116,46 @@ public:
     }
 };
 
+/**
+ * Downsample image by shrinkFactor along each axis. When smooth is true the image is first low-pass filtered with
+ * a Gaussian of standard deviation half the output spacing, otherwise voxels are simply subsampled (e.g. masks).
+ */
+template <class TImage>
+static typename TImage::Pointer ShrinkImage( const TImage * image, unsigned int shrinkFactor, bool smooth )
+{
+    typedef itk::ShrinkImageFilter<TImage, TImage> ShrinkFilterType;
+    typedef itk::DiscreteGaussianImageFilter<TImage, TImage> SmoothingFilterType;
+
+    if( shrinkFactor <= 1 ) return const_cast<TImage *>( image );
+
+    typename ShrinkFilterType::Pointer shrinkFilter = ShrinkFilterType::New();
+    shrinkFilter->SetShrinkFactors( shrinkFactor );
+
+    typename SmoothingFilterType::Pointer smoothingFilter = SmoothingFilterType::New();
+    if( smooth )
+    {
+        typename SmoothingFilterType::ArrayType variance;
+        for( unsigned int d = 0; d < TImage::ImageDimension; d++ )
+        {
+            double sigma = 0.5 * shrinkFactor * image->GetSpacing()[d];
+            variance[d]  = sigma * sigma;
+        }
+        smoothingFilter->SetInput( image );
+        smoothingFilter->SetVariance( variance );
+        smoothingFilter->SetUseImageSpacing( true );
+        shrinkFilter->SetInput( smoothingFilter->GetOutput() );
+    }
+    else
+    {
+        shrinkFilter->SetInput( image );
+    }
+
+    shrinkFilter->Update();
+    typename TImage::Pointer output = shrinkFilter->GetOutput();
+    output->DisconnectPipeline();
+    return output;
+}
+
 GPU_RigidRegistration::GPU_RigidRegistration()
     : m_OptimizationRunning( false ),
       m_debug( false ),
@@ -123,6 +166,7 @@ GPU_RigidRegistration::GPU_RigidRegistration()
       m_numberOfPixels( 16000 ),
       m_orientationSelectivity( 2 ),
       m_populationSize( 0 ),
+      m_cacheSourceGradient( true ),
       m_parentVtkTransform( nullptr ),
       m_sourceVtkTransform( nullptr ),
       m_targetVtkTransform( nullptr ),
@@ -133,10 +177,65 @@ GPU_RigidRegistration::GPU_RigidRegistration()
       m_itkTargetImage( nullptr )
 {
     m_samplingStrategy = SamplingStrategy::RANDOM;
+    m_requestedBackend = AutomaticBackend;
+    m_backend          = IsGPUBackendAvailable() ? GPUBackend : CPUBackend;
 }
 
 GPU_RigidRegistration::~GPU_RigidRegistration() {}
 
+bool GPU_RigidRegistration::IsGPUBackendAvailable()
+{
+#ifdef HAS_OPENCL
+    return itk::IsGPUAvailable();
+#else
+    return false;
+#endif
+}
+
+GPU_RigidRegistration::PyramidSchedule GPU_RigidRegistration::CreatePyramidSchedule( unsigned int numberOfLevels,
+                                                                                     unsigned int numberOfPixels,
+                                                                                     double initialSigma )
+{
+    PyramidSchedule schedule;
+    for( unsigned int l = 0; l < numberOfLevels; l++ )
+    {
+        // Level 0 is the coarsest, the last level is the full resolution. The number of samples follows the
+        // number of voxels of a slice, down to 4000.
+        unsigned int coarseness            = numberOfLevels - 1 - l;
+        unsigned int minimumNumberOfPixels = std::min( numberOfPixels, 4000u );
+
+        PyramidLevel level;
+        level.shrinkFactor              = 1u << coarseness;
+        level.numberOfPixels            = std::max( numberOfPixels >> ( 2 * coarseness ), minimumNumberOfPixels );
+        level.initialSigma              = initialSigma * level.shrinkFactor;
+        level.maximumNumberOfIterations = coarseness > 0 ? 100 : 300;
+        schedule.push_back( level );
+    }
+    return schedule;
+}
+
+GPU_RigidRegistration::MetricPointer GPU_RigidRegistration::CreateMetric()
+{
+#ifdef HAS_OPENCL
+    if( m_requestedBackend != CPUBackend && IsGPUBackendAvailable() )
+    {
+        try
+        {
+            MetricPointer metric = GPUMetricType::New().GetPointer();
+            m_backend            = GPUBackend;
+            return metric;
+        }
+        catch( itk::ExceptionObject & err )
+        {
+            std::cerr << "Could not initialize OpenCL orientation matching metric, using CPU instead." << std::endl;
+            std::cerr << err << std::endl;
+        }
+    }
+#endif
+    m_backend = CPUBackend;
+    return CPUMetricType::New().GetPointer();
+}
+
 void GPU_RigidRegistration::runRegistration()
 {
     // Make sure all params have been specified
@@ -180,39 +279,11 @@ void GPU_RigidRegistration::runRegistration()
     {
         *this->m_debugStream << "Processing..(patience is a virtue)";
         *this->m_debugStream << "Setting up registration..." << std::endl;
-        timer.Start( "Pre-processing" );
     }
 
     // Registration
     ItkRigidTransformType::Pointer itkTransform = ItkRigidTransformType::New();
 
-    OptimizerType::Pointer optimizer = OptimizerType::New();
-
-    double percentile                   = m_percentile;
-    double initialSigma                 = m_initialSigma;
-    double gradientScale                = m_gradientScale;
-    unsigned int numberOfPixels         = m_numberOfPixels;
-    unsigned int orientationSelectivity = m_orientationSelectivity;
-    unsigned int populationSize         = m_populationSize;
-
-    GPUMetricPointer metric = GPUMetricType::New();
-    metric->SetFixedImage( itkTargetImage );
-    metric->SetMovingImage( itkSourceImage );
-
-    if( m_targetSpatialObjectMask )
-    {
-        *this->m_debugStream << "Using fixed mask" << std::endl;
-        metric->SetFixedImageMaskSpatialObject( m_targetSpatialObjectMask );
-        metric->SetUseFixedImageMask( true );
-    }
-
-    if( m_sourceSpatialObjectMask )
-    {
-        *this->m_debugStream << "Using moving mask" << std::endl;
-        metric->SetMovingImageMaskSpatialObject( m_sourceSpatialObjectMask );
-        metric->SetUseMovingImageMask( true );
-    }
-
     // Initialize Transform
     vtkSmartPointer<vtkMatrix4x4> finalMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
     sourceVtkTransform->GetInverse( finalMatrix );
@@ -277,6 +348,122 @@ void GPU_RigidRegistration::runRegistration()
     itkTransform->SetCenter( center );
     itkTransform->SetParameters( params );
 
+    PyramidSchedule schedule = m_pyramidSchedule;
+    if( schedule.empty() )
+    {
+        PyramidLevel fullResolution;
+        fullResolution.shrinkFactor              = 1;
+        fullResolution.numberOfPixels            = m_numberOfPixels;
+        fullResolution.initialSigma              = m_initialSigma;
+        fullResolution.maximumNumberOfIterations = 300;
+        schedule.push_back( fullResolution );
+    }
+
+    m_OptimizationRunning = true;
+    for( unsigned int l = 0; l < schedule.size(); l++ )
+    {
+        const PyramidLevel & level = schedule[l];
+        if( m_debug && schedule.size() > 1 )
+            *this->m_debugStream << "Pyramid level " << l + 1 << "/" << schedule.size() << ": shrink factor "
+                                 << level.shrinkFactor << ", " << level.numberOfPixels << " pixels" << std::endl;
+
+        if( m_debug ) timer.Start( "Pre-processing" );
+
+        unsigned int shrinkFactor = std::max( level.shrinkFactor, 1u );
+
+        ImageMaskPointer targetMask = m_targetSpatialObjectMask;
+        if( m_targetSpatialObjectMask && shrinkFactor > 1 )
+        {
+            targetMask = ImageMaskType::New();
+            targetMask->SetImage( ShrinkImage( m_targetSpatialObjectMask->GetImage(), shrinkFactor, false ) );
+        }
+        ImageMaskPointer sourceMask = m_sourceSpatialObjectMask;
+        if( m_sourceSpatialObjectMask && shrinkFactor > 1 )
+        {
+            sourceMask = ImageMaskType::New();
+            sourceMask->SetImage( ShrinkImage( m_sourceSpatialObjectMask->GetImage(), shrinkFactor, false ) );
+        }
+
+        try
+        {
+            runLevel( level, ShrinkImage( itkTargetImage.GetPointer(), shrinkFactor, true ),
+                      ShrinkImage( itkSourceImage.GetPointer(), shrinkFactor, true ), targetMask, sourceMask,
+                      itkTransform, targetVtkTransform, timer );
+        }
+        catch( itk::ExceptionObject & err )
+        {
+            std::cerr << "ExceptionObject caught !" << std::endl;
+            std::cerr << err << std::endl;
+            break;
+        }
+    }
+
+    if( m_debug )
+    {
+        *this->m_debugStream << "Done." << std::endl;
+        timer.Report( *this->m_debugStream );
+    }
+
+    m_OptimizationRunning = false;
+}
+
+void GPU_RigidRegistration::runLevel( const PyramidLevel & level, IbisItkFloat3ImageType::Pointer itkTargetImage,
+                                      IbisItkFloat3ImageType::Pointer itkSourceImage, ImageMaskPointer targetMask,
+                                      ImageMaskPointer sourceMask, ItkRigidTransformType::Pointer itkTransform,
+                                      vtkTransform * targetVtkTransform, itk::TimeProbesCollectorBase & timer )
+{
+    OptimizerType::Pointer optimizer = OptimizerType::New();
+
+    double percentile                   = m_percentile;
+    double initialSigma                 = level.initialSigma;
+    double gradientScale                = m_gradientScale;
+    unsigned int numberOfPixels         = level.numberOfPixels;
+    unsigned int orientationSelectivity = m_orientationSelectivity;
+    unsigned int populationSize         = m_populationSize;
+
+    MetricPointer metric = CreateMetric();
+    if( m_debug )
+        *this->m_debugStream << "Metric backend: " << ( m_backend == GPUBackend ? "GPU" : "CPU" ) << std::endl;
+    metric->SetFixedImage( itkTargetImage );
+    metric->SetMovingImage( itkSourceImage );
+    // The shrunk images of the coarser levels are recreated by every registration
+    metric->SetCacheMovingImageGradient( m_cacheSourceGradient && level.shrinkFactor <= 1 );
+
+    if( targetMask )
+    {
+        *this->m_debugStream << "Using fixed mask" << std::endl;
+        metric->SetFixedImageMaskSpatialObject( targetMask );
+        metric->SetUseFixedImageMask( true );
+    }
+
+    if( sourceMask )
+    {
+        *this->m_debugStream << "Using moving mask" << std::endl;
+        metric->SetMovingImageMaskSpatialObject( sourceMask );
+        metric->SetUseMovingImageMask( true );
+    }
+
+    GPUCostFunctionPointer costFunction = GPUCostFunctionType::New();
+    costFunction->SetMetric( metric );
+    costFunction->SetDebug( m_debug );
+
+    // The cost function rotates around the center of the fixed image of the level, express the
+    // current transform around that center
+    ItkRigidTransformType::CenterType center     = costFunction->GetCenter();
+    ItkRigidTransformType::ParametersType params = itkTransform->GetParameters();
+    ItkRigidTransformType::MatrixType matrix     = itkTransform->GetMatrix();
+    ItkRigidTransformType::OffsetType offset     = itkTransform->GetOffset();
+    for( unsigned int i = 0; i < 3; i++ )
+    {
+        params[i + 3] = offset[i] - center[i];
+        for( unsigned int j = 0; j < 3; j++ )
+        {
+            params[i + 3] += matrix[i][j] * center[j];
+        }
+    }
+    itkTransform->SetCenter( center );
+    itkTransform->SetParameters( params );
+
     metric->SetSamplingStrategy( m_samplingStrategy );
     metric->SetTransform( itkTransform );
     metric->SetNumberOfPixels( numberOfPixels );
@@ -285,9 +472,6 @@ void GPU_RigidRegistration::runRegistration()
     metric->SetComputeMask( m_useMask );
     metric->SetMaskThreshold( 0.05 );
     metric->SetGradientScale( gradientScale );
-    GPUCostFunctionPointer costFunction = GPUCostFunctionType::New();
-    costFunction->SetGPUMetric( metric );
-    costFunction->SetDebug( m_debug );
 
     metric->Update();
 
@@ -297,6 +481,9 @@ void GPU_RigidRegistration::runRegistration()
         timer.Start( "Registration" );
     }
 
+    // Coarse levels have larger voxels, let the search deviate proportionally further
+    const double deviationScale = std::max( level.shrinkFactor, 1u );
+
     optimizer->SetCostFunction( costFunction );
     optimizer->SetInitialPosition( itkTransform->GetParameters() );
     OptimizerType::ScalesType scales = OptimizerType::ScalesType( itkTransform->GetNumberOfParameters() );
@@ -310,12 +497,12 @@ void GPU_RigidRegistration::runRegistration()
     optimizer->SetUseCovarianceMatrixAdaptation( false );
     optimizer->SetUpdateBDPeriod( 0 );
     optimizer->SetValueTolerance( 0.001 );
-    optimizer->SetMaximumDeviation( 2 );
+    optimizer->SetMaximumDeviation( 2 * deviationScale );
     optimizer->SetMinimumDeviation( 1 );
     optimizer->SetUseScales( true );
     optimizer->SetPopulationSize( populationSize );
     optimizer->SetNumberOfParents( 0 );
-    optimizer->SetMaximumNumberOfIterations( 300 );
+    optimizer->SetMaximumNumberOfIterations( level.maximumNumberOfIterations );
     optimizer->SetInitialSigma( initialSigma );
 
     CommandIterationUpdateOpenCL::Pointer observer = CommandIterationUpdateOpenCL::New();
@@ -327,7 +514,6 @@ void GPU_RigidRegistration::runRegistration()
 
     if( m_debug ) *this->m_debugStream << "Starting registration..." << std::endl;
 
-    m_OptimizationRunning = true;
     try
     {
         optimizer->StartOptimization();
@@ -341,13 +527,7 @@ void GPU_RigidRegistration::runRegistration()
         std::cerr << err << std::endl;
     }
 
-    if( m_debug ) timer.Stop( "Registration" );
+    itkTransform->SetParameters( optimizer->GetCurrentPosition() );
 
-    if( m_debug )
-    {
-        *this->m_debugStream << "Done." << std::endl;
-        timer.Report( *this->m_debugStream );
-    }
-
-    m_OptimizationRunning = false;
+    if( m_debug ) timer.Stop( "Registration" );
 }
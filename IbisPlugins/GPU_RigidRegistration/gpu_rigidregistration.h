@@ -14,34 +14,68 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #define GPU_RIGIDREGISTRATION_H
 
 #include <itkAmoebaOptimizer.h>
-#include <itkCMAEvolutionStrategyOptimizer.h>
 #include <itkEuler3DTransform.h>
 #include <itkImageMaskSpatialObject.h>
 #include <itkSPSAOptimizer.h>
+#include <itkTimeProbesCollectorBase.h>
 #include <vtkMatrix4x4.h>
 #include <vtkTransform.h>
 
 #include <sstream>
+#include <vector>
 
 #include "imageobject.h"
+#include "itkBatchedCMAEvolutionStrategyOptimizer.h"
+#include "itkCPUOrientationMatchingMatrixTransformationSparseMask.h"
 #include "itkGPU3DRigidSimilarityMetric.h"
+#ifdef HAS_OPENCL
+#include "itkGPUOrientationMatchingMatrixTransformationSparseMask.h"
+#endif
 
 class GPU_RigidRegistration
 {
 public:
-    typedef itk::CMAEvolutionStrategyOptimizer OptimizerType;
-
     typedef itk::GPU3DRigidSimilarityMetric<IbisItkFloat3ImageType, IbisItkFloat3ImageType> GPUCostFunctionType;
     typedef GPUCostFunctionType::Pointer GPUCostFunctionPointer;
 
-    typedef GPUCostFunctionType::GPUMetricType GPUMetricType;
-    typedef GPUCostFunctionType::GPUMetricPointer GPUMetricPointer;
+    // Each CMA-ES generation is evaluated as one batch by the metric
+    typedef itk::BatchedCMAEvolutionStrategyOptimizer<GPUCostFunctionType> OptimizerType;
+
+    typedef GPUCostFunctionType::MetricType MetricType;
+    typedef GPUCostFunctionType::MetricPointer MetricPointer;
+#ifdef HAS_OPENCL
+    typedef itk::GPUOrientationMatchingMatrixTransformationSparseMask<IbisItkFloat3ImageType, IbisItkFloat3ImageType>
+        GPUMetricType;
+#endif
+    typedef itk::CPUOrientationMatchingMatrixTransformationSparseMask<IbisItkFloat3ImageType, IbisItkFloat3ImageType>
+        CPUMetricType;
+
+    // AutomaticBackend uses OpenCL when a GPU is available and falls back to the CPU otherwise. Without
+    // HAS_OPENCL, the GPU metric is compiled out and the CPU is always used.
+    enum Backend
+    {
+        AutomaticBackend,
+        GPUBackend,
+        CPUBackend
+    };
 
     typedef itk::Euler3DTransform<double> ItkRigidTransformType;
 
     using ImageMaskType    = itk::ImageMaskSpatialObject<3>;
     using ImageMaskPointer = ImageMaskType::Pointer;
 
+    /** One stage of the coarse-to-fine registration. Both volumes are smoothed and downsampled by shrinkFactor,
+     *  then registered with numberOfPixels samples, starting from the result of the previous level. */
+    struct PyramidLevel
+    {
+        unsigned int shrinkFactor;
+        unsigned int numberOfPixels;
+        double initialSigma;
+        unsigned int maximumNumberOfIterations;
+    };
+    // Levels are ordered from the coarsest to the finest
+    typedef std::vector<PyramidLevel> PyramidSchedule;
+
     explicit GPU_RigidRegistration();
     ~GPU_RigidRegistration();
 
@@ -69,6 +103,13 @@ public:
         m_orientationSelectivity = orientationSelectivity;
     }
     void SetPopulationSize( unsigned int populationSize ) { this->m_populationSize = populationSize; }
+    /** Register coarse to fine with schedule. An empty schedule registers the full resolution volumes once,
+     *  with the number of pixels and initial sigma of the registration. */
+    void SetPyramidSchedule( const PyramidSchedule & schedule ) { this->m_pyramidSchedule = schedule; }
+    /** Schedule of numberOfLevels levels, the resolution being halved at each coarser level. The coarser levels
+     *  use fewer samples, a larger initial sigma and fewer iterations. */
+    static PyramidSchedule CreatePyramidSchedule( unsigned int numberOfLevels, unsigned int numberOfPixels,
+                                                  double initialSigma );
     void SetParentVtkTransform( vtkTransform * transform ) { this->m_parentVtkTransform = transform; }
     // void SetDebugOn() { m_debug = true; }
     // void SetDebugOff() { m_debug = false; }
@@ -78,16 +119,26 @@ public:
         this->m_debugStream = strstream;
     }
     void SetUseMask( bool usemask ) { this->m_useMask = usemask; }
+    /** Keep the gradient of the full resolution source image across registrations, e.g. when registering
+     *  the same preoperative volume to successive acquisitions. On by default. */
+    void SetCacheSourceGradient( bool cache ) { this->m_cacheSourceGradient = cache; }
+    /** Select the backend used to evaluate the metric by the next registrations. */
+    void SetBackend( Backend backend ) { this->m_requestedBackend = backend; }
+    /** Return the backend effectively used by the last registration: GPUBackend or CPUBackend. */
+    Backend GetBackend() { return m_backend; }
+    static bool IsGPUBackendAvailable();
 
     double GetPercentile() { return m_percentile; }
     double GetInitialSigma() { return m_initialSigma; }
     unsigned int GetNumberOfPixels() { return m_numberOfPixels; }
     unsigned int GetOrientationSelectivity() { return m_orientationSelectivity; }
     unsigned int GetPopulationSize() { return m_populationSize; }
+    PyramidSchedule GetPyramidSchedule() { return m_pyramidSchedule; }
     vtkTransform * GetResultTransform() { return m_resultTransform; }
     bool GetUseMask() { return m_useMask; }
+    bool GetCacheSourceGradient() { return m_cacheSourceGradient; }
 
-    using SamplingStrategy = GPUMetricType::SamplingStrategyType;
+    using SamplingStrategy = MetricType::SamplingStrategyType;
     void SetSamplingStrategyToRandom() { this->m_samplingStrategy = SamplingStrategy::RANDOM; }
     void SetSamplingStrategyToGrid() { this->m_samplingStrategy = SamplingStrategy::GRID; }
     void SetSamplingStrategyToFull() { this->m_samplingStrategy = SamplingStrategy::FULL; }
@@ -98,6 +149,12 @@ public:
 
 private:
     void updateTagsDistance();
+    MetricPointer CreateMetric();
+    /** Register the volumes of one pyramid level, starting from and updating itkTransform. */
+    void runLevel( const PyramidLevel & level, IbisItkFloat3ImageType::Pointer itkTargetImage,
+                   IbisItkFloat3ImageType::Pointer itkSourceImage, ImageMaskPointer targetMask,
+                   ImageMaskPointer sourceMask, ItkRigidTransformType::Pointer itkTransform,
+                   vtkTransform * targetVtkTransform, itk::TimeProbesCollectorBase & timer );
 
     bool m_OptimizationRunning;
     bool m_debug;
@@ -120,9 +177,14 @@ private:
     unsigned int m_numberOfPixels;
     unsigned int m_orientationSelectivity;
     unsigned int m_populationSize;
+    PyramidSchedule m_pyramidSchedule;
+    bool m_cacheSourceGradient;
 
     vtkTransform * m_parentVtkTransform;
     SamplingStrategy m_samplingStrategy;
+
+    Backend m_requestedBackend;
+    Backend m_backend;
 };
 
 #endif
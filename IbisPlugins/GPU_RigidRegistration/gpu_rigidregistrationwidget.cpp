@@ -104,6 +104,11 @@ void GPU_RigidRegistrationWidget::on_startButton_clicked()
     rigidRegistrator->SetPercentile(
         ui->percentileComboBox->itemData( ui->percentileComboBox->currentIndex() ).toDouble() );
     rigidRegistrator->SetUseMask( ui->computeMaskCheckBox->isChecked() );
+    rigidRegistrator->SetBackend( static_cast<GPU_RigidRegistration::Backend>(
+        ui->backendComboBox->itemData( ui->backendComboBox->currentIndex() ).toInt() ) );
+    rigidRegistrator->SetPyramidSchedule( GPU_RigidRegistration::CreatePyramidSchedule(
+        ui->pyramidLevelsSpinBox->value(), rigidRegistrator->GetNumberOfPixels(),
+        rigidRegistrator->GetInitialSigma() ) );
     rigidRegistrator->SetDebug( debug, &debugStringStream );
 
     // Set image inputs
@@ -132,8 +137,14 @@ void GPU_RigidRegistrationWidget::on_startButton_clicked()
 
     qint64 registrationTime = m_registrationTimer.elapsed();
 
-    QString feedbackString =
-        QString( "Full Registration finished in %1 secs" ).arg( qreal( registrationTime ) / 1000.0 );
+    QString backendName = rigidRegistrator->GetBackend() == GPU_RigidRegistration::GPUBackend ? "GPU" : "CPU";
+
+    int numberOfLevels = ui->pyramidLevelsSpinBox->value();
+    if( numberOfLevels > 1 ) backendName += QString( ", %1 levels" ).arg( numberOfLevels );
+
+    QString feedbackString = QString( "Full Registration finished in %1 secs (%2)" )
+                                 .arg( qreal( registrationTime ) / 1000.0 )
+                                 .arg( backendName );
     ui->userFeedbackLabel->setText( feedbackString );
     m_OptimizationRunning = false;
 
@@ -161,6 +172,14 @@ void GPU_RigidRegistrationWidget::UpdateUi()
     ui->initialSigmaComboBox->addItem( "8.0", QVariant( 8.0 ) );
     ui->initialSigmaComboBox->setCurrentIndex( 1 );
 
+    ui->backendComboBox->clear();
+    ui->backendComboBox->addItem( QString( "Automatic" ), QVariant( GPU_RigidRegistration::AutomaticBackend ) );
+    if( GPU_RigidRegistration::IsGPUBackendAvailable() )
+    {
+        ui->backendComboBox->addItem( QString( "GPU (OpenCL)" ), QVariant( GPU_RigidRegistration::GPUBackend ) );
+    }
+    ui->backendComboBox->addItem( QString( "CPU (multithreaded)" ), QVariant( GPU_RigidRegistration::CPUBackend ) );
+
     IbisAPI * ibisAPI = m_pluginInterface->GetIbisAPI();
     Q_ASSERT( ibisAPI );
     const QList<SceneObject *> & allObjects = ibisAPI->GetAllObjects();
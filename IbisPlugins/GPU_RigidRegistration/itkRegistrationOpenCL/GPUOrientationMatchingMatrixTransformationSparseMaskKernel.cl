@@ -19,22 +19,9 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #define INT uint
 
 #ifdef DIM_3
-__kernel void OrientationMatchingMetricSparseMask( 
-                                        __constant REAL4 * rigidContext,
-                                        __global REAL4* g_fg, __global REAL4* g_fl,
-                                        read_only image3d_t mgImage,
-                                        __global REAL * metricOutput, 
-                                        __local REAL * metricAccums
-                                        )
+/* Metric value of the sample at location loc with fixed gradient fixedGrad, for the rigid context rigidContext */
+REAL EvaluateSample( __constant REAL4 * rigidContext, REAL4 loc, REAL4 fixedGrad, read_only image3d_t mgImage )
 {
-
-  unsigned int gidx = get_global_id(0);
-  unsigned int lid = get_local_id(0);
-  unsigned int groupID = get_group_id(0);                                      
-
-  /* Evaluate Fixed Image Gradient */  
-  REAL4 loc = g_fl[gidx];
-
   const sampler_t mySampler = CLK_FILTER_LINEAR | CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP;
 
   REAL4 rcX = rigidContext[0];
@@ -64,7 +51,6 @@ __kernel void OrientationMatchingMetricSparseMask(
 
       REAL4 trMovingGradN = normalize(trMovingGrad);
 
-      REAL4 fixedGrad = g_fg[gidx];
       REAL4 fixedGradN = normalize(fixedGrad);
 
       REAL innerProduct = dot(fixedGradN, trMovingGradN);
@@ -74,8 +60,14 @@ __kernel void OrientationMatchingMetricSparseMask(
   {
       metricValue = 0.0f;
   }
-  metricAccums[lid] = metricValue;  
-  
+  return metricValue;
+}
+
+/* Sum of the values of the work group, written by the first item to metricOutput[outputID] */
+void ReduceWorkGroup( __global REAL * metricOutput, unsigned int outputID, __local REAL * metricAccums )
+{
+  unsigned int lid = get_local_id(0);
+
   barrier(CLK_LOCAL_MEM_FENCE);
 
   for(unsigned int s = LOCALSIZE / 2; s > 0; s >>= 1)
@@ -87,9 +79,45 @@ __kernel void OrientationMatchingMetricSparseMask(
     barrier(CLK_LOCAL_MEM_FENCE);
   }
   
-  if(lid == 0) metricOutput[groupID] = metricAccums[0];
+  if(lid == 0) metricOutput[outputID] = metricAccums[0];
+}
+
+__kernel void OrientationMatchingMetricSparseMask( 
+                                        __constant REAL4 * rigidContext,
+                                        __global REAL4* g_fg, __global REAL4* g_fl,
+                                        read_only image3d_t mgImage,
+                                        __global REAL * metricOutput, 
+                                        __local REAL * metricAccums
+                                        )
+{
+
+  unsigned int gidx = get_global_id(0);
+  unsigned int lid = get_local_id(0);
+  unsigned int groupID = get_group_id(0);                                      
+
+  metricAccums[lid] = EvaluateSample(rigidContext, g_fl[gidx], g_fg[gidx], mgImage);
+  
+  ReduceWorkGroup(metricOutput, groupID, metricAccums);
+}
 
+/* Batch of transforms: dimension 0 runs over the samples and dimension 1 over the rigid contexts. The sums of
+   the work groups of context c are written to metricOutput[c * get_num_groups(0) + group]. */
+__kernel void OrientationMatchingMetricSparseMaskBatch( 
+                                        __constant REAL4 * rigidContexts,
+                                        __global REAL4* g_fg, __global REAL4* g_fl,
+                                        read_only image3d_t mgImage,
+                                        __global REAL * metricOutput, 
+                                        __local REAL * metricAccums
+                                        )
+{
 
+  unsigned int gidx = get_global_id(0);
+  unsigned int lid = get_local_id(0);
+  unsigned int context = get_global_id(1);
+
+  metricAccums[lid] = EvaluateSample(rigidContexts + 6 * context, g_fl[gidx], g_fg[gidx], mgImage);
+  
+  ReduceWorkGroup(metricOutput, context * get_num_groups(0) + get_group_id(0), metricAccums);
 }
 
 #endif
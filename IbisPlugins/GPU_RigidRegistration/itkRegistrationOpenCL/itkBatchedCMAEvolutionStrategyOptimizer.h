@@ -0,0 +1,95 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#ifndef ITKBATCHEDCMAEVOLUTIONSTRATEGYOPTIMIZER_H
+#define ITKBATCHEDCMAEVOLUTIONSTRATEGYOPTIMIZER_H
+
+#include <itkCMAEvolutionStrategyOptimizer.h>
+
+#include <vector>
+
+namespace itk
+{
+/**
+ * \class BatchedCMAEvolutionStrategyOptimizer
+ * CMA-ES optimizer that evaluates each generation of candidates in a single call to the cost function.
+ * CMAEvolutionStrategyOptimizer draws the offspring and evaluates them one by one. Here the cost function
+ * only records the candidates while they are drawn and the whole population is then evaluated at once with
+ * EvaluateDeferredValues, which lets the metric process all the candidates in one pass.
+ *
+ * TCostFunction must provide SetDeferEvaluation( bool ) and EvaluateDeferredValues( std::vector<MeasureType> & ),
+ * like GPU3DRigidSimilarityMetric. With any other cost function the candidates are evaluated one by one.
+ */
+template <class TCostFunction>
+class BatchedCMAEvolutionStrategyOptimizer : public CMAEvolutionStrategyOptimizer
+{
+public:
+    typedef BatchedCMAEvolutionStrategyOptimizer Self;
+    typedef CMAEvolutionStrategyOptimizer Superclass;
+    typedef SmartPointer<Self> Pointer;
+    typedef SmartPointer<const Self> ConstPointer;
+
+    itkNewMacro( Self );
+    itkTypeMacro( BatchedCMAEvolutionStrategyOptimizer, CMAEvolutionStrategyOptimizer );
+
+    typedef TCostFunction BatchCostFunctionType;
+    typedef Superclass::MeasureType MeasureType;
+
+protected:
+    BatchedCMAEvolutionStrategyOptimizer() {}
+    ~BatchedCMAEvolutionStrategyOptimizer() override {}
+
+    void GenerateOffspring( void ) override
+    {
+        BatchCostFunctionType * costFunction =
+            dynamic_cast<BatchCostFunctionType *>( this->GetModifiableCostFunction() );
+        if( !costFunction )
+        {
+            Superclass::GenerateOffspring();
+            return;
+        }
+
+        // Draw the population, the cost function values are placeholders until the batch is evaluated
+        costFunction->SetDeferEvaluation( true );
+        try
+        {
+            Superclass::GenerateOffspring();
+        }
+        catch( ... )
+        {
+            costFunction->SetDeferEvaluation( false );
+            throw;
+        }
+        costFunction->SetDeferEvaluation( false );
+
+        std::vector<MeasureType> values;
+        costFunction->EvaluateDeferredValues( values );
+        if( values.size() != this->m_CostFunctionValues.size() )
+        {
+            itkExceptionMacro( << "Evaluated " << values.size() << " candidates for a population of "
+                               << this->m_CostFunctionValues.size() );
+        }
+
+        // The candidates are evaluated in the order they are drawn. Like the scaled cost function,
+        // negate the values when maximizing.
+        for( unsigned int i = 0; i < values.size(); i++ )
+        {
+            this->m_CostFunctionValues[i].first = this->GetMaximize() ? -values[i] : values[i];
+        }
+    }
+
+private:
+    BatchedCMAEvolutionStrategyOptimizer( const Self & );  // purposely not implemented
+    void operator=( const Self & );                        // purposely not implemented
+};
+}  // end namespace itk
+
+#endif
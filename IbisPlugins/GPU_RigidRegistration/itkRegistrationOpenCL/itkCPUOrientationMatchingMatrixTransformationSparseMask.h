@@ -0,0 +1,120 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#ifndef ITKCPUORIENTATIONMATCHINGMATRIXTRANSFORMATIONSPARSEMASK_H
+#define ITKCPUORIENTATIONMATCHINGMATRIXTRANSFORMATIONSPARSEMASK_H
+
+#include <itkMultiThreaderBase.h>
+
+#include "itkOrientationMatchingMatrixTransformationSparseMask.h"
+
+namespace itk
+{
+/**
+ * \class CPUOrientationMatchingMatrixTransformationSparseMask
+ * CPU backend of the gradient orientation matching metric. The image gradients are computed with the
+ * same separable filter as GPUDiscreteGaussianGradientImageFilter.cl and the moving gradient is sampled
+ * with trilinear interpolation, the 4 values of a voxel being interpolated at once with SSE.
+ *
+ * The samples are evaluated in parallel by blocks of m_Threads samples. Each block is summed with the
+ * same pairwise reduction as the OpenCL work groups and the block sums are then added in order, so the
+ * metric value does not depend on the number of threads and can be compared with the GPU backend.
+ * A batch of transforms is evaluated in a single parallel pass over the (transform, block) pairs.
+ */
+template <class TFixedImage, class TMovingImage>
+class ITK_EXPORT CPUOrientationMatchingMatrixTransformationSparseMask
+    : public OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>
+{
+public:
+    /** Standard class typedefs. */
+    typedef CPUOrientationMatchingMatrixTransformationSparseMask Self;
+    typedef OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage> Superclass;
+    typedef SmartPointer<Self> Pointer;
+    typedef SmartPointer<const Self> ConstPointer;
+
+    typedef typename Superclass::InternalRealType InternalRealType;
+    typedef typename Superclass::FixedImageType FixedImageType;
+    typedef typename Superclass::MovingImageType MovingImageType;
+    typedef typename Superclass::FixedDerivativeOperatorType FixedDerivativeOperatorType;
+    typedef typename Superclass::MovingDerivativeOperatorType MovingDerivativeOperatorType;
+    typedef typename Superclass::FixedImageMaskPixelType FixedImageMaskPixelType;
+    typedef typename Superclass::MovingImageMaskPixelType MovingImageMaskPixelType;
+
+    /** Method for creation through the object factory. */
+    itkNewMacro( Self );
+
+    /** Run-time type information (and related methods). */
+    itkTypeMacro( CPUOrientationMatchingMatrixTransformationSparseMask,
+                  OrientationMatchingMatrixTransformationSparseMask );
+
+    itkStaticConstMacro( FixedImageDimension, unsigned int, TFixedImage::ImageDimension );
+    itkStaticConstMacro( MovingImageDimension, unsigned int, TMovingImage::ImageDimension );
+
+protected:
+    CPUOrientationMatchingMatrixTransformationSparseMask();
+    ~CPUOrientationMatchingMatrixTransformationSparseMask();
+
+    using Superclass::m_Blocks;
+    using Superclass::m_ComputeMask;
+    using Superclass::m_Debug;
+    using Superclass::m_FixedGradientSamples;
+    using Superclass::m_FixedImage;
+    using Superclass::m_FixedLocationSamples;
+    using Superclass::m_MaskThreshold;
+    using Superclass::m_MovingImage;
+    using Superclass::m_N;
+    using Superclass::m_NumberOfSamples;
+    using Superclass::m_RigidContext;
+    using Superclass::m_Threads;
+
+    void ComputeFixedImageGradient( std::vector<InternalRealType> & fixedGradient ) override;
+    void ComputeMovingImageGradient( void ) override;
+    void InitializeMetric( void ) override;
+    InternalRealType ComputeMetricSum( void ) override;
+    void ComputeMetricSums( const std::vector<InternalRealType> & contexts,
+                            std::vector<InternalRealType> & sums ) override;
+
+    /** Compute the gradient of a 3D image, 4 values per voxel, with the derivative operators opers. */
+    template <class TImage, class TMaskPixel, class TOperator>
+    void ComputeImageGradient( const TImage * image, const TMaskPixel * mask, const std::vector<TOperator> & opers,
+                               std::vector<InternalRealType> & gradient );
+
+    /** Metric value of sample i for the transform context rc, 0 for the padding samples. */
+    InternalRealType EvaluateSample( unsigned int i, const InternalRealType * rc ) const;
+
+    /** Pairwise sum of the metric over the samples of a block, like an OpenCL work group. metricAccums holds
+     *  m_Threads values and is only used by this block. */
+    InternalRealType EvaluateBlock( unsigned int block, const InternalRealType * rc,
+                                    InternalRealType * metricAccums ) const;
+
+    MultiThreaderBase::Pointer m_Threader;
+
+    typedef typename Superclass::GradientPointer GradientPointer;
+
+    GradientPointer m_MovingImageGradient;
+    int m_MovingImageSize[3];
+
+    // Reused by every evaluation: the accumulators of each block, like the local memory of the work groups, and
+    // the sum of each block for each transform context. m_BlockSums grows to the largest batch evaluated.
+    std::vector<InternalRealType> m_MetricAccums;
+    std::vector<InternalRealType> m_BlockSums;
+
+private:
+    CPUOrientationMatchingMatrixTransformationSparseMask( const Self & );  // purposely not implemented
+    void operator=( const Self & );                                        // purposely not implemented
+};
+}  // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkCPUOrientationMatchingMatrixTransformationSparseMask.hxx"
+#endif
+
+#endif
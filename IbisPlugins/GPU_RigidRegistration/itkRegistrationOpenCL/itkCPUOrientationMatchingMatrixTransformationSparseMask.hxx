@@ -0,0 +1,416 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#ifndef ITKCPUORIENTATIONMATCHINGMATRIXTRANSFORMATIONSPARSEMASK_HXX
+#define ITKCPUORIENTATIONMATCHINGMATRIXTRANSFORMATIONSPARSEMASK_HXX
+
+#include <itkTimeProbe.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+#include "itkCPUOrientationMatchingMatrixTransformationSparseMask.h"
+
+// The 4 values of a gradient voxel are interpolated together
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define IBIS_ORIENTATION_MATCHING_SSE 1
+#else
+#define IBIS_ORIENTATION_MATCHING_SSE 0
+#endif
+
+namespace itk
+{
+namespace OrientationMatchingSIMD
+{
+/**
+ * Trilinear interpolation of a 4 values per voxel image at continuous index cIdx. Voxels outside of
+ * the image count as 0, like the border color of an OpenCL image read with CLK_ADDRESS_CLAMP.
+ */
+inline void InterpolateGradient( const float * gradient, const int size[3], const float cIdx[3], float value[4] )
+{
+    int i0[3];
+    float f[3];
+    for( int d = 0; d < 3; d++ )
+    {
+        float fl = std::floor( cIdx[d] );
+        i0[d]    = (int)fl;
+        f[d]     = cIdx[d] - fl;
+    }
+
+#if IBIS_ORIENTATION_MATCHING_SSE
+    __m128 corners[2][2][2];
+    for( int dz = 0; dz < 2; dz++ )
+    {
+        int z = i0[2] + dz;
+        for( int dy = 0; dy < 2; dy++ )
+        {
+            int y = i0[1] + dy;
+            for( int dx = 0; dx < 2; dx++ )
+            {
+                int x = i0[0] + dx;
+                if( x < 0 || x >= size[0] || y < 0 || y >= size[1] || z < 0 || z >= size[2] )
+                {
+                    corners[dz][dy][dx] = _mm_setzero_ps();
+                }
+                else
+                {
+                    size_t idx          = ( (size_t)z * size[1] + y ) * size[0] + x;
+                    corners[dz][dy][dx] = _mm_loadu_ps( gradient + 4 * idx );
+                }
+            }
+        }
+    }
+
+    __m128 fx = _mm_set1_ps( f[0] );
+    __m128 fy = _mm_set1_ps( f[1] );
+    __m128 fz = _mm_set1_ps( f[2] );
+    __m128 c[2][2];
+    for( int dz = 0; dz < 2; dz++ )
+    {
+        for( int dy = 0; dy < 2; dy++ )
+        {
+            c[dz][dy] = _mm_add_ps( corners[dz][dy][0],
+                                    _mm_mul_ps( fx, _mm_sub_ps( corners[dz][dy][1], corners[dz][dy][0] ) ) );
+        }
+    }
+    __m128 c0 = _mm_add_ps( c[0][0], _mm_mul_ps( fy, _mm_sub_ps( c[0][1], c[0][0] ) ) );
+    __m128 c1 = _mm_add_ps( c[1][0], _mm_mul_ps( fy, _mm_sub_ps( c[1][1], c[1][0] ) ) );
+    _mm_storeu_ps( value, _mm_add_ps( c0, _mm_mul_ps( fz, _mm_sub_ps( c1, c0 ) ) ) );
+#else
+    for( int k = 0; k < 4; k++ ) value[k] = 0.0f;
+    for( int dz = 0; dz < 2; dz++ )
+    {
+        int z    = i0[2] + dz;
+        float wz = dz ? f[2] : 1.0f - f[2];
+        for( int dy = 0; dy < 2; dy++ )
+        {
+            int y    = i0[1] + dy;
+            float wy = dy ? f[1] : 1.0f - f[1];
+            for( int dx = 0; dx < 2; dx++ )
+            {
+                int x = i0[0] + dx;
+                if( x < 0 || x >= size[0] || y < 0 || y >= size[1] || z < 0 || z >= size[2] ) continue;
+                float w         = wz * wy * ( dx ? f[0] : 1.0f - f[0] );
+                const float * g = gradient + 4 * ( ( (size_t)z * size[1] + y ) * size[0] + x );
+                for( int k = 0; k < 4; k++ ) value[k] += w * g[k];
+            }
+        }
+    }
+#endif
+}
+}  // end namespace OrientationMatchingSIMD
+
+template <class TFixedImage, class TMovingImage>
+CPUOrientationMatchingMatrixTransformationSparseMask<
+    TFixedImage, TMovingImage>::CPUOrientationMatchingMatrixTransformationSparseMask()
+{
+    m_Threader = MultiThreaderBase::New();
+
+    m_MovingImageSize[0] = m_MovingImageSize[1] = m_MovingImageSize[2] = 0;
+}
+
+template <class TFixedImage, class TMovingImage>
+CPUOrientationMatchingMatrixTransformationSparseMask<
+    TFixedImage, TMovingImage>::~CPUOrientationMatchingMatrixTransformationSparseMask()
+{
+}
+
+/**
+ * Separable derivative filter of GPUDiscreteGaussianGradientImageFilter.cl, one slice per work unit
+ */
+template <class TFixedImage, class TMovingImage>
+template <class TImage, class TMaskPixel, class TOperator>
+void CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeImageGradient(
+    const TImage * image, const TMaskPixel * mask, const std::vector<TOperator> & opers,
+    std::vector<InternalRealType> & gradient )
+{
+    int imgSize[3];
+    int radius[3];
+    InternalRealType spacing[3];
+    for( int d = 0; d < 3; d++ )
+    {
+        imgSize[d] = image->GetLargestPossibleRegion().GetSize()[d];
+        radius[d]  = opers[d].GetRadius( d );
+        spacing[d] = image->GetSpacing()[d];
+    }
+    const int width  = imgSize[0];
+    const int height = imgSize[1];
+    const int depth  = imgSize[2];
+
+    gradient.assign( 4 * (size_t)width * height * depth, (InternalRealType)0 );
+
+    const typename TImage::PixelType * in = image->GetBufferPointer();
+    const double threshold                = m_MaskThreshold;
+    InternalRealType * out                = gradient.data();
+
+    m_Threader->ParallelizeArray(
+        0, depth,
+        [&]( SizeValueType giz )
+        {
+            for( int giy = 0; giy < height; giy++ )
+            {
+                for( int gix = 0; gix < width; gix++ )
+                {
+                    size_t gidx            = (size_t)width * ( giz * height + giy ) + gix;
+                    InternalRealType * grd = out + 4 * gidx;
+                    if( !( mask[gidx] > 0 ) )
+                    {
+                        grd[3] = (InternalRealType)-1.0;
+                        continue;
+                    }
+
+                    bool maskBool = true;
+                    const InternalRealType * op;
+
+                    InternalRealType sumx = 0;
+                    op                    = opers[0].Begin();
+                    for( int x = gix - radius[0]; x <= gix + radius[0]; x++ )
+                    {
+                        size_t cidx = (size_t)width * ( giz * height + giy ) + std::min( std::max( 0, x ), width - 1 );
+                        sumx += (InternalRealType)in[cidx] * *op++;
+                        if( in[cidx] < threshold ) maskBool = false;
+                    }
+                    grd[0] = sumx / spacing[0];
+
+                    InternalRealType sumy = 0;
+                    op                    = opers[1].Begin();
+                    for( int y = giy - radius[1]; y <= giy + radius[1]; y++ )
+                    {
+                        size_t cidx = (size_t)width * ( giz * height + std::min( std::max( 0, y ), height - 1 ) ) + gix;
+                        sumy += (InternalRealType)in[cidx] * *op++;
+                        if( in[cidx] < threshold ) maskBool = false;
+                    }
+                    grd[1] = sumy / spacing[1];
+
+                    InternalRealType sumz = 0;
+                    op                    = opers[2].Begin();
+                    for( int z = (int)giz - radius[2]; z <= (int)giz + radius[2]; z++ )
+                    {
+                        size_t cidx = (size_t)width * ( std::min( std::max( 0, z ), depth - 1 ) * height + giy ) + gix;
+                        sumz += (InternalRealType)in[cidx] * *op++;
+                        if( in[cidx] < threshold ) maskBool = false;
+                    }
+                    grd[2] = sumz / spacing[2];
+
+                    if( maskBool ) grd[3] = (InternalRealType)1.0;
+                }
+            }
+        },
+        nullptr );
+}
+
+/**
+ * Compute Gradient of Fixed Image
+ */
+template <class TFixedImage, class TMovingImage>
+void CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeFixedImageGradient(
+    std::vector<InternalRealType> & fixedGradient )
+{
+    itk::TimeProbe clock;
+    clock.Start();
+
+    std::vector<FixedImageMaskPixelType> defaultMask;
+    const FixedImageMaskPixelType * fixedMaskBuffer = this->GetFixedImageMaskBuffer( defaultMask );
+
+    std::vector<FixedDerivativeOperatorType> opers;
+    std::vector<InternalRealType> kernelNorms;
+    this->CreateDerivativeOperators( m_FixedImage->GetSpacing(), opers, kernelNorms );
+
+    this->ComputeImageGradient( m_FixedImage.GetPointer(), fixedMaskBuffer, opers, fixedGradient );
+
+    clock.Stop();
+    if( m_Debug ) std::cerr << "Fixed Image Gradient on CPU took:\t" << clock.GetMean() << std::endl;
+}
+
+/**
+ * Compute Gradient of Moving Image
+ */
+template <class TFixedImage, class TMovingImage>
+void CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeMovingImageGradient( void )
+{
+    for( int d = 0; d < 3; d++ )
+    {
+        m_MovingImageSize[d] = m_MovingImage->GetLargestPossibleRegion().GetSize()[d];
+    }
+
+    m_MovingImageGradient = this->FindCachedMovingImageGradient();
+    if( m_MovingImageGradient )
+    {
+        if( m_Debug ) std::cout << "Using cached moving image gradient" << std::endl;
+        return;
+    }
+
+    if( m_Debug ) std::cout << "Computing Moving Image Gradient" << std::endl;
+
+    std::vector<MovingImageMaskPixelType> defaultMask;
+    const MovingImageMaskPixelType * movingMaskBuffer = this->GetMovingImageMaskBuffer( defaultMask );
+
+    std::vector<MovingDerivativeOperatorType> opers;
+    std::vector<InternalRealType> kernelNorms;
+    this->CreateDerivativeOperators( m_MovingImage->GetSpacing(), opers, kernelNorms );
+
+    std::shared_ptr<std::vector<InternalRealType> > movingGradient = std::make_shared<std::vector<InternalRealType> >();
+    this->ComputeImageGradient( m_MovingImage.GetPointer(), movingMaskBuffer, opers, *movingGradient );
+    m_MovingImageGradient = movingGradient;
+    this->InsertCachedMovingImageGradient( m_MovingImageGradient );
+}
+
+template <class TFixedImage, class TMovingImage>
+void CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InitializeMetric( void )
+{
+    m_MetricAccums.assign( m_Blocks * m_Threads, (InternalRealType)0 );
+    m_BlockSums.assign( m_Blocks, (InternalRealType)0 );
+}
+
+/**
+ * Same computation as the OrientationMatchingMetricSparseMask kernel for a single sample
+ */
+template <class TFixedImage, class TMovingImage>
+typename CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InternalRealType
+CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::EvaluateSample(
+    unsigned int i, const InternalRealType * rc ) const
+{
+    if( i >= m_NumberOfSamples ) return 0;
+
+    const InternalRealType x = m_FixedLocationSamples[0][i];
+    const InternalRealType y = m_FixedLocationSamples[1][i];
+    const InternalRealType z = m_FixedLocationSamples[2][i];
+
+    InternalRealType cIdx[3];
+    for( int r = 0; r < 3; r++ )
+    {
+        cIdx[r] = rc[4 * r] * x + rc[4 * r + 1] * y + rc[4 * r + 2] * z + rc[4 * r + 3];
+    }
+
+    InternalRealType movingGrad[4];
+    OrientationMatchingSIMD::InterpolateGradient( m_MovingImageGradient->data(), m_MovingImageSize, cIdx, movingGrad );
+
+    if( !( ( !m_ComputeMask && ( movingGrad[3] > (InternalRealType)-1.0 ) ) ||
+           ( m_ComputeMask && ( movingGrad[3] > (InternalRealType)0.0 ) ) ) )
+    {
+        return 0;
+    }
+
+    // Transformed moving gradient and fixed gradient, both normalized
+    InternalRealType trMovingGrad[3];
+    InternalRealType fixedGrad[3];
+    InternalRealType trNorm    = 0;
+    InternalRealType fixedNorm = 0;
+    for( int r = 0; r < 3; r++ )
+    {
+        const InternalRealType * rct = rc + 12 + 4 * r;
+        trMovingGrad[r]              = rct[0] * movingGrad[0] + rct[1] * movingGrad[1] + rct[2] * movingGrad[2];
+        fixedGrad[r]                 = m_FixedGradientSamples[r][i];
+        trNorm += trMovingGrad[r] * trMovingGrad[r];
+        fixedNorm += fixedGrad[r] * fixedGrad[r];
+    }
+    if( trNorm <= 0 || fixedNorm <= 0 ) return 0;
+    trNorm    = std::sqrt( trNorm );
+    fixedNorm = std::sqrt( fixedNorm );
+
+    InternalRealType innerProduct = 0;
+    for( int r = 0; r < 3; r++ ) innerProduct += ( fixedGrad[r] / fixedNorm ) * ( trMovingGrad[r] / trNorm );
+
+    InternalRealType metricValue = 1;
+    for( unsigned int k = 0; k < m_N; k++ ) metricValue *= innerProduct;
+    return metricValue;
+}
+
+/**
+ * Sum of the metric over the samples of a block, reduced like an OpenCL work group
+ */
+template <class TFixedImage, class TMovingImage>
+typename CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InternalRealType
+CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::EvaluateBlock(
+    unsigned int block, const InternalRealType * rc, InternalRealType * metricAccums ) const
+{
+    for( unsigned int lid = 0; lid < m_Threads; lid++ )
+    {
+        metricAccums[lid] = this->EvaluateSample( block * m_Threads + lid, rc );
+    }
+    for( unsigned int s = m_Threads / 2; s > 0; s >>= 1 )
+    {
+        for( unsigned int lid = 0; lid < s; lid++ )
+        {
+            metricAccums[lid] += metricAccums[lid + s];
+        }
+    }
+    return metricAccums[0];
+}
+
+/**
+ * Sum of the metric over the samples, reduced block by block like the OpenCL work groups
+ */
+template <class TFixedImage, class TMovingImage>
+typename CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InternalRealType
+CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeMetricSum( void )
+{
+    std::fill( m_MetricAccums.begin(), m_MetricAccums.end(), (InternalRealType)0 );
+    std::fill( m_BlockSums.begin(), m_BlockSums.begin() + m_Blocks, (InternalRealType)0 );
+    m_Threader->ParallelizeArray(
+        0, m_Blocks,
+        [this]( SizeValueType block )
+        {
+            m_BlockSums[block] =
+                this->EvaluateBlock( block, m_RigidContext, m_MetricAccums.data() + block * m_Threads );
+        },
+        nullptr );
+
+    InternalRealType metricSum = 0;
+    for( unsigned int i = 0; i < m_Blocks; i++ )
+    {
+        metricSum += m_BlockSums[i];
+    }
+    return metricSum;
+}
+
+/**
+ * Sums of the metric for a batch of transform contexts, all the contexts in one pass over the blocks
+ */
+template <class TFixedImage, class TMovingImage>
+void CPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeMetricSums(
+    const std::vector<InternalRealType> & contexts, std::vector<InternalRealType> & sums )
+{
+    const unsigned int numberOfContexts = contexts.size() / 24;
+
+    // Each block evaluates every context with its own accumulators, the samples of the block are reused
+    const size_t nbrOfBlockSums = (size_t)numberOfContexts * m_Blocks;
+    if( m_BlockSums.size() < nbrOfBlockSums ) m_BlockSums.resize( nbrOfBlockSums );
+    std::fill( m_MetricAccums.begin(), m_MetricAccums.end(), (InternalRealType)0 );
+    std::fill( m_BlockSums.begin(), m_BlockSums.begin() + nbrOfBlockSums, (InternalRealType)0 );
+    m_Threader->ParallelizeArray(
+        0, m_Blocks,
+        [this, &contexts, numberOfContexts]( SizeValueType block )
+        {
+            InternalRealType * metricAccums = m_MetricAccums.data() + block * m_Threads;
+            for( unsigned int context = 0; context < numberOfContexts; context++ )
+            {
+                m_BlockSums[context * m_Blocks + block] =
+                    this->EvaluateBlock( block, contexts.data() + 24 * context, metricAccums );
+            }
+        },
+        nullptr );
+
+    sums.assign( numberOfContexts, (InternalRealType)0 );
+    for( unsigned int t = 0; t < numberOfContexts; t++ )
+    {
+        for( unsigned int i = 0; i < m_Blocks; i++ )
+        {
+            sums[t] += m_BlockSums[t * m_Blocks + i];
+        }
+    }
+}
+
+}  // end namespace itk
+
+#endif
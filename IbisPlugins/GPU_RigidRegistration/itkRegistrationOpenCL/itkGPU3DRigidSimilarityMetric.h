@@ -13,7 +13,9 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <itkEuler3DTransform.h>
 #include <itkSingleValuedCostFunction.h>
 
-#include "itkGPUOrientationMatchingMatrixTransformationSparseMask.h"
+#include <vector>
+
+#include "itkOrientationMatchingMatrixTransformationSparseMask.h"
 
 namespace itk
 {
@@ -41,64 +43,88 @@ public:
 
     typedef vnl_vector<double> VectorType;
 
-    typedef itk::GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage> GPUMetricType;
-    typedef typename GPUMetricType::Pointer GPUMetricPointer;
-    typedef typename GPUMetricType::MatrixTransformType MetricTransformType;
+    typedef itk::OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage> MetricType;
+    typedef typename MetricType::Pointer MetricPointer;
+    typedef typename MetricType::MatrixTransformType MetricTransformType;
     typedef typename MetricTransformType::Pointer MetricTransformPointer;
 
     typedef itk::Euler3DTransform<double> EulerTransformType;
     typedef EulerTransformType::Pointer EulerTransformPointer;
     typedef EulerTransformType::InputPointType PointType;
 
-    itkSetObjectMacro( GPUMetric, GPUMetricType );
+    itkSetObjectMacro( Metric, MetricType );
 
     GPU3DRigidSimilarityMetric()
     {
-        m_GPUMetric      = NULL;
-        m_EulerTransform = EulerTransformType::New();
-        m_Debug          = true;
+        m_Metric          = NULL;
+        m_EulerTransform  = EulerTransformType::New();
+        m_Debug           = true;
+        m_DeferEvaluation = false;
     }
 
     double GetValue( const ParametersType & parameters ) const override
     {
-        if( !m_GPUMetric ) itkExceptionMacro( << "GPUMetric has not been set!" );
-
-        PointType center;
-        center[0] = m_GPUMetric->GetFixedImage()->GetOrigin()[0] +
-                    m_GPUMetric->GetFixedImage()->GetSpacing()[0] *
-                        m_GPUMetric->GetFixedImage()->GetBufferedRegion().GetSize()[0] / 2.0;
-        center[1] = m_GPUMetric->GetFixedImage()->GetOrigin()[1] +
-                    m_GPUMetric->GetFixedImage()->GetSpacing()[1] *
-                        m_GPUMetric->GetFixedImage()->GetBufferedRegion().GetSize()[1] / 2.0;
-        center[2] = m_GPUMetric->GetFixedImage()->GetOrigin()[2] +
-                    m_GPUMetric->GetFixedImage()->GetSpacing()[2] *
-                        m_GPUMetric->GetFixedImage()->GetBufferedRegion().GetSize()[2] / 2.0;
-
-        m_EulerTransform->SetCenter( center );
-        m_EulerTransform->SetParameters( parameters );
+        if( !m_Metric ) itkExceptionMacro( << "Metric has not been set!" );
 
-        MetricTransformPointer tempTransform = MetricTransformType::New();
-        tempTransform->SetMatrix( m_EulerTransform->GetMatrix() );
-        tempTransform->SetOffset( m_EulerTransform->GetOffset() );
+        if( m_DeferEvaluation )
+        {
+            m_DeferredParameters.push_back( parameters );
+            return 0;
+        }
 
-        m_GPUMetric->SetTransform( tempTransform );
-        m_GPUMetric->Update();
+        m_Metric->SetTransform( this->CreateMetricTransform( parameters ) );
+        m_Metric->Update();
 
-        return -m_GPUMetric->GetMetricValue();
+        return -m_Metric->GetMetricValue();
+    }
+
+    /** Evaluate the cost function for a whole set of parameters, in a single call to the metric. */
+    void GetValues( const std::vector<ParametersType> & parameters, std::vector<MeasureType> & values ) const
+    {
+        if( !m_Metric ) itkExceptionMacro( << "Metric has not been set!" );
+
+        std::vector<typename MetricType::MatrixTransformConstPointer> transforms( parameters.size() );
+        for( unsigned int i = 0; i < parameters.size(); i++ )
+        {
+            transforms[i] = this->CreateMetricTransform( parameters[i] );
+        }
+
+        std::vector<typename MetricType::InternalRealType> metricValues;
+        m_Metric->GetValues( transforms, metricValues );
+
+        values.resize( metricValues.size() );
+        for( unsigned int i = 0; i < metricValues.size(); i++ )
+        {
+            values[i] = -metricValues[i];
+        }
+    }
+
+    /** When on, GetValue only records its parameters and returns 0. The recorded parameters are evaluated
+     *  together by EvaluateDeferredValues. This lets an optimizer that evaluates its candidates one by one
+     *  have them evaluated as a batch. */
+    void SetDeferEvaluation( bool defer ) { m_DeferEvaluation = defer; }
+
+    /** Evaluate the parameters recorded since deferred evaluation was turned on, in the order of the calls
+     *  to GetValue, and clear them. */
+    void EvaluateDeferredValues( std::vector<MeasureType> & values )
+    {
+        std::vector<ParametersType> parameters;
+        parameters.swap( m_DeferredParameters );
+        this->GetValues( parameters, values );
     }
 
     PointType GetCenter( void ) const
     {
         PointType temp;
-        temp[0] = m_GPUMetric->GetFixedImage()->GetOrigin()[0] +
-                  m_GPUMetric->GetFixedImage()->GetSpacing()[0] *
-                      m_GPUMetric->GetFixedImage()->GetBufferedRegion().GetSize()[0] / 2.0;
-        temp[1] = m_GPUMetric->GetFixedImage()->GetOrigin()[1] +
-                  m_GPUMetric->GetFixedImage()->GetSpacing()[1] *
-                      m_GPUMetric->GetFixedImage()->GetBufferedRegion().GetSize()[1] / 2.0;
-        temp[2] = m_GPUMetric->GetFixedImage()->GetOrigin()[2] +
-                  m_GPUMetric->GetFixedImage()->GetSpacing()[2] *
-                      m_GPUMetric->GetFixedImage()->GetBufferedRegion().GetSize()[2] / 2.0;
+        temp[0] = m_Metric->GetFixedImage()->GetOrigin()[0] +
+                  m_Metric->GetFixedImage()->GetSpacing()[0] *
+                      m_Metric->GetFixedImage()->GetBufferedRegion().GetSize()[0] / 2.0;
+        temp[1] = m_Metric->GetFixedImage()->GetOrigin()[1] +
+                  m_Metric->GetFixedImage()->GetSpacing()[1] *
+                      m_Metric->GetFixedImage()->GetBufferedRegion().GetSize()[1] / 2.0;
+        temp[2] = m_Metric->GetFixedImage()->GetOrigin()[2] +
+                  m_Metric->GetFixedImage()->GetSpacing()[2] *
+                      m_Metric->GetFixedImage()->GetBufferedRegion().GetSize()[2] / 2.0;
 
         return temp;
     }
@@ -111,11 +137,26 @@ public:
     unsigned int GetNumberOfParameters( void ) const override { return SpaceDimension; }
 
 private:
-    typename GPUMetricType::Pointer m_GPUMetric;
+    /** Matrix transform of the metric for the Euler parameters, rotating around the center of the fixed image. */
+    MetricTransformPointer CreateMetricTransform( const ParametersType & parameters ) const
+    {
+        m_EulerTransform->SetCenter( this->GetCenter() );
+        m_EulerTransform->SetParameters( parameters );
+
+        MetricTransformPointer tempTransform = MetricTransformType::New();
+        tempTransform->SetMatrix( m_EulerTransform->GetMatrix() );
+        tempTransform->SetOffset( m_EulerTransform->GetOffset() );
+        return tempTransform;
+    }
+
+    typename MetricType::Pointer m_Metric;
     EulerTransformPointer m_EulerTransform;
     PointType m_Center;
 
     bool m_Debug;
+
+    bool m_DeferEvaluation;
+    mutable std::vector<ParametersType> m_DeferredParameters;
 };
 
 }  // namespace itk
@@ -23,6 +23,10 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <itkTimeProbe.h>
 #include <vnl/vnl_matrix.h>
 
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
 #include "GPUDiscreteGaussianGradientImageFilter.h"
 #include "GPUOrientationMatchingMatrixTransformationSparseMaskKernel.h"
 #include "itkGPUOrientationMatchingMatrixTransformationSparseMask.h"
@@ -40,8 +44,6 @@ template <class TFixedImage, class TMovingImage>
 GPUOrientationMatchingMatrixTransformationSparseMask<
     TFixedImage, TMovingImage>::GPUOrientationMatchingMatrixTransformationSparseMask()
 {
-    m_Debug = false;
-
     if( !itk::IsGPUAvailable() )
     {
         itkExceptionMacro( << "OpenCL-enabled GPU is not present." );
@@ -50,28 +52,8 @@ GPUOrientationMatchingMatrixTransformationSparseMask<
     /* Initialize GPU Context */
     this->InitializeGPUContext();
 
-    m_OrientationMatchingKernel = 0;
-    m_Percentile                = 0.9;
-    m_N                         = 2;
-
-    m_GradientScale = 1.0;
-
-    m_ComputeMask   = true;
-    m_MaskThreshold = 0.0;
-
-    m_FixedImage  = nullptr;
-    m_MovingImage = nullptr;
-
-    m_MovingImageGradientGPUImage = nullptr;
-
-    m_Transform   = nullptr;
-    m_MetricValue = 0;
-
-    m_UseFixedImageMask            = false;
-    m_UseMovingImageMask           = false;
-    m_FixedImageMaskSpatialObject  = nullptr;
-    m_MovingImageMaskSpatialObject = nullptr;
-    SetSamplingStrategyToRandom();
+    m_OrientationMatchingKernel      = 0;
+    m_OrientationMatchingBatchKernel = 0;
 
     m_FixedImageGradientGPUBuffer  = NULL;
     m_FixedImageGPUBuffer          = NULL;
@@ -84,6 +66,9 @@ GPUOrientationMatchingMatrixTransformationSparseMask<
     m_MovingImageGradientGPUImage  = NULL;
     m_gpuMetricAccum               = NULL;
     m_gpuDummy                     = NULL;
+    m_gpuBatchContexts             = NULL;
+    m_gpuBatchMetricAccum          = NULL;
+    m_BatchCapacity                = 0;
 }
 
 template <class TFixedImage, class TMovingImage>
@@ -95,12 +80,18 @@ GPUOrientationMatchingMatrixTransformationSparseMask<
     {
         clReleaseKernel( m_OrientationMatchingKernel );
     }
+    if( m_OrientationMatchingBatchKernel )
+    {
+        clReleaseKernel( m_OrientationMatchingBatchKernel );
+    }
 
     if( m_gpuFixedGradientSamples ) clReleaseMemObject( m_gpuFixedGradientSamples );
     if( m_gpuFixedLocationSamples ) clReleaseMemObject( m_gpuFixedLocationSamples );
     if( m_MovingImageGradientGPUImage ) clReleaseMemObject( m_MovingImageGradientGPUImage );
     if( m_gpuMetricAccum ) clReleaseMemObject( m_gpuMetricAccum );
     if( m_gpuDummy ) clReleaseMemObject( m_gpuDummy );
+    if( m_gpuBatchContexts ) clReleaseMemObject( m_gpuBatchContexts );
+    if( m_gpuBatchMetricAccum ) clReleaseMemObject( m_gpuBatchMetricAccum );
     if( m_FixedImageGradientGPUBuffer ) clReleaseMemObject( m_FixedImageGradientGPUBuffer );
     if( m_FixedImageGPUBuffer ) clReleaseMemObject( m_FixedImageGPUBuffer );
     if( m_FixedImageMaskGPUBuffer ) clReleaseMemObject( m_FixedImageMaskGPUBuffer );
@@ -112,54 +103,55 @@ GPUOrientationMatchingMatrixTransformationSparseMask<
 template <class TFixedImage, class TMovingImage>
 void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InitializeGPUContext( void )
 {
-    cl_int errid;
-
-    // Get the platforms
-    errid = clGetPlatformIDs( 0, nullptr, &m_NumberOfPlatforms );
-    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
-
-    // Get NVIDIA platform by default
-    m_Platform = OpenCLSelectPlatform( "NVIDIA" );
-    assert( m_Platform != nullptr );
+    // The context and the command queues are created once and shared by all the metric objects, so that they
+    // can all use the gradient images kept by OrientationMatchingGradientCache. They are never released.
+    static std::mutex contextMutex;
+    static cl_platform_id sharedPlatform         = nullptr;
+    static cl_device_id * sharedDevices          = nullptr;
+    static cl_uint sharedNumberOfDevices         = 0;
+    static cl_uint sharedNumberOfPlatforms       = 0;
+    static cl_context sharedContext              = nullptr;
+    static cl_command_queue * sharedCommandQueue = nullptr;
+
+    std::lock_guard<std::mutex> lock( contextMutex );
+    if( !sharedContext )
+    {
+        cl_int errid;
+
+        // Get the platforms
+        errid = clGetPlatformIDs( 0, nullptr, &sharedNumberOfPlatforms );
+        OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
-    cl_device_type devType = CL_DEVICE_TYPE_GPU;
-    m_Devices              = OpenCLGetAvailableDevices( m_Platform, devType, &m_NumberOfDevices );
+        // Get NVIDIA platform by default
+        sharedPlatform = OpenCLSelectPlatform( "NVIDIA" );
+        if( sharedPlatform == nullptr )
+        {
+            itkExceptionMacro( << "No OpenCL platform found." );
+        }
 
-    // create context
-    m_Context = clCreateContext( 0, m_NumberOfDevices, m_Devices, nullptr, nullptr, &errid );
-    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+        cl_device_type devType = CL_DEVICE_TYPE_GPU;
+        sharedDevices          = OpenCLGetAvailableDevices( sharedPlatform, devType, &sharedNumberOfDevices );
 
-    // create command queues
-    m_CommandQueue = (cl_command_queue *)malloc( m_NumberOfDevices * sizeof( cl_command_queue ) );
-    for( unsigned int i = 0; i < m_NumberOfDevices; i++ )
-    {
-        m_CommandQueue[i] = clCreateCommandQueue( m_Context, m_Devices[i], 0, &errid );
+        // create context
+        cl_context context = clCreateContext( 0, sharedNumberOfDevices, sharedDevices, nullptr, nullptr, &errid );
         OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
-    }
-}
-
-/**
- * Standard "PrintSelf" method.
- */
-template <class TFixedImage, class TMovingImage>
-void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::PrintSelf( std::ostream & os,
-                                                                                                 Indent indent ) const
-{
-    Superclass::PrintSelf( os, indent );
 
-    // GetTypenameInString( typeid(TElement), os);
-}
+        // create command queues
+        sharedCommandQueue = (cl_command_queue *)malloc( sharedNumberOfDevices * sizeof( cl_command_queue ) );
+        for( unsigned int i = 0; i < sharedNumberOfDevices; i++ )
+        {
+            sharedCommandQueue[i] = clCreateCommandQueue( context, sharedDevices[i], 0, &errid );
+            OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+        }
+        sharedContext = context;
+    }
 
-template <class TFixedImage, class TMovingImage>
-unsigned int GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::NextPow2( unsigned int x )
-{
-    --x;
-    x |= x >> 1;
-    x |= x >> 2;
-    x |= x >> 4;
-    x |= x >> 8;
-    x |= x >> 16;
-    return ++x;
+    m_NumberOfPlatforms = sharedNumberOfPlatforms;
+    m_Platform          = sharedPlatform;
+    m_NumberOfDevices   = sharedNumberOfDevices;
+    m_Devices           = sharedDevices;
+    m_Context           = sharedContext;
+    m_CommandQueue      = sharedCommandQueue;
 }
 
 /**
@@ -228,17 +220,12 @@ cl_kernel GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMov
 }
 
 /**
- * Compute Gradients of Fixed and Moving Image
+ * Compute Gradient of Fixed Image
  */
 template <class TFixedImage, class TMovingImage>
-void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeFixedImageGradient( void )
+void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeFixedImageGradient(
+    std::vector<InternalRealType> & fixedGradient )
 {
-    if( !m_FixedImage )
-    {
-        itkExceptionMacro( << "Fixed Image is not set" );
-    }
-    m_FixedImage->Update();
-
     itk::TimeProbe clockGPUKernel;
     clockGPUKernel.Start();
     /*Create Fixed Image Buffer */
@@ -255,32 +242,16 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
     imgSize[1] = m_FixedImage->GetLargestPossibleRegion().GetSize()[1];
     imgSize[2] = m_FixedImage->GetLargestPossibleRegion().GetSize()[2];
 
-    InternalRealType * cpuFixedGradientBuffer =
-        (InternalRealType *)malloc( 4 * nbrOfPixelsInFixedImage * sizeof( InternalRealType ) );
-    memset( cpuFixedGradientBuffer, (InternalRealType)0, 4 * nbrOfPixelsInFixedImage * sizeof( InternalRealType ) );
+    fixedGradient.assign( 4 * nbrOfPixelsInFixedImage, (InternalRealType)0 );
+    InternalRealType * cpuFixedGradientBuffer = fixedGradient.data();
 
     m_FixedImageGradientGPUBuffer =
         clCreateBuffer( m_Context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
                         4 * sizeof( FixedImagePixelType ) * nbrOfPixelsInFixedImage, cpuFixedGradientBuffer, &errid );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
-    FixedImageMaskPixelType * fixedMaskBuffer;
-    if( ( m_UseFixedImageMask ) && ( m_FixedImageMaskSpatialObject ) )
-    {
-        fixedMaskBuffer = (FixedImageMaskPixelType *)m_FixedImageMaskSpatialObject->GetImage()->GetBufferPointer();
-    }
-    else
-    {
-        if( m_UseFixedImageMask )
-        {
-            itkWarningMacro( << "FixedImageMaskSpatialObject was not found, UseFixedImageMask is set to OFF" );
-            m_UseFixedImageMask = false;
-        }
-        fixedMaskBuffer =
-            (FixedImageMaskPixelType *)malloc( nbrOfPixelsInFixedImage * sizeof( FixedImageMaskPixelType ) );
-        memset( fixedMaskBuffer, (FixedImageMaskPixelType)1,
-                nbrOfPixelsInFixedImage * sizeof( FixedImageMaskPixelType ) );
-    }
+    std::vector<FixedImageMaskPixelType> defaultMask;
+    const FixedImageMaskPixelType * fixedMaskBuffer = this->GetFixedImageMaskBuffer( defaultMask );
     m_FixedImageMaskGPUBuffer = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                                                 sizeof( FixedImageMaskPixelType ) * nbrOfPixelsInFixedImage,
                                                 (unsigned char *)fixedMaskBuffer, &errid );
@@ -288,38 +259,13 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
 
     /* Create Gauss Derivative Operator and Populate GPU Buffer */
     std::vector<FixedDerivativeOperatorType> opers;
-    opers.resize( FixedImageDimension );
-    m_GPUDerivOperatorBuffers.resize( FixedImageDimension );
-
     std::vector<InternalRealType> kernelNorms;
-    kernelNorms.resize( FixedImageDimension );
+    this->CreateDerivativeOperators( m_FixedImage->GetSpacing(), opers, kernelNorms );
+    m_GPUDerivOperatorBuffers.resize( FixedImageDimension );
     for( int dim = 0; dim < FixedImageDimension; dim++ )
     {
-        // Set up the operator for this dimension
-        opers[dim].SetDirection( dim );
-        opers[dim].SetOrder( 1 );
-        // convert the variance from physical units to pixels
-        double s = m_FixedImage->GetSpacing()[dim];
-        s        = s * s;
-        opers[dim].SetVariance( m_GradientScale / s );
-
-        opers[dim].CreateDirectional();
-
-        unsigned int numberOfElements = 1;
-        for( int j = 0; j < FixedImageDimension; j++ )
-        {
-            numberOfElements *= opers[dim].GetSize()[j];
-        }
-
-        kernelNorms[dim] = 0;
-        for( unsigned int k = 0; k < opers[dim].GetSize( 0 ); k++ )
-        {
-            kernelNorms[dim] += pow( opers[dim].GetElement( k ), 2 );
-        }
-        kernelNorms[dim] = sqrt( kernelNorms[dim] );
-
         m_GPUDerivOperatorBuffers[dim] = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                                         sizeof( InternalRealType ) * numberOfElements,
+                                                         sizeof( InternalRealType ) * opers[dim].Size(),
                                                          (InternalRealType *)opers[dim].Begin(), &errid );
         OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
     }
@@ -394,6 +340,7 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
     errid = clFinish( m_CommandQueue[0] );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
+
 #ifdef __OUTPUT_GRADIENTS__
     {
         using GradientPixelType                 = itk::Vector<float, 3>;
@@ -449,265 +396,6 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
     clockGPUKernel.Stop();
     if( m_Debug ) std::cerr << "Fixed Image Gradient GPU Kernel took:\t" << clockGPUKernel.GetMean() << std::endl;
 
-    FixedGradientMagnitudeSampleType::Pointer sample = FixedGradientMagnitudeSampleType::New();
-    IdxSampleType::Pointer maskIdxSample             = IdxSampleType::New();
-
-    itk::TimeProbe clock;
-    clock.Start();
-
-    // process full sampling separately
-    if( m_SamplingStrategy == FULL )
-    {
-        typename FixedImageType::RegionType region = m_FixedImage->GetRequestedRegion();
-        typename FixedImageType::SizeType size     = region.GetSize();
-        typename FixedImageType::IndexType start   = region.GetIndex();
-        region.SetIndex( start );
-        region.SetSize( size );
-
-        FixedImageIteratorType imageIterator( m_FixedImage, region );
-        for( imageIterator.GoToBegin(); !imageIterator.IsAtEnd(); ++imageIterator )
-        {
-            unsigned int idx = static_cast<unsigned int>( m_FixedImage->ComputeOffset( imageIterator.GetIndex() ) );
-
-            if( ( !m_ComputeMask && ( cpuFixedGradientBuffer[idx * 4 + 3] > (InternalRealType)-1.0 ) ) ||
-                ( m_ComputeMask && ( cpuFixedGradientBuffer[idx * 4 + 3] > (InternalRealType)0.0 ) ) )
-            {
-                InternalRealType magnitudeValue = 0;
-                MeasurementVectorType tempSample;
-
-                for( unsigned int d = 0; d < FixedImageDimension; ++d )
-                {
-                    magnitudeValue += pow( cpuFixedGradientBuffer[idx * 4 + d] / kernelNorms[d], 2.0 );
-                }
-                magnitudeValue = sqrt( magnitudeValue );
-                tempSample[0]  = magnitudeValue;
-
-                if( imageIterator.Get() > 0 )
-                {
-                    sample->PushBack( tempSample );
-                    maskIdxSample->PushBack( idx );
-                }
-            }
-        }
-    }
-    else
-    {
-        typename ImageSamplerType::Pointer imageSampler            = nullptr;
-        typename SampleContainerType::Pointer imageSampleContainer = SampleContainerType::New();
-        SampleType imageSample;
-        typename FixedImageType::RegionType bufferedRegion = m_FixedImage->GetBufferedRegion();
-        typename FixedImageType::IndexType imageIndex;
-        unsigned int nbrOfPixelsForHistogram = 100000;
-
-        if( ( m_SamplingStrategy == RANDOM ) )
-        {
-            typename RandomImageSamplerType::Pointer temporaryImageSampler = RandomImageSamplerType::New();
-            temporaryImageSampler->SetNumberOfSamples( nbrOfPixelsForHistogram );
-            imageSampler = temporaryImageSampler;
-        }
-        else if( m_SamplingStrategy == GRID )
-        {
-            typename GridImageSamplerType::Pointer temporaryImageSampler = GridImageSamplerType::New();
-            temporaryImageSampler->SetNumberOfSamples( nbrOfPixelsForHistogram );
-            imageSampler = temporaryImageSampler;
-        }
-
-        imageSampler->SetInput( m_FixedImage );
-        imageSampler->SetInputImageRegion( bufferedRegion );
-
-        try
-        {
-            imageSampler->Update();
-        }
-        catch( itk::ExceptionObject & err )
-        {
-            std::cerr << err << std::endl;
-            std::cerr << "Cannot grid sample the image" << std::endl;
-        }
-
-        imageSampleContainer = imageSampler->GetOutput();
-
-        for( unsigned int i = 0; i < imageSampleContainer->Size(); ++i )
-        {
-            imageSample = imageSampleContainer->ElementAt( i );
-            m_FixedImage->TransformPhysicalPointToIndex( imageSample.m_ImageCoordinates, imageIndex );
-            if( bufferedRegion.IsInside( imageIndex ) )
-            {
-                InternalRealType magnitudeValue = 0;
-                MeasurementVectorType tempSample;
-                unsigned int idx = static_cast<unsigned int>( m_FixedImage->ComputeOffset( imageIndex ) );
-                for( unsigned int d = 0; d < FixedImageDimension; ++d )
-                {
-                    magnitudeValue += pow( cpuFixedGradientBuffer[idx * 4 + d] / kernelNorms[d], 2.0 );
-                }
-                magnitudeValue = sqrt( magnitudeValue );
-                tempSample[0]  = magnitudeValue;
-                if( ( !m_ComputeMask && ( cpuFixedGradientBuffer[idx * 4 + 3] > (InternalRealType)-1.0 ) ) ||
-                    ( m_ComputeMask && ( cpuFixedGradientBuffer[idx * 4 + 3] > (InternalRealType)0.0 ) ) )
-                {
-                    sample->PushBack( tempSample );
-                    maskIdxSample->PushBack( idx );
-                }
-            }
-        }
-    }
-
-    if( m_Debug )
-    {
-        std::cerr << "Sample Size:\t" << sample->Size() << std::endl;
-    }
-
-    itk::TimeProbe clock2;
-    clock2.Start();
-    SampleToHistogramFilterType::Pointer sampleToHistogramFilter = SampleToHistogramFilterType::New();
-    sampleToHistogramFilter->SetInput( sample );
-
-    SampleToHistogramFilterType::HistogramSizeType histogramSize( 1 );
-    histogramSize.Fill( 100 );
-    sampleToHistogramFilter->SetHistogramSize( histogramSize );
-
-    sampleToHistogramFilter->Update();
-    HistogramType::ConstPointer histogram = sampleToHistogramFilter->GetOutput();
-
-    InternalRealType magnitudeThreshold = histogram->Quantile( 0, m_Percentile );
-
-    clock2.Stop();
-    if( m_Debug )
-    {
-        std::cerr << "Computing histogram took:\t" << clock2.GetMean() << std::endl;
-        std::cerr << "Magnitude Threshold:\t" << magnitudeThreshold << std::endl;
-    }
-
-    unsigned int maxThreads = 256;
-    m_Threads = ( m_NumberOfPixels < maxThreads * 2 ) ? this->NextPow2( ( m_NumberOfPixels + 1 ) / 2 ) : maxThreads;
-    m_Blocks  = ( m_NumberOfPixels + m_Threads - 1 ) / ( m_Threads );
-
-    m_cpuFixedGradientSamples = (InternalRealType *)malloc( m_Blocks * m_Threads * 4 * sizeof( InternalRealType ) );
-    memset( m_cpuFixedGradientSamples, (InternalRealType)0, 4 * m_Blocks * m_Threads * sizeof( InternalRealType ) );
-
-    m_cpuFixedLocationSamples = (InternalRealType *)malloc( m_Blocks * m_Threads * 4 * sizeof( InternalRealType ) );
-    memset( m_cpuFixedLocationSamples, (InternalRealType)0, 4 * m_Blocks * m_Threads * sizeof( InternalRealType ) );
-
-    unsigned int numberOfSamples = m_Blocks * m_Threads;
-
-    // process full sampling separately
-    if( m_SamplingStrategy == FULL )
-    {
-        typename FixedImageType::RegionType region = m_FixedImage->GetRequestedRegion();
-        typename FixedImageType::SizeType size     = region.GetSize();
-        typename FixedImageType::IndexType start   = region.GetIndex();
-        region.SetIndex( start );
-        region.SetSize( size );
-
-        FixedImageIteratorType imageIterator( m_FixedImage, region );
-        unsigned int pixelCntr = 0;
-
-        for( imageIterator.GoToBegin(); !imageIterator.IsAtEnd() & ( pixelCntr < numberOfSamples ); ++imageIterator )
-        {
-            unsigned int idx = static_cast<unsigned int>( m_FixedImage->ComputeOffset( imageIterator.GetIndex() ) );
-
-            if( ( !m_ComputeMask && ( cpuFixedGradientBuffer[idx * 4 + 3] > (InternalRealType)-1.0 ) ) ||
-                ( m_ComputeMask && ( cpuFixedGradientBuffer[idx * 4 + 3] > (InternalRealType)0.0 ) ) )
-            {
-                InternalRealType magnitudeValue = 0;
-
-                for( unsigned int d = 0; d < FixedImageDimension; ++d )
-                {
-                    magnitudeValue += pow( cpuFixedGradientBuffer[idx * 4 + d] / kernelNorms[d], 2.0 );
-                }
-                magnitudeValue = sqrt( magnitudeValue );
-
-                if( magnitudeValue > magnitudeThreshold )
-                {
-                    typename FixedImageType::PointType fixedLocation;
-                    this->m_FixedImage->TransformIndexToPhysicalPoint( imageIterator.GetIndex(), fixedLocation );
-                    for( unsigned int d = 0; d < FixedImageDimension; ++d )
-                    {
-                        m_cpuFixedGradientSamples[4 * pixelCntr + d] = cpuFixedGradientBuffer[idx * 4 + d];
-                        m_cpuFixedLocationSamples[4 * pixelCntr + d] = (InternalRealType)fixedLocation[d];
-                    }
-                    m_cpuFixedLocationSamples[4 * pixelCntr + 3] = (InternalRealType)1.0;
-                    pixelCntr++;
-                }
-            }
-        }
-    }
-    else
-    {
-        typename ImageSamplerType::Pointer imageSampler            = nullptr;
-        typename SampleContainerType::Pointer imageSampleContainer = SampleContainerType::New();
-        SampleType imageSample;
-        typename FixedImageType::RegionType bufferedRegion = m_FixedImage->GetBufferedRegion();
-        typename FixedImageType::IndexType imageIndex;
-
-        if( m_SamplingStrategy == RANDOM )
-        {
-            typename RandomImageSamplerType::Pointer temporaryImageSampler = RandomImageSamplerType::New();
-            temporaryImageSampler->SetNumberOfSamples( m_NumberOfPixels );
-            imageSampler = temporaryImageSampler;
-        }
-        else if( m_SamplingStrategy == GRID )
-        {
-            typename GridImageSamplerType::Pointer temporaryImageSampler = GridImageSamplerType::New();
-            temporaryImageSampler->SetNumberOfSamples( m_NumberOfPixels );
-            imageSampler = temporaryImageSampler;
-        }
-
-        imageSampler->SetInput( m_FixedImage );
-        imageSampler->SetInputImageRegion( bufferedRegion );
-
-        try
-        {
-            imageSampler->Update();
-        }
-        catch( itk::ExceptionObject & err )
-        {
-            std::cerr << err << std::endl;
-            std::cerr << "Cannot grid sample the image" << std::endl;
-        }
-
-        imageSampleContainer = imageSampler->GetOutput();
-
-        unsigned int pixelCntr = 0;
-        for( unsigned int i = 0; i < imageSampleContainer->Size(); ++i )
-        {
-            if( imageSampleContainer->GetElementIfIndexExists( i, &imageSample ) )
-            {
-                m_FixedImage->TransformPhysicalPointToIndex( imageSample.m_ImageCoordinates, imageIndex );
-                if( bufferedRegion.IsInside( imageIndex ) )
-                {
-                    unsigned int idx = static_cast<unsigned int>( m_FixedImage->ComputeOffset( imageIndex ) );
-                    if( ( !m_ComputeMask && ( cpuFixedGradientBuffer[idx * 4 + 3] > (InternalRealType)-1.0 ) ) ||
-                        ( m_ComputeMask && ( cpuFixedGradientBuffer[idx * 4 + 3] > (InternalRealType)0.0 ) ) )
-                    {
-                        InternalRealType magnitudeValue = 0.0;
-                        for( unsigned int d = 0; d < FixedImageDimension; ++d )
-                        {
-                            magnitudeValue += pow( cpuFixedGradientBuffer[idx * 4 + d] / kernelNorms[d], 2.0 );
-                        }
-                        magnitudeValue = sqrt( magnitudeValue );
-                        if( magnitudeValue > magnitudeThreshold )
-                        {
-                            typename FixedImageType::PointType fixedLocation;
-                            this->m_FixedImage->TransformIndexToPhysicalPoint( m_FixedImage->ComputeIndex( idx ),
-                                                                               fixedLocation );
-                            for( unsigned int d = 0; d < FixedImageDimension; ++d )
-                            {
-                                m_cpuFixedGradientSamples[4 * pixelCntr + d] = cpuFixedGradientBuffer[idx * 4 + d];
-                                m_cpuFixedLocationSamples[4 * pixelCntr + d] = (InternalRealType)fixedLocation[d];
-                            }
-                            m_cpuFixedLocationSamples[4 * pixelCntr + 3] = (InternalRealType)1.0;
-                            pixelCntr++;
-                        }
-                    }
-                }
-            }
-        }
-    }
-
-    clock.Stop();
-    if( m_Debug ) std::cerr << "Post-Processing Fixed Image Gradient took:\t" << clock.GetMean() << std::endl;
-
     clReleaseKernel( m_GradientKernel );
     clReleaseMemObject( m_FixedImageGradientGPUBuffer );
     clReleaseMemObject( m_FixedImageGPUBuffer );
@@ -719,24 +407,46 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
     {
         clReleaseMemObject( m_GPUDerivOperatorBuffers[d] );
     }
-    delete[] cpuFixedGradientBuffer;
 }
 
 /**
- * Compute Gradients of Fixed and Moving Image
+ * Compute Gradient of Moving Image
  */
 template <class TFixedImage, class TMovingImage>
 void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeMovingImageGradient( void )
 {
-    if( !m_MovingImage )
+    unsigned int nbrOfPixelsInMovingImage = m_MovingImage->GetBufferedRegion().GetNumberOfPixels();
+
+    int imgSize[3];
+    imgSize[0] = m_MovingImage->GetLargestPossibleRegion().GetSize()[0];
+    imgSize[1] = m_MovingImage->GetLargestPossibleRegion().GetSize()[1];
+    imgSize[2] = m_MovingImage->GetLargestPossibleRegion().GetSize()[2];
+
+    if( m_CacheMovingImageGradient )
     {
-        itkExceptionMacro( << "Moving Image is not set" );
+        OrientationMatchingGradientCache::Pointer cache = OrientationMatchingGradientCache::GetInstance();
+        GradientCacheKey key                            = this->GetMovingImageGradientKey();
+
+        m_MovingImageGradientGPUImage = cache->FindGPUImage( key, m_Context );
+        if( m_MovingImageGradientGPUImage )
+        {
+            if( m_Debug ) std::cout << "Using cached moving image gradient" << std::endl;
+            return;
+        }
+
+        GradientPointer movingGradient = cache->FindGradient( key );
+        if( movingGradient )
+        {
+            if( m_Debug ) std::cout << "Uploading cached moving image gradient" << std::endl;
+            m_MovingImageGradientGPUImage = this->CreateGradientImage( imgSize, movingGradient->data() );
+            cache->InsertGPUImage( key, m_Context, m_MovingImageGradientGPUImage );
+            return;
+        }
     }
+
     if( m_Debug ) std::cout << "Computing Moving Image Gradient" << std::endl;
     /*Create Moving Image Buffer */
 
-    unsigned int nbrOfPixelsInMovingImage = m_MovingImage->GetBufferedRegion().GetNumberOfPixels();
-
     cl_int errid;
 
     m_MovingImageGPUBuffer = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
@@ -744,11 +454,6 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
                                              m_MovingImage->GetBufferPointer(), &errid );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
-    int imgSize[3];
-    imgSize[0] = m_MovingImage->GetLargestPossibleRegion().GetSize()[0];
-    imgSize[1] = m_MovingImage->GetLargestPossibleRegion().GetSize()[1];
-    imgSize[2] = m_MovingImage->GetLargestPossibleRegion().GetSize()[2];
-
 #ifdef __OUTPUT_GRADIENTS__
     InternalRealType * cpuMovingGradientBuffer =
         (InternalRealType *)malloc( 4 * nbrOfPixelsInMovingImage * sizeof( InternalRealType ) );
@@ -764,24 +469,8 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
 
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
-    MovingImageMaskPixelType * movingMaskBuffer;
-    if( ( m_UseMovingImageMask ) && ( m_MovingImageMaskSpatialObject ) )
-    {
-        movingMaskBuffer = (MovingImageMaskPixelType *)m_MovingImageMaskSpatialObject->GetImage()->GetBufferPointer();
-    }
-    else
-    {
-        if( m_UseMovingImageMask )
-        {
-            itkWarningMacro( << "MovingImageMaskSpatialObject was not found, UseMovingImageMask is set to OFF" );
-            m_UseMovingImageMask = false;
-        }
-
-        movingMaskBuffer =
-            (MovingImageMaskPixelType *)malloc( nbrOfPixelsInMovingImage * sizeof( MovingImageMaskPixelType ) );
-        memset( movingMaskBuffer, (MovingImageMaskPixelType)1,
-                nbrOfPixelsInMovingImage * sizeof( MovingImageMaskPixelType ) );
-    }
+    std::vector<MovingImageMaskPixelType> defaultMask;
+    const MovingImageMaskPixelType * movingMaskBuffer = this->GetMovingImageMaskBuffer( defaultMask );
 
     m_MovingImageMaskGPUBuffer = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
                                                  sizeof( MovingImageMaskPixelType ) * nbrOfPixelsInMovingImage,
@@ -790,38 +479,13 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
 
     /* Create Gauss Derivative Operator and Populate GPU Buffer */
     std::vector<MovingDerivativeOperatorType> opers;
-    opers.resize( MovingImageDimension );
-    m_GPUDerivOperatorBuffers.resize( MovingImageDimension );
-
     std::vector<InternalRealType> kernelNorms;
-    kernelNorms.resize( MovingImageDimension );
+    this->CreateDerivativeOperators( m_MovingImage->GetSpacing(), opers, kernelNorms );
+    m_GPUDerivOperatorBuffers.resize( MovingImageDimension );
     for( int dim = 0; dim < MovingImageDimension; dim++ )
     {
-        // Set up the operator for this dimension
-        opers[dim].SetDirection( dim );
-        opers[dim].SetOrder( 1 );
-        // convert the variance from physical units to pixels
-        double s = m_MovingImage->GetSpacing()[dim];
-        s        = s * s;
-        opers[dim].SetVariance( m_GradientScale / s );
-
-        opers[dim].CreateDirectional();
-
-        unsigned int numberOfElements = 1;
-        for( int j = 0; j < MovingImageDimension; j++ )
-        {
-            numberOfElements *= opers[dim].GetSize()[j];
-        }
-
-        kernelNorms[dim] = 0;
-        for( unsigned int k = 0; k < opers[dim].GetSize( 0 ); k++ )
-        {
-            kernelNorms[dim] += pow( opers[dim].GetElement( k ), 2 );
-        }
-        kernelNorms[dim] = sqrt( kernelNorms[dim] );
-
         m_GPUDerivOperatorBuffers[dim] = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                                         sizeof( InternalRealType ) * numberOfElements,
+                                                         sizeof( InternalRealType ) * opers[dim].Size(),
                                                          (InternalRealType *)opers[dim].Begin(), &errid );
         OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
     }
@@ -882,26 +546,8 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
     errid = clFinish( m_CommandQueue[0] );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
-    cl_image_format gpu_gradient_image_format;
-    gpu_gradient_image_format.image_channel_order     = CL_RGBA;
-    gpu_gradient_image_format.image_channel_data_type = CL_FLOAT;
-
-    cl_image_desc desc;
-    desc.image_type        = CL_MEM_OBJECT_IMAGE3D;
-    desc.image_width       = imgSize[0];
-    desc.image_height      = imgSize[1];
-    desc.image_depth       = imgSize[2];
-    desc.image_array_size  = 0;
-    desc.image_row_pitch   = 0;
-    desc.image_slice_pitch = 0;
-    desc.num_mip_levels    = 0;
-    desc.num_samples       = 0;
-    desc.buffer            = nullptr;
-
     m_cpuMovingGradientImageBuffer = nullptr;
-    m_MovingImageGradientGPUImage  = clCreateImage( m_Context, CL_MEM_READ_ONLY, &( gpu_gradient_image_format ), &desc,
-                                                   m_cpuMovingGradientImageBuffer, &errid );
-    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+    m_MovingImageGradientGPUImage  = this->CreateGradientImage( imgSize, m_cpuMovingGradientImageBuffer );
 
     size_t origin[3] = { 0, 0, 0 };
     size_t region[3] = { ( size_t )( imgSize[0] ), ( size_t )( imgSize[1] ), ( size_t )( imgSize[2] ) };
@@ -910,6 +556,22 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
     errid            = clFinish( m_CommandQueue[0] );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
+    if( m_CacheMovingImageGradient )
+    {
+        // Keep the gradient on the host as well, for the metrics created in another context or on the CPU
+        std::shared_ptr<std::vector<InternalRealType> > movingGradient =
+            std::make_shared<std::vector<InternalRealType> >( 4 * nbrOfPixelsInMovingImage );
+        errid = clEnqueueReadBuffer( m_CommandQueue[0], m_MovingImageGradientGPUBuffer, CL_TRUE, 0,
+                                     nbrOfPixelsInMovingImage * 4 * sizeof( InternalRealType ), movingGradient->data(),
+                                     0, nullptr, nullptr );
+        OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+        OrientationMatchingGradientCache::Pointer cache = OrientationMatchingGradientCache::GetInstance();
+        GradientCacheKey key                            = this->GetMovingImageGradientKey();
+        cache->InsertGradient( key, movingGradient );
+        cache->InsertGPUImage( key, m_Context, m_MovingImageGradientGPUImage );
+    }
+
 #ifdef __OUTPUT_GRADIENTS__
     {
         errid = clEnqueueReadBuffer( m_CommandQueue[0], m_MovingImageGradientGPUBuffer, CL_TRUE, 0,
@@ -985,142 +647,104 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
 }
 
 /**
- * Update Metric Value
+ * Create the 3D RGBA image of a gradient volume, initialized from hostGradient if it is not null
  */
 template <class TFixedImage, class TMovingImage>
-void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::CreateGPUVariablesForCostFunction(
-    void )
+cl_mem GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::CreateGradientImage(
+    const int imgSize[3], const InternalRealType * hostGradient )
 {
-    MovingImageDirectionType movingIndexToLocation = m_MovingImage->GetDirection();
+    cl_image_format gpu_gradient_image_format;
+    gpu_gradient_image_format.image_channel_order     = CL_RGBA;
+    gpu_gradient_image_format.image_channel_data_type = CL_FLOAT;
 
-    MovingImageDirectionType scale;
+    cl_image_desc desc;
+    desc.image_type        = CL_MEM_OBJECT_IMAGE3D;
+    desc.image_width       = imgSize[0];
+    desc.image_height      = imgSize[1];
+    desc.image_depth       = imgSize[2];
+    desc.image_array_size  = 0;
+    desc.image_row_pitch   = 0;
+    desc.image_slice_pitch = 0;
+    desc.num_mip_levels    = 0;
+    desc.num_samples       = 0;
+    desc.buffer            = nullptr;
 
-    for( unsigned int i = 0; i < MovingImageDimension; i++ )
-    {
-        scale[i][i] = m_MovingImage->GetSpacing()[i];
-    }
-    movingIndexToLocation = movingIndexToLocation * scale;
+    cl_mem_flags flags = CL_MEM_READ_ONLY;
+    if( hostGradient ) flags |= CL_MEM_COPY_HOST_PTR;
 
-    MovingImageDirectionType movingLocationToIndex = MovingImageDirectionType( movingIndexToLocation.GetInverse() );
-    MovingImagePointType movingOrigin              = m_MovingImage->GetOrigin();
+    cl_int errid;
+    cl_mem image = clCreateImage( m_Context, flags, &( gpu_gradient_image_format ), &desc, (void *)hostGradient,
+                                  &errid );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+    return image;
+}
 
-    for( unsigned int i = 0; i < MovingImageDimension; i++ )
+/**
+ * Upload the samples and build the metric kernel
+ */
+template <class TFixedImage, class TMovingImage>
+void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InitializeMetric( void )
+{
+    // The kernel reads the samples as float4: (gx, gy, gz, 0) and (x, y, z, 1). Padding samples are left to 0.
+    unsigned int numberOfSamples = m_Blocks * m_Threads;
+    std::vector<InternalRealType> fixedGradientSamples( 4 * numberOfSamples, (InternalRealType)0 );
+    std::vector<InternalRealType> fixedLocationSamples( 4 * numberOfSamples, (InternalRealType)0 );
+    for( unsigned int i = 0; i < m_NumberOfSamples; ++i )
     {
-        m_mOrigin[i] = movingOrigin[i];
-        for( unsigned int j = 0; j < MovingImageDimension; j++ )
+        for( unsigned int d = 0; d < 3; ++d )
         {
-            m_locToIdx[i][j] = movingLocationToIndex[i][j];
+            fixedGradientSamples[4 * i + d] = m_FixedGradientSamples[d][i];
+            fixedLocationSamples[4 * i + d] = m_FixedLocationSamples[d][i];
         }
+        fixedLocationSamples[4 * i + 3] = (InternalRealType)1.0;
     }
 
     cl_int errid;
-    unsigned int dummySize = 24;
-    m_cpuDummy             = (InternalRealType *)malloc( dummySize * sizeof( InternalRealType ) );
-    memset( m_cpuDummy, 0, dummySize * sizeof( InternalRealType ) );
-    m_gpuDummy = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                 dummySize * sizeof( InternalRealType ), m_cpuDummy, &errid );
+    m_gpuDummy = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, 24 * sizeof( InternalRealType ),
+                                 m_RigidContext, &errid );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
     m_gpuMetricAccum = clCreateBuffer( m_Context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
                                        m_Blocks * sizeof( InternalRealType ), nullptr, &errid );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
-    m_gpuFixedGradientSamples =
-        clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                        m_Blocks * m_Threads * 4 * sizeof( InternalRealType ), m_cpuFixedGradientSamples, &errid );
+    m_gpuFixedGradientSamples = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                                numberOfSamples * 4 * sizeof( InternalRealType ),
+                                                fixedGradientSamples.data(), &errid );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
-    m_gpuFixedLocationSamples =
-        clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                        m_Blocks * m_Threads * 4 * sizeof( InternalRealType ), m_cpuFixedLocationSamples, &errid );
+    m_gpuFixedLocationSamples = clCreateBuffer( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                                numberOfSamples * 4 * sizeof( InternalRealType ),
+                                                fixedLocationSamples.data(), &errid );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
-}
 
-/**
- * Update Metric Value
- */
-template <class TFixedImage, class TMovingImage>
-void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::UpdateGPUTransformVariables(
-    void )
-{
-    m_TransformMatrix = m_Transform->GetMatrix();
-    m_TransformOffset = m_Transform->GetOffset();
-
-    m_matrixDummy     = m_locToIdx * m_TransformMatrix.GetVnlMatrix();
-    m_matrixTranspose = m_TransformMatrix.GetVnlMatrix().transpose();
-    m_OffsetOrigin    = m_TransformOffset.GetVnlVector() - m_mOrigin;
-    m_vectorDummy     = m_locToIdx * m_OffsetOrigin;
-    for( unsigned int i = 0; i < MovingImageDimension; i++ )
-    {
-        for( unsigned int j = 0; j < MovingImageDimension; j++ )
-        {
-            m_cpuDummy[4 * i + j]      = m_matrixDummy[i][j];
-            m_cpuDummy[4 * i + j + 12] = m_matrixTranspose[i][j];
-        }
-        m_cpuDummy[4 * i + 3] = m_vectorDummy[i];
-    }
+    /* Build Orientation Matching Kernel */
+    std::ostringstream defines2;
+    defines2 << "#define SEL " << m_N << std::endl;
+    defines2 << "#define N " << m_Blocks * m_Threads << std::endl;
+    defines2 << "#define LOCALSIZE " << m_Threads << std::endl;
+    defines2 << "#define USEMASK " << m_ComputeMask << std::endl;
 
-    cl_int errid;
-    errid = clEnqueueWriteBuffer( m_CommandQueue[0], m_gpuDummy, CL_TRUE, 0, 24 * sizeof( InternalRealType ),
-                                  m_cpuDummy, 0, nullptr, nullptr );
+    m_OrientationMatchingKernel =
+        CreateKernelFromString( GPUOrientationMatchingMatrixTransformationSparseMaskKernel, defines2.str().c_str(),
+                                "OrientationMatchingMetricSparseMask", "" );
+
+    // The batch kernel comes from the same program
+    m_OrientationMatchingBatchKernel = clCreateKernel( m_Program, "OrientationMatchingMetricSparseMaskBatch", &errid );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 }
 
 /**
- * Update Metric Value
+ * Evaluate the metric for the current transform and add up the sums of the work groups
  */
 template <class TFixedImage, class TMovingImage>
-void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::Update( void )
+typename GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InternalRealType
+GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeMetricSum( void )
 {
-    if( !m_Transform )
-    {
-        itkExceptionMacro( << "Transform is not set." );
-    }
-
-    if( m_UseFixedImageMask )
-    {
-        if( !m_FixedImageMaskSpatialObject )
-        {
-            itkWarningMacro( << "FixedImageMaskSpatialObject was not found, UseFixedImageMask is set to OFF" );
-            m_UseFixedImageMask = false;
-        }
-    }
-
-    if( m_UseMovingImageMask )
-    {
-        if( !m_MovingImageMaskSpatialObject )
-        {
-            itkWarningMacro( << "MovingImageMaskSpatialObject was not found, UseMovingImageMask is set to OFF" );
-            m_UseMovingImageMask = false;
-        }
-    }
-
-    if( !m_MovingImageGradientGPUImage )
-    {
-        if( m_Debug ) std::cout << "Preparing to compute image gradients.." << std::endl;
-        this->ComputeFixedImageGradient();
-        this->ComputeMovingImageGradient();
-
-        this->CreateGPUVariablesForCostFunction();
-
-        /* Build Orientation Matching Kernel */
-        std::ostringstream defines2;
-        defines2 << "#define SEL " << m_N << std::endl;
-        defines2 << "#define N " << m_Blocks * m_Threads << std::endl;
-        defines2 << "#define LOCALSIZE " << m_Threads << std::endl;
-        defines2 << "#define USEMASK " << m_ComputeMask << std::endl;
-
-        m_OrientationMatchingKernel =
-            CreateKernelFromString( GPUOrientationMatchingMatrixTransformationSparseMaskKernel, defines2.str().c_str(),
-                                    "OrientationMatchingMetricSparseMask", "" );
-    }
-
-    if( m_TransformMatrix == m_Transform->GetMatrix() && m_TransformOffset == m_TransformOffset )
-    {
-        return;
-    }
-
-    this->UpdateGPUTransformVariables();
+    cl_int errid;
+    errid = clEnqueueWriteBuffer( m_CommandQueue[0], m_gpuDummy, CL_TRUE, 0, 24 * sizeof( InternalRealType ),
+                                  m_RigidContext, 0, nullptr, nullptr );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
     size_t globalSize[1];
     size_t localSize[1];
@@ -1140,7 +764,6 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
     clEnqueueNDRangeKernel( m_CommandQueue[0], m_OrientationMatchingKernel, 1, nullptr, globalSize, localSize, 0,
                             nullptr, nullptr );
 
-    cl_int errid;
     errid = clFinish( m_CommandQueue[0] );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
@@ -1155,8 +778,107 @@ void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingIm
         metricSum += m_cpuMetricAccum[i];
     }
 
-    m_MetricValue = 0;
-    if( metricSum > 0 ) m_MetricValue = ( InternalRealType )( metricSum / ( (InternalRealType)globalSize[0] ) );
+    errid = clEnqueueUnmapMemObject( m_CommandQueue[0], m_gpuMetricAccum, m_cpuMetricAccum, 0, nullptr, nullptr );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+    return metricSum;
+}
+
+/**
+ * Allocate the batch buffers for at least numberOfContexts transform contexts
+ */
+template <class TFixedImage, class TMovingImage>
+void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ReserveBatchBuffers(
+    unsigned int numberOfContexts )
+{
+    if( numberOfContexts <= m_BatchCapacity ) return;
+
+    if( m_gpuBatchContexts ) clReleaseMemObject( m_gpuBatchContexts );
+    if( m_gpuBatchMetricAccum ) clReleaseMemObject( m_gpuBatchMetricAccum );
+    m_gpuBatchContexts    = NULL;
+    m_gpuBatchMetricAccum = NULL;
+    m_BatchCapacity       = 0;
+
+    cl_int errid;
+    m_gpuBatchContexts = clCreateBuffer( m_Context, CL_MEM_READ_ONLY,
+                                         numberOfContexts * 24 * sizeof( InternalRealType ), nullptr, &errid );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+    m_gpuBatchMetricAccum = clCreateBuffer( m_Context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                            numberOfContexts * m_Blocks * sizeof( InternalRealType ), nullptr, &errid );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+    m_BatchCapacity = numberOfContexts;
+}
+
+/**
+ * Evaluate the metric for a batch of transform contexts with one launch of the batch kernel per chunk of contexts
+ */
+template <class TFixedImage, class TMovingImage>
+void GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeMetricSums(
+    const std::vector<InternalRealType> & contexts, std::vector<InternalRealType> & sums )
+{
+    const unsigned int numberOfContexts = contexts.size() / 24;
+    sums.assign( numberOfContexts, (InternalRealType)0 );
+    if( numberOfContexts == 0 ) return;
+
+    // The contexts are read from constant memory, which is at least 64KB: stay well below with 256 contexts
+    const unsigned int maximumContextsPerLaunch = 256;
+    this->ReserveBatchBuffers( std::min( numberOfContexts, maximumContextsPerLaunch ) );
+
+    cl_int errid;
+    for( unsigned int first = 0; first < numberOfContexts; first += m_BatchCapacity )
+    {
+        const unsigned int count = std::min( m_BatchCapacity, numberOfContexts - first );
+
+        errid = clEnqueueWriteBuffer( m_CommandQueue[0], m_gpuBatchContexts, CL_TRUE, 0,
+                                      count * 24 * sizeof( InternalRealType ), contexts.data() + 24 * first, 0,
+                                      nullptr, nullptr );
+        OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+        size_t globalSize[2];
+        size_t localSize[2];
+
+        globalSize[0] = m_Blocks * m_Threads;
+        globalSize[1] = count;
+        localSize[0]  = m_Threads;
+        localSize[1]  = 1;
+
+        int argidx = 0;
+
+        clSetKernelArg( m_OrientationMatchingBatchKernel, argidx++, sizeof( cl_mem ), (void *)&m_gpuBatchContexts );
+        clSetKernelArg( m_OrientationMatchingBatchKernel, argidx++, sizeof( cl_mem ),
+                        (void *)&m_gpuFixedGradientSamples );
+        clSetKernelArg( m_OrientationMatchingBatchKernel, argidx++, sizeof( cl_mem ),
+                        (void *)&m_gpuFixedLocationSamples );
+        clSetKernelArg( m_OrientationMatchingBatchKernel, argidx++, sizeof( cl_mem ),
+                        (void *)&m_MovingImageGradientGPUImage );
+        clSetKernelArg( m_OrientationMatchingBatchKernel, argidx++, sizeof( cl_mem ), (void *)&m_gpuBatchMetricAccum );
+        clSetKernelArg( m_OrientationMatchingBatchKernel, argidx++, sizeof( InternalRealType ) * m_Threads, nullptr );
+
+        clEnqueueNDRangeKernel( m_CommandQueue[0], m_OrientationMatchingBatchKernel, 2, nullptr, globalSize, localSize,
+                                0, nullptr, nullptr );
+
+        errid = clFinish( m_CommandQueue[0] );
+        OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+        InternalRealType * cpuBatchMetricAccum = (InternalRealType *)clEnqueueMapBuffer(
+            m_CommandQueue[0], m_gpuBatchMetricAccum, CL_TRUE, CL_MAP_READ, 0,
+            count * m_Blocks * sizeof( InternalRealType ), 0, nullptr, nullptr, &errid );
+        OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+        for( unsigned int t = 0; t < count; t++ )
+        {
+            for( unsigned int i = 0; i < m_Blocks; i++ )
+            {
+                sums[first + t] += cpuBatchMetricAccum[t * m_Blocks + i];
+            }
+        }
+
+        errid = clEnqueueUnmapMemObject( m_CommandQueue[0], m_gpuBatchMetricAccum, cpuBatchMetricAccum, 0, nullptr,
+                                         nullptr );
+        OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+    }
 }
 
 }  // end namespace itk
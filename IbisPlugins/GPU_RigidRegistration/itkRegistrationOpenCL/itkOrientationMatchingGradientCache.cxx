@@ -0,0 +1,136 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#include "itkOrientationMatchingGradientCache.h"
+
+namespace itk
+{
+OrientationMatchingGradientCache::OrientationMatchingGradientCache() { m_MaximumNumberOfEntries = 4; }
+
+OrientationMatchingGradientCache::~OrientationMatchingGradientCache() { this->Clear(); }
+
+OrientationMatchingGradientCache::Pointer OrientationMatchingGradientCache::GetInstance()
+{
+    // Never deleted: the OpenCL images must not be released after the OpenCL runtime has been unloaded
+    static Self * instance = new Self;
+    return instance;
+}
+
+std::list<OrientationMatchingGradientCache::Entry>::iterator OrientationMatchingGradientCache::Touch(
+    const Key & key )
+{
+    for( std::list<Entry>::iterator it = m_Entries.begin(); it != m_Entries.end(); ++it )
+    {
+        if( it->key == key )
+        {
+            m_Entries.splice( m_Entries.begin(), m_Entries, it );
+            return m_Entries.begin();
+        }
+    }
+    return m_Entries.end();
+}
+
+#ifdef HAS_OPENCL
+void OrientationMatchingGradientCache::ReleaseGPUImage( Entry & entry )
+{
+    if( entry.gpuImage ) clReleaseMemObject( entry.gpuImage );
+    entry.gpuImage   = nullptr;
+    entry.gpuContext = nullptr;
+}
+#else
+void OrientationMatchingGradientCache::ReleaseGPUImage( Entry & ) {}
+#endif
+
+void OrientationMatchingGradientCache::Prune()
+{
+    while( m_Entries.size() > m_MaximumNumberOfEntries )
+    {
+        this->ReleaseGPUImage( m_Entries.back() );
+        m_Entries.pop_back();
+    }
+}
+
+OrientationMatchingGradientCache::GradientPointer OrientationMatchingGradientCache::FindGradient( const Key & key )
+{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    std::list<Entry>::iterator it = this->Touch( key );
+    return it != m_Entries.end() ? it->gradient : GradientPointer();
+}
+
+void OrientationMatchingGradientCache::InsertGradient( const Key & key, GradientPointer gradient )
+{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    std::list<Entry>::iterator it = this->Touch( key );
+    if( it == m_Entries.end() )
+    {
+        Entry entry;
+        entry.key = key;
+#ifdef HAS_OPENCL
+        entry.gpuContext = nullptr;
+        entry.gpuImage   = nullptr;
+#endif
+        m_Entries.push_front( entry );
+        it = m_Entries.begin();
+    }
+    this->ReleaseGPUImage( *it );
+    it->gradient = gradient;
+    this->Prune();
+}
+
+#ifdef HAS_OPENCL
+cl_mem OrientationMatchingGradientCache::FindGPUImage( const Key & key, cl_context context )
+{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    std::list<Entry>::iterator it = this->Touch( key );
+    if( it == m_Entries.end() || !it->gpuImage || it->gpuContext != context ) return nullptr;
+    clRetainMemObject( it->gpuImage );
+    return it->gpuImage;
+}
+
+void OrientationMatchingGradientCache::InsertGPUImage( const Key & key, cl_context context, cl_mem image )
+{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    std::list<Entry>::iterator it = this->Touch( key );
+    if( it == m_Entries.end() ) return;
+    this->ReleaseGPUImage( *it );
+    clRetainMemObject( image );
+    it->gpuContext = context;
+    it->gpuImage   = image;
+}
+#endif
+
+void OrientationMatchingGradientCache::SetMaximumNumberOfEntries( unsigned int maximumNumberOfEntries )
+{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    if( m_MaximumNumberOfEntries == maximumNumberOfEntries ) return;
+    m_MaximumNumberOfEntries = maximumNumberOfEntries;
+    this->Prune();
+    this->Modified();
+}
+
+void OrientationMatchingGradientCache::Clear()
+{
+    std::lock_guard<std::mutex> lock( m_Mutex );
+    for( std::list<Entry>::iterator it = m_Entries.begin(); it != m_Entries.end(); ++it )
+    {
+        this->ReleaseGPUImage( *it );
+    }
+    m_Entries.clear();
+}
+
+void OrientationMatchingGradientCache::PrintSelf( std::ostream & os, Indent indent ) const
+{
+    Superclass::PrintSelf( os, indent );
+    os << indent << "MaximumNumberOfEntries: " << m_MaximumNumberOfEntries << std::endl;
+    os << indent << "NumberOfEntries: " << m_Entries.size() << std::endl;
+}
+
+}  // end namespace itk
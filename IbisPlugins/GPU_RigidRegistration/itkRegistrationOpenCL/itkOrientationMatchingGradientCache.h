@@ -0,0 +1,124 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#ifndef ITKORIENTATIONMATCHINGGRADIENTCACHE_H
+#define ITKORIENTATIONMATCHINGGRADIENTCACHE_H
+
+#include <itkObject.h>
+#include <itkObjectFactory.h>
+#ifdef HAS_OPENCL
+#include <itkOpenCLUtil.h>
+#endif
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace itk
+{
+/**
+ * \class OrientationMatchingGradientCache
+ * Process wide cache of the image gradients computed by the orientation matching metric, so that an image
+ * registered several times, e.g. a preoperative volume registered to successive ultrasound sweeps, has its
+ * gradient computed once. A gradient is identified by the image and its modification time, the mask and its
+ * modification time, and the parameters of the gradient filter. Images are only used as keys and are never
+ * dereferenced by the cache.
+ *
+ * The cache keeps the gradient on the host, 4 values per voxel, and optionally the OpenCL image created from
+ * it. An OpenCL image can only be used within its context, so it is returned for the same context only. The
+ * least recently used gradients are discarded beyond MaximumNumberOfEntries. Without HAS_OPENCL, only the
+ * gradients on the host are cached.
+ */
+class ITK_EXPORT OrientationMatchingGradientCache : public Object
+{
+public:
+    /** Standard class typedefs. */
+    typedef OrientationMatchingGradientCache Self;
+    typedef Object Superclass;
+    typedef SmartPointer<Self> Pointer;
+    typedef SmartPointer<const Self> ConstPointer;
+
+    itkTypeMacro( OrientationMatchingGradientCache, Object );
+
+    typedef std::shared_ptr<const std::vector<float> > GradientPointer;
+
+    struct Key
+    {
+        const void * image;
+        ModifiedTimeType imageMTime;
+        const void * mask;
+        ModifiedTimeType maskMTime;
+        double gradientScale;
+        double maskThreshold;
+
+        bool operator==( const Key & other ) const
+        {
+            return image == other.image && imageMTime == other.imageMTime && mask == other.mask &&
+                   maskMTime == other.maskMTime && gradientScale == other.gradientScale &&
+                   maskThreshold == other.maskThreshold;
+        }
+    };
+
+    /** Return the cache shared by all the metrics. */
+    static Pointer GetInstance();
+
+    /** Return the gradient cached for key, nullptr if there is none. */
+    GradientPointer FindGradient( const Key & key );
+    /** Cache gradient for key, replacing any gradient and OpenCL image cached for it. */
+    void InsertGradient( const Key & key, GradientPointer gradient );
+
+#ifdef HAS_OPENCL
+    /** Return the OpenCL image cached for key in context, retained for the caller, nullptr if there is none. */
+    cl_mem FindGPUImage( const Key & key, cl_context context );
+    /** Cache the OpenCL image of the gradient of key, which must be cached. The image is retained by the cache. */
+    void InsertGPUImage( const Key & key, cl_context context, cl_mem image );
+#endif
+
+    itkGetConstMacro( MaximumNumberOfEntries, unsigned int );
+    void SetMaximumNumberOfEntries( unsigned int maximumNumberOfEntries );
+
+    /** Release all the cached gradients. */
+    void Clear();
+
+protected:
+    OrientationMatchingGradientCache();
+    ~OrientationMatchingGradientCache();
+
+    void PrintSelf( std::ostream & os, Indent indent ) const override;
+
+private:
+    OrientationMatchingGradientCache( const Self & );  // purposely not implemented
+    void operator=( const Self & );                    // purposely not implemented
+
+    struct Entry
+    {
+        Key key;
+        GradientPointer gradient;
+#ifdef HAS_OPENCL
+        cl_context gpuContext;
+        cl_mem gpuImage;
+#endif
+    };
+
+    /** Move the entry of key to the front and return it, or return m_Entries.end(). Called with m_Mutex locked. */
+    std::list<Entry>::iterator Touch( const Key & key );
+    void ReleaseGPUImage( Entry & entry );
+    void Prune();
+
+    std::mutex m_Mutex;
+    // Most recently used first
+    std::list<Entry> m_Entries;
+    unsigned int m_MaximumNumberOfEntries;
+};
+}  // end namespace itk
+
+#endif
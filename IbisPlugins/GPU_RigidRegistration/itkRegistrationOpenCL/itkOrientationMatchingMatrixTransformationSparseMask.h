@@ -0,0 +1,330 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+// Thanks to Dante De Nigris for writing the original GPU class
+
+#ifndef ITKORIENTATIONMATCHINGMATRIXTRANSFORMATIONSPARSEMASK_H
+#define ITKORIENTATIONMATCHINGMATRIXTRANSFORMATIONSPARSEMASK_H
+
+#include <itkCovariantVector.h>
+#include <itkGaussianDerivativeOperator.h>
+#include <itkHistogram.h>
+#include <itkImage.h>
+#include <itkImageFullSampler.h>
+#include <itkImageGridSampler.h>
+#include <itkImageMaskSpatialObject.h>
+#include <itkImageRandomSampler.h>
+#include <itkImageRandomSamplerBase.h>
+#include <itkImageRegionIteratorWithIndex.h>
+#include <itkImageSample.h>
+#include <itkImageSamplerBase.h>
+#include <itkListSample.h>
+#include <itkMatrixOffsetTransformBase.h>
+#include <itkObject.h>
+#include <itkSampleToHistogramFilter.h>
+
+#include <vector>
+
+#include "itkOrientationMatchingGradientCache.h"
+
+namespace itk
+{
+/**
+ * \class OrientationMatchingMatrixTransformationSparseMask
+ * Base class of the gradient orientation matching metric backends. It holds the parameters,
+ * selects the fixed image samples with the strongest gradient magnitudes and computes the
+ * transform context used to map the samples into the moving image. The metric value is the
+ * average over the samples of the N-th power of the cosine between the fixed image gradient
+ * and the transformed moving image gradient.
+ *
+ * Gradients are stored with 4 values per voxel: the 3 components of the gradient and a mask
+ * value (-1 outside of the image mask, 0 if a voxel of the neighbourhood is below MaskThreshold,
+ * 1 otherwise), as computed by GPUDiscreteGaussianGradientImageFilter.cl.
+ * \sa GPUOrientationMatchingMatrixTransformationSparseMask CPUOrientationMatchingMatrixTransformationSparseMask
+ */
+template <class TFixedImage, class TMovingImage>
+class ITK_EXPORT OrientationMatchingMatrixTransformationSparseMask : public Object
+{
+public:
+    /** Standard class typedefs. */
+    typedef OrientationMatchingMatrixTransformationSparseMask Self;
+    typedef Object Superclass;
+    typedef SmartPointer<Self> Pointer;
+    typedef SmartPointer<const Self> ConstPointer;
+
+    typedef float InternalRealType;
+
+    /** Run-time type information (and related methods). */
+    itkTypeMacro( OrientationMatchingMatrixTransformationSparseMask, Object );
+
+    /** FixedImage image type. */
+    typedef TFixedImage FixedImageType;
+    typedef typename FixedImageType::PixelType FixedImagePixelType;
+    typedef typename FixedImageType::Pointer FixedImagePointer;
+    typedef typename FixedImageType::ConstPointer FixedImageConstPointer;
+
+    itkGetObjectMacro( FixedImage, FixedImageType );
+    itkSetObjectMacro( FixedImage, FixedImageType );
+
+    /** MovingImage image type. */
+    typedef TMovingImage MovingImageType;
+    typedef typename MovingImageType::PixelType MovingImagePixelType;
+    typedef typename MovingImageType::Pointer MovingImagePointer;
+    typedef typename MovingImageType::ConstPointer MovingImageConstPointer;
+    typedef typename MovingImageType::DirectionType MovingImageDirectionType;
+    typedef typename MovingImageType::PointType MovingImagePointType;
+
+    itkGetObjectMacro( MovingImage, MovingImageType );
+    itkSetObjectMacro( MovingImage, MovingImageType );
+
+    /** Extract dimension from input image. */
+    itkStaticConstMacro( FixedImageDimension, unsigned int, TFixedImage::ImageDimension );
+    itkStaticConstMacro( MovingImageDimension, unsigned int, TMovingImage::ImageDimension );
+
+    typedef Image<InternalRealType, FixedImageDimension> RealImageType;
+    typedef typename RealImageType::Pointer RealImagePointer;
+
+    typedef CovariantVector<InternalRealType, itkGetStaticConstMacro( FixedImageDimension )> FixedGradientType;
+
+    typedef Image<FixedGradientType, itkGetStaticConstMacro( FixedImageDimension )> FixedImageGradientType;
+    typedef typename FixedImageGradientType::Pointer FixedImageGradientPointer;
+    typedef typename FixedImageGradientType::ConstPointer FixedImageGradientConstPointer;
+
+    typedef CovariantVector<InternalRealType, itkGetStaticConstMacro( MovingImageDimension )> MovingGradientType;
+
+    typedef Image<MovingGradientType, itkGetStaticConstMacro( MovingImageDimension )> MovingImageGradientType;
+    typedef typename MovingImageGradientType::Pointer MovingImageGradientPointer;
+    typedef typename MovingImageGradientType::ConstPointer MovingImageGradientConstPointer;
+
+    typedef double TransformRealType;
+
+    typedef MatrixOffsetTransformBase<TransformRealType, FixedImageDimension, MovingImageDimension> MatrixTransformType;
+    typedef typename MatrixTransformType::Pointer MatrixTransformPointer;
+    typedef typename MatrixTransformType::ConstPointer MatrixTransformConstPointer;
+
+    typedef typename MatrixTransformType::MatrixType TransformMatrixType;
+    typedef typename MatrixTransformType::InverseMatrixType TransformInverseMatrixType;
+    typedef typename MatrixTransformType::OutputVectorType TransformOffsetType;
+
+    itkGetConstObjectMacro( Transform, MatrixTransformType );
+    itkSetObjectMacro( Transform, MatrixTransformType );
+
+    itkGetConstMacro( MetricValue, InternalRealType );
+
+    itkSetMacro( NumberOfPixels, unsigned int );
+    itkSetMacro( N, unsigned int );
+    itkSetMacro( Percentile, double );
+
+    itkSetMacro( ComputeMask, bool );
+    itkSetMacro( MaskThreshold, double );
+
+    itkSetMacro( GradientScale, double );
+
+    itkSetMacro( Debug, bool );
+
+    /** Keep the gradient of the fixed (moving) image in OrientationMatchingGradientCache and reuse it in the
+     *  following metrics, e.g. for a preoperative volume registered several times. Off by default. */
+    itkSetMacro( CacheFixedImageGradient, bool );
+    itkGetConstMacro( CacheFixedImageGradient, bool );
+    itkBooleanMacro( CacheFixedImageGradient );
+    itkSetMacro( CacheMovingImageGradient, bool );
+    itkGetConstMacro( CacheMovingImageGradient, bool );
+    itkBooleanMacro( CacheMovingImageGradient );
+
+    typedef OrientationMatchingGradientCache::GradientPointer GradientPointer;
+    typedef OrientationMatchingGradientCache::Key GradientCacheKey;
+
+    typedef GaussianDerivativeOperator<InternalRealType, FixedImageDimension> FixedDerivativeOperatorType;
+    typedef GaussianDerivativeOperator<InternalRealType, MovingImageDimension> MovingDerivativeOperatorType;
+
+    typedef itk::Vector<InternalRealType, 1> MeasurementVectorType;
+    typedef itk::Statistics::ListSample<MeasurementVectorType> FixedGradientMagnitudeSampleType;
+
+    typedef itk::Statistics::ListSample<itk::Vector<unsigned int, 1> > IdxSampleType;
+
+    typedef itk::Statistics::Histogram<float, itk::Statistics::DenseFrequencyContainer2> HistogramType;
+
+    typedef itk::Statistics::SampleToHistogramFilter<FixedGradientMagnitudeSampleType, HistogramType>
+        SampleToHistogramFilterType;
+
+    /** Image Sampler typedefs */
+    using ImageSamplerType       = itk::ImageSamplerBase<FixedImageType>;
+    using RandomImageSamplerType = itk::ImageRandomSampler<FixedImageType>;
+    using GridImageSamplerType   = itk::ImageGridSampler<FixedImageType>;
+    using FullImageSamplerType   = itk::ImageFullSampler<FixedImageType>;
+
+    using SampleContainerType = typename ImageSamplerType::ImageSampleContainerType;
+    using SampleType          = typename ImageSamplerType::ImageSampleType;
+    using GridSpacingType     = typename GridImageSamplerType::SampleGridSpacingType;
+
+    enum SamplingStrategyType
+    {
+        RANDOM = 0,
+        GRID   = 1,
+        FULL   = 2
+    };
+
+    itkSetMacro( SamplingStrategy, SamplingStrategyType );
+    void SetSamplingStrategyToRandom() { this->m_SamplingStrategy = RANDOM; }
+    void SetSamplingStrategyToGrid() { this->m_SamplingStrategy = GRID; }
+    void SetSamplingStrategyToFull() { this->m_SamplingStrategy = FULL; }
+
+    using FixedImageMaskSpatialObjectType    = itk::ImageMaskSpatialObject<FixedImageDimension>;
+    using FixedImageMaskSpatialObjectPointer = typename FixedImageMaskSpatialObjectType::Pointer;
+    using FixedImageMaskType                 = typename FixedImageMaskSpatialObjectType::ImageType;
+    using FixedImageMaskPointer              = typename FixedImageMaskType::Pointer;
+    using FixedImageMaskPixelType            = typename FixedImageMaskType::PixelType;
+
+    using MovingImageMaskSpatialObjectType    = itk::ImageMaskSpatialObject<MovingImageDimension>;
+    using MovingImageMaskSpatialObjectPointer = typename MovingImageMaskSpatialObjectType::Pointer;
+    using MovingImageMaskType                 = typename MovingImageMaskSpatialObjectType::ImageType;
+    using MovingImageMaskPointer              = typename MovingImageMaskType::Pointer;
+    using MovingImageMaskPixelType            = typename MovingImageMaskType::PixelType;
+
+    itkSetMacro( FixedImageMaskSpatialObject, FixedImageMaskSpatialObjectPointer );
+    itkSetMacro( MovingImageMaskSpatialObject, MovingImageMaskSpatialObjectPointer );
+    itkSetMacro( UseFixedImageMask, bool );
+    itkSetMacro( UseMovingImageMask, bool );
+
+    using FixedImageMaskIteratorType = itk::ImageRegionConstIteratorWithIndex<FixedImageMaskType>;
+    using FixedImageIteratorType     = itk::ImageRegionConstIteratorWithIndex<FixedImageType>;
+
+    using MovingImageMaskIteratorType = itk::ImageRegionConstIteratorWithIndex<MovingImageMaskType>;
+    using MovingImageIteratorType     = itk::ImageRegionConstIteratorWithIndex<MovingImageType>;
+
+    /** Compute the image gradients and select the fixed samples on the first call, then evaluate
+     *  the metric if the transform has changed since the last call. */
+    void Update( void );
+
+    /** Evaluate the metric for several transforms at once, values[i] being the metric value of transforms[i].
+     *  All the transforms are evaluated in a single pass of the backend. The metric value and the transform
+     *  of the object are left to those of the last transform. */
+    void GetValues( const std::vector<MatrixTransformConstPointer> & transforms,
+                    std::vector<InternalRealType> & values );
+
+    unsigned int NextPow2( unsigned int x );
+
+protected:
+    OrientationMatchingMatrixTransformationSparseMask();
+    virtual ~OrientationMatchingMatrixTransformationSparseMask();
+
+    void PrintSelf( std::ostream & os, Indent indent ) const override;
+
+    /** Compute the gradient of the fixed image, 4 values per voxel. */
+    virtual void ComputeFixedImageGradient( std::vector<InternalRealType> & fixedGradient ) = 0;
+    /** Compute the gradient of the moving image and keep it for the evaluations of the metric. */
+    virtual void ComputeMovingImageGradient( void ) = 0;
+    /** Prepare the evaluation of the metric once the fixed samples have been selected. */
+    virtual void InitializeMetric( void ) = 0;
+    /** Return the sum over the samples of the metric for the current transform context. */
+    virtual InternalRealType ComputeMetricSum( void ) = 0;
+    /** Return in sums the sum over the samples of the metric for each transform context of contexts, 24 values
+     *  per context. The default implementation calls ComputeMetricSum once per context. */
+    virtual void ComputeMetricSums( const std::vector<InternalRealType> & contexts,
+                                    std::vector<InternalRealType> & sums );
+
+    /** Check the masks and, on the first call, compute the image gradients and select the fixed samples. */
+    void ComputeGradients( void );
+
+    /** Create the first order Gaussian derivative operators along each direction, given the spacing
+     *  of the image, and the L2 norm of each operator. */
+    template <class TOperator, class TSpacing>
+    void CreateDerivativeOperators( const TSpacing & spacing, std::vector<TOperator> & opers,
+                                    std::vector<InternalRealType> & kernelNorms ) const;
+
+    /** Return the mask buffer of the fixed (moving) image. If there is no mask, defaultMask is filled
+     *  with ones and returned. */
+    const FixedImageMaskPixelType * GetFixedImageMaskBuffer( std::vector<FixedImageMaskPixelType> & defaultMask );
+    const MovingImageMaskPixelType * GetMovingImageMaskBuffer( std::vector<MovingImageMaskPixelType> & defaultMask );
+
+    /** Select the samples used by the metric from the fixed image gradient. */
+    void SelectFixedImageSamples( const std::vector<InternalRealType> & fixedGradient );
+    bool IsFixedGradientValid( const InternalRealType * gradient ) const;
+    InternalRealType FixedGradientMagnitude( const InternalRealType * gradient,
+                                             const std::vector<InternalRealType> & kernelNorms ) const;
+
+    void UpdateTransformVariables( void );
+
+    /** Key of the gradient of the fixed (moving) image in OrientationMatchingGradientCache. */
+    GradientCacheKey GetFixedImageGradientKey( void ) const;
+    GradientCacheKey GetMovingImageGradientKey( void ) const;
+    /** Return the cached gradient of the moving image, nullptr if it is not cached or CacheMovingImageGradient
+     *  is off. */
+    GradientPointer FindCachedMovingImageGradient( void );
+    /** Cache gradient as the gradient of the moving image if CacheMovingImageGradient is on. */
+    void InsertCachedMovingImageGradient( GradientPointer gradient );
+
+    unsigned int m_NumberOfPixels;
+    double m_Percentile;
+    unsigned int m_N;
+    double m_GradientScale;
+
+    // m_ComputeMask: when true only select strong gradient magnitudes
+    bool m_ComputeMask;
+    double m_MaskThreshold;
+
+    bool m_Debug;
+
+    bool m_CacheFixedImageGradient;
+    bool m_CacheMovingImageGradient;
+
+    // The samples are processed in m_Blocks blocks of m_Threads samples, the unused samples of the last block are
+    // left to 0. The metric is averaged over m_Blocks * m_Threads samples.
+    unsigned int m_Blocks;
+    unsigned int m_Threads;
+
+    SamplingStrategyType m_SamplingStrategy;
+
+    FixedImagePointer m_FixedImage;
+    MovingImagePointer m_MovingImage;
+
+    InternalRealType m_MetricValue;
+
+    MatrixTransformConstPointer m_Transform;
+
+    TransformMatrixType m_TransformMatrix;
+    TransformOffsetType m_TransformOffset;
+
+    bool m_GradientsComputed;
+
+    // Fixed gradient and physical location of the samples, one array per component
+    unsigned int m_NumberOfSamples;
+    std::vector<InternalRealType> m_FixedGradientSamples[3];
+    std::vector<InternalRealType> m_FixedLocationSamples[3];
+
+    // Rows 0 to 2: fixed location to moving continuous index (3x4), rows 3 to 5: transposed transform matrix
+    InternalRealType m_RigidContext[24];
+
+    vnl_matrix_fixed<TransformRealType, MovingImageDimension, MovingImageDimension> m_locToIdx;
+    vnl_matrix_fixed<TransformRealType, MovingImageDimension, MovingImageDimension> m_matrixDummy;
+    vnl_matrix_fixed<TransformRealType, MovingImageDimension, MovingImageDimension> m_matrixTranspose;
+    vnl_vector_fixed<TransformRealType, MovingImageDimension> m_mOrigin;
+    vnl_vector_fixed<TransformRealType, MovingImageDimension> m_OffsetOrigin;
+    vnl_vector_fixed<TransformRealType, MovingImageDimension> m_vectorDummy;
+
+    FixedImageMaskSpatialObjectPointer m_FixedImageMaskSpatialObject;
+    MovingImageMaskSpatialObjectPointer m_MovingImageMaskSpatialObject;
+
+    // m_UseFixedImageMask: when true samples gradients from masked region in FixedImage
+    bool m_UseFixedImageMask;
+    // m_UseMovingImageMask: when true samples gradients from masked region in MovingImage
+    bool m_UseMovingImageMask;
+
+private:
+    OrientationMatchingMatrixTransformationSparseMask( const Self & );  // purposely not implemented
+    void operator=( const Self & );                                     // purposely not implemented
+};
+}  // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkOrientationMatchingMatrixTransformationSparseMask.hxx"
+#endif
+
+#endif
@@ -0,0 +1,671 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+// Thanks to Dante De Nigris for writing the original GPU class
+
+#ifndef ITKORIENTATIONMATCHINGMATRIXTRANSFORMATIONSPARSEMASK_HXX
+#define ITKORIENTATIONMATCHINGMATRIXTRANSFORMATIONSPARSEMASK_HXX
+
+#include <itkMacro.h>
+#include <itkMatrix.h>
+#include <itkTimeProbe.h>
+#include <vnl/vnl_matrix.h>
+
+#include <algorithm>
+#include <memory>
+
+#include "itkOrientationMatchingMatrixTransformationSparseMask.h"
+
+namespace itk
+{
+/**
+ * Default constructor
+ */
+template <class TFixedImage, class TMovingImage>
+OrientationMatchingMatrixTransformationSparseMask<TFixedImage,
+                                                  TMovingImage>::OrientationMatchingMatrixTransformationSparseMask()
+{
+    m_Debug = false;
+
+    m_CacheFixedImageGradient  = false;
+    m_CacheMovingImageGradient = false;
+
+    m_NumberOfPixels = 0;
+    m_Percentile     = 0.9;
+    m_N              = 2;
+
+    m_GradientScale = 1.0;
+
+    m_ComputeMask   = true;
+    m_MaskThreshold = 0.0;
+
+    m_Blocks  = 0;
+    m_Threads = 0;
+
+    m_FixedImage  = nullptr;
+    m_MovingImage = nullptr;
+
+    m_Transform   = nullptr;
+    m_MetricValue = 0;
+
+    m_GradientsComputed = false;
+    m_NumberOfSamples   = 0;
+    std::fill( m_RigidContext, m_RigidContext + 24, (InternalRealType)0.0 );
+
+    m_UseFixedImageMask            = false;
+    m_UseMovingImageMask           = false;
+    m_FixedImageMaskSpatialObject  = nullptr;
+    m_MovingImageMaskSpatialObject = nullptr;
+    SetSamplingStrategyToRandom();
+}
+
+template <class TFixedImage, class TMovingImage>
+OrientationMatchingMatrixTransformationSparseMask<TFixedImage,
+                                                  TMovingImage>::~OrientationMatchingMatrixTransformationSparseMask()
+{
+}
+
+/**
+ * Standard "PrintSelf" method.
+ */
+template <class TFixedImage, class TMovingImage>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::PrintSelf( std::ostream & os,
+                                                                                              Indent indent ) const
+{
+    Superclass::PrintSelf( os, indent );
+}
+
+template <class TFixedImage, class TMovingImage>
+unsigned int OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::NextPow2( unsigned int x )
+{
+    --x;
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+    return ++x;
+}
+
+template <class TFixedImage, class TMovingImage>
+template <class TOperator, class TSpacing>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::CreateDerivativeOperators(
+    const TSpacing & spacing, std::vector<TOperator> & opers, std::vector<InternalRealType> & kernelNorms ) const
+{
+    const unsigned int dimension = TOperator::NeighborhoodDimension;
+    opers.resize( dimension );
+    kernelNorms.resize( dimension );
+    for( unsigned int dim = 0; dim < dimension; dim++ )
+    {
+        // Set up the operator for this dimension
+        opers[dim].SetDirection( dim );
+        opers[dim].SetOrder( 1 );
+        // convert the variance from physical units to pixels
+        double s = spacing[dim];
+        s        = s * s;
+        opers[dim].SetVariance( m_GradientScale / s );
+
+        opers[dim].CreateDirectional();
+
+        kernelNorms[dim] = 0;
+        for( unsigned int k = 0; k < opers[dim].GetSize( 0 ); k++ )
+        {
+            kernelNorms[dim] += pow( opers[dim].GetElement( k ), 2 );
+        }
+        kernelNorms[dim] = sqrt( kernelNorms[dim] );
+    }
+}
+
+template <class TFixedImage, class TMovingImage>
+const typename OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::FixedImageMaskPixelType *
+OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::GetFixedImageMaskBuffer(
+    std::vector<FixedImageMaskPixelType> & defaultMask )
+{
+    if( ( m_UseFixedImageMask ) && ( m_FixedImageMaskSpatialObject ) )
+    {
+        return m_FixedImageMaskSpatialObject->GetImage()->GetBufferPointer();
+    }
+
+    if( m_UseFixedImageMask )
+    {
+        itkWarningMacro( << "FixedImageMaskSpatialObject was not found, UseFixedImageMask is set to OFF" );
+        m_UseFixedImageMask = false;
+    }
+    defaultMask.assign( m_FixedImage->GetBufferedRegion().GetNumberOfPixels(), (FixedImageMaskPixelType)1 );
+    return defaultMask.data();
+}
+
+template <class TFixedImage, class TMovingImage>
+const typename OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::MovingImageMaskPixelType *
+OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::GetMovingImageMaskBuffer(
+    std::vector<MovingImageMaskPixelType> & defaultMask )
+{
+    if( ( m_UseMovingImageMask ) && ( m_MovingImageMaskSpatialObject ) )
+    {
+        return m_MovingImageMaskSpatialObject->GetImage()->GetBufferPointer();
+    }
+
+    if( m_UseMovingImageMask )
+    {
+        itkWarningMacro( << "MovingImageMaskSpatialObject was not found, UseMovingImageMask is set to OFF" );
+        m_UseMovingImageMask = false;
+    }
+    defaultMask.assign( m_MovingImage->GetBufferedRegion().GetNumberOfPixels(), (MovingImageMaskPixelType)1 );
+    return defaultMask.data();
+}
+
+template <class TFixedImage, class TMovingImage>
+bool OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::IsFixedGradientValid(
+    const InternalRealType * gradient ) const
+{
+    return ( !m_ComputeMask && ( gradient[3] > (InternalRealType)-1.0 ) ) ||
+           ( m_ComputeMask && ( gradient[3] > (InternalRealType)0.0 ) );
+}
+
+template <class TFixedImage, class TMovingImage>
+typename OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InternalRealType
+OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::FixedGradientMagnitude(
+    const InternalRealType * gradient, const std::vector<InternalRealType> & kernelNorms ) const
+{
+    InternalRealType magnitudeValue = 0;
+    for( unsigned int d = 0; d < FixedImageDimension; ++d )
+    {
+        magnitudeValue += pow( gradient[d] / kernelNorms[d], 2.0 );
+    }
+    return sqrt( magnitudeValue );
+}
+
+/**
+ * Select the fixed image samples with a gradient magnitude above the requested percentile
+ */
+template <class TFixedImage, class TMovingImage>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::SelectFixedImageSamples(
+    const std::vector<InternalRealType> & fixedGradient )
+{
+    std::vector<FixedDerivativeOperatorType> opers;
+    std::vector<InternalRealType> kernelNorms;
+    this->CreateDerivativeOperators( m_FixedImage->GetSpacing(), opers, kernelNorms );
+
+    const InternalRealType * cpuFixedGradientBuffer = fixedGradient.data();
+
+    FixedGradientMagnitudeSampleType::Pointer sample = FixedGradientMagnitudeSampleType::New();
+    IdxSampleType::Pointer maskIdxSample             = IdxSampleType::New();
+
+    itk::TimeProbe clock;
+    clock.Start();
+
+    // process full sampling separately
+    if( m_SamplingStrategy == FULL )
+    {
+        typename FixedImageType::RegionType region = m_FixedImage->GetRequestedRegion();
+
+        FixedImageIteratorType imageIterator( m_FixedImage, region );
+        for( imageIterator.GoToBegin(); !imageIterator.IsAtEnd(); ++imageIterator )
+        {
+            unsigned int idx = static_cast<unsigned int>( m_FixedImage->ComputeOffset( imageIterator.GetIndex() ) );
+
+            if( this->IsFixedGradientValid( &cpuFixedGradientBuffer[idx * 4] ) )
+            {
+                MeasurementVectorType tempSample;
+                tempSample[0] = this->FixedGradientMagnitude( &cpuFixedGradientBuffer[idx * 4], kernelNorms );
+
+                if( imageIterator.Get() > 0 )
+                {
+                    sample->PushBack( tempSample );
+                    maskIdxSample->PushBack( idx );
+                }
+            }
+        }
+    }
+    else
+    {
+        typename ImageSamplerType::Pointer imageSampler            = nullptr;
+        typename SampleContainerType::Pointer imageSampleContainer = SampleContainerType::New();
+        SampleType imageSample;
+        typename FixedImageType::RegionType bufferedRegion = m_FixedImage->GetBufferedRegion();
+        typename FixedImageType::IndexType imageIndex;
+        unsigned int nbrOfPixelsForHistogram = 100000;
+
+        if( ( m_SamplingStrategy == RANDOM ) )
+        {
+            typename RandomImageSamplerType::Pointer temporaryImageSampler = RandomImageSamplerType::New();
+            temporaryImageSampler->SetNumberOfSamples( nbrOfPixelsForHistogram );
+            imageSampler = temporaryImageSampler;
+        }
+        else if( m_SamplingStrategy == GRID )
+        {
+            typename GridImageSamplerType::Pointer temporaryImageSampler = GridImageSamplerType::New();
+            temporaryImageSampler->SetNumberOfSamples( nbrOfPixelsForHistogram );
+            imageSampler = temporaryImageSampler;
+        }
+
+        imageSampler->SetInput( m_FixedImage );
+        imageSampler->SetInputImageRegion( bufferedRegion );
+
+        try
+        {
+            imageSampler->Update();
+        }
+        catch( itk::ExceptionObject & err )
+        {
+            std::cerr << err << std::endl;
+            std::cerr << "Cannot grid sample the image" << std::endl;
+        }
+
+        imageSampleContainer = imageSampler->GetOutput();
+
+        for( unsigned int i = 0; i < imageSampleContainer->Size(); ++i )
+        {
+            imageSample = imageSampleContainer->ElementAt( i );
+            m_FixedImage->TransformPhysicalPointToIndex( imageSample.m_ImageCoordinates, imageIndex );
+            if( bufferedRegion.IsInside( imageIndex ) )
+            {
+                MeasurementVectorType tempSample;
+                unsigned int idx = static_cast<unsigned int>( m_FixedImage->ComputeOffset( imageIndex ) );
+                tempSample[0]    = this->FixedGradientMagnitude( &cpuFixedGradientBuffer[idx * 4], kernelNorms );
+                if( this->IsFixedGradientValid( &cpuFixedGradientBuffer[idx * 4] ) )
+                {
+                    sample->PushBack( tempSample );
+                    maskIdxSample->PushBack( idx );
+                }
+            }
+        }
+    }
+
+    if( m_Debug )
+    {
+        std::cerr << "Sample Size:\t" << sample->Size() << std::endl;
+    }
+
+    itk::TimeProbe clock2;
+    clock2.Start();
+    SampleToHistogramFilterType::Pointer sampleToHistogramFilter = SampleToHistogramFilterType::New();
+    sampleToHistogramFilter->SetInput( sample );
+
+    SampleToHistogramFilterType::HistogramSizeType histogramSize( 1 );
+    histogramSize.Fill( 100 );
+    sampleToHistogramFilter->SetHistogramSize( histogramSize );
+
+    sampleToHistogramFilter->Update();
+    HistogramType::ConstPointer histogram = sampleToHistogramFilter->GetOutput();
+
+    InternalRealType magnitudeThreshold = histogram->Quantile( 0, m_Percentile );
+
+    clock2.Stop();
+    if( m_Debug )
+    {
+        std::cerr << "Computing histogram took:\t" << clock2.GetMean() << std::endl;
+        std::cerr << "Magnitude Threshold:\t" << magnitudeThreshold << std::endl;
+    }
+
+    unsigned int maxThreads = 256;
+    m_Threads = ( m_NumberOfPixels < maxThreads * 2 ) ? this->NextPow2( ( m_NumberOfPixels + 1 ) / 2 ) : maxThreads;
+    m_Blocks  = ( m_NumberOfPixels + m_Threads - 1 ) / ( m_Threads );
+
+    unsigned int numberOfSamples = m_Blocks * m_Threads;
+    for( unsigned int d = 0; d < 3; ++d )
+    {
+        m_FixedGradientSamples[d].assign( numberOfSamples, (InternalRealType)0 );
+        m_FixedLocationSamples[d].assign( numberOfSamples, (InternalRealType)0 );
+    }
+
+    unsigned int pixelCntr = 0;
+
+    // process full sampling separately
+    if( m_SamplingStrategy == FULL )
+    {
+        typename FixedImageType::RegionType region = m_FixedImage->GetRequestedRegion();
+
+        FixedImageIteratorType imageIterator( m_FixedImage, region );
+
+        for( imageIterator.GoToBegin(); !imageIterator.IsAtEnd() & ( pixelCntr < numberOfSamples ); ++imageIterator )
+        {
+            unsigned int idx = static_cast<unsigned int>( m_FixedImage->ComputeOffset( imageIterator.GetIndex() ) );
+
+            if( this->IsFixedGradientValid( &cpuFixedGradientBuffer[idx * 4] ) )
+            {
+                InternalRealType magnitudeValue =
+                    this->FixedGradientMagnitude( &cpuFixedGradientBuffer[idx * 4], kernelNorms );
+
+                if( magnitudeValue > magnitudeThreshold )
+                {
+                    typename FixedImageType::PointType fixedLocation;
+                    this->m_FixedImage->TransformIndexToPhysicalPoint( imageIterator.GetIndex(), fixedLocation );
+                    for( unsigned int d = 0; d < FixedImageDimension; ++d )
+                    {
+                        m_FixedGradientSamples[d][pixelCntr] = cpuFixedGradientBuffer[idx * 4 + d];
+                        m_FixedLocationSamples[d][pixelCntr] = (InternalRealType)fixedLocation[d];
+                    }
+                    pixelCntr++;
+                }
+            }
+        }
+    }
+    else
+    {
+        typename ImageSamplerType::Pointer imageSampler            = nullptr;
+        typename SampleContainerType::Pointer imageSampleContainer = SampleContainerType::New();
+        SampleType imageSample;
+        typename FixedImageType::RegionType bufferedRegion = m_FixedImage->GetBufferedRegion();
+        typename FixedImageType::IndexType imageIndex;
+
+        if( m_SamplingStrategy == RANDOM )
+        {
+            typename RandomImageSamplerType::Pointer temporaryImageSampler = RandomImageSamplerType::New();
+            temporaryImageSampler->SetNumberOfSamples( m_NumberOfPixels );
+            imageSampler = temporaryImageSampler;
+        }
+        else if( m_SamplingStrategy == GRID )
+        {
+            typename GridImageSamplerType::Pointer temporaryImageSampler = GridImageSamplerType::New();
+            temporaryImageSampler->SetNumberOfSamples( m_NumberOfPixels );
+            imageSampler = temporaryImageSampler;
+        }
+
+        imageSampler->SetInput( m_FixedImage );
+        imageSampler->SetInputImageRegion( bufferedRegion );
+
+        try
+        {
+            imageSampler->Update();
+        }
+        catch( itk::ExceptionObject & err )
+        {
+            std::cerr << err << std::endl;
+            std::cerr << "Cannot grid sample the image" << std::endl;
+        }
+
+        imageSampleContainer = imageSampler->GetOutput();
+
+        for( unsigned int i = 0; i < imageSampleContainer->Size() && pixelCntr < numberOfSamples; ++i )
+        {
+            if( imageSampleContainer->GetElementIfIndexExists( i, &imageSample ) )
+            {
+                m_FixedImage->TransformPhysicalPointToIndex( imageSample.m_ImageCoordinates, imageIndex );
+                if( bufferedRegion.IsInside( imageIndex ) )
+                {
+                    unsigned int idx = static_cast<unsigned int>( m_FixedImage->ComputeOffset( imageIndex ) );
+                    if( this->IsFixedGradientValid( &cpuFixedGradientBuffer[idx * 4] ) )
+                    {
+                        InternalRealType magnitudeValue =
+                            this->FixedGradientMagnitude( &cpuFixedGradientBuffer[idx * 4], kernelNorms );
+                        if( magnitudeValue > magnitudeThreshold )
+                        {
+                            typename FixedImageType::PointType fixedLocation;
+                            this->m_FixedImage->TransformIndexToPhysicalPoint( m_FixedImage->ComputeIndex( idx ),
+                                                                               fixedLocation );
+                            for( unsigned int d = 0; d < FixedImageDimension; ++d )
+                            {
+                                m_FixedGradientSamples[d][pixelCntr] = cpuFixedGradientBuffer[idx * 4 + d];
+                                m_FixedLocationSamples[d][pixelCntr] = (InternalRealType)fixedLocation[d];
+                            }
+                            pixelCntr++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    m_NumberOfSamples = pixelCntr;
+
+    clock.Stop();
+    if( m_Debug ) std::cerr << "Post-Processing Fixed Image Gradient took:\t" << clock.GetMean() << std::endl;
+}
+
+/**
+ * Update the fixed location to moving index matrix and the gradient rotation for the current transform
+ */
+template <class TFixedImage, class TMovingImage>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::UpdateTransformVariables( void )
+{
+    m_TransformMatrix = m_Transform->GetMatrix();
+    m_TransformOffset = m_Transform->GetOffset();
+
+    m_matrixDummy     = m_locToIdx * m_TransformMatrix.GetVnlMatrix();
+    m_matrixTranspose = m_TransformMatrix.GetVnlMatrix().transpose();
+    m_OffsetOrigin    = m_TransformOffset.GetVnlVector() - m_mOrigin;
+    m_vectorDummy     = m_locToIdx * m_OffsetOrigin;
+    for( unsigned int i = 0; i < MovingImageDimension; i++ )
+    {
+        for( unsigned int j = 0; j < MovingImageDimension; j++ )
+        {
+            m_RigidContext[4 * i + j]      = m_matrixDummy[i][j];
+            m_RigidContext[4 * i + j + 12] = m_matrixTranspose[i][j];
+        }
+        m_RigidContext[4 * i + 3] = m_vectorDummy[i];
+    }
+}
+
+/**
+ * Keys of the image gradients in the gradient cache
+ */
+template <class TFixedImage, class TMovingImage>
+typename OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::GradientCacheKey
+OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::GetFixedImageGradientKey( void ) const
+{
+    GradientCacheKey key;
+    key.image         = m_FixedImage.GetPointer();
+    key.imageMTime    = m_FixedImage->GetMTime();
+    key.mask          = nullptr;
+    key.maskMTime     = 0;
+    key.gradientScale = m_GradientScale;
+    key.maskThreshold = m_MaskThreshold;
+    if( m_UseFixedImageMask && m_FixedImageMaskSpatialObject )
+    {
+        key.mask      = m_FixedImageMaskSpatialObject->GetImage();
+        key.maskMTime = m_FixedImageMaskSpatialObject->GetImage()->GetMTime();
+    }
+    return key;
+}
+
+template <class TFixedImage, class TMovingImage>
+typename OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::GradientCacheKey
+OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::GetMovingImageGradientKey( void ) const
+{
+    GradientCacheKey key;
+    key.image         = m_MovingImage.GetPointer();
+    key.imageMTime    = m_MovingImage->GetMTime();
+    key.mask          = nullptr;
+    key.maskMTime     = 0;
+    key.gradientScale = m_GradientScale;
+    key.maskThreshold = m_MaskThreshold;
+    if( m_UseMovingImageMask && m_MovingImageMaskSpatialObject )
+    {
+        key.mask      = m_MovingImageMaskSpatialObject->GetImage();
+        key.maskMTime = m_MovingImageMaskSpatialObject->GetImage()->GetMTime();
+    }
+    return key;
+}
+
+template <class TFixedImage, class TMovingImage>
+typename OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::GradientPointer
+OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::FindCachedMovingImageGradient( void )
+{
+    if( !m_CacheMovingImageGradient ) return GradientPointer();
+    return OrientationMatchingGradientCache::GetInstance()->FindGradient( this->GetMovingImageGradientKey() );
+}
+
+template <class TFixedImage, class TMovingImage>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::InsertCachedMovingImageGradient(
+    GradientPointer gradient )
+{
+    if( !m_CacheMovingImageGradient ) return;
+    OrientationMatchingGradientCache::GetInstance()->InsertGradient( this->GetMovingImageGradientKey(), gradient );
+}
+
+/**
+ * Check the masks and compute the image gradients once
+ */
+template <class TFixedImage, class TMovingImage>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeGradients( void )
+{
+    if( m_UseFixedImageMask )
+    {
+        if( !m_FixedImageMaskSpatialObject )
+        {
+            itkWarningMacro( << "FixedImageMaskSpatialObject was not found, UseFixedImageMask is set to OFF" );
+            m_UseFixedImageMask = false;
+        }
+    }
+
+    if( m_UseMovingImageMask )
+    {
+        if( !m_MovingImageMaskSpatialObject )
+        {
+            itkWarningMacro( << "MovingImageMaskSpatialObject was not found, UseMovingImageMask is set to OFF" );
+            m_UseMovingImageMask = false;
+        }
+    }
+
+    if( m_GradientsComputed ) return;
+
+    if( !m_FixedImage )
+    {
+        itkExceptionMacro( << "Fixed Image is not set" );
+    }
+    if( !m_MovingImage )
+    {
+        itkExceptionMacro( << "Moving Image is not set" );
+    }
+    m_FixedImage->Update();
+    m_MovingImage->Update();
+
+    if( m_Debug ) std::cout << "Preparing to compute image gradients.." << std::endl;
+    {
+        OrientationMatchingGradientCache::Pointer cache = OrientationMatchingGradientCache::GetInstance();
+
+        GradientPointer fixedGradient;
+        if( m_CacheFixedImageGradient ) fixedGradient = cache->FindGradient( this->GetFixedImageGradientKey() );
+        if( fixedGradient )
+        {
+            if( m_Debug ) std::cout << "Using cached fixed image gradient" << std::endl;
+        }
+        else
+        {
+            std::shared_ptr<std::vector<InternalRealType> > computedGradient =
+                std::make_shared<std::vector<InternalRealType> >();
+            this->ComputeFixedImageGradient( *computedGradient );
+            fixedGradient = computedGradient;
+            if( m_CacheFixedImageGradient ) cache->InsertGradient( this->GetFixedImageGradientKey(), fixedGradient );
+        }
+        this->SelectFixedImageSamples( *fixedGradient );
+    }
+    this->ComputeMovingImageGradient();
+
+    MovingImageDirectionType movingIndexToLocation = m_MovingImage->GetDirection();
+
+    MovingImageDirectionType scale;
+
+    for( unsigned int i = 0; i < MovingImageDimension; i++ )
+    {
+        scale[i][i] = m_MovingImage->GetSpacing()[i];
+    }
+    movingIndexToLocation = movingIndexToLocation * scale;
+
+    MovingImageDirectionType movingLocationToIndex = MovingImageDirectionType( movingIndexToLocation.GetInverse() );
+    MovingImagePointType movingOrigin              = m_MovingImage->GetOrigin();
+
+    for( unsigned int i = 0; i < MovingImageDimension; i++ )
+    {
+        m_mOrigin[i] = movingOrigin[i];
+        for( unsigned int j = 0; j < MovingImageDimension; j++ )
+        {
+            m_locToIdx[i][j] = movingLocationToIndex[i][j];
+        }
+    }
+
+    this->InitializeMetric();
+    m_GradientsComputed = true;
+}
+
+/**
+ * Update Metric Value
+ */
+template <class TFixedImage, class TMovingImage>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::Update( void )
+{
+    if( !m_Transform )
+    {
+        itkExceptionMacro( << "Transform is not set." );
+    }
+
+    if( m_GradientsComputed && m_TransformMatrix == m_Transform->GetMatrix() &&
+        m_TransformOffset == m_Transform->GetOffset() )
+    {
+        return;
+    }
+
+    this->ComputeGradients();
+
+    this->UpdateTransformVariables();
+
+    InternalRealType metricSum = this->ComputeMetricSum();
+
+    m_MetricValue = 0;
+    if( metricSum > 0 ) m_MetricValue = ( InternalRealType )( metricSum / ( (InternalRealType)m_Blocks * m_Threads ) );
+}
+
+/**
+ * Evaluate the metric for a set of transforms
+ */
+template <class TFixedImage, class TMovingImage>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::GetValues(
+    const std::vector<MatrixTransformConstPointer> & transforms, std::vector<InternalRealType> & values )
+{
+    values.assign( transforms.size(), (InternalRealType)0 );
+    if( transforms.empty() ) return;
+
+    for( unsigned int t = 0; t < transforms.size(); t++ )
+    {
+        if( !transforms[t] )
+        {
+            itkExceptionMacro( << "Transform " << t << " is not set." );
+        }
+    }
+
+    this->ComputeGradients();
+
+    std::vector<InternalRealType> contexts( 24 * transforms.size() );
+    for( unsigned int t = 0; t < transforms.size(); t++ )
+    {
+        m_Transform = transforms[t];
+        this->UpdateTransformVariables();
+        std::copy( m_RigidContext, m_RigidContext + 24, contexts.begin() + 24 * t );
+    }
+
+    std::vector<InternalRealType> sums;
+    this->ComputeMetricSums( contexts, sums );
+
+    for( unsigned int t = 0; t < transforms.size(); t++ )
+    {
+        if( sums[t] > 0 ) values[t] = ( InternalRealType )( sums[t] / ( (InternalRealType)m_Blocks * m_Threads ) );
+    }
+    m_MetricValue = values.back();
+}
+
+/**
+ * Default batch evaluation, one context at a time
+ */
+template <class TFixedImage, class TMovingImage>
+void OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>::ComputeMetricSums(
+    const std::vector<InternalRealType> & contexts, std::vector<InternalRealType> & sums )
+{
+    const unsigned int numberOfContexts = contexts.size() / 24;
+    sums.resize( numberOfContexts );
+    for( unsigned int t = 0; t < numberOfContexts; t++ )
+    {
+        std::copy( contexts.begin() + 24 * t, contexts.begin() + 24 * ( t + 1 ), m_RigidContext );
+        sums[t] = this->ComputeMetricSum();
+    }
+}
+
+}  // end namespace itk
+
+#endif
@@ -7,12 +7,68 @@
 
 GPU_VolumeReconstruction::GPU_VolumeReconstruction()
 {
-    m_VolReconstructor = GPU_VolumeReconstruction::VolumeReconstructionType::New();
+    m_backend          = CPUBackend;
+    m_sliceBinning     = true;
+    m_VolReconstructor = CreateReconstructor( AutomaticBackend );
     m_VolReconstructor->SetDebug( false );
 }
 
 GPU_VolumeReconstruction::~GPU_VolumeReconstruction() {}
 
+bool GPU_VolumeReconstruction::IsGPUBackendAvailable()
+{
+#ifdef HAS_OPENCL
+    return itk::IsGPUAvailable();
+#else
+    return false;
+#endif
+}
+
+GPU_VolumeReconstruction::VolumeReconstructionPointer GPU_VolumeReconstruction::CreateReconstructor( Backend backend )
+{
+#ifdef HAS_OPENCL
+    if( backend != CPUBackend && IsGPUBackendAvailable() )
+    {
+        try
+        {
+            VolumeReconstructionPointer reconstructor = GPUVolumeReconstructionType::New().GetPointer();
+            m_backend                                 = GPUBackend;
+            return reconstructor;
+        }
+        catch( itk::ExceptionObject & err )
+        {
+            std::cerr << "Could not initialize OpenCL volume reconstruction, using CPU instead." << std::endl;
+            std::cerr << err << std::endl;
+        }
+    }
+#endif
+    m_backend = CPUBackend;
+    return CPUVolumeReconstructionType::New().GetPointer();
+}
+
+bool GPU_VolumeReconstruction::SetBackend( Backend backend )
+{
+    if( backend == m_backend ) return true;
+    if( backend == AutomaticBackend && m_backend == GPUBackend ) return true;
+
+    VolumeReconstructionPointer reconstructor = CreateReconstructor( backend );
+
+    // Transfer inputs and parameters to the new reconstructor
+    reconstructor->SetDebug( m_VolReconstructor->GetDebug() );
+    reconstructor->SetUSSearchRadius( m_VolReconstructor->GetUSSearchRadius() );
+    reconstructor->SetVolumeSpacing( m_VolReconstructor->GetVolumeSpacing() );
+    reconstructor->SetKernelStdDev( m_VolReconstructor->GetKernelStdDev() );
+    reconstructor->SetTransform( m_VolReconstructor->GetTransform() );
+    reconstructor->SetFixedSliceMask( m_VolReconstructor->GetFixedSliceMask() );
+    unsigned int nbrOfSlices = m_VolReconstructor->GetNumberOfSlices();
+    reconstructor->SetNumberOfSlices( nbrOfSlices );
+    for( unsigned int i = 0; i < nbrOfSlices; i++ )
+        reconstructor->SetFixedSlice( i, m_VolReconstructor->GetFixedSlice( i ) );
+    m_VolReconstructor = reconstructor;
+
+    return backend != GPUBackend || m_backend == GPUBackend;
+}
+
 void GPU_VolumeReconstruction::SetNumberOfSlices( unsigned int nbrOfSlices )
 {
     m_VolReconstructor->SetNumberOfSlices( nbrOfSlices );
@@ -50,7 +106,13 @@ void GPU_VolumeReconstruction::SetFixedSlice( int index, vtkImageData * slice, v
 
 void GPU_VolumeReconstruction::SetTransform( vtkMatrix4x4 * transformMatrix )
 {
-    // First convert to itk
+    // set transform in reconstructor
+    m_VolReconstructor->SetTransform( ConvertTransform( transformMatrix ) );
+}
+
+GPU_VolumeReconstruction::ItkRigidTransformType::Pointer GPU_VolumeReconstruction::ConvertTransform(
+    vtkMatrix4x4 * transformMatrix )
+{
     GPU_VolumeReconstruction::ItkRigidTransformType::Pointer itkTransform =
         GPU_VolumeReconstruction::ItkRigidTransformType::New();
     GPU_VolumeReconstruction::ItkRigidTransformType::OffsetType offset;
@@ -105,12 +167,14 @@ void GPU_VolumeReconstruction::SetTransform( vtkMatrix4x4 * transformMatrix )
 
     itkTransform->SetCenter( center );
     itkTransform->SetParameters( params );
-    // set transform in reconstructor
-    m_VolReconstructor->SetTransform( itkTransform );
+    return itkTransform;
 }
 
 void GPU_VolumeReconstruction::run()
 {
+    CPUVolumeReconstructionType * cpuReconstructor =
+        dynamic_cast<CPUVolumeReconstructionType *>( m_VolReconstructor.GetPointer() );
+    if( cpuReconstructor ) cpuReconstructor->SetSliceBinning( m_sliceBinning );
     m_VolReconstructor->ReconstructVolume();
     m_reconstructedImage = m_VolReconstructor->GetReconstructedVolume();
 }
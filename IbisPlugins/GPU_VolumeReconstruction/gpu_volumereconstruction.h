@@ -8,7 +8,10 @@
 #include <QThread>
 
 #include "imageobject.h"
+#include "itkCPUVolumeReconstruction.h"
+#ifdef HAS_OPENCL
 #include "itkGPUVolumeReconstruction.h"
+#endif
 
 class vtkImageData;
 class vtkMatrix4x4;
@@ -20,8 +23,21 @@ class GPU_VolumeReconstruction : public QThread, public vtkObject
 public:
     typedef itk::Euler3DTransform<float> ItkRigidTransformType;
 
-    typedef itk::GPUVolumeReconstruction<IbisItkFloat3ImageType> VolumeReconstructionType;
+    typedef itk::VolumeReconstruction<IbisItkFloat3ImageType> VolumeReconstructionType;
     typedef VolumeReconstructionType::Pointer VolumeReconstructionPointer;
+#ifdef HAS_OPENCL
+    typedef itk::GPUVolumeReconstruction<IbisItkFloat3ImageType> GPUVolumeReconstructionType;
+#endif
+    typedef itk::CPUVolumeReconstruction<IbisItkFloat3ImageType> CPUVolumeReconstructionType;
+
+    // AutomaticBackend uses OpenCL when a GPU is available and falls back to the CPU otherwise. Without
+    // HAS_OPENCL, the GPU backend is compiled out and the CPU is always used.
+    enum Backend
+    {
+        AutomaticBackend,
+        GPUBackend,
+        CPUBackend
+    };
 
     static GPU_VolumeReconstruction * New() { return new GPU_VolumeReconstruction; }
 
@@ -34,6 +50,16 @@ public:
         return m_VolReconstructor;
     }
 
+    /** Select the reconstruction backend. Inputs and parameters already set are kept.
+     *  Returns false if the GPU backend was requested but could not be initialized, the CPU is used in that case. */
+    bool SetBackend( Backend backend );
+    /** Return the backend effectively used: GPUBackend or CPUBackend. */
+    Backend GetBackend() { return m_backend; }
+    static bool IsGPUBackendAvailable();
+    /** Only visit the slices that can reach each part of the volume. Only used by the CPU backend. */
+    void SetSliceBinning( bool binning ) { m_sliceBinning = binning; }
+    bool GetSliceBinning() { return m_sliceBinning; }
+
     IbisItkFloat3ImageType::Pointer GetReconstructedImage() { return m_reconstructedImage; }
     void SetNumberOfSlices( unsigned int nbrOfSlices );
     void SetFixedSliceMask( vtkImageData * mask );
@@ -42,10 +68,14 @@ public:
     void SetKernelStdDev( float stdDev );
     void SetFixedSlice( int index, vtkImageData * slice, vtkMatrix4x4 * sliceTransformMatrix );
     void SetTransform( vtkMatrix4x4 * transformMatrix );
+    static ItkRigidTransformType::Pointer ConvertTransform( vtkMatrix4x4 * transformMatrix );
     void SetDebugFlag( bool debug );
 
 protected:
     void run() override;
+    VolumeReconstructionPointer CreateReconstructor( Backend backend );
+    Backend m_backend;
+    bool m_sliceBinning;
     VolumeReconstructionPointer m_VolReconstructor;
     IbisItkFloat3ImageType::Pointer m_reconstructedImage;
 };
@@ -15,13 +15,22 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QtPlugin>
 
 #include "gpu_volumereconstructionwidget.h"
+#include "ibisapi.h"
+#include "livevolumereconstruction.h"
+#include "usacquisitionobject.h"
 
 GPU_VolumeReconstructionPluginInterface::GPU_VolumeReconstructionPluginInterface()
 {
     m_volumeReconstructionWidget = nullptr;
+    m_liveReconstruction         = LiveVolumeReconstruction::New();
+    m_liveReconstructionEnabled  = false;
 }
 
-GPU_VolumeReconstructionPluginInterface::~GPU_VolumeReconstructionPluginInterface() {}
+GPU_VolumeReconstructionPluginInterface::~GPU_VolumeReconstructionPluginInterface()
+{
+    m_liveReconstruction->Cancel();
+    m_liveReconstruction->Delete();
+}
 
 bool GPU_VolumeReconstructionPluginInterface::CanRun() { return true; }
 
@@ -32,3 +41,58 @@ QWidget * GPU_VolumeReconstructionPluginInterface::CreateFloatingWidget()
     widget->setAttribute( Qt::WA_DeleteOnClose, true );
     return widget;
 }
+
+LiveVolumeReconstruction * GPU_VolumeReconstructionPluginInterface::GetLiveReconstruction()
+{
+    m_liveReconstruction->SetIbisAPI( GetIbisAPI() );
+    return m_liveReconstruction;
+}
+
+void GPU_VolumeReconstructionPluginInterface::SetLiveReconstructionEnabled( bool enabled )
+{
+    if( enabled == m_liveReconstructionEnabled ) return;
+    m_liveReconstructionEnabled = enabled;
+
+    IbisAPI * ibisAPI = GetIbisAPI();
+    Q_ASSERT( ibisAPI );
+    if( enabled )
+    {
+        // Acquisitions already in the scene may be recorded again, new ones are watched as they are added
+        const QList<SceneObject *> & allObjects = ibisAPI->GetAllObjects();
+        for( int i = 0; i < allObjects.size(); ++i ) WatchAcquisition( allObjects[i] );
+        connect( ibisAPI, SIGNAL( ObjectAdded( int ) ), this, SLOT( OnObjectAdded( int ) ) );
+    }
+    else
+    {
+        disconnect( ibisAPI, SIGNAL( ObjectAdded( int ) ), this, SLOT( OnObjectAdded( int ) ) );
+        const QList<SceneObject *> & allObjects = ibisAPI->GetAllObjects();
+        for( int i = 0; i < allObjects.size(); ++i )
+        {
+            USAcquisitionObject * acquisition = USAcquisitionObject::SafeDownCast( allObjects[i] );
+            if( acquisition )
+                disconnect( acquisition, SIGNAL( RecordingStarted() ), this, SLOT( OnRecordingStarted() ) );
+        }
+        // The acquisition being recorded is still reconstructed up to its last frame
+        m_liveReconstruction->Stop();
+    }
+}
+
+void GPU_VolumeReconstructionPluginInterface::OnObjectAdded( int objectId )
+{
+    WatchAcquisition( GetIbisAPI()->GetObjectByID( objectId ) );
+}
+
+void GPU_VolumeReconstructionPluginInterface::WatchAcquisition( SceneObject * object )
+{
+    USAcquisitionObject * acquisition = USAcquisitionObject::SafeDownCast( object );
+    if( acquisition )
+        connect( acquisition, SIGNAL( RecordingStarted() ), this, SLOT( OnRecordingStarted() ),
+                 Qt::UniqueConnection );
+}
+
+void GPU_VolumeReconstructionPluginInterface::OnRecordingStarted()
+{
+    USAcquisitionObject * acquisition = qobject_cast<USAcquisitionObject *>( sender() );
+    if( !acquisition || !m_liveReconstructionEnabled ) return;
+    GetLiveReconstruction()->Start( acquisition );
+}
@@ -16,6 +16,8 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include "toolplugininterface.h"
 
 class GPU_VolumeReconstructionWidget;
+class LiveVolumeReconstruction;
+class SceneObject;
 
 class GPU_VolumeReconstructionPluginInterface : public ToolPluginInterface
 {
@@ -34,8 +36,26 @@ public:
 
     QWidget * CreateFloatingWidget() override;
 
+    // Reconstruction of the acquisitions as they are recorded. It lives as long as the plugin, closing the widget
+    // doesn't stop it, and its last finished volume can be used by other plugins, see
+    // LiveVolumeReconstruction::GetFinishedVolume().
+    LiveVolumeReconstruction * GetLiveReconstruction();
+    // Off by default. When enabled, the live reconstruction starts when an acquisition starts recording, with the
+    // parameters it had when it was enabled. Acquisitions loaded or imported are not reconstructed.
+    void SetLiveReconstructionEnabled( bool enabled );
+    bool IsLiveReconstructionEnabled() { return m_liveReconstructionEnabled; }
+
+private slots:
+
+    void OnObjectAdded( int objectId );
+    void OnRecordingStarted();
+
 protected:
+    void WatchAcquisition( SceneObject * object );
+
     GPU_VolumeReconstructionWidget * m_volumeReconstructionWidget;
+    LiveVolumeReconstruction * m_liveReconstruction;
+    bool m_liveReconstructionEnabled;
 };
 
 #endif
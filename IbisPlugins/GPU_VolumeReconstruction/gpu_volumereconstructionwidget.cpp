@@ -32,7 +32,7 @@ GPU_VolumeReconstructionWidget::GPU_VolumeReconstructionWidget( QWidget * parent
     : QWidget( parent ), ui( new Ui::GPU_VolumeReconstructionWidget ), m_pluginInterface( nullptr )
 {
     ui->setupUi( this );
-    setWindowTitle( "US Volume Reconstruction with GPU" );
+    setWindowTitle( "US Volume Reconstruction" );
 
     ui->progressBar->setMinimum( 0 );
     ui->progressBar->setMaximum( 0 );
@@ -40,12 +40,22 @@ GPU_VolumeReconstructionWidget::GPU_VolumeReconstructionWidget( QWidget * parent
 
     m_VolumeReconstructor = GPU_VolumeReconstruction::New();
     connect( m_VolumeReconstructor, SIGNAL( finished() ), this, SLOT( slot_finished() ) );
+
+    m_LiveReconstructor = nullptr;
 }
 
 void GPU_VolumeReconstructionWidget::SetPluginInterface( GPU_VolumeReconstructionPluginInterface * ifc )
 {
-    m_pluginInterface = ifc;
+    m_pluginInterface   = ifc;
+    m_LiveReconstructor = m_pluginInterface->GetLiveReconstruction();
+    connect( m_LiveReconstructor, SIGNAL( ReconstructionFinished() ), this, SLOT( slot_liveFinished() ) );
     UpdateUi();
+
+    // The live reconstruction belongs to the plugin, it may have been enabled by a previous widget
+    ui->liveCheckBox->blockSignals( true );
+    ui->liveCheckBox->setChecked( m_pluginInterface->IsLiveReconstructionEnabled() );
+    ui->liveCheckBox->blockSignals( false );
+    if( m_LiveReconstructor->IsActive() ) ui->userFeedbackLabel->setText( QString( "Live reconstruction running." ) );
 }
 
 GPU_VolumeReconstructionWidget::~GPU_VolumeReconstructionWidget()
@@ -83,8 +93,11 @@ void GPU_VolumeReconstructionWidget::slot_finished()
         std::cout << "Volume Reconstruction took " << qreal( reconstructionTime ) / 1000.0 << "secs" << std::endl;
 #endif
 
-        QString feedbackString =
-            QString( "Volume Reconstruction finished in %1 secs" ).arg( qreal( reconstructionTime ) / 1000.0 );
+        QString backendName =
+            m_VolumeReconstructor->GetBackend() == GPU_VolumeReconstruction::GPUBackend ? "GPU" : "CPU";
+        QString feedbackString = QString( "Volume Reconstruction finished in %1 secs (%2)" )
+                                     .arg( qreal( reconstructionTime ) / 1000.0 )
+                                     .arg( backendName );
         ui->userFeedbackLabel->setText( feedbackString );
     }
     else
@@ -160,6 +173,14 @@ void GPU_VolumeReconstructionWidget::on_startButton_clicked()
     m_VolumeReconstructor->SetVolumeSpacing( usVolumeSpacing );
     m_VolumeReconstructor->SetKernelStdDev( usVolumeSpacing / 2.0 );
 
+    GPU_VolumeReconstruction::Backend backend = static_cast<GPU_VolumeReconstruction::Backend>(
+        ui->backendComboBox->itemData( ui->backendComboBox->currentIndex() ).toInt() );
+    if( !m_VolumeReconstructor->SetBackend( backend ) )
+    {
+        std::cerr << "GPU reconstruction could not be initialized, using CPU instead." << std::endl;
+    }
+    m_VolumeReconstructor->SetSliceBinning( ui->sliceBinningCheckBox->isChecked() );
+
 #ifdef DEBUG
     std::cerr << "Constructing m_Reconstructor...DONE" << std::endl;
 #endif
@@ -187,11 +208,36 @@ void GPU_VolumeReconstructionWidget::on_startButton_clicked()
     ibisAPI->SetRenderingEnabled( true );
 }
 
+void GPU_VolumeReconstructionWidget::on_liveCheckBox_toggled( bool checked )
+{
+    if( checked )
+    {
+        // The parameters shown now are used for every recording until live reconstruction is enabled again
+        unsigned int usSearchRadius =
+            ui->usSearchRadiusComboBox->itemData( ui->usSearchRadiusComboBox->currentIndex() ).toInt();
+        float usVolumeSpacing =
+            ui->usVolumeSpacingComboBox->itemData( ui->usVolumeSpacingComboBox->currentIndex() ).toFloat();
+        m_LiveReconstructor->SetUseMask( ui->useMaskCheckBox->isChecked() );
+        m_LiveReconstructor->SetUSSearchRadius( usSearchRadius );
+        m_LiveReconstructor->SetVolumeSpacing( usVolumeSpacing );
+        ui->userFeedbackLabel->setText( QString( "Waiting for a US recording (%1 mm, search radius %2)." )
+                                            .arg( usVolumeSpacing )
+                                            .arg( usSearchRadius ) );
+    }
+    m_pluginInterface->SetLiveReconstructionEnabled( checked );
+}
+
+void GPU_VolumeReconstructionWidget::slot_liveFinished()
+{
+    ui->userFeedbackLabel->setText( QString( "Live reconstruction finished." ) );
+}
+
 void GPU_VolumeReconstructionWidget::UpdateUi()
 {
     ui->usAcquisitionComboBox->clear();
     ui->usSearchRadiusComboBox->clear();
     ui->usVolumeSpacingComboBox->clear();
+    ui->backendComboBox->clear();
     IbisAPI * ibisAPI = m_pluginInterface->GetIbisAPI();
     Q_ASSERT( ibisAPI );
     const QList<SceneObject *> & allObjects = ibisAPI->GetAllObjects();
@@ -220,4 +266,11 @@ void GPU_VolumeReconstructionWidget::UpdateUi()
 
     ui->usVolumeSpacingComboBox->addItem( QString( "1.0 mm x 1.0 mm x 1.0 mm" ), QVariant( 1.0 ) );
     ui->usVolumeSpacingComboBox->addItem( QString( "0.5 mm x 0.5 mm x 0.5 mm" ), QVariant( 0.5 ) );
+
+    ui->backendComboBox->addItem( QString( "Automatic" ), QVariant( GPU_VolumeReconstruction::AutomaticBackend ) );
+    if( GPU_VolumeReconstruction::IsGPUBackendAvailable() )
+    {
+        ui->backendComboBox->addItem( QString( "GPU (OpenCL)" ), QVariant( GPU_VolumeReconstruction::GPUBackend ) );
+    }
+    ui->backendComboBox->addItem( QString( "CPU (multithreaded)" ), QVariant( GPU_VolumeReconstruction::CPUBackend ) );
 }
@@ -19,6 +19,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 
 #include "gpu_volumereconstruction.h"
 #include "ibisitkvtkconverter.h"
+#include "livevolumereconstruction.h"
 #include "ui_gpu_volumereconstructionwidget.h"
 
 class GPU_VolumeReconstructionPluginInterface;
@@ -45,12 +46,15 @@ private:
     GPU_VolumeReconstruction::VolumeReconstructionPointer m_Reconstructor;
     QElapsedTimer m_ReconstructionTimer;
     GPU_VolumeReconstruction * m_VolumeReconstructor;
+    LiveVolumeReconstruction * m_LiveReconstructor;
     GPU_VolumeReconstructionPluginInterface * m_pluginInterface;
 
 private slots:
 
     void on_startButton_clicked();
+    void on_liveCheckBox_toggled( bool checked );
     void slot_finished();
+    void slot_liveFinished();
 };
 
 #endif
@@ -40,7 +40,7 @@ __kernel void VolumeReconstructionPopulating(
 
   event_t copydone1 = async_work_group_copy(localBuffer, allMatrices, 3*(2*nbrOfInputSlices+1), 0);
 
-  unsigned int gidx = outWidth*(giz*outHeight + giy) + gix;
+  ulong gidx = (ulong)outWidth*((ulong)giz*outHeight + giy) + gix;
 
   bool isValid = true;
   if(gix < 0 || gix >= outWidth) isValid = false;
@@ -143,3 +143,20 @@ __kernel void VolumeReconstructionPopulating(
       outputWeightAndWeightedValue[gidx] = accumWeightandWeightedValue;  
   }
 }
+
+__kernel void VolumeReconstructionNormalizing(
+                                         __global const REAL2* weightAndWeightedValue,
+                                         __global REAL* outputVolume,
+                                         ulong nbrOfVoxels
+                                        )
+{
+  ulong gidx = get_global_id(0);
+  if(gidx >= nbrOfVoxels)
+    return;
+
+  REAL2 accumWeightandWeightedValue = weightAndWeightedValue[gidx];
+  if(accumWeightandWeightedValue.x > 0)
+    outputVolume[gidx] = accumWeightandWeightedValue.x / accumWeightandWeightedValue.y;
+  else
+    outputVolume[gidx] = 0.0f;
+}
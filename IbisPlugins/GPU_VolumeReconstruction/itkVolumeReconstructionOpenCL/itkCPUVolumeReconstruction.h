@@ -0,0 +1,120 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#ifndef ITKCPUVOLUMERECONSTRUCTION_H
+#define ITKCPUVOLUMERECONSTRUCTION_H
+
+#include "itkVolumeReconstruction.h"
+
+namespace itk
+{
+/**
+ * \class CPUVolumeReconstruction
+ * CPU backend of the US volume reconstruction. It evaluates the same Gaussian weighted kernel as
+ * GPUVolumeReconstructionKernel.cl. The output volume is split in tiles of TileSize^3 voxels that
+ * are processed in parallel by the ITK thread pool. For every voxel, the slice pixels of the search
+ * neighbourhood are tested for proximity several at a time with SSE (or AVX when the compiler targets it).
+ * With slice binning on (the default), the slices are first binned into the tiles that lie within
+ * reach of their pixels, so each voxel only visits the few slices that can contribute to it.
+ */
+template <class TImage>
+class ITK_EXPORT CPUVolumeReconstruction : public VolumeReconstruction<TImage>
+{
+public:
+    /** Standard class typedefs. */
+    typedef CPUVolumeReconstruction Self;
+    typedef VolumeReconstruction<TImage> Superclass;
+    typedef SmartPointer<Self> Pointer;
+    typedef SmartPointer<const Self> ConstPointer;
+
+    typedef typename Superclass::InternalRealType InternalRealType;
+    typedef typename Superclass::ImageType ImageType;
+    typedef typename Superclass::ImagePixelType ImagePixelType;
+    typedef typename Superclass::ImagePointer ImagePointer;
+    typedef typename Superclass::WriterType WriterType;
+    typedef typename Superclass::WriterPointer WriterPointer;
+
+    /** Method for creation through the object factory. */
+    itkNewMacro( Self );
+
+    /** Run-time type information (and related methods). */
+    itkTypeMacro( CPUVolumeReconstruction, VolumeReconstruction );
+
+    itkStaticConstMacro( ImageDimension, unsigned int, TImage::ImageDimension );
+
+    /** Number of voxels along each side of the tiles processed by a single thread. */
+    itkStaticConstMacro( TileSize, int, 8 );
+
+    /** Bin the slices into the tiles they can reach before reconstructing. On by default. */
+    itkSetMacro( SliceBinning, bool );
+    itkGetConstMacro( SliceBinning, bool );
+    itkBooleanMacro( SliceBinning );
+
+    void ReconstructVolume( void ) override;
+
+    /** Accumulate the contribution of one slice to a single voxel. volumeIndexToSliceIndex and sliceIndexToLocation
+     *  are the row-major 3x4 matrices of the slice, volumeLocation is the position of the voxel in mm. */
+    static void AccumulateSlice( const InternalRealType * volumeIndexToSliceIndex,
+                                 const InternalRealType * sliceIndexToLocation, const ImagePixelType * pixels,
+                                 const unsigned char * maskValues, const int sliceSize[2], int searchRadius,
+                                 InternalRealType variance, const InternalRealType volumeIndex[3],
+                                 const InternalRealType volumeLocation[3], InternalRealType & weightedValue,
+                                 InternalRealType & weight );
+
+    /** Compute the bounding box of a slice in volume index space, expanded by margin, as well as a point
+     *  (the slice origin) and the unit normal of the slice plane. */
+    static void ComputeSliceBounds( const InternalRealType * volumeIndexToSliceIndex, const int sliceSize[2],
+                                    double margin, double lower[3], double upper[3], double origin[3],
+                                    double normal[3] );
+
+protected:
+    CPUVolumeReconstruction();
+    virtual ~CPUVolumeReconstruction();
+
+    using Superclass::m_Debug;
+    using Superclass::m_FixedSliceMask;
+    using Superclass::m_FixedSlices;
+    using Superclass::m_KernelStdDev;
+    using Superclass::m_MaskValues;
+    using Superclass::m_NbrPixelsInSlice;
+    using Superclass::m_NumberOfSlices;
+    using Superclass::m_ReconstructedVolume;
+    using Superclass::m_SliceIndexToLocationMatrices;
+    using Superclass::m_USSearchRadius;
+    using Superclass::m_VolumeIndexToLocationMatrix;
+    using Superclass::m_VolumeIndexToSliceIndexMatrices;
+    using Superclass::m_VolumeSpacing;
+
+    /** Reconstruct all voxels of a tile from the given slices and write them to the output volume. */
+    void ReconstructTile( const int tileStart[3], const std::vector<unsigned int> & slices );
+
+    /** Fill m_TileSlices with the indices, in increasing order, of the slices that may contribute to each tile. */
+    void BinSlices( const int nbrOfTiles[3] );
+
+    bool m_SliceBinning;
+    std::vector<std::vector<unsigned int> > m_TileSlices;
+
+    int m_SliceSize[2];
+    int m_VolumeSize[3];
+    InternalRealType m_Variance;
+    std::vector<const ImagePixelType *> m_SlicePixels;
+
+private:
+    CPUVolumeReconstruction( const Self & );  // purposely not implemented
+    void operator=( const Self & );           // purposely not implemented
+};
+}  // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkCPUVolumeReconstruction.hxx"
+#endif
+
+#endif
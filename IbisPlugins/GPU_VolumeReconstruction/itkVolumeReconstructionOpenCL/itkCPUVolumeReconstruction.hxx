@@ -0,0 +1,366 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#ifndef ITKCPUVOLUMERECONSTRUCTION_HXX
+#define ITKCPUVOLUMERECONSTRUCTION_HXX
+
+#include <itkMultiThreaderBase.h>
+#include <itkTimeProbe.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "itkCPUVolumeReconstruction.h"
+
+// Number of slice pixels tested at once for proximity to a voxel
+#if defined( __AVX__ )
+#include <immintrin.h>
+#define IBIS_VOLUME_RECONSTRUCTION_LANES 8
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define IBIS_VOLUME_RECONSTRUCTION_LANES 4
+#else
+#define IBIS_VOLUME_RECONSTRUCTION_LANES 1
+#endif
+
+namespace itk
+{
+namespace VolumeReconstructionSIMD
+{
+/**
+ * Compute the squared distance between a voxel and the slice pixels ix, ix+1, ..., ix+LANES-1 of a row.
+ * The offset from the voxel to pixel ix of the row is c * ix + b. Returns a bit mask of the pixels
+ * closer than 1 mm.
+ */
+inline int ClosePixels( int ix, const float c[3], const float b[3], float * squaredDistances )
+{
+#if IBIS_VOLUME_RECONSTRUCTION_LANES == 8
+    __m256 x  = _mm256_add_ps( _mm256_set1_ps( (float)ix ), _mm256_set_ps( 7, 6, 5, 4, 3, 2, 1, 0 ) );
+    __m256 dx = _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( c[0] ), x ), _mm256_set1_ps( b[0] ) );
+    __m256 dy = _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( c[1] ), x ), _mm256_set1_ps( b[1] ) );
+    __m256 dz = _mm256_add_ps( _mm256_mul_ps( _mm256_set1_ps( c[2] ), x ), _mm256_set1_ps( b[2] ) );
+    __m256 d2 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( dx, dx ), _mm256_mul_ps( dy, dy ) ),
+                               _mm256_mul_ps( dz, dz ) );
+    _mm256_storeu_ps( squaredDistances, d2 );
+    return _mm256_movemask_ps( _mm256_cmp_ps( d2, _mm256_set1_ps( 1.0f ), _CMP_LT_OQ ) );
+#elif IBIS_VOLUME_RECONSTRUCTION_LANES == 4
+    __m128 x  = _mm_add_ps( _mm_set1_ps( (float)ix ), _mm_set_ps( 3, 2, 1, 0 ) );
+    __m128 dx = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( c[0] ), x ), _mm_set1_ps( b[0] ) );
+    __m128 dy = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( c[1] ), x ), _mm_set1_ps( b[1] ) );
+    __m128 dz = _mm_add_ps( _mm_mul_ps( _mm_set1_ps( c[2] ), x ), _mm_set1_ps( b[2] ) );
+    __m128 d2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) );
+    _mm_storeu_ps( squaredDistances, d2 );
+    return _mm_movemask_ps( _mm_cmplt_ps( d2, _mm_set1_ps( 1.0f ) ) );
+#else
+    float x            = (float)ix;
+    float dx           = c[0] * x + b[0];
+    float dy           = c[1] * x + b[1];
+    float dz           = c[2] * x + b[2];
+    squaredDistances[0] = dx * dx + dy * dy + dz * dz;
+    return squaredDistances[0] < 1.0f ? 1 : 0;
+#endif
+}
+}  // end namespace VolumeReconstructionSIMD
+
+template <class TImage>
+CPUVolumeReconstruction<TImage>::CPUVolumeReconstruction()
+{
+    m_SliceSize[0]  = 0;
+    m_SliceSize[1]  = 0;
+    m_VolumeSize[0] = 0;
+    m_VolumeSize[1] = 0;
+    m_VolumeSize[2] = 0;
+    m_Variance      = 1.0;
+    m_SliceBinning  = true;
+}
+
+template <class TImage>
+CPUVolumeReconstruction<TImage>::~CPUVolumeReconstruction()
+{
+}
+
+template <class TImage>
+void CPUVolumeReconstruction<TImage>::AccumulateSlice(
+    const InternalRealType * volumeIndexToSliceIndex, const InternalRealType * sliceIndexToLocation,
+    const ImagePixelType * pixels, const unsigned char * maskValues, const int sliceSize[2], int searchRadius,
+    InternalRealType variance, const InternalRealType volumeIndex[3], const InternalRealType volumeLocation[3],
+    InternalRealType & weightedValue, InternalRealType & weight )
+{
+    const int lanes  = IBIS_VOLUME_RECONSTRUCTION_LANES;
+    const int width  = sliceSize[0];
+    const int height = sliceSize[1];
+
+    const InternalRealType * m   = volumeIndexToSliceIndex;
+    InternalRealType sliceIndexX = m[0] * volumeIndex[0] + m[1] * volumeIndex[1] + m[2] * volumeIndex[2] + m[3];
+    InternalRealType sliceIndexY = m[4] * volumeIndex[0] + m[5] * volumeIndex[1] + m[6] * volumeIndex[2] + m[7];
+    InternalRealType roundedX    = std::round( sliceIndexX );
+    InternalRealType roundedY    = std::round( sliceIndexY );
+    if( roundedX < 0 || roundedX >= width || roundedY < 0 || roundedY >= height ) return;
+
+    int centerX = (int)roundedX;
+    int centerY = (int)roundedY;
+    if( maskValues[centerY * width + centerX] == 0 ) return;
+
+    // Same bounds as the OpenCL kernel: the upper bounds are inclusive and clamped
+    // to the edge of the slice like the OpenCL sampler does.
+    int xStart = std::max( 0, centerX - searchRadius );
+    int xEnd   = std::min( width, centerX + searchRadius );
+    int yStart = std::max( 0, centerY - searchRadius );
+    int yEnd   = std::min( height, centerY + searchRadius );
+
+    const InternalRealType * l  = sliceIndexToLocation;
+    const InternalRealType c[3] = { l[0], l[4], l[8] };
+    float squaredDistances[IBIS_VOLUME_RECONSTRUCTION_LANES];
+
+    for( int iy = yStart; iy <= yEnd; iy++ )
+    {
+        // offset from the voxel to the first pixel of the row
+        InternalRealType b[3];
+        for( int k = 0; k < 3; k++ ) b[k] = l[4 * k + 1] * iy + l[4 * k + 3] - volumeLocation[k];
+        int rowOffset = std::min( iy, height - 1 ) * width;
+
+        for( int ix = xStart; ix <= xEnd; ix += lanes )
+        {
+            int closeMask = VolumeReconstructionSIMD::ClosePixels( ix, c, b, squaredDistances );
+            if( closeMask == 0 ) continue;
+            int nbLanes = std::min( lanes, xEnd - ix + 1 );
+            for( int lane = 0; lane < nbLanes; lane++ )
+            {
+                if( !( closeMask & ( 1 << lane ) ) ) continue;
+                int pixelIndex = rowOffset + std::min( ix + lane, width - 1 );
+                if( maskValues[pixelIndex] > 0 )
+                {
+                    InternalRealType currentWeight = std::exp( -squaredDistances[lane] / ( 2.0f * variance ) );
+                    weightedValue += currentWeight * pixels[pixelIndex];
+                    weight += currentWeight;
+                }
+            }
+        }
+    }
+}
+
+template <class TImage>
+void CPUVolumeReconstruction<TImage>::ComputeSliceBounds( const InternalRealType * volumeIndexToSliceIndex,
+                                                          const int sliceSize[2], double margin, double lower[3],
+                                                          double upper[3], double origin[3], double normal[3] )
+{
+    vnl_matrix_fixed<double, 4, 4> toSliceIndex;
+    toSliceIndex.set_identity();
+    for( unsigned int i = 0; i < 3; i++ )
+    {
+        for( unsigned int j = 0; j < 4; j++ )
+        {
+            toSliceIndex[i][j] = volumeIndexToSliceIndex[4 * i + j];
+        }
+    }
+    vnl_matrix_fixed<double, 4, 4> sliceIndexToVolumeIndex = vnl_inverse( toSliceIndex );
+
+    double axisX[3], axisY[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        origin[k] = sliceIndexToVolumeIndex[k][3];
+        axisX[k]  = sliceIndexToVolumeIndex[k][0];
+        axisY[k]  = sliceIndexToVolumeIndex[k][1];
+    }
+
+    // The kernel may read pixels up to index width and height (clamped to the edge), so those are the corners used.
+    for( int k = 0; k < 3; k++ )
+    {
+        double x = axisX[k] * sliceSize[0];
+        double y = axisY[k] * sliceSize[1];
+        lower[k] = origin[k] + std::min( 0.0, x ) + std::min( 0.0, y ) - margin;
+        upper[k] = origin[k] + std::max( 0.0, x ) + std::max( 0.0, y ) + margin;
+    }
+
+    normal[0]   = axisX[1] * axisY[2] - axisX[2] * axisY[1];
+    normal[1]   = axisX[2] * axisY[0] - axisX[0] * axisY[2];
+    normal[2]   = axisX[0] * axisY[1] - axisX[1] * axisY[0];
+    double norm = std::sqrt( normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2] );
+    for( int k = 0; k < 3; k++ ) normal[k] = norm > 0.0 ? normal[k] / norm : 0.0;
+}
+
+template <class TImage>
+void CPUVolumeReconstruction<TImage>::ReconstructTile( const int tileStart[3],
+                                                       const std::vector<unsigned int> & slices )
+{
+    if( slices.empty() ) return;  // the output volume is already filled with 0
+
+    const InternalRealType * toLocation = m_VolumeIndexToLocationMatrix.data();
+    ImagePixelType * output             = m_ReconstructedVolume->GetBufferPointer();
+
+    int tileEnd[3];
+    for( int k = 0; k < 3; k++ ) tileEnd[k] = std::min( tileStart[k] + (int)TileSize, m_VolumeSize[k] );
+
+    for( int z = tileStart[2]; z < tileEnd[2]; z++ )
+    {
+        for( int y = tileStart[1]; y < tileEnd[1]; y++ )
+        {
+            for( int x = tileStart[0]; x < tileEnd[0]; x++ )
+            {
+                InternalRealType volumeIndex[3] = { (InternalRealType)x, (InternalRealType)y, (InternalRealType)z };
+                InternalRealType volumeLocation[3];
+                for( int k = 0; k < 3; k++ )
+                {
+                    volumeLocation[k] = toLocation[4 * k] * volumeIndex[0] + toLocation[4 * k + 1] * volumeIndex[1] +
+                                        toLocation[4 * k + 2] * volumeIndex[2] + toLocation[4 * k + 3];
+                }
+
+                InternalRealType weightedValue = 0.0;
+                InternalRealType weight        = 0.0;
+                for( unsigned int sliceIdx : slices )
+                {
+                    AccumulateSlice( &m_VolumeIndexToSliceIndexMatrices[12 * sliceIdx],
+                                     &m_SliceIndexToLocationMatrices[12 * sliceIdx], m_SlicePixels[sliceIdx],
+                                     m_MaskValues.data(), m_SliceSize, (int)m_USSearchRadius, m_Variance, volumeIndex,
+                                     volumeLocation, weightedValue, weight );
+                }
+
+                size_t voxelIndex = ( (size_t)z * m_VolumeSize[1] + y ) * m_VolumeSize[0] + x;
+                output[voxelIndex] = weightedValue > 0 ? ImagePixelType( weightedValue / weight ) : ImagePixelType( 0 );
+            }
+        }
+    }
+}
+
+template <class TImage>
+void CPUVolumeReconstruction<TImage>::BinSlices( const int nbrOfTiles[3] )
+{
+    size_t totalNbrOfTiles = (size_t)nbrOfTiles[0] * nbrOfTiles[1] * nbrOfTiles[2];
+    m_TileSlices.assign( totalNbrOfTiles, std::vector<unsigned int>() );
+
+    // A voxel only gets a contribution from pixels closer than 1 mm. The volume spacing is isotropic
+    // and its direction is the identity, so this distance is 1 / spacing in volume index space.
+    // Half a voxel is added to stay on the safe side of rounding.
+    const double margin     = 1.0 / m_VolumeSpacing + 0.5;
+    const double tileRadius = 0.5 * std::sqrt( 3.0 ) * ( TileSize - 1 );
+
+    for( unsigned int sliceIdx = 0; sliceIdx < m_NumberOfSlices; sliceIdx++ )
+    {
+        // Bounds of the slice in volume index space and its plane, used to drop the tiles
+        // of the bounding box that are too far from the slice
+        double lower[3], upper[3], origin[3], normal[3];
+        ComputeSliceBounds( &m_VolumeIndexToSliceIndexMatrices[12 * sliceIdx], m_SliceSize, margin, lower, upper,
+                            origin, normal );
+
+        int tileLower[3], tileUpper[3];
+        bool outside = false;
+        for( int k = 0; k < 3; k++ )
+        {
+            tileLower[k] = std::max( 0, (int)std::floor( lower[k] / TileSize ) );
+            tileUpper[k] = std::min( nbrOfTiles[k] - 1, (int)std::floor( upper[k] / TileSize ) );
+            if( tileLower[k] > tileUpper[k] ) outside = true;
+        }
+        if( outside ) continue;
+
+        for( int tz = tileLower[2]; tz <= tileUpper[2]; tz++ )
+        {
+            for( int ty = tileLower[1]; ty <= tileUpper[1]; ty++ )
+            {
+                for( int tx = tileLower[0]; tx <= tileUpper[0]; tx++ )
+                {
+                    int tile[3]     = { tx, ty, tz };
+                    double distance = 0.0;
+                    for( int k = 0; k < 3; k++ )
+                    {
+                        double center = tile[k] * TileSize + 0.5 * ( TileSize - 1 );
+                        distance += ( center - origin[k] ) * normal[k];
+                    }
+                    if( std::fabs( distance ) > tileRadius + margin ) continue;
+
+                    size_t tileIdx = ( (size_t)tz * nbrOfTiles[1] + ty ) * nbrOfTiles[0] + tx;
+                    m_TileSlices[tileIdx].push_back( sliceIdx );
+                }
+            }
+        }
+    }
+}
+
+template <class TImage>
+void CPUVolumeReconstruction<TImage>::ReconstructVolume( void )
+{
+    this->InitializeReconstruction();
+
+    itk::TimeProbe clockKernel;
+    clockKernel.Start();
+
+    m_SliceSize[0] = m_FixedSliceMask->GetLargestPossibleRegion().GetSize()[0];
+    m_SliceSize[1] = m_FixedSliceMask->GetLargestPossibleRegion().GetSize()[1];
+    for( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+        m_VolumeSize[i] = m_ReconstructedVolume->GetLargestPossibleRegion().GetSize()[i];
+    }
+    m_Variance = m_KernelStdDev * m_KernelStdDev;
+
+    m_SlicePixels.resize( m_NumberOfSlices );
+    for( unsigned int sliceIdx = 0; sliceIdx < m_NumberOfSlices; sliceIdx++ )
+    {
+        m_FixedSlices[sliceIdx]->Update();
+        m_SlicePixels[sliceIdx] = m_FixedSlices[sliceIdx]->GetBufferPointer();
+    }
+
+    int nbrOfTiles[3];
+    for( int k = 0; k < 3; k++ ) nbrOfTiles[k] = ( m_VolumeSize[k] + TileSize - 1 ) / TileSize;
+    SizeValueType totalNbrOfTiles = (SizeValueType)nbrOfTiles[0] * nbrOfTiles[1] * nbrOfTiles[2];
+
+    std::vector<unsigned int> allSlices;
+    if( m_SliceBinning )
+    {
+        BinSlices( nbrOfTiles );
+    }
+    else
+    {
+        allSlices.resize( m_NumberOfSlices );
+        for( unsigned int sliceIdx = 0; sliceIdx < m_NumberOfSlices; sliceIdx++ ) allSlices[sliceIdx] = sliceIdx;
+    }
+
+    MultiThreaderBase::Pointer threader = MultiThreaderBase::New();
+    threader->ParallelizeArray(
+        0, totalNbrOfTiles,
+        [this, &nbrOfTiles, &allSlices]( SizeValueType tileIdx )
+        {
+            int tileStart[3];
+            tileStart[0] = (int)( tileIdx % nbrOfTiles[0] ) * TileSize;
+            tileStart[1] = (int)( ( tileIdx / nbrOfTiles[0] ) % nbrOfTiles[1] ) * TileSize;
+            tileStart[2] = (int)( tileIdx / ( (SizeValueType)nbrOfTiles[0] * nbrOfTiles[1] ) ) * TileSize;
+            this->ReconstructTile( tileStart, m_SliceBinning ? m_TileSlices[tileIdx] : allSlices );
+        },
+        nullptr );
+
+    if( m_Debug && m_SliceBinning )
+    {
+        size_t nbrOfBinnedSlices = 0;
+        for( const std::vector<unsigned int> & tileSlices : m_TileSlices ) nbrOfBinnedSlices += tileSlices.size();
+        std::cout << "Average number of slices per tile:\t" << double( nbrOfBinnedSlices ) / totalNbrOfTiles
+                  << " of " << m_NumberOfSlices << std::endl;
+    }
+
+    m_SlicePixels.clear();
+    m_TileSlices.clear();
+    m_ReconstructedVolume->Modified();
+
+    clockKernel.Stop();
+
+    if( m_Debug )
+    {
+        std::cout << "Volume Size:\t" << m_VolumeSize[0] << ", " << m_VolumeSize[1] << ", " << m_VolumeSize[2]
+                  << std::endl;
+        std::cout << "Number of threads:\t" << threader->GetMaximumNumberOfThreads() << std::endl;
+        std::cerr << "Time to Reconstruct on CPU:\t" << clockKernel.GetMean() << std::endl;
+        WriterPointer writer = WriterType::New();
+        writer->SetInput( m_ReconstructedVolume );
+        writer->SetFileName( "reconstructedVolume.mnc" );
+        writer->Update();
+    }
+}
+
+}  // end namespace itk
+
+#endif
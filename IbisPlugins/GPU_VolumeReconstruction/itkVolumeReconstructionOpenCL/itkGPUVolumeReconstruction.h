@@ -13,118 +13,85 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #ifndef ITKGPUVOLUMERECONSTRUCTION_H
 #define ITKGPUVOLUMERECONSTRUCTION_H
 
-#include <itkEuler3DTransform.h>
-#include <itkImage.h>
-#include <itkImageFileWriter.h>  //ImageFileWriter used for debugging
-#include <itkObject.h>
 #include <itkOpenCLUtil.h>
-#include <vnl/vnl_inverse.h>
-#include <vnl/vnl_matrix.h>
-#include <vnl/vnl_matrix_fixed.h>
+
+#include "itkVolumeReconstruction.h"
+
 namespace itk
 {
+/**
+ * \class GPUVolumeReconstruction
+ * OpenCL backend of the US volume reconstruction. Slices are uploaded to the device in
+ * batches and the kernel accumulates the weighted values of each batch for every voxel.
+ * A second kernel normalizes the accumulated values and the result is read straight into
+ * the buffer of the reconstructed volume. The device buffers are kept between calls and
+ * only reallocated when the volume grows.
+ */
 template <class TImage>
-class ITK_EXPORT GPUVolumeReconstruction : public Object
+class ITK_EXPORT GPUVolumeReconstruction : public VolumeReconstruction<TImage>
 {
 public:
     /** Standard class typedefs. */
     typedef GPUVolumeReconstruction Self;
-    typedef Object Superclass;
+    typedef VolumeReconstruction<TImage> Superclass;
     typedef SmartPointer<Self> Pointer;
     typedef SmartPointer<const Self> ConstPointer;
 
-    typedef float InternalRealType;
+    typedef typename Superclass::InternalRealType InternalRealType;
+    typedef typename Superclass::ImageType ImageType;
+    typedef typename Superclass::ImagePixelType ImagePixelType;
+    typedef typename Superclass::ImagePointer ImagePointer;
+    typedef typename Superclass::WriterType WriterType;
+    typedef typename Superclass::WriterPointer WriterPointer;
 
     /** Method for creation through the object factory. */
     itkNewMacro( Self );
 
     /** Run-time type information (and related methods). */
-    itkTypeMacro( GPUVolumeReconstruction, Object );
-
-    /** Image type. */
-    typedef TImage ImageType;
-    typedef typename ImageType::PixelType ImagePixelType;
-    typedef typename ImageType::Pointer ImagePointer;
-    typedef typename ImageType::ConstPointer ImageConstPointer;
-    typedef typename ImageType::PointType ImagePointType;
-    typedef typename ImageType::DirectionType ImageDirectionType;
-
-    typedef itk::Euler3DTransform<float> TransformType;
-    typedef typename TransformType::Pointer TransformPointer;
-
-    itkGetObjectMacro( FixedSliceMask, ImageType );
-    itkSetObjectMacro( FixedSliceMask, ImageType );
-
-    itkGetObjectMacro( ReconstructedVolume, ImageType );
-
-    itkSetMacro( USSearchRadius, unsigned int );
+    itkTypeMacro( GPUVolumeReconstruction, VolumeReconstruction );
 
-    itkSetMacro( KernelStdDev, float );
-
-    itkSetMacro( VolumeSpacing, float );
-
-    itkGetObjectMacro( Transform, TransformType );
-    itkSetObjectMacro( Transform, TransformType );
-
-    /** Extract dimension from input image. */
     itkStaticConstMacro( ImageDimension, unsigned int, TImage::ImageDimension );
 
-    typedef Image<InternalRealType, ImageDimension> RealImageType;
-    typedef typename RealImageType::Pointer RealImagePointer;
-
-    itkSetMacro( Debug, bool );
-
-    // ImageFileWriter used for debugging
-    typedef itk::ImageFileWriter<ImageType> WriterType;
-    typedef typename WriterType::Pointer WriterPointer;
-
-    void ReconstructVolume( void );
-
-    void SetFixedSlice( unsigned int sliceIdx, ImagePointer sliceImage );
-
-    void SetNumberOfSlices( unsigned int numberOfSlices );
+    void ReconstructVolume( void ) override;
 
 protected:
     GPUVolumeReconstruction();
     virtual ~GPUVolumeReconstruction();
 
-    void InitializeGPUContext( void );
+    using Superclass::m_Debug;
+    using Superclass::m_FixedSliceMask;
+    using Superclass::m_FixedSlices;
+    using Superclass::m_KernelStdDev;
+    using Superclass::m_MaskValues;
+    using Superclass::m_NbrPixelsInSlice;
+    using Superclass::m_NumberOfSlices;
+    using Superclass::m_ReconstructedVolume;
+    using Superclass::m_SliceIndexToLocationMatrices;
+    using Superclass::m_USSearchRadius;
+    using Superclass::m_VolumeIndexToLocationMatrix;
+    using Superclass::m_VolumeIndexToSliceIndexMatrices;
+    using Superclass::m_VolumeSpacing;
 
-    void PrintSelf( std::ostream & os, Indent indent ) const override;
+    void InitializeGPUContext( void );
 
     cl_kernel CreateKernelFromFile( const char * filename, const char * cPreamble, const char * kernelname,
                                     const char * cOptions );
     cl_kernel CreateKernelFromString( const char * cOriginalSourceString, const char * cPreamble,
                                       const char * kernelname, const char * cOptions, cl_program * program );
 
-    void CreateReconstructedVolume( void );
-    void CreateMatrices( void );
-
-    bool CheckAllSlicesDefined( void );
-
-    bool m_Debug;
-
-    unsigned int m_NumberOfSlices;
-    unsigned int m_NbrPixelsInSlice;
-
-    unsigned int m_USSearchRadius;
-    float m_KernelStdDev;
-    float m_VolumeSpacing;
-
-    TransformPointer m_Transform;
-
-    ImagePointer m_FixedSliceMask;
+    /** Make sure the device buffers can hold a volume of nbrOfVoxels voxels and clear the accumulator. */
+    void PrepareVolumeGPUBuffers( size_t nbrOfVoxels );
 
     cl_mem m_FixedImageGPUBuffer;
 
-    std::vector<ImagePointer> m_FixedSlices;
-
-    std::vector<unsigned int> m_SliceValidIdxs;
-
-    ImagePointer m_ReconstructedVolume;
-
     cl_program m_VolumeReconstructionPopulatingProgram;
     cl_kernel m_VolumeReconstructionPopulatingKernel;
+    cl_kernel m_VolumeReconstructionNormalizingKernel;
+
+    // Weight and weighted value accumulator (REAL2 per voxel) and normalized volume, reused between calls
+    cl_mem m_AccumWeightAndWeightedValueGPUBuffer;
+    cl_mem m_ReconstructedVolumeGPUBuffer;
+    size_t m_VolumeGPUBuffersCapacity;
 
     cl_platform_id m_Platform;
     cl_context m_Context;
@@ -136,10 +103,6 @@ protected:
 
     cl_mem m_gpuAllMatrices;
 
-    InternalRealType * m_VolumeIndexToSliceIndexMatrices;
-    InternalRealType * m_VolumeIndexToLocationMatrix;
-    InternalRealType * m_SliceIndexToLocationMatrices;
-
 private:
     GPUVolumeReconstruction( const Self & );  // purposely not implemented
     void operator=( const Self & );           // purposely not implemented
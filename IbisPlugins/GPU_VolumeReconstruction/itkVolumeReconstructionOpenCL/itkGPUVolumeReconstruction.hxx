@@ -13,13 +13,14 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #ifndef ITKGPUVOLUMERECONSTRUCTION_HXX
 #define ITKGPUVOLUMERECONSTRUCTION_HXX
 
-#include <itkImageDuplicator.h>
 #include <itkMacro.h>
 #include <itkMatrix.h>
 #include <itkOpenCLUtil.h>
 #include <itkTimeProbe.h>
 #include <vnl/vnl_matrix.h>
 
+#include <type_traits>
+
 #include "GPUVolumeReconstructionKernel.h"
 #include "itkGPUVolumeReconstruction.h"
 
@@ -36,19 +37,14 @@ GPUVolumeReconstruction<TImage>::GPUVolumeReconstruction()
         itkExceptionMacro( << "OpenCL-enabled GPU is not present." );
     }
 
-    m_Debug                                = false;
-    m_VolumeReconstructionPopulatingKernel = 0;
+    m_VolumeReconstructionPopulatingKernel  = 0;
+    m_VolumeReconstructionNormalizingKernel = 0;
+    m_AccumWeightAndWeightedValueGPUBuffer  = 0;
+    m_ReconstructedVolumeGPUBuffer          = 0;
+    m_VolumeGPUBuffersCapacity              = 0;
 
     /* Initialize GPU Context */
     this->InitializeGPUContext();
-
-    m_NumberOfSlices = 0;
-
-    m_USSearchRadius = 0;
-    m_KernelStdDev   = 1.0;
-    m_VolumeSpacing  = 1.0;
-
-    m_Transform = TransformType::New();
 }
 
 template <class TImage>
@@ -56,6 +52,9 @@ GPUVolumeReconstruction<TImage>::~GPUVolumeReconstruction()
 {
     if( m_VolumeReconstructionPopulatingProgram ) clReleaseProgram( m_VolumeReconstructionPopulatingProgram );
     if( m_VolumeReconstructionPopulatingKernel ) clReleaseKernel( m_VolumeReconstructionPopulatingKernel );
+    if( m_VolumeReconstructionNormalizingKernel ) clReleaseKernel( m_VolumeReconstructionNormalizingKernel );
+    if( m_AccumWeightAndWeightedValueGPUBuffer ) clReleaseMemObject( m_AccumWeightAndWeightedValueGPUBuffer );
+    if( m_ReconstructedVolumeGPUBuffer ) clReleaseMemObject( m_ReconstructedVolumeGPUBuffer );
     for( unsigned int i = 0; i < m_NumberOfDevices; i++ )
     {
         clReleaseCommandQueue( m_CommandQueue[i] );
@@ -76,7 +75,10 @@ void GPUVolumeReconstruction<TImage>::InitializeGPUContext( void )
 
     // Get NVIDIA platform by default
     m_Platform = OpenCLSelectPlatform( "NVIDIA" );
-    assert( m_Platform != nullptr );
+    if( m_Platform == nullptr )
+    {
+        itkExceptionMacro( << "No OpenCL platform found." );
+    }
 
     cl_device_type devType = CL_DEVICE_TYPE_GPU;
     m_Devices              = OpenCLGetAvailableDevices( m_Platform, devType, &m_NumberOfDevices );
@@ -96,15 +98,39 @@ void GPUVolumeReconstruction<TImage>::InitializeGPUContext( void )
     m_VolumeReconstructionPopulatingKernel =
         CreateKernelFromString( GPUVolumeReconstructionKernel, "", "VolumeReconstructionPopulating", "",
                                 &m_VolumeReconstructionPopulatingProgram );
+
+    // Both kernels are in the same source, no need to build the program twice
+    m_VolumeReconstructionNormalizingKernel =
+        clCreateKernel( m_VolumeReconstructionPopulatingProgram, "VolumeReconstructionNormalizing", &errid );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 }
 
-/**
- * Standard "PrintSelf" method.
- */
 template <class TImage>
-void GPUVolumeReconstruction<TImage>::PrintSelf( std::ostream & os, Indent indent ) const
+void GPUVolumeReconstruction<TImage>::PrepareVolumeGPUBuffers( size_t nbrOfVoxels )
 {
-    Superclass::PrintSelf( os, indent );
+    cl_int errid;
+    if( nbrOfVoxels > m_VolumeGPUBuffersCapacity )
+    {
+        if( m_AccumWeightAndWeightedValueGPUBuffer ) clReleaseMemObject( m_AccumWeightAndWeightedValueGPUBuffer );
+        if( m_ReconstructedVolumeGPUBuffer ) clReleaseMemObject( m_ReconstructedVolumeGPUBuffer );
+        m_AccumWeightAndWeightedValueGPUBuffer = 0;
+        m_ReconstructedVolumeGPUBuffer         = 0;
+        m_VolumeGPUBuffersCapacity             = 0;
+
+        m_AccumWeightAndWeightedValueGPUBuffer = clCreateBuffer(
+            m_Context, CL_MEM_READ_WRITE, 2 * nbrOfVoxels * sizeof( InternalRealType ), nullptr, &errid );
+        OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+        m_ReconstructedVolumeGPUBuffer =
+            clCreateBuffer( m_Context, CL_MEM_WRITE_ONLY, nbrOfVoxels * sizeof( InternalRealType ), nullptr, &errid );
+        OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+        m_VolumeGPUBuffersCapacity = nbrOfVoxels;
+    }
+
+    // Clear the part of the accumulator used by this volume on the device, without going through a host buffer
+    InternalRealType zero = 0.0;
+    errid = clEnqueueFillBuffer( m_CommandQueue[0], m_AccumWeightAndWeightedValueGPUBuffer, &zero, sizeof( zero ), 0,
+                                 2 * nbrOfVoxels * sizeof( InternalRealType ), 0, nullptr, nullptr );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 }
 
 /**
@@ -181,273 +207,22 @@ cl_kernel GPUVolumeReconstruction<TImage>::CreateKernelFromString( const char *
     return kernel;
 }
 
-template <class TImage>
-void GPUVolumeReconstruction<TImage>::SetNumberOfSlices( unsigned int numberOfSlices )
-{
-    if( m_NumberOfSlices != numberOfSlices )
-    {
-        m_NumberOfSlices = numberOfSlices;
-        m_FixedSlices.resize( m_NumberOfSlices );
-    }
-
-    for( unsigned int i = 0; i < m_NumberOfSlices; i++ )
-    {
-        m_FixedSlices[i] = nullptr;
-    }
-}
-
-template <class TImage>
-void GPUVolumeReconstruction<TImage>::SetFixedSlice( unsigned int sliceIdx, ImagePointer sliceImage )
-{
-    m_FixedSlices[sliceIdx] = sliceImage;
-}
-
-template <class TImage>
-bool GPUVolumeReconstruction<TImage>::CheckAllSlicesDefined( void )
-{
-    bool allSlicesDefined = true;
-    for( unsigned int i = 0; i < m_NumberOfSlices; i++ )
-    {
-        if( m_FixedSlices[i] == nullptr )
-        {
-            allSlicesDefined = false;
-            break;
-        }
-    }
-    return allSlicesDefined;
-}
-
-template <class TImage>
-void GPUVolumeReconstruction<TImage>::CreateReconstructedVolume( void )
-{
-    if( m_Debug ) std::cerr << "Creating Empty Reconstructed Volume.." << std::endl;
-
-    itk::TimeProbe clockReconstruction;
-    clockReconstruction.Start();
-    // Find bounds for 1mm3 US volume
-    typename ImageType::PointType corner1, corner2, corner3, corner4;
-    typename ImageType::PointType trCorner1, trCorner2, trCorner3, trCorner4;
-    typename ImageType::IndexType fixedIndex;
-    typename ImageType::SizeType sliceSize = m_FixedSlices[1]->GetLargestPossibleRegion().GetSize();
-
-    double m_LowerBound[3], m_UpperBound[3];
-
-    m_LowerBound[0] = 10000.0;
-    m_LowerBound[1] = 10000.0;
-    m_LowerBound[2] = 10000.0;
-    m_UpperBound[0] = -10000.0;
-    m_UpperBound[1] = -10000.0;
-    m_UpperBound[2] = -10000.0;
-    for( unsigned int i = 1; i < m_NumberOfSlices; i++ )
-    {
-        fixedIndex[0] = 0;
-        fixedIndex[1] = 0;
-        fixedIndex[2] = 0;
-        m_FixedSlices[i]->TransformIndexToPhysicalPoint( fixedIndex, corner1 );
-
-        fixedIndex[0] = 0 + sliceSize[0];
-        fixedIndex[1] = 0;
-        fixedIndex[2] = 0;
-        m_FixedSlices[i]->TransformIndexToPhysicalPoint( fixedIndex, corner2 );
-
-        fixedIndex[0] = 0;
-        fixedIndex[1] = 0 + sliceSize[1];
-        fixedIndex[2] = 0;
-        m_FixedSlices[i]->TransformIndexToPhysicalPoint( fixedIndex, corner3 );
-
-        fixedIndex[0] = 0 + sliceSize[0];
-        fixedIndex[1] = 0 + sliceSize[1];
-        fixedIndex[2] = 0;
-        m_FixedSlices[i]->TransformIndexToPhysicalPoint( fixedIndex, corner4 );
-
-        trCorner1 = m_Transform->TransformPoint( corner1 );
-        trCorner2 = m_Transform->TransformPoint( corner2 );
-        trCorner3 = m_Transform->TransformPoint( corner3 );
-        trCorner4 = m_Transform->TransformPoint( corner4 );
-
-        m_LowerBound[0] = std::min( trCorner1[0], m_LowerBound[0] );
-        m_LowerBound[1] = std::min( trCorner1[1], m_LowerBound[1] );
-        m_LowerBound[2] = std::min( trCorner1[2], m_LowerBound[2] );
-        m_LowerBound[0] = std::min( trCorner2[0], m_LowerBound[0] );
-        m_LowerBound[1] = std::min( trCorner2[1], m_LowerBound[1] );
-        m_LowerBound[2] = std::min( trCorner2[2], m_LowerBound[2] );
-        m_LowerBound[0] = std::min( trCorner3[0], m_LowerBound[0] );
-        m_LowerBound[1] = std::min( trCorner3[1], m_LowerBound[1] );
-        m_LowerBound[2] = std::min( trCorner3[2], m_LowerBound[2] );
-        m_LowerBound[0] = std::min( trCorner4[0], m_LowerBound[0] );
-        m_LowerBound[1] = std::min( trCorner4[1], m_LowerBound[1] );
-        m_LowerBound[2] = std::min( trCorner4[2], m_LowerBound[2] );
-
-        m_UpperBound[0] = std::max( trCorner1[0], m_UpperBound[0] );
-        m_UpperBound[1] = std::max( trCorner1[1], m_UpperBound[1] );
-        m_UpperBound[2] = std::max( trCorner1[2], m_UpperBound[2] );
-        m_UpperBound[0] = std::max( trCorner2[0], m_UpperBound[0] );
-        m_UpperBound[1] = std::max( trCorner2[1], m_UpperBound[1] );
-        m_UpperBound[2] = std::max( trCorner2[2], m_UpperBound[2] );
-        m_UpperBound[0] = std::max( trCorner3[0], m_UpperBound[0] );
-        m_UpperBound[1] = std::max( trCorner3[1], m_UpperBound[1] );
-        m_UpperBound[2] = std::max( trCorner3[2], m_UpperBound[2] );
-        m_UpperBound[0] = std::max( trCorner4[0], m_UpperBound[0] );
-        m_UpperBound[1] = std::max( trCorner4[1], m_UpperBound[1] );
-        m_UpperBound[2] = std::max( trCorner4[2], m_UpperBound[2] );
-    }
-
-    typename ImageType::IndexType startIndex;
-    startIndex[0] = 0;  // first index on X
-    startIndex[1] = 0;  // first index on Y
-    startIndex[2] = 0;  // first index on Z
-
-    typename ImageType::SpacingType spacing1;
-    spacing1.Fill( m_VolumeSpacing );
-
-    typename ImageType::SizeType size1;
-    size1[0] = ceil( m_UpperBound[0] - m_LowerBound[0] ) / spacing1[0];  // size along X
-    size1[1] = ceil( m_UpperBound[1] - m_LowerBound[1] ) / spacing1[1];  // size along Y
-    size1[2] = ceil( m_UpperBound[2] - m_LowerBound[2] ) / spacing1[2];  // size along Z
-
-    typename ImageType::RegionType region1;
-    region1.SetSize( size1 );
-    region1.SetIndex( startIndex );
-
-    m_ReconstructedVolume = ImageType::New();
-    m_ReconstructedVolume->SetRegions( region1 );
-    m_ReconstructedVolume->SetOrigin( m_LowerBound );
-    m_ReconstructedVolume->SetSpacing( spacing1 );
-    m_ReconstructedVolume->Allocate();
-    m_ReconstructedVolume->FillBuffer( 0.0 );
-
-    if( m_Debug ) std::cerr << "Creating Emtpy Reconstructed Volume..DONE" << std::endl;
-}
-
-template <class TImage>
-void GPUVolumeReconstruction<TImage>::CreateMatrices( void )
-{
-    if( m_Debug ) std::cerr << "Creating Matrices.." << std::endl;
-
-    m_VolumeIndexToSliceIndexMatrices = new InternalRealType[m_NumberOfSlices * 12];
-    m_VolumeIndexToLocationMatrix     = new InternalRealType[12];
-    m_SliceIndexToLocationMatrices    = new InternalRealType[m_NumberOfSlices * 12];
-
-    ImageDirectionType volumeScale;
-    for( unsigned int i = 0; i < ImageDimension; i++ )
-    {
-        volumeScale[i][i] = m_ReconstructedVolume->GetSpacing()[i];
-    }
-    ImageDirectionType volumeIndexToLocation3x3 = m_ReconstructedVolume->GetDirection() * volumeScale;
-
-    vnl_matrix_fixed<InternalRealType, 4, 4> volumeIndexToLocation4x4;
-    volumeIndexToLocation4x4.set_identity();
-    for( unsigned int i = 0; i < ImageDimension; i++ )
-    {
-        volumeIndexToLocation4x4[i][3]           = m_ReconstructedVolume->GetOrigin()[i];
-        m_VolumeIndexToLocationMatrix[4 * i + 3] = volumeIndexToLocation4x4[i][3];
-        for( unsigned int j = 0; j < ImageDimension; j++ )
-        {
-            volumeIndexToLocation4x4[i][j]           = volumeIndexToLocation3x3[i][j];  // Does this make sense??
-            m_VolumeIndexToLocationMatrix[4 * i + j] = volumeIndexToLocation3x3[i][j];
-        }
-    }
-
-    vnl_matrix_fixed<InternalRealType, 4, 4> locationToTransformLocation4x4;
-    locationToTransformLocation4x4.set_identity();
-    for( unsigned int i = 0; i < ImageDimension; i++ )
-    {
-        locationToTransformLocation4x4[i][3] = m_Transform->GetOffset()[i];
-        for( unsigned int j = 0; j < ImageDimension; j++ )
-        {
-            locationToTransformLocation4x4[i][j] = m_Transform->GetMatrix()[i][j];
-        }
-    }
-
-    for( unsigned int sliceIdx = 0; sliceIdx < m_NumberOfSlices; sliceIdx++ )
-    {
-        ImageDirectionType scale;
-        for( unsigned int i = 0; i < ImageDimension; i++ )
-        {
-            scale[i][i] = m_FixedSlices[sliceIdx]->GetSpacing()[i];
-        }
-        ImageDirectionType sliceIndexToLocation3x3 = m_FixedSlices[sliceIdx]->GetDirection() * scale;
-
-        vnl_matrix_fixed<InternalRealType, 4, 4> sliceIndexToLocation4x4, transSliceIndexToLocation4x4;
-        sliceIndexToLocation4x4.set_identity();
-        for( unsigned int i = 0; i < ImageDimension; i++ )
-        {
-            sliceIndexToLocation4x4[i][3] = m_FixedSlices[sliceIdx]->GetOrigin()[i];
-
-            for( unsigned int j = 0; j < ImageDimension; j++ )
-            {
-                sliceIndexToLocation4x4[i][j] = sliceIndexToLocation3x3[i][j];  // Does this make sense??
-            }
-        }
-
-        transSliceIndexToLocation4x4 = locationToTransformLocation4x4 * sliceIndexToLocation4x4;
-        vnl_matrix_fixed<InternalRealType, 4, 4> volumeIndexToSliceIndex =
-            vnl_inverse( transSliceIndexToLocation4x4 ) * volumeIndexToLocation4x4;
-        for( unsigned int i = 0; i < ImageDimension; i++ )
-        {
-            m_VolumeIndexToSliceIndexMatrices[sliceIdx * 12 + 4 * i + 3] = volumeIndexToSliceIndex[i][3];
-            m_SliceIndexToLocationMatrices[sliceIdx * 12 + 4 * i + 3]    = transSliceIndexToLocation4x4[i][3];
-            for( unsigned int j = 0; j < ImageDimension; j++ )
-            {
-                m_VolumeIndexToSliceIndexMatrices[sliceIdx * 12 + 4 * i + j] = volumeIndexToSliceIndex[i][j];
-
-                m_SliceIndexToLocationMatrices[sliceIdx * 12 + 4 * i + j] = transSliceIndexToLocation4x4[i][j];
-            }
-        }
-    }
-
-    if( m_Debug )
-    {
-        std::cout << "Creating Matrix Buffers on GPU" << std::endl;
-        std::cout << "Creating Matrices..DONE" << std::endl;
-    }
-}
-
 template <class TImage>
 void GPUVolumeReconstruction<TImage>::ReconstructVolume( void )
 {
-    if( !CheckAllSlicesDefined() )
-    {
-        itkExceptionMacro( << "All Fixed Slices have not been set." );
-    }
-
-    if( m_FixedSliceMask == nullptr )
-    {
-        using DuplicatorType                        = itk::ImageDuplicator<ImageType>;
-        typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
-        duplicator->SetInputImage( m_FixedSlices[0] );
-        duplicator->Update();
-        m_FixedSliceMask = duplicator->GetOutput();
-        m_FixedSliceMask->FillBuffer( 1 );
-    }
-    m_FixedSliceMask->Update();
-
-    CreateReconstructedVolume();
+    static_assert( std::is_same<ImagePixelType, InternalRealType>::value,
+                   "The normalized volume is read directly into the output image buffer" );
 
-    CreateMatrices();
+    this->InitializeReconstruction();
 
     unsigned int maxNbrOfSlices = 8;  // No reason in particular.. seems to yield a good tradeoff
 
     itk::TimeProbe clockGPUKernel;
     clockGPUKernel.Start();
 
-    m_NbrPixelsInSlice               = m_FixedSliceMask->GetLargestPossibleRegion().GetNumberOfPixels();
-    unsigned int nbrOfPixelsInVolume = m_ReconstructedVolume->GetLargestPossibleRegion().GetNumberOfPixels();
-    unsigned int size_output         = nbrOfPixelsInVolume * sizeof( ImagePixelType );
-    unsigned int size_slice          = m_NbrPixelsInSlice * sizeof( InternalRealType );
-
-    if( m_Debug )
-    {
-        std::cout << "Volume Spacing:\t" << m_VolumeSpacing << std::endl;
-        std::cout << "Standard Deviation:\t" << m_KernelStdDev << std::endl;
-        std::cout << "Number of Pixels in Slice:\t" << m_NbrPixelsInSlice << std::endl;
-    }
-
-    unsigned char * maskValues = new unsigned char[m_NbrPixelsInSlice];
-    for( unsigned int n = 0; n < m_NbrPixelsInSlice; n++ )
-    {
-        maskValues[n] = (unsigned char)( m_FixedSliceMask->GetPixel( m_FixedSliceMask->ComputeIndex( n ) ) );
-    }
+    size_t nbrOfPixelsInVolume = m_ReconstructedVolume->GetLargestPossibleRegion().GetNumberOfPixels();
+    size_t size_output         = nbrOfPixelsInVolume * sizeof( ImagePixelType );
+    unsigned int size_slice    = m_NbrPixelsInSlice * sizeof( InternalRealType );
 
     cl_int errid;
     cl_image_format mask_image_format;
@@ -465,17 +240,13 @@ void GPUVolumeReconstruction<TImage>::ReconstructVolume( void )
     desc.num_samples               = 0;
     desc.buffer                    = nullptr;
     cl_mem inputImageMaskGPUBuffer = clCreateImage( m_Context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                                    &( mask_image_format ), &desc, maskValues, &errid );
+                                                    &( mask_image_format ), &desc, m_MaskValues.data(), &errid );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
     size_t localSize[3], globalSize[3];
     localSize[0] = localSize[1] = localSize[2] = OpenCLGetLocalBlockSize( 3 );
 
-    InternalRealType * cpuAccumWeightAndWeightedValueBuffer = new InternalRealType[2 * nbrOfPixelsInVolume]{};
-    cl_mem accumWeightAndWeightedValueGPUBuffer =
-        clCreateBuffer( m_Context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 2 * size_output,
-                        cpuAccumWeightAndWeightedValueBuffer, &errid );
-    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+    this->PrepareVolumeGPUBuffers( nbrOfPixelsInVolume );
 
     int volumeSize[3];
     volumeSize[0] = m_ReconstructedVolume->GetLargestPossibleRegion().GetSize()[0];
@@ -495,7 +266,7 @@ void GPUVolumeReconstruction<TImage>::ReconstructVolume( void )
     itk::TimeProbe clockMemCpy;
 
     InternalRealType * allMatrices = new InternalRealType[12 * ( 2 * maxNbrOfSlices + 1 )];
-    memcpy( (void *)&allMatrices[0], (void *)m_VolumeIndexToLocationMatrix, 12 * sizeof( InternalRealType ) );
+    memcpy( (void *)&allMatrices[0], (void *)m_VolumeIndexToLocationMatrix.data(), 12 * sizeof( InternalRealType ) );
 
     unsigned int sliceCntr = 0;  // Counts the number of slices that have been processed.
     do
@@ -560,7 +331,7 @@ void GPUVolumeReconstruction<TImage>::ReconstructVolume( void )
         OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
         errid = clSetKernelArg( m_VolumeReconstructionPopulatingKernel, argidx++, sizeof( cl_mem ),
-                                (void *)&accumWeightAndWeightedValueGPUBuffer );
+                                (void *)&m_AccumWeightAndWeightedValueGPUBuffer );
         OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
         for( unsigned int i = 0; i < ImageDimension; i++ )
@@ -618,18 +389,10 @@ void GPUVolumeReconstruction<TImage>::ReconstructVolume( void )
     } while( sliceCntr < m_NumberOfSlices );
 
     delete[] allMatrices;
-    delete[] m_VolumeIndexToSliceIndexMatrices;
-    delete[] m_VolumeIndexToLocationMatrix;
-    delete[] m_SliceIndexToLocationMatrices;
-    delete[] maskValues;
 
     errid = clReleaseMemObject( inputImageMaskGPUBuffer );
     OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
 
-    errid = clEnqueueReadBuffer( m_CommandQueue[0], accumWeightAndWeightedValueGPUBuffer, CL_TRUE, 0, 2 * size_output,
-                                 cpuAccumWeightAndWeightedValueBuffer, 0, nullptr, nullptr );
-    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
-
     clockGPUKernel.Stop();
 
     if( m_Debug )
@@ -641,39 +404,43 @@ void GPUVolumeReconstruction<TImage>::ReconstructVolume( void )
     itk::TimeProbe clockSettingValue;
     clockSettingValue.Start();
 
-    unsigned int n = 0, m = 0;
-    for( unsigned int i = 0; i < nbrOfPixelsInVolume; i++ )
-    {
-        InternalRealType weightedValue = cpuAccumWeightAndWeightedValueBuffer[2 * i];
-        InternalRealType weight        = cpuAccumWeightAndWeightedValueBuffer[2 * i + 1];
+    // Normalize on the device and read the result directly into the output volume. The number of voxels doesn't
+    // fit in an int for volumes of 2^31 voxels and more.
+    cl_ulong nbrOfVoxels = nbrOfPixelsInVolume;
+
+    errid = clSetKernelArg( m_VolumeReconstructionNormalizingKernel, 0, sizeof( cl_mem ),
+                            (void *)&m_AccumWeightAndWeightedValueGPUBuffer );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+    errid = clSetKernelArg( m_VolumeReconstructionNormalizingKernel, 1, sizeof( cl_mem ),
+                            (void *)&m_ReconstructedVolumeGPUBuffer );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+    errid = clSetKernelArg( m_VolumeReconstructionNormalizingKernel, 2, sizeof( cl_ulong ), &nbrOfVoxels );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+    size_t normalizingLocalSize  = OpenCLGetLocalBlockSize( 1 );
+    size_t normalizingGlobalSize = normalizingLocalSize * ( ( nbrOfPixelsInVolume + normalizingLocalSize - 1 ) /
+                                                            normalizingLocalSize );
+    errid = clEnqueueNDRangeKernel( m_CommandQueue[0], m_VolumeReconstructionNormalizingKernel, 1, nullptr,
+                                    &normalizingGlobalSize, &normalizingLocalSize, 0, nullptr, nullptr );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+
+    errid = clEnqueueReadBuffer( m_CommandQueue[0], m_ReconstructedVolumeGPUBuffer, CL_TRUE, 0, size_output,
+                                 m_ReconstructedVolume->GetBufferPointer(), 0, nullptr, nullptr );
+    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
+    m_ReconstructedVolume->Modified();
 
-        if( weightedValue > 0 )
-        {
-            ImagePixelType reconstructedValue = weightedValue / weight;
-            m_ReconstructedVolume->SetPixel( m_ReconstructedVolume->ComputeIndex( i ), reconstructedValue );
-            if( m_Debug ) m++;
-        }
-        else
-        {
-            m_ReconstructedVolume->SetPixel( m_ReconstructedVolume->ComputeIndex( i ), 0.0 );
-            if( m_Debug ) n++;
-        }
-    }
     clockSettingValue.Stop();
 
     if( m_Debug )
     {
-        std::cout << "nbrOfPixelsInVolume = " << nbrOfPixelsInVolume << " m = " << m << " n = " << n << std::endl;
-        std::cerr << "Time to Pixel Values with for loop:\t" << clockSettingValue.GetMean() << std::endl;
+        std::cerr << "Time to normalize and read back the volume:\t" << clockSettingValue.GetMean() << std::endl;
         WriterPointer writer = WriterType::New();
         writer->SetInput( m_ReconstructedVolume );
         writer->SetFileName( "reconstructedVolume.mnc" );
         writer->Update();
     }
-    errid = clReleaseMemObject( accumWeightAndWeightedValueGPUBuffer );
-    OpenCLCheckError( errid, __FILE__, __LINE__, ITK_LOCATION );
-
-    delete[] cpuAccumWeightAndWeightedValueBuffer;
 }
 
 }  // end namespace itk
@@ -0,0 +1,169 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#ifndef ITKSTREAMINGVOLUMERECONSTRUCTION_H
+#define ITKSTREAMINGVOLUMERECONSTRUCTION_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "itkCPUVolumeReconstruction.h"
+
+namespace itk
+{
+/**
+ * \class StreamingVolumeReconstruction
+ * Incremental US volume reconstruction. Slices are accumulated one at a time as they are acquired
+ * and the volume can be produced at any moment without going over the previous slices again.
+ * Every slice is processed with the same kernel as CPUVolumeReconstruction, so once all slices
+ * have been added, the result matches a reconstruction of the whole acquisition on the same grid.
+ *
+ * The voxel grid is aligned on the origin of the reconstruction space and is not bounded: the weighted
+ * value and weight accumulators are allocated by bricks of BrickSize^3 voxels as slices reach them.
+ * The output volume covers the bricks reached so far. It is grown by GrowthMargin bricks at a time to
+ * limit the number of times its size changes during an acquisition.
+ *
+ * Two output volumes are kept and used in turn. They are only reallocated when the output region grows,
+ * otherwise only the bricks modified since the volume was last produced are written to it.
+ *
+ * This class is not thread safe: AddSlice and GetReconstructedVolume must be called from the same thread.
+ */
+template <class TImage>
+class ITK_EXPORT StreamingVolumeReconstruction : public Object
+{
+public:
+    /** Standard class typedefs. */
+    typedef StreamingVolumeReconstruction Self;
+    typedef Object Superclass;
+    typedef SmartPointer<Self> Pointer;
+    typedef SmartPointer<const Self> ConstPointer;
+
+    typedef VolumeReconstruction<TImage> VolumeReconstructionType;
+    typedef CPUVolumeReconstruction<TImage> KernelType;
+    typedef typename VolumeReconstructionType::InternalRealType InternalRealType;
+    typedef typename VolumeReconstructionType::ImageType ImageType;
+    typedef typename VolumeReconstructionType::ImagePixelType ImagePixelType;
+    typedef typename VolumeReconstructionType::ImagePointer ImagePointer;
+    typedef typename VolumeReconstructionType::TransformType TransformType;
+    typedef typename VolumeReconstructionType::TransformPointer TransformPointer;
+
+    /** Method for creation through the object factory. */
+    itkNewMacro( Self );
+
+    /** Run-time type information (and related methods). */
+    itkTypeMacro( StreamingVolumeReconstruction, Object );
+
+    /** Number of voxels along each side of the accumulator bricks. */
+    itkStaticConstMacro( BrickSize, int, 8 );
+
+    /** Parameters. Changing them once slices have been added has no effect until Reset() is called. */
+    itkGetObjectMacro( FixedSliceMask, ImageType );
+    itkSetObjectMacro( FixedSliceMask, ImageType );
+
+    itkSetMacro( USSearchRadius, unsigned int );
+    itkGetConstMacro( USSearchRadius, unsigned int );
+
+    itkSetMacro( KernelStdDev, float );
+    itkGetConstMacro( KernelStdDev, float );
+
+    itkSetMacro( VolumeSpacing, float );
+    itkGetConstMacro( VolumeSpacing, float );
+
+    itkGetObjectMacro( Transform, TransformType );
+    itkSetObjectMacro( Transform, TransformType );
+
+    /** Number of bricks added on each side of the output volume when it needs to grow. */
+    itkSetMacro( GrowthMargin, int );
+    itkGetConstMacro( GrowthMargin, int );
+
+    /** Discard all accumulated slices. */
+    void Reset();
+
+    /** Accumulate the contribution of a new slice. The slice is not kept. */
+    void AddSlice( ImageType * slice );
+
+    unsigned int GetNumberOfSlices() const { return m_NumberOfSlices; }
+
+    /** Bounds of the corners of the slices added, in reconstruction space. VolumeReconstruction computes the extent
+     *  of its volume the same way, the output volume is padded and aligned to the bricks. */
+    void GetSliceBounds( double lower[3], double upper[3] ) const;
+
+    /** Return a volume with the current state of the reconstruction, nullptr if nothing was reconstructed yet.
+     *  The two output volumes are used in turn, so the returned volume is only valid until the next call but one. */
+    ImagePointer GetReconstructedVolume();
+
+protected:
+    StreamingVolumeReconstruction();
+    virtual ~StreamingVolumeReconstruction();
+
+    void PrintSelf( std::ostream & os, Indent indent ) const override;
+
+    struct Brick
+    {
+        Brick()
+            : weightedValues( BrickSize * BrickSize * BrickSize, 0.0 ),
+              weights( BrickSize * BrickSize * BrickSize, 0.0 ),
+              lastSlice( 0 )
+        {
+        }
+        std::vector<InternalRealType> weightedValues;
+        std::vector<InternalRealType> weights;
+        unsigned int lastSlice;  // index of the last slice that contributed to the brick
+    };
+
+    /** Output volume and the state of the reconstruction it was last produced from. */
+    struct OutputVolume
+    {
+        OutputVolume() : numberOfSlices( 0 ) {}
+        ImagePointer image;
+        int lowerBrick[3];
+        int upperBrick[3];
+        unsigned int numberOfSlices;
+    };
+    typedef std::unordered_map<unsigned long long, Brick> BrickContainer;
+
+    static unsigned long long BrickKey( const int brick[3] );
+    static void BrickFromKey( unsigned long long key, int brick[3] );
+
+    void InitializeMask( ImageType * slice );
+
+    unsigned int m_USSearchRadius;
+    float m_KernelStdDev;
+    float m_VolumeSpacing;
+    int m_GrowthMargin;
+
+    TransformPointer m_Transform;
+    ImagePointer m_FixedSliceMask;
+
+    // State of the current reconstruction
+    std::vector<unsigned char> m_MaskValues;
+    int m_SliceSize[2];
+    unsigned int m_NumberOfSlices;
+    double m_SliceLowerBound[3];
+    double m_SliceUpperBound[3];
+    BrickContainer m_Bricks;
+    bool m_HasOutputRegion;
+    int m_OutputLowerBrick[3];
+    int m_OutputUpperBrick[3];
+    OutputVolume m_OutputVolumes[2];
+    int m_NextOutputVolume;
+
+private:
+    StreamingVolumeReconstruction( const Self & );  // purposely not implemented
+    void operator=( const Self & );                 // purposely not implemented
+};
+}  // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkStreamingVolumeReconstruction.hxx"
+#endif
+
+#endif
@@ -0,0 +1,385 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+
+#ifndef ITKSTREAMINGVOLUMERECONSTRUCTION_HXX
+#define ITKSTREAMINGVOLUMERECONSTRUCTION_HXX
+
+#include <itkMultiThreaderBase.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include "itkStreamingVolumeReconstruction.h"
+
+namespace itk
+{
+template <class TImage>
+StreamingVolumeReconstruction<TImage>::StreamingVolumeReconstruction()
+{
+    m_USSearchRadius = 0;
+    m_KernelStdDev   = 1.0;
+    m_VolumeSpacing  = 1.0;
+    m_GrowthMargin   = 4;
+
+    m_Transform = TransformType::New();
+
+    m_SliceSize[0]    = 0;
+    m_SliceSize[1]    = 0;
+    m_NumberOfSlices  = 0;
+    m_HasOutputRegion = false;
+    for( int k = 0; k < 3; k++ )
+    {
+        m_SliceLowerBound[k]  = 0.0;
+        m_SliceUpperBound[k]  = 0.0;
+        m_OutputLowerBrick[k] = 0;
+        m_OutputUpperBrick[k] = 0;
+    }
+    m_NextOutputVolume = 0;
+}
+
+template <class TImage>
+StreamingVolumeReconstruction<TImage>::~StreamingVolumeReconstruction()
+{
+}
+
+template <class TImage>
+void StreamingVolumeReconstruction<TImage>::PrintSelf( std::ostream & os, Indent indent ) const
+{
+    Superclass::PrintSelf( os, indent );
+    os << indent << "NumberOfSlices: " << m_NumberOfSlices << std::endl;
+    os << indent << "NumberOfBricks: " << m_Bricks.size() << std::endl;
+}
+
+template <class TImage>
+unsigned long long StreamingVolumeReconstruction<TImage>::BrickKey( const int brick[3] )
+{
+    // 21 bits per brick coordinate, offset to keep them positive
+    const long long offset = 1 << 20;
+    return ( (unsigned long long)( brick[0] + offset ) << 42 ) | ( (unsigned long long)( brick[1] + offset ) << 21 ) |
+           (unsigned long long)( brick[2] + offset );
+}
+
+template <class TImage>
+void StreamingVolumeReconstruction<TImage>::BrickFromKey( unsigned long long key, int brick[3] )
+{
+    const long long offset        = 1 << 20;
+    const unsigned long long mask = ( 1 << 21 ) - 1;
+    brick[0] = (int)( (long long)( ( key >> 42 ) & mask ) - offset );
+    brick[1] = (int)( (long long)( ( key >> 21 ) & mask ) - offset );
+    brick[2] = (int)( (long long)( key & mask ) - offset );
+}
+
+template <class TImage>
+void StreamingVolumeReconstruction<TImage>::Reset()
+{
+    m_Bricks.clear();
+    m_MaskValues.clear();
+    m_SliceSize[0]    = 0;
+    m_SliceSize[1]    = 0;
+    m_NumberOfSlices  = 0;
+    m_HasOutputRegion = false;
+    for( int k = 0; k < 3; k++ )
+    {
+        m_SliceLowerBound[k] = 0.0;
+        m_SliceUpperBound[k] = 0.0;
+    }
+    for( int i = 0; i < 2; i++ ) m_OutputVolumes[i] = OutputVolume();
+    m_NextOutputVolume = 0;
+}
+
+template <class TImage>
+void StreamingVolumeReconstruction<TImage>::GetSliceBounds( double lower[3], double upper[3] ) const
+{
+    for( int k = 0; k < 3; k++ )
+    {
+        lower[k] = m_SliceLowerBound[k];
+        upper[k] = m_SliceUpperBound[k];
+    }
+}
+
+template <class TImage>
+void StreamingVolumeReconstruction<TImage>::InitializeMask( ImageType * slice )
+{
+    typename ImageType::SizeType sliceSize = slice->GetLargestPossibleRegion().GetSize();
+    m_SliceSize[0]                         = sliceSize[0];
+    m_SliceSize[1]                         = sliceSize[1];
+    size_t nbrPixelsInSlice                = (size_t)m_SliceSize[0] * m_SliceSize[1];
+
+    if( m_FixedSliceMask == nullptr )
+    {
+        m_MaskValues.assign( nbrPixelsInSlice, 1 );
+        return;
+    }
+
+    m_FixedSliceMask->Update();
+    if( m_FixedSliceMask->GetLargestPossibleRegion().GetNumberOfPixels() != nbrPixelsInSlice )
+    {
+        itkExceptionMacro( << "The slice mask and the slices do not have the same size." );
+    }
+    m_MaskValues.resize( nbrPixelsInSlice );
+    const ImagePixelType * maskPixels = m_FixedSliceMask->GetBufferPointer();
+    for( size_t n = 0; n < nbrPixelsInSlice; n++ )
+    {
+        m_MaskValues[n] = (unsigned char)( maskPixels[n] );
+    }
+}
+
+template <class TImage>
+void StreamingVolumeReconstruction<TImage>::AddSlice( ImageType * slice )
+{
+    if( m_NumberOfSlices == 0 )
+    {
+        InitializeMask( slice );
+    }
+    else
+    {
+        typename ImageType::SizeType sliceSize = slice->GetLargestPossibleRegion().GetSize();
+        if( (int)sliceSize[0] != m_SliceSize[0] || (int)sliceSize[1] != m_SliceSize[1] )
+        {
+            itkExceptionMacro( << "All slices must have the same size." );
+        }
+    }
+
+    // Corners of the slice in reconstruction space
+    typename ImageType::IndexType cornerIndex;
+    cornerIndex[2] = 0;
+    for( int corner = 0; corner < 4; corner++ )
+    {
+        cornerIndex[0] = ( corner & 1 ) ? m_SliceSize[0] : 0;
+        cornerIndex[1] = ( corner & 2 ) ? m_SliceSize[1] : 0;
+        typename ImageType::PointType cornerPoint;
+        slice->TransformIndexToPhysicalPoint( cornerIndex, cornerPoint );
+        cornerPoint = m_Transform->TransformPoint( cornerPoint );
+        for( int k = 0; k < 3; k++ )
+        {
+            if( m_NumberOfSlices == 0 && corner == 0 )
+            {
+                m_SliceLowerBound[k] = cornerPoint[k];
+                m_SliceUpperBound[k] = cornerPoint[k];
+            }
+            m_SliceLowerBound[k] = std::min( m_SliceLowerBound[k], double( cornerPoint[k] ) );
+            m_SliceUpperBound[k] = std::max( m_SliceUpperBound[k], double( cornerPoint[k] ) );
+        }
+    }
+
+    // Voxel grid: isotropic spacing, no rotation, index 0 at the origin of the reconstruction space
+    vnl_matrix_fixed<InternalRealType, 4, 4> volumeIndexToLocation4x4;
+    volumeIndexToLocation4x4.set_identity();
+    for( int k = 0; k < 3; k++ ) volumeIndexToLocation4x4[k][k] = m_VolumeSpacing;
+
+    InternalRealType volumeIndexToSliceIndex[12];
+    InternalRealType sliceIndexToLocation[12];
+    VolumeReconstructionType::ComputeSliceMatrices( slice, m_Transform, volumeIndexToLocation4x4,
+                                                    volumeIndexToSliceIndex, sliceIndexToLocation );
+
+    // Only the voxels closer than 1 mm (plus half a voxel for rounding) to the slice can receive something
+    const double margin      = 1.0 / m_VolumeSpacing + 0.5;
+    const double brickRadius = 0.5 * std::sqrt( 3.0 ) * ( BrickSize - 1 );
+    double lower[3], upper[3], origin[3], normal[3];
+    KernelType::ComputeSliceBounds( volumeIndexToSliceIndex, m_SliceSize, margin, lower, upper, origin, normal );
+
+    int lowerIndex[3], upperIndex[3], lowerBrick[3], upperBrick[3];
+    for( int k = 0; k < 3; k++ )
+    {
+        lowerIndex[k] = (int)std::ceil( lower[k] );
+        upperIndex[k] = (int)std::floor( upper[k] );
+        lowerBrick[k] = (int)std::floor( double( lowerIndex[k] ) / BrickSize );
+        upperBrick[k] = (int)std::floor( double( upperIndex[k] ) / BrickSize );
+    }
+
+    const ImagePixelType * pixels   = slice->GetBufferPointer();
+    const InternalRealType variance = m_KernelStdDev * m_KernelStdDev;
+    const int searchRadius          = (int)m_USSearchRadius;
+
+    int brick[3];
+    for( brick[2] = lowerBrick[2]; brick[2] <= upperBrick[2]; brick[2]++ )
+    {
+        for( brick[1] = lowerBrick[1]; brick[1] <= upperBrick[1]; brick[1]++ )
+        {
+            for( brick[0] = lowerBrick[0]; brick[0] <= upperBrick[0]; brick[0]++ )
+            {
+                double brickDistance = 0.0;
+                for( int k = 0; k < 3; k++ )
+                    brickDistance += ( brick[k] * BrickSize + 0.5 * ( BrickSize - 1 ) - origin[k] ) * normal[k];
+                if( std::fabs( brickDistance ) > brickRadius + margin ) continue;
+
+                // Bricks are only allocated when a voxel actually receives a contribution
+                unsigned long long key                    = BrickKey( brick );
+                typename BrickContainer::iterator itBrick = m_Bricks.find( key );
+                Brick * currentBrick                      = itBrick == m_Bricks.end() ? nullptr : &itBrick->second;
+
+                int brickStart[3], start[3], end[3];
+                for( int k = 0; k < 3; k++ )
+                {
+                    brickStart[k] = brick[k] * BrickSize;
+                    start[k]      = std::max( lowerIndex[k], brickStart[k] );
+                    end[k]        = std::min( upperIndex[k], brickStart[k] + BrickSize - 1 );
+                }
+
+                for( int z = start[2]; z <= end[2]; z++ )
+                {
+                    for( int y = start[1]; y <= end[1]; y++ )
+                    {
+                        for( int x = start[0]; x <= end[0]; x++ )
+                        {
+                            double distance = ( x - origin[0] ) * normal[0] + ( y - origin[1] ) * normal[1] +
+                                              ( z - origin[2] ) * normal[2];
+                            if( std::fabs( distance ) > margin ) continue;
+
+                            InternalRealType volumeIndex[3]    = { (InternalRealType)x, (InternalRealType)y,
+                                                                   (InternalRealType)z };
+                            InternalRealType volumeLocation[3] = { m_VolumeSpacing * x, m_VolumeSpacing * y,
+                                                                   m_VolumeSpacing * z };
+                            InternalRealType weightedValue     = 0.0;
+                            InternalRealType weight            = 0.0;
+                            KernelType::AccumulateSlice( volumeIndexToSliceIndex, sliceIndexToLocation, pixels,
+                                                         m_MaskValues.data(), m_SliceSize, searchRadius, variance,
+                                                         volumeIndex, volumeLocation, weightedValue, weight );
+                            if( weight <= 0.0 ) continue;
+
+                            if( !currentBrick ) currentBrick = &m_Bricks[key];
+                            currentBrick->lastSlice = m_NumberOfSlices;
+                            int voxelInBrick = ( z - brickStart[2] ) * BrickSize * BrickSize +
+                                               ( y - brickStart[1] ) * BrickSize + x - brickStart[0];
+                            currentBrick->weightedValues[voxelInBrick] += weightedValue;
+                            currentBrick->weights[voxelInBrick] += weight;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    m_NumberOfSlices++;
+}
+
+template <class TImage>
+typename StreamingVolumeReconstruction<TImage>::ImagePointer
+StreamingVolumeReconstruction<TImage>::GetReconstructedVolume()
+{
+    if( m_Bricks.empty() ) return nullptr;
+
+    struct BrickToCopy
+    {
+        int coordinates[3];
+        const Brick * brick;
+    };
+
+    int lowerBrick[3] = { INT_MAX, INT_MAX, INT_MAX };
+    int upperBrick[3] = { INT_MIN, INT_MIN, INT_MIN };
+    for( typename BrickContainer::const_iterator it = m_Bricks.begin(); it != m_Bricks.end(); ++it )
+    {
+        int coordinates[3];
+        BrickFromKey( it->first, coordinates );
+        for( int k = 0; k < 3; k++ )
+        {
+            lowerBrick[k] = std::min( lowerBrick[k], coordinates[k] );
+            upperBrick[k] = std::max( upperBrick[k], coordinates[k] );
+        }
+    }
+
+    // Grow the output region by a margin so that its size does not change with every slice
+    for( int k = 0; k < 3; k++ )
+    {
+        if( !m_HasOutputRegion || lowerBrick[k] < m_OutputLowerBrick[k] )
+            m_OutputLowerBrick[k] = lowerBrick[k] - m_GrowthMargin;
+        if( !m_HasOutputRegion || upperBrick[k] > m_OutputUpperBrick[k] )
+            m_OutputUpperBrick[k] = upperBrick[k] + m_GrowthMargin;
+    }
+    m_HasOutputRegion = true;
+
+    typename ImageType::SizeType size;
+    for( int k = 0; k < 3; k++ ) size[k] = ( m_OutputUpperBrick[k] - m_OutputLowerBrick[k] + 1 ) * BrickSize;
+
+    // The output volume is reallocated if the region grew since it was last produced. Only a new volume is cleared,
+    // voxels outside of the bricks are never written afterwards.
+    OutputVolume & outputVolume = m_OutputVolumes[m_NextOutputVolume];
+    m_NextOutputVolume          = 1 - m_NextOutputVolume;
+    bool sameRegion             = outputVolume.image.IsNotNull();
+    for( int k = 0; k < 3 && sameRegion; k++ )
+        sameRegion = outputVolume.lowerBrick[k] == m_OutputLowerBrick[k] &&
+                     outputVolume.upperBrick[k] == m_OutputUpperBrick[k];
+    if( !sameRegion )
+    {
+        typename ImageType::IndexType startIndex;
+        typename ImageType::PointType volumeOrigin;
+        for( int k = 0; k < 3; k++ )
+        {
+            startIndex[k]              = 0;
+            volumeOrigin[k]            = m_VolumeSpacing * m_OutputLowerBrick[k] * BrickSize;
+            outputVolume.lowerBrick[k] = m_OutputLowerBrick[k];
+            outputVolume.upperBrick[k] = m_OutputUpperBrick[k];
+        }
+
+        typename ImageType::SpacingType spacing;
+        spacing.Fill( m_VolumeSpacing );
+
+        typename ImageType::RegionType region;
+        region.SetSize( size );
+        region.SetIndex( startIndex );
+
+        outputVolume.image = ImageType::New();
+        outputVolume.image->SetRegions( region );
+        outputVolume.image->SetOrigin( volumeOrigin );
+        outputVolume.image->SetSpacing( spacing );
+        outputVolume.image->Allocate();
+        outputVolume.image->FillBuffer( 0.0 );
+        outputVolume.numberOfSlices = 0;
+    }
+
+    // Only the bricks modified since the volume was last produced are written
+    std::vector<BrickToCopy> bricks;
+    bricks.reserve( m_Bricks.size() );
+    for( typename BrickContainer::const_iterator it = m_Bricks.begin(); it != m_Bricks.end(); ++it )
+    {
+        if( it->second.lastSlice < outputVolume.numberOfSlices ) continue;
+        BrickToCopy brickToCopy;
+        BrickFromKey( it->first, brickToCopy.coordinates );
+        brickToCopy.brick = &it->second;
+        bricks.push_back( brickToCopy );
+    }
+    outputVolume.numberOfSlices = m_NumberOfSlices;
+
+    ImagePixelType * output             = outputVolume.image->GetBufferPointer();
+    const int * outputLowerBrick        = m_OutputLowerBrick;
+    MultiThreaderBase::Pointer threader = MultiThreaderBase::New();
+    threader->ParallelizeArray(
+        0, bricks.size(),
+        [&bricks, &size, output, outputLowerBrick]( SizeValueType i )
+        {
+            const Brick * brick = bricks[i].brick;
+            int start[3];
+            for( int k = 0; k < 3; k++ ) start[k] = ( bricks[i].coordinates[k] - outputLowerBrick[k] ) * BrickSize;
+            int voxelInBrick = 0;
+            for( int z = 0; z < BrickSize; z++ )
+            {
+                for( int y = 0; y < BrickSize; y++ )
+                {
+                    size_t voxelIndex = ( (size_t)( start[2] + z ) * size[1] + start[1] + y ) * size[0] + start[0];
+                    for( int x = 0; x < BrickSize; x++, voxelInBrick++ )
+                    {
+                        InternalRealType weightedValue = brick->weightedValues[voxelInBrick];
+                        if( weightedValue > 0 )
+                            output[voxelIndex + x] = ImagePixelType( weightedValue / brick->weights[voxelInBrick] );
+                    }
+                }
+            }
+        },
+        nullptr );
+
+    outputVolume.image->Modified();
+    return outputVolume.image;
+}
+
+}  // end namespace itk
+
+#endif
@@ -0,0 +1,157 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+// Thanks to Dante De Nigris for writing the original GPU class
+
+#ifndef ITKVOLUMERECONSTRUCTION_H
+#define ITKVOLUMERECONSTRUCTION_H
+
+#include <itkEuler3DTransform.h>
+#include <itkImage.h>
+#include <itkImageFileWriter.h>  //ImageFileWriter used for debugging
+#include <itkObject.h>
+#include <vnl/vnl_inverse.h>
+#include <vnl/vnl_matrix.h>
+#include <vnl/vnl_matrix_fixed.h>
+
+#include <vector>
+
+namespace itk
+{
+/**
+ * \class VolumeReconstruction
+ * Base class of the US volume reconstruction backends. It holds the input slices and
+ * the reconstruction parameters, computes the geometry of the output volume and the
+ * volume index to slice index matrices used by the reconstruction kernel. Each voxel
+ * receives the Gaussian weighted average of the slice pixels that lie within 1 mm of it.
+ * \sa GPUVolumeReconstruction CPUVolumeReconstruction
+ */
+template <class TImage>
+class ITK_EXPORT VolumeReconstruction : public Object
+{
+public:
+    /** Standard class typedefs. */
+    typedef VolumeReconstruction Self;
+    typedef Object Superclass;
+    typedef SmartPointer<Self> Pointer;
+    typedef SmartPointer<const Self> ConstPointer;
+
+    typedef float InternalRealType;
+
+    /** Run-time type information (and related methods). */
+    itkTypeMacro( VolumeReconstruction, Object );
+
+    /** Image type. */
+    typedef TImage ImageType;
+    typedef typename ImageType::PixelType ImagePixelType;
+    typedef typename ImageType::Pointer ImagePointer;
+    typedef typename ImageType::ConstPointer ImageConstPointer;
+    typedef typename ImageType::PointType ImagePointType;
+    typedef typename ImageType::DirectionType ImageDirectionType;
+
+    typedef itk::Euler3DTransform<float> TransformType;
+    typedef typename TransformType::Pointer TransformPointer;
+
+    itkGetObjectMacro( FixedSliceMask, ImageType );
+    itkSetObjectMacro( FixedSliceMask, ImageType );
+
+    itkGetObjectMacro( ReconstructedVolume, ImageType );
+
+    itkSetMacro( USSearchRadius, unsigned int );
+    itkGetConstMacro( USSearchRadius, unsigned int );
+
+    itkSetMacro( KernelStdDev, float );
+    itkGetConstMacro( KernelStdDev, float );
+
+    itkSetMacro( VolumeSpacing, float );
+    itkGetConstMacro( VolumeSpacing, float );
+
+    itkGetObjectMacro( Transform, TransformType );
+    itkSetObjectMacro( Transform, TransformType );
+
+    /** Extract dimension from input image. */
+    itkStaticConstMacro( ImageDimension, unsigned int, TImage::ImageDimension );
+
+    typedef Image<InternalRealType, ImageDimension> RealImageType;
+    typedef typename RealImageType::Pointer RealImagePointer;
+
+    itkSetMacro( Debug, bool );
+    itkGetConstMacro( Debug, bool );
+
+    // ImageFileWriter used for debugging
+    typedef itk::ImageFileWriter<ImageType> WriterType;
+    typedef typename WriterType::Pointer WriterPointer;
+
+    virtual void ReconstructVolume( void ) = 0;
+
+    void SetFixedSlice( unsigned int sliceIdx, ImagePointer sliceImage );
+    ImagePointer GetFixedSlice( unsigned int sliceIdx ) { return m_FixedSlices[sliceIdx]; }
+
+    void SetNumberOfSlices( unsigned int numberOfSlices );
+    unsigned int GetNumberOfSlices() { return m_NumberOfSlices; }
+
+    /** Compute the row-major 3x4 volume index to slice index and slice index to (transformed) location
+     *  matrices of a slice, given the volume index to location matrix of the output volume. */
+    static void ComputeSliceMatrices( const ImageType * slice, const TransformType * transform,
+                                      const vnl_matrix_fixed<InternalRealType, 4, 4> & volumeIndexToLocation4x4,
+                                      InternalRealType * volumeIndexToSliceIndexMatrix,
+                                      InternalRealType * sliceIndexToLocationMatrix );
+
+protected:
+    VolumeReconstruction();
+    virtual ~VolumeReconstruction();
+
+    void PrintSelf( std::ostream & os, Indent indent ) const override;
+
+    /** Validate the inputs, create the slice mask if needed, the empty output volume and the matrices. */
+    void InitializeReconstruction( void );
+
+    void CreateReconstructedVolume( void );
+    void CreateMatrices( void );
+    void CreateMaskValues( void );
+
+    bool CheckAllSlicesDefined( void );
+
+    bool m_Debug;
+
+    unsigned int m_NumberOfSlices;
+    unsigned int m_NbrPixelsInSlice;
+
+    unsigned int m_USSearchRadius;
+    float m_KernelStdDev;
+    float m_VolumeSpacing;
+
+    TransformPointer m_Transform;
+
+    ImagePointer m_FixedSliceMask;
+    std::vector<unsigned char> m_MaskValues;
+
+    std::vector<ImagePointer> m_FixedSlices;
+
+    std::vector<unsigned int> m_SliceValidIdxs;
+
+    ImagePointer m_ReconstructedVolume;
+
+    // Row-major 3x4 matrices
+    std::vector<InternalRealType> m_VolumeIndexToSliceIndexMatrices;
+    std::vector<InternalRealType> m_VolumeIndexToLocationMatrix;
+    std::vector<InternalRealType> m_SliceIndexToLocationMatrices;
+
+private:
+    VolumeReconstruction( const Self & );  // purposely not implemented
+    void operator=( const Self & );        // purposely not implemented
+};
+}  // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkVolumeReconstruction.hxx"
+#endif
+
+#endif
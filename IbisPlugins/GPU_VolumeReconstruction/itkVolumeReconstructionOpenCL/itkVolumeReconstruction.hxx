@@ -0,0 +1,333 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+// Thanks to Dante De Nigris for writing the original GPU class
+
+#ifndef ITKVOLUMERECONSTRUCTION_HXX
+#define ITKVOLUMERECONSTRUCTION_HXX
+
+#include <itkImageDuplicator.h>
+#include <itkMacro.h>
+#include <itkMatrix.h>
+#include <itkTimeProbe.h>
+#include <vnl/vnl_matrix.h>
+
+#include "itkVolumeReconstruction.h"
+
+namespace itk
+{
+/**
+ * Default constructor
+ */
+template <class TImage>
+VolumeReconstruction<TImage>::VolumeReconstruction()
+{
+    m_Debug = false;
+
+    m_NumberOfSlices   = 0;
+    m_NbrPixelsInSlice = 0;
+
+    m_USSearchRadius = 0;
+    m_KernelStdDev   = 1.0;
+    m_VolumeSpacing  = 1.0;
+
+    m_Transform = TransformType::New();
+}
+
+template <class TImage>
+VolumeReconstruction<TImage>::~VolumeReconstruction()
+{
+}
+
+/**
+ * Standard "PrintSelf" method.
+ */
+template <class TImage>
+void VolumeReconstruction<TImage>::PrintSelf( std::ostream & os, Indent indent ) const
+{
+    Superclass::PrintSelf( os, indent );
+}
+
+template <class TImage>
+void VolumeReconstruction<TImage>::SetNumberOfSlices( unsigned int numberOfSlices )
+{
+    if( m_NumberOfSlices != numberOfSlices )
+    {
+        m_NumberOfSlices = numberOfSlices;
+        m_FixedSlices.resize( m_NumberOfSlices );
+    }
+
+    for( unsigned int i = 0; i < m_NumberOfSlices; i++ )
+    {
+        m_FixedSlices[i] = nullptr;
+    }
+}
+
+template <class TImage>
+void VolumeReconstruction<TImage>::SetFixedSlice( unsigned int sliceIdx, ImagePointer sliceImage )
+{
+    m_FixedSlices[sliceIdx] = sliceImage;
+}
+
+template <class TImage>
+bool VolumeReconstruction<TImage>::CheckAllSlicesDefined( void )
+{
+    bool allSlicesDefined = true;
+    for( unsigned int i = 0; i < m_NumberOfSlices; i++ )
+    {
+        if( m_FixedSlices[i] == nullptr )
+        {
+            allSlicesDefined = false;
+            break;
+        }
+    }
+    return allSlicesDefined;
+}
+
+template <class TImage>
+void VolumeReconstruction<TImage>::CreateReconstructedVolume( void )
+{
+    if( m_Debug ) std::cerr << "Creating Empty Reconstructed Volume.." << std::endl;
+
+    itk::TimeProbe clockReconstruction;
+    clockReconstruction.Start();
+    // Find bounds for 1mm3 US volume
+    typename ImageType::PointType corner1, corner2, corner3, corner4;
+    typename ImageType::PointType trCorner1, trCorner2, trCorner3, trCorner4;
+    typename ImageType::IndexType fixedIndex;
+    typename ImageType::SizeType sliceSize = m_FixedSlices[1]->GetLargestPossibleRegion().GetSize();
+
+    double m_LowerBound[3], m_UpperBound[3];
+
+    m_LowerBound[0] = 10000.0;
+    m_LowerBound[1] = 10000.0;
+    m_LowerBound[2] = 10000.0;
+    m_UpperBound[0] = -10000.0;
+    m_UpperBound[1] = -10000.0;
+    m_UpperBound[2] = -10000.0;
+    for( unsigned int i = 1; i < m_NumberOfSlices; i++ )
+    {
+        fixedIndex[0] = 0;
+        fixedIndex[1] = 0;
+        fixedIndex[2] = 0;
+        m_FixedSlices[i]->TransformIndexToPhysicalPoint( fixedIndex, corner1 );
+
+        fixedIndex[0] = 0 + sliceSize[0];
+        fixedIndex[1] = 0;
+        fixedIndex[2] = 0;
+        m_FixedSlices[i]->TransformIndexToPhysicalPoint( fixedIndex, corner2 );
+
+        fixedIndex[0] = 0;
+        fixedIndex[1] = 0 + sliceSize[1];
+        fixedIndex[2] = 0;
+        m_FixedSlices[i]->TransformIndexToPhysicalPoint( fixedIndex, corner3 );
+
+        fixedIndex[0] = 0 + sliceSize[0];
+        fixedIndex[1] = 0 + sliceSize[1];
+        fixedIndex[2] = 0;
+        m_FixedSlices[i]->TransformIndexToPhysicalPoint( fixedIndex, corner4 );
+
+        trCorner1 = m_Transform->TransformPoint( corner1 );
+        trCorner2 = m_Transform->TransformPoint( corner2 );
+        trCorner3 = m_Transform->TransformPoint( corner3 );
+        trCorner4 = m_Transform->TransformPoint( corner4 );
+
+        m_LowerBound[0] = std::min( trCorner1[0], m_LowerBound[0] );
+        m_LowerBound[1] = std::min( trCorner1[1], m_LowerBound[1] );
+        m_LowerBound[2] = std::min( trCorner1[2], m_LowerBound[2] );
+        m_LowerBound[0] = std::min( trCorner2[0], m_LowerBound[0] );
+        m_LowerBound[1] = std::min( trCorner2[1], m_LowerBound[1] );
+        m_LowerBound[2] = std::min( trCorner2[2], m_LowerBound[2] );
+        m_LowerBound[0] = std::min( trCorner3[0], m_LowerBound[0] );
+        m_LowerBound[1] = std::min( trCorner3[1], m_LowerBound[1] );
+        m_LowerBound[2] = std::min( trCorner3[2], m_LowerBound[2] );
+        m_LowerBound[0] = std::min( trCorner4[0], m_LowerBound[0] );
+        m_LowerBound[1] = std::min( trCorner4[1], m_LowerBound[1] );
+        m_LowerBound[2] = std::min( trCorner4[2], m_LowerBound[2] );
+
+        m_UpperBound[0] = std::max( trCorner1[0], m_UpperBound[0] );
+        m_UpperBound[1] = std::max( trCorner1[1], m_UpperBound[1] );
+        m_UpperBound[2] = std::max( trCorner1[2], m_UpperBound[2] );
+        m_UpperBound[0] = std::max( trCorner2[0], m_UpperBound[0] );
+        m_UpperBound[1] = std::max( trCorner2[1], m_UpperBound[1] );
+        m_UpperBound[2] = std::max( trCorner2[2], m_UpperBound[2] );
+        m_UpperBound[0] = std::max( trCorner3[0], m_UpperBound[0] );
+        m_UpperBound[1] = std::max( trCorner3[1], m_UpperBound[1] );
+        m_UpperBound[2] = std::max( trCorner3[2], m_UpperBound[2] );
+        m_UpperBound[0] = std::max( trCorner4[0], m_UpperBound[0] );
+        m_UpperBound[1] = std::max( trCorner4[1], m_UpperBound[1] );
+        m_UpperBound[2] = std::max( trCorner4[2], m_UpperBound[2] );
+    }
+
+    typename ImageType::IndexType startIndex;
+    startIndex[0] = 0;  // first index on X
+    startIndex[1] = 0;  // first index on Y
+    startIndex[2] = 0;  // first index on Z
+
+    typename ImageType::SpacingType spacing1;
+    spacing1.Fill( m_VolumeSpacing );
+
+    typename ImageType::SizeType size1;
+    size1[0] = ceil( m_UpperBound[0] - m_LowerBound[0] ) / spacing1[0];  // size along X
+    size1[1] = ceil( m_UpperBound[1] - m_LowerBound[1] ) / spacing1[1];  // size along Y
+    size1[2] = ceil( m_UpperBound[2] - m_LowerBound[2] ) / spacing1[2];  // size along Z
+
+    typename ImageType::RegionType region1;
+    region1.SetSize( size1 );
+    region1.SetIndex( startIndex );
+
+    m_ReconstructedVolume = ImageType::New();
+    m_ReconstructedVolume->SetRegions( region1 );
+    m_ReconstructedVolume->SetOrigin( m_LowerBound );
+    m_ReconstructedVolume->SetSpacing( spacing1 );
+    m_ReconstructedVolume->Allocate();
+    m_ReconstructedVolume->FillBuffer( 0.0 );
+
+    if( m_Debug ) std::cerr << "Creating Emtpy Reconstructed Volume..DONE" << std::endl;
+}
+
+template <class TImage>
+void VolumeReconstruction<TImage>::CreateMatrices( void )
+{
+    if( m_Debug ) std::cerr << "Creating Matrices.." << std::endl;
+
+    m_VolumeIndexToSliceIndexMatrices.resize( m_NumberOfSlices * 12 );
+    m_VolumeIndexToLocationMatrix.resize( 12 );
+    m_SliceIndexToLocationMatrices.resize( m_NumberOfSlices * 12 );
+
+    ImageDirectionType volumeScale;
+    for( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+        volumeScale[i][i] = m_ReconstructedVolume->GetSpacing()[i];
+    }
+    ImageDirectionType volumeIndexToLocation3x3 = m_ReconstructedVolume->GetDirection() * volumeScale;
+
+    vnl_matrix_fixed<InternalRealType, 4, 4> volumeIndexToLocation4x4;
+    volumeIndexToLocation4x4.set_identity();
+    for( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+        volumeIndexToLocation4x4[i][3]           = m_ReconstructedVolume->GetOrigin()[i];
+        m_VolumeIndexToLocationMatrix[4 * i + 3] = volumeIndexToLocation4x4[i][3];
+        for( unsigned int j = 0; j < ImageDimension; j++ )
+        {
+            volumeIndexToLocation4x4[i][j]           = volumeIndexToLocation3x3[i][j];  // Does this make sense??
+            m_VolumeIndexToLocationMatrix[4 * i + j] = volumeIndexToLocation3x3[i][j];
+        }
+    }
+
+    for( unsigned int sliceIdx = 0; sliceIdx < m_NumberOfSlices; sliceIdx++ )
+    {
+        ComputeSliceMatrices( m_FixedSlices[sliceIdx], m_Transform, volumeIndexToLocation4x4,
+                              &m_VolumeIndexToSliceIndexMatrices[sliceIdx * 12],
+                              &m_SliceIndexToLocationMatrices[sliceIdx * 12] );
+    }
+
+    if( m_Debug ) std::cout << "Creating Matrices..DONE" << std::endl;
+}
+
+template <class TImage>
+void VolumeReconstruction<TImage>::ComputeSliceMatrices(
+    const ImageType * slice, const TransformType * transform,
+    const vnl_matrix_fixed<InternalRealType, 4, 4> & volumeIndexToLocation4x4,
+    InternalRealType * volumeIndexToSliceIndexMatrix, InternalRealType * sliceIndexToLocationMatrix )
+{
+    vnl_matrix_fixed<InternalRealType, 4, 4> locationToTransformLocation4x4;
+    locationToTransformLocation4x4.set_identity();
+    for( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+        locationToTransformLocation4x4[i][3] = transform->GetOffset()[i];
+        for( unsigned int j = 0; j < ImageDimension; j++ )
+        {
+            locationToTransformLocation4x4[i][j] = transform->GetMatrix()[i][j];
+        }
+    }
+
+    ImageDirectionType scale;
+    for( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+        scale[i][i] = slice->GetSpacing()[i];
+    }
+    ImageDirectionType sliceIndexToLocation3x3 = slice->GetDirection() * scale;
+
+    vnl_matrix_fixed<InternalRealType, 4, 4> sliceIndexToLocation4x4, transSliceIndexToLocation4x4;
+    sliceIndexToLocation4x4.set_identity();
+    for( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+        sliceIndexToLocation4x4[i][3] = slice->GetOrigin()[i];
+
+        for( unsigned int j = 0; j < ImageDimension; j++ )
+        {
+            sliceIndexToLocation4x4[i][j] = sliceIndexToLocation3x3[i][j];  // Does this make sense??
+        }
+    }
+
+    transSliceIndexToLocation4x4 = locationToTransformLocation4x4 * sliceIndexToLocation4x4;
+    vnl_matrix_fixed<InternalRealType, 4, 4> volumeIndexToSliceIndex =
+        vnl_inverse( transSliceIndexToLocation4x4 ) * volumeIndexToLocation4x4;
+    for( unsigned int i = 0; i < ImageDimension; i++ )
+    {
+        volumeIndexToSliceIndexMatrix[4 * i + 3] = volumeIndexToSliceIndex[i][3];
+        sliceIndexToLocationMatrix[4 * i + 3]    = transSliceIndexToLocation4x4[i][3];
+        for( unsigned int j = 0; j < ImageDimension; j++ )
+        {
+            volumeIndexToSliceIndexMatrix[4 * i + j] = volumeIndexToSliceIndex[i][j];
+            sliceIndexToLocationMatrix[4 * i + j]    = transSliceIndexToLocation4x4[i][j];
+        }
+    }
+}
+
+template <class TImage>
+void VolumeReconstruction<TImage>::CreateMaskValues( void )
+{
+    m_NbrPixelsInSlice = m_FixedSliceMask->GetLargestPossibleRegion().GetNumberOfPixels();
+    m_MaskValues.resize( m_NbrPixelsInSlice );
+    const ImagePixelType * maskPixels = m_FixedSliceMask->GetBufferPointer();
+    for( unsigned int n = 0; n < m_NbrPixelsInSlice; n++ )
+    {
+        m_MaskValues[n] = (unsigned char)( maskPixels[n] );
+    }
+}
+
+template <class TImage>
+void VolumeReconstruction<TImage>::InitializeReconstruction( void )
+{
+    if( !CheckAllSlicesDefined() )
+    {
+        itkExceptionMacro( << "All Fixed Slices have not been set." );
+    }
+
+    if( m_FixedSliceMask == nullptr )
+    {
+        using DuplicatorType                        = itk::ImageDuplicator<ImageType>;
+        typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
+        duplicator->SetInputImage( m_FixedSlices[0] );
+        duplicator->Update();
+        m_FixedSliceMask = duplicator->GetOutput();
+        m_FixedSliceMask->FillBuffer( 1 );
+    }
+    m_FixedSliceMask->Update();
+
+    CreateReconstructedVolume();
+
+    CreateMatrices();
+
+    CreateMaskValues();
+
+    if( m_Debug )
+    {
+        std::cout << "Volume Spacing:\t" << m_VolumeSpacing << std::endl;
+        std::cout << "Standard Deviation:\t" << m_KernelStdDev << std::endl;
+        std::cout << "Number of Pixels in Slice:\t" << m_NbrPixelsInSlice << std::endl;
+    }
+}
+
+}  // end namespace itk
+
+#endif
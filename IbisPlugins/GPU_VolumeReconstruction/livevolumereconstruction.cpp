@@ -0,0 +1,349 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "livevolumereconstruction.h"
+
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkSmartPointer.h>
+#include <vtkTransform.h>
+
+#include <itkImageDuplicator.h>
+#include <itkRegionOfInterestImageFilter.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "gpu_volumereconstruction.h"
+#include "ibisapi.h"
+#include "ibisitkvtkconverter.h"
+#include "usacquisitionobject.h"
+
+LiveVolumeReconstruction::LiveVolumeReconstruction()
+{
+    m_ibisAPI         = nullptr;
+    m_useMask         = true;
+    m_usSearchRadius  = 1;
+    m_volumeSpacing   = 1.0;
+    m_publishInterval = 1000;
+    m_acquisitionId   = SceneManager::InvalidId;
+    m_imageObjectId   = SceneManager::InvalidId;
+    m_stopRequested         = false;
+    m_cancelRequested       = false;
+    m_latestVolumePublished = false;
+
+    // The worker thread emits VolumeAvailable and WorkerDone, the volume is published in the main thread
+    connect( this, SIGNAL( VolumeAvailable() ), this, SLOT( OnVolumeAvailable() ), Qt::QueuedConnection );
+    connect( this, SIGNAL( WorkerDone( int ) ), this, SLOT( OnWorkerDone( int ) ), Qt::QueuedConnection );
+}
+
+LiveVolumeReconstruction::~LiveVolumeReconstruction() { Cancel(); }
+
+void LiveVolumeReconstruction::Start( USAcquisitionObject * acquisition )
+{
+    Q_ASSERT( acquisition );
+    if( IsActive() )
+    {
+        // The previous acquisition stopped recording, wait for its remaining frames
+        Stop();
+        wait();
+        Finish();
+    }
+
+    m_finishedVolume = FinishedVolume();
+    m_reconstructor  = StreamingReconstructionType::New();
+    m_reconstructor->SetUSSearchRadius( m_usSearchRadius );
+    m_reconstructor->SetVolumeSpacing( m_volumeSpacing );
+    m_reconstructor->SetKernelStdDev( m_volumeSpacing / 2.0 );
+    m_localMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
+    m_localMatrix->DeepCopy( acquisition->GetLocalTransform()->GetMatrix() );
+    m_reconstructor->SetTransform( GPU_VolumeReconstruction::ConvertTransform( m_localMatrix ) );
+    if( m_useMask )
+    {
+        IbisItkFloat3ImageType::Pointer itkSliceMask   = IbisItkFloat3ImageType::New();
+        vtkSmartPointer<IbisItkVtkConverter> converter = vtkSmartPointer<IbisItkVtkConverter>::New();
+        vtkSmartPointer<vtkMatrix4x4> sliceMaskMatrix  = vtkSmartPointer<vtkMatrix4x4>::New();
+        converter->ConvertVtkImageToItkImage( itkSliceMask, acquisition->GetMask(), sliceMaskMatrix );
+        m_reconstructor->SetFixedSliceMask( itkSliceMask );
+    }
+
+    m_acquisitionId         = acquisition->GetObjectID();
+    m_imageObjectId         = SceneManager::InvalidId;
+    m_latestVolume          = nullptr;
+    m_latestVolumePublished = false;
+    m_pendingFrames.clear();
+    m_stopRequested   = false;
+    m_cancelRequested = false;
+
+    connect( acquisition, SIGNAL( FrameAdded( int ) ), this, SLOT( OnFrameAdded( int ) ) );
+    connect( acquisition, SIGNAL( RecordingStopped() ), this, SLOT( Stop() ) );
+    connect( acquisition, SIGNAL( RemovingFromScene() ), this, SLOT( Cancel() ) );
+
+    start();
+}
+
+void LiveVolumeReconstruction::Stop()
+{
+    if( !IsActive() ) return;
+
+    // No new frames, but a removed acquisition still cancels the reconstruction
+    USAcquisitionObject * acquisition =
+        m_ibisAPI ? USAcquisitionObject::SafeDownCast( m_ibisAPI->GetObjectByID( m_acquisitionId ) ) : nullptr;
+    if( acquisition )
+    {
+        disconnect( acquisition, SIGNAL( FrameAdded( int ) ), this, SLOT( OnFrameAdded( int ) ) );
+        disconnect( acquisition, SIGNAL( RecordingStopped() ), this, SLOT( Stop() ) );
+    }
+
+    // The worker processes the frames still queued and produces the final volume, see OnWorkerDone()
+    m_mutex.lock();
+    m_stopRequested = true;
+    m_slicesAvailable.wakeOne();
+    m_mutex.unlock();
+}
+
+void LiveVolumeReconstruction::Cancel()
+{
+    if( !IsActive() ) return;
+
+    // The scene may be torn down, the volume is not published
+    DisconnectAcquisition();
+    m_mutex.lock();
+    m_stopRequested   = true;
+    m_cancelRequested = true;
+    m_slicesAvailable.wakeOne();
+    m_mutex.unlock();
+    wait();
+    m_pendingFrames.clear();
+    m_acquisitionId = SceneManager::InvalidId;
+    m_latestVolume  = nullptr;
+}
+
+void LiveVolumeReconstruction::DisconnectAcquisition()
+{
+    USAcquisitionObject * acquisition =
+        m_ibisAPI ? USAcquisitionObject::SafeDownCast( m_ibisAPI->GetObjectByID( m_acquisitionId ) ) : nullptr;
+    if( acquisition ) disconnect( acquisition, nullptr, this, nullptr );
+}
+
+void LiveVolumeReconstruction::OnWorkerDone( int acquisitionId )
+{
+    // Nothing to do if the reconstruction was cancelled or already finished by Start()
+    if( !IsActive() || acquisitionId != m_acquisitionId ) return;
+    wait();  // the worker is returning from run()
+    Finish();
+}
+
+void LiveVolumeReconstruction::Finish()
+{
+    OnVolumeAvailable();
+
+    // Keep the final volume so that the acquisition doesn't have to be reconstructed again, see GetFinishedVolume()
+    m_finishedVolume.acquisitionId  = m_acquisitionId;
+    m_finishedVolume.numberOfFrames = int( m_reconstructor->GetNumberOfSlices() );
+    m_finishedVolume.useMask        = m_reconstructor->GetFixedSliceMask() != nullptr;
+    m_finishedVolume.usSearchRadius = m_reconstructor->GetUSSearchRadius();
+    m_finishedVolume.volumeSpacing  = m_reconstructor->GetVolumeSpacing();
+    m_finishedVolume.localMatrix    = m_localMatrix;
+    m_reconstructor->GetSliceBounds( m_finishedVolume.lowerBound, m_finishedVolume.upperBound );
+    m_finishedVolume.volume = GetReconstructedImage();
+
+    DisconnectAcquisition();
+    m_pendingFrames.clear();
+    m_acquisitionId = SceneManager::InvalidId;
+    emit ReconstructionFinished();
+}
+
+IbisItkFloat3ImageType::Pointer LiveVolumeReconstruction::GetReconstructedImage()
+{
+    QMutexLocker lock( &m_mutex );
+    return m_latestVolume;
+}
+
+IbisItkFloat3ImageType::Pointer LiveVolumeReconstruction::GetFinishedVolume( USAcquisitionObject * acquisition,
+                                                                              bool useMask,
+                                                                              unsigned int usSearchRadius,
+                                                                              float volumeSpacing )
+{
+    if( !acquisition || acquisition->GetObjectID() != m_finishedVolume.acquisitionId ) return nullptr;
+
+    // Every frame of the acquisition has to be in the volume, with the same reconstruction parameters
+    if( m_finishedVolume.numberOfFrames != acquisition->GetNumberOfSlices() || m_finishedVolume.useMask != useMask ||
+        m_finishedVolume.usSearchRadius != usSearchRadius || m_finishedVolume.volumeSpacing != volumeSpacing )
+        return nullptr;
+    if( !m_finishedVolume.volume ) return nullptr;
+
+    // The frames are placed in the space of the acquisition, it must not have moved since
+    vtkMatrix4x4 * localMatrix = acquisition->GetLocalTransform()->GetMatrix();
+    for( int i = 0; i < 4; i++ )
+        for( int j = 0; j < 4; j++ )
+            if( localMatrix->GetElement( i, j ) != m_finishedVolume.localMatrix->GetElement( i, j ) ) return nullptr;
+
+    // The live volume is padded and aligned to the bricks of the reconstructor. Keep the voxels that cover the
+    // extent of the frames.
+    typedef IbisItkFloat3ImageType::RegionType RegionType;
+    const RegionType & largestRegion = m_finishedVolume.volume->GetLargestPossibleRegion();
+    const IbisItkFloat3ImageType::PointType & origin = m_finishedVolume.volume->GetOrigin();
+    RegionType::IndexType cropIndex;
+    RegionType::SizeType cropSize;
+    for( int k = 0; k < 3; k++ )
+    {
+        double spacing = m_finishedVolume.volume->GetSpacing()[k];
+        long lower     = long( std::floor( ( m_finishedVolume.lowerBound[k] - origin[k] ) / spacing ) );
+        long upper     = long( std::ceil( ( m_finishedVolume.upperBound[k] - origin[k] ) / spacing ) );
+        lower          = std::max( lower, long( largestRegion.GetIndex()[k] ) );
+        upper = std::min( upper, long( largestRegion.GetIndex()[k] + largestRegion.GetSize()[k] ) - 1 );
+        if( upper < lower ) return nullptr;
+        cropIndex[k] = lower;
+        cropSize[k]  = upper - lower + 1;
+    }
+
+    typedef itk::RegionOfInterestImageFilter<IbisItkFloat3ImageType, IbisItkFloat3ImageType> CropFilterType;
+    CropFilterType::Pointer cropFilter = CropFilterType::New();
+    cropFilter->SetInput( m_finishedVolume.volume );
+    cropFilter->SetRegionOfInterest( RegionType( cropIndex, cropSize ) );
+    cropFilter->Update();
+    return cropFilter->GetOutput();
+}
+
+void LiveVolumeReconstruction::OnFrameAdded( int frameIndex )
+{
+    Q_ASSERT( m_ibisAPI );
+    USAcquisitionObject * acquisition =
+        USAcquisitionObject::SafeDownCast( m_ibisAPI->GetObjectByID( m_acquisitionId ) );
+    if( !acquisition ) return;
+
+    // The frame has to be copied here, the video buffer can only be accessed from the main thread.
+    // It is converted to an itk image by the worker thread.
+    PendingFrame frame;
+    frame.image  = vtkSmartPointer<vtkImageData>::New();
+    frame.matrix = vtkSmartPointer<vtkMatrix4x4>::New();
+    acquisition->GetFrameData( frameIndex, frame.image, frame.matrix );
+
+    m_mutex.lock();
+    m_pendingFrames.push_back( frame );
+    m_slicesAvailable.wakeOne();
+    m_mutex.unlock();
+}
+
+void LiveVolumeReconstruction::OnVolumeAvailable()
+{
+    if( !m_ibisAPI ) return;
+    ImageObject * imageObject = ImageObject::SafeDownCast( m_ibisAPI->GetObjectByID( m_imageObjectId ) );
+
+    // The published volume is an output volume of the reconstructor, the worker writes to it again two publishes
+    // later, so it is copied while the worker can't publish. Most of the time, the volume keeps the same geometry:
+    // its voxels are then copied to the itk image of the ImageObject, which updates its vtk image and LUT range.
+    IbisItkFloat3ImageType::Pointer newVolume;
+    {
+        QMutexLocker lock( &m_mutex );
+        IbisItkFloat3ImageType::Pointer volume = m_latestVolume;
+        if( !volume || m_latestVolumePublished ) return;
+        m_latestVolumePublished = true;
+
+        IbisItkFloat3ImageType::Pointer displayedVolume = imageObject ? imageObject->GetItkImage() : nullptr;
+        if( displayedVolume && displayedVolume->GetLargestPossibleRegion() == volume->GetLargestPossibleRegion() &&
+            displayedVolume->GetOrigin() == volume->GetOrigin() &&
+            displayedVolume->GetSpacing() == volume->GetSpacing() &&
+            displayedVolume->GetDirection() == volume->GetDirection() )
+        {
+            size_t nbrOfVoxels = volume->GetLargestPossibleRegion().GetNumberOfPixels();
+            std::copy( volume->GetBufferPointer(), volume->GetBufferPointer() + nbrOfVoxels,
+                       displayedVolume->GetBufferPointer() );
+        }
+        else
+        {
+            typedef itk::ImageDuplicator<IbisItkFloat3ImageType> DuplicatorType;
+            DuplicatorType::Pointer duplicator = DuplicatorType::New();
+            duplicator->SetInputImage( volume );
+            duplicator->Update();
+            newVolume = duplicator->GetOutput();
+        }
+    }
+
+    if( !newVolume )
+    {
+        imageObject->ItkImageModified();
+        return;
+    }
+
+    USAcquisitionObject * acquisition =
+        USAcquisitionObject::SafeDownCast( m_ibisAPI->GetObjectByID( m_acquisitionId ) );
+
+    vtkSmartPointer<ImageObject> reconstructedImage = vtkSmartPointer<ImageObject>::New();
+    reconstructedImage->SetName( imageObject ? imageObject->GetName() : QString( "Live Reconstructed Volume" ) );
+    if( !reconstructedImage->SetItkImage( newVolume ) ) return;
+
+    SceneObject * parent = nullptr;
+    if( imageObject )
+        parent = imageObject->GetParent();
+    else if( acquisition && acquisition->GetParent() )
+        parent = acquisition->GetParent()->GetParent();
+    m_ibisAPI->AddObject( reconstructedImage, parent );
+    if( imageObject )
+        m_ibisAPI->RemoveObject( imageObject );
+    else
+        m_ibisAPI->SetCurrentObject( reconstructedImage );
+    m_imageObjectId = reconstructedImage->GetObjectID();
+}
+
+void LiveVolumeReconstruction::run()
+{
+    int acquisitionId                              = m_acquisitionId;
+    vtkSmartPointer<IbisItkVtkConverter> converter = vtkSmartPointer<IbisItkVtkConverter>::New();
+    QElapsedTimer publishTimer;
+    publishTimer.start();
+    bool volumeChanged = false;
+    bool stop          = false;
+    while( !stop )
+    {
+        std::deque<PendingFrame> frames;
+        m_mutex.lock();
+        if( m_pendingFrames.empty() && !m_stopRequested ) m_slicesAvailable.wait( &m_mutex, m_publishInterval );
+        frames.swap( m_pendingFrames );
+        stop = m_stopRequested;
+        if( m_cancelRequested )
+        {
+            m_mutex.unlock();
+            return;
+        }
+        m_mutex.unlock();
+
+        for( PendingFrame & frame : frames )
+        {
+            if( m_cancelRequested ) return;
+            try
+            {
+                IbisItkFloat3ImageType::Pointer slice = IbisItkFloat3ImageType::New();
+                converter->ConvertVtkImageToItkImage( slice, frame.image, frame.matrix );
+                m_reconstructor->AddSlice( slice );
+                volumeChanged = true;
+            }
+            catch( itk::ExceptionObject & err )
+            {
+                std::cerr << "Live volume reconstruction: could not add slice." << std::endl;
+                std::cerr << err << std::endl;
+            }
+        }
+
+        if( volumeChanged && ( stop || publishTimer.elapsed() >= m_publishInterval ) )
+        {
+            IbisItkFloat3ImageType::Pointer volume = m_reconstructor->GetReconstructedVolume();
+            m_mutex.lock();
+            m_latestVolume          = volume;
+            m_latestVolumePublished = false;
+            m_mutex.unlock();
+            emit VolumeAvailable();
+            volumeChanged = false;
+            publishTimer.restart();
+        }
+    }
+    emit WorkerDone( acquisitionId );
+}
@@ -0,0 +1,155 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef LIVEVOLUMERECONSTRUCTION_H
+#define LIVEVOLUMERECONSTRUCTION_H
+
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+
+#include "imageobject.h"
+#include "itkStreamingVolumeReconstruction.h"
+
+class IbisAPI;
+class USAcquisitionObject;
+class vtkImageData;
+class vtkMatrix4x4;
+
+// Reconstructs a US volume while an acquisition is being recorded. Frames are copied on the main thread
+// as the acquisition emits FrameAdded, then converted and accumulated by a worker thread. The volume is added
+// to the scene as soon as the first frame is processed and refreshed at most every PublishInterval msec.
+// When recording stops, the worker processes the remaining frames and the final volume is published in the main
+// thread once it is done, without blocking the main thread in the meantime. When the acquisition is removed or the
+// reconstruction is destroyed, it is cancelled and nothing more is published.
+class LiveVolumeReconstruction : public QThread, public vtkObject
+{
+    Q_OBJECT
+
+public:
+    typedef itk::StreamingVolumeReconstruction<IbisItkFloat3ImageType> StreamingReconstructionType;
+
+    static LiveVolumeReconstruction * New() { return new LiveVolumeReconstruction; }
+
+    LiveVolumeReconstruction();
+    virtual ~LiveVolumeReconstruction();
+    vtkTypeMacro( LiveVolumeReconstruction, vtkObject );
+
+    void SetIbisAPI( IbisAPI * api ) { m_ibisAPI = api; }
+    void SetUseMask( bool useMask ) { m_useMask = useMask; }
+    void SetUSSearchRadius( unsigned int usSearchRadius ) { m_usSearchRadius = usSearchRadius; }
+    void SetVolumeSpacing( float usVolumeSpacing ) { m_volumeSpacing = usVolumeSpacing; }
+    void SetPublishInterval( int msec ) { m_publishInterval = msec; }
+    int GetPublishInterval() { return m_publishInterval; }
+
+    // Start reconstructing the frames added to acquisition from now on. If the previous reconstruction is still
+    // processing its remaining frames, it is finished first.
+    void Start( USAcquisitionObject * acquisition );
+    // True from Start() until the reconstruction is finished or cancelled
+    bool IsActive() { return m_acquisitionId != SceneManager::InvalidId; }
+
+    // Latest volume published, nullptr if none. While the reconstruction is active, the worker writes to it again
+    // two publishes later.
+    IbisItkFloat3ImageType::Pointer GetReconstructedImage();
+    int GetImageObjectId() { return m_imageObjectId; }
+
+    // Final volume of the last finished reconstruction if it is the reconstruction of every frame of acquisition
+    // with these parameters and the current local transform of acquisition, nullptr otherwise. It is cropped to the
+    // extent of the frames, as the volume of GPU_VolumeReconstruction, the voxels keep the grid of the live volume.
+    // The finished volume is kept until the next reconstruction is started.
+    IbisItkFloat3ImageType::Pointer GetFinishedVolume( USAcquisitionObject * acquisition, bool useMask,
+                                                       unsigned int usSearchRadius, float volumeSpacing );
+
+public slots:
+
+    // Let the worker process the frames still queued and return. The final volume is published and
+    // ReconstructionFinished emitted when the worker is done.
+    void Stop();
+    // Stop the worker thread and detach from the acquisition without touching the scene.
+    void Cancel();
+
+signals:
+
+    void VolumeAvailable();
+    void ReconstructionFinished();
+    // Emitted by the worker thread when it is done with the frames of acquisitionId
+    void WorkerDone( int acquisitionId );
+
+private slots:
+
+    void OnFrameAdded( int frameIndex );
+    void OnVolumeAvailable();
+    void OnWorkerDone( int acquisitionId );
+
+protected:
+    void run() override;
+    void DisconnectAcquisition();
+    // Publish the final volume and detach from the acquisition, once the worker is done
+    void Finish();
+
+    IbisAPI * m_ibisAPI;
+    bool m_useMask;
+    unsigned int m_usSearchRadius;
+    float m_volumeSpacing;
+    int m_publishInterval;
+
+    int m_acquisitionId;
+    vtkSmartPointer<vtkMatrix4x4> m_localMatrix;  // local transform of the acquisition when it started
+    int m_imageObjectId;
+    StreamingReconstructionType::Pointer m_reconstructor;
+
+    // Copy of a frame of the acquisition and its calibrated matrix
+    struct PendingFrame
+    {
+        vtkSmartPointer<vtkImageData> image;
+        vtkSmartPointer<vtkMatrix4x4> matrix;
+    };
+
+    // Last finished reconstruction
+    struct FinishedVolume
+    {
+        FinishedVolume()
+            : acquisitionId( SceneManager::InvalidId ),
+              numberOfFrames( 0 ),
+              useMask( false ),
+              usSearchRadius( 0 ),
+              volumeSpacing( 0.0 )
+        {
+            for( int k = 0; k < 3; k++ ) lowerBound[k] = upperBound[k] = 0.0;
+        }
+        int acquisitionId;
+        int numberOfFrames;
+        bool useMask;
+        unsigned int usSearchRadius;
+        float volumeSpacing;
+        vtkSmartPointer<vtkMatrix4x4> localMatrix;
+        double lowerBound[3];
+        double upperBound[3];
+        IbisItkFloat3ImageType::Pointer volume;
+    };
+    FinishedVolume m_finishedVolume;
+
+    // Shared with the worker thread
+    QMutex m_mutex;
+    QWaitCondition m_slicesAvailable;
+    std::deque<PendingFrame> m_pendingFrames;
+    bool m_stopRequested;
+    std::atomic<bool> m_cancelRequested;  // also checked between frames
+    IbisItkFloat3ImageType::Pointer m_latestVolume;
+    bool m_latestVolumePublished;  // the latest volume was copied to the scene
+};
+
+#endif
@@ -0,0 +1,239 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "labelsurfaceextractor.h"
+
+#include <vtkDataArray.h>
+#include <vtkDiscreteMarchingCubes.h>
+#include <vtkPointData.h>
+#include <vtkStripper.h>
+#include <vtkTriangleFilter.h>
+#include <vtkWindowedSincPolyDataFilter.h>
+
+#include <QMutexLocker>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+struct LabelBounds
+{
+    LabelBounds() : numberOfVoxels( 0 ) {}
+    vtkIdType numberOfVoxels;
+    int extent[6];
+};
+
+// Count the voxels of every label in [minLabel, minLabel + bounds.size()[ and find their extents in one sweep
+template <class T>
+void SweepLabels( vtkImageData * image, T * voxels, int minLabel, std::vector<LabelBounds> & bounds )
+{
+    int extent[6];
+    image->GetExtent( extent );
+    int nbComponents = image->GetNumberOfScalarComponents();
+    int maxLabel     = minLabel + (int)bounds.size() - 1;
+    for( int z = extent[4]; z <= extent[5]; ++z )
+    {
+        for( int y = extent[2]; y <= extent[3]; ++y )
+        {
+            for( int x = extent[0]; x <= extent[1]; ++x, voxels += nbComponents )
+            {
+                int label = (int)*voxels;
+                if( label < minLabel || label > maxLabel ) continue;
+                LabelBounds & b = bounds[label - minLabel];
+                if( b.numberOfVoxels++ == 0 )
+                {
+                    b.extent[0] = b.extent[1] = x;
+                    b.extent[2] = b.extent[3] = y;
+                    b.extent[4] = b.extent[5] = z;
+                    continue;
+                }
+                b.extent[0] = std::min( b.extent[0], x );
+                b.extent[1] = std::max( b.extent[1], x );
+                b.extent[2] = std::min( b.extent[2], y );
+                b.extent[3] = std::max( b.extent[3], y );
+                b.extent[4] = std::min( b.extent[4], z );
+                b.extent[5] = std::max( b.extent[5], z );
+            }
+        }
+    }
+}
+}  // namespace
+
+LabelSurfaceExtractor::LabelSurfaceExtractor()
+{
+    m_threads                 = new QThreadPool;
+    m_smoothingIterations     = 15;
+    m_passBand                = 0.001;
+    m_featureAngle            = 120.0;
+    m_nextLabel               = 0;
+    m_numberOfProcessedLabels = 0;
+    m_cancelled               = false;
+}
+
+LabelSurfaceExtractor::~LabelSurfaceExtractor()
+{
+    Cancel();
+    Wait();
+    delete m_threads;
+}
+
+void LabelSurfaceExtractor::SetNumberOfThreads( int n )
+{
+    m_threads->setMaxThreadCount( n > 0 ? n : QThread::idealThreadCount() );
+}
+
+int LabelSurfaceExtractor::GetNumberOfThreads() { return m_threads->maxThreadCount(); }
+
+int LabelSurfaceExtractor::Start( vtkImageData * labelImage, int minLabel )
+{
+    Cancel();
+    Wait();
+    m_image                   = labelImage;
+    m_nextLabel               = 0;
+    m_numberOfProcessedLabels = 0;
+    m_cancelled               = false;
+    m_surfaces.clear();
+    FindLabels( minLabel );
+
+    int numberOfLabels = (int)m_labels.size();
+    auto extractLabels = [this, numberOfLabels]()
+    {
+        // Every thread has its own pipeline
+        vtkSmartPointer<vtkDiscreteMarchingCubes> contourExtractor = vtkSmartPointer<vtkDiscreteMarchingCubes>::New();
+        vtkSmartPointer<vtkTriangleFilter> triangleFilter          = vtkSmartPointer<vtkTriangleFilter>::New();
+        triangleFilter->SetInputConnection( contourExtractor->GetOutputPort() );
+        vtkSmartPointer<vtkStripper> stripper = vtkSmartPointer<vtkStripper>::New();
+        stripper->SetInputConnection( triangleFilter->GetOutputPort() );
+        vtkSmartPointer<vtkWindowedSincPolyDataFilter> smoother = vtkSmartPointer<vtkWindowedSincPolyDataFilter>::New();
+        smoother->SetInputConnection( stripper->GetOutputPort() );
+        smoother->SetNumberOfIterations( m_smoothingIterations );
+        smoother->BoundarySmoothingOff();
+        smoother->FeatureEdgeSmoothingOff();
+        smoother->SetFeatureAngle( m_featureAngle );
+        smoother->SetPassBand( m_passBand );
+        smoother->NonManifoldSmoothingOn();
+        smoother->NormalizeCoordinatesOn();
+
+        for( int i = m_nextLabel++; i < numberOfLabels && !m_cancelled; i = m_nextLabel++ )
+        {
+            const LabelExtent & label = m_labels[i];
+            contourExtractor->SetInputData( CropLabel( label ) );
+            contourExtractor->SetValue( 0, label.label );
+            smoother->Update();
+
+            Surface surface;
+            surface.label    = label.label;
+            surface.polyData = vtkSmartPointer<vtkPolyData>::New();
+            surface.polyData->DeepCopy( smoother->GetOutput() );
+
+            QMutexLocker lock( &m_mutex );
+            if( !m_cancelled && surface.polyData->GetNumberOfPoints() > 0 ) m_surfaces.push_back( surface );
+            ++m_numberOfProcessedLabels;
+            m_surfaceReady.wakeAll();
+        }
+    };
+    int numberOfThreads = std::min( m_threads->maxThreadCount(), numberOfLabels );
+    for( int t = 0; t < numberOfThreads; ++t ) m_threads->start( extractLabels );
+    return numberOfLabels;
+}
+
+bool LabelSurfaceExtractor::WaitForSurfaces( std::vector<Surface> & surfaces, int timeout )
+{
+    QMutexLocker lock( &m_mutex );
+    if( m_surfaces.empty() && !m_cancelled && m_numberOfProcessedLabels < (int)m_labels.size() )
+        m_surfaceReady.wait( &m_mutex, timeout );
+    while( !m_surfaces.empty() )
+    {
+        surfaces.push_back( m_surfaces.front() );
+        m_surfaces.pop_front();
+    }
+    return !m_cancelled && m_numberOfProcessedLabels < (int)m_labels.size();
+}
+
+void LabelSurfaceExtractor::Cancel()
+{
+    QMutexLocker lock( &m_mutex );
+    m_cancelled = true;
+    m_surfaces.clear();
+    m_surfaceReady.wakeAll();
+}
+
+void LabelSurfaceExtractor::Wait() { m_threads->waitForDone(); }
+
+void LabelSurfaceExtractor::FindLabels( int minLabel )
+{
+    m_labels.clear();
+    if( !m_image || !m_image->GetPointData()->GetScalars() ) return;
+
+    double range[2];
+    m_image->GetScalarRange( range );
+    int maxLabel = (int)floor( range[1] );
+    if( maxLabel < minLabel ) return;
+
+    std::vector<LabelBounds> bounds( maxLabel - minLabel + 1 );
+    switch( m_image->GetScalarType() )
+    {
+        vtkTemplateMacro( SweepLabels( m_image.GetPointer(), static_cast<VTK_TT *>( m_image->GetScalarPointer() ),
+                                       minLabel, bounds ) );
+    }
+
+    for( size_t i = 0; i < bounds.size(); ++i )
+    {
+        if( bounds[i].numberOfVoxels == 0 ) continue;
+        LabelExtent label;
+        label.label          = minLabel + (int)i;
+        label.numberOfVoxels = bounds[i].numberOfVoxels;
+        memcpy( label.extent, bounds[i].extent, sizeof( label.extent ) );
+        m_labels.push_back( label );
+    }
+
+    // Start with the largest labels so that the threads finish at about the same time
+    std::sort( m_labels.begin(), m_labels.end(), []( const LabelExtent & a, const LabelExtent & b )
+               { return a.numberOfVoxels > b.numberOfVoxels; } );
+}
+
+vtkSmartPointer<vtkImageData> LabelSurfaceExtractor::CropLabel( const LabelExtent & label )
+{
+    // Pad the extent of the label by one voxel to close the surface
+    int wholeExtent[6], extent[6];
+    m_image->GetExtent( wholeExtent );
+    for( int i = 0; i < 3; ++i )
+    {
+        extent[2 * i]     = std::max( label.extent[2 * i] - 1, wholeExtent[2 * i] );
+        extent[2 * i + 1] = std::min( label.extent[2 * i + 1] + 1, wholeExtent[2 * i + 1] );
+    }
+
+    vtkSmartPointer<vtkImageData> crop = vtkSmartPointer<vtkImageData>::New();
+    crop->SetExtent( extent );
+    crop->SetOrigin( m_image->GetOrigin() );
+    crop->SetSpacing( m_image->GetSpacing() );
+    crop->AllocateScalars( m_image->GetScalarType(), m_image->GetNumberOfScalarComponents() );
+
+    // The input is only read through its buffer, it is shared by all threads
+    size_t voxelSize = size_t( m_image->GetScalarSize() ) * size_t( m_image->GetNumberOfScalarComponents() );
+    size_t rowSize   = size_t( wholeExtent[1] - wholeExtent[0] + 1 ) * voxelSize;
+    size_t sliceSize = size_t( wholeExtent[3] - wholeExtent[2] + 1 ) * rowSize;
+    size_t cropRow   = size_t( extent[1] - extent[0] + 1 ) * voxelSize;
+    const char * in  = static_cast<const char *>( m_image->GetPointData()->GetScalars()->GetVoidPointer( 0 ) );
+    char * out       = static_cast<char *>( crop->GetPointData()->GetScalars()->GetVoidPointer( 0 ) );
+    for( int z = extent[4]; z <= extent[5]; ++z )
+    {
+        for( int y = extent[2]; y <= extent[3]; ++y, out += cropRow )
+        {
+            const char * row = in + size_t( z - wholeExtent[4] ) * sliceSize + size_t( y - wholeExtent[2] ) * rowSize +
+                               size_t( extent[0] - wholeExtent[0] ) * voxelSize;
+            memcpy( out, row, cropRow );
+        }
+    }
+    return crop;
+}
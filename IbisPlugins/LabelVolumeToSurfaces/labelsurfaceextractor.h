@@ -0,0 +1,101 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef LABELSURFACEEXTRACTOR_H
+#define LABELSURFACEEXTRACTOR_H
+
+#include <vtkImageData.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+class QThreadPool;
+
+/**
+ * @class   LabelSurfaceExtractor
+ * @brief   Extract the surfaces of all the labels of a label volume in parallel
+ *
+ * Start() finds the labels present in the volume and the extent of each label in a single sweep over the voxels,
+ * then a pool of threads extracts and smooths the surfaces, one label at a time. Each label is processed on a
+ * copy of its extent padded by one voxel, not on the whole volume. The largest labels are started first.
+ *
+ * The surfaces are handed to the caller as they are finished, see WaitForSurfaces(), so that they can be added to
+ * the scene from the GUI thread while the other labels are processed.
+ */
+class LabelSurfaceExtractor
+{
+public:
+    struct Surface
+    {
+        int label;
+        vtkSmartPointer<vtkPolyData> polyData;
+    };
+
+    LabelSurfaceExtractor();
+    /** Cancel and wait for the threads. */
+    ~LabelSurfaceExtractor();
+
+    /** Number of threads extracting surfaces, the ideal number of threads by default. */
+    void SetNumberOfThreads( int n );
+    int GetNumberOfThreads();
+
+    void SetSmoothingIterations( int n ) { m_smoothingIterations = n; }
+    void SetPassBand( double passBand ) { m_passBand = passBand; }
+    void SetFeatureAngle( double angle ) { m_featureAngle = angle; }
+
+    /** Start the extraction of the labels greater or equal to minLabel. Return the number of labels found. The
+     * image must not be modified until the extraction is finished. */
+    int Start( vtkImageData * labelImage, int minLabel );
+    /** Wait at most timeout ms for surfaces and append the finished ones to surfaces. Return false when all labels
+     * are processed or the extraction is cancelled and no surface is left. */
+    bool WaitForSurfaces( std::vector<Surface> & surfaces, int timeout );
+    /** Number of labels processed, with or without a surface. */
+    int GetNumberOfProcessedLabels() { return m_numberOfProcessedLabels; }
+    int GetNumberOfLabels() { return (int)m_labels.size(); }
+
+    /** Stop the labels that are not started yet, the running ones are finished and discarded. */
+    void Cancel();
+    /** Block until the threads are finished. */
+    void Wait();
+
+protected:
+    struct LabelExtent
+    {
+        int label;
+        vtkIdType numberOfVoxels;
+        int extent[6];
+    };
+
+    void FindLabels( int minLabel );
+    vtkSmartPointer<vtkImageData> CropLabel( const LabelExtent & label );
+
+    QThreadPool * m_threads;
+    int m_smoothingIterations;
+    double m_passBand;
+    double m_featureAngle;
+
+    vtkSmartPointer<vtkImageData> m_image;
+    std::vector<LabelExtent> m_labels;
+    std::atomic<int> m_nextLabel;
+    std::atomic<int> m_numberOfProcessedLabels;
+    std::atomic<bool> m_cancelled;
+
+    // Surfaces finished by the threads, waiting to be taken by WaitForSurfaces
+    QMutex m_mutex;
+    QWaitCondition m_surfaceReady;
+    std::deque<Surface> m_surfaces;
+};
+
+#endif
@@ -12,14 +12,7 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 
 #include "labelvolumetosurfacesplugininterface.h"
 
-#include <vtkDiscreteMarchingCubes.h>
-#include <vtkImageAccumulate.h>
 #include <vtkImageData.h>
-#include <vtkMarchingContourFilter.h>
-#include <vtkPointData.h>
-#include <vtkStripper.h>
-#include <vtkTriangleFilter.h>
-#include <vtkWindowedSincPolyDataFilter.h>
 
 #include <QApplication>
 #include <QMessageBox>
@@ -27,9 +20,13 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <QString>
 #include <QtGui>
 #include <QtPlugin>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 #include "ibisapi.h"
 #include "imageobject.h"
+#include "labelsurfaceextractor.h"
 #include "polydataobject.h"
 
 static double labelColors[256][3] = { { 0, 0, 0 },
@@ -309,86 +306,45 @@ void LabelVolumeToSurfacesPluginInterface::Run()
     ImageObject * image = ImageObject::SafeDownCast( ibisAPI->GetCurrentObject() );
     if( image && image->IsLabelImage() )
     {
-        // Get the range of labels
+        // Label 0 is usually the background
         double imageRange[2];
         image->GetImageScalarRange( imageRange );
-        int minLabel = (int)floor( imageRange[0] );
-        if( minLabel == 0 ) minLabel = 1;  // Usually, label 0 is a mask in minc files
-        int maxLabel       = (int)floor( imageRange[1] );
-        int numberOfLabels = maxLabel - minLabel + 1;
+        int minLabel = std::max( (int)floor( imageRange[0] ), 1 );
 
-        // Compute the histogram to find out which labels really exist in the volume
-        vtkImageAccumulate * histogram = vtkImageAccumulate::New();
-        histogram->SetInputData( image->GetImage() );
-        histogram->SetComponentExtent( 0, maxLabel, 0, 0, 0, 0 );
-        histogram->SetComponentOrigin( 0, 0, 0 );
-        histogram->SetComponentSpacing( 1, 1, 1 );
-        histogram->Update();
-
-        // Setup filters
-        vtkDiscreteMarchingCubes * contourExtractor = vtkDiscreteMarchingCubes::New();
-        contourExtractor->SetInputData( image->GetImage() );
-        vtkTriangleFilter * triangleFilter = vtkTriangleFilter::New();
-        triangleFilter->SetInputConnection( contourExtractor->GetOutputPort() );
-        vtkStripper * stripper = vtkStripper::New();
-        stripper->SetInputConnection( triangleFilter->GetOutputPort() );
-
-        unsigned int smoothingIterations         = 15;
-        double passBand                          = 0.001;
-        double featureAngle                      = 120.0;
-        vtkWindowedSincPolyDataFilter * smoother = vtkWindowedSincPolyDataFilter::New();
-        smoother->SetInputConnection( stripper->GetOutputPort() );
-        smoother->SetNumberOfIterations( smoothingIterations );
-        smoother->BoundarySmoothingOff();
-        smoother->FeatureEdgeSmoothingOff();
-        smoother->SetFeatureAngle( featureAngle );
-        smoother->SetPassBand( passBand );
-        smoother->NonManifoldSmoothingOn();
-        smoother->NormalizeCoordinatesOn();
-
-        IbisAPI * ibisAPI = GetIbisAPI();
-        Q_ASSERT( ibisAPI );
-        QProgressDialog * pd = ibisAPI->StartProgress( 100, "Extracting surfaces..." );
+        LabelSurfaceExtractor extractor;
+        int numberOfLabels   = extractor.Start( image->GetImage(), minLabel );
+        QProgressDialog * pd = ibisAPI->StartProgress( numberOfLabels, "Extracting surfaces..." );
         QApplication::processEvents();
 
-        for( int i = minLabel; i <= maxLabel; ++i )
+        // Surfaces are added to the scene as soon as they are extracted
+        bool extracting = numberOfLabels > 0;
+        while( extracting )
         {
-            // skip label if there is no voxel from this label
-            double frequency = histogram->GetOutput()->GetPointData()->GetScalars()->GetTuple1( i );
-            if( frequency == 0.0 ) continue;
-
-            contourExtractor->SetValue( 0, i );
+            std::vector<LabelSurfaceExtractor::Surface> surfaces;
+            extracting = extractor.WaitForSurfaces( surfaces, 50 );
+            for( size_t s = 0; s < surfaces.size(); ++s )
+            {
+                int label                    = surfaces[s].label;
+                PolyDataObject * polyDataObj = PolyDataObject::New();
+                QString objName              = QString( "Label %1" ).arg( label );
+                polyDataObj->SetName( objName );
+                polyDataObj->SetPolyData( surfaces[s].polyData );
+                if( label < 256 ) polyDataObj->SetColor( labelColors[label] );
+                ibisAPI->AddObject( polyDataObj, image );
+                polyDataObj->Delete();
+            }
 
-            // Do the processing
-            smoother->Update();
-
-            // Setup a PolyDataObject with output and add it to the scene
-            vtkPolyData * outCopy = vtkPolyData::New();
-            outCopy->DeepCopy( smoother->GetOutput() );
-            PolyDataObject * polyDataObj = PolyDataObject::New();
-            QString objName              = QString( "Label %1" ).arg( i );
-            polyDataObj->SetName( objName );
-            polyDataObj->SetPolyData( outCopy );
-            if( i < 256 ) polyDataObj->SetColor( labelColors[i] );
-            ibisAPI->AddObject( polyDataObj, image );
-
-            // cleanup
-            outCopy->Delete();
-            polyDataObj->Delete();
-
-            int progress = (int)( 100 * i / (double)numberOfLabels );
-            ibisAPI->UpdateProgress( pd, progress );
+            if( pd->wasCanceled() )
+            {
+                extractor.Cancel();
+                break;
+            }
+            ibisAPI->UpdateProgress( pd, extractor.GetNumberOfProcessedLabels() );
             QApplication::processEvents();
         }
+        extractor.Wait();
 
         ibisAPI->StopProgress( pd );
-
-        // Cleanup
-        contourExtractor->Delete();
-        triangleFilter->Delete();
-        stripper->Delete();
-        smoother->Delete();
-        histogram->Delete();
     }
     else
         QMessageBox::warning( 0, "Error!", "Current object should be a label volume" );
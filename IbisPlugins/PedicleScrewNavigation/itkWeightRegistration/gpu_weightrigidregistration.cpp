@@ -15,6 +15,9 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vnl/algo/vnl_real_eigensystem.h>
 #include <vnl/algo/vnl_symmetric_eigensystem.h>
 
+#include <algorithm>
+#include <sstream>
+
 class CommandIterationUpdateWeightOpenCL : public itk::Command
 {
 public:
@@ -123,70 +126,47 @@ GPU_WeightRigidRegistration::GPU_WeightRigidRegistration()
       m_orientationSelectivity( 2 ),
       m_targetSpatialObjectMask( nullptr ),
       m_lambdaMetricBalance( 0.5 ),
+      m_cacheSourceGradient( true ),
       m_orientationSamplingStrategy( OrientationSamplingStrategy::RANDOM ),
       m_registrationMetricToUse( RegistrationMetricToUseType::INTENSITY )
 {
+    m_requestedBackend = AutomaticBackend;
+    m_backend          = IsGPUBackendAvailable() ? GPUBackend : CPUBackend;
 }
 
 GPU_WeightRigidRegistration::~GPU_WeightRigidRegistration() {}
 
-void GPU_WeightRigidRegistration::runRegistration()
-{
-    // Make sure all params have been specified
-    if( !m_itkTargetImage )
-    {
-        std::cerr << "Fixed image is invalid " << m_itkTargetImage << std::endl;
-        std::cerr << "Use SetItkTargetImage( )" << std::endl;
-        return;
-    }
-    IbisItkFloat3ImageType::Pointer itkTargetImage = m_itkTargetImage;
-
-    if( !m_itkSourceImage )
-    {
-        std::cerr << "Moving image is invalid " << m_itkSourceImage << std::endl;
-        std::cerr << "Use SetItkSourceImage( )" << std::endl;
-        return;
-    }
-    IbisItkFloat3ImageType::Pointer itkSourceImage = m_itkSourceImage;
+bool GPU_WeightRigidRegistration::IsGPUBackendAvailable() { return itk::IsGPUAvailable(); }
 
-    if( m_sourceVtkTransform == 0 )
-    {
-        m_sourceVtkTransform = vtkTransform::New();
-    }
-
-    if( m_targetVtkTransform == 0 )
-    {
-        m_targetVtkTransform = vtkTransform::New();
-    }
-
-    if( m_resultTransform == 0 )
-    {
-        m_resultTransform = m_sourceVtkTransform;
-    }
-
-    vtkTransform * sourceVtkTransform = m_sourceVtkTransform;
-    vtkTransform * targetVtkTransform = m_targetVtkTransform;
-
-    itk::TimeProbesCollectorBase timer;
-
-    if( m_debug )
+GPU_WeightRigidRegistration::OrientationMetricPointer GPU_WeightRigidRegistration::CreateOrientationMetric(
+    Backend backend )
+{
+    if( backend != CPUBackend && IsGPUBackendAvailable() )
     {
-        std::cout << "Processing..(patience is a virtue)";
-        std::cout << "Setting up registration..." << std::endl;
-        timer.Start( "Pre-processing" );
+        try
+        {
+            OrientationMetricPointer metric = GPUOrientationMetricType::New().GetPointer();
+            m_backend                       = GPUBackend;
+            return metric;
+        }
+        catch( itk::ExceptionObject & err )
+        {
+            std::cerr << "Could not initialize OpenCL orientation matching metric, using CPU instead." << std::endl;
+            std::cerr << err << std::endl;
+        }
     }
+    m_backend = CPUBackend;
+    return CPUOrientationMetricType::New().GetPointer();
+}
 
-    // Registration
-    ItkRigidTransformType::Pointer itkTransform = ItkRigidTransformType::New();
-
-    OptimizerType::Pointer optimizer = OptimizerType::New();
-
-    double initialSigma         = m_initialSigma;
-    unsigned int populationSize = m_populationSize;
+GPU_WeightRigidRegistration::ItkRigidTransformType::Pointer GPU_WeightRigidRegistration::CreateInitialTransform()
+{
+    IbisItkFloat3ImageType::Pointer itkTargetImage = m_itkTargetImage;
+    ItkRigidTransformType::Pointer itkTransform    = ItkRigidTransformType::New();
 
     // Initialize Transform
     vtkSmartPointer<vtkMatrix4x4> finalMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
-    sourceVtkTransform->GetInverse( finalMatrix );
+    m_sourceVtkTransform->GetInverse( finalMatrix );
 
     ItkRigidTransformType::OffsetType offset;
 
@@ -246,11 +226,18 @@ void GPU_WeightRigidRegistration::runRegistration()
 
     itkTransform->SetCenter( center );
     itkTransform->SetParameters( params );
+    return itkTransform;
+}
 
+GPU_WeightRigidRegistration::GPUCostFunctionPointer GPU_WeightRigidRegistration::CreateCostFunction(
+    ItkRigidTransformType * itkTransform, OrientationMetricType * orientationMetric,
+    RegistrationMetricToUseType metricToUse )
+{
     GPUCostFunctionPointer costFunction = GPUCostFunctionType::New();
-    costFunction->SetFixedImage( itkTargetImage );
-    costFunction->SetMovingImage( itkSourceImage );
+    costFunction->SetFixedImage( m_itkTargetImage );
+    costFunction->SetMovingImage( m_itkSourceImage );
     costFunction->SetMetricTransform( itkTransform );
+    costFunction->SetOrientationMetric( orientationMetric );
 
     costFunction->SetLambda( m_lambdaMetricBalance );
 
@@ -260,6 +247,7 @@ void GPU_WeightRigidRegistration::runRegistration()
     costFunction->SetOrientationUseMask( m_useMask );
     costFunction->SetOrientationSelectivity( m_orientationSelectivity );
     costFunction->SetOrientationNumberOfPixels( m_orientationNumberOfPixels );
+    costFunction->SetOrientationCacheMovingImageGradient( m_cacheSourceGradient );
     if( m_targetSpatialObjectMask )
     {
         costFunction->SetFixedSpatialObjectImageMask( m_targetSpatialObjectMask );
@@ -267,9 +255,165 @@ void GPU_WeightRigidRegistration::runRegistration()
     }
 
     costFunction->SetDebug( m_debug );
-    costFunction->SetRegistrationMetricToUse( m_registrationMetricToUse );
+    costFunction->SetRegistrationMetricToUse( metricToUse );
 
     costFunction->UpdateMetrics();
+    return costFunction;
+}
+
+bool GPU_WeightRigidRegistration::CompareBackends( double tolerance, std::string & report )
+{
+    std::ostringstream out;
+    if( !m_itkTargetImage || !m_itkSourceImage || !m_sourceVtkTransform )
+    {
+        report = "Backend comparison needs the fixed image, the moving image and the source transform.";
+        return false;
+    }
+    if( !IsGPUBackendAvailable() )
+    {
+        report = "Backend comparison needs an OpenCL device.";
+        return false;
+    }
+
+    // Random sampling would draw different pixels for each backend, use the deterministic grid instead
+    OrientationSamplingStrategy samplingStrategy = m_orientationSamplingStrategy;
+    if( samplingStrategy == OrientationSamplingStrategy::RANDOM )
+        m_orientationSamplingStrategy = OrientationSamplingStrategy::GRID;
+
+    Backend backend        = m_backend;
+    bool ok                = true;
+    double maxDiff         = 0.0;
+    const int nbPoses      = 13;
+    int nbPosesInAgreement = 0;
+    try
+    {
+        ItkRigidTransformType::Pointer itkTransform = CreateInitialTransform();
+        OrientationMetricPointer gpuMetric          = CreateOrientationMetric( GPUBackend );
+        if( m_backend != GPUBackend )
+        {
+            out << "The OpenCL metric could not be initialized." << std::endl;
+            ok = false;
+        }
+        else
+        {
+            OrientationMetricPointer cpuMetric = CreateOrientationMetric( CPUBackend );
+            GPUCostFunctionPointer gpuCostFunction =
+                CreateCostFunction( itkTransform, gpuMetric, RegistrationMetricToUseType::GRADIENT );
+            GPUCostFunctionPointer cpuCostFunction =
+                CreateCostFunction( itkTransform, cpuMetric, RegistrationMetricToUseType::GRADIENT );
+
+            // The initial pose, then a small rotation or translation on each side of it along every parameter
+            const double steps[6]                         = { 0.05, 0.05, 0.05, 2.0, 2.0, 2.0 };
+            ItkRigidTransformType::ParametersType initial = itkTransform->GetParameters();
+            for( int p = 0; p < nbPoses; ++p )
+            {
+                ItkRigidTransformType::ParametersType params = initial;
+                if( p > 0 ) params[( p - 1 ) / 2] += ( p % 2 ? 1.0 : -1.0 ) * steps[( p - 1 ) / 2];
+
+                double gpuValue = gpuCostFunction->GetValue( params );
+                double cpuValue = cpuCostFunction->GetValue( params );
+                double diff     = std::fabs( gpuValue - cpuValue );
+                maxDiff         = std::max( maxDiff, diff );
+                if( diff <= tolerance * std::max( 1.0, std::fabs( gpuValue ) ) )
+                    ++nbPosesInAgreement;
+                else
+                    out << "Pose " << p << ": GPU " << gpuValue << ", CPU " << cpuValue << std::endl;
+            }
+            ok = ( nbPosesInAgreement == nbPoses );
+            out << nbPosesInAgreement << " of " << nbPoses << " poses agree, maximum difference " << maxDiff
+                << " (tolerance " << tolerance << ")" << std::endl;
+        }
+    }
+    catch( itk::ExceptionObject & err )
+    {
+        out << "Backend comparison failed: " << err << std::endl;
+        ok = false;
+    }
+
+    m_orientationSamplingStrategy = samplingStrategy;
+    m_backend                     = backend;
+    report                        = out.str();
+    return ok;
+}
+
+void GPU_WeightRigidRegistration::runRegistration()
+{
+    // Make sure all params have been specified
+    if( !m_itkTargetImage )
+    {
+        std::cerr << "Fixed image is invalid " << m_itkTargetImage << std::endl;
+        std::cerr << "Use SetItkTargetImage( )" << std::endl;
+        return;
+    }
+    IbisItkFloat3ImageType::Pointer itkTargetImage = m_itkTargetImage;
+
+    if( !m_itkSourceImage )
+    {
+        std::cerr << "Moving image is invalid " << m_itkSourceImage << std::endl;
+        std::cerr << "Use SetItkSourceImage( )" << std::endl;
+        return;
+    }
+    IbisItkFloat3ImageType::Pointer itkSourceImage = m_itkSourceImage;
+
+    if( m_sourceVtkTransform == 0 )
+    {
+        m_sourceVtkTransform = vtkTransform::New();
+    }
+
+    if( m_targetVtkTransform == 0 )
+    {
+        m_targetVtkTransform = vtkTransform::New();
+    }
+
+    if( m_resultTransform == 0 )
+    {
+        m_resultTransform = m_sourceVtkTransform;
+    }
+
+    vtkTransform * targetVtkTransform = m_targetVtkTransform;
+
+    itk::TimeProbesCollectorBase timer;
+
+    if( m_debug )
+    {
+        std::cout << "Processing..(patience is a virtue)";
+        std::cout << "Setting up registration..." << std::endl;
+        timer.Start( "Pre-processing" );
+    }
+
+    // Registration
+    OptimizerType::Pointer optimizer = OptimizerType::New();
+
+    double initialSigma         = m_initialSigma;
+    unsigned int populationSize = m_populationSize;
+
+    ItkRigidTransformType::Pointer itkTransform = CreateInitialTransform();
+
+    OrientationMetricPointer orientationMetric = CreateOrientationMetric( m_requestedBackend );
+    if( m_debug ) std::cout << "Metric backend: " << ( m_backend == GPUBackend ? "GPU" : "CPU" ) << std::endl;
+
+    RegistrationMetricToUseType metricToUse = m_registrationMetricToUse;
+    if( m_backend == CPUBackend && metricToUse != RegistrationMetricToUseType::GRADIENT )
+    {
+        std::cerr << "The intensity metric needs OpenCL, registering with the gradient orientation only." << std::endl;
+        metricToUse = RegistrationMetricToUseType::GRADIENT;
+    }
+
+    GPUCostFunctionPointer costFunction;
+    try
+    {
+        costFunction = CreateCostFunction( itkTransform, orientationMetric, metricToUse );
+    }
+    catch( itk::ExceptionObject & err )
+    {
+        std::cerr << "Could not initialize the registration metrics." << std::endl;
+        std::cerr << err << std::endl;
+        if( m_backend == CPUBackend ) return;
+
+        std::cerr << "Registering with the CPU gradient orientation metric only." << std::endl;
+        orientationMetric = CreateOrientationMetric( CPUBackend );
+        costFunction = CreateCostFunction( itkTransform, orientationMetric, RegistrationMetricToUseType::GRADIENT );
+    }
 
     if( m_debug )
     {
@@ -19,8 +19,12 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <vtkSmartPointer.h>
 #include <vtkTransform.h>
 
+#include <string>
+
 #include "imageobject.h"
+#include "itkCPUOrientationMatchingMatrixTransformationSparseMask.h"
 #include "itkGPU3DRigidSimilarityWeightMetric.h"
+#include "itkGPUOrientationMatchingMatrixTransformationSparseMask.h"
 
 class GPU_WeightRigidRegistration
 {
@@ -29,6 +33,21 @@ public:
 
     typedef itk::GPU3DRigidSimilarityWeightMetric<IbisItkFloat3ImageType, IbisItkFloat3ImageType> GPUCostFunctionType;
     typedef GPUCostFunctionType::Pointer GPUCostFunctionPointer;
+    typedef GPUCostFunctionType::OrientationMetricType OrientationMetricType;
+    typedef GPUCostFunctionType::OrientationMetricPointer OrientationMetricPointer;
+    typedef itk::GPUOrientationMatchingMatrixTransformationSparseMask<IbisItkFloat3ImageType, IbisItkFloat3ImageType>
+        GPUOrientationMetricType;
+    typedef itk::CPUOrientationMatchingMatrixTransformationSparseMask<IbisItkFloat3ImageType, IbisItkFloat3ImageType>
+        CPUOrientationMetricType;
+
+    // AutomaticBackend uses OpenCL when a GPU is available and falls back to the CPU otherwise.
+    // The intensity metric only exists in OpenCL, the CPU backend registers with the gradient orientation alone.
+    enum Backend
+    {
+        AutomaticBackend,
+        GPUBackend,
+        CPUBackend
+    };
 
     typedef itk::Euler3DTransform<double> ItkRigidTransformType;
 
@@ -42,6 +61,10 @@ public:
 
     void runRegistration();
 
+    /** Evaluate the gradient orientation metric with both backends on the fixed/moving pair around the
+        initial transform. Returns false if a backend fails or if the values differ by more than tolerance. */
+    bool CompareBackends( double tolerance, std::string & report );
+
     void SetItkSourceImage( IbisItkFloat3ImageType::Pointer image ) { this->m_itkSourceImage = image; }
     void SetItkTargetImage( IbisItkFloat3ImageType::Pointer image ) { this->m_itkTargetImage = image; }
     void SetSourceVtkTransform( vtkTransform * transform )
@@ -74,12 +97,14 @@ public:
     }
     void SetUseMask( bool usemask ) { this->m_useMask = usemask; }
     void SetLambdaMetricBalance( double lambda ) { this->m_lambdaMetricBalance = lambda; }
+    void SetCacheSourceGradient( bool cache ) { this->m_cacheSourceGradient = cache; }
 
     double GetOrientationPercentile() { return m_orientationPercentile; }
     unsigned int GetOrientationNumberOfPixels() { return m_orientationNumberOfPixels; }
     unsigned int GetOrientationSelectivity() { return m_orientationSelectivity; }
     bool GetUseMask() { return m_useMask; }
     double GetLambdaMetricBalance() { return m_lambdaMetricBalance; }
+    bool GetCacheSourceGradient() { return m_cacheSourceGradient; }
 
     void SetSamplingStrategyToRandom() { this->m_orientationSamplingStrategy = OrientationSamplingStrategy::RANDOM; }
     void SetSamplingStrategyToGrid() { this->m_orientationSamplingStrategy = OrientationSamplingStrategy::GRID; }
@@ -102,12 +127,23 @@ public:
 
     void SetTargetMask( ImageMaskPointer mask ) { this->m_targetSpatialObjectMask = mask; }
 
+    /** Select the backend used to evaluate the metric by the next registrations. */
+    void SetBackend( Backend backend ) { this->m_requestedBackend = backend; }
+    /** Return the backend effectively used by the last registration: GPUBackend or CPUBackend. */
+    Backend GetBackend() { return m_backend; }
+    static bool IsGPUBackendAvailable();
+
     double GetInitialSigma() { return m_initialSigma; }
     unsigned int GetPopulationSize() { return m_populationSize; }
     vtkTransform * GetResultTransform() { return m_resultTransform; }
 
 private:
     void updateTagsDistance();
+    OrientationMetricPointer CreateOrientationMetric( Backend backend );
+    ItkRigidTransformType::Pointer CreateInitialTransform();
+    GPUCostFunctionPointer CreateCostFunction( ItkRigidTransformType * itkTransform,
+                                               OrientationMetricType * orientationMetric,
+                                               RegistrationMetricToUseType metricToUse );
 
     bool m_OptimizationRunning;
     bool m_debug;
@@ -131,9 +167,13 @@ private:
     unsigned int m_orientationNumberOfPixels;
     unsigned int m_orientationSelectivity;
     double m_lambdaMetricBalance;
+    bool m_cacheSourceGradient;
     OrientationSamplingStrategy m_orientationSamplingStrategy;
 
     RegistrationMetricToUseType m_registrationMetricToUse;
+
+    Backend m_requestedBackend;
+    Backend m_backend;
 };
 
 #endif
@@ -16,8 +16,8 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #include <itkEuler3DTransform.h>
 #include <itkSingleValuedCostFunction.h>
 
-#include "itkGPUOrientationMatchingMatrixTransformationSparseMask.h"
 #include "itkGPUWeightMatchingMatrixTransformationSparseMask.h"
+#include "itkOrientationMatchingMatrixTransformationSparseMask.h"
 
 namespace itk
 {
@@ -84,18 +84,20 @@ public:
     typedef typename GPUIntensityMetricType::MatrixTransformType MetricTransformType;
     typedef typename MetricTransformType::Pointer MetricTransformPointer;
 
-    typedef itk::GPUOrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage>
-        GPUOrientationMetricType;
+    // The orientation metric is created by the caller, either the OpenCL or the CPU backend
+    typedef itk::OrientationMatchingMatrixTransformationSparseMask<TFixedImage, TMovingImage> OrientationMetricType;
+    typedef typename OrientationMetricType::Pointer OrientationMetricPointer;
 
     typedef itk::ImageMaskSpatialObject<3> ImageMaskType;
     typedef ImageMaskType::Pointer ImageMaskPointer;
-    typedef typename GPUOrientationMetricType::SamplingStrategyType SamplingStrategy;
+    typedef typename OrientationMetricType::SamplingStrategyType SamplingStrategy;
 
     typedef itk::Euler3DTransform<double> EulerTransformType;
     typedef EulerTransformType::Pointer EulerTransformPointer;
     typedef EulerTransformType::InputPointType PointType;
 
     itkSetObjectMacro( GPUIntensityMetric, GPUIntensityMetricType );
+    itkSetObjectMacro( OrientationMetric, OrientationMetricType );
     itkSetObjectMacro( FixedImage, FixedImageType );
     itkSetObjectMacro( MovingImage, MovingImageType );
     itkSetObjectMacro( MetricTransform, MetricTransformType );
@@ -106,6 +108,7 @@ public:
     itkSetMacro( OrientationSelectivity, unsigned int );
     itkSetMacro( OrientationUseMask, bool );
     itkSetMacro( OrientationSamplingStrategy, SamplingStrategy );
+    itkSetMacro( OrientationCacheMovingImageGradient, bool );
 
     itkSetMacro( RegistrationMetricToUse, RegistrationMetricToUseType );
 
@@ -114,7 +117,7 @@ public:
     GPU3DRigidSimilarityWeightMetric()
     {
         m_GPUIntensityMetric   = NULL;
-        m_GPUOrientationMetric = NULL;
+        m_OrientationMetric    = NULL;
         m_EulerTransform       = EulerTransformType::New();
         m_Debug                = true;
         m_FixedImage           = 0;
@@ -128,6 +131,8 @@ public:
         m_OrientationUseMask          = true;
         m_OrientationSamplingStrategy = SamplingStrategy::RANDOM;
 
+        m_OrientationCacheMovingImageGradient = true;
+
         m_RegistrationMetricToUse = COMBINATION;
         m_Lambda                  = 0.5;
         m_MetricMonitor           = new MetricMonitor;
@@ -135,9 +140,11 @@ public:
 
     double GetValue( const ParametersType & parameters ) const override
     {
-        if( !m_GPUIntensityMetric ) itkExceptionMacro( << "GPUIntensityMetric has not been set!" );
+        if( !m_GPUIntensityMetric && ( m_RegistrationMetricToUse != GRADIENT ) )
+            itkExceptionMacro( << "GPUIntensityMetric has not been set!" );
 
-        if( !m_GPUOrientationMetric ) itkExceptionMacro( << "GPUOrientationMetric has not been set!" );
+        if( !m_OrientationMetric && ( m_RegistrationMetricToUse != INTENSITY ) )
+            itkExceptionMacro( << "OrientationMetric has not been set!" );
 
         m_EulerTransform->SetParameters( parameters );
         double metricValue;
@@ -162,12 +169,12 @@ public:
             gradientTransform->SetMatrix( m_EulerTransform->GetMatrix() );
             gradientTransform->SetOffset( m_EulerTransform->GetOffset() );
 
-            m_GPUOrientationMetric->SetTransform( gradientTransform );
-            m_GPUOrientationMetric->Update();
+            m_OrientationMetric->SetTransform( gradientTransform );
+            m_OrientationMetric->Update();
 
             CurrentGradientMetricValue =
-                (double)std::pow( m_GPUOrientationMetric->GetMetricValue(), 1.0 / m_OrientationSelectivity );
-            //        CurrentGradientMetricValue = (double) m_GPUOrientationMetric->GetMetricValue() * 1000.0;
+                (double)std::pow( m_OrientationMetric->GetMetricValue(), 1.0 / m_OrientationSelectivity );
+            //        CurrentGradientMetricValue = (double) m_OrientationMetric->GetMetricValue() * 1000.0;
         }
 
         //    if (m_RegistrationMetricToUse == COMBINATION)
@@ -214,12 +221,11 @@ public:
 
         if( !m_MetricTransform ) itkExceptionMacro( << "Metric Transform has not been set!" );
 
-        if( !m_GPUIntensityMetric ) m_GPUIntensityMetric = GPUIntensityMetricType::New();
-
-        if( !m_GPUOrientationMetric ) m_GPUOrientationMetric = GPUOrientationMetricType::New();
-
         if( ( m_RegistrationMetricToUse == INTENSITY ) | ( m_RegistrationMetricToUse == COMBINATION ) )
         {
+            // The intensity metric only has an OpenCL implementation
+            if( !m_GPUIntensityMetric ) m_GPUIntensityMetric = GPUIntensityMetricType::New();
+
             m_EulerTransform->SetCenter( m_MetricTransform->GetCenter() );
 
             m_GPUIntensityMetric->SetFixedImage( m_FixedImage );
@@ -230,30 +236,33 @@ public:
 
         if( ( m_RegistrationMetricToUse == GRADIENT ) | ( m_RegistrationMetricToUse == COMBINATION ) )
         {
+            if( !m_OrientationMetric ) itkExceptionMacro( << "OrientationMetric has not been set!" );
+
             m_EulerTransform->SetCenter( m_MetricTransform->GetCenter() );
 
-            m_GPUOrientationMetric->SetFixedImage( m_FixedImage );
-            m_GPUOrientationMetric->SetMovingImage( m_MovingImage );
-            m_GPUOrientationMetric->SetTransform( m_MetricTransform );
+            m_OrientationMetric->SetFixedImage( m_FixedImage );
+            m_OrientationMetric->SetMovingImage( m_MovingImage );
+            m_OrientationMetric->SetTransform( m_MetricTransform );
             if( m_FixedSpatialObjectImageMask )
             {
-                m_GPUOrientationMetric->SetFixedImageMaskSpatialObject( m_FixedSpatialObjectImageMask );
-                m_GPUOrientationMetric->SetUseFixedImageMask( true );
+                m_OrientationMetric->SetFixedImageMaskSpatialObject( m_FixedSpatialObjectImageMask );
+                m_OrientationMetric->SetUseFixedImageMask( true );
             }
-            m_GPUOrientationMetric->SetSamplingStrategy( m_OrientationSamplingStrategy );
-            m_GPUOrientationMetric->SetNumberOfPixels( m_OrientationNumberOfPixels );
-            m_GPUOrientationMetric->SetPercentile( m_OrientationPercentile );
-            m_GPUOrientationMetric->SetN( m_OrientationSelectivity );
-            m_GPUOrientationMetric->SetComputeMask( m_OrientationUseMask );
-            m_GPUOrientationMetric->SetMaskThreshold( 0.5 );
-            m_GPUOrientationMetric->SetGradientScale( 1.0 );
-            m_GPUOrientationMetric->Update();
+            m_OrientationMetric->SetSamplingStrategy( m_OrientationSamplingStrategy );
+            m_OrientationMetric->SetNumberOfPixels( m_OrientationNumberOfPixels );
+            m_OrientationMetric->SetPercentile( m_OrientationPercentile );
+            m_OrientationMetric->SetN( m_OrientationSelectivity );
+            m_OrientationMetric->SetComputeMask( m_OrientationUseMask );
+            m_OrientationMetric->SetMaskThreshold( 0.5 );
+            m_OrientationMetric->SetGradientScale( 1.0 );
+            m_OrientationMetric->SetCacheMovingImageGradient( m_OrientationCacheMovingImageGradient );
+            m_OrientationMetric->Update();
         }
     }
 
 private:
     typename GPUIntensityMetricType::Pointer m_GPUIntensityMetric;
-    typename GPUOrientationMetricType::Pointer m_GPUOrientationMetric;
+    OrientationMetricPointer m_OrientationMetric;
     EulerTransformPointer m_EulerTransform;
     PointType m_Center;
 
@@ -269,6 +278,7 @@ private:
     unsigned int m_OrientationSelectivity;
     bool m_OrientationUseMask;
     SamplingStrategy m_OrientationSamplingStrategy;
+    bool m_OrientationCacheMovingImageGradient;
 
     RegistrationMetricToUseType m_RegistrationMetricToUse;
     double m_Lambda;
@@ -14,6 +14,12 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 
 #include "ui_vertebraregistrationwidget.h"
 
+#include "gpu_volumereconstructionplugininterface.h"
+#include "livevolumereconstruction.h"
+
+// Relative difference allowed between the GPU and CPU gradient orientation metric values
+static const double MetricBackendTolerance = 0.001;
+
 VertebraRegistrationWidget::VertebraRegistrationWidget( QWidget * parent )
     : QWidget( parent ),
       ui( new Ui::VertebraRegistrationWidget ),
@@ -156,6 +162,18 @@ void VertebraRegistrationWidget::UpdateUi()
     ui->optInitialSigmaComboBox->addItem( tr( "8.0" ), 8.0 );
     ui->optInitialSigmaComboBox->setCurrentIndex( 1 );
 
+    ui->backendComboBox->clear();
+    ui->backendComboBox->addItem( tr( "Automatic" ), QVariant( GPU_WeightRigidRegistration::AutomaticBackend ) );
+    if( GPU_WeightRigidRegistration::IsGPUBackendAvailable() )
+    {
+        ui->backendComboBox->addItem( tr( "GPU (OpenCL)" ), QVariant( GPU_WeightRigidRegistration::GPUBackend ) );
+    }
+    else
+    {
+        ui->compareBackendsCheckBox->setEnabled( false );
+    }
+    ui->backendComboBox->addItem( tr( "CPU (multithreaded)" ), QVariant( GPU_WeightRigidRegistration::CPUBackend ) );
+
     ui->advancedSettingsGroupBox->hide();
 }
 
@@ -319,6 +337,24 @@ bool VertebraRegistrationWidget::CreateVolumeFromSlices( USAcquisitionObject * u
         }
     }
 
+    // The volume accumulated by the live reconstruction while the acquisition was recorded is used if it has the
+    // same parameters and transform, cropped to the extent of the slices. Otherwise the slices are reconstructed
+    // again.
+    bool hasSecondaryAcquisitions = false;
+    for( USAcquisitionObject * acq : secondaryAcquisitions )
+    {
+        if( acq->GetObjectID() != usAcquisitionObject->GetObjectID() ) hasSecondaryAcquisitions = true;
+    }
+    if( !hasSecondaryAcquisitions )
+    {
+        IbisItkFloat3ImagePointer liveVolume = this->GetLiveReconstructedVolume( usAcquisitionObject );
+        if( liveVolume )
+        {
+            m_sparseUsVolume = liveVolume;
+            return processOK;
+        }
+    }
+
     for( USAcquisitionObject * acq : secondaryAcquisitions )
     {
         if( ( acq->GetObjectID() != usAcquisitionObject->GetObjectID() ) ||
@@ -375,6 +411,19 @@ bool VertebraRegistrationWidget::CreateVolumeFromSlices( USAcquisitionObject * u
     return processOK;
 }
 
+IbisItkFloat3ImagePointer VertebraRegistrationWidget::GetLiveReconstructedVolume(
+    USAcquisitionObject * usAcquisitionObject )
+{
+    IbisAPI * ibisAPI                = m_pluginInterface->GetIbisAPI();
+    ToolPluginInterface * toolPlugin = ibisAPI->GetToolPluginByName( "GPU_VolumeReconstruction" );
+    GPU_VolumeReconstructionPluginInterface * volumeReconstructionPlugin =
+        GPU_VolumeReconstructionPluginInterface::SafeDownCast( toolPlugin );
+    if( !volumeReconstructionPlugin ) return nullptr;
+    return volumeReconstructionPlugin->GetLiveReconstruction()->GetFinishedVolume(
+        usAcquisitionObject, ui->useMaskCheckBox->isChecked(), m_reconstructionSearchRadius,
+        float( m_reconstructionResolution ) );
+}
+
 IbisItkFloat3ImageType::PointType VertebraRegistrationWidget::GetCenterOfGravity( IbisItkFloat3ImagePointer itkImage )
 {
     using FixedImageCalculatorType                    = itk::ImageMomentsCalculator<IbisItkFloat3ImageType>;
@@ -617,6 +666,8 @@ bool VertebraRegistrationWidget::Register()
         rigidRegistrator->SetInitialSigma( m_optInitialSigma );
         rigidRegistrator->SetLambdaMetricBalance( m_lambdaMetricBalance );
         rigidRegistrator->SetDebug( false );
+        rigidRegistrator->SetBackend( static_cast<GPU_WeightRigidRegistration::Backend>(
+            ui->backendComboBox->itemData( ui->backendComboBox->currentIndex() ).toInt() ) );
 
         // Set image inputs
         rigidRegistrator->SetItkSourceImage( itkSourceImage );
@@ -638,10 +689,22 @@ bool VertebraRegistrationWidget::Register()
             rigidRegistrator->SetParentVtkTransform( parentVtktransform );
         }
 
+        if( ui->compareBackendsCheckBox->isChecked() )
+        {
+            std::string report;
+            bool agree = rigidRegistrator->CompareBackends( MetricBackendTolerance, report );
+            std::cerr << "Metric backend comparison: " << std::endl << report;
+            if( !agree )
+                QMessageBox::warning( this, "Vertebra Rigid Registration",
+                                      tr( "The GPU and CPU metrics disagree:\n" ) + QString::fromStdString( report ) );
+        }
+
         // Run registration
         ctImageObject->StartModifyingTransform();
 
         rigidRegistrator->runRegistration();
+        m_registrationBackend =
+            rigidRegistrator->GetBackend() == GPU_WeightRigidRegistration::GPUBackend ? tr( "GPU" ) : tr( "CPU" );
 
         ctImageObject->FinishModifyingTransform();
         ctImageObject->SetLocalTransform( sourceVtkTransform );
@@ -698,11 +761,17 @@ void VertebraRegistrationWidget::on_startRegistrationButton_clicked()
         QElapsedTimer timer;
         timer.start();
 
+        m_registrationBackend.clear();
         bool processOK;
         processOK = this->Register();
 
         double elapsedTime = double( timer.elapsed() ) / 1000.0;
-        if( processOK ) ui->elapsedTimeLabel->setText( tr( "Time: " ) + QString::number( elapsedTime ) + tr( " s" ) );
+        if( processOK )
+        {
+            QString label = tr( "Time: " ) + QString::number( elapsedTime ) + tr( " s" );
+            if( !m_registrationBackend.isEmpty() ) label += " (" + m_registrationBackend + ")";
+            ui->elapsedTimeLabel->setText( label );
+        }
         m_isProcessing = false;
     }
 }
@@ -98,6 +98,8 @@ private:
     bool CreateVolumeFromSlices( USAcquisitionObject *, float spacingFactor = 0 );
     bool CreateVolumeFromSlices( USAcquisitionObject *, float spacingFactor,
                                  QList<USAcquisitionObject *> secondaryAcquisitions );
+    // Volume reconstructed while the acquisition was recorded, nullptr if there is none for the current parameters
+    IbisItkFloat3ImagePointer GetLiveReconstructedVolume( USAcquisitionObject * );
 
     // Registration functionality
     IbisItkFloat3ImageType::PointType GetCenterOfGravity( IbisItkFloat3ImagePointer );
@@ -147,6 +149,7 @@ private:
     int m_optPopulationSize;
     double m_optPercentile;
     double m_optInitialSigma;
+    QString m_registrationBackend;
 
     int m_it;
     SecondaryUSAcquisition * m_secondaryAcquisitions;
@@ -10,23 +10,24 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 =========================================================================*/
 // Thanks to Houssem Gueziri for writing this class
 
-#define _CRT_SECURE_NO_WARNINGS
 #include "recordtrackingwidget.h"
 
 #include <QCheckBox>
+#include <QDir>
 #include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QLabel>
+#include <QMessageBox>
 #include <QSpacerItem>
+#include <QTemporaryFile>
 #include <QTime>
 #include <QWidgetItem>
-#include <chrono>
-#include <cstdio>
-#include <iomanip>
-#include <sstream>
 
 #include "ibisapi.h"
 #include "recordtrackingplugininterface.h"
+#include "trackingrecorder.h"
+#include "trackingrecording.h"
 #include "ui_recordtrackingwidget.h"
 
 RecordTrackingWidget::RecordTrackingWidget( QWidget * parent )
@@ -34,17 +35,19 @@ RecordTrackingWidget::RecordTrackingWidget( QWidget * parent )
       ui( new Ui::RecordTrackingWidget ),
       m_pluginInterface( nullptr ),
       m_recording( false ),
-      m_frameId( 0 ),
+      m_recorder( new TrackingRecorder ),
+      m_temporaryFile( nullptr ),
       m_cummulativeTime( 0 )
 {
-    m_temporaryFilename = "";
     ui->setupUi( this );
     setWindowTitle( "Rocord Tracking Information" );
 }
 
 RecordTrackingWidget::~RecordTrackingWidget()
 {
-    if( m_recordfile.is_open() ) m_recordfile.close();
+    // Close the recording before its temporary file is removed
+    delete m_recorder;
+    delete m_temporaryFile;
     delete ui;
 }
 
@@ -58,83 +61,62 @@ void RecordTrackingWidget::on_startButton_clicked()
 {
     if( ( !m_recording ) && ( m_pluginInterface ) )
     {
+        // Only a save stops the recorder, a stopped recording that is still there could not be saved
+        if( m_temporaryFile && !m_recorder->isRunning() )
+        {
+            QMessageBox::StandardButton reply = QMessageBox::question(
+                this, tr( "Start Recording" ), tr( "The current recording was not saved. Discard it?" ),
+                QMessageBox::Yes | QMessageBox::No, QMessageBox::No );
+            if( reply != QMessageBox::Yes ) return;
+        }
+
         IbisAPI * ibisApi = m_pluginInterface->GetIbisAPI();
         ui->instrumentGroupBox->setEnabled( false );
 
-        if( m_temporaryFilename != "" )
+        if( m_temporaryFile && m_recorder->isRunning() )
         {
-            m_recordfile.open( m_temporaryFilename, std::fstream::app );
-            if( m_recordfile )
-            {
-                ui->saveButton->setEnabled( false );
-                ui->startButton->setText( tr( "Pause Recording" ) );
-
-                m_recording = true;
-                m_elapsedTimer.start();
-                connect( ibisApi, SIGNAL( IbisClockTick() ), this, SLOT( OnToolsPositionUpdated() ) );
-            }
+            m_recorder->Resume();
         }
         else
         {
-            m_temporaryFilename = std::tmpnam( nullptr );
+            delete m_temporaryFile;
+            m_temporaryFile = new QTemporaryFile( QDir::tempPath() + "/XXXXXX." + TrackingRecording::GetFileSuffix() );
+            if( m_temporaryFile->open() ) m_temporaryFile->close();
 
-            m_recordfile.open( m_temporaryFilename, std::fstream::out );
-            if( m_recordfile )
+            std::vector<TrackedSceneObject *> tools;
+            for( int i = 0; i < ui->trackedObjectLayout->count(); ++i )
             {
-                m_recording = true;
-
-                m_recordedObjectsList.clear();
-                for( int i = 0; i < ui->trackedObjectLayout->count(); ++i )
+                QCheckBox * cb = qobject_cast<QCheckBox *>( ui->trackedObjectLayout->itemAt( i )->widget() );
+                if( cb && cb->isChecked() )
                 {
-                    QLayoutItem * const item = ui->trackedObjectLayout->itemAt( i );
-                    if( dynamic_cast<QWidgetItem *>( item ) )
-                    {
-                        QCheckBox * cb = dynamic_cast<QCheckBox *>( item->widget() );
-                        if( cb->isChecked() )
-                            m_recordedObjectsList.push_back(
-                                TrackedSceneObject::SafeDownCast( ibisApi->GetObjectByID( m_trackedObjectIds[i] ) ) );
-                    }
+                    TrackedSceneObject * obj = TrackedSceneObject::SafeDownCast(
+                        ibisApi->GetObjectByID( cb->property( "ObjectID" ).toInt() ) );
+                    if( obj ) tools.push_back( obj );
                 }
+            }
 
-                ui->saveButton->setEnabled( false );
-                ui->startButton->setText( tr( "Pause Recording" ) );
-                m_frameId = 0;
-
-                m_recordfile << "ObjectType = Image" << std::endl;
-                m_recordfile << "NDims = 3" << std::endl;
-                m_recordfile << "AnatomicalOrientation = RAS" << std::endl;
-                m_recordfile << "BinaryData = True" << std::endl;
-                m_recordfile << "BinaryDataByteOrderMSB = False" << std::endl;
-                m_recordfile << "CenterOfRotation = 0 0 0" << std::endl;
-                m_recordfile << "CompressedData = True" << std::endl;
-                m_recordfile << "CompressedDataSize = 321" << std::endl;
-                m_recordfile << "DimSize = ";
-                m_framenumberfilep = m_recordfile.tellp();
-                m_recordfile << "                         " << std::endl;
-                m_recordfile << "Kinds = domain domain list" << std::endl;
-                m_recordfile << "ElementSpacing = 1 1 1" << std::endl;
-                m_recordfile << "ElementType = MET_UCHAR" << std::endl;
-                m_recordfile << "Offset = 0 0 0" << std::endl;
-                m_recordfile << "TransformMatrix = 1 0 0 0 1 0 0 0 1" << std::endl;
-                m_recordfile << "UltrasoundImageOrientation = UNA" << std::endl;
-
-                m_cummulativeTime = 0;
-                m_elapsedTimer.start();
-                connect( ibisApi, SIGNAL( IbisClockTick() ), this, SLOT( OnToolsPositionUpdated() ) );
+            if( m_temporaryFile->fileName().isEmpty() || !m_recorder->Start( m_temporaryFile->fileName(), tools ) )
+            {
+                delete m_temporaryFile;
+                m_temporaryFile = nullptr;
+                ui->instrumentGroupBox->setEnabled( true );
+                QMessageBox::warning( this, "Error", "Could not create the tracking recording file." );
+                return;
             }
+            m_cummulativeTime = 0;
         }
+
+        ui->saveButton->setEnabled( false );
+        ui->startButton->setText( tr( "Pause Recording" ) );
+        m_recording = true;
+        m_elapsedTimer.start();
+        connect( ibisApi, SIGNAL( IbisClockTick() ), this, SLOT( OnToolsPositionUpdated() ) );
     }
     else
     {
         IbisAPI * ibisApi = m_pluginInterface->GetIbisAPI();
         disconnect( ibisApi, SIGNAL( IbisClockTick() ), this, SLOT( OnToolsPositionUpdated() ) );
-        if( m_recordfile )
-        {
-            // write frame number
-            m_recordfile.seekp( m_framenumberfilep );
-            m_recordfile << "1 1 " << m_frameId;
-            m_recordfile.close();
-        }
+        m_recorder->Pause();
 
         m_cummulativeTime += m_elapsedTimer.elapsed();
         m_recording = false;
@@ -146,20 +128,50 @@ void RecordTrackingWidget::on_startButton_clicked()
 void RecordTrackingWidget::on_saveButton_clicked()
 {
     if( m_recording ) on_startButton_clicked();
+    if( !m_temporaryFile ) return;
     IbisAPI * ibisApi = m_pluginInterface->GetIbisAPI();
-    QString fileName  = QFileDialog::getSaveFileName(
-        this, tr( "Save trackeing sequence" ), ibisApi->GetWorkingDirectory(), tr( "Tracking sequence (*.mha)" ) );
+    QString filter;
+    QString fileName = QFileDialog::getSaveFileName(
+        this, tr( "Save trackeing sequence" ), ibisApi->GetWorkingDirectory(),
+        tr( "Tracking sequence (*.mha);;CSV (*.csv);;Tracking recording (*.ibistrk)" ), &filter );
     if( fileName.size() > 0 )
     {
-        if( !fileName.endsWith( ".mha" ) ) fileName += ".mha";
-        if( QFile( fileName ).exists() ) std::remove( fileName.toUtf8().constData() );
-        if( QFile::copy( tr( m_temporaryFilename.c_str() ), fileName ) )
+        // The format is given by the suffix, or by the selected filter if the suffix is unknown
+        QString suffix = QFileInfo( fileName ).suffix().toLower();
+        if( suffix != "mha" && suffix != "csv" && suffix != TrackingRecording::GetFileSuffix() )
+        {
+            suffix = filter.contains( "*.csv" ) ? "csv" : filter.contains( "*.ibistrk" ) ? "ibistrk" : "mha";
+            fileName += "." + suffix;
+        }
+
+        // Write the samples that are still queued and close the recording
+        m_recorder->Stop();
+
+        if( QFile::exists( fileName ) ) QFile::remove( fileName );
+        bool ok = false;
+        QString errorMessage;
+        if( suffix == TrackingRecording::GetFileSuffix() )
+            ok = QFile::copy( m_temporaryFile->fileName(), fileName );
+        else
         {
-            std::remove( m_temporaryFilename.c_str() );
-            m_temporaryFilename = "";
+            TrackingRecording recording;
+            if( recording.Open( m_temporaryFile->fileName() ) )
+                ok = suffix == "csv" ? recording.ExportCSV( fileName ) : recording.ExportSequence( fileName );
+            errorMessage = recording.GetErrorMessage();
+        }
+
+        if( ok )
+        {
+            delete m_temporaryFile;
+            m_temporaryFile = nullptr;
             ui->saveButton->setEnabled( false );
             ui->instrumentGroupBox->setEnabled( true );
         }
+        else
+            QMessageBox::warning( this, "Error",
+                                  "Could not save the tracking sequence to " + fileName + ".\n" +
+                                      ( errorMessage.isEmpty() ? QString() : errorMessage + "\n" ) +
+                                      "The recording is kept, it can be saved to another file." );
     }
 }
 
@@ -214,6 +226,7 @@ void RecordTrackingWidget::AddTrackedTool( int objId )
 
 void RecordTrackingWidget::RemoveTrackedTool( int objId )
 {
+    m_recorder->RemoveTool( objId );
     for( int i = 0; i < ui->trackedObjectLayout->count(); ++i )
     {
         QWidget * w = ui->trackedObjectLayout->itemAt( i )->widget();
@@ -236,52 +249,15 @@ void RecordTrackingWidget::RemoveTrackedTool( int objId )
 
 void RecordTrackingWidget::OnToolsPositionUpdated()
 {
-    if( m_recordfile )
-    {
-        std::stringstream ss;
-        ss << std::setw( 10 ) << std::setfill( '0' ) << m_frameId;
-        std::string strFrameId = ss.str();
-        m_recordfile << "Seq_Frame" + strFrameId + "_FrameNumber = " + strFrameId << std::endl;
-        double timestamp = -1;
-
-        for( size_t i = 0; i < m_recordedObjectsList.size(); ++i )
-        {
-            TrackedSceneObject * obj = m_recordedObjectsList.at( i );
-            std::string msg;
-            std::string toolStatus;
-
-            m_recordfile << "Seq_Frame" + strFrameId + "_" + obj->GetName().toUtf8().constData() +
-                                "ToReferenceTransform = "
-                         << this->GetStringFromTransform( obj->GetWorldTransform() ) << std::endl;
-            toolStatus = ( obj->GetState() == TrackerToolState::Ok ) ? "OK" : "INVALID";
-            m_recordfile << "Seq_Frame" + strFrameId + "_" + obj->GetName().toUtf8().constData() +
-                                "ToReferenceTransformStatus = "
-                         << toolStatus << std::endl;
-            if( timestamp < 0 ) timestamp = obj->GetLastTimestamp();
-        }
+    m_recorder->SampleTools();
 
-        m_recordfile << "Seq_Frame" + strFrameId + "_Timestamp = " << std::fixed << timestamp << std::endl;
-        m_recordfile << "Seq_Frame" + strFrameId + "_UnfilteredTimestamp = " << std::fixed << timestamp << std::endl;
-        // m_recordfile << "Seq_Frame" + strFrameId + "_ImageStatus = INVALID" << std::endl;
-        m_frameId++;
+    QString samples = "Number of samples: " + QString::number( m_recorder->GetNumberOfSamples() );
+    if( m_recorder->GetNumberOfDroppedSamples() > 0 )
+        samples += " (" + QString::number( m_recorder->GetNumberOfDroppedSamples() ) + " dropped)";
+    if( !m_recorder->IsFileOk() ) samples += " - write error";
 
-        QTime time( 0, 0, 0 );
-        time = time.addMSecs( m_elapsedTimer.elapsed() + m_cummulativeTime );
-        ui->numberOfFramesLabel->setText( "Number of frames: " + QString::number( m_frameId ) );
-        ui->elapsedTimeLabel->setText( "Time: " + time.toString( "hh:mm:ss" ) );
-    }
-}
-
-std::string RecordTrackingWidget::GetStringFromTransform( vtkTransform * transform )
-{
-    std::stringstream strTransform;
-    for( int i = 0; i < 4; ++i )
-    {
-        for( int j = 0; j < 4; ++j )
-        {
-            double elm = transform->GetMatrix()->GetElement( i, j );
-            strTransform << elm << " ";
-        }
-    }
-    return strTransform.str();
+    QTime time( 0, 0, 0 );
+    time = time.addMSecs( m_elapsedTimer.elapsed() + m_cummulativeTime );
+    ui->numberOfFramesLabel->setText( samples );
+    ui->elapsedTimeLabel->setText( "Time: " + time.toString( "hh:mm:ss" ) );
 }
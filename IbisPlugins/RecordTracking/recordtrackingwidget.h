@@ -13,17 +13,15 @@ See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
 #ifndef RECORDTRACKINGWIDGET_H
 #define RECORDTRACKINGWIDGET_H
 
-#include <vtkTransform.h>
-
 #include <QElapsedTimer>
 #include <QWidget>
-#include <fstream>
-#include <iostream>
 #include <vector>
 
 #include "trackedsceneobject.h"
 
 class RecordTrackingPluginInterface;
+class TrackingRecorder;
+class QTemporaryFile;
 
 namespace Ui
 {
@@ -43,9 +41,6 @@ public:
 
     void SetPluginInterface( RecordTrackingPluginInterface * interf );
 
-private:
-    std::string GetStringFromTransform( vtkTransform * );
-
 private:
     void UpdateUi();
 
@@ -53,13 +48,10 @@ private:
     RecordTrackingPluginInterface * m_pluginInterface;
 
     bool m_recording;
-    std::ofstream m_recordfile;
     QList<TrackedSceneObject *> m_trackedToolsList;
-    unsigned long int m_frameId;
     std::vector<int> m_trackedObjectIds;
-    std::vector<TrackedSceneObject *> m_recordedObjectsList;
-    std::iostream::pos_type m_framenumberfilep;
-    std::string m_temporaryFilename;
+    TrackingRecorder * m_recorder;
+    QTemporaryFile * m_temporaryFile;  // recording that has not been saved yet
     QElapsedTimer m_elapsedTimer;
     qint64 m_cummulativeTime;
 
@@ -0,0 +1,207 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "trackingrecorder.h"
+
+#include <vtkMatrix4x4.h>
+#include <vtkTransform.h>
+
+#include <QStringList>
+#include <cstring>
+
+#include "scenemanager.h"
+
+// About 10 s of samples of 20 tools tracked at 300 Hz
+static const unsigned SampleRingCapacity = 1 << 16;
+static const size_t WriteBatchSize       = 1024;
+static const int WriterPollInterval      = 20;  // ms
+
+TrackingRecorder::TrackingRecorder( QObject * parent ) : QThread( parent ), m_samples( SampleRingCapacity )
+{
+    m_droppedSamplesAtStart = 0;
+    m_nextSequenceNumber    = 0;
+    m_recording             = false;
+    m_stop                  = false;
+    m_fileOk                = false;
+}
+
+TrackingRecorder::~TrackingRecorder() { Stop(); }
+
+bool TrackingRecorder::Start( QString filename, const std::vector<TrackedSceneObject *> & tools )
+{
+    Stop();
+
+    QStringList toolNames;
+    for( size_t i = 0; i < tools.size(); ++i ) toolNames.append( tools[i]->GetName() );
+    m_file.setFileName( filename );
+    if( !m_file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) return false;
+    if( !TrackingRecording::WriteHeader( m_file, toolNames ) )
+    {
+        m_file.close();
+        return false;
+    }
+
+    m_tools.clear();
+    for( size_t i = 0; i < tools.size(); ++i )
+    {
+        Tool tool;
+        tool.object              = tools[i];
+        tool.deliversPoseSamples = false;
+        m_tools.push_back( tool );
+    }
+    m_samples.Clear();
+    m_droppedSamplesAtStart = m_samples.GetNumberOfDroppedItems();
+    m_nextSequenceNumber    = 0;
+    m_fileOk                = true;
+    m_clock.start();
+    start();
+
+    Resume();
+    return true;
+}
+
+void TrackingRecorder::Pause()
+{
+    ListenToTools( false );
+    m_recording = false;
+}
+
+void TrackingRecorder::Resume()
+{
+    if( !isRunning() ) return;
+    ListenToTools( true );
+    m_recording = true;
+}
+
+void TrackingRecorder::Stop()
+{
+    Pause();
+    if( isRunning() )
+    {
+        m_stop = true;
+        wait();
+        m_stop = false;
+    }
+    if( m_file.isOpen() ) m_file.close();
+    m_tools.clear();
+}
+
+void TrackingRecorder::RemoveTool( int objectId )
+{
+    for( size_t i = 0; i < m_tools.size(); ++i )
+    {
+        if( m_tools[i].object && m_tools[i].object->GetObjectID() == objectId )
+        {
+            m_tools[i].object->RemovePoseSampleListener( this );
+            m_tools[i].object = nullptr;
+        }
+    }
+}
+
+void TrackingRecorder::ListenToTools( bool listen )
+{
+    for( size_t i = 0; i < m_tools.size(); ++i )
+    {
+        if( !m_tools[i].object ) continue;
+        if( listen )
+            m_tools[i].object->AddPoseSampleListener( this );
+        else
+            m_tools[i].object->RemovePoseSampleListener( this );
+    }
+}
+
+void TrackingRecorder::SampleTools()
+{
+    if( !m_recording ) return;
+
+    // Read the world matrices of all the sampled tools at once, their shared ancestors are only updated once
+    m_sampledObjects.clear();
+    m_sampledToolIndices.clear();
+    SceneManager * manager = nullptr;
+    for( size_t i = 0; i < m_tools.size(); ++i )
+    {
+        TrackedSceneObject * obj = m_tools[i].object;
+        if( !obj || m_tools[i].deliversPoseSamples || !obj->GetManager() ) continue;
+        manager = obj->GetManager();
+        m_sampledObjects.append( obj );
+        m_sampledToolIndices.push_back( int( i ) );
+    }
+    if( !manager ) return;
+    manager->GetWorldMatrices( m_sampledObjects, m_sampledMatrices );
+
+    for( int i = 0; i < m_sampledObjects.size(); ++i )
+    {
+        TrackedSceneObject * obj = m_tools[m_sampledToolIndices[i]].object;
+        PushSample( m_sampledToolIndices[i], &m_sampledMatrices[16 * i], obj->GetLastTimestamp(), obj->GetState() );
+    }
+}
+
+void TrackingRecorder::PoseSampleAdded( TrackedSceneObject * obj, vtkMatrix4x4 * inputMatrix, double timestamp,
+                                        TrackerToolState state )
+{
+    for( size_t i = 0; i < m_tools.size(); ++i )
+    {
+        if( m_tools[i].object != obj ) continue;
+        m_tools[i].deliversPoseSamples = true;
+
+        // World matrix the object will have once the sample is its input matrix
+        double calibrated[16];
+        double world[16];
+        vtkMatrix4x4::Multiply4x4( &inputMatrix->Element[0][0], &obj->GetCalibrationMatrix()->Element[0][0],
+                                   calibrated );
+        if( obj->GetParent() )
+            vtkMatrix4x4::Multiply4x4( &obj->GetParent()->GetWorldMatrix()->Element[0][0], calibrated, world );
+        else
+            memcpy( world, calibrated, sizeof( world ) );
+        PushSample( int( i ), world, timestamp, state );
+    }
+}
+
+void TrackingRecorder::PushSample( int toolIndex, const double worldMatrix[16], double timestamp,
+                                   TrackerToolState state )
+{
+    TrackingSample sample;
+    sample.sequenceNumber = m_nextSequenceNumber++;
+    sample.timestamp      = timestamp;
+    sample.systemTime     = m_clock.nsecsElapsed() * 1e-9;
+    memcpy( sample.matrix, worldMatrix, sizeof( sample.matrix ) );
+    sample.toolIndex = toolIndex;
+    sample.state     = state;
+    m_samples.Push( sample );
+}
+
+void TrackingRecorder::run()
+{
+    std::vector<TrackingSample> samples;
+    samples.reserve( WriteBatchSize );
+    bool stop = false;
+    while( !stop )
+    {
+        // Read before emptying the ring, so that the samples pushed before Stop() are written
+        stop = m_stop;
+        TrackingSample sample;
+        while( m_samples.Pop( sample ) )
+        {
+            samples.push_back( sample );
+            if( samples.size() == WriteBatchSize ) WriteSamples( samples );
+        }
+        WriteSamples( samples );
+        if( m_fileOk ) m_fileOk = m_file.flush();
+        if( !stop ) msleep( WriterPollInterval );
+    }
+}
+
+void TrackingRecorder::WriteSamples( std::vector<TrackingSample> & samples )
+{
+    qint64 size = qint64( samples.size() * sizeof( TrackingSample ) );
+    if( size > 0 && m_fileOk )
+        m_fileOk = m_file.write( reinterpret_cast<const char *>( samples.data() ), size ) == size;
+    samples.clear();
+}
@@ -0,0 +1,99 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef TRACKINGRECORDER_H
+#define TRACKINGRECORDER_H
+
+#include <vtkSmartPointer.h>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QThread>
+#include <atomic>
+#include <vector>
+
+#include "spscring.h"
+#include "trackedsceneobject.h"
+#include "trackingrecording.h"
+
+/**
+ * @class   TrackingRecorder
+ * @brief   Record the poses of tracked tools in a binary tracking recording
+ *
+ * The recorder listens to the pose samples of the tools, so it gets every sample delivered by the hardware module,
+ * including the ones received between clock ticks. On the GUI thread, it only computes the world matrix of the sample
+ * and pushes it to a lock-free ring. The writer thread empties the ring and writes the samples to the file. If the
+ * writer falls behind and the ring fills up, samples are dropped and counted, their sequence numbers are skipped.
+ *
+ * Tools whose hardware module doesn't deliver pose samples are recorded by SampleTools(), once per clock tick.
+ *
+ * @sa TrackingRecording SPSCRing
+ */
+class TrackingRecorder : public QThread, public PoseSampleListener
+{
+    Q_OBJECT
+
+public:
+    TrackingRecorder( QObject * parent = nullptr );
+    ~TrackingRecorder();
+
+    // Start a new recording of tools in filename. Samples are recorded until Pause() or Stop() is called.
+    bool Start( QString filename, const std::vector<TrackedSceneObject *> & tools );
+    void Pause();
+    void Resume();
+    // Write the remaining samples and close the file
+    void Stop();
+    bool IsRecording() { return m_recording; }
+    // Stop recording a tool, e.g. when it is removed from the scene
+    void RemoveTool( int objectId );
+
+    // Record the current pose of the tools that don't deliver pose samples, called on every clock tick
+    void SampleTools();
+
+    quint64 GetNumberOfSamples() { return m_nextSequenceNumber - GetNumberOfDroppedSamples(); }
+    quint64 GetNumberOfDroppedSamples() { return m_samples.GetNumberOfDroppedItems() - m_droppedSamplesAtStart; }
+    // False if the writer thread could not write to the file
+    bool IsFileOk() { return m_fileOk; }
+
+    void PoseSampleAdded( TrackedSceneObject * obj, vtkMatrix4x4 * inputMatrix, double timestamp,
+                          TrackerToolState state ) override;
+
+protected:
+    void run() override;
+    void ListenToTools( bool listen );
+    void PushSample( int toolIndex, const double worldMatrix[16], double timestamp, TrackerToolState state );
+    void WriteSamples( std::vector<TrackingSample> & samples );
+
+    struct Tool
+    {
+        vtkSmartPointer<TrackedSceneObject> object;  // null once the tool is removed
+        bool deliversPoseSamples;
+    };
+    std::vector<Tool> m_tools;
+
+    // Tools read by SampleTools(), kept to avoid allocating on every clock tick
+    QList<SceneObject *> m_sampledObjects;
+    std::vector<int> m_sampledToolIndices;
+    std::vector<double> m_sampledMatrices;
+
+    SPSCRing<TrackingSample> m_samples;
+    unsigned m_droppedSamplesAtStart;
+    quint64 m_nextSequenceNumber;
+    QElapsedTimer m_clock;
+    bool m_recording;
+
+    // Only accessed by the writer thread while it runs
+    QFile m_file;
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_fileOk;
+};
+
+#endif
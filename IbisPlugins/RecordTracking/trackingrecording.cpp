@@ -0,0 +1,238 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "trackingrecording.h"
+
+#include <vtkMatrix4x4.h>
+
+#include <QByteArray>
+#include <algorithm>
+#include <cstring>
+
+#include "ibistypes.h"
+#include "sequencefile.h"
+
+static const char RecordingMagic[8]  = { 'I', 'B', 'I', 'S', 'T', 'R', 'K', 'S' };
+static const qint32 RecordingVersion = 1;
+static const int SamplesPerRead      = 4096;
+static const int WriteBufferSize     = 1 << 20;
+
+struct RecordingHeader
+{
+    char magic[8];
+    qint32 version;
+    qint32 numberOfTools;
+};
+
+static void AppendMatrix( QByteArray & buffer, const double matrix[16], char separator )
+{
+    for( int i = 0; i < 16; ++i )
+    {
+        if( i > 0 ) buffer.append( separator );
+        buffer.append( SequenceFile::FormatNumber( matrix[i] ) );
+    }
+}
+
+static bool Flush( QFile & file, QByteArray & buffer )
+{
+    bool ok = file.write( buffer ) == qint64( buffer.size() );
+    buffer.resize( 0 );
+    return ok;
+}
+
+bool TrackingRecording::WriteHeader( QFile & file, const QStringList & toolNames )
+{
+    RecordingHeader header;
+    memcpy( header.magic, RecordingMagic, sizeof( RecordingMagic ) );
+    header.version       = RecordingVersion;
+    header.numberOfTools = toolNames.size();
+    QByteArray data( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+    for( int i = 0; i < toolNames.size(); ++i )
+    {
+        QByteArray name   = toolNames[i].toUtf8();
+        qint32 nameLength = name.size();
+        data.append( reinterpret_cast<const char *>( &nameLength ), sizeof( nameLength ) );
+        data.append( name );
+    }
+    return file.write( data ) == qint64( data.size() );
+}
+
+bool TrackingRecording::Open( QString filename )
+{
+    Close();
+    m_file.setFileName( filename );
+    if( !m_file.open( QIODevice::ReadOnly ) ) return false;
+
+    RecordingHeader header;
+    bool ok = m_file.read( reinterpret_cast<char *>( &header ), sizeof( header ) ) == qint64( sizeof( header ) ) &&
+              memcmp( header.magic, RecordingMagic, sizeof( RecordingMagic ) ) == 0 &&
+              header.version == RecordingVersion && header.numberOfTools >= 0;
+    for( int i = 0; ok && i < header.numberOfTools; ++i )
+    {
+        qint32 nameLength = 0;
+        ok = m_file.read( reinterpret_cast<char *>( &nameLength ), sizeof( nameLength ) ) == sizeof( nameLength ) &&
+             nameLength >= 0 && nameLength <= m_file.size();
+        QByteArray name = ok ? m_file.read( nameLength ) : QByteArray();
+        ok              = ok && name.size() == nameLength;
+        m_toolNames.append( QString::fromUtf8( name ) );
+    }
+    m_samplesOffset = m_file.pos();
+    if( !ok ) Close();
+    return ok;
+}
+
+void TrackingRecording::Close()
+{
+    m_file.close();
+    m_toolNames.clear();
+    m_samplesOffset = 0;
+}
+
+qint64 TrackingRecording::GetNumberOfSamples()
+{
+    if( !m_file.isOpen() ) return 0;
+    return ( m_file.size() - m_samplesOffset ) / qint64( sizeof( TrackingSample ) );
+}
+
+// Next samples of the file, an incomplete last sample is ignored. Returns false at the end of the file.
+bool TrackingRecording::ReadSamples( std::vector<TrackingSample> & samples )
+{
+    samples.resize( SamplesPerRead );
+    qint64 size = m_file.read( reinterpret_cast<char *>( samples.data() ), SamplesPerRead * sizeof( TrackingSample ) );
+    samples.resize( size_t( std::max( size, qint64( 0 ) ) / sizeof( TrackingSample ) ) );
+    return !samples.empty();
+}
+
+bool TrackingRecording::ExportSequence( QString filename )
+{
+    SequenceFile file;
+    m_errorMessage.clear();
+    if( !m_file.isOpen() || !m_file.seek( m_samplesOffset ) ) return false;
+
+    // The sequence could not be read back with more frames
+    qint64 nbFrames = GetNumberOfSamples();
+    if( nbFrames > SequenceFile::MaxNumberOfFrames )
+    {
+        m_errorMessage = QString( "The recording has %1 samples, a tracking sequence can have at most %2 frames. "
+                                  "Save it as CSV or as a tracking recording instead." )
+                             .arg( nbFrames )
+                             .arg( SequenceFile::MaxNumberOfFrames );
+        return false;
+    }
+    if( !file.Create( filename ) ) return false;
+
+    // Every frame is a 1x1 black image, the poses are in the frame fields
+    file.WriteField( "ObjectType", "Image" );
+    file.WriteField( "NDims", "3" );
+    file.WriteField( "AnatomicalOrientation", "RAS" );
+    file.WriteField( "BinaryData", "True" );
+    file.WriteField( "BinaryDataByteOrderMSB", "False" );
+    file.WriteField( "CenterOfRotation", "0 0 0" );
+    file.WriteField( "CompressedData", "False" );
+    file.WriteField( "DimSize", "1 1 " + QByteArray::number( nbFrames ) );
+    file.WriteField( "Kinds", "domain domain list" );
+    file.WriteField( "ElementSpacing", "1 1 1" );
+    file.WriteField( "ElementType", "MET_UCHAR" );
+    file.WriteField( "Offset", "0 0 0" );
+    file.WriteField( "TransformMatrix", "1 0 0 0 1 0 0 0 1" );
+    file.WriteField( "UltrasoundImageOrientation", "UNA" );
+
+    // The names of the tool fields are formatted once, tools have no pose until their first sample
+    std::vector<QByteArray> transformFields;
+    std::vector<QByteArray> statusFields;
+    std::vector<TrackingSample> lastSamples( size_t( m_toolNames.size() ) );
+    for( int i = 0; i < m_toolNames.size(); ++i )
+    {
+        transformFields.push_back( m_toolNames[i].toUtf8() + "ToReferenceTransform" );
+        statusFields.push_back( m_toolNames[i].toUtf8() + "ToReferenceTransformStatus" );
+        vtkMatrix4x4::Identity( lastSamples[i].matrix );
+        lastSamples[i].state = Missing;
+    }
+
+    // Every sample is a frame, a sample of an unknown tool repeats the poses of the previous frame
+    qint64 frame = 0;
+    std::vector<TrackingSample> samples;
+    while( frame < nbFrames && ReadSamples( samples ) )
+    {
+        for( size_t s = 0; s < samples.size() && frame < nbFrames; ++s )
+        {
+            const TrackingSample & sample = samples[s];
+            if( sample.toolIndex >= 0 && sample.toolIndex < m_toolNames.size() ) lastSamples[sample.toolIndex] = sample;
+
+            file.BeginFrame( int( frame ) );  // nbFrames is at most MaxNumberOfFrames
+            file.WriteFrameField( "FrameNumber", QByteArray::number( frame ).rightJustified( 10, '0' ) );
+            for( size_t t = 0; t < lastSamples.size(); ++t )
+            {
+                file.WriteFrameField( transformFields[t].constData(), lastSamples[t].matrix );
+                file.WriteFrameField( statusFields[t].constData(), lastSamples[t].state == Ok ? "OK" : "INVALID" );
+            }
+            QByteArray timestamp = QByteArray::number( sample.timestamp, 'f', 6 );
+            file.WriteFrameField( "Timestamp", timestamp );
+            file.WriteFrameField( "UnfilteredTimestamp", timestamp );
+            ++frame;
+        }
+    }
+
+    // DimSize must match the frames that were written, the recording may have been truncated since it was opened
+    if( frame != nbFrames )
+    {
+        file.Cancel();
+        return false;
+    }
+    file.WriteField( "ElementDataFile", "LOCAL" );
+    std::vector<char> pixels( size_t( std::min( nbFrames, qint64( WriteBufferSize ) ) ), 0 );
+    for( qint64 written = 0; written < nbFrames; written += qint64( pixels.size() ) )
+        file.WriteData( pixels.data(), std::min( nbFrames - written, qint64( pixels.size() ) ) );
+    return file.Finish();
+}
+
+bool TrackingRecording::ExportCSV( QString filename )
+{
+    QFile file( filename );
+    if( !m_file.isOpen() || !m_file.seek( m_samplesOffset ) ) return false;
+    if( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) return false;
+
+    QByteArray buffer;
+    buffer.reserve( WriteBufferSize );
+    buffer.append( "sequence,tool,status,timestamp,system_time" );
+    for( int i = 0; i < 16; ++i ) buffer.append( ",m" + QByteArray::number( i / 4 ) + QByteArray::number( i % 4 ) );
+    buffer.append( '\n' );
+
+    // Tool names are quoted, quotes in names are doubled
+    std::vector<QByteArray> toolNames;
+    for( int i = 0; i < m_toolNames.size(); ++i )
+        toolNames.push_back( "\"" + m_toolNames[i].toUtf8().replace( "\"", "\"\"" ) + "\"" );
+
+    bool ok = true;
+    std::vector<TrackingSample> samples;
+    while( ok && ReadSamples( samples ) )
+    {
+        for( size_t s = 0; s < samples.size(); ++s )
+        {
+            const TrackingSample & sample = samples[s];
+            if( sample.toolIndex < 0 || sample.toolIndex >= m_toolNames.size() ) continue;
+            buffer.append( QByteArray::number( sample.sequenceNumber ) );
+            buffer.append( ',' );
+            buffer.append( toolNames[sample.toolIndex] );
+            buffer.append( sample.state == Ok ? ",OK," : ",INVALID," );
+            buffer.append( QByteArray::number( sample.timestamp, 'f', 6 ) );
+            buffer.append( ',' );
+            buffer.append( QByteArray::number( sample.systemTime, 'f', 6 ) );
+            buffer.append( ',' );
+            AppendMatrix( buffer, sample.matrix, ',' );
+            buffer.append( '\n' );
+            if( buffer.size() >= WriteBufferSize ) ok = Flush( file, buffer );
+        }
+    }
+    ok = ok && Flush( file, buffer );
+    file.close();
+    if( !ok ) file.remove();
+    return ok;
+}
@@ -0,0 +1,63 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef TRACKINGRECORDING_H
+#define TRACKINGRECORDING_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+// Pose of a tool, as stored in a binary tracking recording
+struct TrackingSample
+{
+    quint64 sequenceNumber;  // order in which the samples of all tools were received, from 0
+    double timestamp;        // tracker time, -1 if unknown
+    double systemTime;       // s since the start of the recording
+    double matrix[16];       // world matrix, row major
+    qint32 toolIndex;
+    qint32 state;  // TrackerToolState
+};
+
+// Binary tracking recording: a header with the names of the tools followed by the samples, in the order they were
+// received. The number of samples is not stored, a recording that was interrupted can still be read.
+//
+// TrackingRecording reads a recording and exports it to the Seq_Frame text format of tracking sequences (.mha) or to
+// CSV. In a sequence, every sample is a frame that has the last pose of every tool.
+class TrackingRecording
+{
+public:
+    static const char * GetFileSuffix() { return "ibistrk"; }
+    static bool WriteHeader( QFile & file, const QStringList & toolNames );
+
+    TrackingRecording() : m_samplesOffset( 0 ) {}
+
+    bool Open( QString filename );
+    void Close();
+    QStringList GetToolNames() { return m_toolNames; }
+    qint64 GetNumberOfSamples();
+
+    // Sequences of more than SequenceFile::MaxNumberOfFrames samples are refused, they could not be read back
+    bool ExportSequence( QString filename );
+    bool ExportCSV( QString filename );
+    // Reason of the last export failure, empty if there is none to give
+    QString GetErrorMessage() { return m_errorMessage; }
+
+private:
+    bool ReadSamples( std::vector<TrackingSample> & samples );
+
+    QFile m_file;
+    QStringList m_toolNames;
+    qint64 m_samplesOffset;
+    QString m_errorMessage;
+};
+
+#endif
@@ -7,14 +7,16 @@
 #include <itkSmartPointer.h>
 #include <vtkDataArray.h>
 #include <vtkImageData.h>
-#include <vtkImageReslice.h>
 #include <vtkPassThrough.h>
+#include <vtkPointData.h>
 #include <vtkSmartPointer.h>
+#include <vtkUnsignedCharArray.h>
 
 #include <QApplication>
 #include <QCheckBox>
 #include <QFile>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QLabel>
 #include <QMessageBox>
 #include <QProgressDialog>
@@ -22,13 +24,12 @@
 #include <QWidgetItem>
 #include <chrono>
 #include <cstdio>
-#include <fstream>
-#include <iomanip>
 #include <sstream>
 #include <typeinfo>
 
 #include "ibisapi.h"
 #include "scenemanager.h"
+#include "sequencefile.h"
 #include "sequenceioplugininterface.h"
 #include "ui_sequenceiowidget.h"
 #include "usacquisitionobject.h"
@@ -41,6 +42,7 @@ SequenceIOWidget::SequenceIOWidget( QWidget * parent )
       m_progressBar( nullptr )
 {
     m_acquisitionProperties = new AcqProperties;
+    m_sequenceFile          = new SequenceFile;
     m_outputFilename        = "";
     ui->setupUi( this );
     setWindowTitle( "Export Ultrasound Sequence" );
@@ -55,7 +57,7 @@ SequenceIOWidget::SequenceIOWidget( QWidget * parent )
 
 SequenceIOWidget::~SequenceIOWidget()
 {
-    if( m_recordfile.is_open() ) m_recordfile.close();
+    delete m_sequenceFile;
     delete ui;
 }
 
@@ -68,196 +70,151 @@ void SequenceIOWidget::SetPluginInterface( SequenceIOPluginInterface * interf )
 template <typename ImageType>
 void SequenceIOWidget::WriteAcquisition( USAcquisitionObject * usAcquisitionObject, itk::SmartPointer<ImageType> image )
 {
-    m_recordfile.open( m_outputFilename.toUtf8().constData(), std::ios::out | std::ios::binary );
-    if( m_recordfile )
+    SequenceFile file;
+    if( !file.Create( m_outputFilename ) ) return;
+
+    int frameCount     = usAcquisitionObject->GetNumberOfSlices();
+    int nbComponents   = int( sizeof( typename ImageType::PixelType ) );
+    QByteArray dimSize = QByteArray::number( usAcquisitionObject->GetSliceWidth() ) + " " +
+                         QByteArray::number( usAcquisitionObject->GetSliceHeight() ) + " " +
+                         QByteArray::number( frameCount );
+
+    file.WriteField( "ObjectType", "Image" );
+    file.WriteField( "NDims", "3" );
+    file.WriteField( "AnatomicalOrientation", "RAS" );
+    file.WriteField( "BinaryData", "True" );
+    file.WriteField( "BinaryDataByteOrderMSB", "False" );
+    file.WriteField( "CenterOfRotation", "0 0 0" );
+    // TODO: add write compressed files
+    file.WriteField( "CompressedData", "False" );
+    file.WriteField( "DimSize", dimSize );
+    file.WriteField( "Kinds", "domain domain list" );
+    file.WriteField( "ElementSpacing", "1 1 1" );
+    if( nbComponents > 1 ) file.WriteField( "ElementNumberOfChannels", QByteArray::number( nbComponents ) );
+    file.WriteField( "ElementType", "MET_UCHAR" );
+    file.WriteField( "Offset", "0 0 0" );
+    file.WriteField( "TransformMatrix", "1 0 0 0 1 0 0 0 1" );
+    QString imageOrientation;
+    imageOrientation =
+        ui->ultrasoundImageOrientationComboBox->itemData( ui->ultrasoundImageOrientationComboBox->currentIndex() )
+            .toString();
+    file.WriteField( "UltrasoundImageOrientation", imageOrientation.toUtf8() );
+    // TODO: write RGB images
+    file.WriteField( "UltrasoundImageType", "BRIGHTNESS" );
+
+    vtkSmartPointer<vtkTransform> calibrationTransform = usAcquisitionObject->GetCalibrationTransform();
+    double cal[4][4];
+    this->GetMatrixFromTransform( cal, calibrationTransform );
+    file.WriteField( "CalibrationTransform", &cal[0][0] );
+
+    // The timestamp of the first frame is used as a baseline
+    // this value is stored in `TimestampBaseline`. This is not required, but avoids sone variable overflow
+    double timestampBaseline = 0.0;
+    timestampBaseline        = usAcquisitionObject->GetFrameTimestamp( 0 );
+    file.WriteField( "TimestampBaseline", QByteArray::number( timestampBaseline, 'f' ) );
+
+    image          = ImageType::New();
+    bool cancelled = false;
+
+    for( int i = 0; i < frameCount && !cancelled; i++ )
     {
-        int frameCount = usAcquisitionObject->GetNumberOfSlices();
-
-        m_recordfile << "ObjectType = Image" << std::endl;
-        m_recordfile << "NDims = 3" << std::endl;
-        m_recordfile << "AnatomicalOrientation = RAS" << std::endl;
-        m_recordfile << "BinaryData = True" << std::endl;
-        m_recordfile << "BinaryDataByteOrderMSB = False" << std::endl;
-        m_recordfile << "CenterOfRotation = 0 0 0" << std::endl;
-        // TODO: add write compressed files
-        m_recordfile << "CompressedData = False" << std::endl;
-        m_recordfile << "DimSize = " << usAcquisitionObject->GetSliceWidth() << " "
-                     << usAcquisitionObject->GetSliceHeight() << " " << frameCount << std::endl;
-        m_recordfile << "Kinds = domain domain list" << std::endl;
-        m_recordfile << "ElementSpacing = 1 1 1" << std::endl;
-        m_recordfile << "ElementType = MET_UCHAR" << std::endl;
-        m_recordfile << "Offset = 0 0 0" << std::endl;
-        m_recordfile << "TransformMatrix = 1 0 0 0 1 0 0 0 1" << std::endl;
-        QString imageOrientation;
-        imageOrientation =
-            ui->ultrasoundImageOrientationComboBox->itemData( ui->ultrasoundImageOrientationComboBox->currentIndex() )
-                .toString();
-        m_recordfile << "UltrasoundImageOrientation = " << imageOrientation.toUtf8().constData() << std::endl;
-        // TODO: write RGB images
-        m_recordfile << "UltrasoundImageType = BRIGHTNESS" << std::endl;
-
-        vtkSmartPointer<vtkTransform> calibrationTransform = usAcquisitionObject->GetCalibrationTransform();
-        double cal[4][4];
-        this->GetMatrixFromTransform( cal, calibrationTransform );
-        std::string strcal = this->GetStringFromMatrix( cal );
-        m_recordfile << "CalibrationTransform = " << strcal << std::endl;
-
-        // The timestamp of the first frame is used as a baseline
-        // this value is stored in `TimestampBaseline`. This is not required, but avoids sone variable overflow
-        double timestampBaseline = 0.0;
-        timestampBaseline        = usAcquisitionObject->GetFrameTimestamp( 0 );
-        m_recordfile << "TimestampBaseline = " << QString::number( timestampBaseline, 'f' ).toUtf8().constData()
-                     << std::endl;
-
-        image = ImageType::New();
-
-        for( int i = 0; i < frameCount; i++ )
-        {
-            this->GetImage( usAcquisitionObject, image, i );
+        this->GetImage( usAcquisitionObject, image, i );
 
-            double uncalmat[4][4], calmat[4][4];
-            this->GetMatrixFromImage( uncalmat, image );
-            this->MultiplyMatrix( calmat, uncalmat, cal );
+        double uncalmat[4][4], calmat[4][4];
+        this->GetMatrixFromImage( uncalmat, image );
+        this->MultiplyMatrix( calmat, uncalmat, cal );
 
-            double timestamp = usAcquisitionObject->GetFrameTimestamp( i );
-            if( timestamp > 0 )
-            {
-                timestamp = timestamp - timestampBaseline;
-            }
-            else
-            {
-                timestamp = (double)i;
-            }
-
-            std::stringstream ss;
-            ss << std::setw( 10 ) << std::setfill( '0' ) << i;
-            std::string strFrameId = ss.str();
-            m_recordfile << "Seq_Frame" + strFrameId + "_FrameNumber = " + strFrameId << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_ImageToProbeTransform = " << strcal << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_ImageToProbeTransformStatus = OK" << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_ProbeToReferenceTransform = "
-                         << this->GetStringFromMatrix( uncalmat ) << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_ProbeToReferenceTransformStatus = OK" << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_ImageToReferenceTransform = "
-                         << this->GetStringFromMatrix( calmat ) << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_ImageToReferenceTransformStatus = OK" << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_ImageStatus = OK" << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_Timestamp = " << timestamp << std::endl;
-            m_recordfile << "Seq_Frame" + strFrameId + "_UnfilteredTimestamp = " << timestamp << std::endl;
-
-            emit exportProgressUpdated( i );
+        double timestamp = usAcquisitionObject->GetFrameTimestamp( i );
+        if( timestamp > 0 )
+        {
+            timestamp = timestamp - timestampBaseline;
         }
-
-        m_recordfile << "ElementDataFile = LOCAL" << std::endl;
-
-        for( int i = 0; i < frameCount; i++ )
+        else
         {
-            this->GetImage( usAcquisitionObject, image, i );
-            typename ImageType::PixelType * pPixel = image->GetBufferPointer();
-            typename ImageType::SizeType size      = image->GetLargestPossibleRegion().GetSize();
-            m_recordfile.write( (char *)&pPixel[0],
-                                sizeof( typename ImageType::PixelType ) * size[0] * size[1] * size[2] );
-
-            emit exportProgressUpdated( i + frameCount );
+            timestamp = (double)i;
         }
+        QByteArray strTimestamp = SequenceFile::FormatNumber( timestamp );
+
+        file.BeginFrame( i );
+        file.WriteFrameField( "FrameNumber", QByteArray::number( i ).rightJustified( 10, '0' ) );
+        file.WriteFrameField( "ImageToProbeTransform", &cal[0][0] );
+        file.WriteFrameField( "ImageToProbeTransformStatus", "OK" );
+        file.WriteFrameField( "ProbeToReferenceTransform", &uncalmat[0][0] );
+        file.WriteFrameField( "ProbeToReferenceTransformStatus", "OK" );
+        file.WriteFrameField( "ImageToReferenceTransform", &calmat[0][0] );
+        file.WriteFrameField( "ImageToReferenceTransformStatus", "OK" );
+        file.WriteFrameField( "ImageStatus", "OK" );
+        file.WriteFrameField( "Timestamp", strTimestamp );
+        file.WriteFrameField( "UnfilteredTimestamp", strTimestamp );
+
+        emit exportProgressUpdated( i );
+        cancelled = m_progressBar && m_progressBar->wasCanceled();
+    }
+
+    file.WriteField( "ElementDataFile", "LOCAL" );
 
-        m_recordfile.close();
+    for( int i = 0; i < frameCount && !cancelled; i++ )
+    {
+        this->GetImage( usAcquisitionObject, image, i );
+        typename ImageType::PixelType * pPixel = image->GetBufferPointer();
+        typename ImageType::SizeType size      = image->GetLargestPossibleRegion().GetSize();
+        file.WriteData( &pPixel[0], sizeof( typename ImageType::PixelType ) * size[0] * size[1] * size[2] );
+
+        emit exportProgressUpdated( i + frameCount );
+        cancelled = m_progressBar && m_progressBar->wasCanceled();
     }
+
+    // The file is only replaced if all the frames were written. Acquisitions mapped from the previous file keep it,
+    // but the parsed header is out of date, the new file is opened again when it is read.
+    if( cancelled )
+        file.Cancel();
+    else if( file.Finish() && QFileInfo( m_sequenceFile->GetFileName() ) == QFileInfo( m_outputFilename ) )
+        m_sequenceFile->Close();
 }
 
 bool SequenceIOWidget::ReadAcquisitionMetaData( QString filename, AcqProperties *& props )
 {
-    std::ifstream filereader( filename.toUtf8().constData(), std::ios::in | std::ios::binary );
-    if( filereader.is_open() )
-    {
-        std::string line;
-        while( std::getline( filereader, line ) )
-        {
-            QString qline( line.c_str() );
-            qline              = qline.trimmed();
-            QStringList tokens = qline.split( "=" );
-            if( tokens[0].trimmed().contains( "ObjectType" ) )
-            {
-                if( !tokens[1].trimmed().contains( "Image" ) ) return false;
-            }
-            else if( tokens[0].trimmed() == "CompressedData" )
-            {
-                if( tokens[1].trimmed().toLower() == "false" )
-                    props->compressed = false;
-                else
-                    props->compressed = true;
-            }
-            else if( tokens[0].trimmed() == "CompressedDataSize" )
-            {
-                props->compressedDataSize = tokens[1].trimmed().toInt();
-            }
-            else if( tokens[0].trimmed().contains( "DimSize" ) )
-            {
-                QStringList strdim        = tokens[1].trimmed().split( " " );
-                props->imageDimensions[0] = strdim[0].toInt();
-                props->imageDimensions[1] = strdim[1].toInt();
-                props->numberOfFrames     = strdim[2].toInt();
-                this->StartProgress( props->numberOfFrames, tr( "Reading Image MetaData" ) );
-            }
-            else if( tokens[0].trimmed() == tr( "UltrasoundImageOrientation" ) )
-            {
-                if( tokens[1].trimmed().contains( "U" ) ) props->flippedAxes[0] = true;
-                if( tokens[1].trimmed().contains( "N" ) ) props->flippedAxes[1] = true;
-            }
-            else if( tokens[0].trimmed().contains( "CalibrationTransform" ) )
-            {
-                QStringList strtransform = tokens[1].trimmed().split( " " );
-                int ii = 0, jj = 0;
-                for( int i = 0; i < 16; i++ )
-                {
-                    ii = i / 4;
-                    jj = i % 4;
-                    props->calibrationMatrix->SetElement( ii, jj, strtransform[i].toDouble() );
-                }
-                props->isCalibrationFound = true;
-            }
-            else if( tokens[0].trimmed().contains( "TimestampBaseline" ) )
-            {
-                props->timestampBaseline = tokens[1].trimmed().toDouble();
-            }
-            else if( tokens[0].trimmed().startsWith( "Seq_" ) )
-            {
-                // metadata starting with Seq_ are tracking information (i.e., frame id, frame transform, frame status,
-                // timestamp, etc.)
-
-                QStringList frameinfo = tokens[0].trimmed().split( "_" );
-                // update progress bar
-                if( frameinfo[2] == "FrameNumber" )
-                {
-                    this->UpdateProgress( tokens[1].toInt() );
-                }
-                // collect unique transform names for GUI display
-                else if( frameinfo[2].endsWith( "Transform" ) )
-                {
-                    // if new transform encountered add to dictionary
-                    if( !props->trackedTransformNames.contains( frameinfo[2].trimmed() ) )
-                        props->trackedTransformNames.append( frameinfo[2].trimmed() );
-                }
-            }
-            else if( tokens[0].trimmed().contains( "ElementDataFile" ) )
-            {
-                // end of metadata
-                props->elementDataFile = tokens[1].trimmed();
-                break;
-            }
-        }
-        filereader.close();
-        this->StopProgress();
-    }
+    // The header is parsed once, the frame fields of the selected transform are converted by ReadAcquisitionData()
+    if( !m_sequenceFile->Open( filename ) ) return false;
+
+    props->imageDimensions[0]    = m_sequenceFile->GetFrameWidth();
+    props->imageDimensions[1]    = m_sequenceFile->GetFrameHeight();
+    props->numberOfFrames        = m_sequenceFile->GetNumberOfFrames();
+    props->trackedTransformNames = m_sequenceFile->GetTransformNames();
+    props->isCalibrationFound    = m_sequenceFile->HasCalibrationMatrix();
+    m_sequenceFile->GetCalibrationMatrix( props->calibrationMatrix );
     return props->isValid();
 }
 
 USAcquisitionObject * SequenceIOWidget::ReadAcquisitionData( QString filename, AcqProperties * props )
 {
-    std::ifstream filereader( filename.toUtf8().constData(), std::ios::in | std::ios::binary );
-    if( !filereader.is_open() ) return nullptr;
+    if( ( !m_sequenceFile->IsOpen() || m_sequenceFile->GetFileName() != filename ) &&
+        !m_sequenceFile->Open( filename ) )
+        return nullptr;
+
+    // Every frame must have the probe transform, its status and a timestamp. Frames are only filtered on their
+    // image status.
+    bool checkImageStatus = ui->checkImageStatusCheckBox->isChecked();
+    std::vector<double> transforms;
+    std::vector<char> transformStatus;
+    std::vector<char> imageStatus;
+    std::vector<double> timestamps;
+    if( !m_sequenceFile->GetFrameMatrices( props->probeTransformName, transforms ) ||
+        !m_sequenceFile->GetFrameStatuses( props->probeTransformName + "Status", transformStatus ) ||
+        !m_sequenceFile->GetFrameValues( "Timestamp", timestamps ) ||
+        ( checkImageStatus && !m_sequenceFile->GetFrameStatuses( "ImageStatus", imageStatus ) ) )
+        return nullptr;
 
-    this->StartProgress( props->numberOfFrames, tr( "Reading Image Data..." ) );
+    std::vector<int> frames;
+    std::vector<double> frameTransforms;
+    std::vector<double> frameTimestamps;
+    for( int i = 0; i < m_sequenceFile->GetNumberOfFrames(); ++i )
+    {
+        if( checkImageStatus && !imageStatus[i] ) continue;
+        frames.push_back( i );
+        frameTransforms.insert( frameTransforms.end(), &transforms[i * 16], &transforms[i * 16] + 16 );
+        frameTimestamps.push_back( m_sequenceFile->GetTimestampBaseline() + timestamps[i] );
+    }
 
     USAcquisitionObject * usAcquisitionObject = USAcquisitionObject::New();
     QFileInfo fi( filename );
@@ -271,165 +228,46 @@ USAcquisitionObject * SequenceIOWidget::ReadAcquisitionData( QString filename, A
     usAcquisitionObject->SetName( tr( "Acquisition_" ) + fi.baseName() );
     usAcquisitionObject->SetCalibrationMatrix( props->calibrationMatrix );
     usAcquisitionObject->SetFrameAndMaskSize( props->imageDimensions[0], props->imageDimensions[1] );
+    if( frames.empty() ) return usAcquisitionObject;
 
-    // list of (transform, status) paris
-    vtkSmartPointer<vtkMatrix4x4> * transforms = new vtkSmartPointer<vtkMatrix4x4>[props->numberOfFrames];
-    bool * transformStatus                     = new bool[props->numberOfFrames];
-    bool * imageStatus                         = new bool[props->numberOfFrames];
-    double * timestamps                        = new double[props->numberOfFrames];
-
-    unsigned int transformCount       = 0;
-    unsigned int transformStatusCount = 0;
-    unsigned int imageStatusCount     = 0;
-    unsigned int timestampsCount      = 0;
-
-    unsigned int frameId = 0;
-
-    std::string line;
-    while( std::getline( filereader, line ) )
+    // Frames stored as they are displayed are mapped, they are read from the file when they are used
+    int format[4] = { m_sequenceFile->GetFrameWidth(), m_sequenceFile->GetFrameHeight(),
+                      m_sequenceFile->GetNumberOfComponents(), VTK_UNSIGNED_CHAR };
+    if( m_sequenceFile->CanUseFramesInPlace() )
     {
-        QString qline( line.c_str() );
-        qline              = qline.trimmed();
-        QStringList tokens = qline.split( "=" );
-
-        if( tokens[0].trimmed().startsWith( "Seq_" ) )
-        {
-            // metadata starting with Seq_ are tracking information (i.e., frame id, frame transform, frame status,
-            // timestamp, etc.)
-            QStringList frameinfo = tokens[0].trimmed().split( "_" );
-            std::string readableA = frameinfo[2].toUtf8().constData();
-            std::string readableB = props->probeTransformName.toUtf8().constData();
-
-            frameId = frameinfo[1].split( "Frame" ).at( 1 ).toInt();
-            if( frameinfo[2] == props->probeTransformName + tr( "Status" ) )
-            {
-                // set transform status: only consider OK status
-                transformStatus[frameId] = tokens[1].trimmed() == "OK";
-                transformStatusCount++;
-            }
-            else if( frameinfo[2] == props->probeTransformName )
-            {
-                QStringList strtransform = tokens[1].trimmed().split( " " );
-                transforms[frameId]      = vtkMatrix4x4::New();
-                int ii = 0, jj = 0;
-                for( int i = 0; i < 16; i++ )
-                {
-                    ii = i / 4;
-                    jj = i % 4;
-                    transforms[frameId]->SetElement( ii, jj, strtransform[i].toDouble() );
-                }
-                transformCount++;
-            }
-            else if( frameinfo[2] == "Timestamp" )
-            {
-                // set timestamp
-                timestamps[frameId] = tokens[1].trimmed().toDouble();
-                timestampsCount++;
-            }
-            else if( frameinfo[2] == "ImageStatus" )
-            {
-                // set transform status: only consider OK status
-                imageStatus[frameId] = tokens[1].trimmed() == "OK";
-                imageStatusCount++;
-            }
-        }
-        else if( tokens[0].trimmed().contains( "ElementDataFile" ) )
-        {
-            // end of metadata
-            break;
-        }
+        std::vector<qint64> frameOffsets;
+        for( unsigned i = 0; i < frames.size(); ++i )
+            frameOffsets.push_back( m_sequenceFile->GetFrameOffset( frames[i] ) );
+        if( usAcquisitionObject->MapFileFrames( filename, format, frameOffsets, frameTransforms, frameTimestamps ) )
+            return usAcquisitionObject;
     }
 
-    // check if number of frames is the same as frameId
-    if( ( props->numberOfFrames != frameId + 1 ) || ( props->numberOfFrames != transformCount ) ||
-        ( props->numberOfFrames != transformStatusCount ) ||
-        ( ( props->numberOfFrames != imageStatusCount ) && ( ui->checkImageStatusCheckBox->isChecked() ) ) ||
-        ( props->numberOfFrames != timestampsCount ) )
+    // Otherwise the frames are uncompressed and flipped in memory and copied to the acquisition
+    this->StartProgress( int( frames.size() ), tr( "Reading Image Data..." ) );
+    std::vector<unsigned char> allFramesPixelBuffer;
+    if( !m_sequenceFile->ReadFrames( allFramesPixelBuffer ) )
     {
         this->StopProgress();
-        filereader.close();
+        usAcquisitionObject->Delete();
         return nullptr;
     }
 
-    std::vector<unsigned char> allFramesPixelBuffer;
-    unsigned int frameSizeInBytes = props->imageDimensions[0] * props->imageDimensions[1] *
-                                    sizeof( vtkTypeUInt8 );  // * number of scalar components
-    unsigned int allFramesPixelBufferSize = props->numberOfFrames * frameSizeInBytes;
-    allFramesPixelBuffer.resize( allFramesPixelBufferSize );
-
-    if( props->compressed )
-    {
-        unsigned int allFramesCompressedPixelBufferSize = props->compressedDataSize;
-        std::vector<unsigned char> allFramesCompressedPixelBuffer;
-        allFramesCompressedPixelBuffer.resize( allFramesCompressedPixelBufferSize );
-
-        filereader.read( (char *)&allFramesCompressedPixelBuffer[0], allFramesCompressedPixelBufferSize );
-
-        uLongf unCompSize = allFramesPixelBufferSize;
-        if( uncompress( (Bytef *)&( allFramesPixelBuffer[0] ), &unCompSize,
-                        (const Bytef *)&( allFramesCompressedPixelBuffer[0] ),
-                        allFramesCompressedPixelBufferSize ) != Z_OK )
-        {
-            filereader.close();
-            this->StopProgress();
-            return nullptr;
-        }
-        if( unCompSize != allFramesPixelBufferSize )
-        {
-            filereader.close();
-            this->StopProgress();
-            return nullptr;
-        }
-    }
-    else
-    {
-        filereader.read( (char *)&allFramesPixelBuffer[0], allFramesPixelBufferSize );
-    }
-
-    for( unsigned int i = 0; i < props->numberOfFrames; i++ )
+    vtkSmartPointer<vtkUnsignedCharArray> pixels = vtkSmartPointer<vtkUnsignedCharArray>::New();
+    pixels->SetNumberOfComponents( format[2] );
+    vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+    image->SetDimensions( format[0], format[1], 1 );
+    image->GetPointData()->SetScalars( pixels );
+    vtkSmartPointer<vtkMatrix4x4> transform = vtkSmartPointer<vtkMatrix4x4>::New();
+    qint64 frameSize                        = m_sequenceFile->GetFrameSize();
+    for( unsigned i = 0; i < frames.size(); ++i )
     {
-        vtkImageData * image = vtkImageData::New();
-        image->SetDimensions( props->imageDimensions[0], props->imageDimensions[1], 1 );
-        image->SetExtent( 0, props->imageDimensions[0] - 1, 0, props->imageDimensions[1], 0, 0 );
-        image->AllocateScalars( VTK_UNSIGNED_CHAR, 1 );
-        unsigned char * pointer = static_cast<unsigned char *>( image->GetScalarPointer() );
-
-        memcpy( pointer, &allFramesPixelBuffer[0] + i * frameSizeInBytes, frameSizeInBytes );
-
-        if( ( props->flippedAxes[0] ) || ( props->flippedAxes[1] ) )
-        {
-            double center[3];
-            center[0] = 0.5 * ( props->imageDimensions[0] - 1 );
-            center[1] = 0.5 * ( props->imageDimensions[1] - 1 );
-            center[2] = 0.5;
-
-            vtkSmartPointer<vtkMatrix4x4> resliceAxes = vtkSmartPointer<vtkMatrix4x4>::New();
-            resliceAxes->Identity();
-            // Set flipped axes
-            resliceAxes->SetElement( 0, 0, props->flippedAxes[0] ? -1 : 1 );
-            resliceAxes->SetElement( 1, 1, props->flippedAxes[1] ? -1 : 1 );
-            // Set the point through which to slice
-            resliceAxes->SetElement( 0, 3, center[0] );
-            resliceAxes->SetElement( 1, 3, center[1] );
-            resliceAxes->SetElement( 2, 3, center[2] );
-
-            // Extract a slice in the desired orientation
-            vtkSmartPointer<vtkImageReslice> reslice = vtkSmartPointer<vtkImageReslice>::New();
-            reslice->SetInputData( image );
-            reslice->SetResliceAxes( resliceAxes );
-            reslice->SetInterpolationModeToNearestNeighbor();
-            reslice->Update();
-            image->DeepCopy( reslice->GetOutput() );
-        }
-
-        if( ( imageStatus[i] ) || ( !ui->checkImageStatusCheckBox->isChecked() ) )
-        {
-            usAcquisitionObject->AddFrame( image, transforms[i], props->timestampBaseline + timestamps[i] );
-        }
+        // the image is a view of the frame, AddFrame() copies it
+        pixels->SetVoidArray( &allFramesPixelBuffer[frames[i] * frameSize], frameSize, 1 );
+        transform->DeepCopy( &frameTransforms[i * 16] );
+        usAcquisitionObject->AddFrame( image, transform, frameTimestamps[i] );
         this->UpdateProgress( i );
     }
 
-    filereader.close();
     this->StopProgress();
     return usAcquisitionObject;
 }
@@ -462,7 +300,6 @@ void SequenceIOWidget::UpdateProgress( int i )
         qApp->processEvents();
         if( m_progressBar->wasCanceled() )
         {
-            m_recordfile.close();
             QMessageBox::information( 0, "Export Ultrasound Sequence", "Process cancelled", 1, 0 );
             return;
         }
@@ -767,19 +604,6 @@ void SequenceIOWidget::on_loadCalibrationTransformButton_clicked()
     }
 }
 
-std::string SequenceIOWidget::GetStringFromMatrix( double mat[4][4] )
-{
-    std::stringstream strTransform;
-    for( int i = 0; i < 4; ++i )
-    {
-        for( int j = 0; j < 4; ++j )
-        {
-            strTransform << mat[i][j] << " ";
-        }
-    }
-    return strTransform.str();
-}
-
 void SequenceIOWidget::AddAcquisition( int objectId )
 {
     Q_ASSERT( m_pluginInterface );
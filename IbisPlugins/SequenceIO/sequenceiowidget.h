@@ -8,15 +8,12 @@
 
 #include <QRadioButton>
 #include <QWidget>
-#include <fstream>
-#include <iostream>
-#include <sstream>
 #include <vector>
 
 #include "ibisitkvtkconverter.h"
 #include "trackedsceneobject.h"
-#include "vtk_zlib.h"
 
+class SequenceFile;
 class SequenceIOPluginInterface;
 class USAcquisitionObject;
 class QProgressDialog;
@@ -42,34 +39,23 @@ public:
     {
         QString probeTransformName;
         QStringList trackedTransformNames;
-        bool compressed;
-        unsigned int compressedDataSize;
         unsigned int imageDimensions[2];
         unsigned int numberOfFrames;
-        bool flippedAxes[2];
         vtkMatrix4x4 * calibrationMatrix;
         bool isCalibrationFound;
-        double timestampBaseline;
-        QString elementDataFile;
 
         AcqProperties()
         {
-            compressed         = false;
-            compressedDataSize = 0;
             imageDimensions[0] = 0;
             imageDimensions[1] = 0;
             numberOfFrames     = 0;
-            flippedAxes[0]     = false;
-            flippedAxes[1]     = false;
             calibrationMatrix  = vtkMatrix4x4::New();
             isCalibrationFound = false;
-            timestampBaseline  = 0;
         }
 
         bool isValid()
         {
-            return imageDimensions[0] && imageDimensions[1] && numberOfFrames && !trackedTransformNames.isEmpty() &&
-                   !elementDataFile.isEmpty();
+            return imageDimensions[0] && imageDimensions[1] && numberOfFrames && !trackedTransformNames.isEmpty();
         }
     };
 
@@ -79,7 +65,6 @@ private:
     bool ReadAcquisitionMetaData( QString, AcqProperties *& );
     USAcquisitionObject * ReadAcquisitionData( QString, AcqProperties * );
 
-    std::string GetStringFromMatrix( double mat[4][4] );
     template <typename ImageType>
     void GetMatrixFromImage( double ( &mat )[4][4], itk::SmartPointer<ImageType> );
     void GetMatrixFromTransform( double ( &mat )[4][4], vtkTransform * );
@@ -98,7 +83,7 @@ protected:
     Ui::SequenceIOWidget * ui;
     SequenceIOPluginInterface * m_pluginInterface;
 
-    std::ofstream m_recordfile;
+    SequenceFile * m_sequenceFile;  // sequence being imported, its header is parsed when it is opened
     QString m_outputFilename;
     QProgressDialog * m_progressBar;
     std::vector<QRadioButton *> m_transformNamesList;
@@ -0,0 +1,519 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#include "sequencefile.h"
+
+#include <vtkMatrix4x4.h>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QLocale>
+#include <QThreadPool>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "vtk_zlib.h"
+
+static const qint64 HeaderChunkSize = 1 << 20;
+static const int WriteBufferSize    = 1 << 20;
+static const char FramePrefix[]     = "Seq_Frame";
+
+const int SequenceFile::MaxNumberOfFrames;
+
+static bool IsBlank( char c ) { return c == ' ' || c == '\t' || c == '\r'; }
+
+// Parse up to nbValues space separated numbers, return the number of values parsed or -1 if one is not a number
+static int ParseNumbers( const QByteArray & value, double * values, int nbValues )
+{
+    const char * p   = value.constData();
+    const char * end = p + value.size();
+    int count        = 0;
+    while( count < nbValues )
+    {
+        while( p < end && IsBlank( *p ) ) ++p;
+        if( p == end ) break;
+        const char * number = p;
+        while( p < end && !IsBlank( *p ) ) ++p;
+        bool ok         = false;
+        values[count++] = QByteArray::fromRawData( number, int( p - number ) ).toDouble( &ok );
+        if( !ok ) return -1;
+    }
+    return count;
+}
+
+SequenceFile::SequenceFile()
+{
+    m_map               = nullptr;
+    m_header            = nullptr;
+    m_framePrefixLength = 0;
+    m_writeOk           = false;
+    Close();
+}
+
+SequenceFile::~SequenceFile() { Close(); }
+
+bool SequenceFile::Open( QString filename )
+{
+    Close();
+    m_file.setFileName( filename );
+    if( !m_file.open( QIODevice::ReadOnly ) ) return false;
+
+    // The whole file is mapped, the header is tokenized in place and the frames are paged in when they are used
+    m_map       = m_file.map( 0, m_file.size() );
+    bool ok     = false;
+    qint64 size = 0;
+    if( m_map )
+    {
+        m_header = reinterpret_cast<const char *>( m_map );
+        size     = m_file.size();
+        ok       = true;
+    }
+    else if( ReadHeader() )
+    {
+        m_header = m_headerBuffer.constData();
+        size     = m_headerBuffer.size();
+        ok       = true;
+    }
+    ok = ok && ParseHeader( size ) && m_dimensions[0] > 0 && m_dimensions[1] > 0 && m_dimensions[2] > 0 &&
+         m_numberOfComponents > 0;
+    if( !ok ) Close();
+    return ok;
+}
+
+void SequenceFile::Close()
+{
+    // Output that is not finished is discarded
+    if( m_saveFile.isOpen() ) Cancel();
+    if( m_map ) m_file.unmap( m_map );
+    m_file.close();
+    m_map    = nullptr;
+    m_header = nullptr;
+    m_headerBuffer.clear();
+    m_headerSize = 0;
+
+    for( int i = 0; i < 3; ++i ) m_dimensions[i] = 0;
+    m_numberOfComponents = 1;
+    m_spacing[0]         = 1.0;
+    m_spacing[1]         = 1.0;
+    m_compressed         = false;
+    m_compressedDataSize = 0;
+    m_flippedAxes[0]     = false;
+    m_flippedAxes[1]     = false;
+    vtkMatrix4x4::Identity( m_calibrationMatrix );
+    m_calibrationFound  = false;
+    m_timestampBaseline = 0.0;
+    m_localData         = false;
+    m_dataFileName.clear();
+    m_transformNames.clear();
+    m_frameFields.clear();
+    m_writeBuffer.clear();
+}
+
+qint64 SequenceFile::GetFrameSize() { return qint64( m_dimensions[0] ) * m_dimensions[1] * m_numberOfComponents; }
+
+void SequenceFile::GetCalibrationMatrix( vtkMatrix4x4 * mat ) { mat->DeepCopy( m_calibrationMatrix ); }
+
+// Read the file until the end of the ElementDataFile line, the last field of the header
+bool SequenceFile::ReadHeader()
+{
+    int searchFrom = 0;
+    while( !m_file.atEnd() )
+    {
+        QByteArray chunk = m_file.read( HeaderChunkSize );
+        if( chunk.isEmpty() ) return false;
+        m_headerBuffer.append( chunk );
+        int key = m_headerBuffer.indexOf( "ElementDataFile", searchFrom );
+        if( key >= 0 && m_headerBuffer.indexOf( '\n', key ) >= 0 ) return true;
+        searchFrom = key >= 0 ? key : std::max( 0, int( m_headerBuffer.size() ) - int( sizeof( "ElementDataFile" ) ) );
+    }
+    return !m_headerBuffer.isEmpty();
+}
+
+// Single pass over the lines of the header, keys and values are views of the header
+bool SequenceFile::ParseHeader( qint64 size )
+{
+    const char * end  = m_header + size;
+    const char * line = m_header;
+    while( line < end )
+    {
+        const char * lineEnd = static_cast<const char *>( memchr( line, '\n', size_t( end - line ) ) );
+        const char * next    = lineEnd ? lineEnd + 1 : end;
+        if( !lineEnd ) lineEnd = end;
+
+        const char * equal = static_cast<const char *>( memchr( line, '=', size_t( lineEnd - line ) ) );
+        if( equal )
+        {
+            const char * keyBegin   = line;
+            const char * keyEnd     = equal;
+            const char * valueBegin = equal + 1;
+            const char * valueEnd   = lineEnd;
+            while( keyBegin < keyEnd && IsBlank( *keyBegin ) ) ++keyBegin;
+            while( keyEnd > keyBegin && IsBlank( keyEnd[-1] ) ) --keyEnd;
+            while( valueBegin < valueEnd && IsBlank( *valueBegin ) ) ++valueBegin;
+            while( valueEnd > valueBegin && IsBlank( valueEnd[-1] ) ) --valueEnd;
+
+            QByteArray key = QByteArray::fromRawData( keyBegin, int( keyEnd - keyBegin ) );
+            if( !ParseField( key, valueBegin - m_header, int( valueEnd - valueBegin ) ) ) return false;
+            if( key == "ElementDataFile" )
+            {
+                m_headerSize = next - m_header;
+                return true;
+            }
+        }
+        line = next;
+    }
+    return false;
+}
+
+bool SequenceFile::ParseField( const QByteArray & key, qint64 valueOffset, int valueLength )
+{
+    if( key.startsWith( FramePrefix ) ) return ParseFrameField( key, valueOffset, valueLength );
+
+    QByteArray value = QByteArray::fromRawData( m_header + valueOffset, valueLength );
+    if( key == "ObjectType" )
+        return value == "Image";
+    else if( key == "ElementType" )
+        return value == "MET_UCHAR";
+    else if( key == "ElementNumberOfChannels" )
+        m_numberOfComponents = value.toInt();
+    else if( key == "CompressedData" )
+        m_compressed = value.toLower() != "false";
+    else if( key == "CompressedDataSize" )
+        m_compressedDataSize = value.toLongLong();
+    else if( key == "DimSize" )
+    {
+        double dims[3];
+        if( ParseNumbers( value, dims, 3 ) != 3 ) return false;
+        if( dims[2] < 0 || dims[2] > MaxNumberOfFrames ) return false;
+        for( int i = 0; i < 3; ++i ) m_dimensions[i] = int( dims[i] );
+    }
+    else if( key == "ElementSpacing" )
+    {
+        double spacing[3];
+        if( ParseNumbers( value, spacing, 3 ) < 2 ) return false;
+        m_spacing[0] = spacing[0];
+        m_spacing[1] = spacing[1];
+    }
+    else if( key == "UltrasoundImageOrientation" )
+    {
+        m_flippedAxes[0] = value.contains( 'U' );
+        m_flippedAxes[1] = value.contains( 'N' );
+    }
+    else if( key == "CalibrationTransform" )
+        m_calibrationFound = ParseNumbers( value, m_calibrationMatrix, 16 ) == 16;
+    else if( key == "TimestampBaseline" )
+        m_timestampBaseline = value.toDouble();
+    else if( key == "ElementDataFile" )
+    {
+        m_localData    = value == "LOCAL";
+        m_dataFileName = m_localData ? QString() : QString::fromUtf8( value );
+    }
+    return true;
+}
+
+// key is Seq_Frame<frame number>_<field>
+bool SequenceFile::ParseFrameField( const QByteArray & key, qint64 valueOffset, int valueLength )
+{
+    const char * p      = key.constData() + sizeof( FramePrefix ) - 1;
+    const char * end    = key.constData() + key.size();
+    const char * digits = p;
+    qint64 frame        = 0;
+    while( p < end && *p >= '0' && *p <= '9' && frame < MaxNumberOfFrames ) frame = frame * 10 + ( *p++ - '0' );
+    if( p == digits || p == end || *p != '_' ) return false;
+    // Frame numbers must be below DimSize when it is known, sequences are written with DimSize before the frames
+    if( frame >= ( m_dimensions[2] > 0 ? m_dimensions[2] : MaxNumberOfFrames ) ) return false;
+    ++p;
+
+    QByteArray name                            = QByteArray::fromRawData( p, int( end - p ) );
+    QHash<QByteArray, FrameField>::iterator it = m_frameFields.find( name );
+    if( it == m_frameFields.end() )
+    {
+        it = m_frameFields.insert( QByteArray( name.constData(), name.size() ), FrameField() );
+        if( name.endsWith( "Transform" ) ) m_transformNames.append( QString::fromLatin1( name ) );
+    }
+
+    std::vector<ValueRange> & values = it->values;
+    if( size_t( frame ) >= values.size() )
+    {
+        ValueRange noValue = { -1, 0 };
+        values.resize( std::max( size_t( frame ) + 1, size_t( std::max( m_dimensions[2], 0 ) ) ), noValue );
+    }
+    if( values[frame].offset < 0 ) it->numberOfValues++;
+    values[frame].offset = valueOffset;
+    values[frame].length = valueLength;
+    return true;
+}
+
+QByteArray SequenceFile::GetValue( const ValueRange & range )
+{
+    return QByteArray::fromRawData( m_header + range.offset, range.length );
+}
+
+// The field must have a value for each frame and no more
+const SequenceFile::FrameField * SequenceFile::GetFrameField( QString field )
+{
+    QHash<QByteArray, FrameField>::const_iterator it = m_frameFields.constFind( field.toLatin1() );
+    if( it == m_frameFields.constEnd() ) return nullptr;
+    if( it->numberOfValues != m_dimensions[2] || it->values.size() != size_t( m_dimensions[2] ) ) return nullptr;
+    return &it.value();
+}
+
+bool SequenceFile::GetFrameMatrices( QString field, std::vector<double> & elements )
+{
+    const FrameField * values = GetFrameField( field );
+    if( !values ) return false;
+    elements.resize( values->values.size() * 16 );
+    for( size_t i = 0; i < values->values.size(); ++i )
+    {
+        if( ParseNumbers( GetValue( values->values[i] ), &elements[i * 16], 16 ) != 16 ) return false;
+    }
+    return true;
+}
+
+bool SequenceFile::GetFrameValues( QString field, std::vector<double> & values )
+{
+    const FrameField * frameValues = GetFrameField( field );
+    if( !frameValues ) return false;
+    values.resize( frameValues->values.size() );
+    for( size_t i = 0; i < values.size(); ++i )
+    {
+        bool ok   = false;
+        values[i] = GetValue( frameValues->values[i] ).toDouble( &ok );
+        if( !ok ) return false;
+    }
+    return true;
+}
+
+bool SequenceFile::GetFrameStatuses( QString field, std::vector<char> & ok )
+{
+    const FrameField * values = GetFrameField( field );
+    if( !values ) return false;
+    ok.resize( values->values.size() );
+    for( size_t i = 0; i < ok.size(); ++i ) ok[i] = GetValue( values->values[i] ) == "OK";
+    return true;
+}
+
+bool SequenceFile::CanUseFramesInPlace()
+{
+    return m_localData && !m_compressed && !m_flippedAxes[0] && !m_flippedAxes[1] &&
+           m_headerSize + GetFrameSize() * GetNumberOfFrames() <= m_file.size();
+}
+
+bool SequenceFile::ReadFrames( std::vector<unsigned char> & frames )
+{
+    // Frames follow the header or are in a file next to it
+    QFile dataFile;
+    QFile & file      = m_localData ? m_file : dataFile;
+    qint64 dataOffset = m_localData ? m_headerSize : 0;
+    if( !m_localData )
+    {
+        if( m_dataFileName.isEmpty() ) return false;
+        dataFile.setFileName( QFileInfo( m_file.fileName() ).dir().filePath( m_dataFileName ) );
+        if( !dataFile.open( QIODevice::ReadOnly ) ) return false;
+    }
+
+    qint64 framesSize = GetFrameSize() * GetNumberOfFrames();
+    qint64 dataSize   = framesSize;
+    if( m_compressed ) dataSize = m_compressedDataSize > 0 ? m_compressedDataSize : file.size() - dataOffset;
+    if( dataSize <= 0 || dataOffset + dataSize > file.size() ) return false;
+    frames.resize( size_t( framesSize ) );
+
+    // Mapped data is used in place, compressed data is read in a separate buffer and frames directly
+    std::vector<unsigned char> compressedData;
+    const unsigned char * data = m_map && m_localData ? m_map + m_headerSize : nullptr;
+    if( !data )
+    {
+        unsigned char * buffer = frames.data();
+        if( m_compressed )
+        {
+            compressedData.resize( size_t( dataSize ) );
+            buffer = compressedData.data();
+        }
+        if( !file.seek( dataOffset ) || file.read( reinterpret_cast<char *>( buffer ), dataSize ) != dataSize )
+            return false;
+        data = buffer;
+    }
+
+    if( m_compressed )
+    {
+        if( !Inflate( data, dataSize, frames.data(), framesSize ) ) return false;
+    }
+    else if( data != frames.data() )
+        memcpy( frames.data(), data, size_t( framesSize ) );
+
+    if( m_flippedAxes[0] || m_flippedAxes[1] ) FlipFrames( frames.data() );
+    return true;
+}
+
+// uncompress() takes the sizes as uLong, which has 32 bits on Windows. The sizes of a stream are uInt, the data is
+// inflated in pieces of at most 4 GB.
+bool SequenceFile::Inflate( const unsigned char * data, qint64 dataSize, unsigned char * frames, qint64 framesSize )
+{
+    const qint64 maxPieceSize = std::numeric_limits<uInt>::max();
+    z_stream stream;
+    memset( &stream, 0, sizeof( stream ) );
+    if( inflateInit( &stream ) != Z_OK ) return false;
+
+    qint64 dataRead     = 0;
+    qint64 framesOffset = 0;
+    int status          = Z_OK;
+    while( status == Z_OK )
+    {
+        if( stream.avail_in == 0 && dataRead < dataSize )
+        {
+            stream.next_in  = const_cast<Bytef *>( data + dataRead );
+            stream.avail_in = uInt( std::min( dataSize - dataRead, maxPieceSize ) );
+            dataRead += stream.avail_in;
+        }
+        if( stream.avail_out == 0 && framesOffset < framesSize )
+        {
+            stream.next_out  = frames + framesOffset;
+            stream.avail_out = uInt( std::min( framesSize - framesOffset, maxPieceSize ) );
+            framesOffset += stream.avail_out;
+        }
+        status = inflate( &stream, Z_NO_FLUSH );
+    }
+    // The frames must be filled exactly
+    bool ok = status == Z_STREAM_END && stream.avail_out == 0 && framesOffset == framesSize;
+    inflateEnd( &stream );
+    return ok;
+}
+
+void SequenceFile::FlipFrames( unsigned char * frames )
+{
+    int nbFrames     = GetNumberOfFrames();
+    size_t frameSize = size_t( GetFrameSize() );
+    std::atomic<int> nextFrame( 0 );
+    auto flipFrames = [this, frames, frameSize, nbFrames, &nextFrame]() {
+        for( int i = nextFrame++; i < nbFrames; i = nextFrame++ ) FlipFrame( frames + i * frameSize );
+    };
+
+    QThreadPool threads;
+    int nbThreads = std::min( threads.maxThreadCount(), nbFrames );
+    for( int t = 0; t < nbThreads; ++t ) threads.start( flipFrames );
+    threads.waitForDone();
+}
+
+void SequenceFile::FlipFrame( unsigned char * frame )
+{
+    int width        = m_dimensions[0];
+    int height       = m_dimensions[1];
+    size_t pixelSize = size_t( m_numberOfComponents );
+    size_t rowSize   = pixelSize * width;
+    if( m_flippedAxes[1] )
+    {
+        for( int y = 0; y < height / 2; ++y )
+            std::swap_ranges( frame + y * rowSize, frame + ( y + 1 ) * rowSize, frame + ( height - 1 - y ) * rowSize );
+    }
+    if( m_flippedAxes[0] )
+    {
+        for( int y = 0; y < height; ++y )
+        {
+            unsigned char * row = frame + y * rowSize;
+            for( int x = 0; x < width / 2; ++x )
+                std::swap_ranges( row + x * pixelSize, row + ( x + 1 ) * pixelSize,
+                                  row + ( width - 1 - x ) * pixelSize );
+        }
+    }
+}
+
+bool SequenceFile::Create( QString filename )
+{
+    Close();
+    m_saveFile.setFileName( filename );
+    m_writeOk = m_saveFile.open( QIODevice::WriteOnly );
+    m_writeBuffer.reserve( WriteBufferSize );
+    return m_writeOk;
+}
+
+void SequenceFile::WriteField( const char * name, const QByteArray & value )
+{
+    m_writeBuffer.append( name );
+    m_writeBuffer.append( " = " );
+    m_writeBuffer.append( value );
+    m_writeBuffer.append( '\n' );
+    if( m_writeBuffer.size() >= WriteBufferSize ) Flush();
+}
+
+void SequenceFile::WriteField( const char * name, const double mat[16] )
+{
+    m_writeBuffer.append( name );
+    m_writeBuffer.append( " = " );
+    AppendMatrix( mat );
+    m_writeBuffer.append( '\n' );
+    if( m_writeBuffer.size() >= WriteBufferSize ) Flush();
+}
+
+void SequenceFile::BeginFrame( int frame )
+{
+    m_framePrefixLength = snprintf( m_framePrefix, sizeof( m_framePrefix ), "%s%010d_", FramePrefix, frame );
+}
+
+void SequenceFile::WriteFrameField( const char * field, const QByteArray & value )
+{
+    m_writeBuffer.append( m_framePrefix, m_framePrefixLength );
+    WriteField( field, value );
+}
+
+void SequenceFile::WriteFrameField( const char * field, const double mat[16] )
+{
+    m_writeBuffer.append( m_framePrefix, m_framePrefixLength );
+    WriteField( field, mat );
+}
+
+void SequenceFile::WriteData( const void * data, qint64 size )
+{
+    Flush();
+    if( m_writeOk ) m_writeOk = m_saveFile.write( static_cast<const char *>( data ), size ) == size;
+}
+
+bool SequenceFile::Finish()
+{
+    if( !m_saveFile.isOpen() ) return false;
+    Flush();
+    if( !m_writeOk ) m_saveFile.cancelWriting();
+    // commit() closes the output and only replaces the file if writing was not cancelled
+    m_writeOk = m_saveFile.commit();
+    return m_writeOk;
+}
+
+void SequenceFile::Cancel()
+{
+    if( !m_saveFile.isOpen() ) return;
+    m_saveFile.cancelWriting();
+    m_saveFile.commit();
+    m_writeBuffer.resize( 0 );
+    m_writeOk = false;
+}
+
+QByteArray SequenceFile::FormatNumber( double value )
+{
+    return QByteArray::number( value, 'g', QLocale::FloatingPointShortest );
+}
+
+void SequenceFile::AppendMatrix( const double mat[16] )
+{
+    for( int i = 0; i < 16; ++i )
+    {
+        if( i > 0 ) m_writeBuffer.append( ' ' );
+        m_writeBuffer.append( FormatNumber( mat[i] ) );
+    }
+}
+
+void SequenceFile::Flush()
+{
+    if( m_writeOk && !m_writeBuffer.isEmpty() )
+        m_writeOk = m_saveFile.write( m_writeBuffer ) == qint64( m_writeBuffer.size() );
+    // keep the capacity of the buffer
+    m_writeBuffer.resize( 0 );
+}
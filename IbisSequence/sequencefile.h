@@ -0,0 +1,153 @@
+/*=========================================================================
+Ibis Neuronav
+Copyright (c) Simon Drouin, Anna Kochanowska, Louis Collins.
+All rights reserved.
+See Copyright.txt or http://ibisneuronav.org/Copyright.html for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notice for more information.
+=========================================================================*/
+#ifndef SEQUENCEFILE_H
+#define SEQUENCEFILE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QString>
+#include <QStringList>
+#include <vector>
+
+class vtkMatrix4x4;
+
+// Reader and writer of tracked ultrasound sequences (.igs.mha). These are MetaImage files with 8 bit frames whose
+// header also has the fields of every frame: Seq_Frame<frame number>_<field> = <value>.
+//
+// Open() maps the file in memory, or reads its header if the file can't be mapped, and tokenizes the header in a
+// single pass. Values are neither copied nor converted: the position of each frame value is kept and the values of a
+// field are parsed when they are requested, so only the fields that are used, e.g. the probe transform, are converted.
+//
+// Frames follow the header (ElementDataFile = LOCAL) or are in a file next to it. When they follow the header
+// uncompressed and don't need to be flipped, they can be used where they are in the file, see GetFrameOffset().
+// Otherwise, ReadFrames() reads and uncompresses them and flips them in parallel.
+//
+// Writing: Create(), the header fields, the fields of each frame after BeginFrame(), ElementDataFile and the frames,
+// then Finish(). Output is buffered and the key prefix of the frame fields is formatted once per frame. The output goes
+// to a temporary file that only replaces the file in Finish(), so frames mapped from the previous file, e.g. when an
+// acquisition is exported to the file it was read from, stay valid.
+class SequenceFile
+{
+public:
+    // Frame fields are indexed by frame number, files with more frames are rejected to bound the memory used by a
+    // corrupted header
+    static const int MaxNumberOfFrames = 1 << 22;
+
+    SequenceFile();
+    ~SequenceFile();
+
+    bool Open( QString filename );
+    void Close();
+    bool IsOpen() { return m_file.isOpen(); }
+    QString GetFileName() { return m_file.fileName(); }
+
+    // Header
+    int GetFrameWidth() { return m_dimensions[0]; }
+    int GetFrameHeight() { return m_dimensions[1]; }
+    int GetNumberOfFrames() { return m_dimensions[2]; }
+    int GetNumberOfComponents() { return m_numberOfComponents; }
+    qint64 GetFrameSize();
+    // mm, 1 if the header has no ElementSpacing
+    double GetFrameSpacing( int axis ) { return m_spacing[axis]; }
+    bool IsCompressed() { return m_compressed; }
+    // Axes flipped by UltrasoundImageOrientation, U for axis 0 and N for axis 1
+    bool IsAxisFlipped( int axis ) { return m_flippedAxes[axis]; }
+    bool HasCalibrationMatrix() { return m_calibrationFound; }
+    void GetCalibrationMatrix( vtkMatrix4x4 * mat );
+    double GetTimestampBaseline() { return m_timestampBaseline; }
+    // Frame fields that end with Transform, in the order they first appear
+    QStringList GetTransformNames() { return m_transformNames; }
+
+    // Values of a frame field, for all the frames. They return false if a frame doesn't have the field or if a value
+    // can't be parsed.
+    bool GetFrameMatrices( QString field, std::vector<double> & elements );  // 16 elements per frame, row major
+    bool GetFrameValues( QString field, std::vector<double> & values );
+    // Whether the value is OK, e.g. for ImageStatus or <transform>Status
+    bool GetFrameStatuses( QString field, std::vector<char> & ok );
+
+    // Frames can be used in place if they are stored uncompressed in this file and don't need to be flipped
+    bool CanUseFramesInPlace();
+    qint64 GetFrameOffset( int frame ) { return m_headerSize + frame * GetFrameSize(); }
+    // All the frames, uncompressed and flipped as given by UltrasoundImageOrientation
+    bool ReadFrames( std::vector<unsigned char> & frames );
+
+    // Writing
+    bool Create( QString filename );
+    void WriteField( const char * name, const QByteArray & value );
+    void WriteField( const char * name, const double mat[16] );
+    void BeginFrame( int frame );
+    void WriteFrameField( const char * field, const QByteArray & value );
+    void WriteFrameField( const char * field, const double mat[16] );
+    void WriteData( const void * data, qint64 size );
+    // Flush the output and replace the file, return false if anything could not be written
+    bool Finish();
+    // Discard the output, the file is left as it was
+    void Cancel();
+
+    // Locale independent, shortest representation that reads back to the same value
+    static QByteArray FormatNumber( double value );
+
+private:
+    // Position of a value in the header, offset is -1 if the frame has no value
+    struct ValueRange
+    {
+        qint64 offset;
+        int length;
+    };
+    struct FrameField
+    {
+        FrameField() : numberOfValues( 0 ) {}
+        std::vector<ValueRange> values;  // indexed by frame number
+        int numberOfValues;
+    };
+
+    bool ReadHeader();
+    bool ParseHeader( qint64 size );
+    bool ParseField( const QByteArray & key, qint64 valueOffset, int valueLength );
+    bool ParseFrameField( const QByteArray & key, qint64 valueOffset, int valueLength );
+    QByteArray GetValue( const ValueRange & range );
+    const FrameField * GetFrameField( QString field );
+    static bool Inflate( const unsigned char * data, qint64 dataSize, unsigned char * frames, qint64 framesSize );
+    void FlipFrames( unsigned char * frames );
+    void FlipFrame( unsigned char * frame );
+    void AppendMatrix( const double mat[16] );
+    void Flush();
+
+    QFile m_file;
+    uchar * m_map;
+    QByteArray m_headerBuffer;  // header, when the file is not mapped
+    const char * m_header;
+    qint64 m_headerSize;  // offset of the frames
+
+    int m_dimensions[3];
+    int m_numberOfComponents;
+    double m_spacing[2];
+    bool m_compressed;
+    qint64 m_compressedDataSize;
+    bool m_flippedAxes[2];
+    double m_calibrationMatrix[16];
+    bool m_calibrationFound;
+    double m_timestampBaseline;
+    bool m_localData;
+    QString m_dataFileName;  // ElementDataFile, relative to the header
+    QStringList m_transformNames;
+    QHash<QByteArray, FrameField> m_frameFields;
+
+    QSaveFile m_saveFile;
+    QByteArray m_writeBuffer;
+    char m_framePrefix[32];  // Seq_Frame<frame number>_
+    int m_framePrefixLength;
+    bool m_writeOk;
+};
+
+#endif